@@ -637,7 +637,8 @@ static void kvm_dirty_ring_mark_page(KVMState *s, uint32_t as_id,
         return;
     }
 
-    set_bit(offset, mem->dirty_bmap);
+    /* Rings of different vcpus can be reaped in parallel */
+    set_bit_atomic(offset, mem->dirty_bmap);
 }
 
 static bool dirty_gfn_is_dirtied(struct kvm_dirty_gfn *gfn)
@@ -710,6 +711,51 @@ static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
     return count;
 }
 
+typedef struct KVMDirtyRingReapAll {
+    KVMState *s;
+    GPtrArray *cpus;
+    uint32_t *count;
+} KVMDirtyRingReapAll;
+
+static void kvm_dirty_ring_reap_job(void *opaque, unsigned int i)
+{
+    KVMDirtyRingReapAll *all = opaque;
+
+    all->count[i] = kvm_dirty_ring_reap_one(all->s,
+                                            g_ptr_array_index(all->cpus, i));
+}
+
+/* Must be with slots_lock held */
+static uint64_t kvm_dirty_ring_reap_all_locked(KVMState *s)
+{
+    KVMDirtyRingReapAll all = { .s = s };
+    uint64_t total = 0;
+    CPUState *cpu;
+
+    if (!s->reaper.reap_threads) {
+        CPU_FOREACH(cpu) {
+            total += kvm_dirty_ring_reap_one(s, cpu);
+        }
+        return total;
+    }
+
+    all.cpus = g_ptr_array_new();
+    CPU_FOREACH(cpu) {
+        g_ptr_array_add(all.cpus, cpu);
+    }
+    all.count = g_new(uint32_t, all.cpus->len);
+
+    qemu_parallel_run(s->reaper.reap_threads, all.cpus->len,
+                      kvm_dirty_ring_reap_job, &all);
+
+    for (unsigned int i = 0; i < all.cpus->len; i++) {
+        total += all.count[i];
+    }
+    g_free(all.count);
+    g_ptr_array_free(all.cpus, true);
+    return total;
+}
+
 /* Must be with slots_lock held */
 static uint64_t kvm_dirty_ring_reap_locked(KVMState *s, CPUState* cpu)
 {
@@ -722,9 +768,7 @@ static uint64_t kvm_dirty_ring_reap_locked(KVMState *s, CPUState* cpu)
     if (cpu) {
         total = kvm_dirty_ring_reap_one(s, cpu);
     } else {
-        CPU_FOREACH(cpu) {
-            total += kvm_dirty_ring_reap_one(s, cpu);
-        }
+        total = kvm_dirty_ring_reap_all_locked(s);
     }
 
     if (total) {
@@ -1415,13 +1459,28 @@ static void *kvm_dirty_ring_reaper_thread(void *data)
     return NULL;
 }
 
-static void kvm_dirty_ring_reaper_init(KVMState *s)
+/*
+ * Reaping all the rings is done with the BQL held, and stalls the vcpus
+ * that need it.  Share the work among more threads on large guests.
+ */
+#define KVM_DIRTY_RING_REAP_VCPUS_PER_THREAD  16
+#define KVM_DIRTY_RING_REAP_THREADS_MAX       8
+
+static void kvm_dirty_ring_reaper_init(KVMState *s, unsigned int nr_vcpus)
 {
     struct KVMDirtyRingReaper *r = &s->reaper;
+    unsigned int nr_threads;
 
     qemu_thread_create(&r->reaper_thr, "kvm-reaper",
                        kvm_dirty_ring_reaper_thread,
                        s, QEMU_THREAD_JOINABLE);
+
+    /* The thread that asks for the rings to be reaped takes a share */
+    nr_threads = MIN(nr_vcpus / KVM_DIRTY_RING_REAP_VCPUS_PER_THREAD,
+                     KVM_DIRTY_RING_REAP_THREADS_MAX);
+    if (nr_threads > 1) {
+        r->reap_threads = qemu_parallel_new("kvm-reap", nr_threads - 1);
+    }
 }
 
 static int kvm_dirty_ring_init(KVMState *s)
@@ -2592,7 +2651,7 @@ static int kvm_init(MachineState *ms)
     }
 
     if (s->kvm_dirty_ring_size) {
-        kvm_dirty_ring_reaper_init(s);
+        kvm_dirty_ring_reaper_init(s, ms->smp.max_cpus);
     }
 
     if (kvm_check_extension(kvm_state, KVM_CAP_BINARY_STATS_FD)) {
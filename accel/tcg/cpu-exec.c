@@ -404,7 +404,7 @@ const void *HELPER(lookup_tb_ptr)(CPUArchState *env)
     }
 
     tb = tb_lookup(cpu, pc, cs_base, flags, cflags);
-    if (tb == NULL) {
+    if (tb == NULL || qatomic_read(&tb->warmup)) {
         return tcg_code_gen_epilogue;
     }
 
@@ -516,6 +516,10 @@ static void cpu_exec_longjmp_cleanup(CPUState *cpu)
     /* Non-buggy compilers preserve this; assert the correct value. */
     g_assert(cpu == current_cpu);
 
+    if (cpu->exception_index >= 0) {
+        cpu->tcg_exits[TCG_EXIT_CAUSE_EXCEPTION]++;
+    }
+
 #ifdef CONFIG_USER_ONLY
     clear_helper_retaddr();
     if (have_mmap_lock()) {
@@ -541,6 +545,8 @@ static void cpu_exec_longjmp_cleanup(CPUState *cpu)
         tb_unlock_pages(tcg_ctx->gen_tb);
         tcg_ctx->gen_tb = NULL;
     }
+    /* An I/O access left mid-TB, cpu_restore_state() fixed the budget */
+    cpu->icount_io_pending = 0;
 #endif
     if (bql_locked()) {
         bql_unlock();
@@ -564,6 +570,8 @@ void cpu_exec_step_atomic(CPUState *cpu)
         cpu->running = true;
 
         cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
+        cpu->tcg_atomic_steps++;
+        trace_exec_step_atomic(cpu->cpu_index, pc);
 
         cflags = curr_cflags(cpu);
         /* Execute in a serial context. */
@@ -841,6 +849,7 @@ static inline bool cpu_handle_interrupt(CPUState *cpu,
 
             if (tcg_ops->cpu_exec_interrupt &&
                 tcg_ops->cpu_exec_interrupt(cpu, interrupt_request)) {
+                cpu->tcg_exits[TCG_EXIT_CAUSE_INTERRUPT]++;
                 if (!tcg_ops->need_replay_interrupt ||
                     tcg_ops->need_replay_interrupt(interrupt_request)) {
                     replay_interrupt();
@@ -877,6 +886,7 @@ static inline bool cpu_handle_interrupt(CPUState *cpu,
     /* Finally, check if we need to exit to the main loop.  */
     if (unlikely(qatomic_read(&cpu->exit_request)) || icount_exit_request(cpu)) {
         qatomic_set(&cpu->exit_request, 0);
+        cpu->tcg_exits[TCG_EXIT_CAUSE_REQUEST]++;
         if (cpu->exception_index == -1) {
             cpu->exception_index = EXCP_INTERRUPT;
         }
@@ -935,6 +945,33 @@ static inline void cpu_loop_exec_tb(CPUState *cpu, TranslationBlock *tb,
 #endif
 }
 
+/*
+ * Count one execution of @tb if it is still warming up, and replace it
+ * with an optimized translation after the last one.
+ */
+static TranslationBlock *tb_warmup_exec(CPUState *cpu, TranslationBlock *tb,
+                                        vaddr pc)
+{
+    uint32_t n = qatomic_read(&tb->warmup);
+    CPUJumpCache *jc;
+    uint32_t h;
+
+    /* Lost updates only delay the optimization, which is harmless. */
+    if (n == 0 || qatomic_cmpxchg(&tb->warmup, n, n - 1) != n || n > 1) {
+        return tb;
+    }
+
+    mmap_lock();
+    tb = tb_optimize(cpu, tb, pc);
+    mmap_unlock();
+
+    h = tb_jmp_cache_hash_func(pc);
+    jc = cpu->tb_jmp_cache;
+    jc->array[h].pc = pc;
+    qatomic_set(&jc->array[h].tb, tb);
+    return tb;
+}
+
 /* main execution loop */
 
 static int __attribute__((noinline))
@@ -974,10 +1011,17 @@ cpu_exec_loop(CPUState *cpu, SyncClocks *sc)
             }
 
             tb = tb_lookup(cpu, pc, cs_base, flags, cflags);
+#ifndef CONFIG_USER_ONLY
+            if (tb == NULL && unlikely(qatomic_read(&tb_cache_pending))) {
+                tb_cache_preload(cpu);
+                tb = tb_lookup(cpu, pc, cs_base, flags, cflags);
+            }
+#endif
             if (tb == NULL) {
                 CPUJumpCache *jc;
                 uint32_t h;
 
+                cpu->tcg_exits[TCG_EXIT_CAUSE_TB_MISS]++;
                 mmap_lock();
                 tb = tb_gen_code(cpu, pc, cs_base, flags, cflags);
                 mmap_unlock();
@@ -992,6 +1036,13 @@ cpu_exec_loop(CPUState *cpu, SyncClocks *sc)
                 qatomic_set(&jc->array[h].tb, tb);
             }
 
+            if (unlikely(qatomic_read(&tb->warmup))) {
+                tb = tb_warmup_exec(cpu, tb, pc);
+                last_tb = NULL;
+            } else if (last_tb && qatomic_read(&last_tb->warmup)) {
+                last_tb = NULL;
+            }
+
 #ifndef CONFIG_USER_ONLY
             /*
              * We don't take care of direct jumps when address mapping
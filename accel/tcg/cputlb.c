@@ -34,6 +34,7 @@
 #include "qemu/atomic.h"
 #include "qemu/atomic128.h"
 #include "exec/translate-all.h"
+#include "sysemu/cpu-timers.h"
 #include "trace.h"
 #include "tb-hash.h"
 #include "internal-common.h"
@@ -95,6 +96,36 @@ static inline size_t sizeof_tlb(CPUTLBDescFast *fast)
     return fast->mask + (1 << CPU_TLB_ENTRY_BITS);
 }
 
+/*
+ * Geometry of the victim tlb, and lower bound of the dynamic sizing of
+ * the fast tlb.  These are set by tlb_set_geometry() before any cpu is
+ * created.  The victim tlb is made of vtlb_size / vtlb_ways sets, indexed
+ * by the low bits of the page number.
+ */
+static unsigned vtlb_size = CPU_VTLB_SIZE;
+static unsigned vtlb_ways = CPU_VTLB_SIZE;
+static unsigned tlb_dyn_min_bits = CPU_TLB_DYN_MIN_BITS;
+
+void tlb_set_geometry(unsigned victim_size, unsigned victim_ways,
+                      unsigned min_bits)
+{
+    assert(is_power_of_2(victim_size) && victim_size <= CPU_VTLB_MAX_SIZE);
+    assert(is_power_of_2(victim_ways) && victim_ways <= victim_size);
+
+    vtlb_size = victim_size;
+    vtlb_ways = victim_ways;
+    tlb_dyn_min_bits = MIN(MAX(min_bits, CPU_TLB_DYN_MIN_BITS),
+                           CPU_TLB_DYN_MAX_BITS);
+}
+
+/* Return the first entry of the victim tlb set that may hold @page. */
+static inline size_t vtlb_set_index(vaddr page)
+{
+    size_t n_sets = vtlb_size / vtlb_ways;
+
+    return ((page >> TARGET_PAGE_BITS) & (n_sets - 1)) * vtlb_ways;
+}
+
 static void tlb_window_reset(CPUTLBDesc *desc, int64_t ns,
                              size_t max_entries)
 {
@@ -191,7 +222,7 @@ static void tlb_mmu_resize_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast,
         if (expected_rate > 70) {
             ceil *= 2;
         }
-        new_size = MAX(ceil, 1 << CPU_TLB_DYN_MIN_BITS);
+        new_size = MAX(ceil, 1 << tlb_dyn_min_bits);
     }
 
     if (new_size == old_size) {
@@ -239,7 +270,7 @@ static void tlb_mmu_flush_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast)
     desc->large_page_mask = -1;
     desc->vindex = 0;
     memset(fast->table, -1, sizeof_tlb(fast));
-    memset(desc->vtable, -1, sizeof(desc->vtable));
+    memset(desc->vtable, -1, vtlb_size * sizeof(CPUTLBEntry));
 }
 
 static void tlb_flush_one_mmuidx_locked(CPUState *cpu, int mmu_idx,
@@ -254,13 +285,15 @@ static void tlb_flush_one_mmuidx_locked(CPUState *cpu, int mmu_idx,
 
 static void tlb_mmu_init(CPUTLBDesc *desc, CPUTLBDescFast *fast, int64_t now)
 {
-    size_t n_entries = 1 << CPU_TLB_DYN_DEFAULT_BITS;
+    size_t n_entries = 1 << MAX(CPU_TLB_DYN_DEFAULT_BITS, tlb_dyn_min_bits);
 
     tlb_window_reset(desc, now, 0);
     desc->n_used_entries = 0;
     fast->mask = (n_entries - 1) << CPU_TLB_ENTRY_BITS;
     fast->table = g_new(CPUTLBEntry, n_entries);
     desc->fulltlb = g_new(CPUTLBEntryFull, n_entries);
+    desc->vtable = g_new(CPUTLBEntry, vtlb_size);
+    desc->vfulltlb = g_new(CPUTLBEntryFull, vtlb_size);
     tlb_mmu_flush_locked(desc, fast);
 }
 
@@ -280,6 +313,7 @@ void tlb_init(CPUState *cpu)
     int i;
 
     qemu_spin_init(&cpu->neg.tlb.c.lock);
+    qemu_event_init(&cpu->neg.tlb.c.shootdown_event, false);
 
     /* All tlbs are initialized flushed. */
     cpu->neg.tlb.c.dirty = 0;
@@ -294,12 +328,15 @@ void tlb_destroy(CPUState *cpu)
     int i;
 
     qemu_spin_destroy(&cpu->neg.tlb.c.lock);
+    qemu_event_destroy(&cpu->neg.tlb.c.shootdown_event);
     for (i = 0; i < NB_MMU_MODES; i++) {
         CPUTLBDesc *desc = &cpu->neg.tlb.d[i];
         CPUTLBDescFast *fast = &cpu->neg.tlb.f[i];
 
         g_free(fast->table);
         g_free(desc->fulltlb);
+        g_free(desc->vtable);
+        g_free(desc->vfulltlb);
     }
 }
 
@@ -322,6 +359,133 @@ static void flush_all_helper(CPUState *src, run_on_cpu_func fn,
     }
 }
 
+/*
+ * TLB shootdowns for the _synced operations
+ *
+ * The flush for each destination vCPU is pushed onto its shootdown list
+ * and the source vCPU counts it as pending.  Only the push onto an empty
+ * list queues work on the destination, so that a burst of flushes from
+ * one or more vCPUs costs the destination a single exit from cpu_exec(),
+ * at its next TB boundary, where it runs all of them.  The source does
+ * its own flush immediately and then, instead of waiting for an exclusive
+ * section that stops every vCPU, waits before its next TB until the
+ * flushes it queued are done.  While it waits it drains its own list,
+ * so that two vCPUs shooting down each other do not deadlock.
+ *
+ * All of this needs a thread per vCPU; with round-robin TCG the flushes
+ * are left to an exclusive section as before.
+ */
+typedef struct TLBShootdown {
+    QSLIST_ENTRY(TLBShootdown) next;
+    CPUState *src;
+    run_on_cpu_func fn;
+    run_on_cpu_data data;
+} TLBShootdown;
+
+static void tlb_shootdown_drain(CPUState *cpu)
+{
+    QSLIST_HEAD(, TLBShootdown) list;
+    TLBShootdown *s, *tmp;
+
+    QSLIST_MOVE_ATOMIC(&list, &cpu->neg.tlb.c.shootdown);
+    QSLIST_FOREACH_SAFE(s, &list, next, tmp) {
+        CPUTLBCommon *src_c = &s->src->neg.tlb.c;
+
+        s->fn(cpu, s->data);
+        if (qatomic_fetch_dec(&src_c->shootdown_pending) == 1) {
+            qemu_event_set(&src_c->shootdown_event);
+        }
+        g_free(s);
+    }
+}
+
+static void tlb_shootdown_work(CPUState *cpu, run_on_cpu_data data)
+{
+    tlb_shootdown_drain(cpu);
+}
+
+static void tlb_shootdown_wait_work(CPUState *cpu, run_on_cpu_data data)
+{
+    CPUTLBCommon *c = &cpu->neg.tlb.c;
+    bool locked = bql_locked();
+
+    /* The destinations may need the BQL to reach their next TB. */
+    if (locked) {
+        bql_unlock();
+    }
+    for (;;) {
+        qemu_event_reset(&c->shootdown_event);
+        tlb_shootdown_drain(cpu);
+        if (!qatomic_read(&c->shootdown_pending)) {
+            break;
+        }
+        qemu_event_wait(&c->shootdown_event);
+    }
+    if (locked) {
+        bql_lock();
+    }
+}
+
+static void tlb_shootdown(CPUState *src, CPUState *dst, run_on_cpu_func fn,
+                          run_on_cpu_data d)
+{
+    CPUTLBCommon *c = &dst->neg.tlb.c;
+    TLBShootdown *s, *old;
+
+    if (!qemu_tcg_mttcg_enabled()) {
+        async_run_on_cpu(dst, fn, d);
+        return;
+    }
+
+    s = g_new(TLBShootdown, 1);
+    s->src = src;
+    s->fn = fn;
+    s->data = d;
+    qatomic_inc(&src->neg.tlb.c.shootdown_pending);
+
+    do {
+        old = qatomic_read(&c->shootdown.slh_first);
+        s->next.sle_next = old;
+    } while (qatomic_cmpxchg(&c->shootdown.slh_first, old, s) != old);
+
+    if (!old) {
+        async_run_on_cpu(dst, tlb_shootdown_work, RUN_ON_CPU_NULL);
+    }
+    /* In case dst is itself waiting for its own shootdowns. */
+    qemu_event_set(&c->shootdown_event);
+}
+
+/*
+ * Complete a _synced operation after tlb_shootdown() has been called for
+ * all the other vCPUs, by running fn on src itself.
+ */
+static void tlb_shootdown_finish(CPUState *src, run_on_cpu_func fn,
+                                 run_on_cpu_data d)
+{
+    if (!qemu_tcg_mttcg_enabled()) {
+        async_safe_run_on_cpu(src, fn, d);
+        return;
+    }
+
+    fn(src, d);
+    if (qatomic_read(&src->neg.tlb.c.shootdown_pending)) {
+        async_run_on_cpu(src, tlb_shootdown_wait_work, RUN_ON_CPU_NULL);
+    }
+}
+
+static void flush_all_helper_synced(CPUState *src, run_on_cpu_func fn,
+                                    run_on_cpu_data d)
+{
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        if (cpu != src) {
+            tlb_shootdown(src, cpu, fn, d);
+        }
+    }
+    tlb_shootdown_finish(src, fn, d);
+}
+
 static void tlb_flush_by_mmuidx_async_work(CPUState *cpu, run_on_cpu_data data)
 {
     uint16_t asked = data.host_int;
@@ -400,8 +564,7 @@ void tlb_flush_by_mmuidx_all_cpus_synced(CPUState *src_cpu, uint16_t idxmap)
 
     tlb_debug("mmu_idx: 0x%"PRIx16"\n", idxmap);
 
-    flush_all_helper(src_cpu, fn, RUN_ON_CPU_HOST_INT(idxmap));
-    async_safe_run_on_cpu(src_cpu, fn, RUN_ON_CPU_HOST_INT(idxmap));
+    flush_all_helper_synced(src_cpu, fn, RUN_ON_CPU_HOST_INT(idxmap));
 }
 
 void tlb_flush_all_cpus_synced(CPUState *src_cpu)
@@ -434,6 +597,20 @@ static inline bool tlb_entry_is_empty(const CPUTLBEntry *te)
     return te->addr_read == -1 && te->addr_write == -1 && te->addr_code == -1;
 }
 
+/* Return the page mapped by the non-empty entry @te. */
+static inline vaddr tlb_entry_page(const CPUTLBEntry *te)
+{
+    uint64_t addr = te->addr_read;
+
+    if (addr == -1) {
+        addr = te->addr_write;
+    }
+    if (addr == -1) {
+        addr = te->addr_code;
+    }
+    return addr & TARGET_PAGE_MASK;
+}
+
 /* Called with tlb_c.lock held */
 static bool tlb_flush_entry_mask_locked(CPUTLBEntry *tlb_entry,
                                         vaddr page,
@@ -457,10 +634,15 @@ static void tlb_flush_vtlb_page_mask_locked(CPUState *cpu, int mmu_idx,
                                             vaddr mask)
 {
     CPUTLBDesc *d = &cpu->neg.tlb.d[mmu_idx];
-    int k;
+    size_t k, k0 = 0, n = vtlb_size;
 
     assert_cpu_is_self(cpu);
-    for (k = 0; k < CPU_VTLB_SIZE; k++) {
+    /* A partial mask may match the page in any set. */
+    if (mask == -1) {
+        k0 = vtlb_set_index(page);
+        n = vtlb_ways;
+    }
+    for (k = k0; k < k0 + n; k++) {
         if (tlb_flush_entry_mask_locked(&d->vtable[k], page, mask)) {
             tlb_n_used_entries_dec(cpu, mmu_idx);
         }
@@ -658,10 +840,8 @@ void tlb_flush_page_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
      * See tlb_flush_page_by_mmuidx for details.
      */
     if (idxmap < TARGET_PAGE_SIZE) {
-        flush_all_helper(src_cpu, tlb_flush_page_by_mmuidx_async_1,
-                         RUN_ON_CPU_TARGET_PTR(addr | idxmap));
-        async_safe_run_on_cpu(src_cpu, tlb_flush_page_by_mmuidx_async_1,
-                              RUN_ON_CPU_TARGET_PTR(addr | idxmap));
+        flush_all_helper_synced(src_cpu, tlb_flush_page_by_mmuidx_async_1,
+                                RUN_ON_CPU_TARGET_PTR(addr | idxmap));
     } else {
         CPUState *dst_cpu;
         TLBFlushPageByMMUIdxData *d;
@@ -672,16 +852,17 @@ void tlb_flush_page_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
                 d = g_new(TLBFlushPageByMMUIdxData, 1);
                 d->addr = addr;
                 d->idxmap = idxmap;
-                async_run_on_cpu(dst_cpu, tlb_flush_page_by_mmuidx_async_2,
-                                 RUN_ON_CPU_HOST_PTR(d));
+                tlb_shootdown(src_cpu, dst_cpu,
+                              tlb_flush_page_by_mmuidx_async_2,
+                              RUN_ON_CPU_HOST_PTR(d));
             }
         }
 
         d = g_new(TLBFlushPageByMMUIdxData, 1);
         d->addr = addr;
         d->idxmap = idxmap;
-        async_safe_run_on_cpu(src_cpu, tlb_flush_page_by_mmuidx_async_2,
-                              RUN_ON_CPU_HOST_PTR(d));
+        tlb_shootdown_finish(src_cpu, tlb_flush_page_by_mmuidx_async_2,
+                             RUN_ON_CPU_HOST_PTR(d));
     }
 }
 
@@ -916,14 +1097,14 @@ void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
     CPU_FOREACH(dst_cpu) {
         if (dst_cpu != src_cpu) {
             p = g_memdup(&d, sizeof(d));
-            async_run_on_cpu(dst_cpu, tlb_flush_range_by_mmuidx_async_1,
-                             RUN_ON_CPU_HOST_PTR(p));
+            tlb_shootdown(src_cpu, dst_cpu, tlb_flush_range_by_mmuidx_async_1,
+                          RUN_ON_CPU_HOST_PTR(p));
         }
     }
 
     p = g_memdup(&d, sizeof(d));
-    async_safe_run_on_cpu(src_cpu, tlb_flush_range_by_mmuidx_async_1,
-                          RUN_ON_CPU_HOST_PTR(p));
+    tlb_shootdown_finish(src_cpu, tlb_flush_range_by_mmuidx_async_1,
+                         RUN_ON_CPU_HOST_PTR(p));
 }
 
 void tlb_flush_page_bits_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
@@ -1020,7 +1201,7 @@ void tlb_reset_dirty(CPUState *cpu, ram_addr_t start1, ram_addr_t length)
                                          start1, length);
         }
 
-        for (i = 0; i < CPU_VTLB_SIZE; i++) {
+        for (i = 0; i < vtlb_size; i++) {
             tlb_reset_dirty_range_locked(&cpu->neg.tlb.d[mmu_idx].vtable[i],
                                          start1, length);
         }
@@ -1052,8 +1233,8 @@ void tlb_set_dirty(CPUState *cpu, vaddr addr)
     }
 
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
-        int k;
-        for (k = 0; k < CPU_VTLB_SIZE; k++) {
+        size_t k, k0 = vtlb_set_index(addr);
+        for (k = k0; k < k0 + vtlb_ways; k++) {
             tlb_set_dirty1_locked(&cpu->neg.tlb.d[mmu_idx].vtable[k], addr);
         }
     }
@@ -1220,7 +1401,8 @@ void tlb_set_page_full(CPUState *cpu, int mmu_idx,
      * different page; otherwise just overwrite the stale data.
      */
     if (!tlb_hit_page_anyprot(te, addr_page) && !tlb_entry_is_empty(te)) {
-        unsigned vidx = desc->vindex++ % CPU_VTLB_SIZE;
+        size_t vidx = vtlb_set_index(tlb_entry_page(te)) +
+                      desc->vindex++ % vtlb_ways;
         CPUTLBEntry *tv = &desc->vtable[vidx];
 
         /* Evict the old entry into the victim tlb.  */
@@ -1326,7 +1508,7 @@ static inline void cpu_unaligned_access(CPUState *cpu, vaddr addr,
 }
 
 static MemoryRegionSection *
-io_prepare(hwaddr *out_offset, CPUState *cpu, hwaddr xlat,
+io_prepare(hwaddr *out_offset, bool *io_sync, CPUState *cpu, hwaddr xlat,
            MemTxAttrs attrs, vaddr addr, uintptr_t retaddr)
 {
     MemoryRegionSection *section;
@@ -1335,8 +1517,13 @@ io_prepare(hwaddr *out_offset, CPUState *cpu, hwaddr xlat,
     section = iotlb_to_section(cpu, xlat, attrs);
     mr_offset = (xlat & TARGET_PAGE_MASK) + addr;
     cpu->mem_io_pc = retaddr;
+    *io_sync = false;
     if (!cpu->neg.can_do_io) {
-        cpu_io_recompile(cpu, retaddr);
+        if (!icount_iosync_tb) {
+            cpu_io_recompile(cpu, retaddr);
+        }
+        cpu_io_sync_begin(cpu, retaddr);
+        *io_sync = true;
     }
 
     *out_offset = mr_offset;
@@ -1362,27 +1549,41 @@ static void io_failed(CPUState *cpu, CPUTLBEntryFull *full, vaddr addr,
 static bool victim_tlb_hit(CPUState *cpu, size_t mmu_idx, size_t index,
                            MMUAccessType access_type, vaddr page)
 {
-    size_t vidx;
+    size_t vidx, vidx0 = vtlb_set_index(page);
 
     assert_cpu_is_self(cpu);
-    for (vidx = 0; vidx < CPU_VTLB_SIZE; ++vidx) {
+    qatomic_set(&cpu->neg.tlb.c.miss_count, cpu->neg.tlb.c.miss_count + 1);
+    for (vidx = vidx0; vidx < vidx0 + vtlb_ways; ++vidx) {
         CPUTLBEntry *vtlb = &cpu->neg.tlb.d[mmu_idx].vtable[vidx];
         uint64_t cmp = tlb_read_idx(vtlb, access_type);
 
         if (cmp == page) {
-            /* Found entry in victim tlb, swap tlb and iotlb.  */
+            /*
+             * Found entry in victim tlb, swap tlb and iotlb.  The entry
+             * evicted from the main tlb goes to the set of its own page.
+             */
+            CPUTLBDesc *desc = &cpu->neg.tlb.d[mmu_idx];
             CPUTLBEntry tmptlb, *tlb = &cpu->neg.tlb.f[mmu_idx].table[index];
+            size_t dest = vidx;
 
             qemu_spin_lock(&cpu->neg.tlb.c.lock);
             copy_tlb_helper_locked(&tmptlb, tlb);
             copy_tlb_helper_locked(tlb, vtlb);
-            copy_tlb_helper_locked(vtlb, &tmptlb);
+            if (!tlb_entry_is_empty(&tmptlb) &&
+                vtlb_set_index(tlb_entry_page(&tmptlb)) != vidx0) {
+                dest = vtlb_set_index(tlb_entry_page(&tmptlb)) +
+                       desc->vindex++ % vtlb_ways;
+                memset(vtlb, -1, sizeof(*vtlb));
+            }
+            copy_tlb_helper_locked(&desc->vtable[dest], &tmptlb);
             qemu_spin_unlock(&cpu->neg.tlb.c.lock);
 
-            CPUTLBEntryFull *f1 = &cpu->neg.tlb.d[mmu_idx].fulltlb[index];
-            CPUTLBEntryFull *f2 = &cpu->neg.tlb.d[mmu_idx].vfulltlb[vidx];
+            CPUTLBEntryFull *f1 = &desc->fulltlb[index];
+            CPUTLBEntryFull *f2 = &desc->vfulltlb[vidx];
             CPUTLBEntryFull tmpf;
-            tmpf = *f1; *f1 = *f2; *f2 = tmpf;
+            tmpf = *f1; *f1 = *f2; desc->vfulltlb[dest] = tmpf;
+            qatomic_set(&cpu->neg.tlb.c.victim_hit_count,
+                        cpu->neg.tlb.c.victim_hit_count + 1);
             return true;
         }
     }
@@ -2022,18 +2223,23 @@ static uint64_t do_ld_mmio_beN(CPUState *cpu, CPUTLBEntryFull *full,
     MemoryRegion *mr;
     hwaddr mr_offset;
     MemTxAttrs attrs;
+    bool io_sync;
     uint64_t ret;
 
     tcg_debug_assert(size > 0 && size <= 8);
 
     attrs = full->attrs;
-    section = io_prepare(&mr_offset, cpu, full->xlat_section, attrs, addr, ra);
+    section = io_prepare(&mr_offset, &io_sync, cpu, full->xlat_section,
+                         attrs, addr, ra);
     mr = section->mr;
 
     bql_lock();
     ret = int_ld_mmio_beN(cpu, full, ret_be, addr, size, mmu_idx,
                           type, ra, mr, mr_offset);
     bql_unlock();
+    if (io_sync) {
+        cpu_io_sync_end(cpu);
+    }
 
     return ret;
 }
@@ -2046,12 +2252,14 @@ static Int128 do_ld16_mmio_beN(CPUState *cpu, CPUTLBEntryFull *full,
     MemoryRegion *mr;
     hwaddr mr_offset;
     MemTxAttrs attrs;
+    bool io_sync;
     uint64_t a, b;
 
     tcg_debug_assert(size > 8 && size <= 16);
 
     attrs = full->attrs;
-    section = io_prepare(&mr_offset, cpu, full->xlat_section, attrs, addr, ra);
+    section = io_prepare(&mr_offset, &io_sync, cpu, full->xlat_section,
+                         attrs, addr, ra);
     mr = section->mr;
 
     bql_lock();
@@ -2060,6 +2268,9 @@ static Int128 do_ld16_mmio_beN(CPUState *cpu, CPUTLBEntryFull *full,
     b = int_ld_mmio_beN(cpu, full, ret_be, addr + size - 8, 8, mmu_idx,
                         MMU_DATA_LOAD, ra, mr, mr_offset + size - 8);
     bql_unlock();
+    if (io_sync) {
+        cpu_io_sync_end(cpu);
+    }
 
     return int128_make128(b, a);
 }
@@ -2569,18 +2780,23 @@ static uint64_t do_st_mmio_leN(CPUState *cpu, CPUTLBEntryFull *full,
     hwaddr mr_offset;
     MemoryRegion *mr;
     MemTxAttrs attrs;
+    bool io_sync;
     uint64_t ret;
 
     tcg_debug_assert(size > 0 && size <= 8);
 
     attrs = full->attrs;
-    section = io_prepare(&mr_offset, cpu, full->xlat_section, attrs, addr, ra);
+    section = io_prepare(&mr_offset, &io_sync, cpu, full->xlat_section,
+                         attrs, addr, ra);
     mr = section->mr;
 
     bql_lock();
     ret = int_st_mmio_leN(cpu, full, val_le, addr, size, mmu_idx,
                           ra, mr, mr_offset);
     bql_unlock();
+    if (io_sync) {
+        cpu_io_sync_end(cpu);
+    }
 
     return ret;
 }
@@ -2593,12 +2809,14 @@ static uint64_t do_st16_mmio_leN(CPUState *cpu, CPUTLBEntryFull *full,
     MemoryRegion *mr;
     hwaddr mr_offset;
     MemTxAttrs attrs;
+    bool io_sync;
     uint64_t ret;
 
     tcg_debug_assert(size > 8 && size <= 16);
 
     attrs = full->attrs;
-    section = io_prepare(&mr_offset, cpu, full->xlat_section, attrs, addr, ra);
+    section = io_prepare(&mr_offset, &io_sync, cpu, full->xlat_section,
+                         attrs, addr, ra);
     mr = section->mr;
 
     bql_lock();
@@ -2607,6 +2825,9 @@ static uint64_t do_st16_mmio_leN(CPUState *cpu, CPUTLBEntryFull *full,
     ret = int_st_mmio_leN(cpu, full, int128_gethi(val_le), addr + 8,
                           size - 8, mmu_idx, ra, mr, mr_offset + 8);
     bql_unlock();
+    if (io_sync) {
+        cpu_io_sync_end(cpu);
+    }
 
     return ret;
 }
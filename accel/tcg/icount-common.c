@@ -52,6 +52,8 @@ static bool icount_sleep = true;
 /* Do not count executed instructions */
 ICountMode use_icount = ICOUNT_DISABLED;
 
+bool icount_iosync_tb;
+
 static void icount_enable_precise(void)
 {
     /* Fixed conversion of insn to ns via "shift" option */
@@ -67,12 +69,14 @@ static void icount_enable_adaptive(void)
 /*
  * The current number of executed instructions is based on what we
  * originally budgeted minus the current state of the decrementing
- * icount counters in extra/u16.low.
+ * icount counters in extra/u16.low.  During an I/O access in the middle
+ * of a TB, the rest of the TB is charged already but has not run.
  */
 static int64_t icount_get_executed(CPUState *cpu)
 {
     return (cpu->icount_budget -
-            (cpu->neg.icount_decr.u16.low + cpu->icount_extra));
+            (cpu->neg.icount_decr.u16.low + cpu->icount_extra +
+             cpu->icount_io_pending));
 }
 
 /*
@@ -422,6 +426,7 @@ bool icount_configure(QemuOpts *opts, Error **errp)
     const char *option = qemu_opt_get(opts, "shift");
     bool sleep = qemu_opt_get_bool(opts, "sleep", true);
     bool align = qemu_opt_get_bool(opts, "align", false);
+    const char *iosync = qemu_opt_get(opts, "iosync");
     long time_shift = -1;
 
     if (!option) {
@@ -437,6 +442,14 @@ bool icount_configure(QemuOpts *opts, Error **errp)
         return false;
     }
 
+    if (iosync && strcmp(iosync, "insn") != 0) {
+        if (strcmp(iosync, "tb") != 0) {
+            error_setg(errp, "icount: Invalid iosync value");
+            return false;
+        }
+        icount_iosync_tb = true;
+    }
+
     if (strcmp(option, "auto") != 0) {
         if (qemu_strtol(option, NULL, 0, &time_shift) < 0
             || time_shift < 0 || time_shift > MAX_ICOUNT_SHIFT) {
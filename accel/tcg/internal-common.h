@@ -23,4 +23,9 @@ static inline bool cpu_in_serial_context(CPUState *cs)
     return !(cs->tcg_cflags & CF_PARALLEL) || cpu_in_exclusive_context(cs);
 }
 
+/* profile.c */
+bool tcg_profile_enabled(void);
+void tcg_profile_thread_init(CPUState *cpu);
+void tcg_profile_drain(void);
+
 #endif
@@ -67,18 +67,33 @@ void tb_invalidate_phys_range_fast(ram_addr_t ram_addr,
                                    unsigned size,
                                    uintptr_t retaddr);
 G_NORETURN void cpu_io_recompile(CPUState *cpu, uintptr_t retaddr);
+void cpu_io_sync_begin(CPUState *cpu, uintptr_t retaddr);
+void cpu_io_sync_end(CPUState *cpu);
 #endif /* CONFIG_SOFTMMU */
 
 TranslationBlock *tb_gen_code(CPUState *cpu, vaddr pc,
                               uint64_t cs_base, uint32_t flags,
                               int cflags);
+TranslationBlock *tb_optimize(CPUState *cpu, TranslationBlock *tb, vaddr pc);
 void page_init(void);
 void tb_htable_init(void);
 void tb_reset_jump(TranslationBlock *tb, int n);
+void tb_evict(CPUState *cpu);
 TranslationBlock *tb_link_page(TranslationBlock *tb);
 bool tb_invalidate_phys_page_unwind(tb_page_addr_t addr, uintptr_t pc);
 void cpu_restore_state_from_tb(CPUState *cpu, TranslationBlock *tb,
                                uintptr_t host_pc);
+/* Return in @pc the guest insn at @host_pc in translated code, if any */
+bool tb_host_pc_to_guest(uintptr_t host_pc, vaddr *pc);
+
+#ifndef CONFIG_USER_ONLY
+extern bool tb_cache_pending;
+void tb_cache_init(const char *path);
+void tb_cache_preload(CPUState *cpu);
+bool tcg_profile_init(const char *path, uint32_t hz, Error **errp);
+void tlb_set_geometry(unsigned victim_size, unsigned victim_ways,
+                      unsigned min_bits);
+#endif
 
 bool tcg_exec_realizefn(CPUState *cpu, Error **errp);
 void tcg_exec_unrealizefn(CPUState *cpu);
@@ -94,6 +109,7 @@ static inline vaddr log_pc(CPUState *cpu, const TranslationBlock *tb)
 }
 
 extern bool one_insn_per_tb;
+extern uint32_t tb_warmup;
 
 /**
  * tcg_req_mo:
@@ -13,8 +13,10 @@
 #include "qapi/type-helpers.h"
 #include "qapi/qapi-commands-machine.h"
 #include "monitor/monitor.h"
+#include "hw/core/cpu.h"
 #include "sysemu/cpus.h"
 #include "sysemu/cpu-timers.h"
+#include "sysemu/stats.h"
 #include "sysemu/tcg.h"
 #include "tcg/tcg.h"
 #include "internal-common.h"
@@ -126,6 +128,19 @@ static gboolean tb_tree_stats_iter(gpointer key, gpointer value, gpointer data)
     return false;
 }
 
+static void tlb_miss_counts(size_t *pmiss, size_t *pvictim)
+{
+    CPUState *cpu;
+    size_t miss = 0, victim = 0;
+
+    CPU_FOREACH(cpu) {
+        miss += qatomic_read(&cpu->neg.tlb.c.miss_count);
+        victim += qatomic_read(&cpu->neg.tlb.c.victim_hit_count);
+    }
+    *pmiss = miss;
+    *pvictim = victim;
+}
+
 static void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide)
 {
     CPUState *cpu;
@@ -150,7 +165,9 @@ static void dump_exec_info(GString *buf)
 {
     struct tb_tree_stats tst = {};
     struct qht_stats hst;
-    size_t nb_tbs, flush_full, flush_part, flush_elide;
+    size_t nb_tbs, flush_full, flush_part, flush_elide, tlb_miss, tlb_victim;
+    uint64_t atomic_steps = 0;
+    CPUState *cpu;
 
     tcg_tb_foreach(tb_tree_stats_iter, &tst);
     nb_tbs = tst.nb_tbs;
@@ -189,13 +206,24 @@ static void dump_exec_info(GString *buf)
     g_string_append_printf(buf, "\nStatistics:\n");
     g_string_append_printf(buf, "TB flush count      %u\n",
                            qatomic_read(&tb_ctx.tb_flush_count));
+    g_string_append_printf(buf, "TB evict count      %u\n",
+                           qatomic_read(&tb_ctx.tb_evict_count));
     g_string_append_printf(buf, "TB invalidate count %u\n",
                            qatomic_read(&tb_ctx.tb_phys_invalidate_count));
+    CPU_FOREACH(cpu) {
+        atomic_steps += cpu->tcg_atomic_steps;
+    }
+    g_string_append_printf(buf, "exclusive steps     %" PRIu64 "\n",
+                           atomic_steps);
 
     tlb_flush_counts(&flush_full, &flush_part, &flush_elide);
     g_string_append_printf(buf, "TLB full flushes    %zu\n", flush_full);
     g_string_append_printf(buf, "TLB partial flushes %zu\n", flush_part);
     g_string_append_printf(buf, "TLB elided flushes  %zu\n", flush_elide);
+    tlb_miss_counts(&tlb_miss, &tlb_victim);
+    g_string_append_printf(buf, "TLB misses          %zu\n", tlb_miss);
+    g_string_append_printf(buf, "TLB victim hits     %zu (%zu%%)\n", tlb_victim,
+                           tlb_miss ? (tlb_victim * 100) / tlb_miss : 0);
     tcg_dump_info(buf);
 }
 
@@ -242,3 +270,231 @@ static void hmp_tcg_register(void)
 }
 
 type_init(hmp_tcg_register);
+
+static const char *const tcg_exit_names[TCG_EXIT_CAUSE__MAX] = {
+    [TCG_EXIT_CAUSE_EXCEPTION] = "exception_exits",
+    [TCG_EXIT_CAUSE_INTERRUPT] = "irq_exits",
+    [TCG_EXIT_CAUSE_TB_MISS]   = "tb_miss_exits",
+    [TCG_EXIT_CAUSE_IO]        = "io_exits",
+    [TCG_EXIT_CAUSE_REQUEST]   = "request_exits",
+};
+
+static void tcg_stats_add_scalar(StatsList **stats_list, strList *names,
+                                 const char *name, uint64_t value)
+{
+    Stats *stats;
+
+    if (!apply_str_list_filter(name, names)) {
+        return;
+    }
+
+    stats = g_new0(Stats, 1);
+    stats->name = g_strdup(name);
+    stats->value = g_new0(StatsValue, 1);
+    stats->value->type = QTYPE_QNUM;
+    stats->value->u.scalar = value;
+    QAPI_LIST_PREPEND(*stats_list, stats);
+}
+
+static void tcg_stats_add_list(StatsList **stats_list, strList *names,
+                               const char *name, const uint64_t *values,
+                               size_t n)
+{
+    uint64List *list = NULL;
+    Stats *stats;
+
+    if (!apply_str_list_filter(name, names)) {
+        return;
+    }
+
+    while (n--) {
+        QAPI_LIST_PREPEND(list, values[n]);
+    }
+
+    stats = g_new0(Stats, 1);
+    stats->name = g_strdup(name);
+    stats->value = g_new0(StatsValue, 1);
+    stats->value->type = QTYPE_QLIST;
+    stats->value->u.list = list;
+    QAPI_LIST_PREPEND(*stats_list, stats);
+}
+
+static void tcg_query_stats_vm(StatsResultList **result, strList *names)
+{
+    StatsList *stats_list = NULL;
+    struct qht_stats hst;
+    g_autofree uint64_t *fill = NULL;
+    g_autofree uint64_t *chain = NULL;
+    size_t n_regions, n_chain = 0, i;
+
+    /* The number of regions is fixed at init time. */
+    n_regions = tcg_region_fill(NULL, 0);
+    fill = g_new0(uint64_t, n_regions);
+    tcg_region_fill(fill, n_regions);
+
+    /*
+     * Chain lengths as a linear histogram with a bucket size of 1:
+     * element N counts the chains made of N buckets.
+     */
+    qht_statistics_init(&tb_ctx.htable, &hst);
+    if (hst.chain.n) {
+        n_chain = (size_t)qdist_xmax(&hst.chain) + 1;
+        chain = g_new0(uint64_t, n_chain);
+        for (i = 0; i < hst.chain.n; i++) {
+            chain[(size_t)hst.chain.entries[i].x] +=
+                hst.chain.entries[i].count;
+        }
+    }
+    qht_statistics_destroy(&hst);
+
+    tcg_stats_add_list(&stats_list, names, "hash_chain_length",
+                       chain, n_chain);
+    tcg_stats_add_scalar(&stats_list, names, "tb_invalidations",
+                         qatomic_read(&tb_ctx.tb_phys_invalidate_count));
+    tcg_stats_add_scalar(&stats_list, names, "region_evictions",
+                         qatomic_read(&tb_ctx.tb_evict_count));
+    tcg_stats_add_scalar(&stats_list, names, "tb_flushes",
+                         qatomic_read(&tb_ctx.tb_flush_count));
+    tcg_stats_add_list(&stats_list, names, "region_fill", fill, n_regions);
+    tcg_stats_add_scalar(&stats_list, names, "code_capacity",
+                         tcg_code_capacity());
+    tcg_stats_add_scalar(&stats_list, names, "code_size", tcg_code_size());
+    tcg_stats_add_scalar(&stats_list, names, "tb_count", tcg_nb_tbs());
+
+    if (stats_list) {
+        add_stats_entry(result, STATS_PROVIDER_TCG, NULL, stats_list);
+    }
+}
+
+static void tcg_query_stats_vcpu(StatsResultList **result, strList *names,
+                                 strList *targets)
+{
+    CPUState *cpu;
+    int i;
+
+    CPU_FOREACH(cpu) {
+        CPUTLBCommon *c = &cpu->neg.tlb.c;
+        StatsList *stats_list = NULL;
+
+        if (!apply_str_list_filter(cpu->parent_obj.canonical_path, targets)) {
+            continue;
+        }
+
+        /*
+         * The counters are only written by the vCPU thread, and
+         * sampled here without synchronization.
+         */
+        tcg_stats_add_scalar(&stats_list, names, "tlb_victim_hits",
+                             qatomic_read(&c->victim_hit_count));
+        tcg_stats_add_scalar(&stats_list, names, "tlb_misses",
+                             qatomic_read(&c->miss_count));
+        tcg_stats_add_scalar(&stats_list, names, "tlb_elided_flushes",
+                             qatomic_read(&c->elide_flush_count));
+        tcg_stats_add_scalar(&stats_list, names, "tlb_partial_flushes",
+                             qatomic_read(&c->part_flush_count));
+        tcg_stats_add_scalar(&stats_list, names, "tlb_full_flushes",
+                             qatomic_read(&c->full_flush_count));
+        for (i = TCG_EXIT_CAUSE__MAX - 1; i >= 0; i--) {
+            tcg_stats_add_scalar(&stats_list, names, tcg_exit_names[i],
+                                 cpu->tcg_exits[i]);
+        }
+        tcg_stats_add_scalar(&stats_list, names, "atomic_steps",
+                             cpu->tcg_atomic_steps);
+
+        if (stats_list) {
+            add_stats_entry(result, STATS_PROVIDER_TCG,
+                            cpu->parent_obj.canonical_path, stats_list);
+        }
+    }
+}
+
+static void tcg_query_stats_cb(StatsResultList **result, StatsTarget target,
+                               strList *names, strList *targets,
+                               Error **errp)
+{
+    if (!tcg_enabled()) {
+        return;
+    }
+
+    switch (target) {
+    case STATS_TARGET_VM:
+        tcg_query_stats_vm(result, names);
+        break;
+    case STATS_TARGET_VCPU:
+        tcg_query_stats_vcpu(result, names, targets);
+        break;
+    default:
+        break;
+    }
+}
+
+static void tcg_stats_add_schema(StatsSchemaValueList **list,
+                                 const char *name, StatsType type,
+                                 bool bytes)
+{
+    StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+    value->name = g_strdup(name);
+    value->type = type;
+    if (bytes) {
+        value->has_unit = true;
+        value->unit = STATS_UNIT_BYTES;
+    }
+    if (type == STATS_TYPE_LINEAR_HISTOGRAM) {
+        value->has_bucket_size = true;
+        value->bucket_size = 1;
+    }
+    QAPI_LIST_PREPEND(*list, value);
+}
+
+static void tcg_query_stats_schemas_cb(StatsSchemaList **result,
+                                       Error **errp)
+{
+    StatsSchemaValueList *vm_list = NULL;
+    StatsSchemaValueList *vcpu_list = NULL;
+    int i;
+
+    if (!tcg_enabled()) {
+        return;
+    }
+
+    tcg_stats_add_schema(&vm_list, "hash_chain_length",
+                         STATS_TYPE_LINEAR_HISTOGRAM, false);
+    tcg_stats_add_schema(&vm_list, "tb_invalidations",
+                         STATS_TYPE_CUMULATIVE, false);
+    tcg_stats_add_schema(&vm_list, "region_evictions",
+                         STATS_TYPE_CUMULATIVE, false);
+    tcg_stats_add_schema(&vm_list, "tb_flushes", STATS_TYPE_CUMULATIVE, false);
+    tcg_stats_add_schema(&vm_list, "region_fill", STATS_TYPE_INSTANT, true);
+    tcg_stats_add_schema(&vm_list, "code_capacity", STATS_TYPE_INSTANT, true);
+    tcg_stats_add_schema(&vm_list, "code_size", STATS_TYPE_INSTANT, true);
+    tcg_stats_add_schema(&vm_list, "tb_count", STATS_TYPE_INSTANT, false);
+    add_stats_schema(result, STATS_PROVIDER_TCG, STATS_TARGET_VM, vm_list);
+
+    tcg_stats_add_schema(&vcpu_list, "tlb_victim_hits",
+                         STATS_TYPE_CUMULATIVE, false);
+    tcg_stats_add_schema(&vcpu_list, "tlb_misses",
+                         STATS_TYPE_CUMULATIVE, false);
+    tcg_stats_add_schema(&vcpu_list, "tlb_elided_flushes",
+                         STATS_TYPE_CUMULATIVE, false);
+    tcg_stats_add_schema(&vcpu_list, "tlb_partial_flushes",
+                         STATS_TYPE_CUMULATIVE, false);
+    tcg_stats_add_schema(&vcpu_list, "tlb_full_flushes",
+                         STATS_TYPE_CUMULATIVE, false);
+    for (i = TCG_EXIT_CAUSE__MAX - 1; i >= 0; i--) {
+        tcg_stats_add_schema(&vcpu_list, tcg_exit_names[i],
+                             STATS_TYPE_CUMULATIVE, false);
+    }
+    tcg_stats_add_schema(&vcpu_list, "atomic_steps",
+                         STATS_TYPE_CUMULATIVE, false);
+    add_stats_schema(result, STATS_PROVIDER_TCG, STATS_TARGET_VCPU,
+                     vcpu_list);
+}
+
+static void tcg_stats_register(void)
+{
+    add_stats_callbacks(STATS_PROVIDER_TCG, tcg_query_stats_cb,
+                        tcg_query_stats_schemas_cb);
+}
+
+type_init(tcg_stats_register);
@@ -41,6 +41,10 @@
  * optimization to avoid generating redundant operations. For instance, for the
  * second and all subsequent callbacks of an event, we do not need to reload the
  * CPU's index into a TCG temp, since the first callback did it already.
+ *
+ * Inline ops and conditional callbacks do not use this scheme: their empty
+ * events only mark the insertion point, and their ops are emitted there
+ * directly through tcg_ctx->emit_before_op.
  */
 #include "qemu/osdep.h"
 #include "cpu.h"
@@ -80,6 +84,7 @@ enum plugin_gen_from {
 enum plugin_gen_cb {
     PLUGIN_GEN_CB_UDATA,
     PLUGIN_GEN_CB_INLINE,
+    PLUGIN_GEN_CB_COND,
     PLUGIN_GEN_CB_MEM,
     PLUGIN_GEN_ENABLE_MEM_HELPER,
     PLUGIN_GEN_DISABLE_MEM_HELPER,
@@ -93,6 +98,12 @@ enum plugin_gen_cb {
 void HELPER(plugin_vcpu_udata_cb)(uint32_t cpu_index, void *udata)
 { }
 
+void HELPER(plugin_vcpu_udata_cb_no_wg)(uint32_t cpu_index, void *udata)
+{ }
+
+void HELPER(plugin_vcpu_udata_cb_rw_regs)(uint32_t cpu_index, void *udata)
+{ }
+
 void HELPER(plugin_vcpu_mem_cb)(unsigned int vcpu_index,
                                 qemu_plugin_meminfo_t info, uint64_t vaddr,
                                 void *userdata)
@@ -112,22 +123,9 @@ static void gen_empty_udata_cb(void)
     tcg_temp_free_i32(cpu_index);
 }
 
-/*
- * For now we only support addi_i64.
- * When we support more ops, we can generate one empty inline cb for each.
- */
-static void gen_empty_inline_cb(void)
+/* Inline ops and conditional callbacks are generated in place */
+static void gen_empty_inplace_cb(void)
 {
-    TCGv_i64 val = tcg_temp_ebb_new_i64();
-    TCGv_ptr ptr = tcg_temp_ebb_new_ptr();
-
-    tcg_gen_movi_ptr(ptr, 0);
-    tcg_gen_ld_i64(val, ptr, 0);
-    /* pass an immediate != 0 so that it doesn't get optimized away */
-    tcg_gen_addi_i64(val, val, 0xdeadface);
-    tcg_gen_st_i64(val, ptr, 0);
-    tcg_temp_free_ptr(ptr);
-    tcg_temp_free_i64(val);
 }
 
 static void gen_empty_mem_cb(TCGv_i64 addr, uint32_t info)
@@ -193,7 +191,8 @@ static void plugin_gen_empty_callback(enum plugin_gen_from from)
         /* fall through */
     case PLUGIN_GEN_FROM_TB:
         gen_wrapped(from, PLUGIN_GEN_CB_UDATA, gen_empty_udata_cb);
-        gen_wrapped(from, PLUGIN_GEN_CB_INLINE, gen_empty_inline_cb);
+        gen_wrapped(from, PLUGIN_GEN_CB_INLINE, gen_empty_inplace_cb);
+        gen_wrapped(from, PLUGIN_GEN_CB_COND, gen_empty_inplace_cb);
         break;
     default:
         g_assert_not_reached();
@@ -209,7 +208,7 @@ void plugin_gen_empty_mem_callback(TCGv_i64 addr, uint32_t info)
     tcg_gen_plugin_cb_end();
 
     gen_plugin_cb_start(PLUGIN_GEN_FROM_MEM, PLUGIN_GEN_CB_INLINE, rw);
-    gen_empty_inline_cb();
+    gen_empty_inplace_cb();
     tcg_gen_plugin_cb_end();
 }
 
@@ -274,19 +273,6 @@ static TCGOp *copy_const_ptr(TCGOp **begin_op, TCGOp *op, void *ptr)
     return op;
 }
 
-static TCGOp *copy_ld_i64(TCGOp **begin_op, TCGOp *op)
-{
-    if (TCG_TARGET_REG_BITS == 32) {
-        /* 2x ld_i32 */
-        op = copy_op(begin_op, op, INDEX_op_ld_i32);
-        op = copy_op(begin_op, op, INDEX_op_ld_i32);
-    } else {
-        /* ld_i64 */
-        op = copy_op(begin_op, op, INDEX_op_ld_i64);
-    }
-    return op;
-}
-
 static TCGOp *copy_st_i64(TCGOp **begin_op, TCGOp *op)
 {
     if (TCG_TARGET_REG_BITS == 32) {
@@ -300,21 +286,6 @@ static TCGOp *copy_st_i64(TCGOp **begin_op, TCGOp *op)
     return op;
 }
 
-static TCGOp *copy_add_i64(TCGOp **begin_op, TCGOp *op, uint64_t v)
-{
-    if (TCG_TARGET_REG_BITS == 32) {
-        /* all 32-bit backends must implement add2_i32 */
-        g_assert(TCG_TARGET_HAS_add2_i32);
-        op = copy_op(begin_op, op, INDEX_op_add2_i32);
-        op->args[4] = tcgv_i32_arg(tcg_constant_i32(v));
-        op->args[5] = tcgv_i32_arg(tcg_constant_i32(v >> 32));
-    } else {
-        op = copy_op(begin_op, op, INDEX_op_add_i64);
-        op->args[2] = tcgv_i64_arg(tcg_constant_i64(v));
-    }
-    return op;
-}
-
 static TCGOp *copy_st_ptr(TCGOp **begin_op, TCGOp *op)
 {
     if (UINTPTR_MAX == UINT32_MAX) {
@@ -350,6 +321,155 @@ static TCGOp *copy_call(TCGOp **begin_op, TCGOp *op, void *func, int *cb_idx)
     return op;
 }
 
+static TCGv_i32 gen_cpu_index(void)
+{
+    TCGv_i32 cpu_index = tcg_temp_ebb_new_i32();
+
+    tcg_gen_ld_i32(cpu_index, tcg_env,
+                   -offsetof(ArchCPU, env) + offsetof(CPUState, cpu_index));
+    return cpu_index;
+}
+
+/*
+ * Return the address of the uint64_t an inline op or a conditional
+ * callback works on: the entry of the current vCPU in @entry, or @ptr if
+ * @entry has no scoreboard.
+ */
+static TCGv_ptr gen_plugin_u64_ptr(qemu_plugin_u64 entry, void *ptr)
+{
+    TCGv_ptr addr = tcg_temp_ebb_new_ptr();
+    GArray *arr;
+    TCGv_i32 offset;
+
+    if (!entry.score) {
+        tcg_gen_movi_ptr(addr, (intptr_t)ptr);
+        return addr;
+    }
+
+    arr = entry.score->data;
+    offset = gen_cpu_index();
+    tcg_gen_muli_i32(offset, offset, g_array_get_element_size(arr));
+    tcg_gen_ext_i32_ptr(addr, offset);
+    tcg_gen_addi_ptr(addr, addr, (intptr_t)(arr->data + entry.offset));
+    tcg_temp_free_i32(offset);
+    return addr;
+}
+
+static void gen_inline_cb(const struct qemu_plugin_dyn_cb *cb)
+{
+    TCGv_ptr ptr = gen_plugin_u64_ptr(cb->inline_insn.entry, cb->userp);
+    TCGv_i64 val = tcg_temp_ebb_new_i64();
+
+    switch (cb->inline_insn.op) {
+    case QEMU_PLUGIN_INLINE_ADD_U64:
+        tcg_gen_ld_i64(val, ptr, 0);
+        tcg_gen_addi_i64(val, val, cb->inline_insn.imm);
+        tcg_gen_st_i64(val, ptr, 0);
+        break;
+    default:
+        g_assert_not_reached();
+    }
+
+    tcg_temp_free_i64(val);
+    tcg_temp_free_ptr(ptr);
+}
+
+static TCGCond plugin_cond_to_tcgcond(enum qemu_plugin_cond cond)
+{
+    switch (cond) {
+    case QEMU_PLUGIN_COND_EQ:
+        return TCG_COND_EQ;
+    case QEMU_PLUGIN_COND_NE:
+        return TCG_COND_NE;
+    case QEMU_PLUGIN_COND_LT:
+        return TCG_COND_LTU;
+    case QEMU_PLUGIN_COND_LE:
+        return TCG_COND_LEU;
+    case QEMU_PLUGIN_COND_GT:
+        return TCG_COND_GTU;
+    case QEMU_PLUGIN_COND_GE:
+        return TCG_COND_GEU;
+    default:
+        /* ALWAYS and NEVER conditions are handled at registration */
+        g_assert_not_reached();
+    }
+}
+
+/* Write back the value of the global @ts to its canonical slot */
+static void gen_sync_global(TCGTemp *ts)
+{
+    TCGTemp *base = ts->mem_base;
+    int i, n = ts->base_type == ts->type ? 1 : 2;
+
+    if (base->kind != TEMP_FIXED) {
+        gen_sync_global(base);
+    }
+    for (i = 0; i < n; i++) {
+        if (ts[i].type == TCG_TYPE_I32) {
+            tcg_gen_st_i32(temp_tcgv_i32(&ts[i]), temp_tcgv_ptr(base),
+                           ts[i].mem_offset);
+        } else {
+            tcg_gen_st_i64(temp_tcgv_i64(&ts[i]), temp_tcgv_ptr(base),
+                           ts[i].mem_offset);
+        }
+    }
+}
+
+/*
+ * Call the udata callback @cb.  The helper flags follow cb->flags, so
+ * that TCG syncs (and for RW_REGS, reloads) all globals around the call.
+ * Callbacks that list their registers keep TCG_CALL_NO_RWG and only get
+ * those written back.
+ */
+static void gen_udata_cb(const struct qemu_plugin_dyn_cb *cb)
+{
+    TCGv_i32 cpu_index;
+    TCGv_ptr udata = tcg_constant_ptr(cb->userp);
+    TCGOp *op;
+    size_t i;
+
+    for (i = 0; i < cb->n_regs; i++) {
+        gen_sync_global(&tcg_ctx->temps[plugin_register_global(cb->regs[i])]);
+    }
+
+    /* Call the matching empty helper, then retarget it */
+    cpu_index = gen_cpu_index();
+    switch (cb->flags) {
+    case QEMU_PLUGIN_CB_R_REGS:
+        gen_helper_plugin_vcpu_udata_cb_no_wg(cpu_index, udata);
+        break;
+    case QEMU_PLUGIN_CB_RW_REGS:
+        gen_helper_plugin_vcpu_udata_cb_rw_regs(cpu_index, udata);
+        break;
+    default:
+        gen_helper_plugin_vcpu_udata_cb(cpu_index, udata);
+        break;
+    }
+    op = tcg_last_op();
+    tcg_debug_assert(op->opc == INDEX_op_call);
+    op->args[TCGOP_CALLO(op) + TCGOP_CALLI(op)] = (uintptr_t)cb->f.vcpu_udata;
+
+    tcg_temp_free_i32(cpu_index);
+}
+
+static void gen_cond_cb(const struct qemu_plugin_dyn_cb *cb)
+{
+    TCGv_ptr ptr = gen_plugin_u64_ptr(cb->cond.entry, NULL);
+    TCGv_i64 val = tcg_temp_ebb_new_i64();
+    TCGLabel *after_cb = gen_new_label();
+
+    /* Skip the call if the condition does not hold */
+    tcg_gen_ld_i64(val, ptr, 0);
+    tcg_gen_brcondi_i64(tcg_invert_cond(plugin_cond_to_tcgcond(cb->cond.cond)),
+                        val, cb->cond.imm, after_cb);
+
+    gen_udata_cb(cb);
+    gen_set_label(after_cb);
+
+    tcg_temp_free_i64(val);
+    tcg_temp_free_ptr(ptr);
+}
+
 /*
  * When we append/replace ops here we are sensitive to changing patterns of
  * TCGOps generated by the tcg_gen_FOO calls when we generated the
@@ -359,6 +479,16 @@ static TCGOp *copy_call(TCGOp **begin_op, TCGOp *op, void *func, int *cb_idx)
 static TCGOp *append_udata_cb(const struct qemu_plugin_dyn_cb *cb,
                               TCGOp *begin_op, TCGOp *op, int *cb_idx)
 {
+    /* callbacks that touch registers are generated in place, see above */
+    if (cb->flags != QEMU_PLUGIN_CB_NO_REGS || cb->n_regs) {
+        TCGOp *next = QTAILQ_NEXT(op, link);
+
+        tcg_ctx->emit_before_op = next;
+        gen_udata_cb(cb);
+        tcg_ctx->emit_before_op = NULL;
+        return next ? QTAILQ_PREV(next, link) : tcg_last_op();
+    }
+
     /* const_ptr */
     op = copy_const_ptr(&begin_op, op, cb->userp);
 
@@ -376,25 +506,6 @@ static TCGOp *append_udata_cb(const struct qemu_plugin_dyn_cb *cb,
     return op;
 }
 
-static TCGOp *append_inline_cb(const struct qemu_plugin_dyn_cb *cb,
-                               TCGOp *begin_op, TCGOp *op,
-                               int *unused)
-{
-    /* const_ptr */
-    op = copy_const_ptr(&begin_op, op, cb->userp);
-
-    /* ld_i64 */
-    op = copy_ld_i64(&begin_op, op);
-
-    /* add_i64 */
-    op = copy_add_i64(&begin_op, op, cb->inline_insn.imm);
-
-    /* st_i64 */
-    op = copy_st_i64(&begin_op, op);
-
-    return op;
-}
-
 static TCGOp *append_mem_cb(const struct qemu_plugin_dyn_cb *cb,
                             TCGOp *begin_op, TCGOp *op, int *cb_idx)
 {
@@ -476,10 +587,40 @@ inject_udata_cb(const GArray *cbs, TCGOp *begin_op)
     inject_cb_type(cbs, begin_op, append_udata_cb, op_ok);
 }
 
+/* Emit the ops of the callbacks in @cbs in place of the empty event */
+static void inject_inplace_cb(const GArray *cbs, TCGOp *begin_op,
+                              void (*gen)(const struct qemu_plugin_dyn_cb *),
+                              op_ok_fn ok)
+{
+    TCGOp *end_op = find_op(begin_op, INDEX_op_plugin_cb_end);
+    int i;
+
+    tcg_debug_assert(end_op);
+
+    tcg_ctx->emit_before_op = begin_op;
+    for (i = 0; cbs && i < cbs->len; i++) {
+        struct qemu_plugin_dyn_cb *cb =
+            &g_array_index(cbs, struct qemu_plugin_dyn_cb, i);
+
+        if (ok(begin_op, cb)) {
+            gen(cb);
+        }
+    }
+    tcg_ctx->emit_before_op = NULL;
+
+    rm_ops_range(begin_op, end_op);
+}
+
 static void
 inject_inline_cb(const GArray *cbs, TCGOp *begin_op, op_ok_fn ok)
 {
-    inject_cb_type(cbs, begin_op, append_inline_cb, ok);
+    inject_inplace_cb(cbs, begin_op, gen_inline_cb, ok);
+}
+
+static void
+inject_cond_cb(const GArray *cbs, TCGOp *begin_op)
+{
+    inject_inplace_cb(cbs, begin_op, gen_cond_cb, op_ok);
 }
 
 static void
@@ -594,6 +735,12 @@ static void plugin_gen_tb_inline(const struct qemu_plugin_tb *ptb,
     inject_inline_cb(ptb->cbs[PLUGIN_CB_INLINE], begin_op, op_ok);
 }
 
+static void plugin_gen_tb_cond(const struct qemu_plugin_tb *ptb,
+                               TCGOp *begin_op)
+{
+    inject_cond_cb(ptb->cbs[PLUGIN_CB_COND], begin_op);
+}
+
 static void plugin_gen_insn_udata(const struct qemu_plugin_tb *ptb,
                                   TCGOp *begin_op, int insn_idx)
 {
@@ -610,6 +757,14 @@ static void plugin_gen_insn_inline(const struct qemu_plugin_tb *ptb,
                      begin_op, op_ok);
 }
 
+static void plugin_gen_insn_cond(const struct qemu_plugin_tb *ptb,
+                                 TCGOp *begin_op, int insn_idx)
+{
+    struct qemu_plugin_insn *insn = g_ptr_array_index(ptb->insns, insn_idx);
+
+    inject_cond_cb(insn->cbs[PLUGIN_CB_INSN][PLUGIN_CB_COND], begin_op);
+}
+
 static void plugin_gen_mem_regular(const struct qemu_plugin_tb *ptb,
                                    TCGOp *begin_op, int insn_idx)
 {
@@ -676,6 +831,9 @@ static void pr_ops(void)
             case PLUGIN_GEN_CB_INLINE:
                 type = "inline";
                 break;
+            case PLUGIN_GEN_CB_COND:
+                type = "cond";
+                break;
             case PLUGIN_GEN_CB_MEM:
                 type = "mem";
                 break;
@@ -724,6 +882,9 @@ static void plugin_gen_inject(struct qemu_plugin_tb *plugin_tb)
                 case PLUGIN_GEN_CB_INLINE:
                     plugin_gen_tb_inline(plugin_tb, op);
                     break;
+                case PLUGIN_GEN_CB_COND:
+                    plugin_gen_tb_cond(plugin_tb, op);
+                    break;
                 default:
                     g_assert_not_reached();
                 }
@@ -740,6 +901,9 @@ static void plugin_gen_inject(struct qemu_plugin_tb *plugin_tb)
                 case PLUGIN_GEN_CB_INLINE:
                     plugin_gen_insn_inline(plugin_tb, op, insn_idx);
                     break;
+                case PLUGIN_GEN_CB_COND:
+                    plugin_gen_insn_cond(plugin_tb, op, insn_idx);
+                    break;
                 case PLUGIN_GEN_ENABLE_MEM_HELPER:
                     plugin_gen_enable_mem_helper(plugin_tb, op, insn_idx);
                     break;
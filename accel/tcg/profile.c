@@ -0,0 +1,284 @@
+/*
+ * Sampling profiler for guest code
+ *
+ * Each vCPU thread arms a timer on its own CPU time clock.  The SIGPROF
+ * handler only records the host PC it interrupted in a per-thread ring;
+ * the thread maps the samples to guest PCs, through the unwind data of
+ * the TB that contains them, before it leaves cpu_exec().  No TB can be
+ * flushed in-between, since that needs all vCPUs out of cpu_exec().
+ * At exit the guest PCs are symbolized against the symbols of the ELF
+ * images that the loader has loaded, and written out as folded stacks,
+ * one "cpuN;function count" line per function, which flamegraph.pl and
+ * similar tools take as is.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qemu/error-report.h"
+#include "qemu/lockable.h"
+#include "qemu/notify.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+#include "disas/disas.h"
+#include "exec/exec-all.h"
+#include "hw/core/cpu.h"
+#include "sysemu/sysemu.h"
+#include "internal-common.h"
+#include "internal-target.h"
+
+#if defined(CONFIG_LINUX) && \
+    (defined(__x86_64__) || defined(__aarch64__) || defined(__riscv))
+#define HAVE_TCG_PROFILE
+#include <ucontext.h>
+#endif
+
+#ifndef HAVE_SIGEV_NOTIFY_THREAD_ID
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+/* Samples that could not be mapped to guest code, e.g. in helpers */
+#define PROFILE_PC_QEMU     UINT64_MAX
+
+#define PROFILE_HZ_MAX      100000
+
+/* A power of two, since the ring positions are free-running */
+#define PROFILE_RING_LEN    4096
+
+typedef struct ProfileSample {
+    uintptr_t host_pc;
+    int cpu_index;
+} ProfileSample;
+
+typedef struct ProfileRing {
+    unsigned int head;          /* written by the signal handler */
+    unsigned int tail;          /* written by the thread */
+    unsigned int lost;
+    ProfileSample samples[PROFILE_RING_LEN];
+} ProfileRing;
+
+typedef struct ProfileKey {
+    uint64_t pc;
+    int cpu_index;
+} ProfileKey;
+
+static char *profile_path;
+static uint32_t profile_hz;
+static QemuMutex profile_lock;
+static GHashTable *profile_counts;      /* ProfileKey -> uint64_t count */
+static uint64_t profile_lost;
+static Notifier profile_exit_notifier;
+static __thread ProfileRing *profile_ring;
+
+bool tcg_profile_enabled(void)
+{
+    return profile_path;
+}
+
+static guint profile_key_hash(gconstpointer v)
+{
+    const ProfileKey *k = v;
+
+    return g_int64_hash(&k->pc) ^ k->cpu_index;
+}
+
+static gboolean profile_key_equal(gconstpointer v1, gconstpointer v2)
+{
+    const ProfileKey *k1 = v1, *k2 = v2;
+
+    return k1->pc == k2->pc && k1->cpu_index == k2->cpu_index;
+}
+
+#ifdef HAVE_TCG_PROFILE
+static uintptr_t profile_host_pc(ucontext_t *uc)
+{
+#if defined(__x86_64__)
+    return uc->uc_mcontext.gregs[REG_RIP];
+#elif defined(__aarch64__)
+    return uc->uc_mcontext.pc;
+#else
+    return uc->uc_mcontext.__gregs[REG_PC];
+#endif
+}
+
+static void profile_signal(int sig, siginfo_t *info, void *uc)
+{
+    ProfileRing *ring = profile_ring;
+    CPUState *cpu = current_cpu;
+    unsigned int head;
+
+    if (!ring || !cpu) {
+        return;
+    }
+
+    head = ring->head;
+    if (head - qatomic_read(&ring->tail) >= PROFILE_RING_LEN) {
+        ring->lost++;
+        return;
+    }
+    ring->samples[head % PROFILE_RING_LEN] = (ProfileSample) {
+        .host_pc = profile_host_pc(uc),
+        .cpu_index = cpu->cpu_index,
+    };
+    signal_barrier();
+    qatomic_set(&ring->head, head + 1);
+
+    /* Long running TB chains do not leave cpu_exec() on their own */
+    if (head + 1 - ring->tail >= PROFILE_RING_LEN / 2) {
+        cpu_exit(cpu);
+    }
+}
+#endif
+
+void tcg_profile_thread_init(CPUState *cpu)
+{
+#ifdef HAVE_TCG_PROFILE
+    struct sigevent sev = {
+        .sigev_notify = SIGEV_THREAD_ID,
+        .sigev_signo = SIGPROF,
+    };
+    struct itimerspec its = {
+        .it_interval.tv_sec = 1 / profile_hz,
+        .it_interval.tv_nsec = NANOSECONDS_PER_SECOND / profile_hz %
+                               NANOSECONDS_PER_SECOND,
+    };
+    sigset_t set;
+    timer_t timer;
+
+    if (!profile_path || profile_ring) {
+        return;
+    }
+
+    profile_ring = g_new0(ProfileRing, 1);
+    its.it_value = its.it_interval;
+    sev.sigev_notify_thread_id = qemu_get_thread_id();
+    if (timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &timer) < 0 ||
+        timer_settime(timer, 0, &its, NULL) < 0) {
+        warn_report("profile: cannot sample CPU %d: %s",
+                    cpu->cpu_index, strerror(errno));
+        return;
+    }
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGPROF);
+    pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+#endif
+}
+
+void tcg_profile_drain(void)
+{
+    ProfileRing *ring = profile_ring;
+    unsigned int head, tail;
+
+    if (!ring) {
+        return;
+    }
+
+    head = qatomic_read(&ring->head);
+    signal_barrier();
+
+    QEMU_LOCK_GUARD(&profile_lock);
+    for (tail = ring->tail; tail != head; tail++) {
+        ProfileSample *sample = &ring->samples[tail % PROFILE_RING_LEN];
+        ProfileKey key = { .cpu_index = sample->cpu_index };
+        uint64_t *count;
+        vaddr pc;
+
+        key.pc = tb_host_pc_to_guest(sample->host_pc, &pc)
+                 ? pc : PROFILE_PC_QEMU;
+        count = g_hash_table_lookup(profile_counts, &key);
+        if (!count) {
+            count = g_new0(uint64_t, 1);
+            g_hash_table_insert(profile_counts, g_memdup2(&key, sizeof(key)),
+                                count);
+        }
+        (*count)++;
+    }
+    profile_lost += qatomic_xchg(&ring->lost, 0);
+
+    signal_barrier();
+    qatomic_set(&ring->tail, tail);
+}
+
+static void profile_save(Notifier *n, void *unused)
+{
+    g_autoptr(GHashTable) folded = g_hash_table_new_full(g_str_hash,
+                                                         g_str_equal,
+                                                         g_free, g_free);
+    g_autoptr(GString) out = g_string_new(NULL);
+    g_autoptr(GError) err = NULL;
+    GHashTableIter iter;
+    gpointer key, value;
+
+    QEMU_LOCK_GUARD(&profile_lock);
+
+    g_hash_table_iter_init(&iter, profile_counts);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        ProfileKey *k = key;
+        g_autofree char *stack = NULL;
+        const char *sym;
+        uint64_t *total;
+
+        if (k->pc == PROFILE_PC_QEMU) {
+            stack = g_strdup_printf("cpu%d;[qemu]", k->cpu_index);
+        } else if ((sym = lookup_symbol(k->pc))[0]) {
+            stack = g_strdup_printf("cpu%d;%s", k->cpu_index, sym);
+        } else {
+            stack = g_strdup_printf("cpu%d;[0x%" PRIx64 "]",
+                                    k->cpu_index, k->pc);
+        }
+
+        total = g_hash_table_lookup(folded, stack);
+        if (!total) {
+            total = g_new0(uint64_t, 1);
+            g_hash_table_insert(folded, g_steal_pointer(&stack), total);
+        }
+        *total += *(uint64_t *)value;
+    }
+
+    g_hash_table_iter_init(&iter, folded);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        g_string_append_printf(out, "%s %" PRIu64 "\n", (char *)key,
+                               *(uint64_t *)value);
+    }
+    if (profile_lost) {
+        g_string_append_printf(out, "[lost] %" PRIu64 "\n", profile_lost);
+    }
+
+    if (!g_file_set_contents(profile_path, out->str, out->len, &err)) {
+        warn_report("profile: failed to write %s: %s",
+                    profile_path, err->message);
+    }
+}
+
+bool tcg_profile_init(const char *path, uint32_t hz, Error **errp)
+{
+#ifdef HAVE_TCG_PROFILE
+    struct sigaction act = {
+        .sa_sigaction = profile_signal,
+        .sa_flags = SA_SIGINFO | SA_RESTART,
+    };
+
+    if (!hz || hz > PROFILE_HZ_MAX) {
+        error_setg(errp, "profile-hz must be between 1 and %d",
+                   PROFILE_HZ_MAX);
+        return false;
+    }
+
+    sigfillset(&act.sa_mask);
+    sigaction(SIGPROF, &act, NULL);
+
+    qemu_mutex_init(&profile_lock);
+    profile_counts = g_hash_table_new_full(profile_key_hash,
+                                           profile_key_equal, g_free, g_free);
+    profile_path = g_strdup(path);
+    profile_hz = hz;
+    profile_exit_notifier.notify = profile_save;
+    qemu_add_exit_notifier(&profile_exit_notifier);
+    return true;
+#else
+    error_setg(errp, "profile is not supported on this host");
+    return false;
+#endif
+}
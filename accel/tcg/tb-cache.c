@@ -0,0 +1,217 @@
+/*
+ * Persistent translation block cache
+ *
+ * The set of translation blocks live at exit is written to a file, and
+ * translated again on the next run before the guest first misses in the
+ * TB hash table.  Host code cannot be stored as such, since it embeds
+ * absolute host addresses (helpers, env, the code buffer itself), so
+ * the file records the lookup key of each block together with the guest
+ * code it was translated from.  An entry is only translated again when
+ * the current guest mapping of its PC resolves to the same RAM address
+ * and the guest code there is byte for byte identical.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/error-report.h"
+#include "qemu/notify.h"
+#include "qemu/rcu.h"
+#include "exec/cpu-all.h"
+#include "exec/exec-all.h"
+#include "exec/memory.h"
+#include "sysemu/sysemu.h"
+#include "tb-context.h"
+#include "internal-common.h"
+#include "internal-target.h"
+#include "trace.h"
+
+#define TB_CACHE_MAGIC    "QEMUTBC1"
+
+typedef struct TBCacheHeader {
+    char magic[8];
+    char target[16];
+    uint32_t page_bits;
+    uint32_t nb_entries;
+} TBCacheHeader;
+
+typedef struct TBCacheEntry {
+    uint64_t pc;
+    uint64_t cs_base;
+    uint64_t ram_addr;
+    uint32_t flags;
+    uint32_t cflags;
+    uint32_t size;
+    uint32_t reserved;
+    /* followed by @size bytes of guest code, padded to 8 bytes */
+} TBCacheEntry;
+
+#define TB_CACHE_ENTRY_LEN(e) (sizeof(TBCacheEntry) + ROUND_UP((e)->size, 8))
+
+bool tb_cache_pending;
+
+static char *tb_cache_path;
+static char *tb_cache_data;
+static gsize tb_cache_len;
+static Notifier tb_cache_exit_notifier;
+
+static void tb_cache_header_init(TBCacheHeader *hdr, uint32_t nb_entries)
+{
+    memset(hdr, 0, sizeof(*hdr));
+    memcpy(hdr->magic, TB_CACHE_MAGIC, sizeof(hdr->magic));
+    pstrcpy(hdr->target, sizeof(hdr->target), TARGET_NAME);
+    hdr->page_bits = TARGET_PAGE_BITS;
+    hdr->nb_entries = nb_entries;
+}
+
+static void tb_cache_save_one(void *p, uint32_t hash, void *userp)
+{
+    const TranslationBlock *tb = p;
+    GByteArray *buf = userp;
+    static const uint8_t pad[8];
+    TBCacheEntry e = { 0 };
+    uint32_t cflags = tb_cflags(tb);
+    void *host;
+
+    /*
+     * Without the virtual PC the block cannot be looked up again, and
+     * the guest code of a block spanning two pages is not contiguous
+     * in host memory.
+     */
+    if ((cflags & (CF_PCREL | CF_INVALID)) ||
+        tb_page_addr0(tb) == -1 || tb_page_addr1(tb) != -1) {
+        return;
+    }
+
+    host = qemu_map_ram_ptr(NULL, tb_page_addr0(tb));
+    e.pc = tb->pc;
+    e.cs_base = tb->cs_base;
+    e.ram_addr = tb_page_addr0(tb);
+    e.flags = tb->flags;
+    e.cflags = cflags;
+    e.size = tb->size;
+    g_byte_array_append(buf, (guint8 *)&e, sizeof(e));
+    g_byte_array_append(buf, host, e.size);
+    g_byte_array_append(buf, pad, ROUND_UP(e.size, 8) - e.size);
+    ((TBCacheHeader *)buf->data)->nb_entries++;
+}
+
+static void tb_cache_save(Notifier *n, void *data)
+{
+    g_autoptr(GError) err = NULL;
+    GByteArray *buf = g_byte_array_new();
+    TBCacheHeader hdr;
+
+    tb_cache_header_init(&hdr, 0);
+    g_byte_array_append(buf, (guint8 *)&hdr, sizeof(hdr));
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        qht_iter(&tb_ctx.htable, tb_cache_save_one, buf);
+    }
+
+    trace_tb_cache_save(tb_cache_path,
+                        ((TBCacheHeader *)buf->data)->nb_entries);
+    if (!g_file_set_contents(tb_cache_path, (char *)buf->data, buf->len,
+                             &err)) {
+        warn_report("tb-cache: failed to write %s: %s",
+                    tb_cache_path, err->message);
+    }
+    g_byte_array_free(buf, true);
+}
+
+void tb_cache_init(const char *path)
+{
+    g_autoptr(GError) err = NULL;
+    TBCacheHeader hdr;
+
+    tb_cache_path = g_strdup(path);
+    tb_cache_exit_notifier.notify = tb_cache_save;
+    qemu_add_exit_notifier(&tb_cache_exit_notifier);
+
+    if (!g_file_test(path, G_FILE_TEST_EXISTS)) {
+        return;
+    }
+    if (!g_file_get_contents(path, &tb_cache_data, &tb_cache_len, &err)) {
+        warn_report("tb-cache: failed to read %s: %s", path, err->message);
+        return;
+    }
+
+    tb_cache_header_init(&hdr, 0);
+    if (tb_cache_len < sizeof(hdr) ||
+        memcmp(tb_cache_data, &hdr, offsetof(TBCacheHeader, nb_entries))) {
+        warn_report("tb-cache: ignoring %s, not a cache for this target",
+                    path);
+        g_free(tb_cache_data);
+        tb_cache_data = NULL;
+        return;
+    }
+    qatomic_set(&tb_cache_pending, true);
+}
+
+/*
+ * Return true if the block described by @e can be translated again in
+ * the current context of @cpu with the same result.
+ */
+static bool tb_cache_entry_valid(CPUState *cpu, const TBCacheEntry *e,
+                                 uint32_t cflags)
+{
+    CPUArchState *env = cpu_env(cpu);
+    void *host;
+    int flags;
+
+    if (e->cflags != cflags || e->size == 0 ||
+        (e->pc & ~TARGET_PAGE_MASK) + e->size > TARGET_PAGE_SIZE) {
+        return false;
+    }
+
+    flags = probe_access_flags(env, e->pc, 1, MMU_INST_FETCH,
+                               cpu_mmu_index(cpu, true), true, &host, 0);
+    if ((flags & TLB_INVALID_MASK) || host == NULL ||
+        qemu_ram_addr_from_host_nofail(host) != e->ram_addr) {
+        return false;
+    }
+
+    return memcmp(host, e + 1, e->size) == 0;
+}
+
+void tb_cache_preload(CPUState *cpu)
+{
+    uint32_t cflags = curr_cflags(cpu);
+    char *data, *end, *p;
+    uint32_t loaded = 0, skipped = 0;
+
+    /* Only the first vcpu to miss in the hash table does this. */
+    if (!qatomic_xchg(&tb_cache_pending, false)) {
+        return;
+    }
+
+    /*
+     * tb_gen_code leaves through cpu_loop_exit when the code buffer
+     * fills up; the remaining entries are then simply dropped.
+     */
+    data = tb_cache_data;
+    end = data + tb_cache_len;
+
+    for (p = data + sizeof(TBCacheHeader);
+         p + sizeof(TBCacheEntry) <= end;
+         p += TB_CACHE_ENTRY_LEN((TBCacheEntry *)p)) {
+        TBCacheEntry *e = (TBCacheEntry *)p;
+
+        if (p + TB_CACHE_ENTRY_LEN(e) > end) {
+            break;
+        }
+        if (!tb_cache_entry_valid(cpu, e, cflags)) {
+            skipped++;
+            continue;
+        }
+
+        mmap_lock();
+        tb_gen_code(cpu, e->pc, e->cs_base, e->flags, cflags);
+        mmap_unlock();
+        loaded++;
+    }
+
+    trace_tb_cache_preload(loaded, skipped);
+    g_free(tb_cache_data);
+    tb_cache_data = NULL;
+}
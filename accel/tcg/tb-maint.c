@@ -182,8 +182,16 @@ struct PageDesc {
     QemuSpin lock;
     /* list of TBs intersecting this ram page */
     uintptr_t first_tb;
+    /*
+     * One bit per 1/64th of the page that may hold translated code.
+     * Bits are set when a TB is added and only cleared when the page
+     * is invalidated, so this is a superset of the code in the page.
+     */
+    uint64_t code_bitmap;
 };
 
+#define PAGE_CODE_BITMAP_SHIFT  (TARGET_PAGE_BITS - 6)
+
 void page_table_config_init(void)
 {
     uint32_t v_l1_bits;
@@ -312,6 +320,42 @@ typedef int PageForEachNext;
 #define PAGE_FOR_EACH_TB(start, last, pagedesc, tb, n) \
     TB_FOR_EACH_TAGGED((pagedesc)->first_tb, tb, n, page_next)
 
+/* Return in [@pstart, @plast] the bytes of @tb on its @n-th page. */
+static void tb_page_range(const TranslationBlock *tb, int n,
+                          tb_page_addr_t *pstart, tb_page_addr_t *plast)
+{
+    tb_page_addr_t tb_start, tb_last;
+
+    /* NOTE: this is subtle as a TB may span two physical pages */
+    tb_start = tb_page_addr0(tb);
+    tb_last = tb_start + tb->size - 1;
+    if (n == 0) {
+        tb_last = MIN(tb_last, tb_start | ~TARGET_PAGE_MASK);
+    } else {
+        tb_start = tb_page_addr1(tb);
+        tb_last = tb_start + (tb_last & ~TARGET_PAGE_MASK);
+    }
+    *pstart = tb_start;
+    *plast = tb_last;
+}
+
+/* Return the bits of PageDesc.code_bitmap covering [@start, @last]. */
+static uint64_t page_code_mask(tb_page_addr_t start, tb_page_addr_t last)
+{
+    unsigned first = (start & ~TARGET_PAGE_MASK) >> PAGE_CODE_BITMAP_SHIFT;
+    unsigned final = (last & ~TARGET_PAGE_MASK) >> PAGE_CODE_BITMAP_SHIFT;
+
+    return MAKE_64BIT_MASK(first, final - first + 1);
+}
+
+static uint64_t tb_page_code_mask(const TranslationBlock *tb, int n)
+{
+    tb_page_addr_t start, last;
+
+    tb_page_range(tb, n, &start, &last);
+    return page_code_mask(start, last);
+}
+
 #ifdef CONFIG_DEBUG_TCG
 
 static __thread GHashTable *ht_pages_locked_debug;
@@ -663,6 +707,7 @@ static void tb_remove_all_1(int level, void **lp)
         for (i = 0; i < V_L2_SIZE; ++i) {
             page_lock(&pd[i]);
             pd[i].first_tb = (uintptr_t)NULL;
+            pd[i].code_bitmap = 0;
             page_unlock(&pd[i]);
         }
     } else {
@@ -695,7 +740,9 @@ static void tb_page_add(PageDesc *p, TranslationBlock *tb, unsigned int n)
 
     tb->page_next[n] = p->first_tb;
     page_already_protected = p->first_tb != 0;
-    p->first_tb = (uintptr_t)tb | n;
+    qatomic_set(&p->code_bitmap, p->code_bitmap | tb_page_code_mask(tb, n));
+    /* pairs with tb_invalidate_phys_range_unlocked */
+    qatomic_store_release(&p->first_tb, (uintptr_t)tb | n);
 
     /*
      * If some code is already present, then the pages are already
@@ -731,7 +778,11 @@ static void tb_page_remove(PageDesc *pd, TranslationBlock *tb)
     pprev = &pd->first_tb;
     PAGE_FOR_EACH_TB(unused, unused, pd, tb1, n1) {
         if (tb1 == tb) {
-            *pprev = tb1->page_next[n1];
+            /*
+             * Leave tb->page_next intact, so that a lockless walker
+             * standing on @tb can still reach the rest of the list.
+             */
+            qatomic_set(pprev, tb1->page_next[n1]);
             return;
         }
         pprev = &tb1->page_next[n1];
@@ -963,6 +1014,65 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
     }
 }
 
+static void tb_evict_one(TranslationBlock *tb)
+{
+    if (tb_page_addr0(tb) == -1) {
+        /* One-shot TBs are only reachable through the jump cache */
+        tb_jmp_cache_inval_tb(tb);
+    } else {
+        tb_phys_invalidate(tb, -1);
+    }
+}
+
+/* evict the oldest code region, or flush everything if there is none */
+static void do_tb_evict(CPUState *cpu, run_on_cpu_data tb_reclaim_count)
+{
+    bool did_evict = false;
+    unsigned count;
+
+    mmap_lock();
+    /*
+     * If space has already been reclaimed on request of another CPU,
+     * just retry.
+     */
+    count = tb_ctx.tb_flush_count + tb_ctx.tb_evict_count;
+    if (count != tb_reclaim_count.host_int) {
+        mmap_unlock();
+        return;
+    }
+
+    qemu_thread_jit_write();
+    did_evict = tcg_region_evict(tb_evict_one);
+    qemu_thread_jit_execute();
+    if (did_evict) {
+        qatomic_inc(&tb_ctx.tb_evict_count);
+    }
+    mmap_unlock();
+
+    if (did_evict) {
+        qemu_plugin_flush_cb();
+    } else {
+        do_tb_flush(cpu, RUN_ON_CPU_HOST_INT(tb_ctx.tb_flush_count));
+    }
+}
+
+/*
+ * Make room in the code buffer.  Unlike tb_flush, this only discards the
+ * TBs of the code region that filled up first, so that the hot code of a
+ * large guest does not have to be translated again all at once.
+ */
+void tb_evict(CPUState *cpu)
+{
+    unsigned count = qatomic_read(&tb_ctx.tb_flush_count) +
+                     qatomic_read(&tb_ctx.tb_evict_count);
+
+    if (cpu_in_serial_context(cpu)) {
+        do_tb_evict(cpu, RUN_ON_CPU_HOST_INT(count));
+    } else {
+        async_safe_run_on_cpu(cpu, do_tb_evict, RUN_ON_CPU_HOST_INT(count));
+    }
+}
+
 /*
  * Add a new TB and link it to the physical page tables.
  * Called with mmap_lock held for user-mode emulation.
@@ -1089,6 +1199,19 @@ bool tb_invalidate_phys_page_unwind(tb_page_addr_t addr, uintptr_t pc)
     return false;
 }
 #else
+/*
+ * Return true if the part of @tb on its @n-th page intersects
+ * [@start, @last].
+ */
+static bool tb_page_overlaps(const TranslationBlock *tb, int n,
+                             tb_page_addr_t start, tb_page_addr_t last)
+{
+    tb_page_addr_t tb_start, tb_last;
+
+    tb_page_range(tb, n, &tb_start, &tb_last);
+    return !(tb_last < start || tb_start > last);
+}
+
 /*
  * @p must be non-NULL.
  * Call with all @pages locked.
@@ -1101,6 +1224,7 @@ tb_invalidate_phys_page_range__locked(struct page_collection *pages,
 {
     TranslationBlock *tb;
     PageForEachNext n;
+    uint64_t code_bitmap;
 #ifdef TARGET_HAS_PRECISE_SMC
     bool current_tb_modified = false;
     TranslationBlock *current_tb = retaddr ? tcg_tb_lookup(retaddr) : NULL;
@@ -1114,18 +1238,7 @@ tb_invalidate_phys_page_range__locked(struct page_collection *pages,
      * XXX: see if in some cases it could be faster to invalidate all the code
      */
     PAGE_FOR_EACH_TB(start, last, p, tb, n) {
-        tb_page_addr_t tb_start, tb_last;
-
-        /* NOTE: this is subtle as a TB may span two physical pages */
-        tb_start = tb_page_addr0(tb);
-        tb_last = tb_start + tb->size - 1;
-        if (n == 0) {
-            tb_last = MIN(tb_last, tb_start | ~TARGET_PAGE_MASK);
-        } else {
-            tb_start = tb_page_addr1(tb);
-            tb_last = tb_start + (tb_last & ~TARGET_PAGE_MASK);
-        }
-        if (!(tb_last < start || tb_start > last)) {
+        if (tb_page_overlaps(tb, n, start, last)) {
 #ifdef TARGET_HAS_PRECISE_SMC
             if (current_tb == tb &&
                 (tb_cflags(current_tb) & CF_COUNT_MASK) != 1) {
@@ -1149,6 +1262,13 @@ tb_invalidate_phys_page_range__locked(struct page_collection *pages,
         tlb_unprotect_code(start);
     }
 
+    /* drop the bits of the TBs that were just removed */
+    code_bitmap = 0;
+    PAGE_FOR_EACH_TB(start, last, p, tb, n) {
+        code_bitmap |= tb_page_code_mask(tb, n);
+    }
+    qatomic_set(&p->code_bitmap, code_bitmap);
+
 #ifdef TARGET_HAS_PRECISE_SMC
     if (current_tb_modified) {
         page_collection_unlock(pages);
@@ -1215,12 +1335,67 @@ static void tb_invalidate_phys_page_fast__locked(struct page_collection *pages,
  * Called via softmmu_template.h when code areas are written to with
  * iothread mutex not held.
  */
+/*
+ * Return true if a write to [@start, @last], within a single page, is
+ * known not to hit any TB, without taking any page lock.
+ *
+ * Writes to data that shares a page with code are frequent, and locking
+ * the page together with the pages of all its TBs for each of them
+ * serializes vCPUs that have nothing to invalidate.  The TB list of a
+ * page is only ever pushed at its head with a release store, and TBs are
+ * unlinked without touching their own link, so walking it locklessly
+ * sees a consistent list.  TBs are only freed in a safe-work context,
+ * during which no vCPU is running this.
+ *
+ * A page that is locked may be getting a TB added by a concurrent
+ * translation, and a page that has no TB left must be unprotected under
+ * its lock, so both cases take the slow path.  Otherwise the result is
+ * the same as if the page had been locked at the time of the check.
+ */
+static bool tb_invalidate_phys_range_unlocked(tb_page_addr_t start,
+                                              tb_page_addr_t last)
+{
+    PageDesc *p = page_find(start >> TARGET_PAGE_BITS);
+    TranslationBlock *tb;
+    uintptr_t next;
+    int n;
+
+    if (p == NULL) {
+        return true;
+    }
+    if (qemu_spin_locked(&p->lock)) {
+        return false;
+    }
+
+    next = qatomic_load_acquire(&p->first_tb);
+    if (next == 0) {
+        return false;
+    }
+    if (!(qatomic_read(&p->code_bitmap) & page_code_mask(start, last))) {
+        return true;
+    }
+    do {
+        n = next & 1;
+        tb = (TranslationBlock *)(next & ~1);
+        if (tb_page_overlaps(tb, n, start, last)) {
+            return false;
+        }
+        next = qatomic_load_acquire(&tb->page_next[n]);
+    } while (next);
+
+    return true;
+}
+
 void tb_invalidate_phys_range_fast(ram_addr_t ram_addr,
                                    unsigned size,
                                    uintptr_t retaddr)
 {
     struct page_collection *pages;
 
+    if (tb_invalidate_phys_range_unlocked(ram_addr, ram_addr + size - 1)) {
+        return;
+    }
+
     pages = page_collection_lock(ram_addr, ram_addr + size - 1);
     tb_invalidate_phys_page_fast__locked(pages, ram_addr, size, retaddr);
     page_collection_unlock(pages);
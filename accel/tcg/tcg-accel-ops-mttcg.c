@@ -33,6 +33,7 @@
 #include "exec/exec-all.h"
 #include "hw/boards.h"
 #include "tcg/startup.h"
+#include "internal-common.h"
 #include "tcg-accel-ops.h"
 #include "tcg-accel-ops-mttcg.h"
 
@@ -84,6 +85,7 @@ static void *mttcg_cpu_thread_fn(void *arg)
     current_cpu = cpu;
     cpu_thread_signal_created(cpu);
     qemu_guest_random_seed_thread_part2(cpu->random_seed);
+    tcg_profile_thread_init(cpu);
 
     /* process any pending work */
     cpu->exit_request = 1;
@@ -145,6 +147,5 @@ void mttcg_start_vcpu_thread(CPUState *cpu)
     snprintf(thread_name, VCPU_THREAD_NAME_SIZE, "CPU %d/TCG",
              cpu->cpu_index);
 
-    qemu_thread_create(cpu->thread, thread_name, mttcg_cpu_thread_fn,
-                       cpu, QEMU_THREAD_JOINABLE);
+    cpu_thread_create(cpu, thread_name, mttcg_cpu_thread_fn);
 }
@@ -33,6 +33,7 @@
 #include "qemu/guest-random.h"
 #include "exec/exec-all.h"
 #include "tcg/startup.h"
+#include "internal-common.h"
 #include "tcg-accel-ops.h"
 #include "tcg-accel-ops-rr.h"
 #include "tcg-accel-ops-icount.h"
@@ -195,6 +196,7 @@ static void *rr_cpu_thread_fn(void *arg)
     cpu->neg.can_do_io = true;
     cpu_thread_signal_created(cpu);
     qemu_guest_random_seed_thread_part2(cpu->random_seed);
+    tcg_profile_thread_init(cpu);
 
     /* wait for initial kick-off after machine start */
     while (first_cpu->stopped) {
@@ -323,9 +325,7 @@ void rr_start_vcpu_thread(CPUState *cpu)
 
         /* share a single thread for all cpus with TCG */
         snprintf(thread_name, VCPU_THREAD_NAME_SIZE, "ALL CPUs/TCG");
-        qemu_thread_create(cpu->thread, thread_name,
-                           rr_cpu_thread_fn,
-                           cpu, QEMU_THREAD_JOINABLE);
+        cpu_thread_create(cpu, thread_name, rr_cpu_thread_fn);
 
         single_tcg_halt_cond = cpu->halt_cond;
         single_tcg_cpu_thread = cpu->thread;
@@ -37,6 +37,7 @@
 #include "exec/tb-flush.h"
 #include "exec/gdbstub.h"
 
+#include "internal-common.h"
 #include "tcg-accel-ops.h"
 #include "tcg-accel-ops-mttcg.h"
 #include "tcg-accel-ops-rr.h"
@@ -61,6 +62,11 @@ void tcg_cpu_init_cflags(CPUState *cpu, bool parallel)
     cflags |= parallel ? CF_PARALLEL : 0;
     cflags |= icount_enabled() ? CF_USE_ICOUNT : 0;
     cpu->tcg_cflags |= cflags;
+
+    /* The profiler needs the guest PC of each TB */
+    if (tcg_profile_enabled()) {
+        cpu->tcg_cflags &= ~CF_PCREL;
+    }
 }
 
 void tcg_cpu_destroy(CPUState *cpu)
@@ -74,6 +80,8 @@ int tcg_cpu_exec(CPUState *cpu)
     assert(tcg_enabled());
     cpu_exec_start(cpu);
     ret = cpu_exec(cpu);
+    /* Before any TB flush can reuse the code the samples point into */
+    tcg_profile_drain();
     cpu_exec_end(cpu);
     return ret;
 }
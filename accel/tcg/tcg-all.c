@@ -35,6 +35,7 @@
 #include "qemu/atomic.h"
 #include "qapi/qapi-builtin-visit.h"
 #include "qemu/units.h"
+#include "qemu/host-utils.h"
 #if !defined(CONFIG_USER_ONLY)
 #include "hw/boards.h"
 #endif
@@ -47,6 +48,15 @@ struct TCGState {
     bool one_insn_per_tb;
     int splitwx_enabled;
     unsigned long tb_size;
+    bool tb_hugepages;
+    bool tb_cold_code;
+    uint32_t tb_region_size;
+    char *tb_cache;
+    char *profile;
+    uint32_t profile_hz;
+    uint32_t tlb_victim_size;
+    uint32_t tlb_victim_ways;
+    uint32_t tlb_min_bits;
 };
 typedef struct TCGState TCGState;
 
@@ -88,6 +98,11 @@ static void tcg_accel_instance_init(Object *obj)
     TCGState *s = TCG_STATE(obj);
 
     s->mttcg_enabled = default_mttcg_enabled();
+#ifndef CONFIG_USER_ONLY
+    s->tlb_victim_size = CPU_VTLB_SIZE;
+    s->tlb_min_bits = CPU_TLB_DYN_MIN_BITS;
+    s->profile_hz = 1000;
+#endif
 
     /* If debugging enabled, default "auto on", otherwise off. */
 #if defined(CONFIG_DEBUG_TCG) && !defined(CONFIG_USER_ONLY)
@@ -99,6 +114,7 @@ static void tcg_accel_instance_init(Object *obj)
 
 bool mttcg_enabled;
 bool one_insn_per_tb;
+uint32_t tb_warmup;
 
 static int tcg_init_machine(MachineState *ms)
 {
@@ -114,6 +130,8 @@ static int tcg_init_machine(MachineState *ms)
 
     page_init();
     tb_htable_init();
+    tcg_region_set_layout(s->tb_hugepages, s->tb_region_size * MiB,
+                          s->tb_cold_code);
     tcg_init(s->tb_size * MiB, s->splitwx_enabled, max_cpus);
 
 #if defined(CONFIG_SOFTMMU)
@@ -124,6 +142,31 @@ static int tcg_init_machine(MachineState *ms)
     tcg_prologue_init();
 #endif
 
+#ifndef CONFIG_USER_ONLY
+    if (s->tb_cache) {
+        tb_cache_init(s->tb_cache);
+    }
+    if (s->profile) {
+        Error *local_err = NULL;
+
+        if (!tcg_profile_init(s->profile, s->profile_hz, &local_err)) {
+            error_report_err(local_err);
+            return -1;
+        }
+    }
+
+    /* Without tlb-victim-ways, the victim tlb stays fully associative. */
+    if (!s->tlb_victim_ways) {
+        s->tlb_victim_ways = s->tlb_victim_size;
+    }
+    if (s->tlb_victim_ways > s->tlb_victim_size) {
+        error_report("tlb-victim-ways must not exceed tlb-victim-size");
+        return -1;
+    }
+    tlb_set_geometry(s->tlb_victim_size, s->tlb_victim_ways,
+                     s->tlb_min_bits);
+#endif
+
     return 0;
 }
 
@@ -181,6 +224,189 @@ static void tcg_set_tb_size(Object *obj, Visitor *v,
     s->tb_size = value;
 }
 
+static bool tcg_get_tb_hugepages(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    return s->tb_hugepages;
+}
+
+static void tcg_set_tb_hugepages(Object *obj, bool value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    s->tb_hugepages = value;
+}
+
+static bool tcg_get_tb_cold_code(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    return s->tb_cold_code;
+}
+
+static void tcg_set_tb_cold_code(Object *obj, bool value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    s->tb_cold_code = value;
+}
+
+#ifndef CONFIG_USER_ONLY
+static void tcg_get_tb_region_size(Object *obj, Visitor *v,
+                                   const char *name, void *opaque,
+                                   Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    visit_type_uint32(v, name, &s->tb_region_size, errp);
+}
+
+static void tcg_set_tb_region_size(Object *obj, Visitor *v,
+                                   const char *name, void *opaque,
+                                   Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+
+    s->tb_region_size = value;
+}
+#endif
+
+#ifndef CONFIG_USER_ONLY
+static char *tcg_get_tb_cache(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    return g_strdup(s->tb_cache);
+}
+
+static void tcg_set_tb_cache(Object *obj, const char *value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    g_free(s->tb_cache);
+    s->tb_cache = g_strdup(value);
+}
+
+static char *tcg_get_profile(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    return g_strdup(s->profile);
+}
+
+static void tcg_set_profile(Object *obj, const char *value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    g_free(s->profile);
+    s->profile = g_strdup(value);
+}
+
+static void tcg_get_profile_hz(Object *obj, Visitor *v,
+                               const char *name, void *opaque,
+                               Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    visit_type_uint32(v, name, &s->profile_hz, errp);
+}
+
+static void tcg_set_profile_hz(Object *obj, Visitor *v,
+                               const char *name, void *opaque,
+                               Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+
+    s->profile_hz = value;
+}
+#endif
+
+static void tcg_get_tb_warmup(Object *obj, Visitor *v,
+                              const char *name, void *opaque,
+                              Error **errp)
+{
+    uint32_t value = qatomic_read(&tb_warmup);
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_tb_warmup(Object *obj, Visitor *v,
+                              const char *name, void *opaque,
+                              Error **errp)
+{
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (value > UINT16_MAX) {
+        error_setg(errp, "'%s' must be at most %u", name, UINT16_MAX);
+        return;
+    }
+
+    qatomic_set(&tb_warmup, value);
+}
+
+#ifndef CONFIG_USER_ONLY
+static void tcg_get_tlb_param(Object *obj, Visitor *v,
+                              const char *name, void *opaque,
+                              Error **errp)
+{
+    uint32_t *ptr = (uint32_t *)((char *)obj + (uintptr_t)opaque);
+
+    visit_type_uint32(v, name, ptr, errp);
+}
+
+static void tcg_set_tlb_victim(Object *obj, Visitor *v,
+                               const char *name, void *opaque,
+                               Error **errp)
+{
+    uint32_t *ptr = (uint32_t *)((char *)obj + (uintptr_t)opaque);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (!is_power_of_2(value) || value > CPU_VTLB_MAX_SIZE) {
+        error_setg(errp, "'%s' must be a power of 2, at most %d", name,
+                   CPU_VTLB_MAX_SIZE);
+        return;
+    }
+
+    *ptr = value;
+}
+
+static void tcg_set_tlb_min_bits(Object *obj, Visitor *v,
+                                 const char *name, void *opaque,
+                                 Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (value < CPU_TLB_DYN_MIN_BITS || value > CPU_TLB_DYN_MAX_BITS) {
+        error_setg(errp, "'%s' must be between %d and %d", name,
+                   CPU_TLB_DYN_MIN_BITS, CPU_TLB_DYN_MAX_BITS);
+        return;
+    }
+
+    s->tlb_min_bits = value;
+}
+#endif
+
 static bool tcg_get_splitwx(Object *obj, Error **errp)
 {
     TCGState *s = TCG_STATE(obj);
@@ -242,6 +468,66 @@ static void tcg_accel_class_init(ObjectClass *oc, void *data)
     object_class_property_set_description(oc, "tb-size",
         "TCG translation block cache size");
 
+    object_class_property_add_bool(oc, "tb-hugepages",
+        tcg_get_tb_hugepages, tcg_set_tb_hugepages);
+    object_class_property_set_description(oc, "tb-hugepages",
+        "Back the translation block cache with huge pages");
+
+    object_class_property_add_bool(oc, "tb-cold-code",
+        tcg_get_tb_cold_code, tcg_set_tb_cold_code);
+    object_class_property_set_description(oc, "tb-cold-code",
+        "Keep TCG slow paths apart from the translation blocks");
+
+    object_class_property_add(oc, "tb-warmup", "int",
+        tcg_get_tb_warmup, tcg_set_tb_warmup,
+        NULL, NULL);
+    object_class_property_set_description(oc, "tb-warmup",
+        "Executions of a translation block before it is optimized");
+
+#ifndef CONFIG_USER_ONLY
+    object_class_property_add_str(oc, "tb-cache",
+                                  tcg_get_tb_cache,
+                                  tcg_set_tb_cache);
+    object_class_property_set_description(oc, "tb-cache",
+        "File in which translation blocks are kept between runs");
+
+    object_class_property_add_str(oc, "profile",
+                                  tcg_get_profile,
+                                  tcg_set_profile);
+    object_class_property_set_description(oc, "profile",
+        "File to which a sampled profile of the guest code is written");
+
+    object_class_property_add(oc, "profile-hz", "int",
+        tcg_get_profile_hz, tcg_set_profile_hz,
+        NULL, NULL);
+    object_class_property_set_description(oc, "profile-hz",
+        "Samples per second of vCPU time taken by the profiler");
+
+    object_class_property_add(oc, "tb-region-size", "int",
+        tcg_get_tb_region_size, tcg_set_tb_region_size,
+        NULL, NULL);
+    object_class_property_set_description(oc, "tb-region-size",
+        "Size in MiB of each per-vCPU region of the translation cache");
+
+    object_class_property_add(oc, "tlb-victim-size", "int",
+        tcg_get_tlb_param, tcg_set_tlb_victim, NULL,
+        (void *)offsetof(TCGState, tlb_victim_size));
+    object_class_property_set_description(oc, "tlb-victim-size",
+        "Number of entries of the victim TLB of each MMU mode");
+
+    object_class_property_add(oc, "tlb-victim-ways", "int",
+        tcg_get_tlb_param, tcg_set_tlb_victim, NULL,
+        (void *)offsetof(TCGState, tlb_victim_ways));
+    object_class_property_set_description(oc, "tlb-victim-ways",
+        "Associativity of the victim TLB (default: fully associative)");
+
+    object_class_property_add(oc, "tlb-min-bits", "int",
+        tcg_get_tlb_param, tcg_set_tlb_min_bits, NULL,
+        (void *)offsetof(TCGState, tlb_min_bits));
+    object_class_property_set_description(oc, "tlb-min-bits",
+        "Log2 of the minimum number of entries of the dynamic TLB");
+#endif
+
     object_class_property_add_bool(oc, "split-wx",
         tcg_get_splitwx, tcg_set_splitwx);
     object_class_property_set_description(oc, "split-wx",
@@ -254,6 +254,24 @@ bool cpu_unwind_state_data(CPUState *cpu, uintptr_t host_pc, uint64_t *data)
     return false;
 }
 
+bool tb_host_pc_to_guest(uintptr_t host_pc, vaddr *pc)
+{
+    uint64_t data[TARGET_INSN_START_WORDS];
+    TranslationBlock *tb;
+
+    if (!in_code_gen_buffer((const void *)(host_pc - tcg_splitwx_diff))) {
+        return false;
+    }
+    tb = tcg_tb_lookup(host_pc);
+    /* Unlike a return address, @host_pc is within the insn it executes */
+    if (!tb || (tb_cflags(tb) & CF_PCREL) ||
+        cpu_unwind_data_from_tb(tb, host_pc + GETPC_ADJ, data) < 0) {
+        return false;
+    }
+    *pc = data[0];
+    return true;
+}
+
 void page_init(void)
 {
     page_size_init();
@@ -285,9 +303,10 @@ static int setjmp_gen_code(CPUArchState *env, TranslationBlock *tb,
 }
 
 /* Called with mmap_lock held for user mode emulation.  */
-TranslationBlock *tb_gen_code(CPUState *cpu,
-                              vaddr pc, uint64_t cs_base,
-                              uint32_t flags, int cflags)
+static TranslationBlock *tb_gen_code_warmup(CPUState *cpu,
+                                            vaddr pc, uint64_t cs_base,
+                                            uint32_t flags, int cflags,
+                                            uint32_t warmup, bool hot)
 {
     CPUArchState *env = cpu_env(cpu);
     TranslationBlock *tb, *existing_tb;
@@ -317,8 +336,8 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     assert_no_pages_locked();
     tb = tcg_tb_alloc(tcg_ctx);
     if (unlikely(!tb)) {
-        /* flush must be done */
-        tb_flush(cpu);
+        /* eviction or flush must be done */
+        tb_evict(cpu);
         mmap_unlock();
         /* Make the execution loop process the flush as soon as possible.  */
         cpu->exception_index = EXCP_INTERRUPT;
@@ -333,6 +352,12 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb->cs_base = cs_base;
     tb->flags = flags;
     tb->cflags = cflags;
+    /* One-shot and single-step blocks are not worth optimizing later. */
+    if (cflags & (CF_COUNT_MASK | CF_NOIRQ | CF_SINGLE_STEP)) {
+        warmup = 0;
+    }
+    tb->warmup = warmup;
+    tb->hot = hot;
     tb_set_page_addr0(tb, phys_pc);
     tb_set_page_addr1(tb, -1);
     if (phys_pc != -1) {
@@ -564,6 +589,29 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     return tb;
 }
 
+TranslationBlock *tb_gen_code(CPUState *cpu,
+                              vaddr pc, uint64_t cs_base,
+                              uint32_t flags, int cflags)
+{
+    return tb_gen_code_warmup(cpu, pc, cs_base, flags, cflags,
+                              qatomic_read(&tb_warmup), false);
+}
+
+/*
+ * Called with mmap_lock held for user mode emulation, once @tb, which
+ * was translated without optimization, has run tb_warmup times.
+ * Replace it with an optimized translation, which is marked hot.
+ */
+TranslationBlock *tb_optimize(CPUState *cpu, TranslationBlock *tb, vaddr pc)
+{
+    uint64_t cs_base = tb->cs_base;
+    uint32_t flags = tb->flags;
+    uint32_t cflags = tb_cflags(tb);
+
+    tb_phys_invalidate(tb, -1);
+    return tb_gen_code_warmup(cpu, pc, cs_base, flags, cflags, 0, true);
+}
+
 /* user-mode: call with mmap_lock held */
 void tb_check_watchpoint(CPUState *cpu, uintptr_t retaddr)
 {
@@ -633,6 +681,7 @@ void cpu_io_recompile(CPUState *cpu, uintptr_t retaddr)
      * double instrument the instruction.
      */
     cpu->cflags_next_tb = curr_cflags(cpu) | CF_MEMI_ONLY | n;
+    cpu->tcg_exits[TCG_EXIT_CAUSE_IO]++;
 
     if (qemu_loglevel_mask(CPU_LOG_EXEC)) {
         vaddr pc = log_pc(cpu, tb);
@@ -645,6 +694,38 @@ void cpu_io_recompile(CPUState *cpu, uintptr_t retaddr)
     cpu_loop_exit_noexc(cpu);
 }
 
+/*
+ * With -icount iosync=tb, I/O instructions in the middle of a TB are not
+ * moved to a TB of their own.  The budget was charged for the whole TB
+ * on entry, so tell the icount code how much of it does not run before
+ * the access; the guest then sees the same time as with iosync=insn.
+ * Interrupts raised by the access are only taken at the end of the TB.
+ */
+void cpu_io_sync_begin(CPUState *cpu, uintptr_t retaddr)
+{
+    uint64_t data[TARGET_INSN_START_WORDS];
+    TranslationBlock *tb;
+    int insns_left;
+
+    tb = tcg_tb_lookup(retaddr);
+    if (!tb) {
+        cpu_abort(cpu, "cpu_io_sync_begin: could not find TB for pc=%p",
+                  (void *)retaddr);
+    }
+    insns_left = cpu_unwind_data_from_tb(tb, retaddr, data);
+    assert(insns_left > 0);
+
+    /* The I/O instruction itself counts as executed */
+    cpu->icount_io_pending = insns_left - 1;
+    cpu->neg.can_do_io = true;
+}
+
+void cpu_io_sync_end(CPUState *cpu)
+{
+    cpu->icount_io_pending = 0;
+    cpu->neg.can_do_io = false;
+}
+
 #else /* CONFIG_USER_ONLY */
 
 void cpu_interrupt(CPUState *cpu, int mask)
@@ -123,6 +123,16 @@ bool translator_use_goto_tb(DisasContextBase *db, vaddr dest)
     return ((db->pc_first ^ dest) & TARGET_PAGE_MASK) == 0;
 }
 
+bool translator_follow_jump(DisasContextBase *db, vaddr dest)
+{
+    if (!db->tb->hot || db->singlestep_enabled || db->plugin_enabled ||
+        (tb_cflags(db->tb) & (CF_PCREL | CF_NO_GOTO_TB))) {
+        return false;
+    }
+
+    return dest > db->pc_next && is_same_page(db, dest);
+}
+
 void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
                      vaddr pc, void *host_pc, const TranslatorOps *ops,
                      DisasContextBase *db)
@@ -23,6 +23,7 @@
 #include "tcg/tcg.h"
 #include "qemu/bitops.h"
 #include "qemu/rcu.h"
+#include "qemu/seqlock.h"
 #include "exec/cpu_ldst.h"
 #include "exec/translate-all.h"
 #include "exec/helper-proto.h"
@@ -145,6 +146,14 @@ typedef struct PageFlagsNode {
 
 static IntervalTreeRoot pageflags_root;
 
+/*
+ * Bumped around every modification of pageflags_root; writers are
+ * serialized by the mmap_lock.  A lockless lookup that found nothing
+ * while no modification was in progress is a true negative, and does
+ * not need to be retried with the mmap_lock held.
+ */
+static QemuSeqLock pageflags_seq;
+
 static PageFlagsNode *pageflags_find(target_ulong start, target_ulong last)
 {
     IntervalTreeNode *n;
@@ -208,17 +217,18 @@ void page_dump(FILE *f)
 
 int page_get_flags(target_ulong address)
 {
+    unsigned seq = seqlock_read_begin(&pageflags_seq);
     PageFlagsNode *p = pageflags_find(address, address);
 
     /*
      * See util/interval-tree.c re lockless lookups: no false positives but
-     * there are false negatives.  If we find nothing, retry with the mmap
-     * lock acquired.
+     * there are false negatives.  If we find nothing while the tree was
+     * being modified, retry with the mmap lock acquired.
      */
     if (p) {
         return p->flags;
     }
-    if (have_mmap_lock()) {
+    if (have_mmap_lock() || !seqlock_read_retry(&pageflags_seq, seq)) {
         return 0;
     }
 
@@ -508,6 +518,7 @@ void page_set_flags(target_ulong start, target_ulong last, int flags)
         }
     }
 
+    seqlock_write_begin(&pageflags_seq);
     if (!flags || reset) {
         page_reset_target_data(start, last);
         inval_tb |= pageflags_unset(start, last);
@@ -516,6 +527,7 @@ void page_set_flags(target_ulong start, target_ulong last, int flags)
         inval_tb |= pageflags_set_clear(start, last, flags,
                                         ~(reset ? 0 : PAGE_STICKY));
     }
+    seqlock_write_end(&pageflags_seq);
     if (inval_tb) {
         tb_invalidate_phys_range(start, last);
     }
@@ -538,14 +550,15 @@ bool page_check_range(target_ulong start, target_ulong len, int flags)
 
     locked = have_mmap_lock();
     while (true) {
+        unsigned seq = seqlock_read_begin(&pageflags_seq);
         PageFlagsNode *p = pageflags_find(start, last);
         int missing;
 
         if (!p) {
-            if (!locked) {
+            if (!locked && seqlock_read_retry(&pageflags_seq, seq)) {
                 /*
-                 * Lockless lookups have false negatives.
-                 * Retry with the lock held.
+                 * Lockless lookups have false negatives while the tree
+                 * is modified.  Retry with the lock held.
                  */
                 mmap_lock();
                 locked = -1;
@@ -678,7 +691,9 @@ void page_protect(tb_page_addr_t address)
     }
 
     if (prot & PAGE_WRITE) {
+        seqlock_write_begin(&pageflags_seq);
         pageflags_set_clear(start, last, 0, PAGE_WRITE);
+        seqlock_write_end(&pageflags_seq);
         mprotect(g2h_untagged(start), qemu_host_page_size,
                  prot & (PAGE_READ | PAGE_EXEC) ? PROT_READ : PROT_NONE);
     }
@@ -732,7 +747,9 @@ int page_unprotect(target_ulong address, uintptr_t pc)
             start = address & TARGET_PAGE_MASK;
             len = TARGET_PAGE_SIZE;
             prot = p->flags | PAGE_WRITE;
+            seqlock_write_begin(&pageflags_seq);
             pageflags_set_clear(start, start + len - 1, PAGE_WRITE, 0);
+            seqlock_write_end(&pageflags_seq);
             current_tb_invalidated = tb_invalidate_phys_page_unwind(start, pc);
         } else {
             start = address & qemu_host_page_mask;
@@ -747,8 +764,10 @@ int page_unprotect(target_ulong address, uintptr_t pc)
                     prot |= p->flags;
                     if (p->flags & PAGE_WRITE_ORG) {
                         prot |= PAGE_WRITE;
+                        seqlock_write_begin(&pageflags_seq);
                         pageflags_set_clear(addr, addr + TARGET_PAGE_SIZE - 1,
                                             PAGE_WRITE, 0);
+                        seqlock_write_end(&pageflags_seq);
                     }
                 }
                 /*
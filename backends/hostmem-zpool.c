@@ -0,0 +1,587 @@
+/*
+ * QEMU host memory backend compressing idle guest pages
+ *
+ * Anonymous RAM whose cold pages are moved into a zstd compressed pool
+ * inside QEMU and brought back on fault through userfaultfd, much like
+ * zswap does for the host.  A scanner thread ages the resident pages:
+ * every page it visits is write-protected, a write fault makes it young
+ * again, and a page that stayed unwritten for cold-age scans is
+ * compressed and dropped.  Reads cannot be observed this way, so a page
+ * that is only read is evicted and faulted back once per cold-age scans.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <zstd.h>
+#include "sysemu/hostmem.h"
+#include "exec/memory.h"
+#include "qapi/error.h"
+#include "qapi/visitor.h"
+#include "qemu/bitmap.h"
+#include "qemu/cutils.h"
+#include "qemu/error-report.h"
+#include "qemu/event_notifier.h"
+#include "qemu/main-loop.h"
+#include "qemu/module.h"
+#include "qemu/thread.h"
+#include "qemu/userfaultfd.h"
+#include "qom/object_interfaces.h"
+#include "trace.h"
+
+#define TYPE_MEMORY_BACKEND_ZPOOL "memory-backend-zpool"
+
+OBJECT_DECLARE_SIMPLE_TYPE(HostMemoryBackendZpool, MEMORY_BACKEND_ZPOOL)
+
+#define ZPOOL_FAULT_BATCH   16
+
+typedef struct ZpoolSlot {
+    uint32_t len;
+    uint8_t data[];
+} ZpoolSlot;
+
+struct HostMemoryBackendZpool {
+    HostMemoryBackend parent_obj;
+
+    uint32_t scan_interval;     /* ms */
+    uint64_t scan_pages;
+    uint8_t cold_age;
+    int32_t compress_level;
+
+    void *host;
+    size_t page_size;
+    uint64_t nr_pages;
+    int uffd;
+    bool discard_required;
+
+    /*
+     * Serialises the scanner against the fault thread.  A resident page
+     * is mapped; a page that is not resident is backed by its slot, or
+     * is zero if the slot is NULL.  Write-protected pages are aging.
+     */
+    QemuMutex lock;
+    unsigned long *resident;
+    unsigned long *wp;
+    uint8_t *age;
+    ZpoolSlot **slots;
+    uint64_t scan_pos;
+    uint64_t evicted_pages;
+    uint64_t pool_size;
+
+    bool quit;
+    QemuCond quit_cond;
+    EventNotifier quit_notifier;
+    QemuThread fault_thread;
+    QemuThread scan_thread;
+    bool threads_running;
+};
+
+static void *zpool_page(HostMemoryBackendZpool *z, uint64_t page)
+{
+    return (uint8_t *)z->host + page * z->page_size;
+}
+
+static void zpool_fault(HostMemoryBackendZpool *z, ZSTD_DCtx *dctx,
+                        void *buf, const struct uffd_msg *msg)
+{
+    uint64_t offset = msg->arg.pagefault.address - (uintptr_t)z->host;
+    uint64_t page = offset / z->page_size;
+    void *addr = zpool_page(z, page);
+    bool write = msg->arg.pagefault.flags & UFFD_PAGEFAULT_FLAG_WRITE;
+    ZpoolSlot *slot;
+    size_t ret;
+
+    if (page >= z->nr_pages) {
+        return;
+    }
+
+    QEMU_LOCK_GUARD(&z->lock);
+    if (msg->arg.pagefault.flags & UFFD_PAGEFAULT_FLAG_WP) {
+        trace_zpool_fault_wp(page);
+        if (test_bit(page, z->resident)) {
+            /* Written while aging: young again */
+            z->age[page] = 0;
+            clear_bit(page, z->wp);
+            uffd_change_protection(z->uffd, addr, z->page_size, false, false);
+        } else {
+            /* Evicted meanwhile, the retry takes a missing fault */
+            uffd_wakeup(z->uffd, addr, z->page_size);
+        }
+        return;
+    }
+
+    if (test_bit(page, z->resident)) {
+        /* Another thread faulted on the same page */
+        uffd_wakeup(z->uffd, addr, z->page_size);
+        return;
+    }
+
+    slot = z->slots[page];
+    trace_zpool_fault_missing(page, slot ? slot->len : 0, write);
+    if (slot) {
+        ret = ZSTD_decompressDCtx(dctx, buf, z->page_size,
+                                  slot->data, slot->len);
+        if (ZSTD_isError(ret) || ret != z->page_size) {
+            error_report("memory-backend-zpool: corrupt page %" PRIu64,
+                         page);
+            abort();
+        }
+        uffd_copy_page(z->uffd, addr, buf, z->page_size, false);
+        z->pool_size -= slot->len;
+        z->evicted_pages--;
+        z->slots[page] = NULL;
+        g_free(slot);
+    } else if (write) {
+        /* Avoid mapping the zero page just to COW it right away */
+        memset(buf, 0, z->page_size);
+        uffd_copy_page(z->uffd, addr, buf, z->page_size, false);
+    } else {
+        uffd_zero_page(z->uffd, addr, z->page_size, false);
+    }
+    set_bit(page, z->resident);
+    clear_bit(page, z->wp);
+    z->age[page] = 0;
+}
+
+static void *zpool_fault_thread(void *opaque)
+{
+    HostMemoryBackendZpool *z = opaque;
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    g_autofree void *buf = g_malloc(z->page_size);
+    struct uffd_msg msgs[ZPOOL_FAULT_BATCH];
+    struct pollfd pfd[2] = {
+        { .fd = z->uffd, .events = POLLIN },
+        { .fd = event_notifier_get_fd(&z->quit_notifier), .events = POLLIN },
+    };
+    int i, n;
+
+    for (;;) {
+        if (poll(pfd, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error_report("memory-backend-zpool: poll failed: %s",
+                         strerror(errno));
+            break;
+        }
+        if (pfd[1].revents & POLLIN) {
+            break;
+        }
+        n = uffd_read_events(z->uffd, msgs, ZPOOL_FAULT_BATCH);
+        if (n < 0) {
+            break;
+        }
+        for (i = 0; i < n; i++) {
+            if (msgs[i].event == UFFD_EVENT_PAGEFAULT) {
+                zpool_fault(z, dctx, buf, &msgs[i]);
+            }
+        }
+    }
+
+    ZSTD_freeDCtx(dctx);
+    return NULL;
+}
+
+/*
+ * Called with the lock held, on a page that stayed write-protected for
+ * cold-age scans.  Pages that compress to more than three quarters of
+ * their size are left alone.
+ */
+static void zpool_evict(HostMemoryBackendZpool *z, ZSTD_CCtx *cctx,
+                        void *buf, size_t buf_len, uint64_t page)
+{
+    void *addr = zpool_page(z, page);
+    ZpoolSlot *slot = NULL;
+    size_t len = 0;
+
+    if (!buffer_is_zero(addr, z->page_size)) {
+        len = ZSTD_compressCCtx(cctx, buf, buf_len, addr, z->page_size,
+                                qatomic_read(&z->compress_level));
+        if (ZSTD_isError(len) || len > z->page_size / 4 * 3) {
+            z->age[page] = 0;
+            return;
+        }
+        slot = g_malloc(sizeof(*slot) + len);
+        slot->len = len;
+        memcpy(slot->data, buf, len);
+    }
+
+    trace_zpool_evict(page, len);
+    qemu_madvise(addr, z->page_size, QEMU_MADV_DONTNEED);
+    z->slots[page] = slot;
+    z->pool_size += len;
+    z->evicted_pages++;
+    clear_bit(page, z->resident);
+    clear_bit(page, z->wp);
+    z->age[page] = 0;
+}
+
+static void zpool_scan_page(HostMemoryBackendZpool *z, ZSTD_CCtx *cctx,
+                            void *buf, size_t buf_len, uint64_t page)
+{
+    uint8_t cold_age = qatomic_read(&z->cold_age);
+
+    QEMU_LOCK_GUARD(&z->lock);
+    if (!test_bit(page, z->resident)) {
+        return;
+    }
+    if (!test_bit(page, z->wp)) {
+        /* Start aging; the next write takes a fault and resets it */
+        if (uffd_change_protection(z->uffd, zpool_page(z, page),
+                                   z->page_size, true, false)) {
+            return;
+        }
+        set_bit(page, z->wp);
+        z->age[page] = 0;
+        return;
+    }
+    if (z->age[page] < UINT8_MAX) {
+        z->age[page]++;
+    }
+    if (z->age[page] >= cold_age) {
+        zpool_evict(z, cctx, buf, buf_len, page);
+    }
+}
+
+static void *zpool_scan_thread(void *opaque)
+{
+    HostMemoryBackendZpool *z = opaque;
+    ZSTD_CCtx *cctx = ZSTD_createCCtx();
+    size_t buf_len = ZSTD_compressBound(z->page_size);
+    g_autofree void *buf = g_malloc(buf_len);
+    uint64_t i, n;
+
+    qemu_mutex_lock(&z->lock);
+    while (!z->quit) {
+        qemu_cond_timedwait(&z->quit_cond, &z->lock,
+                            qatomic_read(&z->scan_interval));
+        if (z->quit) {
+            break;
+        }
+        n = MIN(qatomic_read(&z->scan_pages), z->nr_pages);
+        qemu_mutex_unlock(&z->lock);
+
+        for (i = 0; i < n; i++) {
+            zpool_scan_page(z, cctx, buf, buf_len, z->scan_pos);
+            z->scan_pos = (z->scan_pos + 1) % z->nr_pages;
+        }
+
+        qemu_mutex_lock(&z->lock);
+    }
+    qemu_mutex_unlock(&z->lock);
+
+    ZSTD_freeCCtx(cctx);
+    return NULL;
+}
+
+static bool zpool_uffd_init(HostMemoryBackendZpool *z, Error **errp)
+{
+    uint64_t features, ioctls;
+
+    if (uffd_query_features(&features) ||
+        !(features & UFFD_FEATURE_PAGEFAULT_FLAG_WP)) {
+        error_setg(errp, "userfaultfd write-protection is not supported "
+                   "by the host");
+        return false;
+    }
+    z->uffd = uffd_create_fd(UFFD_FEATURE_PAGEFAULT_FLAG_WP, true);
+    if (z->uffd < 0) {
+        error_setg(errp, "cannot create userfaultfd");
+        return false;
+    }
+    if (uffd_register_memory(z->uffd, z->host, z->nr_pages * z->page_size,
+                             UFFDIO_REGISTER_MODE_MISSING |
+                             UFFDIO_REGISTER_MODE_WP, &ioctls)) {
+        error_setg(errp, "cannot register guest memory with userfaultfd");
+        goto fail;
+    }
+    if (!(ioctls & BIT(_UFFDIO_COPY)) ||
+        !(ioctls & BIT(_UFFDIO_WRITEPROTECT))) {
+        error_setg(errp, "userfaultfd lacks copy or write-protect support");
+        uffd_unregister_memory(z->uffd, z->host,
+                               z->nr_pages * z->page_size);
+        goto fail;
+    }
+    return true;
+
+fail:
+    uffd_close_fd(z->uffd);
+    z->uffd = -1;
+    return false;
+}
+
+static bool
+zpool_backend_memory_alloc(HostMemoryBackend *backend, Error **errp)
+{
+    HostMemoryBackendZpool *z = MEMORY_BACKEND_ZPOOL(backend);
+    g_autofree char *name = NULL;
+    uint32_t ram_flags;
+
+    if (!backend->size) {
+        error_setg(errp, "can't create backend with size 0");
+        return false;
+    }
+    if (backend->share) {
+        error_setg(errp, "memory-backend-zpool does not support share=on");
+        return false;
+    }
+    if (ram_block_discard_require(true)) {
+        error_setg(errp, "memory-backend-zpool conflicts with a device "
+                   "that cannot tolerate discarded RAM");
+        return false;
+    }
+    z->discard_required = true;
+
+    name = host_memory_backend_get_name(backend);
+    ram_flags = backend->reserve ? 0 : RAM_NORESERVE;
+    if (!memory_region_init_ram_flags_nomigrate(&backend->mr, OBJECT(backend),
+                                                name, backend->size,
+                                                ram_flags, errp)) {
+        return false;
+    }
+
+    z->host = memory_region_get_ram_ptr(&backend->mr);
+    z->page_size = qemu_real_host_page_size();
+    z->nr_pages = backend->size / z->page_size;
+    /* Transparent huge pages would defeat per-page eviction */
+    qemu_madvise(z->host, backend->size, QEMU_MADV_NOHUGEPAGE);
+
+    if (!zpool_uffd_init(z, errp)) {
+        return false;
+    }
+
+    z->resident = bitmap_new(z->nr_pages);
+    z->wp = bitmap_new(z->nr_pages);
+    z->age = g_new0(uint8_t, z->nr_pages);
+    z->slots = g_new0(ZpoolSlot *, z->nr_pages);
+
+    event_notifier_init(&z->quit_notifier, false);
+    qemu_thread_create(&z->fault_thread, "zpool-fault", zpool_fault_thread,
+                       z, QEMU_THREAD_JOINABLE);
+    qemu_thread_create(&z->scan_thread, "zpool-scan", zpool_scan_thread,
+                       z, QEMU_THREAD_JOINABLE);
+    z->threads_running = true;
+    return true;
+}
+
+static void
+zpool_backend_set_scan_interval(Object *obj, Visitor *v, const char *name,
+                                void *opaque, Error **errp)
+{
+    HostMemoryBackendZpool *z = MEMORY_BACKEND_ZPOOL(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (!value) {
+        error_setg(errp, "Property '%s.%s' doesn't take value '%" PRIu32 "'",
+                   object_get_typename(obj), name, value);
+        return;
+    }
+    qatomic_set(&z->scan_interval, value);
+}
+
+static void
+zpool_backend_get_scan_interval(Object *obj, Visitor *v, const char *name,
+                                void *opaque, Error **errp)
+{
+    uint32_t value = qatomic_read(&MEMORY_BACKEND_ZPOOL(obj)->scan_interval);
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void
+zpool_backend_set_cold_age(Object *obj, Visitor *v, const char *name,
+                           void *opaque, Error **errp)
+{
+    HostMemoryBackendZpool *z = MEMORY_BACKEND_ZPOOL(obj);
+    uint8_t value;
+
+    if (!visit_type_uint8(v, name, &value, errp)) {
+        return;
+    }
+    if (!value) {
+        error_setg(errp, "Property '%s.%s' doesn't take value '%" PRIu8 "'",
+                   object_get_typename(obj), name, value);
+        return;
+    }
+    qatomic_set(&z->cold_age, value);
+}
+
+static void
+zpool_backend_get_cold_age(Object *obj, Visitor *v, const char *name,
+                           void *opaque, Error **errp)
+{
+    uint8_t value = qatomic_read(&MEMORY_BACKEND_ZPOOL(obj)->cold_age);
+
+    visit_type_uint8(v, name, &value, errp);
+}
+
+static void
+zpool_backend_set_scan_pages(Object *obj, Visitor *v, const char *name,
+                             void *opaque, Error **errp)
+{
+    HostMemoryBackendZpool *z = MEMORY_BACKEND_ZPOOL(obj);
+    uint64_t value;
+
+    if (!visit_type_uint64(v, name, &value, errp)) {
+        return;
+    }
+    qatomic_set(&z->scan_pages, value);
+}
+
+static void
+zpool_backend_get_scan_pages(Object *obj, Visitor *v, const char *name,
+                             void *opaque, Error **errp)
+{
+    uint64_t value = qatomic_read(&MEMORY_BACKEND_ZPOOL(obj)->scan_pages);
+
+    visit_type_uint64(v, name, &value, errp);
+}
+
+static void
+zpool_backend_set_compress_level(Object *obj, Visitor *v, const char *name,
+                                 void *opaque, Error **errp)
+{
+    HostMemoryBackendZpool *z = MEMORY_BACKEND_ZPOOL(obj);
+    int32_t value;
+
+    if (!visit_type_int32(v, name, &value, errp)) {
+        return;
+    }
+    if (value < ZSTD_minCLevel() || value > ZSTD_maxCLevel()) {
+        error_setg(errp, "Property '%s.%s' must be between %d and %d",
+                   object_get_typename(obj), name, ZSTD_minCLevel(),
+                   ZSTD_maxCLevel());
+        return;
+    }
+    qatomic_set(&z->compress_level, value);
+}
+
+static void
+zpool_backend_get_compress_level(Object *obj, Visitor *v, const char *name,
+                                 void *opaque, Error **errp)
+{
+    int32_t value = qatomic_read(&MEMORY_BACKEND_ZPOOL(obj)->compress_level);
+
+    visit_type_int32(v, name, &value, errp);
+}
+
+static void
+zpool_backend_get_stat(Object *obj, Visitor *v, const char *name,
+                       void *opaque, Error **errp)
+{
+    HostMemoryBackendZpool *z = MEMORY_BACKEND_ZPOOL(obj);
+    uint64_t value;
+
+    WITH_QEMU_LOCK_GUARD(&z->lock) {
+        value = opaque ? z->pool_size : z->evicted_pages;
+    }
+    visit_type_uint64(v, name, &value, errp);
+}
+
+static void
+zpool_backend_instance_init(Object *obj)
+{
+    HostMemoryBackendZpool *z = MEMORY_BACKEND_ZPOOL(obj);
+
+    z->scan_interval = 1000;
+    z->scan_pages = 16384;
+    z->cold_age = 8;
+    z->compress_level = 1;
+    z->uffd = -1;
+    qemu_mutex_init(&z->lock);
+    qemu_cond_init(&z->quit_cond);
+}
+
+static void
+zpool_backend_instance_finalize(Object *obj)
+{
+    HostMemoryBackendZpool *z = MEMORY_BACKEND_ZPOOL(obj);
+    uint64_t i;
+
+    if (z->threads_running) {
+        WITH_QEMU_LOCK_GUARD(&z->lock) {
+            z->quit = true;
+            qemu_cond_signal(&z->quit_cond);
+        }
+        event_notifier_set(&z->quit_notifier);
+        qemu_thread_join(&z->scan_thread);
+        qemu_thread_join(&z->fault_thread);
+        event_notifier_cleanup(&z->quit_notifier);
+    }
+    if (z->uffd >= 0) {
+        uffd_unregister_memory(z->uffd, z->host, z->nr_pages * z->page_size);
+        uffd_close_fd(z->uffd);
+    }
+    if (z->slots) {
+        for (i = 0; i < z->nr_pages; i++) {
+            g_free(z->slots[i]);
+        }
+    }
+    g_free(z->slots);
+    g_free(z->age);
+    g_free(z->wp);
+    g_free(z->resident);
+    if (z->discard_required) {
+        ram_block_discard_require(false);
+    }
+    qemu_cond_destroy(&z->quit_cond);
+    qemu_mutex_destroy(&z->lock);
+}
+
+static void
+zpool_backend_class_init(ObjectClass *oc, void *data)
+{
+    HostMemoryBackendClass *bc = MEMORY_BACKEND_CLASS(oc);
+
+    bc->alloc = zpool_backend_memory_alloc;
+
+    object_class_property_add(oc, "scan-interval", "uint32",
+                              zpool_backend_get_scan_interval,
+                              zpool_backend_set_scan_interval, NULL, NULL);
+    object_class_property_set_description(oc, "scan-interval",
+        "Milliseconds between two scanner passes");
+    object_class_property_add(oc, "scan-pages", "uint64",
+                              zpool_backend_get_scan_pages,
+                              zpool_backend_set_scan_pages, NULL, NULL);
+    object_class_property_set_description(oc, "scan-pages",
+        "Pages visited by each scanner pass");
+    object_class_property_add(oc, "cold-age", "uint8",
+                              zpool_backend_get_cold_age,
+                              zpool_backend_set_cold_age, NULL, NULL);
+    object_class_property_set_description(oc, "cold-age",
+        "Scanner passes a page must stay unwritten before it is compressed");
+    object_class_property_add(oc, "compress-level", "int32",
+                              zpool_backend_get_compress_level,
+                              zpool_backend_set_compress_level, NULL, NULL);
+    object_class_property_set_description(oc, "compress-level",
+        "zstd compression level");
+    object_class_property_add(oc, "evicted-pages", "uint64",
+                              zpool_backend_get_stat, NULL, NULL, NULL);
+    object_class_property_set_description(oc, "evicted-pages",
+        "Pages currently held in the pool, zero pages included");
+    object_class_property_add(oc, "pool-size", "uint64",
+                              zpool_backend_get_stat, NULL, NULL,
+                              (void *)1);
+    object_class_property_set_description(oc, "pool-size",
+        "Bytes of compressed data in the pool");
+}
+
+static const TypeInfo zpool_backend_info = {
+    .name = TYPE_MEMORY_BACKEND_ZPOOL,
+    .parent = TYPE_MEMORY_BACKEND,
+    .instance_init = zpool_backend_instance_init,
+    .instance_finalize = zpool_backend_instance_finalize,
+    .class_init = zpool_backend_class_init,
+    .instance_size = sizeof(HostMemoryBackendZpool),
+};
+
+static void register_types(void)
+{
+    type_register_static(&zpool_backend_info);
+}
+
+type_init(register_types);
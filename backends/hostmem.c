@@ -15,6 +15,7 @@
 #include "hw/boards.h"
 #include "qapi/error.h"
 #include "qapi/qapi-builtin-visit.h"
+#include "qapi/qmp/qlist.h"
 #include "qapi/visitor.h"
 #include "qemu/config-file.h"
 #include "qom/object_interfaces.h"
@@ -317,11 +318,50 @@ size_t host_memory_backend_pagesize(HostMemoryBackend *memdev)
     return pagesize;
 }
 
+#ifdef CONFIG_NUMA
+/*
+ * Without a prealloc-context, create a thread context whose threads run
+ * on the CPUs of the host nodes the memory is bound to, so that the pages
+ * are touched from the nodes they are allocated on.  Returns NULL if the
+ * nodes have no CPUs.  The caller unparents the context once the
+ * preallocation threads have been created.
+ */
+static ThreadContext *
+host_memory_backend_node_context(HostMemoryBackend *backend)
+{
+    g_autoptr(QList) nodes = qlist_new();
+    Error *local_err = NULL;
+    unsigned long node;
+    Object *obj;
+
+    for (node = find_first_bit(backend->host_nodes, MAX_NODES);
+         node < MAX_NODES;
+         node = find_next_bit(backend->host_nodes, MAX_NODES, node + 1)) {
+        qlist_append_int(nodes, node);
+    }
+
+    obj = object_new(TYPE_THREAD_CONTEXT);
+    object_property_add_child(OBJECT(backend), "prealloc-node-context", obj);
+    object_unref(obj);
+
+    if (!object_property_set_qobject(obj, "node-affinity", QOBJECT(nodes),
+                                     &local_err) ||
+        !user_creatable_complete(USER_CREATABLE(obj), &local_err)) {
+        /* Not fatal, the threads just run anywhere */
+        error_free(local_err);
+        object_unparent(obj);
+        return NULL;
+    }
+    return THREAD_CONTEXT(obj);
+}
+#endif
+
 static void
 host_memory_backend_memory_complete(UserCreatable *uc, Error **errp)
 {
     HostMemoryBackend *backend = MEMORY_BACKEND(uc);
     HostMemoryBackendClass *bc = MEMORY_BACKEND_GET_CLASS(uc);
+    ThreadContext *tc = backend->prealloc_context;
     void *ptr;
     uint64_t sz;
     bool async = !phase_check(PHASE_LATE_BACKENDS_CREATED);
@@ -395,18 +435,24 @@ host_memory_backend_memory_complete(UserCreatable *uc, Error **errp)
             return;
         }
     }
+
+    if (backend->prealloc && !tc && maxnode) {
+        tc = host_memory_backend_node_context(backend);
+    }
 #endif
     /*
      * Preallocate memory after the NUMA policy has been instantiated.
      * This is necessary to guarantee memory is allocated with
      * specified NUMA policy in place.
      */
-    if (backend->prealloc && !qemu_prealloc_mem(memory_region_get_fd(&backend->mr),
-                                                ptr, sz,
-                                                backend->prealloc_threads,
-                                                backend->prealloc_context,
-                                                async, errp)) {
-        return;
+    if (backend->prealloc) {
+        qemu_prealloc_mem(memory_region_get_fd(&backend->mr), ptr, sz,
+                          backend->prealloc_threads, tc, async, errp);
+    }
+
+    /* The preallocation threads outlive the context they were created in */
+    if (tc && tc != backend->prealloc_context) {
+        object_unparent(OBJECT(tc));
     }
 }
 
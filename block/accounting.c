@@ -26,6 +26,7 @@
 #include "qemu/osdep.h"
 #include "block/accounting.h"
 #include "block/block_int.h"
+#include "qemu/host-utils.h"
 #include "qemu/timer.h"
 #include "sysemu/qtest.h"
 
@@ -200,6 +201,23 @@ void block_latency_histograms_clear(BlockAcctStats *stats)
     }
 }
 
+static unsigned block_latency_hdr_bin(uint64_t latency_ns)
+{
+    int e;
+
+    if (latency_ns < BLOCK_LATENCY_HDR_SUB) {
+        return latency_ns;
+    }
+
+    e = 63 - clz64(latency_ns);
+    if (e >= BLOCK_LATENCY_HDR_MAX_BITS) {
+        return BLOCK_LATENCY_HDR_BINS - 1;
+    }
+    return (e - BLOCK_LATENCY_HDR_SUB_BITS + 1) * BLOCK_LATENCY_HDR_SUB +
+           ((latency_ns >> (e - BLOCK_LATENCY_HDR_SUB_BITS)) &
+            (BLOCK_LATENCY_HDR_SUB - 1));
+}
+
 static void block_account_one_io(BlockAcctStats *stats, BlockAcctCookie *cookie,
                                  bool failed)
 {
@@ -217,23 +235,34 @@ static void block_account_one_io(BlockAcctStats *stats, BlockAcctCookie *cookie,
         return;
     }
 
-    WITH_QEMU_LOCK_GUARD(&stats->lock) {
-        if (failed) {
-            stats->failed_ops[cookie->type]++;
-        } else {
-            stats->nr_bytes[cookie->type] += cookie->bytes;
-            stats->nr_ops[cookie->type]++;
-        }
+    if (failed) {
+        stat64_add(&stats->failed_ops[cookie->type], 1);
+    } else {
+        stat64_add(&stats->nr_bytes[cookie->type], cookie->bytes);
+        stat64_add(&stats->nr_ops[cookie->type], 1);
+    }
+
+    stat64_add(&stats->latency_hdr[cookie->type]
+                                  [block_latency_hdr_bin(latency_ns)], 1);
 
-        block_latency_histogram_account(&stats->latency_histogram[cookie->type],
-                                        latency_ns);
+    /* The configurable histograms and intervals still need the lock */
+    if (stats->latency_histogram[cookie->type].bins) {
+        WITH_QEMU_LOCK_GUARD(&stats->lock) {
+            block_latency_histogram_account(
+                &stats->latency_histogram[cookie->type], latency_ns);
+        }
+    }
 
-        if (!failed || stats->account_failed) {
-            stats->total_time_ns[cookie->type] += latency_ns;
-            stats->last_access_time_ns = time_ns;
+    if (!failed || stats->account_failed) {
+        stat64_add(&stats->total_time_ns[cookie->type], latency_ns);
+        stat64_max(&stats->last_access_time_ns, time_ns);
 
-            QSLIST_FOREACH(s, &stats->intervals, entries) {
-                timed_average_account(&s->latency[cookie->type], latency_ns);
+        if (!QSLIST_EMPTY(&stats->intervals)) {
+            WITH_QEMU_LOCK_GUARD(&stats->lock) {
+                QSLIST_FOREACH(s, &stats->intervals, entries) {
+                    timed_average_account(&s->latency[cookie->type],
+                                          latency_ns);
+                }
             }
         }
     }
@@ -259,13 +288,12 @@ void block_acct_invalid(BlockAcctStats *stats, enum BlockAcctType type)
      * not.  The reason is that invalid requests are accounted during their
      * submission, therefore there's no actual I/O involved.
      */
-    qemu_mutex_lock(&stats->lock);
-    stats->invalid_ops[type]++;
+    stat64_add(&stats->invalid_ops[type], 1);
 
     if (stats->account_invalid) {
-        stats->last_access_time_ns = qemu_clock_get_ns(clock_type);
+        stat64_max(&stats->last_access_time_ns,
+                   qemu_clock_get_ns(clock_type));
     }
-    qemu_mutex_unlock(&stats->lock);
 }
 
 void block_acct_merge_done(BlockAcctStats *stats, enum BlockAcctType type,
@@ -273,14 +301,13 @@ void block_acct_merge_done(BlockAcctStats *stats, enum BlockAcctType type,
 {
     assert(type < BLOCK_MAX_IOTYPE);
 
-    qemu_mutex_lock(&stats->lock);
-    stats->merged[type] += num_requests;
-    qemu_mutex_unlock(&stats->lock);
+    stat64_add(&stats->merged[type], num_requests);
 }
 
 int64_t block_acct_idle_time_ns(BlockAcctStats *stats)
 {
-    return qemu_clock_get_ns(clock_type) - stats->last_access_time_ns;
+    return qemu_clock_get_ns(clock_type) -
+           stat64_get(&stats->last_access_time_ns);
 }
 
 double block_acct_queue_depth(BlockAcctTimedStats *stats,
@@ -33,6 +33,21 @@
 
 #define NOT_DONE 0x7fffffff /* used while emulated sync operation in progress */
 
+/* Limits for coalescing small sequential writes, see blk_co_write_batched() */
+#define BLK_WRITE_BATCH_MAX_REQ    (64 * KiB)
+#define BLK_WRITE_BATCH_MAX_BYTES  (1 * MiB)
+
+typedef struct BlkWriteBatch {
+    int64_t offset;
+    int64_t bytes;
+    BdrvRequestFlags flags;
+    QEMUIOVector qiov;
+    int refcnt;
+    bool done;
+    int ret;
+    CoQueue waiters;
+} BlkWriteBatch;
+
 typedef struct BlockBackendAioNotifier {
     void (*attached_aio_context)(AioContext *new_context, void *opaque);
     void (*detach_aio_context)(void *opaque);
@@ -83,6 +98,14 @@ struct BlockBackend {
     CoQueue queued_requests;
     bool disable_request_queuing; /* atomic */
 
+    /*
+     * If non-zero, small writes wait up to write_batch_ns for adjacent
+     * writes to be submitted together with them.
+     */
+    uint64_t write_batch_ns;
+    QemuMutex write_batch_lock; /* protects write_batch */
+    BlkWriteBatch *write_batch; /* still open for further writes */
+
     VMChangeStateEntry *vmsh;
     bool force_allow_inactivate;
 
@@ -371,6 +394,7 @@ BlockBackend *blk_new(AioContext *ctx, uint64_t perm, uint64_t shared_perm)
     block_acct_init(&blk->stats);
 
     qemu_mutex_init(&blk->queued_requests_lock);
+    qemu_mutex_init(&blk->write_batch_lock);
     qemu_co_queue_init(&blk->queued_requests);
     notifier_list_init(&blk->remove_bs_notifiers);
     notifier_list_init(&blk->insert_bs_notifiers);
@@ -495,6 +519,8 @@ static void blk_delete(BlockBackend *blk)
     assert(QLIST_EMPTY(&blk->aio_notifiers));
     assert(qemu_co_queue_empty(&blk->queued_requests));
     qemu_mutex_destroy(&blk->queued_requests_lock);
+    assert(!blk->write_batch);
+    qemu_mutex_destroy(&blk->write_batch_lock);
     QTAILQ_REMOVE(&block_backends, blk, link);
     drive_info_del(blk->legacy_dinfo);
     block_acct_cleanup(&blk->stats);
@@ -1394,6 +1420,83 @@ int coroutine_fn blk_co_preadv_part(BlockBackend *blk, int64_t offset,
 }
 
 /* To be called between exactly one pair of blk_inc/dec_in_flight() */
+/* Called with blk->write_batch_lock held */
+static void blk_write_batch_unref_locked(BlkWriteBatch *batch)
+{
+    if (--batch->refcnt == 0) {
+        qemu_iovec_destroy(&batch->qiov);
+        g_free(batch);
+    }
+}
+
+/*
+ * Small sequential writes, as issued by log appenders in the guest, each
+ * cost a host syscall and on some storage an I/O operation that is billed
+ * for.  Instead, the first of them waits for blk->write_batch_ns, and the
+ * writes that continue where it ends are appended to it in the meantime.
+ * The whole batch then goes down the graph as one vectored request, and
+ * all of its writes complete with its result.
+ */
+static int coroutine_fn GRAPH_RDLOCK
+blk_co_write_batched(BlockBackend *blk, int64_t offset, int64_t bytes,
+                     QEMUIOVector *qiov, size_t qiov_offset,
+                     BdrvRequestFlags flags)
+{
+    BlkWriteBatch *batch;
+    int ret;
+
+    qemu_mutex_lock(&blk->write_batch_lock);
+    batch = blk->write_batch;
+    if (batch && batch->offset + batch->bytes == offset &&
+        batch->flags == flags &&
+        batch->bytes + bytes <= BLK_WRITE_BATCH_MAX_BYTES &&
+        batch->qiov.niov + qiov->niov <= IOV_MAX) {
+        qemu_iovec_concat(&batch->qiov, qiov, qiov_offset, bytes);
+        batch->bytes += bytes;
+        batch->refcnt++;
+        while (!batch->done) {
+            qemu_co_queue_wait(&batch->waiters, &blk->write_batch_lock);
+        }
+        ret = batch->ret;
+        blk_write_batch_unref_locked(batch);
+        qemu_mutex_unlock(&blk->write_batch_lock);
+        return ret;
+    }
+
+    batch = g_new0(BlkWriteBatch, 1);
+    batch->offset = offset;
+    batch->flags = flags;
+    batch->refcnt = 1;
+    qemu_co_queue_init(&batch->waiters);
+    qemu_iovec_init(&batch->qiov, qiov->niov);
+    qemu_iovec_concat(&batch->qiov, qiov, qiov_offset, bytes);
+    batch->bytes = bytes;
+    blk->write_batch = batch;
+    qemu_mutex_unlock(&blk->write_batch_lock);
+
+    qemu_co_sleep_ns(QEMU_CLOCK_REALTIME, blk->write_batch_ns);
+
+    /* A write elsewhere may already have opened the next batch */
+    qemu_mutex_lock(&blk->write_batch_lock);
+    if (blk->write_batch == batch) {
+        blk->write_batch = NULL;
+    }
+    qemu_mutex_unlock(&blk->write_batch_lock);
+
+    trace_blk_co_write_batch(blk, batch->offset, batch->bytes,
+                             batch->qiov.niov);
+    ret = bdrv_co_pwritev_part(blk->root, batch->offset, batch->bytes,
+                               &batch->qiov, 0, batch->flags);
+
+    qemu_mutex_lock(&blk->write_batch_lock);
+    batch->ret = ret;
+    batch->done = true;
+    qemu_co_queue_restart_all(&batch->waiters);
+    blk_write_batch_unref_locked(batch);
+    qemu_mutex_unlock(&blk->write_batch_lock);
+    return ret;
+}
+
 static int coroutine_fn
 blk_co_do_pwritev_part(BlockBackend *blk, int64_t offset, int64_t bytes,
                        QEMUIOVector *qiov, size_t qiov_offset,
@@ -1426,8 +1529,14 @@ blk_co_do_pwritev_part(BlockBackend *blk, int64_t offset, int64_t bytes,
         flags |= BDRV_REQ_FUA;
     }
 
-    ret = bdrv_co_pwritev_part(blk->root, offset, bytes, qiov, qiov_offset,
-                               flags);
+    if (blk->write_batch_ns && qiov && bytes <= BLK_WRITE_BATCH_MAX_REQ &&
+        !(flags & ~BDRV_REQ_FUA)) {
+        ret = blk_co_write_batched(blk, offset, bytes, qiov, qiov_offset,
+                                   flags);
+    } else {
+        ret = bdrv_co_pwritev_part(blk->root, offset, bytes, qiov,
+                                   qiov_offset, flags);
+    }
     bdrv_dec_in_flight(bs);
     return ret;
 }
@@ -2232,6 +2341,16 @@ void blk_set_enable_write_cache(BlockBackend *blk, bool wce)
     blk->enable_write_cache = wce;
 }
 
+/*
+ * Let small sequential writes wait up to @deadline_ns for each other, so
+ * that they reach the host as one request.  Zero disables this.
+ */
+void blk_set_write_batching(BlockBackend *blk, uint64_t deadline_ns)
+{
+    GLOBAL_STATE_CODE();
+    blk->write_batch_ns = deadline_ns;
+}
+
 void blk_activate(BlockBackend *blk, Error **errp)
 {
     BlockDriverState *bs = blk_bs(blk);
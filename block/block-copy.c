@@ -54,6 +54,8 @@ typedef struct BlockCopyCallState {
     int max_workers;
     int64_t max_chunk;
     bool ignore_ratelimit;
+    /* Whether tasks may finish before the data reaches the target */
+    bool write_behind;
     BlockCopyAsyncCallbackFunc cb;
     void *cb_opaque;
     /* Coroutine where async block-copy is running */
@@ -112,6 +114,13 @@ static int64_t task_end(BlockCopyTask *task)
     return task->req.offset + task->req.bytes;
 }
 
+/* Data of a finished task that is still being written to the target */
+typedef struct BlockCopyWriteBehind {
+    BlockCopyState *s;
+    BlockReq req;
+    void *buf;
+} BlockCopyWriteBehind;
+
 typedef struct BlockCopyState {
     /*
      * BdrvChild objects are not owned or managed by block-copy. They are
@@ -139,6 +148,17 @@ typedef struct BlockCopyState {
     BlockCopyMethod method;
     BlockReqList reqs;
     QLIST_HEAD(, BlockCopyCallState) calls;
+    /*
+     * Areas that block_copy() already reported as copied, but whose data is
+     * still on its way to the target.  They are not in @reqs, because
+     * nothing needs to be copied there anymore.  @write_behind_ret is the
+     * first error of such a write.
+     */
+    BlockReqList write_behind_reqs;
+    int64_t write_behind_bytes;
+    int64_t write_behind_max;
+    int write_behind_ret;
+    int write_behind_count; /* atomic */
     /*
      * skip_unallocated:
      *
@@ -268,6 +288,8 @@ void block_copy_state_free(BlockCopyState *s)
         return;
     }
 
+    AIO_WAIT_WHILE_UNLOCKED(NULL, qatomic_read(&s->write_behind_count));
+
     ratelimit_destroy(&s->rate_limit);
     bdrv_release_dirty_bitmap(s->copy_bitmap);
     shres_destroy(s->mem);
@@ -423,6 +445,7 @@ BlockCopyState *block_copy_state_new(BdrvChild *source, BdrvChild *target,
     qemu_co_mutex_init(&s->lock);
     QLIST_INIT(&s->reqs);
     QLIST_INIT(&s->calls);
+    QLIST_INIT(&s->write_behind_reqs);
 
     return s;
 }
@@ -558,17 +581,111 @@ block_copy_do_copy(BlockCopyState *s, int64_t offset, int64_t bytes,
     return ret;
 }
 
+static void coroutine_fn block_copy_write_behind_entry(void *opaque)
+{
+    BlockCopyWriteBehind *wb = opaque;
+    BlockCopyState *s = wb->s;
+    BlockDriverState *target_bs = s->target->bs;
+    int64_t nbytes = MIN(wb->req.offset + wb->req.bytes, s->len) -
+                     wb->req.offset;
+    int ret;
+
+    WITH_GRAPH_RDLOCK_GUARD() {
+        ret = bdrv_co_pwrite(s->target, wb->req.offset, nbytes, wb->buf,
+                             s->write_flags);
+    }
+    if (ret < 0) {
+        trace_block_copy_write_fail(s, wb->req.offset, ret);
+    }
+    qemu_vfree(wb->buf);
+
+    WITH_QEMU_LOCK_GUARD(&s->lock) {
+        /*
+         * The source may already have been overwritten, so there is no
+         * point in setting the dirty bits again.
+         */
+        if (ret < 0 && !s->write_behind_ret) {
+            s->write_behind_ret = ret;
+        }
+        s->write_behind_bytes -= wb->req.bytes;
+        reqlist_remove_req(&wb->req);
+    }
+    g_free(wb);
+
+    qatomic_dec(&s->write_behind_count);
+    bdrv_dec_in_flight(target_bs);
+}
+
+/*
+ * Read the area of @t into memory and write it to the target in the
+ * background, so that the task can finish as soon as the read is done.
+ *
+ * Returns false if the write-behind buffer is full; the caller then does
+ * a normal copy.  Otherwise, @ret is the result of the read.
+ */
+static bool coroutine_fn GRAPH_RDLOCK
+block_copy_write_behind(BlockCopyTask *t, int *ret, bool *error_is_read)
+{
+    BlockCopyState *s = t->s;
+    int64_t nbytes = MIN(task_end(t), s->len) - t->req.offset;
+    BlockCopyWriteBehind *wb;
+    Coroutine *co;
+
+    WITH_QEMU_LOCK_GUARD(&s->lock) {
+        if (s->write_behind_bytes + t->req.bytes > s->write_behind_max) {
+            return false;
+        }
+        s->write_behind_bytes += t->req.bytes;
+    }
+
+    wb = g_new(BlockCopyWriteBehind, 1);
+    *wb = (BlockCopyWriteBehind) {
+        .s = s,
+        .buf = qemu_blockalign(s->source->bs, nbytes),
+    };
+
+    *ret = bdrv_co_pread(s->source, t->req.offset, nbytes, wb->buf, 0);
+    if (*ret < 0) {
+        trace_block_copy_read_fail(s, t->req.offset, *ret);
+        *error_is_read = true;
+        WITH_QEMU_LOCK_GUARD(&s->lock) {
+            s->write_behind_bytes -= t->req.bytes;
+        }
+        qemu_vfree(wb->buf);
+        g_free(wb);
+        return true;
+    }
+
+    WITH_QEMU_LOCK_GUARD(&s->lock) {
+        reqlist_init_req(&s->write_behind_reqs, &wb->req, t->req.offset,
+                         t->req.bytes);
+    }
+
+    qatomic_inc(&s->write_behind_count);
+    bdrv_inc_in_flight(s->target->bs);
+    co = qemu_coroutine_create(block_copy_write_behind_entry, wb);
+    aio_co_enter(bdrv_get_aio_context(s->target->bs), co);
+
+    return true;
+}
+
 static coroutine_fn int block_copy_task_entry(AioTask *task)
 {
     BlockCopyTask *t = container_of(task, BlockCopyTask, task);
     BlockCopyState *s = t->s;
     bool error_is_read = false;
     BlockCopyMethod method = t->method;
+    bool write_behind = t->call_state->write_behind &&
+                        (method == COPY_READ_WRITE ||
+                         method == COPY_READ_WRITE_CLUSTER);
     int ret;
 
     WITH_GRAPH_RDLOCK_GUARD() {
-        ret = block_copy_do_copy(s, t->req.offset, t->req.bytes, &method,
-                                 &error_is_read);
+        if (!write_behind ||
+            !block_copy_write_behind(t, &ret, &error_is_read)) {
+            ret = block_copy_do_copy(s, t->req.offset, t->req.bytes, &method,
+                                     &error_is_read);
+        }
     }
 
     WITH_QEMU_LOCK_GUARD(&s->lock) {
@@ -921,6 +1038,7 @@ int coroutine_fn block_copy(BlockCopyState *s, int64_t start, int64_t bytes,
         .offset = start,
         .bytes = bytes,
         .ignore_ratelimit = ignore_ratelimit,
+        .write_behind = s->write_behind_max > 0,
         .max_workers = BLOCK_COPY_MAX_WORKERS,
         .cb = cb,
         .cb_opaque = cb_opaque,
@@ -1034,6 +1152,21 @@ void block_copy_set_skip_unallocated(BlockCopyState *s, bool skip)
     qatomic_set(&s->skip_unallocated, skip);
 }
 
+/* Only set before any actual copy request, no need for locking. */
+void block_copy_set_write_behind(BlockCopyState *s, int64_t bytes)
+{
+    s->write_behind_max = bytes;
+}
+
+int coroutine_fn block_copy_wait_write_behind(BlockCopyState *s,
+                                              int64_t offset, int64_t bytes)
+{
+    QEMU_LOCK_GUARD(&s->lock);
+
+    reqlist_wait_all(&s->write_behind_reqs, offset, bytes, &s->lock);
+    return s->write_behind_ret;
+}
+
 void block_copy_set_speed(BlockCopyState *s, uint64_t speed)
 {
     ratelimit_set_speed(&s->rate_limit, speed, BLOCK_COPY_SLICE_TIME);
@@ -36,6 +36,8 @@
 
 #include "block/copy-before-write.h"
 #include "block/reqlist.h"
+#include "qemu/memalign.h"
+#include "qemu/range.h"
 
 #include "qapi/qapi-visit-block-core.h"
 
@@ -76,6 +78,21 @@ typedef struct BDRVCopyBeforeWriteState {
      * snapshot-API requests will fail with that error.
      */
     int snapshot_error;
+
+    /*
+     * Read-ahead for sequential snapshot reads, protected by @lock.
+     * @ra_buf holds @ra_bytes of snapshot data from @ra_offset if @ra_valid
+     * is set.  Snapshot data never changes, so the buffer can't go stale;
+     * only access to the area may be revoked.
+     */
+    int64_t read_ahead;
+    uint8_t *ra_buf;
+    int64_t ra_offset;
+    int64_t ra_bytes;
+    int64_t ra_next;
+    bool ra_valid;
+    bool ra_busy;
+    CoQueue ra_queue;
 } BDRVCopyBeforeWriteState;
 
 static int coroutine_fn GRAPH_RDLOCK
@@ -256,10 +273,35 @@ cbw_snapshot_read_unlock(BlockDriverState *bs, BlockReq *req)
     g_free(req);
 }
 
+/*
+ * Areas in @done_bitmap may still be being written to @target in the
+ * background; wait for that before reading them from there.
+ *
+ * The guest write that triggered the copy has already completed, so a
+ * failed background write always breaks the snapshot.
+ */
+static int coroutine_fn
+cbw_wait_write_behind(BDRVCopyBeforeWriteState *s, int64_t offset,
+                      int64_t bytes)
+{
+    int ret = block_copy_wait_write_behind(s->bcs, offset, bytes);
+
+    if (ret < 0) {
+        WITH_QEMU_LOCK_GUARD(&s->lock) {
+            if (!s->snapshot_error) {
+                s->snapshot_error = ret;
+            }
+        }
+    }
+
+    return ret;
+}
+
 static int coroutine_fn GRAPH_RDLOCK
-cbw_co_preadv_snapshot(BlockDriverState *bs, int64_t offset, int64_t bytes,
+cbw_do_preadv_snapshot(BlockDriverState *bs, int64_t offset, int64_t bytes,
                        QEMUIOVector *qiov, size_t qiov_offset)
 {
+    BDRVCopyBeforeWriteState *s = bs->opaque;
     BlockReq *req;
     BdrvChild *file;
     int ret;
@@ -273,6 +315,14 @@ cbw_co_preadv_snapshot(BlockDriverState *bs, int64_t offset, int64_t bytes,
             return -EACCES;
         }
 
+        if (file == s->target) {
+            ret = cbw_wait_write_behind(s, offset, cur_bytes);
+            if (ret < 0) {
+                cbw_snapshot_read_unlock(bs, req);
+                return ret;
+            }
+        }
+
         ret = bdrv_co_preadv_part(file, offset, cur_bytes,
                                   qiov, qiov_offset, 0);
         cbw_snapshot_read_unlock(bs, req);
@@ -288,6 +338,100 @@ cbw_co_preadv_snapshot(BlockDriverState *bs, int64_t offset, int64_t bytes,
     return 0;
 }
 
+static void coroutine_fn cbw_read_ahead_entry(void *opaque)
+{
+    BlockDriverState *bs = opaque;
+    BDRVCopyBeforeWriteState *s = bs->opaque;
+    QEMUIOVector qiov;
+    int ret;
+
+    /* @ra_offset and @ra_bytes don't change while @ra_busy is set */
+    qemu_iovec_init_buf(&qiov, s->ra_buf, s->ra_bytes);
+    WITH_GRAPH_RDLOCK_GUARD() {
+        ret = cbw_do_preadv_snapshot(bs, s->ra_offset, s->ra_bytes, &qiov, 0);
+    }
+
+    WITH_QEMU_LOCK_GUARD(&s->lock) {
+        s->ra_valid = ret == 0;
+        s->ra_busy = false;
+        qemu_co_queue_restart_all(&s->ra_queue);
+    }
+
+    bdrv_dec_in_flight(bs);
+}
+
+/* Refill the read-ahead buffer from @offset once it has been consumed */
+static void coroutine_fn cbw_start_read_ahead(BlockDriverState *bs,
+                                              int64_t offset)
+{
+    BDRVCopyBeforeWriteState *s = bs->opaque;
+    int64_t len = bs->total_sectors * BDRV_SECTOR_SIZE;
+    Coroutine *co;
+
+    WITH_QEMU_LOCK_GUARD(&s->lock) {
+        if (s->ra_busy || offset >= len ||
+            (s->ra_valid && offset >= s->ra_offset &&
+             offset < s->ra_offset + s->ra_bytes)) {
+            return;
+        }
+
+        s->ra_busy = true;
+        s->ra_valid = false;
+        s->ra_offset = offset;
+        s->ra_bytes = MIN(s->read_ahead, len - offset);
+    }
+
+    bdrv_inc_in_flight(bs);
+    co = qemu_coroutine_create(cbw_read_ahead_entry, bs);
+    aio_co_enter(bdrv_get_aio_context(bs), co);
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+cbw_co_preadv_snapshot(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                       QEMUIOVector *qiov, size_t qiov_offset)
+{
+    BDRVCopyBeforeWriteState *s = bs->opaque;
+    bool hit = false, sequential = false;
+    int ret;
+
+    if (!s->read_ahead || bytes > s->read_ahead) {
+        return cbw_do_preadv_snapshot(bs, offset, bytes, qiov, qiov_offset);
+    }
+
+    WITH_QEMU_LOCK_GUARD(&s->lock) {
+        while (s->ra_busy &&
+               ranges_overlap(offset, bytes, s->ra_offset, s->ra_bytes)) {
+            qemu_co_queue_wait(&s->ra_queue, &s->lock);
+        }
+
+        hit = !s->ra_busy && s->ra_valid && !s->snapshot_error &&
+              offset >= s->ra_offset &&
+              offset + bytes <= s->ra_offset + s->ra_bytes &&
+              bdrv_dirty_bitmap_next_zero(s->access_bitmap,
+                                          offset, bytes) == -1;
+        if (hit) {
+            qemu_iovec_from_buf(qiov, qiov_offset,
+                                s->ra_buf + (offset - s->ra_offset), bytes);
+        }
+
+        sequential = offset == s->ra_next;
+        s->ra_next = offset + bytes;
+    }
+
+    if (!hit) {
+        ret = cbw_do_preadv_snapshot(bs, offset, bytes, qiov, qiov_offset);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    if (sequential) {
+        cbw_start_read_ahead(bs, offset + bytes);
+    }
+
+    return 0;
+}
+
 static int coroutine_fn GRAPH_RDLOCK
 cbw_co_snapshot_block_status(BlockDriverState *bs,
                              bool want_zero, int64_t offset, int64_t bytes,
@@ -305,6 +449,14 @@ cbw_co_snapshot_block_status(BlockDriverState *bs,
         return -EACCES;
     }
 
+    if (child == s->target) {
+        ret = cbw_wait_write_behind(s, offset, cur_bytes);
+        if (ret < 0) {
+            cbw_snapshot_read_unlock(bs, req);
+            return ret;
+        }
+    }
+
     ret = bdrv_co_block_status(child->bs, offset, cur_bytes, pnum, map, file);
     if (child == s->target) {
         /*
@@ -396,6 +548,8 @@ static BlockdevOptions *cbw_parse_options(QDict *options, Error **errp)
     qdict_extract_subqdict(options, NULL, "bitmap");
     qdict_del(options, "on-cbw-error");
     qdict_del(options, "cbw-timeout");
+    qdict_del(options, "write-behind");
+    qdict_del(options, "read-ahead");
 
 out:
     visit_free(v);
@@ -445,6 +599,16 @@ static int cbw_open(BlockDriverState *bs, QDict *options, int flags,
             ON_CBW_ERROR_BREAK_GUEST_WRITE;
     s->cbw_timeout_ns = opts->has_cbw_timeout ?
         opts->cbw_timeout * NANOSECONDS_PER_SECOND : 0;
+    if (opts->has_read_ahead && opts->read_ahead > BDRV_REQUEST_MAX_BYTES) {
+        error_setg(errp, "read-ahead must not exceed %" PRId64 " bytes",
+                   (int64_t)BDRV_REQUEST_MAX_BYTES);
+        return -EINVAL;
+    }
+    if (opts->has_write_behind && opts->write_behind > INT64_MAX) {
+        error_setg(errp, "write-behind is too large");
+        return -EINVAL;
+    }
+    s->read_ahead = opts->has_read_ahead ? opts->read_ahead : 0;
 
     bs->total_sectors = bs->file->bs->total_sectors;
     bs->supported_write_flags = BDRV_REQ_WRITE_UNCHANGED |
@@ -458,6 +622,9 @@ static int cbw_open(BlockDriverState *bs, QDict *options, int flags,
         error_prepend(errp, "Cannot create block-copy-state: ");
         return -EINVAL;
     }
+    if (opts->has_write_behind) {
+        block_copy_set_write_behind(s->bcs, opts->write_behind);
+    }
 
     cluster_size = block_copy_cluster_size(s->bcs);
 
@@ -477,7 +644,13 @@ static int cbw_open(BlockDriverState *bs, QDict *options, int flags,
                                      block_copy_dirty_bitmap(s->bcs), NULL,
                                      true);
 
+    if (s->read_ahead) {
+        s->ra_buf = qemu_blockalign(bs->file->bs, s->read_ahead);
+        s->ra_next = -1;
+    }
+
     qemu_co_mutex_init(&s->lock);
+    qemu_co_queue_init(&s->ra_queue);
     QLIST_INIT(&s->frozen_read_reqs);
     return 0;
 }
@@ -488,6 +661,7 @@ static void cbw_close(BlockDriverState *bs)
 
     bdrv_release_dirty_bitmap(s->access_bitmap);
     bdrv_release_dirty_bitmap(s->done_bitmap);
+    qemu_vfree(s->ra_buf);
 
     block_copy_state_free(s->bcs);
     s->bcs = NULL;
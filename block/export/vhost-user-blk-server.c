@@ -18,6 +18,7 @@
 #include "vhost-user-blk-server.h"
 #include "qapi/error.h"
 #include "qom/object_interfaces.h"
+#include "sysemu/iothread.h"
 #include "util/block-helpers.h"
 #include "virtio-blk-handler.h"
 
@@ -38,6 +39,7 @@ typedef struct {
     VirtioBlkHandler handler;
     QIOChannelSocket *sioc;
     struct virtio_blk_config blkcfg;
+    AioContext **vq_ctxs;
 } VuBlkExport;
 
 static void vu_blk_req_complete(VuBlkReq *req, size_t in_len)
@@ -322,6 +324,8 @@ static int vu_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
     Error *local_err = NULL;
     uint64_t logical_block_size;
     uint16_t num_queues = VHOST_USER_BLK_NUM_QUEUES_DEFAULT;
+    strList *iothreads;
+    int nr_vq_ctxs = 0;
 
     vexp->blkcfg.wce = 0;
 
@@ -344,6 +348,20 @@ static int vu_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
         error_setg(errp, "num-queues must be greater than 0");
         return -EINVAL;
     }
+
+    for (iothreads = vu_opts->iothreads; iothreads;
+         iothreads = iothreads->next) {
+        IOThread *iothread = iothread_by_id(iothreads->value);
+
+        if (!iothread) {
+            error_setg(errp, "iothread \"%s\" not found", iothreads->value);
+            g_free(vexp->vq_ctxs);
+            vexp->vq_ctxs = NULL;
+            return -EINVAL;
+        }
+        vexp->vq_ctxs = g_renew(AioContext *, vexp->vq_ctxs, nr_vq_ctxs + 1);
+        vexp->vq_ctxs[nr_vq_ctxs++] = iothread_get_aio_context(iothread);
+    }
     vexp->handler.blk = exp->blk;
     vexp->handler.serial = g_strdup("vhost_user_blk");
     vexp->handler.logical_block_size = logical_block_size;
@@ -358,10 +376,12 @@ static int vu_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
     blk_set_dev_ops(exp->blk, &vu_blk_dev_ops, vexp);
 
     if (!vhost_user_server_start(&vexp->vu_server, vu_opts->addr, exp->ctx,
+                                 vexp->vq_ctxs, nr_vq_ctxs,
                                  num_queues, &vu_blk_iface, errp)) {
         blk_remove_aio_context_notifier(exp->blk, blk_aio_attached,
                                         blk_aio_detach, vexp);
         g_free(vexp->handler.serial);
+        g_free(vexp->vq_ctxs);
         return -EADDRNOTAVAIL;
     }
 
@@ -375,6 +395,7 @@ static void vu_blk_exp_delete(BlockExport *exp)
     blk_remove_aio_context_notifier(exp->blk, blk_aio_attached, blk_aio_detach,
                                     vexp);
     g_free(vexp->handler.serial);
+    g_free(vexp->vq_ctxs);
 }
 
 const BlockExportDriver blk_exp_vhost_user_blk = {
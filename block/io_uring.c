@@ -16,6 +16,8 @@
 #include "block/raw-aio.h"
 #include "qemu/coroutine.h"
 #include "qemu/defer-call.h"
+#include "qemu/lockable.h"
+#include "qemu/units.h"
 #include "qapi/error.h"
 #include "sysemu/block-backend.h"
 #include "trace.h"
@@ -26,6 +28,30 @@
 /* io_uring ring size */
 #define MAX_ENTRIES 128
 
+/*
+ * Buffers registered with luring_register_buf(), usually guest RAM.  Every
+ * ring registers the same table as fixed buffers and picks up changes the
+ * next time it submits a request, see luring_sync_fixed_bufs().  The
+ * kernel limits each fixed buffer to 1 GiB, so larger areas take several
+ * slots.
+ */
+#define LURING_MAX_FIXED_BUFS 1024
+#define LURING_MAX_FIXED_BUF_SIZE (1 * GiB)
+
+typedef struct LuringFixedBuf {
+    struct iovec iov;
+    unsigned int refcnt;
+} LuringFixedBuf;
+
+static QemuMutex luring_fixed_lock;
+static LuringFixedBuf luring_fixed_bufs[LURING_MAX_FIXED_BUFS];
+static unsigned int luring_fixed_gen;
+
+static void __attribute__((constructor)) luring_fixed_init(void)
+{
+    qemu_mutex_init(&luring_fixed_lock);
+}
+
 typedef struct LuringAIOCB {
     Coroutine *co;
     struct io_uring_sqe sqeq;
@@ -58,6 +84,12 @@ struct LuringState {
     LuringQueue io_q;
 
     QEMUBH *completion_bh;
+
+    /* Fixed buffers registered with this ring, indexed like the kernel's */
+    struct iovec *fixed_bufs;
+    unsigned int nr_fixed_bufs; /* no buffer at or after this index */
+    unsigned int fixed_gen;
+    bool fixed_bufs_failed;
 };
 
 /**
@@ -88,6 +120,14 @@ static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
 
     /* Update read position */
     luringcb->total_read += nread;
+
+    if (luringcb->sqeq.opcode == IORING_OP_READ_FIXED) {
+        luringcb->sqeq.off += nread;
+        luringcb->sqeq.addr += nread;
+        luringcb->sqeq.len -= nread;
+        luring_resubmit(s, luringcb);
+        return;
+    }
     remaining = luringcb->qiov->size - luringcb->total_read;
 
     /* Shorten qiov */
@@ -323,6 +363,74 @@ static void luring_deferred_fn(void *opaque)
     }
 }
 
+/**
+ * luring_sync_fixed_bufs:
+ *
+ * Bring the fixed buffers of the ring up to date with luring_fixed_bufs.
+ */
+static void luring_sync_fixed_bufs(LuringState *s)
+{
+#ifdef HAVE_IO_URING_REGISTER_BUFFERS_SPARSE
+    unsigned int i;
+    int rc;
+
+    if (likely(qatomic_read(&luring_fixed_gen) == s->fixed_gen) ||
+        s->fixed_bufs_failed) {
+        return;
+    }
+
+    QEMU_LOCK_GUARD(&luring_fixed_lock);
+
+    if (!s->fixed_bufs) {
+        rc = io_uring_register_buffers_sparse(&s->ring, LURING_MAX_FIXED_BUFS);
+        if (rc < 0) {
+            trace_luring_fixed_bufs_unsupported(s, rc);
+            s->fixed_bufs_failed = true;
+            return;
+        }
+        s->fixed_bufs = g_new0(struct iovec, LURING_MAX_FIXED_BUFS);
+    }
+
+    s->nr_fixed_bufs = 0;
+    for (i = 0; i < LURING_MAX_FIXED_BUFS; i++) {
+        struct iovec *iov = &luring_fixed_bufs[i].iov;
+        struct iovec *cur = &s->fixed_bufs[i];
+
+        if (iov->iov_base != cur->iov_base || iov->iov_len != cur->iov_len) {
+            __u64 tag = 0;
+
+            /* An empty iovec clears the slot */
+            rc = io_uring_register_buffers_update_tag(&s->ring, i, iov,
+                                                      &tag, 1);
+            trace_luring_fixed_buf_update(s, i, iov->iov_base, iov->iov_len,
+                                          rc);
+            *cur = rc < 0 ? (struct iovec) {} : *iov;
+        }
+        if (cur->iov_base) {
+            s->nr_fixed_bufs = i + 1;
+        }
+    }
+    s->fixed_gen = luring_fixed_gen;
+#endif
+}
+
+/* Return the fixed buffer that contains @iov, or -1 */
+static int luring_fixed_buf_index(LuringState *s, const struct iovec *iov)
+{
+    uintptr_t start = (uintptr_t)iov->iov_base;
+    uintptr_t end = start + iov->iov_len;
+    unsigned int i;
+
+    for (i = 0; i < s->nr_fixed_bufs; i++) {
+        uintptr_t base = (uintptr_t)s->fixed_bufs[i].iov_base;
+
+        if (base && base <= start && end <= base + s->fixed_bufs[i].iov_len) {
+            return i;
+        }
+    }
+    return -1;
+}
+
 /**
  * luring_do_submit:
  * @fd: file descriptor for I/O
@@ -339,9 +447,23 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
 {
     int ret;
     struct io_uring_sqe *sqes = &luringcb->sqeq;
+    int buf_index = -1;
+
+    if (type == QEMU_AIO_READ || type == QEMU_AIO_WRITE) {
+        luring_sync_fixed_bufs(s);
+        if (s->nr_fixed_bufs && luringcb->qiov->niov == 1) {
+            buf_index = luring_fixed_buf_index(s, luringcb->qiov->iov);
+        }
+    }
 
     switch (type) {
     case QEMU_AIO_WRITE:
+        if (buf_index >= 0) {
+            io_uring_prep_write_fixed(sqes, fd, luringcb->qiov->iov->iov_base,
+                                      luringcb->qiov->iov->iov_len, offset,
+                                      buf_index);
+            break;
+        }
         io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
                              luringcb->qiov->niov, offset);
         break;
@@ -350,6 +472,12 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
                              luringcb->qiov->niov, offset);
         break;
     case QEMU_AIO_READ:
+        if (buf_index >= 0) {
+            io_uring_prep_read_fixed(sqes, fd, luringcb->qiov->iov->iov_base,
+                                     luringcb->qiov->iov->iov_len, offset,
+                                     buf_index);
+            break;
+        }
         io_uring_prep_readv(sqes, fd, luringcb->qiov->iov,
                             luringcb->qiov->niov, offset);
         break;
@@ -446,5 +574,72 @@ void luring_cleanup(LuringState *s)
 {
     io_uring_queue_exit(&s->ring);
     trace_luring_cleanup_state(s);
+    g_free(s->fixed_bufs);
     g_free(s);
 }
+
+/*
+ * Register [@host, @host + @size) as fixed buffers for all rings.  This is
+ * best effort: parts that do not fit in the table are left out and I/O to
+ * them keeps using plain readv/writev.  Registering the same area again
+ * only takes a reference.
+ */
+void luring_register_buf(void *host, size_t size)
+{
+    size_t off, len;
+    int i, free_slot;
+
+    QEMU_LOCK_GUARD(&luring_fixed_lock);
+
+    for (off = 0; off < size; off += len) {
+        void *base = host + off;
+
+        len = MIN(size - off, LURING_MAX_FIXED_BUF_SIZE);
+        free_slot = -1;
+        for (i = 0; i < LURING_MAX_FIXED_BUFS; i++) {
+            struct iovec *iov = &luring_fixed_bufs[i].iov;
+
+            if (iov->iov_base == base && iov->iov_len == len) {
+                break;
+            }
+            if (!iov->iov_base && free_slot < 0) {
+                free_slot = i;
+            }
+        }
+
+        if (i < LURING_MAX_FIXED_BUFS) {
+            luring_fixed_bufs[i].refcnt++;
+        } else if (free_slot >= 0) {
+            luring_fixed_bufs[free_slot] = (LuringFixedBuf) {
+                .iov = { .iov_base = base, .iov_len = len },
+                .refcnt = 1,
+            };
+            qatomic_inc(&luring_fixed_gen);
+        }
+    }
+}
+
+void luring_unregister_buf(void *host, size_t size)
+{
+    size_t off, len;
+    int i;
+
+    QEMU_LOCK_GUARD(&luring_fixed_lock);
+
+    for (off = 0; off < size; off += len) {
+        void *base = host + off;
+
+        len = MIN(size - off, LURING_MAX_FIXED_BUF_SIZE);
+        for (i = 0; i < LURING_MAX_FIXED_BUFS; i++) {
+            LuringFixedBuf *buf = &luring_fixed_bufs[i];
+
+            if (buf->iov.iov_base == base && buf->iov.iov_len == len) {
+                if (--buf->refcnt == 0) {
+                    buf->iov = (struct iovec) {};
+                    qatomic_inc(&luring_fixed_gen);
+                }
+                break;
+            }
+        }
+    }
+}
@@ -24,6 +24,7 @@
 #include "qemu/ratelimit.h"
 #include "qemu/bitmap.h"
 #include "qemu/memalign.h"
+#include "qemu/madvise.h"
 
 #define MAX_IN_FLIGHT 16
 #define MAX_IO_BYTES (1 << 20) /* 1 Mb */
@@ -93,6 +94,8 @@ typedef struct MirrorBlockJob {
     int64_t active_write_bytes_in_flight;
     bool prepared;
     bool in_drain;
+    /* Cleared on the first failed offloaded copy */
+    bool use_copy_range;
 } MirrorBlockJob;
 
 typedef struct MirrorBDSOpaque {
@@ -371,6 +374,35 @@ static void coroutine_fn mirror_co_read(void *opaque)
     assert(QEMU_IS_ALIGNED(op->offset, s->granularity));
     /* The range is sector-aligned, since bdrv_getlength() rounds up. */
     assert(QEMU_IS_ALIGNED(op->bytes, BDRV_SECTOR_SIZE));
+
+    if (s->use_copy_range) {
+        /*
+         * Let the drivers copy the data without going through the bounce
+         * buffer.  Any failure, including a plain -ENOTSUP, disables the
+         * offload and the area is copied again below.
+         */
+        s->in_flight++;
+        s->bytes_in_flight += op->bytes;
+        op->is_in_flight = true;
+        trace_mirror_one_iteration(s, op->offset, op->bytes);
+
+        WITH_GRAPH_RDLOCK_GUARD() {
+            ret = bdrv_co_copy_range(s->mirror_top_bs->backing, op->offset,
+                                     blk_root(s->target), op->offset,
+                                     op->bytes, 0, 0);
+        }
+        if (ret == 0) {
+            mirror_iteration_done(op, 0);
+            return;
+        }
+
+        trace_mirror_copy_range_fail(s, op->offset, ret);
+        s->use_copy_range = false;
+        s->in_flight--;
+        s->bytes_in_flight -= op->bytes;
+        op->is_in_flight = false;
+    }
+
     nb_chunks = DIV_ROUND_UP(op->bytes, s->granularity);
 
     while (s->buf_free_count < nb_chunks) {
@@ -484,8 +516,8 @@ static void coroutine_fn GRAPH_RDLOCK mirror_iteration(MirrorBlockJob *s)
     BlockDriverState *source = s->mirror_top_bs->backing->bs;
     MirrorOp *pseudo_op;
     int64_t offset;
-    /* At least the first dirty chunk is mirrored in one iteration. */
-    int nb_chunks = 1;
+    int64_t bytes, next_clean;
+    int nb_chunks;
     bool write_zeroes_ok = bdrv_can_write_zeroes_with_unmap(blk_bs(s->target));
     int max_io_bytes = MAX(s->buf_size / MAX_IN_FLIGHT, MAX_IO_BYTES);
 
@@ -510,29 +542,25 @@ static void coroutine_fn GRAPH_RDLOCK mirror_iteration(MirrorBlockJob *s)
 
     job_pause_point(&s->common.job);
 
-    /* Find the number of consecutive dirty chunks following the first dirty
-     * one, and wait for in flight requests in them. */
+    /*
+     * Find the number of consecutive dirty chunks following the first dirty
+     * one that are not in flight.  Both bitmaps are searched a word at a
+     * time rather than chunk by chunk.  At least the first dirty chunk is
+     * mirrored in one iteration.
+     */
     bdrv_dirty_bitmap_lock(s->dirty_bitmap);
-    while (nb_chunks * s->granularity < s->buf_size) {
-        int64_t next_dirty;
-        int64_t next_offset = offset + nb_chunks * s->granularity;
-        int64_t next_chunk = next_offset / s->granularity;
-        if (next_offset >= s->bdev_length ||
-            !bdrv_dirty_bitmap_get_locked(s->dirty_bitmap, next_offset)) {
-            break;
-        }
-        if (test_bit(next_chunk, s->in_flight_bitmap)) {
-            break;
-        }
-
-        next_dirty = bdrv_dirty_iter_next(s->dbi);
-        if (next_dirty > next_offset || next_dirty < 0) {
-            /* The bitmap iterator's cache is stale, refresh it */
-            bdrv_set_dirty_iter(s->dbi, next_offset);
-            next_dirty = bdrv_dirty_iter_next(s->dbi);
-        }
-        assert(next_dirty == next_offset);
-        nb_chunks++;
+    bytes = MIN(s->buf_size, s->bdev_length - offset);
+    next_clean = bdrv_dirty_bitmap_next_zero(s->dirty_bitmap, offset, bytes);
+    if (next_clean >= 0) {
+        bytes = MAX(next_clean - offset, s->granularity);
+    }
+    nb_chunks = DIV_ROUND_UP(bytes, s->granularity);
+    nb_chunks = find_next_bit(s->in_flight_bitmap,
+                              offset / s->granularity + nb_chunks,
+                              offset / s->granularity + 1) -
+                offset / s->granularity;
+    if (offset + nb_chunks * s->granularity < s->bdev_length) {
+        bdrv_set_dirty_iter(s->dbi, offset + nb_chunks * s->granularity);
     }
 
     /* Clear dirty bits before querying the block status, because
@@ -1002,11 +1030,29 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
     s->max_iov = MIN(bs->bl.max_iov, target_bs->bl.max_iov);
     bdrv_graph_co_rdunlock();
 
-    s->buf = qemu_try_blockalign(bs, s->buf_size);
+    /*
+     * The buffer is carved into granularity-sized chunks and reused for the
+     * whole job.  Large buffers are aligned so that they can be backed by
+     * transparent huge pages, which saves TLB misses on the copy path.
+     */
+#ifdef QEMU_VMALLOC_ALIGN
+    if (s->buf_size >= QEMU_VMALLOC_ALIGN) {
+        s->buf = qemu_try_memalign(MAX(QEMU_VMALLOC_ALIGN,
+                                       bdrv_opt_mem_align(bs)),
+                                   s->buf_size);
+        if (s->buf) {
+            qemu_madvise(s->buf, s->buf_size, QEMU_MADV_HUGEPAGE);
+        }
+    } else
+#endif
+    {
+        s->buf = qemu_try_blockalign(bs, s->buf_size);
+    }
     if (s->buf == NULL) {
         ret = -ENOMEM;
         goto immediate_exit;
     }
+    s->use_copy_range = true;
 
     mirror_free_init(s);
 
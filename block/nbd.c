@@ -48,7 +48,9 @@
 #include "qemu/yank.h"
 
 #define EN_OPTSTR ":exportname="
-#define MAX_NBD_REQUESTS    16
+#define DEFAULT_NBD_REQUESTS    16
+#define MAX_NBD_REQUESTS        1024
+#define MAX_NBD_CONNS           16
 
 #define COOKIE_TO_INDEX(cookie) ((cookie) - 1)
 #define INDEX_TO_COOKIE(index)  ((index) + 1)
@@ -71,14 +73,15 @@ typedef struct BDRVNBDState {
     NBDExportInfo info;
 
     /*
-     * Protects state, free_sema, in_flight, requests[].coroutine,
+     * Protects state, free_sema, in_flight, window, requests[].coroutine,
      * reconnect_delay_timer.
      */
     QemuMutex requests_lock;
     NBDClientState state;
     CoQueue free_sema;
     unsigned in_flight;
-    NBDClientRequest requests[MAX_NBD_REQUESTS];
+    unsigned window;                /* current limit for in_flight */
+    NBDClientRequest *requests;     /* max_requests entries */
     QEMUTimer *reconnect_delay_timer;
 
     /* Protects sending data on the socket.  */
@@ -95,9 +98,20 @@ typedef struct BDRVNBDState {
 
     BlockDriverState *bs;
 
+    /*
+     * All connections to the server, conns[0] being this state.  The
+     * others share its connection parameters and only carry I/O; they
+     * exist only if the server advertised NBD_FLAG_CAN_MULTI_CONN.
+     */
+    struct BDRVNBDState **conns;
+    unsigned nr_conns;
+    unsigned next_conn;
+
     /* Connection parameters */
     uint32_t reconnect_delay;
     uint32_t open_timeout;
+    uint32_t multi_conn;
+    uint32_t max_requests;
     SocketAddress *saddr;
     char *export;
     char *tlscredsid;
@@ -114,6 +128,21 @@ static void nbd_yank(void *opaque);
 static void nbd_clear_bdrvstate(BlockDriverState *bs)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    unsigned i;
+
+    for (i = 1; i < s->nr_conns; i++) {
+        BDRVNBDState *c = s->conns[i];
+
+        assert(!c->reconnect_delay_timer);
+        nbd_client_connection_release(c->conn);
+        g_free(c->requests);
+        g_free(c);
+    }
+    g_free(s->conns);
+    s->conns = NULL;
+    s->nr_conns = 0;
+    g_free(s->requests);
+    s->requests = NULL;
 
     nbd_client_connection_release(s->conn);
     s->conn = NULL;
@@ -154,7 +183,7 @@ static void coroutine_fn nbd_recv_coroutines_wake(BDRVNBDState *s)
     int i;
 
     QEMU_LOCK_GUARD(&s->receive_mutex);
-    for (i = 0; i < MAX_NBD_REQUESTS; i++) {
+    for (i = 0; i < s->max_requests; i++) {
         if (nbd_recv_coroutine_wake_one(&s->requests[i])) {
             return;
         }
@@ -172,6 +201,9 @@ static void coroutine_fn nbd_channel_error_locked(BDRVNBDState *s, int ret)
         if (s->state == NBD_CLIENT_CONNECTED) {
             s->state = s->reconnect_delay ? NBD_CLIENT_CONNECTING_WAIT :
                                             NBD_CLIENT_CONNECTING_NOWAIT;
+            /* Go easier on a server that just dropped us */
+            s->window = MAX(s->window / 2,
+                            MIN(s->max_requests, DEFAULT_NBD_REQUESTS));
         }
     } else {
         s->state = NBD_CLIENT_QUIT;
@@ -216,16 +248,14 @@ static void reconnect_delay_timer_init(BDRVNBDState *s, uint64_t expire_time_ns)
     timer_mod(s->reconnect_delay_timer, expire_time_ns);
 }
 
-static void nbd_teardown_connection(BlockDriverState *bs)
+static void nbd_teardown_connection(BDRVNBDState *s)
 {
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
-
     assert(!s->in_flight);
 
     if (s->ioc) {
         qio_channel_shutdown(s->ioc, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
         yank_unregister_function(BLOCKDEV_YANK_INSTANCE(s->bs->node_name),
-                                 nbd_yank, s->bs);
+                                 nbd_yank, s);
         object_unref(OBJECT(s->ioc));
         s->ioc = NULL;
     }
@@ -316,12 +346,31 @@ nbd_handle_updated_info(BlockDriverState *bs, Error **errp)
     return 0;
 }
 
-int coroutine_fn nbd_co_do_establish_connection(BlockDriverState *bs,
-                                                bool blocking, Error **errp)
+/*
+ * Requests go to any of the connections, so the extra ones must have
+ * negotiated the same export as the first.
+ */
+static int nbd_check_conn_info(BDRVNBDState *s, Error **errp)
+{
+    BDRVNBDState *first = s->bs->opaque;
+
+    if (s->info.size != first->info.size ||
+        s->info.flags != first->info.flags ||
+        s->info.mode != first->info.mode ||
+        s->info.base_allocation != first->info.base_allocation ||
+        s->info.min_block != first->info.min_block ||
+        s->info.max_block != first->info.max_block) {
+        error_setg(errp, "server changed the export between connections");
+        return -EINVAL;
+    }
+    s->alloc_depth = first->alloc_depth;
+    return 0;
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+nbd_co_conn_establish(BDRVNBDState *s, bool blocking, Error **errp)
 {
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
     int ret;
-    IO_CODE();
 
     assert_bdrv_graph_readable();
     assert(!s->ioc);
@@ -332,9 +381,13 @@ int coroutine_fn nbd_co_do_establish_connection(BlockDriverState *bs,
     }
 
     yank_register_function(BLOCKDEV_YANK_INSTANCE(s->bs->node_name), nbd_yank,
-                           bs);
+                           s);
 
-    ret = nbd_handle_updated_info(s->bs, NULL);
+    if (s == s->bs->opaque) {
+        ret = nbd_handle_updated_info(s->bs, NULL);
+    } else {
+        ret = nbd_check_conn_info(s, errp);
+    }
     if (ret < 0) {
         /*
          * We have connected, but must fail for other reasons.
@@ -345,7 +398,7 @@ int coroutine_fn nbd_co_do_establish_connection(BlockDriverState *bs,
         nbd_send_request(s->ioc, &request);
 
         yank_unregister_function(BLOCKDEV_YANK_INSTANCE(s->bs->node_name),
-                                 nbd_yank, bs);
+                                 nbd_yank, s);
         object_unref(OBJECT(s->ioc));
         s->ioc = NULL;
 
@@ -363,6 +416,17 @@ int coroutine_fn nbd_co_do_establish_connection(BlockDriverState *bs,
     return 0;
 }
 
+int coroutine_fn nbd_co_do_establish_connection(BlockDriverState *bs,
+                                                unsigned conn, bool blocking,
+                                                Error **errp)
+{
+    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    IO_CODE();
+
+    assert(conn < s->nr_conns);
+    return nbd_co_conn_establish(s->conns[conn], blocking, errp);
+}
+
 /* Called with s->requests_lock held.  */
 static bool nbd_client_connecting(BDRVNBDState *s)
 {
@@ -399,13 +463,13 @@ static void coroutine_fn GRAPH_RDLOCK nbd_reconnect_attempt(BDRVNBDState *s)
     /* Finalize previous connection if any */
     if (s->ioc) {
         yank_unregister_function(BLOCKDEV_YANK_INSTANCE(s->bs->node_name),
-                                 nbd_yank, s->bs);
+                                 nbd_yank, s);
         object_unref(OBJECT(s->ioc));
         s->ioc = NULL;
     }
 
     qemu_mutex_unlock(&s->requests_lock);
-    ret = nbd_co_do_establish_connection(s->bs, blocking, NULL);
+    ret = nbd_co_conn_establish(s, blocking, NULL);
     trace_nbd_reconnect_attempt_result(ret, s->bs->in_flight);
     qemu_mutex_lock(&s->requests_lock);
 
@@ -475,7 +539,7 @@ static coroutine_fn int nbd_receive_replies(BDRVNBDState *s, uint64_t cookie,
             return -EINVAL;
         }
         ind2 = COOKIE_TO_INDEX(s->reply.cookie);
-        if (ind2 >= MAX_NBD_REQUESTS || !s->requests[ind2].coroutine) {
+        if (ind2 >= s->max_requests || !s->requests[ind2].coroutine) {
             nbd_channel_error(s, -EINVAL);
             error_setg(errp, "unexpected cookie value");
             return -EINVAL;
@@ -488,15 +552,54 @@ static coroutine_fn int nbd_receive_replies(BDRVNBDState *s, uint64_t cookie,
     }
 }
 
+/*
+ * Spread the requests round-robin over the connections.  With
+ * NBD_FLAG_CAN_MULTI_CONN the server promises that all of them see the
+ * same data, and that a flush on one of them covers the writes completed
+ * on the others.
+ */
+static BDRVNBDState *nbd_pick_conn(BlockDriverState *bs)
+{
+    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BDRVNBDState *c;
+
+    if (s->nr_conns == 1) {
+        return s;
+    }
+    c = s->conns[qatomic_fetch_inc(&s->next_conn) % s->nr_conns];
+
+    /* An extra connection that gave up for good is of no use */
+    return qatomic_read(&c->state) == NBD_CLIENT_QUIT ? s : c;
+}
+
+/*
+ * Called with s->requests_lock held when the request in slot @i, if any,
+ * has left the window.  Others waiting for a slot mean that the window
+ * is too small for the bandwidth-delay product of the link, so open it
+ * up by one, until it reaches @max-requests.
+ */
+static void coroutine_fn nbd_request_done_locked(BDRVNBDState *s, int i)
+{
+    if (i != -1) {
+        s->requests[i].coroutine = NULL;
+    }
+    s->in_flight--;
+    if (!qemu_co_queue_empty(&s->free_sema) &&
+        s->window < s->max_requests) {
+        s->window++;
+        qemu_co_queue_next(&s->free_sema);
+    }
+    qemu_co_queue_next(&s->free_sema);
+}
+
 static int coroutine_fn GRAPH_RDLOCK
-nbd_co_send_request(BlockDriverState *bs, NBDRequest *request,
+nbd_co_send_request(BDRVNBDState *s, NBDRequest *request,
                     QEMUIOVector *qiov)
 {
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
     int rc, i = -1;
 
     qemu_mutex_lock(&s->requests_lock);
-    while (s->in_flight == MAX_NBD_REQUESTS ||
+    while (s->in_flight >= s->window ||
            (s->state != NBD_CLIENT_CONNECTED && s->in_flight > 0)) {
         qemu_co_queue_wait(&s->free_sema, &s->requests_lock);
     }
@@ -513,13 +616,13 @@ nbd_co_send_request(BlockDriverState *bs, NBDRequest *request,
         }
     }
 
-    for (i = 0; i < MAX_NBD_REQUESTS; i++) {
+    for (i = 0; i < s->max_requests; i++) {
         if (s->requests[i].coroutine == NULL) {
             break;
         }
     }
 
-    assert(i < MAX_NBD_REQUESTS);
+    assert(i < s->max_requests);
     s->requests[i].coroutine = qemu_coroutine_self();
     s->requests[i].offset = request->from;
     s->requests[i].receiving = false;
@@ -548,11 +651,7 @@ nbd_co_send_request(BlockDriverState *bs, NBDRequest *request,
         qemu_mutex_lock(&s->requests_lock);
 err:
         nbd_channel_error_locked(s, rc);
-        if (i != -1) {
-            s->requests[i].coroutine = NULL;
-        }
-        s->in_flight--;
-        qemu_co_queue_next(&s->free_sema);
+        nbd_request_done_locked(s, i);
         qemu_mutex_unlock(&s->requests_lock);
     }
     return rc;
@@ -1059,9 +1158,7 @@ static bool coroutine_fn nbd_reply_chunk_iter_receive(BDRVNBDState *s,
 
 break_loop:
     qemu_mutex_lock(&s->requests_lock);
-    s->requests[COOKIE_TO_INDEX(cookie)].coroutine = NULL;
-    s->in_flight--;
-    qemu_co_queue_next(&s->free_sema);
+    nbd_request_done_locked(s, COOKIE_TO_INDEX(cookie));
     qemu_mutex_unlock(&s->requests_lock);
 
     return false;
@@ -1208,7 +1305,7 @@ nbd_co_request(BlockDriverState *bs, NBDRequest *request,
 {
     int ret, request_ret;
     Error *local_err = NULL;
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BDRVNBDState *s = nbd_pick_conn(bs);
 
     assert(request->type != NBD_CMD_READ);
     if (write_qiov) {
@@ -1219,7 +1316,7 @@ nbd_co_request(BlockDriverState *bs, NBDRequest *request,
     }
 
     do {
-        ret = nbd_co_send_request(bs, request, write_qiov);
+        ret = nbd_co_send_request(s, request, write_qiov);
         if (ret < 0) {
             continue;
         }
@@ -1246,7 +1343,7 @@ nbd_client_co_preadv(BlockDriverState *bs, int64_t offset, int64_t bytes,
 {
     int ret, request_ret;
     Error *local_err = NULL;
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BDRVNBDState *s = nbd_pick_conn(bs);
     NBDRequest request = {
         .type = NBD_CMD_READ,
         .from = offset,
@@ -1278,7 +1375,7 @@ nbd_client_co_preadv(BlockDriverState *bs, int64_t offset, int64_t bytes,
     }
 
     do {
-        ret = nbd_co_send_request(bs, &request, NULL);
+        ret = nbd_co_send_request(s, &request, NULL);
         if (ret < 0) {
             continue;
         }
@@ -1402,7 +1499,7 @@ static int coroutine_fn GRAPH_RDLOCK nbd_client_co_block_status(
 {
     int ret, request_ret;
     NBDExtent64 extent = { 0 };
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BDRVNBDState *s = nbd_pick_conn(bs);
     Error *local_err = NULL;
 
     NBDRequest request = {
@@ -1441,7 +1538,7 @@ static int coroutine_fn GRAPH_RDLOCK nbd_client_co_block_status(
         assert(QEMU_IS_ALIGNED(request.len, s->info.min_block));
     }
     do {
-        ret = nbd_co_send_request(bs, &request, NULL);
+        ret = nbd_co_send_request(s, &request, NULL);
         if (ret < 0) {
             continue;
         }
@@ -1486,8 +1583,7 @@ static int nbd_client_reopen_prepare(BDRVReopenState *state,
 
 static void nbd_yank(void *opaque)
 {
-    BlockDriverState *bs = opaque;
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BDRVNBDState *s = opaque;
 
     QEMU_LOCK_GUARD(&s->requests_lock);
     qio_channel_shutdown(s->ioc, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
@@ -1497,13 +1593,18 @@ static void nbd_yank(void *opaque)
 static void nbd_client_close(BlockDriverState *bs)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
-    NBDRequest request = { .type = NBD_CMD_DISC, .mode = s->info.mode };
+    unsigned i;
 
-    if (s->ioc) {
-        nbd_send_request(s->ioc, &request);
-    }
+    for (i = 0; i < s->nr_conns; i++) {
+        BDRVNBDState *c = s->conns[i];
+        NBDRequest request = { .type = NBD_CMD_DISC, .mode = c->info.mode };
+
+        if (c->ioc) {
+            nbd_send_request(c->ioc, &request);
+        }
 
-    nbd_teardown_connection(bs);
+        nbd_teardown_connection(c);
+    }
 }
 
 
@@ -1841,6 +1942,18 @@ static QemuOptsList nbd_runtime_opts = {
                     "attempts until successful or until @open-timeout seconds "
                     "have elapsed. Default 0",
         },
+        {
+            .name = "multi-conn",
+            .type = QEMU_OPT_NUMBER,
+            .help = "Number of connections to open to a server that "
+                    "supports multiple connections. Default 1",
+        },
+        {
+            .name = "max-requests",
+            .type = QEMU_OPT_NUMBER,
+            .help = "Maximum number of requests in flight on each "
+                    "connection. Default 16",
+        },
         { /* end of list */ }
     },
 };
@@ -1897,6 +2010,21 @@ static int nbd_process_options(BlockDriverState *bs, QDict *options,
     s->reconnect_delay = qemu_opt_get_number(opts, "reconnect-delay", 0);
     s->open_timeout = qemu_opt_get_number(opts, "open-timeout", 0);
 
+    s->multi_conn = qemu_opt_get_number(opts, "multi-conn", 1);
+    if (s->multi_conn < 1 || s->multi_conn > MAX_NBD_CONNS) {
+        error_setg(errp, "multi-conn must be between 1 and %d",
+                   MAX_NBD_CONNS);
+        goto error;
+    }
+
+    s->max_requests = qemu_opt_get_number(opts, "max-requests",
+                                          DEFAULT_NBD_REQUESTS);
+    if (s->max_requests < 1 || s->max_requests > MAX_NBD_REQUESTS) {
+        error_setg(errp, "max-requests must be between 1 and %d",
+                   MAX_NBD_REQUESTS);
+        goto error;
+    }
+
     ret = 0;
 
  error:
@@ -1904,18 +2032,64 @@ static int nbd_process_options(BlockDriverState *bs, QDict *options,
     return ret;
 }
 
-static int nbd_open(BlockDriverState *bs, QDict *options, int flags,
-                    Error **errp)
+static void nbd_init_conn(BlockDriverState *bs, BDRVNBDState *s,
+                          uint32_t max_requests)
 {
-    int ret;
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
-
     s->bs = bs;
     qemu_mutex_init(&s->requests_lock);
     qemu_co_queue_init(&s->free_sema);
     qemu_co_mutex_init(&s->send_mutex);
     qemu_co_mutex_init(&s->receive_mutex);
 
+    s->max_requests = max_requests;
+    s->window = MIN(max_requests, DEFAULT_NBD_REQUESTS);
+    s->requests = g_new0(NBDClientRequest, max_requests);
+}
+
+/*
+ * Open the connections beyond the first one.  Failing to do so is not
+ * fatal, I/O then just uses fewer connections.
+ */
+static void nbd_open_extra_conns(BlockDriverState *bs)
+{
+    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    Error *local_err = NULL;
+
+    if (!(s->info.flags & NBD_FLAG_CAN_MULTI_CONN)) {
+        return;
+    }
+
+    while (s->nr_conns < s->multi_conn) {
+        BDRVNBDState *c = g_new0(BDRVNBDState, 1);
+
+        nbd_init_conn(bs, c, s->max_requests);
+        c->reconnect_delay = s->reconnect_delay;
+        c->conn = nbd_client_connection_new(s->saddr, true, s->export,
+                                            s->x_dirty_bitmap, s->tlscreds,
+                                            s->tlshostname);
+        c->state = NBD_CLIENT_CONNECTING_WAIT;
+        s->conns[s->nr_conns++] = c;
+
+        if (nbd_do_establish_connection(bs, s->nr_conns - 1, true,
+                                        &local_err) < 0) {
+            s->nr_conns--;
+            warn_reportf_err(local_err, "Using %u NBD connections: ",
+                             s->nr_conns);
+            nbd_client_connection_release(c->conn);
+            g_free(c->requests);
+            g_free(c);
+            return;
+        }
+        nbd_client_connection_enable_retry(c->conn);
+    }
+}
+
+static int nbd_open(BlockDriverState *bs, QDict *options, int flags,
+                    Error **errp)
+{
+    int ret;
+    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+
     if (!yank_register_instance(BLOCKDEV_YANK_INSTANCE(bs->node_name), errp)) {
         return -EEXIST;
     }
@@ -1925,6 +2099,11 @@ static int nbd_open(BlockDriverState *bs, QDict *options, int flags,
         goto fail;
     }
 
+    nbd_init_conn(bs, s, s->max_requests);
+    s->conns = g_new0(BDRVNBDState *, s->multi_conn);
+    s->conns[0] = s;
+    s->nr_conns = 1;
+
     s->conn = nbd_client_connection_new(s->saddr, true, s->export,
                                         s->x_dirty_bitmap, s->tlscreds,
                                         s->tlshostname);
@@ -1936,7 +2115,7 @@ static int nbd_open(BlockDriverState *bs, QDict *options, int flags,
     }
 
     s->state = NBD_CLIENT_CONNECTING_WAIT;
-    ret = nbd_do_establish_connection(bs, true, errp);
+    ret = nbd_do_establish_connection(bs, 0, true, errp);
     if (ret < 0) {
         goto fail;
     }
@@ -1949,6 +2128,7 @@ static int nbd_open(BlockDriverState *bs, QDict *options, int flags,
     open_timer_del(s);
 
     nbd_client_connection_enable_retry(s->conn);
+    nbd_open_extra_conns(bs);
 
     return 0;
 
@@ -2100,22 +2280,28 @@ static const char *const nbd_strong_runtime_opts[] = {
 static void nbd_cancel_in_flight(BlockDriverState *bs)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    unsigned i;
 
-    reconnect_delay_timer_del(s);
+    for (i = 0; i < s->nr_conns; i++) {
+        BDRVNBDState *c = s->conns[i];
 
-    qemu_mutex_lock(&s->requests_lock);
-    if (s->state == NBD_CLIENT_CONNECTING_WAIT) {
-        s->state = NBD_CLIENT_CONNECTING_NOWAIT;
-    }
-    qemu_mutex_unlock(&s->requests_lock);
+        reconnect_delay_timer_del(c);
 
-    nbd_co_establish_connection_cancel(s->conn);
+        qemu_mutex_lock(&c->requests_lock);
+        if (c->state == NBD_CLIENT_CONNECTING_WAIT) {
+            c->state = NBD_CLIENT_CONNECTING_NOWAIT;
+        }
+        qemu_mutex_unlock(&c->requests_lock);
+
+        nbd_co_establish_connection_cancel(c->conn);
+    }
 }
 
 static void nbd_attach_aio_context(BlockDriverState *bs,
                                    AioContext *new_context)
 {
     BDRVNBDState *s = bs->opaque;
+    unsigned i;
 
     /* The open_timer is used only during nbd_open() */
     assert(!s->open_timer);
@@ -2129,15 +2315,20 @@ static void nbd_attach_aio_context(BlockDriverState *bs,
      * Since the AioContext can only be changed when a node is drained,
      * the reconnect_delay_timer cannot be active here.
      */
-    assert(!s->reconnect_delay_timer);
+    for (i = 0; i < s->nr_conns; i++) {
+        assert(!s->conns[i]->reconnect_delay_timer);
+    }
 }
 
 static void nbd_detach_aio_context(BlockDriverState *bs)
 {
     BDRVNBDState *s = bs->opaque;
+    unsigned i;
 
     assert(!s->open_timer);
-    assert(!s->reconnect_delay_timer);
+    for (i = 0; i < s->nr_conns; i++) {
+        assert(!s->conns[i]->reconnect_delay_timer);
+    }
 }
 
 static BlockDriver bdrv_nbd = {
@@ -1617,6 +1617,36 @@ do_alloc_cluster_offset(BlockDriverState *bs, uint64_t guest_offset,
         return 0;
     }
 
+    /*
+     * Take the clusters from the current batch if possible.  Refilling
+     * the batch raises the refcounts of many clusters at once, so that
+     * a sequential write does not update a refcount block for each
+     * allocation.
+     */
+    if (*host_offset == INV_OFFSET && !s->alloc_batch_clusters &&
+        s->alloc_batch_size > s->cluster_size) {
+        uint64_t batch = MAX(*nb_clusters,
+                             s->alloc_batch_size >> s->cluster_bits);
+        int64_t batch_offset =
+            qcow2_alloc_clusters(bs, batch << s->cluster_bits);
+
+        if (batch_offset > 0) {
+            s->alloc_batch_offset = batch_offset;
+            s->alloc_batch_clusters = batch;
+        }
+    }
+    if (s->alloc_batch_clusters &&
+        (*host_offset == INV_OFFSET ||
+         *host_offset == s->alloc_batch_offset)) {
+        *nb_clusters = MIN(*nb_clusters, s->alloc_batch_clusters);
+        *host_offset = s->alloc_batch_offset;
+        s->alloc_batch_offset += *nb_clusters << s->cluster_bits;
+        s->alloc_batch_clusters -= *nb_clusters;
+        trace_qcow2_alloc_batch(qemu_coroutine_self(), *host_offset,
+                                *nb_clusters, s->alloc_batch_clusters);
+        return 0;
+    }
+
     /* Allocate new clusters */
     trace_qcow2_cluster_alloc_phys(qemu_coroutine_self());
     if (*host_offset == INV_OFFSET) {
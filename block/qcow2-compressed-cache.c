@@ -0,0 +1,172 @@
+/*
+ * Decompressed cluster cache for the QCOW2 format
+ *
+ * Compressed clusters are never rewritten in place, so the decompressed
+ * data of a cluster stays valid for as long as the host area holding its
+ * compressed data is not freed.  Entries are keyed by the host offset of
+ * the compressed data and are dropped by qcow2_compressed_cache_discard()
+ * when the refcount of any host cluster they overlap drops to zero.
+ *
+ * All functions must be called with s->lock held.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/memalign.h"
+#include "qemu/queue.h"
+#include "qemu/iov.h"
+#include "qcow2.h"
+
+typedef struct Qcow2CompressedEntry {
+    /* Host offset of the compressed data, 0 if the entry is unused */
+    uint64_t coffset;
+    int csize;
+    QTAILQ_ENTRY(Qcow2CompressedEntry) lru_entry;
+} Qcow2CompressedEntry;
+
+struct Qcow2CompressedCache {
+    Qcow2CompressedEntry *entries;
+    GHashTable *index;
+    /* All entries, least recently used first */
+    QTAILQ_HEAD(, Qcow2CompressedEntry) lru;
+    uint8_t *buf;
+    int size;
+    int cluster_size;
+};
+
+static void *qcow2_compressed_cache_buf(Qcow2CompressedCache *c,
+                                        Qcow2CompressedEntry *e)
+{
+    return c->buf + (size_t) (e - c->entries) * c->cluster_size;
+}
+
+static void qcow2_compressed_cache_drop(Qcow2CompressedCache *c,
+                                        Qcow2CompressedEntry *e)
+{
+    g_hash_table_remove(c->index, &e->coffset);
+    e->coffset = 0;
+    QTAILQ_REMOVE(&c->lru, e, lru_entry);
+    QTAILQ_INSERT_HEAD(&c->lru, e, lru_entry);
+}
+
+Qcow2CompressedCache *qcow2_compressed_cache_create(BlockDriverState *bs,
+                                                    int num_clusters)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2CompressedCache *c;
+    int i;
+
+    assert(num_clusters > 0);
+
+    c = g_new0(Qcow2CompressedCache, 1);
+    c->size = num_clusters;
+    c->cluster_size = s->cluster_size;
+    c->entries = g_try_new0(Qcow2CompressedEntry, num_clusters);
+    c->buf = qemu_try_blockalign(bs->file->bs,
+                                 (size_t) num_clusters * c->cluster_size);
+    if (!c->entries || !c->buf) {
+        qemu_vfree(c->buf);
+        g_free(c->entries);
+        g_free(c);
+        return NULL;
+    }
+
+    c->index = g_hash_table_new(g_int64_hash, g_int64_equal);
+    QTAILQ_INIT(&c->lru);
+    for (i = 0; i < num_clusters; i++) {
+        QTAILQ_INSERT_TAIL(&c->lru, &c->entries[i], lru_entry);
+    }
+
+    return c;
+}
+
+void qcow2_compressed_cache_destroy(Qcow2CompressedCache *c)
+{
+    g_hash_table_destroy(c->index);
+    qemu_vfree(c->buf);
+    g_free(c->entries);
+    g_free(c);
+}
+
+/*
+ * Copy @bytes of the decompressed cluster whose compressed data starts at
+ * @coffset, starting @offset_in_cluster bytes into it, to @qiov.  Return
+ * false if the cluster is not cached.
+ */
+bool qcow2_compressed_cache_read(Qcow2CompressedCache *c, uint64_t coffset,
+                                 int offset_in_cluster, uint64_t bytes,
+                                 QEMUIOVector *qiov, size_t qiov_offset)
+{
+    Qcow2CompressedEntry *e = g_hash_table_lookup(c->index, &coffset);
+
+    if (!e) {
+        return false;
+    }
+
+    qemu_iovec_from_buf(qiov, qiov_offset,
+                        qcow2_compressed_cache_buf(c, e) + offset_in_cluster,
+                        bytes);
+    QTAILQ_REMOVE(&c->lru, e, lru_entry);
+    QTAILQ_INSERT_TAIL(&c->lru, e, lru_entry);
+    return true;
+}
+
+bool qcow2_compressed_cache_contains(Qcow2CompressedCache *c,
+                                     uint64_t coffset)
+{
+    return g_hash_table_contains(c->index, &coffset);
+}
+
+/* Store the decompressed cluster @buf, replacing the oldest entry */
+void qcow2_compressed_cache_insert(Qcow2CompressedCache *c, uint64_t coffset,
+                                   int csize, const void *buf)
+{
+    Qcow2CompressedEntry *e;
+
+    if (qcow2_compressed_cache_contains(c, coffset)) {
+        return;
+    }
+
+    e = QTAILQ_FIRST(&c->lru);
+    if (e->coffset) {
+        g_hash_table_remove(c->index, &e->coffset);
+    }
+    e->coffset = coffset;
+    e->csize = csize;
+    memcpy(qcow2_compressed_cache_buf(c, e), buf, c->cluster_size);
+    g_hash_table_add(c->index, &e->coffset);
+    QTAILQ_REMOVE(&c->lru, e, lru_entry);
+    QTAILQ_INSERT_TAIL(&c->lru, e, lru_entry);
+}
+
+/* Drop all entries whose compressed data overlaps the given host range */
+void qcow2_compressed_cache_discard(Qcow2CompressedCache *c, uint64_t offset,
+                                    uint64_t length)
+{
+    int i;
+
+    if (g_hash_table_size(c->index) == 0) {
+        return;
+    }
+
+    for (i = 0; i < c->size; i++) {
+        Qcow2CompressedEntry *e = &c->entries[i];
+
+        if (e->coffset && e->coffset < offset + length &&
+            offset < e->coffset + e->csize) {
+            qcow2_compressed_cache_drop(c, e);
+        }
+    }
+}
+
+void qcow2_compressed_cache_empty(Qcow2CompressedCache *c)
+{
+    int i;
+
+    for (i = 0; i < c->size; i++) {
+        if (c->entries[i].coffset) {
+            qcow2_compressed_cache_drop(c, &c->entries[i]);
+        }
+    }
+}
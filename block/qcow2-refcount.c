@@ -901,6 +901,12 @@ update_refcount(BlockDriverState *bs, int64_t offset, int64_t length,
                 qcow2_cache_discard(s->l2_table_cache, table);
             }
 
+            if (s->compressed_cache) {
+                qcow2_compressed_cache_discard(s->compressed_cache,
+                                               cluster_offset,
+                                               s->cluster_size);
+            }
+
             if (s->discard_passthrough[type]) {
                 update_refcount_discard(bs, cluster_offset, s->cluster_size);
             }
@@ -1155,6 +1161,23 @@ void qcow2_free_clusters(BlockDriverState *bs,
     }
 }
 
+/*
+ * Return the clusters of the current allocation batch that were not handed
+ * out yet.  This must happen before the refcounts are written out or
+ * checked, so that the image does not appear to leak them.
+ */
+void qcow2_alloc_batch_release(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    if (s->alloc_batch_clusters) {
+        qcow2_free_clusters(bs, s->alloc_batch_offset,
+                            s->alloc_batch_clusters << s->cluster_bits,
+                            QCOW2_DISCARD_NEVER);
+        s->alloc_batch_clusters = 0;
+    }
+}
+
 /*
  * Free a cluster using its L2 entry (handles clusters of all types, e.g.
  * normal cluster, compressed cluster, etc.)
@@ -1210,6 +1233,8 @@ int qcow2_write_caches(BlockDriverState *bs)
     BDRVQcow2State *s = bs->opaque;
     int ret;
 
+    qcow2_alloc_batch_release(bs);
+
     ret = qcow2_cache_write(bs, s->l2_table_cache);
     if (ret < 0) {
         return ret;
@@ -2789,6 +2814,8 @@ qcow2_check_refcounts(BlockDriverState *bs, BdrvCheckResult *res, BdrvCheckMode
     bool rebuild = false;
     int ret;
 
+    qcow2_alloc_batch_release(bs);
+
     size = bdrv_co_getlength(bs->file->bs);
     if (size < 0) {
         res->check_errors++;
@@ -685,6 +685,8 @@ static const char *const mutable_opts[] = {
     QCOW2_OPT_DISCARD_SNAPSHOT,
     QCOW2_OPT_DISCARD_OTHER,
     QCOW2_OPT_DISCARD_NO_UNREF,
+    QCOW2_OPT_ALLOC_BATCH_SIZE,
+    QCOW2_OPT_DETECT_ZERO_SUBCLUSTERS,
     QCOW2_OPT_OVERLAP,
     QCOW2_OPT_OVERLAP_TEMPLATE,
     QCOW2_OPT_OVERLAP_MAIN_HEADER,
@@ -701,6 +703,8 @@ static const char *const mutable_opts[] = {
     QCOW2_OPT_L2_CACHE_ENTRY_SIZE,
     QCOW2_OPT_REFCOUNT_CACHE_SIZE,
     QCOW2_OPT_CACHE_CLEAN_INTERVAL,
+    QCOW2_OPT_COMPRESSED_CACHE_SIZE,
+    QCOW2_OPT_COMPRESSED_READAHEAD,
     NULL
 };
 
@@ -734,6 +738,16 @@ static QemuOptsList qcow2_runtime_opts = {
             .type = QEMU_OPT_BOOL,
             .help = "Do not unreference discarded clusters",
         },
+        {
+            .name = QCOW2_OPT_ALLOC_BATCH_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "Allocate data clusters in batches of this size",
+        },
+        {
+            .name = QCOW2_OPT_DETECT_ZERO_SUBCLUSTERS,
+            .type = QEMU_OPT_BOOL,
+            .help = "Write all-zero subclusters as zero subclusters",
+        },
         {
             .name = QCOW2_OPT_OVERLAP,
             .type = QEMU_OPT_STRING,
@@ -817,6 +831,16 @@ static QemuOptsList qcow2_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "Clean unused cache entries after this time (in seconds)",
         },
+        {
+            .name = QCOW2_OPT_COMPRESSED_CACHE_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "Maximum size of the decompressed cluster cache",
+        },
+        {
+            .name = QCOW2_OPT_COMPRESSED_READAHEAD,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Number of compressed clusters to decompress ahead",
+        },
         BLOCK_CRYPTO_OPT_DEF_KEY_SECRET("encrypt.",
             "ID of secret providing qcow2 AES key or LUKS passphrase"),
         { /* end of list */ }
@@ -973,11 +997,15 @@ static bool read_cache_sizes(BlockDriverState *bs, QemuOpts *opts,
 typedef struct Qcow2ReopenState {
     Qcow2Cache *l2_table_cache;
     Qcow2Cache *refcount_block_cache;
+    Qcow2CompressedCache *compressed_cache;
+    int compressed_readahead;
     int l2_slice_size; /* Number of entries in a slice of the L2 table */
     bool use_lazy_refcounts;
     int overlap_check;
     bool discard_passthrough[QCOW2_DISCARD_MAX];
     bool discard_no_unref;
+    uint64_t alloc_batch_size;
+    bool detect_zero_subclusters;
     uint64_t cache_clean_interval;
     QCryptoBlockOpenOptions *crypto_opts; /* Disk encryption runtime options */
 } Qcow2ReopenState;
@@ -991,6 +1019,7 @@ qcow2_update_options_prepare(BlockDriverState *bs, Qcow2ReopenState *r,
     const char *opt_overlap_check, *opt_overlap_check_template;
     int overlap_check_template = 0;
     uint64_t l2_cache_size, l2_cache_entry_size, refcount_cache_size;
+    uint64_t compressed_cache_size, compressed_readahead;
     int i;
     const char *encryptfmt;
     QDict *encryptopts = NULL;
@@ -1061,6 +1090,40 @@ qcow2_update_options_prepare(BlockDriverState *bs, Qcow2ReopenState *r,
         goto fail;
     }
 
+    compressed_cache_size =
+        qemu_opt_get_size(opts, QCOW2_OPT_COMPRESSED_CACHE_SIZE, 0);
+    compressed_cache_size /= s->cluster_size;
+    if (compressed_cache_size > INT_MAX) {
+        error_setg(errp, "Compressed cluster cache size too big");
+        ret = -EINVAL;
+        goto fail;
+    }
+    if (compressed_cache_size) {
+        r->compressed_cache =
+            qcow2_compressed_cache_create(bs, compressed_cache_size);
+        if (r->compressed_cache == NULL) {
+            error_setg(errp, "Could not allocate compressed cluster cache");
+            ret = -ENOMEM;
+            goto fail;
+        }
+    }
+
+    compressed_readahead =
+        qemu_opt_get_number(opts, QCOW2_OPT_COMPRESSED_READAHEAD, 0);
+    if (compressed_readahead > QCOW2_MAX_COMPRESSED_READAHEAD) {
+        error_setg(errp, QCOW2_OPT_COMPRESSED_READAHEAD
+                   " must not exceed %d", QCOW2_MAX_COMPRESSED_READAHEAD);
+        ret = -EINVAL;
+        goto fail;
+    }
+    if (compressed_readahead && !r->compressed_cache) {
+        error_setg(errp, QCOW2_OPT_COMPRESSED_READAHEAD " requires "
+                   QCOW2_OPT_COMPRESSED_CACHE_SIZE);
+        ret = -EINVAL;
+        goto fail;
+    }
+    r->compressed_readahead = compressed_readahead;
+
     /* New interval for cache cleanup timer */
     r->cache_clean_interval =
         qemu_opt_get_number(opts, QCOW2_OPT_CACHE_CLEAN_INTERVAL,
@@ -1157,6 +1220,24 @@ qcow2_update_options_prepare(BlockDriverState *bs, Qcow2ReopenState *r,
         goto fail;
     }
 
+    r->alloc_batch_size = qemu_opt_get_size(opts, QCOW2_OPT_ALLOC_BATCH_SIZE,
+                                            0);
+    if (r->alloc_batch_size > QCOW2_MAX_ALLOC_BATCH_SIZE) {
+        error_setg(errp, "alloc-batch-size must not exceed %" PRIu64,
+                   (uint64_t) QCOW2_MAX_ALLOC_BATCH_SIZE);
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    r->detect_zero_subclusters =
+        qemu_opt_get_bool(opts, QCOW2_OPT_DETECT_ZERO_SUBCLUSTERS, false);
+    if (r->detect_zero_subclusters && s->qcow_version < 3) {
+        error_setg(errp, "detect-zero-subclusters is only supported since "
+                   "qcow2 version 3");
+        ret = -EINVAL;
+        goto fail;
+    }
+
     switch (s->crypt_method_header) {
     case QCOW_CRYPT_NONE:
         if (encryptfmt) {
@@ -1230,6 +1311,12 @@ static void qcow2_update_options_commit(BlockDriverState *bs,
     s->refcount_block_cache = r->refcount_block_cache;
     s->l2_slice_size = r->l2_slice_size;
 
+    if (s->compressed_cache) {
+        qcow2_compressed_cache_destroy(s->compressed_cache);
+    }
+    s->compressed_cache = r->compressed_cache;
+    s->compressed_readahead = r->compressed_readahead;
+
     s->overlap_check = r->overlap_check;
     s->use_lazy_refcounts = r->use_lazy_refcounts;
 
@@ -1238,6 +1325,8 @@ static void qcow2_update_options_commit(BlockDriverState *bs,
     }
 
     s->discard_no_unref = r->discard_no_unref;
+    s->alloc_batch_size = r->alloc_batch_size;
+    s->detect_zero_subclusters = r->detect_zero_subclusters;
 
     if (s->cache_clean_interval != r->cache_clean_interval) {
         cache_clean_timer_del(bs);
@@ -1258,6 +1347,9 @@ static void qcow2_update_options_abort(BlockDriverState *bs,
     if (r->refcount_block_cache) {
         qcow2_cache_destroy(r->refcount_block_cache);
     }
+    if (r->compressed_cache) {
+        qcow2_compressed_cache_destroy(r->compressed_cache);
+    }
     qapi_free_QCryptoBlockOpenOptions(r->crypto_opts);
 }
 
@@ -1899,6 +1991,10 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
     if (s->refcount_block_cache) {
         qcow2_cache_destroy(s->refcount_block_cache);
     }
+    if (s->compressed_cache) {
+        qcow2_compressed_cache_destroy(s->compressed_cache);
+        s->compressed_cache = NULL;
+    }
     qcrypto_block_free(s->crypto);
     qapi_free_QCryptoBlockOpenOptions(s->crypto_opts);
     return ret;
@@ -2659,6 +2755,48 @@ static coroutine_fn GRAPH_RDLOCK int qcow2_co_pwritev_task_entry(AioTask *task)
                                  t->l2meta);
 }
 
+/*
+ * Split off the start of a write request for detect-zero-subclusters.
+ *
+ * Return the length of the run at the start of the request that can be
+ * handled in one go: either whole, aligned subclusters whose data is all
+ * zero (*@zero is set to true), or data up to the next such subcluster.
+ */
+static uint64_t qcow2_zero_subcluster_run(BlockDriverState *bs,
+                                          uint64_t offset, uint64_t bytes,
+                                          QEMUIOVector *qiov,
+                                          size_t qiov_offset, bool *zero)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t end = offset + bytes;
+    uint64_t pos = ROUND_UP(offset, s->subcluster_size);
+
+    *zero = false;
+
+    if (pos == offset) {
+        while (pos + s->subcluster_size <= end &&
+               qemu_iovec_is_zero(qiov, qiov_offset + (pos - offset),
+                                  s->subcluster_size)) {
+            pos += s->subcluster_size;
+        }
+        if (pos > offset) {
+            *zero = true;
+            return pos - offset;
+        }
+        pos += s->subcluster_size;
+    }
+
+    while (pos + s->subcluster_size <= end) {
+        if (qemu_iovec_is_zero(qiov, qiov_offset + (pos - offset),
+                               s->subcluster_size)) {
+            return pos - offset;
+        }
+        pos += s->subcluster_size;
+    }
+
+    return bytes;
+}
+
 static int coroutine_fn GRAPH_RDLOCK
 qcow2_co_pwritev_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
                       QEMUIOVector *qiov, size_t qiov_offset,
@@ -2687,6 +2825,32 @@ qcow2_co_pwritev_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
                             - offset_in_cluster);
         }
 
+        if (s->detect_zero_subclusters) {
+            bool zero;
+            uint64_t run = qcow2_zero_subcluster_run(bs, offset, cur_bytes,
+                                                     qiov, qiov_offset,
+                                                     &zero);
+
+            if (zero) {
+                trace_qcow2_writev_zero_subclusters(qemu_coroutine_self(),
+                                                    offset, run);
+                qemu_co_mutex_lock(&s->lock);
+                ret = qcow2_subcluster_zeroize(bs, offset, run, 0);
+                qemu_co_mutex_unlock(&s->lock);
+                if (ret < 0 && ret != -ENOTSUP) {
+                    goto fail_nometa;
+                }
+                if (ret == 0) {
+                    bytes -= run;
+                    offset += run;
+                    qiov_offset += run;
+                    continue;
+                }
+            } else {
+                cur_bytes = run;
+            }
+        }
+
         qemu_co_mutex_lock(&s->lock);
 
         ret = qcow2_alloc_host_offset(bs, offset, &cur_bytes,
@@ -2756,6 +2920,8 @@ static int GRAPH_RDLOCK qcow2_inactivate(BlockDriverState *bs)
                           bdrv_get_device_or_node_name(bs));
     }
 
+    qcow2_alloc_batch_release(bs);
+
     ret = qcow2_cache_flush(bs, s->l2_table_cache);
     if (ret) {
         result = ret;
@@ -2792,6 +2958,10 @@ qcow2_do_close(BlockDriverState *bs, bool close_data_file)
     cache_clean_timer_del(bs);
     qcow2_cache_destroy(s->l2_table_cache);
     qcow2_cache_destroy(s->refcount_block_cache);
+    if (s->compressed_cache) {
+        qcow2_compressed_cache_destroy(s->compressed_cache);
+        s->compressed_cache = NULL;
+    }
 
     qcrypto_block_free(s->crypto);
     s->crypto = NULL;
@@ -4305,6 +4475,9 @@ qcow2_co_truncate(BlockDriverState *bs, int64_t offset, bool exact,
 
     qemu_co_mutex_lock(&s->lock);
 
+    /* Do not let unused batch clusters prevent or survive a shrink */
+    qcow2_alloc_batch_release(bs);
+
     /*
      * Even though we store snapshot size for all images, it was not
      * required until v3, so it is not safe to proceed for v2.
@@ -4802,19 +4975,15 @@ qcow2_co_pwritev_compressed_part(BlockDriverState *bs,
     return ret;
 }
 
+/* Read and decompress the cluster described by @l2_entry into @out_buf */
 static int coroutine_fn GRAPH_RDLOCK
-qcow2_co_preadv_compressed(BlockDriverState *bs,
-                           uint64_t l2_entry,
-                           uint64_t offset,
-                           uint64_t bytes,
-                           QEMUIOVector *qiov,
-                           size_t qiov_offset)
+qcow2_co_decompress_cluster(BlockDriverState *bs, uint64_t l2_entry,
+                            uint8_t *out_buf)
 {
     BDRVQcow2State *s = bs->opaque;
     int ret = 0, csize;
     uint64_t coffset;
-    uint8_t *buf, *out_buf;
-    int offset_in_cluster = offset_into_cluster(s, offset);
+    uint8_t *buf;
 
     qcow2_parse_compressed_l2_entry(bs, l2_entry, &coffset, &csize);
 
@@ -4823,8 +4992,6 @@ qcow2_co_preadv_compressed(BlockDriverState *bs,
         return -ENOMEM;
     }
 
-    out_buf = qemu_blockalign(bs, s->cluster_size);
-
     BLKDBG_CO_EVENT(bs->file, BLKDBG_READ_COMPRESSED);
     ret = bdrv_co_pread(bs->file, coffset, csize, buf, 0);
     if (ret < 0) {
@@ -4836,11 +5003,160 @@ qcow2_co_preadv_compressed(BlockDriverState *bs,
         goto fail;
     }
 
+fail:
+    g_free(buf);
+    return ret;
+}
+
+typedef struct Qcow2ReadaheadTask {
+    AioTask task;
+
+    BlockDriverState *bs;
+    uint64_t l2_entry;
+} Qcow2ReadaheadTask;
+
+/*
+ * This function can count as GRAPH_RDLOCK because qcow2_co_preadv_part() holds
+ * the graph lock and keeps it until this coroutine has terminated.
+ */
+static int coroutine_fn GRAPH_RDLOCK
+qcow2_co_readahead_task_entry(AioTask *task)
+{
+    Qcow2ReadaheadTask *t = container_of(task, Qcow2ReadaheadTask, task);
+    BDRVQcow2State *s = t->bs->opaque;
+    uint8_t *out_buf = qemu_blockalign(t->bs, s->cluster_size);
+    uint64_t coffset;
+    int csize;
+
+    qcow2_parse_compressed_l2_entry(t->bs, t->l2_entry, &coffset, &csize);
+
+    /* Read-ahead is best effort, errors show up when the guest reads */
+    if (qcow2_co_decompress_cluster(t->bs, t->l2_entry, out_buf) == 0) {
+        qemu_co_mutex_lock(&s->lock);
+        qcow2_compressed_cache_insert(s->compressed_cache, coffset, csize,
+                                      out_buf);
+        qemu_co_mutex_unlock(&s->lock);
+    }
+
+    qemu_vfree(out_buf);
+    return 0;
+}
+
+/*
+ * Start decompressing the compressed clusters that follow the guest
+ * cluster containing @offset and are not cached yet.  This stops at the
+ * first cluster that is not compressed.
+ */
+static void coroutine_fn GRAPH_RDLOCK
+qcow2_co_compressed_readahead(BlockDriverState *bs, AioTaskPool *pool,
+                              uint64_t offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t disk_size = bs->total_sectors * BDRV_SECTOR_SIZE;
+    int i;
+
+    offset = start_of_cluster(s, offset);
+    for (i = 0; i < s->compressed_readahead; i++) {
+        Qcow2ReadaheadTask *task;
+        unsigned int bytes = s->cluster_size;
+        QCow2SubclusterType type;
+        uint64_t l2_entry, coffset;
+        bool cached = false;
+        int csize;
+        int ret;
+
+        offset += s->cluster_size;
+        if (offset >= disk_size) {
+            break;
+        }
+
+        qemu_co_mutex_lock(&s->lock);
+        ret = qcow2_get_host_offset(bs, offset, &bytes, &l2_entry, &type);
+        if (ret == 0 && type == QCOW2_SUBCLUSTER_COMPRESSED) {
+            qcow2_parse_compressed_l2_entry(bs, l2_entry, &coffset, &csize);
+            cached = qcow2_compressed_cache_contains(s->compressed_cache,
+                                                     coffset);
+        }
+        qemu_co_mutex_unlock(&s->lock);
+
+        if (ret < 0 || type != QCOW2_SUBCLUSTER_COMPRESSED) {
+            break;
+        }
+        if (cached) {
+            continue;
+        }
+
+        task = g_new(Qcow2ReadaheadTask, 1);
+        *task = (Qcow2ReadaheadTask) {
+            .task.func = qcow2_co_readahead_task_entry,
+            .bs = bs,
+            .l2_entry = l2_entry,
+        };
+        aio_task_pool_start_task(pool, &task->task);
+    }
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+qcow2_co_preadv_compressed(BlockDriverState *bs,
+                           uint64_t l2_entry,
+                           uint64_t offset,
+                           uint64_t bytes,
+                           QEMUIOVector *qiov,
+                           size_t qiov_offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int ret = 0, csize;
+    uint64_t coffset;
+    uint8_t *out_buf;
+    int offset_in_cluster = offset_into_cluster(s, offset);
+    AioTaskPool *aio = NULL;
+
+    qcow2_parse_compressed_l2_entry(bs, l2_entry, &coffset, &csize);
+
+    if (s->compressed_cache) {
+        bool hit;
+
+        qemu_co_mutex_lock(&s->lock);
+        hit = qcow2_compressed_cache_read(s->compressed_cache, coffset,
+                                          offset_in_cluster, bytes,
+                                          qiov, qiov_offset);
+        qemu_co_mutex_unlock(&s->lock);
+        if (hit) {
+            return 0;
+        }
+
+        /*
+         * Sequential readers will ask for the following clusters next;
+         * decompress them in parallel with this one.
+         */
+        if (s->compressed_readahead) {
+            aio = aio_task_pool_new(QCOW2_MAX_WORKERS);
+            qcow2_co_compressed_readahead(bs, aio, offset);
+        }
+    }
+
+    out_buf = qemu_blockalign(bs, s->cluster_size);
+
+    ret = qcow2_co_decompress_cluster(bs, l2_entry, out_buf);
+    if (ret < 0) {
+        goto fail;
+    }
+
     qemu_iovec_from_buf(qiov, qiov_offset, out_buf + offset_in_cluster, bytes);
 
+    if (s->compressed_cache) {
+        qemu_co_mutex_lock(&s->lock);
+        qcow2_compressed_cache_insert(s->compressed_cache, coffset, csize,
+                                      out_buf);
+        qemu_co_mutex_unlock(&s->lock);
+    }
+
 fail:
+    if (aio) {
+        aio_task_pool_wait_all(aio);
+        aio_task_pool_free(aio);
+    }
     qemu_vfree(out_buf);
-    g_free(buf);
 
     return ret;
 }
@@ -4859,6 +5175,12 @@ static int GRAPH_RDLOCK make_completely_empty(BlockDriverState *bs)
         uint32_t reftable_clusters;
     } QEMU_PACKED l1_ofs_rt_ofs_cls;
 
+    /* All refcounts are reset below */
+    s->alloc_batch_clusters = 0;
+    if (s->compressed_cache) {
+        qcow2_compressed_cache_empty(s->compressed_cache);
+    }
+
     ret = qcow2_cache_empty(bs, s->l2_table_cache);
     if (ret < 0) {
         goto fail;
@@ -5684,6 +6006,8 @@ qcow2_amend_options(BlockDriverState *bs, QemuOpts *opts,
     Qcow2AmendHelperCBInfo helper_cb_info;
     bool encryption_update = false;
 
+    qcow2_alloc_batch_release(bs);
+
     while (desc && desc->name) {
         if (!qemu_opt_find(opts, desc->name)) {
             /* only change explicitly defined options */
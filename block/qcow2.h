@@ -117,6 +117,8 @@
 /* Must be at least 4 to cover all cases of refcount table growth */
 #define MIN_REFCOUNT_CACHE_SIZE 4 /* clusters */
 
+#define QCOW2_MAX_COMPRESSED_READAHEAD 64 /* clusters */
+
 #ifdef CONFIG_LINUX
 #define DEFAULT_L2_CACHE_MAX_SIZE (32 * MiB)
 #define DEFAULT_CACHE_CLEAN_INTERVAL 600  /* seconds */
@@ -126,6 +128,8 @@
 #define DEFAULT_CACHE_CLEAN_INTERVAL 0
 #endif
 
+#define QCOW2_MAX_ALLOC_BATCH_SIZE (1 * GiB)
+
 #define DEFAULT_CLUSTER_SIZE 65536
 
 #define QCOW2_OPT_DATA_FILE "data-file"
@@ -134,6 +138,8 @@
 #define QCOW2_OPT_DISCARD_SNAPSHOT "pass-discard-snapshot"
 #define QCOW2_OPT_DISCARD_OTHER "pass-discard-other"
 #define QCOW2_OPT_DISCARD_NO_UNREF "discard-no-unref"
+#define QCOW2_OPT_ALLOC_BATCH_SIZE "alloc-batch-size"
+#define QCOW2_OPT_DETECT_ZERO_SUBCLUSTERS "detect-zero-subclusters"
 #define QCOW2_OPT_OVERLAP "overlap-check"
 #define QCOW2_OPT_OVERLAP_TEMPLATE "overlap-check.template"
 #define QCOW2_OPT_OVERLAP_MAIN_HEADER "overlap-check.main-header"
@@ -150,6 +156,8 @@
 #define QCOW2_OPT_L2_CACHE_ENTRY_SIZE "l2-cache-entry-size"
 #define QCOW2_OPT_REFCOUNT_CACHE_SIZE "refcount-cache-size"
 #define QCOW2_OPT_CACHE_CLEAN_INTERVAL "cache-clean-interval"
+#define QCOW2_OPT_COMPRESSED_CACHE_SIZE "compressed-cache-size"
+#define QCOW2_OPT_COMPRESSED_READAHEAD "compressed-readahead"
 
 typedef struct QCowHeader {
     uint32_t magic;
@@ -230,6 +238,7 @@ typedef struct QCowSnapshot {
 
 struct Qcow2Cache;
 typedef struct Qcow2Cache Qcow2Cache;
+typedef struct Qcow2CompressedCache Qcow2CompressedCache;
 
 typedef struct Qcow2CryptoHeaderExtension {
     uint64_t offset;
@@ -345,6 +354,10 @@ typedef struct BDRVQcow2State {
 
     Qcow2Cache *l2_table_cache;
     Qcow2Cache *refcount_block_cache;
+    /* NULL unless compressed-cache-size is set */
+    Qcow2CompressedCache *compressed_cache;
+    /* Compressed clusters to decompress ahead of a cache miss */
+    int compressed_readahead;
     QEMUTimer *cache_clean_timer;
     unsigned cache_clean_interval;
 
@@ -356,6 +369,9 @@ typedef struct BDRVQcow2State {
     uint32_t max_refcount_table_index; /* Last used entry in refcount_table */
     uint64_t free_cluster_index;
     uint64_t free_byte_offset;
+    /* Allocated but not yet used data clusters, see alloc_batch_size */
+    uint64_t alloc_batch_offset;
+    uint64_t alloc_batch_clusters;
 
     CoMutex lock;
 
@@ -388,6 +404,16 @@ typedef struct BDRVQcow2State {
 
     bool discard_no_unref;
 
+    /*
+     * Data clusters are taken from a batch of alloc_batch_size bytes
+     * whose refcounts are raised together; clusters left in the batch
+     * are returned before the refcounts are written out.
+     */
+    uint64_t alloc_batch_size;
+
+    /* Write all-zero subclusters as zero subclusters */
+    bool detect_zero_subclusters;
+
     int overlap_check; /* bitmask of Qcow2MetadataOverlap values */
     bool signaled_corruption;
 
@@ -877,6 +903,7 @@ int64_t coroutine_fn GRAPH_RDLOCK qcow2_alloc_bytes(BlockDriverState *bs, int si
 void GRAPH_RDLOCK qcow2_free_clusters(BlockDriverState *bs,
                                       int64_t offset, int64_t size,
                                       enum qcow2_discard_type type);
+void GRAPH_RDLOCK qcow2_alloc_batch_release(BlockDriverState *bs);
 void GRAPH_RDLOCK
 qcow2_free_any_cluster(BlockDriverState *bs, uint64_t l2_entry,
                        enum qcow2_discard_type type);
@@ -1022,6 +1049,21 @@ void qcow2_cache_put(Qcow2Cache *c, void **table);
 void *qcow2_cache_is_table_offset(Qcow2Cache *c, uint64_t offset);
 void qcow2_cache_discard(Qcow2Cache *c, void *table);
 
+/* qcow2-compressed-cache.c functions */
+Qcow2CompressedCache * GRAPH_RDLOCK
+qcow2_compressed_cache_create(BlockDriverState *bs, int num_clusters);
+void qcow2_compressed_cache_destroy(Qcow2CompressedCache *c);
+bool qcow2_compressed_cache_read(Qcow2CompressedCache *c, uint64_t coffset,
+                                 int offset_in_cluster, uint64_t bytes,
+                                 QEMUIOVector *qiov, size_t qiov_offset);
+bool qcow2_compressed_cache_contains(Qcow2CompressedCache *c,
+                                     uint64_t coffset);
+void qcow2_compressed_cache_insert(Qcow2CompressedCache *c, uint64_t coffset,
+                                   int csize, const void *buf);
+void qcow2_compressed_cache_discard(Qcow2CompressedCache *c, uint64_t offset,
+                                    uint64_t length);
+void qcow2_compressed_cache_empty(Qcow2CompressedCache *c);
+
 /* qcow2-bitmap.c functions */
 int coroutine_fn GRAPH_RDLOCK
 qcow2_check_bitmaps_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
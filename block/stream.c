@@ -13,6 +13,7 @@
 
 #include "qemu/osdep.h"
 #include "trace.h"
+#include "block/aio_task.h"
 #include "block/block_int.h"
 #include "block/blockjob_int.h"
 #include "qapi/error.h"
@@ -28,8 +29,14 @@ enum {
      * that populating contiguous regions of the image is efficient.
      */
     STREAM_CHUNK = 512 * 1024, /* in bytes */
+
+    /* Limit for growing the chunk size with several workers */
+    STREAM_MAX_CHUNK = 16 * 1024 * 1024, /* in bytes */
 };
 
+/* Target time to copy one chunk with several workers */
+#define STREAM_CHUNK_NS (100 * SCALE_MS)
+
 typedef struct StreamBlockJob {
     BlockJob common;
     BlockBackend *blk;
@@ -41,8 +48,20 @@ typedef struct StreamBlockJob {
     char *backing_file_str;
     bool backing_mask_protocol;
     bool bs_read_only;
+
+    int max_workers;
+    int64_t chunk;          /* current chunk size */
+    int64_t failed_offset;  /* first chunk that failed, or -1 */
+    int64_t failed_bytes;   /* total size of the chunks that failed */
 } StreamBlockJob;
 
+typedef struct StreamTask {
+    AioTask task;
+    StreamBlockJob *s;
+    int64_t offset;
+    int64_t bytes;
+} StreamTask;
+
 static int coroutine_fn stream_populate(BlockBackend *blk,
                                         int64_t offset, uint64_t bytes)
 {
@@ -152,10 +171,47 @@ static void stream_clean(Job *job)
     g_free(s->backing_file_str);
 }
 
+static int coroutine_fn stream_task_entry(AioTask *task)
+{
+    StreamTask *t = container_of(task, StreamTask, task);
+    StreamBlockJob *s = t->s;
+    int64_t start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int ret;
+
+    ret = stream_populate(s->blk, t->offset, t->bytes);
+    if (ret < 0) {
+        if (s->failed_offset < 0 || t->offset < s->failed_offset) {
+            s->failed_offset = t->offset;
+        }
+        s->failed_bytes += t->bytes;
+        return ret;
+    }
+
+    /*
+     * Aim for chunks that take about STREAM_CHUNK_NS to copy: big enough
+     * that the per-request overhead does not matter, small enough that
+     * pausing, cancelling and the rate limit stay responsive.  Only full
+     * chunks tell how long a chunk takes.
+     */
+    if (s->max_workers > 1 && t->bytes == s->chunk) {
+        int64_t ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start_ns;
+
+        if (ns < STREAM_CHUNK_NS / 2 && s->chunk < STREAM_MAX_CHUNK) {
+            s->chunk *= 2;
+        } else if (ns > STREAM_CHUNK_NS * 2 && s->chunk > STREAM_CHUNK) {
+            s->chunk /= 2;
+        }
+    }
+
+    job_progress_update(&s->common.job, t->bytes);
+    return 0;
+}
+
 static int coroutine_fn stream_run(Job *job, Error **errp)
 {
     StreamBlockJob *s = container_of(job, StreamBlockJob, common.job);
     BlockDriverState *unfiltered_bs;
+    AioTaskPool *pool;
     int64_t len;
     int64_t offset = 0;
     int error = 0;
@@ -175,10 +231,23 @@ static int coroutine_fn stream_run(Job *job, Error **errp)
     }
     job_progress_set_remaining(&s->common.job, len);
 
-    for ( ; offset < len; offset += n) {
+    s->chunk = STREAM_CHUNK;
+    s->failed_offset = -1;
+    pool = aio_task_pool_new(s->max_workers);
+
+    for ( ; ; offset += n) {
+        BlockErrorAction action;
         bool copy;
         int ret;
 
+        if (offset >= len) {
+            /* Done, unless one of the last chunks failed */
+            aio_task_pool_wait_all(pool);
+            if (aio_task_pool_status(pool) == 0) {
+                break;
+            }
+        }
+
         /* Note that even when no rate limit is applied we need to yield
          * with no pending I/O here so that bdrv_drain_all() returns.
          */
@@ -187,54 +256,99 @@ static int coroutine_fn stream_run(Job *job, Error **errp)
             break;
         }
 
+        n = 0;
         copy = false;
 
-        WITH_GRAPH_RDLOCK_GUARD() {
-            ret = bdrv_co_is_allocated(unfiltered_bs, offset, STREAM_CHUNK, &n);
-            if (ret == 1) {
-                /* Allocated in the top, no need to copy.  */
-            } else if (ret >= 0) {
-                /*
-                 * Copy if allocated in the intermediate images.  Limit to the
-                 * known-unallocated area [offset, offset+n*BDRV_SECTOR_SIZE).
-                 */
-                ret = bdrv_co_is_allocated_above(bdrv_cow_bs(unfiltered_bs),
-                                                 s->base_overlay, true,
-                                                 offset, n, &n);
-                /* Finish early if end of backing file has been reached */
-                if (ret == 0 && n == 0) {
-                    n = len - offset;
+        ret = aio_task_pool_status(pool);
+        if (ret < 0) {
+            /* Handle the failed chunks as if the first of them failed now */
+            int64_t failed_offset = s->failed_offset;
+            int64_t failed_bytes = s->failed_bytes;
+
+            aio_task_pool_wait_all(pool);
+            aio_task_pool_free(pool);
+            pool = aio_task_pool_new(s->max_workers);
+            s->failed_offset = -1;
+            s->failed_bytes = 0;
+
+            action = block_job_error_action(&s->common, s->on_error, true,
+                                            -ret);
+            if (action == BLOCK_ERROR_ACTION_IGNORE) {
+                job_progress_update(&s->common.job, failed_bytes);
+            } else {
+                /* Whatever was done since then will be accounted again */
+                job_progress_increase_remaining(&s->common.job,
+                    offset - failed_offset - failed_bytes);
+                offset = failed_offset;
+            }
+        } else {
+            WITH_GRAPH_RDLOCK_GUARD() {
+                ret = bdrv_co_is_allocated(unfiltered_bs, offset, s->chunk,
+                                           &n);
+                if (ret == 1) {
+                    /* Allocated in the top, no need to copy.  */
+                } else if (ret >= 0) {
+                    /*
+                     * Copy if allocated in the intermediate images.  Limit to
+                     * the known-unallocated area [offset, offset+n).
+                     */
+                    ret = bdrv_co_is_allocated_above(
+                        bdrv_cow_bs(unfiltered_bs), s->base_overlay, true,
+                        offset, n, &n);
+                    /* Finish early if end of backing file has been reached */
+                    if (ret == 0 && n == 0) {
+                        n = len - offset;
+                    }
+
+                    copy = (ret > 0);
                 }
-
-                copy = (ret > 0);
             }
-        }
-        trace_stream_one_iteration(s, offset, n, ret);
-        if (copy) {
-            ret = stream_populate(s->blk, offset, n);
-        }
-        if (ret < 0) {
-            BlockErrorAction action =
-                block_job_error_action(&s->common, s->on_error, true, -ret);
-            if (action == BLOCK_ERROR_ACTION_STOP) {
-                n = 0;
+            trace_stream_one_iteration(s, offset, n, ret);
+            if (copy) {
+                StreamTask *t = g_new(StreamTask, 1);
+
+                *t = (StreamTask) {
+                    .task.func = stream_task_entry,
+                    .s = s,
+                    .offset = offset,
+                    .bytes = n,
+                };
+                aio_task_pool_wait_slot(pool);
+                aio_task_pool_start_task(pool, &t->task);
+                if (s->max_workers == 1) {
+                    /* Keep yielding without pending I/O, see above */
+                    aio_task_pool_wait_all(pool);
+                }
+                block_job_ratelimit_processed_bytes(&s->common, n);
                 continue;
             }
-            if (error == 0) {
-                error = ret;
+            if (ret >= 0) {
+                job_progress_update(&s->common.job, n);
+                continue;
             }
-            if (action == BLOCK_ERROR_ACTION_REPORT) {
-                break;
+
+            action = block_job_error_action(&s->common, s->on_error, true,
+                                            -ret);
+            if (action == BLOCK_ERROR_ACTION_IGNORE) {
+                job_progress_update(&s->common.job, n);
             }
         }
 
-        /* Publish progress */
-        job_progress_update(&s->common.job, n);
-        if (copy) {
-            block_job_ratelimit_processed_bytes(&s->common, n);
+        if (action == BLOCK_ERROR_ACTION_STOP) {
+            n = 0;
+            continue;
+        }
+        if (error == 0) {
+            error = ret;
+        }
+        if (action == BLOCK_ERROR_ACTION_REPORT) {
+            break;
         }
     }
 
+    aio_task_pool_wait_all(pool);
+    aio_task_pool_free(pool);
+
     /* Do not remove the backing file if an error was there but ignored. */
     return error;
 }
@@ -256,7 +370,7 @@ void stream_start(const char *job_id, BlockDriverState *bs,
                   bool backing_mask_protocol,
                   BlockDriverState *bottom,
                   int creation_flags, int64_t speed,
-                  BlockdevOnError on_error,
+                  BlockdevOnError on_error, int max_workers,
                   const char *filter_node_name,
                   Error **errp)
 {
@@ -411,6 +525,7 @@ void stream_start(const char *job_id, BlockDriverState *bs,
     s->bs_read_only = bs_read_only;
 
     s->on_error = on_error;
+    s->max_workers = max_workers;
     trace_stream_start(bs, base, s);
     job_start(&s->common.job);
     return;
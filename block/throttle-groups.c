@@ -81,6 +81,13 @@ struct ThrottleGroup {
     QTAILQ_ENTRY(ThrottleGroup) list;
 };
 
+/* A member caches the tokens for about 1 ms worth of the group limits,
+ * and for THROTTLE_CACHE_MAX_OPS requests at most.
+ */
+#define THROTTLE_CACHE_DIV          1000
+#define THROTTLE_CACHE_MAX_OPS      1024
+#define THROTTLE_CACHE_UNLIMITED    UINT32_MAX
+
 /* This is protected by the global QEMU mutex */
 static QTAILQ_HEAD(, ThrottleGroup) throttle_groups =
     QTAILQ_HEAD_INITIALIZER(throttle_groups);
@@ -350,6 +357,134 @@ static void coroutine_mixed_fn schedule_next_request(ThrottleGroupMember *tgm,
     }
 }
 
+/* Admit a request with the tokens cached in a ThrottleGroupMember,
+ * without taking tg->lock.  A token taken for a request that then fails
+ * for lack of bytes is not returned, which only errs on the side of the
+ * limits.
+ *
+ * @tgm:       the current ThrottleGroupMember
+ * @bytes:     the number of bytes for this I/O
+ * @direction: the ThrottleDirection
+ * @ret:       whether the request was admitted
+ */
+static bool throttle_group_cache_take(ThrottleGroupMember *tgm,
+                                      int64_t bytes,
+                                      ThrottleDirection direction)
+{
+    uint32_t old, ops, avail;
+
+    if (bytes >= THROTTLE_CACHE_UNLIMITED) {
+        return false;
+    }
+
+    ops = qatomic_read(&tgm->cache_ops[direction]);
+    do {
+        if (!ops) {
+            return false;
+        }
+        old = ops;
+        ops = qatomic_cmpxchg(&tgm->cache_ops[direction], old, old - 1);
+    } while (ops != old);
+
+    avail = qatomic_read(&tgm->cache_bytes[direction]);
+    while (avail != THROTTLE_CACHE_UNLIMITED) {
+        if (avail < bytes) {
+            return false;
+        }
+        old = avail;
+        avail = qatomic_cmpxchg(&tgm->cache_bytes[direction], old,
+                                old - bytes);
+        if (avail == old) {
+            break;
+        }
+    }
+
+    return true;
+}
+
+/* Charge the group for a batch of tokens and hand them to a
+ * ThrottleGroupMember, whose following requests can then be admitted by
+ * throttle_group_cache_take().  This is only done while no member waits
+ * in this direction, so that the batch does not overtake anyone, and
+ * not with iops-size, where the cost of a request depends on its size.
+ *
+ * This assumes that tg->lock is held.
+ *
+ * @tgm:       the current ThrottleGroupMember
+ * @direction: the ThrottleDirection
+ */
+static void throttle_group_cache_refill(ThrottleGroupMember *tgm,
+                                        ThrottleDirection direction)
+{
+    static const BucketType bucket_types_ops[THROTTLE_MAX][2] = {
+        { THROTTLE_OPS_TOTAL, THROTTLE_OPS_READ },
+        { THROTTLE_OPS_TOTAL, THROTTLE_OPS_WRITE }
+    };
+    static const BucketType bucket_types_bps[THROTTLE_MAX][2] = {
+        { THROTTLE_BPS_TOTAL, THROTTLE_BPS_READ },
+        { THROTTLE_BPS_TOTAL, THROTTLE_BPS_WRITE }
+    };
+    ThrottleState *ts = tgm->throttle_state;
+    ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
+    ThrottleGroupMember *iter;
+    uint64_t ops = THROTTLE_CACHE_MAX_OPS;
+    uint64_t bytes = THROTTLE_CACHE_UNLIMITED;
+    unsigned i;
+
+    if (ts->cfg.op_size || tg->any_timer_armed[direction] ||
+        qatomic_read(&tgm->io_limits_disabled) ||
+        qatomic_read(&tgm->cache_ops[direction])) {
+        return;
+    }
+    QLIST_FOREACH(iter, &tg->head, round_robin) {
+        if (tgm_has_pending_reqs(iter, direction)) {
+            return;
+        }
+    }
+
+    for (i = 0; i < ARRAY_SIZE(bucket_types_ops[THROTTLE_READ]); i++) {
+        LeakyBucket *bkt = &ts->cfg.buckets[bucket_types_ops[direction][i]];
+
+        if (bkt->avg) {
+            ops = MIN(ops, bkt->avg / THROTTLE_CACHE_DIV);
+        }
+        bkt = &ts->cfg.buckets[bucket_types_bps[direction][i]];
+        if (bkt->avg) {
+            bytes = MIN(bytes, bkt->avg / THROTTLE_CACHE_DIV);
+        }
+    }
+
+    /* Limits this low do not see enough requests to contend on the lock */
+    if (ops < 2 || !bytes) {
+        return;
+    }
+
+    throttle_account_units(ts, direction, ops,
+                           bytes == THROTTLE_CACHE_UNLIMITED ? 0 : bytes);
+    qatomic_set(&tgm->cache_bytes[direction], bytes);
+    qatomic_store_release(&tgm->cache_ops[direction], ops);
+}
+
+/* Drop the tokens cached by all members of a group, e.g. because its
+ * limits changed.
+ *
+ * This assumes that tg->lock is held.
+ *
+ * @tg: the ThrottleGroup
+ */
+static void throttle_group_cache_drop(ThrottleGroup *tg)
+{
+    ThrottleGroupMember *tgm;
+    ThrottleDirection dir;
+
+    QLIST_FOREACH(tgm, &tg->head, round_robin) {
+        for (dir = THROTTLE_READ; dir < THROTTLE_MAX; dir++) {
+            qatomic_set(&tgm->cache_ops[dir], 0);
+            qatomic_set(&tgm->cache_bytes[dir], 0);
+        }
+    }
+}
+
 /* Check if an I/O request needs to be throttled, wait and set a timer
  * if necessary, and schedule the next request using a round robin
  * algorithm.
@@ -369,6 +504,12 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
     assert(bytes >= 0);
     assert(direction < THROTTLE_MAX);
 
+    /* Requests covered by the tokens of the member need no lock */
+    if (!qatomic_read(&tgm->pending_reqs[direction]) &&
+        throttle_group_cache_take(tgm, bytes, direction)) {
+        return;
+    }
+
     qemu_mutex_lock(&tg->lock);
 
     /* First we check if this I/O has to be throttled. */
@@ -393,6 +534,8 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
     /* Schedule the next request */
     schedule_next_request(tgm, direction);
 
+    throttle_group_cache_refill(tgm, direction);
+
     qemu_mutex_unlock(&tg->lock);
 }
 
@@ -478,6 +621,7 @@ void throttle_group_config(ThrottleGroupMember *tgm, ThrottleConfig *cfg)
     ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
     qemu_mutex_lock(&tg->lock);
     throttle_config(ts, tg->clock_type, cfg);
+    throttle_group_cache_drop(tg);
     qemu_mutex_unlock(&tg->lock);
 
     throttle_group_restart_tgm(tgm);
@@ -559,6 +703,8 @@ void throttle_group_register_tgm(ThrottleGroupMember *tgm,
             tg->tokens[dir] = tgm;
         }
         qemu_co_queue_init(&tgm->throttled_reqs[dir]);
+        qatomic_set(&tgm->cache_ops[dir], 0);
+        qatomic_set(&tgm->cache_bytes[dir], 0);
     }
 
     QLIST_INSERT_HEAD(&tg->head, tgm, round_robin);
@@ -903,6 +1049,7 @@ static void throttle_group_set_limits(Object *obj, Visitor *v,
         goto unlock;
     }
     throttle_config(&tg->ts, tg->clock_type, &cfg);
+    throttle_group_cache_drop(tg);
 
 unlock:
     qemu_mutex_unlock(&tg->lock);
@@ -2283,6 +2283,7 @@ void qmp_block_stream(const char *job_id, const char *device,
                       const char *bottom,
                       bool has_speed, int64_t speed,
                       bool has_on_error, BlockdevOnError on_error,
+                      bool has_max_workers, int64_t max_workers,
                       const char *filter_node_name,
                       bool has_auto_finalize, bool auto_finalize,
                       bool has_auto_dismiss, bool auto_dismiss,
@@ -2398,6 +2399,13 @@ void qmp_block_stream(const char *job_id, const char *device,
         return;
     }
 
+    if (!has_max_workers) {
+        max_workers = 1;
+    } else if (max_workers < 1 || max_workers > INT_MAX) {
+        error_setg(errp, "max-workers must be between 1 and %d", INT_MAX);
+        return;
+    }
+
     if (has_auto_finalize && !auto_finalize) {
         job_flags |= JOB_MANUAL_FINALIZE;
     }
@@ -2408,7 +2416,7 @@ void qmp_block_stream(const char *job_id, const char *device,
     stream_start(job_id, bs, base_bs, backing_file,
                  backing_mask_protocol,
                  bottom_bs, job_flags, has_speed ? speed : 0, on_error,
-                 filter_node_name, &local_err);
+                 max_workers, filter_node_name, &local_err);
     if (local_err) {
         error_propagate(errp, local_err);
         return;
@@ -29,16 +29,44 @@
 #include "qemu/base64.h"
 #include "qemu/module.h"
 #include "qemu/option.h"
+#include "qemu/atomic.h"
 #include "qom/object.h"
 
 /* Ring buffer chardev */
 
+/*
+ * Layout of the file given with "path", followed by the data.  The
+ * counters are free running byte positions and wrap at 2^32.  QEMU
+ * bumps @claimed before it overwrites anything, writes the data and
+ * then sets @written, with a write barrier in-between each step.
+ *
+ * A reader that has consumed up to position cons loads @written
+ * (acquire), copies the bytes between cons and @written, at offsets
+ * modulo @size, and then loads @claimed after a read barrier.  Bytes
+ * before @claimed - @size may have been overwritten during the copy
+ * and must be discarded, as must everything up to @written - @size
+ * if the reader fell that far behind.
+ */
+#define RINGBUF_SHM_MAGIC       0x31425251      /* "QRB1" */
+#define RINGBUF_SHM_DATA_OFFSET 64
+
+typedef struct RingBufShm {
+    uint32_t magic;
+    uint32_t size;
+    uint32_t claimed;
+    uint32_t written;
+} RingBufShm;
+
+QEMU_BUILD_BUG_ON(sizeof(RingBufShm) > RINGBUF_SHM_DATA_OFFSET);
+
 struct RingBufChardev {
     Chardev parent;
     size_t size;
     size_t prod;
     size_t cons;
     uint8_t *cbuf;
+    RingBufShm *shm;
+    int shm_fd;
 };
 typedef struct RingBufChardev RingBufChardev;
 
@@ -61,6 +89,11 @@ static int ringbuf_chr_write(Chardev *chr, const uint8_t *buf, int len)
         return -1;
     }
 
+    if (d->shm) {
+        qatomic_set(&d->shm->claimed, d->prod + len);
+        smp_wmb();
+    }
+
     for (i = 0; i < len; i++) {
         d->cbuf[d->prod++ & (d->size - 1)] = buf[i];
         if (d->prod - d->cons > d->size) {
@@ -68,6 +101,10 @@ static int ringbuf_chr_write(Chardev *chr, const uint8_t *buf, int len)
         }
     }
 
+    if (d->shm) {
+        qatomic_store_release(&d->shm->written, d->prod);
+    }
+
     return len;
 }
 
@@ -89,9 +126,52 @@ static void char_ringbuf_finalize(Object *obj)
 {
     RingBufChardev *d = RINGBUF_CHARDEV(obj);
 
+#ifdef CONFIG_POSIX
+    if (d->shm) {
+        munmap(d->shm, RINGBUF_SHM_DATA_OFFSET + d->size);
+        close(d->shm_fd);
+        return;
+    }
+#endif
     g_free(d->cbuf);
 }
 
+static bool ringbuf_map(RingBufChardev *d, const char *path, Error **errp)
+{
+#ifdef CONFIG_POSIX
+    size_t len = RINGBUF_SHM_DATA_OFFSET + d->size;
+    void *ptr;
+    int fd;
+
+    fd = qemu_create(path, O_RDWR | O_TRUNC, 0600, errp);
+    if (fd < 0) {
+        return false;
+    }
+    if (ftruncate(fd, len) < 0) {
+        error_setg_errno(errp, errno, "Could not resize '%s'", path);
+        close(fd);
+        return false;
+    }
+    ptr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED) {
+        error_setg_errno(errp, errno, "Could not map '%s'", path);
+        close(fd);
+        return false;
+    }
+
+    d->shm = ptr;
+    d->shm_fd = fd;
+    d->shm->size = d->size;
+    d->cbuf = (uint8_t *)ptr + RINGBUF_SHM_DATA_OFFSET;
+    /* Readers check the magic last */
+    qatomic_store_release(&d->shm->magic, RINGBUF_SHM_MAGIC);
+    return true;
+#else
+    error_setg(errp, "ringbuf chardev 'path' is not supported on this host");
+    return false;
+#endif
+}
+
 static void qemu_chr_open_ringbuf(Chardev *chr,
                                   ChardevBackend *backend,
                                   bool *be_opened,
@@ -108,8 +188,17 @@ static void qemu_chr_open_ringbuf(Chardev *chr,
         return;
     }
 
+    if (d->size > UINT32_MAX / 2) {
+        error_setg(errp, "size of ringbuf chardev must be below 2G");
+        return;
+    }
+
     d->prod = 0;
     d->cons = 0;
+    if (opts->path) {
+        ringbuf_map(d, opts->path, errp);
+        return;
+    }
     d->cbuf = g_malloc0(d->size);
 }
 
@@ -221,6 +310,7 @@ static void qemu_chr_parse_ringbuf(QemuOpts *opts, ChardevBackend *backend,
         ringbuf->has_size = true;
         ringbuf->size = val;
     }
+    ringbuf->path = g_strdup(qemu_opt_get(opts, "path"));
 }
 
 static void char_ringbuf_class_init(ObjectClass *oc, void *data)
@@ -104,38 +104,131 @@ static int tcp_chr_read_poll(void *opaque);
 static void tcp_chr_disconnect_locked(Chardev *chr);
 
 /* Called with chr_write_lock held.  */
-static int tcp_chr_write(Chardev *chr, const uint8_t *buf, int len)
+static int tcp_chr_send(Chardev *chr, const uint8_t *buf, int len)
 {
     SocketChardev *s = SOCKET_CHARDEV(chr);
+    int ret =  io_channel_send_full(s->ioc, buf, len,
+                                    s->write_msgfds,
+                                    s->write_msgfds_num);
 
-    if (s->state == TCP_CHARDEV_STATE_CONNECTED) {
-        int ret =  io_channel_send_full(s->ioc, buf, len,
-                                        s->write_msgfds,
-                                        s->write_msgfds_num);
+    /* free the written msgfds in any cases
+     * other than ret < 0 && errno == EAGAIN
+     */
+    if (!(ret < 0 && EAGAIN == errno)
+        && s->write_msgfds_num) {
+        g_free(s->write_msgfds);
+        s->write_msgfds = 0;
+        s->write_msgfds_num = 0;
+    }
 
-        /* free the written msgfds in any cases
-         * other than ret < 0 && errno == EAGAIN
-         */
-        if (!(ret < 0 && EAGAIN == errno)
-            && s->write_msgfds_num) {
-            g_free(s->write_msgfds);
-            s->write_msgfds = 0;
-            s->write_msgfds_num = 0;
-        }
+    if (ret < 0 && errno != EAGAIN) {
+        if (tcp_chr_read_poll(chr) <= 0) {
+            /* Perform disconnect and return error. */
+            tcp_chr_disconnect_locked(chr);
+        } /* else let the read handler finish it properly */
+    }
 
-        if (ret < 0 && errno != EAGAIN) {
-            if (tcp_chr_read_poll(chr) <= 0) {
-                /* Perform disconnect and return error. */
-                tcp_chr_disconnect_locked(chr);
-            } /* else let the read handler finish it properly */
-        }
+    return ret;
+}
 
-        return ret;
-    } else {
+/*
+ * Send the output held back by "coalesce-ms".  Called with
+ * chr_write_lock held; returns -1 with errno set if some is left.
+ */
+static int tcp_chr_flush_coalesced(Chardev *chr)
+{
+    SocketChardev *s = SOCKET_CHARDEV(chr);
+    GByteArray *out = s->coalesce_buf;
+    int ret;
+
+    if (!out->len) {
+        return 0;
+    }
+
+    ret = tcp_chr_send(chr, out->data, out->len);
+    if (ret < 0) {
+        return -1;
+    }
+    g_byte_array_remove_range(out, 0, ret);
+    if (out->len) {
+        errno = EAGAIN;
+        return -1;
+    }
+    return 0;
+}
+
+static gboolean tcp_chr_coalesce_timeout(gpointer opaque);
+
+static void tcp_chr_coalesce_timer_cancel(SocketChardev *s)
+{
+    if (s->coalesce_timer) {
+        g_source_destroy(s->coalesce_timer);
+        g_source_unref(s->coalesce_timer);
+        s->coalesce_timer = NULL;
+    }
+}
+
+static void tcp_chr_coalesce_timer_start(Chardev *chr)
+{
+    SocketChardev *s = SOCKET_CHARDEV(chr);
+
+    if (!s->coalesce_timer) {
+        s->coalesce_timer = qemu_chr_timeout_add_ms(chr, s->coalesce_ms,
+                                                    tcp_chr_coalesce_timeout,
+                                                    chr);
+    }
+}
+
+static gboolean tcp_chr_coalesce_timeout(gpointer opaque)
+{
+    Chardev *chr = CHARDEV(opaque);
+    SocketChardev *s = SOCKET_CHARDEV(opaque);
+
+    qemu_mutex_lock(&chr->chr_write_lock);
+    g_source_unref(s->coalesce_timer);
+    s->coalesce_timer = NULL;
+    if (s->state == TCP_CHARDEV_STATE_CONNECTED &&
+        tcp_chr_flush_coalesced(chr) < 0 && errno == EAGAIN) {
+        tcp_chr_coalesce_timer_start(chr);
+    }
+    qemu_mutex_unlock(&chr->chr_write_lock);
+
+    return false;
+}
+
+/* Called with chr_write_lock held.  */
+static int tcp_chr_write(Chardev *chr, const uint8_t *buf, int len)
+{
+    SocketChardev *s = SOCKET_CHARDEV(chr);
+
+    if (s->state != TCP_CHARDEV_STATE_CONNECTED) {
         /* Indicate an error. */
         errno = EIO;
         return -1;
     }
+
+    if (!s->coalesce_ms) {
+        return tcp_chr_send(chr, buf, len);
+    }
+
+    /*
+     * Frontends such as UARTs write a byte at a time.  Hold the output
+     * back for up to coalesce_ms, so that it goes out in one syscall,
+     * unless it comes with file descriptors or fills the buffer.
+     */
+    if (s->write_msgfds_num ||
+        s->coalesce_buf->len + len > TCP_COALESCE_MAX) {
+        if (tcp_chr_flush_coalesced(chr) < 0) {
+            return -1;
+        }
+        if (s->write_msgfds_num || len > TCP_COALESCE_MAX) {
+            return tcp_chr_send(chr, buf, len);
+        }
+    }
+
+    g_byte_array_append(s->coalesce_buf, buf, len);
+    tcp_chr_coalesce_timer_start(chr);
+    return len;
 }
 
 static int tcp_chr_read_poll(void *opaque)
@@ -369,6 +462,16 @@ static void tcp_chr_free_connection(Chardev *chr)
 
     remove_hup_source(s);
 
+    tcp_chr_coalesce_timer_cancel(s);
+    if (s->coalesce_buf && s->coalesce_buf->len) {
+        /* Best effort, the connection is going away */
+        if (s->ioc && s->state == TCP_CHARDEV_STATE_CONNECTED) {
+            io_channel_send_full(s->ioc, s->coalesce_buf->data,
+                                 s->coalesce_buf->len, NULL, 0);
+        }
+        g_byte_array_set_size(s->coalesce_buf, 0);
+    }
+
     tcp_set_msgfds(chr, NULL, 0);
     remove_fd_in_watch(chr);
     if (s->registered_yank &&
@@ -1070,6 +1173,9 @@ static void char_socket_finalize(Object *obj)
 
     tcp_chr_free_connection(chr);
     tcp_chr_reconn_timer_cancel(s);
+    if (s->coalesce_buf) {
+        g_byte_array_unref(s->coalesce_buf);
+    }
     qapi_free_SocketAddress(s->addr);
     tcp_chr_telnet_destroy(s);
     g_free(s->telnet_init);
@@ -1348,6 +1454,10 @@ static void qmp_chardev_open_socket(Chardev *chr,
     s->is_tn3270 = is_tn3270;
     s->is_websock = is_websock;
     s->do_nodelay = do_nodelay;
+    if (sock->has_coalesce_ms && sock->coalesce_ms) {
+        s->coalesce_ms = sock->coalesce_ms;
+        s->coalesce_buf = g_byte_array_sized_new(TCP_COALESCE_MAX);
+    }
     if (sock->tls_creds) {
         Object *creds;
         creds = object_resolve_path_component(
@@ -1478,6 +1588,8 @@ static void qemu_chr_parse_socket(QemuOpts *opts, ChardevBackend *backend,
     sock->wait = qemu_opt_get_bool(opts, "wait", true);
     sock->has_reconnect = qemu_opt_find(opts, "reconnect");
     sock->reconnect = qemu_opt_get_number(opts, "reconnect", 0);
+    sock->has_coalesce_ms = qemu_opt_find(opts, "coalesce-ms");
+    sock->coalesce_ms = qemu_opt_get_number(opts, "coalesce-ms", 0);
     sock->tls_creds = g_strdup(qemu_opt_get(opts, "tls-creds"));
     sock->tls_authz = g_strdup(qemu_opt_get(opts, "tls-authz"));
 
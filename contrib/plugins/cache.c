@@ -20,7 +20,6 @@ static enum qemu_plugin_mem_rw rw = QEMU_PLUGIN_MEM_RW;
 static GHashTable *miss_ht;
 
 static GMutex hashtable_lock;
-static GRand *rng;
 
 static int limit;
 static bool sys;
@@ -33,14 +32,43 @@ enum EvictionPolicy {
 
 enum EvictionPolicy policy;
 
+/*
+ * Coherence between the L1 data caches of the cores:
+ *
+ * MESI: write-back, write-allocate caches with the MESI protocol.
+ *
+ * SNOOP: write-through, no-write-allocate caches that invalidate the
+ * copies of other cores when they see a store, which is how the LEON3
+ * and NOEL-V L1 data caches work.
+ */
+enum CoherenceProtocol {
+    COHERENCE_NONE,
+    COHERENCE_MESI,
+    COHERENCE_SNOOP,
+};
+
+static enum CoherenceProtocol coherence;
+
+/* Only simulate every sample_period'th access of each vCPU */
+static uint64_t sample_period = 1;
+static struct qemu_plugin_scoreboard *sample_counts;
+static qemu_plugin_u64 isample_count;
+static qemu_plugin_u64 dsample_count;
+
+typedef struct {
+    uint64_t insn;
+    uint64_t data;
+} SampleCount;
+
 /*
  * A CacheSet is a set of cache blocks. A memory block that maps to a set can be
  * put in any of the blocks inside the set. The number of block per set is
  * called the associativity (assoc).
  *
- * Each block contains the stored tag and a valid bit. Since this is not
+ * Each block contains the stored tag and its state. Since this is not
  * a functional simulator, the data itself is not stored. We only identify
  * whether a block is in the cache or not by searching for its tag.
+ * Without coherence a valid block is always BLK_EXCLUSIVE.
  *
  * In order to search for memory data in the cache, the set identifier and tag
  * are extracted from the address and the set is probed to see whether a tag
@@ -53,12 +81,25 @@ enum EvictionPolicy policy;
  * The tag is compared against all the tags of a set to search for a match. If a
  * match is found, then the access is a hit.
  *
- * The CacheSet also contains bookkeaping information about eviction details.
+ * The CacheSet also contains bookkeaping information about eviction details,
+ * and the statistics of the set.
+ *
+ * Each set is protected by its own lock, so that vCPUs only contend when
+ * they access the same set.  The L1 data caches of all cores share their
+ * locks when coherence is simulated: the lock of set N then covers set N
+ * of every core, which is all that a coherence action touches.
  */
 
+typedef enum {
+    BLK_INVALID,
+    BLK_SHARED,
+    BLK_EXCLUSIVE,
+    BLK_MODIFIED,
+} BlockState;
+
 typedef struct {
     uint64_t tag;
-    bool valid;
+    BlockState state;
 } CacheBlock;
 
 typedef struct {
@@ -66,18 +107,27 @@ typedef struct {
     uint64_t *lru_priorities;
     uint64_t lru_gen_counter;
     GQueue *fifo_queue;
+    uint32_t rand_state;
+    uint64_t accesses;
+    uint64_t misses;
+    uint64_t invalidations;
+    uint64_t writebacks;
 } CacheSet;
 
 typedef struct {
     CacheSet *sets;
+    GMutex *set_locks;
     int num_sets;
     int cachesize;
     int assoc;
     int blksize_shift;
     uint64_t set_mask;
     uint64_t tag_mask;
+    /* totals of the sets, see cache_sum_sets() */
     uint64_t accesses;
     uint64_t misses;
+    uint64_t invalidations;
+    uint64_t writebacks;
 } Cache;
 
 typedef struct {
@@ -101,14 +151,12 @@ static Cache **l1_dcaches, **l1_icaches;
 static bool use_l2;
 static Cache **l2_ucaches;
 
-static GMutex *l1_dcache_locks;
-static GMutex *l1_icache_locks;
-static GMutex *l2_ucache_locks;
-
 static uint64_t l1_dmem_accesses;
 static uint64_t l1_imem_accesses;
 static uint64_t l1_imisses;
 static uint64_t l1_dmisses;
+static uint64_t l1_dinvalidations;
+static uint64_t l1_dwritebacks;
 
 static uint64_t l2_mem_accesses;
 static uint64_t l2_misses;
@@ -211,6 +259,11 @@ static void fifo_update_on_miss(Cache *cache, int set, int blk_idx)
     g_queue_push_head(q, GINT_TO_POINTER(blk_idx));
 }
 
+static void fifo_remove_block(Cache *cache, int set, int blk_idx)
+{
+    g_queue_remove(cache->sets[set].fifo_queue, GINT_TO_POINTER(blk_idx));
+}
+
 static void fifo_destroy(Cache *cache)
 {
     int i;
@@ -246,7 +299,8 @@ static bool bad_cache_params(int blksize, int assoc, int cachesize)
     return (cachesize % blksize) != 0 || (cachesize % (blksize * assoc) != 0);
 }
 
-static Cache *cache_init(int blksize, int assoc, int cachesize)
+static Cache *cache_init(int blksize, int assoc, int cachesize,
+                         GMutex *set_locks)
 {
     Cache *cache;
     int i;
@@ -262,13 +316,13 @@ static Cache *cache_init(int blksize, int assoc, int cachesize)
     cache->assoc = assoc;
     cache->cachesize = cachesize;
     cache->num_sets = cachesize / (blksize * assoc);
-    cache->sets = g_new(CacheSet, cache->num_sets);
+    cache->sets = g_new0(CacheSet, cache->num_sets);
+    cache->set_locks = set_locks ? set_locks : g_new0(GMutex, cache->num_sets);
     cache->blksize_shift = pow_of_two(blksize);
-    cache->accesses = 0;
-    cache->misses = 0;
 
     for (i = 0; i < cache->num_sets; i++) {
         cache->sets[i].blocks = g_new0(CacheBlock, assoc);
+        cache->sets[i].rand_state = i + 1;
     }
 
     blk_mask = blksize - 1;
@@ -282,7 +336,12 @@ static Cache *cache_init(int blksize, int assoc, int cachesize)
     return cache;
 }
 
-static Cache **caches_init(int blksize, int assoc, int cachesize)
+/*
+ * Create a cache for each core.  With @shared_locks, all of them use the
+ * set locks of the first one.
+ */
+static Cache **caches_init(int blksize, int assoc, int cachesize,
+                           bool shared_locks)
 {
     Cache **caches;
     int i;
@@ -294,7 +353,9 @@ static Cache **caches_init(int blksize, int assoc, int cachesize)
     caches = g_new(Cache *, cores);
 
     for (i = 0; i < cores; i++) {
-        caches[i] = cache_init(blksize, assoc, cachesize);
+        GMutex *locks = i && shared_locks ? caches[0]->set_locks : NULL;
+
+        caches[i] = cache_init(blksize, assoc, cachesize, locks);
     }
 
     return caches;
@@ -305,7 +366,7 @@ static int get_invalid_block(Cache *cache, uint64_t set)
     int i;
 
     for (i = 0; i < cache->assoc; i++) {
-        if (!cache->sets[set].blocks[i].valid) {
+        if (cache->sets[set].blocks[i].state == BLK_INVALID) {
             return i;
         }
     }
@@ -315,9 +376,15 @@ static int get_invalid_block(Cache *cache, uint64_t set)
 
 static int get_replaced_block(Cache *cache, int set)
 {
+    uint32_t *rand_state = &cache->sets[set].rand_state;
+
     switch (policy) {
     case RAND:
-        return g_rand_int_range(rng, 0, cache->assoc);
+        /* xorshift32, so that sets do not share a generator */
+        *rand_state ^= *rand_state << 13;
+        *rand_state ^= *rand_state >> 17;
+        *rand_state ^= *rand_state << 5;
+        return *rand_state % cache->assoc;
     case LRU:
         return lru_get_lru_block(cache, set);
     case FIFO:
@@ -337,7 +404,7 @@ static int in_cache(Cache *cache, uint64_t addr)
 
     for (i = 0; i < cache->assoc; i++) {
         if (cache->sets[set].blocks[i].tag == tag &&
-                cache->sets[set].blocks[i].valid) {
+                cache->sets[set].blocks[i].state != BLK_INVALID) {
             return i;
         }
     }
@@ -345,21 +412,52 @@ static int in_cache(Cache *cache, uint64_t addr)
     return -1;
 }
 
+static GMutex *cache_set_lock(Cache *cache, uint64_t addr)
+{
+    return &cache->set_locks[extract_set(cache, addr)];
+}
+
+/* Bring the block of @addr into the cache, in @state */
+static void cache_fill(Cache *cache, uint64_t addr, BlockState state)
+{
+    uint64_t set = extract_set(cache, addr);
+    CacheBlock *blk;
+    int replaced_blk;
+
+    replaced_blk = get_invalid_block(cache, set);
+
+    if (replaced_blk == -1) {
+        replaced_blk = get_replaced_block(cache, set);
+    }
+
+    if (update_miss) {
+        update_miss(cache, set, replaced_blk);
+    }
+
+    blk = &cache->sets[set].blocks[replaced_blk];
+    if (blk->state == BLK_MODIFIED) {
+        cache->sets[set].writebacks++;
+    }
+    blk->tag = extract_tag(cache, addr);
+    blk->state = state;
+}
+
 /**
  * access_cache(): Simulate a cache access
  * @cache: The cache under simulation
  * @addr: The address of the requested memory location
  *
  * Returns true if the requested data is hit in the cache and false when missed.
- * The cache is updated on miss for the next access.
+ * The cache is updated on miss for the next access.  The caller holds the
+ * lock of the set.
  */
 static bool access_cache(Cache *cache, uint64_t addr)
 {
-    int hit_blk, replaced_blk;
-    uint64_t tag, set;
+    int hit_blk;
+    uint64_t set;
 
-    tag = extract_tag(cache, addr);
     set = extract_set(cache, addr);
+    cache->sets[set].accesses++;
 
     hit_blk = in_cache(cache, addr);
     if (hit_blk != -1) {
@@ -369,19 +467,130 @@ static bool access_cache(Cache *cache, uint64_t addr)
         return true;
     }
 
-    replaced_blk = get_invalid_block(cache, set);
+    cache->sets[set].misses++;
+    cache_fill(cache, addr, BLK_EXCLUSIVE);
 
-    if (replaced_blk == -1) {
-        replaced_blk = get_replaced_block(cache, set);
+    return false;
+}
+
+/*
+ * Coherence actions on the L1 data caches of the cores other than @core,
+ * under the shared lock of the set.  Return whether any of them had the
+ * block.
+ */
+static bool snoop_invalidate(int core, uint64_t addr)
+{
+    bool found = false;
+    int i;
+
+    for (i = 0; i < cores; i++) {
+        Cache *cache = l1_dcaches[i];
+        uint64_t set = extract_set(cache, addr);
+        int blk = i == core ? -1 : in_cache(cache, addr);
+
+        if (blk == -1) {
+            continue;
+        }
+        if (cache->sets[set].blocks[blk].state == BLK_MODIFIED) {
+            cache->sets[set].writebacks++;
+        }
+        cache->sets[set].blocks[blk].state = BLK_INVALID;
+        cache->sets[set].invalidations++;
+        if (policy == FIFO) {
+            fifo_remove_block(cache, set, blk);
+        }
+        found = true;
     }
+    return found;
+}
 
-    if (update_miss) {
-        update_miss(cache, set, replaced_blk);
+static bool snoop_share(int core, uint64_t addr)
+{
+    bool found = false;
+    int i;
+
+    for (i = 0; i < cores; i++) {
+        Cache *cache = l1_dcaches[i];
+        uint64_t set = extract_set(cache, addr);
+        int blk = i == core ? -1 : in_cache(cache, addr);
+
+        if (blk == -1) {
+            continue;
+        }
+        if (cache->sets[set].blocks[blk].state == BLK_MODIFIED) {
+            cache->sets[set].writebacks++;
+        }
+        cache->sets[set].blocks[blk].state = BLK_SHARED;
+        found = true;
+    }
+    return found;
+}
+
+/**
+ * access_dcache(): Simulate an access to the L1 data cache of @core
+ *
+ * Like access_cache(), but follows the coherence protocol.  A store that
+ * misses a write-through cache does not allocate the block, but still
+ * counts as a miss.
+ */
+static bool access_dcache(int core, uint64_t addr, bool store)
+{
+    Cache *cache = l1_dcaches[core];
+    uint64_t set = extract_set(cache, addr);
+    int hit_blk;
+
+    if (coherence == COHERENCE_NONE ||
+        (coherence == COHERENCE_SNOOP && !store)) {
+        return access_cache(cache, addr);
+    }
+
+    cache->sets[set].accesses++;
+    hit_blk = in_cache(cache, addr);
+
+    if (coherence == COHERENCE_SNOOP) {
+        snoop_invalidate(core, addr);
+    } else if (hit_blk != -1) {
+        CacheBlock *blk = &cache->sets[set].blocks[hit_blk];
+
+        if (store) {
+            if (blk->state == BLK_SHARED) {
+                snoop_invalidate(core, addr);
+            }
+            blk->state = BLK_MODIFIED;
+        }
+    } else if (store) {
+        snoop_invalidate(core, addr);
+        cache_fill(cache, addr, BLK_MODIFIED);
+    } else {
+        cache_fill(cache, addr,
+                   snoop_share(core, addr) ? BLK_SHARED : BLK_EXCLUSIVE);
     }
 
-    cache->sets[set].blocks[replaced_blk].tag = tag;
-    cache->sets[set].blocks[replaced_blk].valid = true;
+    if (hit_blk == -1) {
+        cache->sets[set].misses++;
+        return false;
+    }
+    if (update_hit) {
+        update_hit(cache, set, hit_blk);
+    }
+    return true;
+}
+
+/* Return true if this access of @vcpu_index is not part of the sample */
+static bool sample_skip(qemu_plugin_u64 count, unsigned int vcpu_index)
+{
+    uint64_t n;
+
+    if (sample_period == 1) {
+        return false;
+    }
 
+    n = qemu_plugin_u64_get(count, vcpu_index) + 1;
+    if (n < sample_period) {
+        qemu_plugin_u64_set(count, vcpu_index, n);
+        return true;
+    }
+    qemu_plugin_u64_set(count, vcpu_index, 0);
     return false;
 }
 
@@ -392,39 +601,43 @@ static void vcpu_mem_access(unsigned int vcpu_index, qemu_plugin_meminfo_t info,
     struct qemu_plugin_hwaddr *hwaddr;
     int cache_idx;
     InsnData *insn;
-    bool hit_in_l1;
+    bool hit_in_l1, hit_in_l2;
+    GMutex *lock;
 
     hwaddr = qemu_plugin_get_hwaddr(info, vaddr);
     if (hwaddr && qemu_plugin_hwaddr_is_io(hwaddr)) {
         return;
     }
+    if (sample_skip(dsample_count, vcpu_index)) {
+        return;
+    }
 
     effective_addr = hwaddr ? qemu_plugin_hwaddr_phys_addr(hwaddr) : vaddr;
     cache_idx = vcpu_index % cores;
+    lock = cache_set_lock(l1_dcaches[cache_idx], effective_addr);
 
-    g_mutex_lock(&l1_dcache_locks[cache_idx]);
-    hit_in_l1 = access_cache(l1_dcaches[cache_idx], effective_addr);
+    g_mutex_lock(lock);
+    hit_in_l1 = access_dcache(cache_idx, effective_addr,
+                              qemu_plugin_mem_is_store(info));
+    g_mutex_unlock(lock);
     if (!hit_in_l1) {
         insn = userdata;
         __atomic_fetch_add(&insn->l1_dmisses, 1, __ATOMIC_SEQ_CST);
-        l1_dcaches[cache_idx]->misses++;
     }
-    l1_dcaches[cache_idx]->accesses++;
-    g_mutex_unlock(&l1_dcache_locks[cache_idx]);
 
     if (hit_in_l1 || !use_l2) {
         /* No need to access L2 */
         return;
     }
 
-    g_mutex_lock(&l2_ucache_locks[cache_idx]);
-    if (!access_cache(l2_ucaches[cache_idx], effective_addr)) {
+    lock = cache_set_lock(l2_ucaches[cache_idx], effective_addr);
+    g_mutex_lock(lock);
+    hit_in_l2 = access_cache(l2_ucaches[cache_idx], effective_addr);
+    g_mutex_unlock(lock);
+    if (!hit_in_l2) {
         insn = userdata;
         __atomic_fetch_add(&insn->l2_misses, 1, __ATOMIC_SEQ_CST);
-        l2_ucaches[cache_idx]->misses++;
     }
-    l2_ucaches[cache_idx]->accesses++;
-    g_mutex_unlock(&l2_ucache_locks[cache_idx]);
 }
 
 static void vcpu_insn_exec(unsigned int vcpu_index, void *userdata)
@@ -432,34 +645,38 @@ static void vcpu_insn_exec(unsigned int vcpu_index, void *userdata)
     uint64_t insn_addr;
     InsnData *insn;
     int cache_idx;
-    bool hit_in_l1;
+    bool hit_in_l1, hit_in_l2;
+    GMutex *lock;
+
+    if (sample_skip(isample_count, vcpu_index)) {
+        return;
+    }
 
     insn_addr = ((InsnData *) userdata)->addr;
 
     cache_idx = vcpu_index % cores;
-    g_mutex_lock(&l1_icache_locks[cache_idx]);
+    lock = cache_set_lock(l1_icaches[cache_idx], insn_addr);
+    g_mutex_lock(lock);
     hit_in_l1 = access_cache(l1_icaches[cache_idx], insn_addr);
+    g_mutex_unlock(lock);
     if (!hit_in_l1) {
         insn = userdata;
         __atomic_fetch_add(&insn->l1_imisses, 1, __ATOMIC_SEQ_CST);
-        l1_icaches[cache_idx]->misses++;
     }
-    l1_icaches[cache_idx]->accesses++;
-    g_mutex_unlock(&l1_icache_locks[cache_idx]);
 
     if (hit_in_l1 || !use_l2) {
         /* No need to access L2 */
         return;
     }
 
-    g_mutex_lock(&l2_ucache_locks[cache_idx]);
-    if (!access_cache(l2_ucaches[cache_idx], insn_addr)) {
+    lock = cache_set_lock(l2_ucaches[cache_idx], insn_addr);
+    g_mutex_lock(lock);
+    hit_in_l2 = access_cache(l2_ucaches[cache_idx], insn_addr);
+    g_mutex_unlock(lock);
+    if (!hit_in_l2) {
         insn = userdata;
         __atomic_fetch_add(&insn->l2_misses, 1, __ATOMIC_SEQ_CST);
-        l2_ucaches[cache_idx]->misses++;
     }
-    l2_ucaches[cache_idx]->accesses++;
-    g_mutex_unlock(&l2_ucache_locks[cache_idx]);
 }
 
 static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
@@ -530,13 +747,34 @@ static void caches_free(Cache **caches)
 {
     int i;
 
+    for (i = 0; i < cores; i++) {
+        if (!i || caches[i]->set_locks != caches[0]->set_locks) {
+            g_free(caches[i]->set_locks);
+        }
+    }
     for (i = 0; i < cores; i++) {
         cache_free(caches[i]);
     }
 }
 
+/* Fill in the totals of @cache from the statistics of its sets */
+static void cache_sum_sets(Cache *cache)
+{
+    int i;
+
+    cache->accesses = cache->misses = 0;
+    cache->invalidations = cache->writebacks = 0;
+    for (i = 0; i < cache->num_sets; i++) {
+        cache->accesses += cache->sets[i].accesses;
+        cache->misses += cache->sets[i].misses;
+        cache->invalidations += cache->sets[i].invalidations;
+        cache->writebacks += cache->sets[i].writebacks;
+    }
+}
+
 static void append_stats_line(GString *line,
                               uint64_t l1_daccess, uint64_t l1_dmisses,
+                              uint64_t l1_dinval, uint64_t l1_dwb,
                               uint64_t l1_iaccess, uint64_t l1_imisses,
                               uint64_t l2_access, uint64_t l2_misses)
 {
@@ -552,6 +790,11 @@ static void append_stats_line(GString *line,
                            l1_imisses,
                            l1_iaccess ? l1_imiss_rate : 0.0);
 
+    if (coherence != COHERENCE_NONE) {
+        g_string_append_printf(line, "  %-13" PRIu64 " %-10" PRIu64,
+                               l1_dinval, l1_dwb);
+    }
+
     if (l2_access && l2_misses) {
         double l2_miss_rate =  ((double) l2_misses) / (l2_access) * 100.0;
         g_string_append_printf(line,
@@ -574,6 +817,8 @@ static void sum_stats(void)
         l1_dmisses += l1_dcaches[i]->misses;
         l1_imem_accesses += l1_icaches[i]->accesses;
         l1_dmem_accesses += l1_dcaches[i]->accesses;
+        l1_dinvalidations += l1_dcaches[i]->invalidations;
+        l1_dwritebacks += l1_dcaches[i]->writebacks;
 
         if (use_l2) {
             l2_misses += l2_ucaches[i]->misses;
@@ -615,6 +860,18 @@ static void log_stats(void)
                                           " dmiss rate, insn accesses,"
                                           " insn misses, imiss rate");
 
+    for (i = 0; i < cores; i++) {
+        cache_sum_sets(l1_dcaches[i]);
+        cache_sum_sets(l1_icaches[i]);
+        if (use_l2) {
+            cache_sum_sets(l2_ucaches[i]);
+        }
+    }
+
+    if (coherence != COHERENCE_NONE) {
+        g_string_append(rep, ", invalidations, writebacks");
+    }
+
     if (use_l2) {
         g_string_append(rep, ", l2 accesses, l2 misses, l2 miss rate");
     }
@@ -627,6 +884,7 @@ static void log_stats(void)
         icache = l1_icaches[i];
         l2_cache = use_l2 ? l2_ucaches[i] : NULL;
         append_stats_line(rep, dcache->accesses, dcache->misses,
+                dcache->invalidations, dcache->writebacks,
                 icache->accesses, icache->misses,
                 l2_cache ? l2_cache->accesses : 0,
                 l2_cache ? l2_cache->misses : 0);
@@ -636,6 +894,7 @@ static void log_stats(void)
         sum_stats();
         g_string_append_printf(rep, "%-8s", "sum");
         append_stats_line(rep, l1_dmem_accesses, l1_dmisses,
+                l1_dinvalidations, l1_dwritebacks,
                 l1_imem_accesses, l1_imisses,
                 l2_cache ? l2_mem_accesses : 0, l2_cache ? l2_misses : 0);
     }
@@ -708,12 +967,12 @@ static void plugin_exit(qemu_plugin_id_t id, void *p)
     caches_free(l1_dcaches);
     caches_free(l1_icaches);
 
-    g_free(l1_dcache_locks);
-    g_free(l1_icache_locks);
-
     if (use_l2) {
         caches_free(l2_ucaches);
-        g_free(l2_ucache_locks);
+    }
+
+    if (sample_counts) {
+        qemu_plugin_scoreboard_free(sample_counts);
     }
 
     g_hash_table_destroy(miss_ht);
@@ -734,7 +993,6 @@ static void policy_init(void)
         metadata_destroy = fifo_destroy;
         break;
     case RAND:
-        rng = g_rand_new();
         break;
     default:
         g_assert_not_reached();
@@ -803,6 +1061,25 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
                 fprintf(stderr, "boolean argument parsing failed: %s\n", opt);
                 return -1;
             }
+        } else if (g_strcmp0(tokens[0], "coherence") == 0) {
+            if (g_strcmp0(tokens[1], "none") == 0) {
+                coherence = COHERENCE_NONE;
+            } else if (g_strcmp0(tokens[1], "mesi") == 0) {
+                coherence = COHERENCE_MESI;
+            } else if (g_strcmp0(tokens[1], "snoop") == 0) {
+                coherence = COHERENCE_SNOOP;
+            } else {
+                fprintf(stderr, "invalid coherence protocol: %s\n", opt);
+                return -1;
+            }
+        } else if (g_strcmp0(tokens[0], "sample") == 0) {
+            gint64 period = STRTOLL(tokens[1]);
+
+            if (period < 1) {
+                fprintf(stderr, "invalid sample period: %s\n", opt);
+                return -1;
+            }
+            sample_period = period;
         } else if (g_strcmp0(tokens[0], "evict") == 0) {
             if (g_strcmp0(tokens[1], "rand") == 0) {
                 policy = RAND;
@@ -822,7 +1099,8 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
 
     policy_init();
 
-    l1_dcaches = caches_init(l1_dblksize, l1_dassoc, l1_dcachesize);
+    l1_dcaches = caches_init(l1_dblksize, l1_dassoc, l1_dcachesize,
+                             coherence != COHERENCE_NONE);
     if (!l1_dcaches) {
         const char *err = cache_config_error(l1_dblksize, l1_dassoc, l1_dcachesize);
         fprintf(stderr, "dcache cannot be constructed from given parameters\n");
@@ -830,7 +1108,7 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
         return -1;
     }
 
-    l1_icaches = caches_init(l1_iblksize, l1_iassoc, l1_icachesize);
+    l1_icaches = caches_init(l1_iblksize, l1_iassoc, l1_icachesize, false);
     if (!l1_icaches) {
         const char *err = cache_config_error(l1_iblksize, l1_iassoc, l1_icachesize);
         fprintf(stderr, "icache cannot be constructed from given parameters\n");
@@ -838,7 +1116,8 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
         return -1;
     }
 
-    l2_ucaches = use_l2 ? caches_init(l2_blksize, l2_assoc, l2_cachesize) : NULL;
+    l2_ucaches = use_l2 ? caches_init(l2_blksize, l2_assoc, l2_cachesize,
+                                      false) : NULL;
     if (!l2_ucaches && use_l2) {
         const char *err = cache_config_error(l2_blksize, l2_assoc, l2_cachesize);
         fprintf(stderr, "L2 cache cannot be constructed from given parameters\n");
@@ -846,9 +1125,15 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
         return -1;
     }
 
-    l1_dcache_locks = g_new0(GMutex, cores);
-    l1_icache_locks = g_new0(GMutex, cores);
-    l2_ucache_locks = use_l2 ? g_new0(GMutex, cores) : NULL;
+    if (sample_period > 1) {
+        sample_counts = qemu_plugin_scoreboard_new(sizeof(SampleCount));
+        isample_count = qemu_plugin_scoreboard_u64_in_struct(sample_counts,
+                                                             SampleCount,
+                                                             insn);
+        dsample_count = qemu_plugin_scoreboard_u64_in_struct(sample_counts,
+                                                             SampleCount,
+                                                             data);
+    }
 
     qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
     qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
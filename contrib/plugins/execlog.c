@@ -7,6 +7,7 @@
  *   See the COPYING file in the top-level directory.
  */
 #include <glib.h>
+#include <errno.h>
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -24,6 +25,218 @@ static GRWLock expand_array_lock;
 static GPtrArray *imatches;
 static GArray *amatches;
 
+/*
+ * Binary trace output
+ *
+ * With binary=<file> each vCPU appends fixed layout records to its own
+ * ring buffer, without formatting or locking, and a writer thread drains
+ * the rings to the file.  scripts/execlog-decode.py prints the file in
+ * the text format.
+ *
+ * The file starts with ExeclogHeader and is in host byte order.  Each
+ * record is an ExeclogRecord, followed for loads and stores by the
+ * physical address (or -1 in user mode) and for REC_DISAS by the
+ * disassembly, NUL padded to a multiple of 8 bytes.  Records of one vCPU
+ * are in execution order, but the rings are written out in chunks, so
+ * the order between vCPUs is only approximate.
+ */
+#define EXECLOG_MAGIC       0x474f4c4345584551ULL /* "QEXECLOG" */
+#define EXECLOG_VERSION     1
+#define EXECLOG_RING_SIZE   (4 * 1024 * 1024)
+
+enum {
+    REC_INSN = 1,       /* data: opcode, addr: vaddr */
+    REC_LOAD,           /* data: EXECLOG_MEM_*, addr: vaddr */
+    REC_STORE,
+    REC_DISAS,          /* data: string length, addr: vaddr */
+};
+
+#define EXECLOG_MEM_SIZE_SHIFT  0xf
+#define EXECLOG_MEM_SIGN_EXT    0x10
+#define EXECLOG_MEM_BIG_ENDIAN  0x20
+#define EXECLOG_MEM_IO          0x40
+
+typedef struct {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t reserved;
+} ExeclogHeader;
+
+typedef struct {
+    uint16_t type;
+    uint16_t cpu;
+    uint32_t data;
+    uint64_t addr;
+} ExeclogRecord;
+
+/* Single producer (the vCPU), single consumer (the writer thread) */
+typedef struct {
+    uint8_t *buf;
+    uint64_t head;
+    uint64_t tail;
+} ExeclogRing;
+
+static FILE *bin_file;
+static GThread *bin_writer;
+static bool bin_stop;
+
+/* vCPU index to ExeclogRing *, for the vCPUs */
+static struct qemu_plugin_scoreboard *bin_rings;
+/* All rings, for the writer thread */
+static GPtrArray *bin_ring_list;
+static GMutex bin_ring_lock;
+
+/* REC_DISAS records generated at translation time */
+static GString *bin_trans;
+static GMutex bin_trans_lock;
+
+static void ring_write(ExeclogRing *r, const void *data, size_t len)
+{
+    uint64_t head = r->head;
+    size_t pos = head % EXECLOG_RING_SIZE;
+    size_t first = MIN(len, EXECLOG_RING_SIZE - pos);
+
+    /* Wait for the writer thread to make space */
+    while (head + len - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >
+           EXECLOG_RING_SIZE) {
+        if (__atomic_load_n(&bin_stop, __ATOMIC_RELAXED)) {
+            return;
+        }
+        g_thread_yield();
+    }
+
+    memcpy(r->buf + pos, data, first);
+    memcpy(r->buf, (const uint8_t *)data + first, len - first);
+    __atomic_store_n(&r->head, head + len, __ATOMIC_RELEASE);
+}
+
+/* Write out everything produced so far, return the number of bytes */
+static size_t bin_drain(void)
+{
+    g_autofree uint64_t *heads = NULL;
+    size_t total = 0;
+    guint i;
+
+    /*
+     * Snapshot the rings before the translation records, so that every
+     * instruction we write out has its disassembly written before it.
+     */
+    g_mutex_lock(&bin_ring_lock);
+    heads = g_new(uint64_t, bin_ring_list->len);
+    for (i = 0; i < bin_ring_list->len; i++) {
+        ExeclogRing *r = g_ptr_array_index(bin_ring_list, i);
+        heads[i] = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    }
+
+    g_mutex_lock(&bin_trans_lock);
+    fwrite(bin_trans->str, 1, bin_trans->len, bin_file);
+    total += bin_trans->len;
+    g_string_truncate(bin_trans, 0);
+    g_mutex_unlock(&bin_trans_lock);
+
+    for (i = 0; i < bin_ring_list->len; i++) {
+        ExeclogRing *r = g_ptr_array_index(bin_ring_list, i);
+        uint64_t tail = r->tail;
+        size_t len = heads[i] - tail;
+        size_t pos = tail % EXECLOG_RING_SIZE;
+        size_t first = MIN(len, EXECLOG_RING_SIZE - pos);
+
+        fwrite(r->buf + pos, 1, first, bin_file);
+        fwrite(r->buf, 1, len - first, bin_file);
+        __atomic_store_n(&r->tail, heads[i], __ATOMIC_RELEASE);
+        total += len;
+    }
+    g_mutex_unlock(&bin_ring_lock);
+
+    return total;
+}
+
+static gpointer bin_writer_thread(gpointer opaque)
+{
+    while (!__atomic_load_n(&bin_stop, __ATOMIC_ACQUIRE)) {
+        if (!bin_drain()) {
+            g_usleep(1000);
+        }
+    }
+    bin_drain();
+    return NULL;
+}
+
+static void vcpu_init_bin(qemu_plugin_id_t id, unsigned int cpu_index)
+{
+    ExeclogRing *r = g_new0(ExeclogRing, 1);
+
+    r->buf = g_malloc(EXECLOG_RING_SIZE);
+    *(ExeclogRing **)qemu_plugin_scoreboard_find(bin_rings, cpu_index) = r;
+
+    g_mutex_lock(&bin_ring_lock);
+    g_ptr_array_add(bin_ring_list, r);
+    g_mutex_unlock(&bin_ring_lock);
+}
+
+static ExeclogRing *vcpu_ring(unsigned int cpu_index)
+{
+    return *(ExeclogRing **)qemu_plugin_scoreboard_find(bin_rings, cpu_index);
+}
+
+static void vcpu_mem_bin(unsigned int cpu_index, qemu_plugin_meminfo_t info,
+                         uint64_t vaddr, void *udata)
+{
+    struct qemu_plugin_hwaddr *hwaddr = qemu_plugin_get_hwaddr(info, vaddr);
+    struct {
+        ExeclogRecord rec;
+        uint64_t paddr;
+    } mem = {
+        .rec = {
+            .type = qemu_plugin_mem_is_store(info) ? REC_STORE : REC_LOAD,
+            .cpu = cpu_index,
+            .data = qemu_plugin_mem_size_shift(info),
+            .addr = vaddr,
+        },
+        .paddr = -1,
+    };
+
+    if (qemu_plugin_mem_is_sign_extended(info)) {
+        mem.rec.data |= EXECLOG_MEM_SIGN_EXT;
+    }
+    if (qemu_plugin_mem_is_big_endian(info)) {
+        mem.rec.data |= EXECLOG_MEM_BIG_ENDIAN;
+    }
+    if (hwaddr) {
+        mem.paddr = qemu_plugin_hwaddr_phys_addr(hwaddr);
+        if (qemu_plugin_hwaddr_is_io(hwaddr)) {
+            mem.rec.data |= EXECLOG_MEM_IO;
+        }
+    }
+    ring_write(vcpu_ring(cpu_index), &mem, sizeof(mem));
+}
+
+static void vcpu_insn_exec_bin(unsigned int cpu_index, void *udata)
+{
+    ExeclogRecord rec = *(ExeclogRecord *)udata;
+
+    rec.cpu = cpu_index;
+    ring_write(vcpu_ring(cpu_index), &rec, sizeof(rec));
+}
+
+static void bin_add_disas(uint64_t vaddr, const char *disas)
+{
+    size_t len = strlen(disas);
+    ExeclogRecord rec = {
+        .type = REC_DISAS,
+        .data = len,
+        .addr = vaddr,
+    };
+
+    g_mutex_lock(&bin_trans_lock);
+    g_string_append_len(bin_trans, (const char *)&rec, sizeof(rec));
+    g_string_append_len(bin_trans, disas, len);
+    do {
+        g_string_append_c(bin_trans, '\0');
+    } while (++len % 8);
+    g_mutex_unlock(&bin_trans_lock);
+}
+
 /*
  * Expand last_exec array.
  *
@@ -155,6 +368,21 @@ static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
 
         if (skip) {
             g_free(insn_disas);
+        } else if (bin_file) {
+            ExeclogRecord *rec = g_new0(ExeclogRecord, 1);
+
+            rec->type = REC_INSN;
+            rec->data = *((uint32_t *)qemu_plugin_insn_data(insn));
+            rec->addr = insn_vaddr;
+            bin_add_disas(insn_vaddr, insn_disas);
+            g_free(insn_disas);
+
+            qemu_plugin_register_vcpu_mem_cb(insn, vcpu_mem_bin,
+                                             QEMU_PLUGIN_CB_NO_REGS,
+                                             QEMU_PLUGIN_MEM_RW, NULL);
+            qemu_plugin_register_vcpu_insn_exec_cb(insn, vcpu_insn_exec_bin,
+                                                   QEMU_PLUGIN_CB_NO_REGS, rec);
+            skip = (imatches || amatches);
         } else {
             uint32_t insn_opcode;
             insn_opcode = *((uint32_t *)qemu_plugin_insn_data(insn));
@@ -184,6 +412,14 @@ static void plugin_exit(qemu_plugin_id_t id, void *p)
 {
     guint i;
     GString *s;
+
+    if (bin_file) {
+        __atomic_store_n(&bin_stop, true, __ATOMIC_RELEASE);
+        g_thread_join(bin_writer);
+        fclose(bin_file);
+        return;
+    }
+
     for (i = 0; i < last_exec->len; i++) {
         s = g_ptr_array_index(last_exec, i);
         if (s->str) {
@@ -212,6 +448,28 @@ static void parse_vaddr_match(char *match)
     g_array_append_val(amatches, v);
 }
 
+static int bin_open(const char *path)
+{
+    ExeclogHeader hdr = {
+        .magic = EXECLOG_MAGIC,
+        .version = EXECLOG_VERSION,
+    };
+
+    bin_file = fopen(path, "wb");
+    if (!bin_file) {
+        fprintf(stderr, "execlog: cannot open %s: %s\n", path,
+                strerror(errno));
+        return -1;
+    }
+    fwrite(&hdr, sizeof(hdr), 1, bin_file);
+
+    bin_rings = qemu_plugin_scoreboard_new(sizeof(ExeclogRing *));
+    bin_ring_list = g_ptr_array_new();
+    bin_trans = g_string_new(NULL);
+    bin_writer = g_thread_new("execlog-writer", bin_writer_thread, NULL);
+    return 0;
+}
+
 /**
  * Install the plugin
  */
@@ -236,6 +494,10 @@ QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id,
             parse_insn_match(tokens[1]);
         } else if (g_strcmp0(tokens[0], "afilter") == 0) {
             parse_vaddr_match(tokens[1]);
+        } else if (g_strcmp0(tokens[0], "binary") == 0 && tokens[1]) {
+            if (bin_file || bin_open(tokens[1]) < 0) {
+                return -1;
+            }
         } else {
             fprintf(stderr, "option parsing failed: %s\n", opt);
             return -1;
@@ -243,6 +505,9 @@ QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id,
     }
 
     /* Register translation block and exit callbacks */
+    if (bin_file) {
+        qemu_plugin_register_vcpu_init_cb(id, vcpu_init_bin);
+    }
     qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
     qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
 
@@ -44,6 +44,7 @@
 #include "hw/core/accel-cpu.h"
 #include "trace/trace-root.h"
 #include "qemu/accel.h"
+#include "qemu/thread-context.h"
 
 uintptr_t qemu_host_page_size;
 intptr_t qemu_host_page_mask;
@@ -201,6 +202,12 @@ static Property cpu_common_props[] = {
      */
     DEFINE_PROP_LINK("memory", CPUState, memory, TYPE_MEMORY_REGION,
                      MemoryRegion *),
+    /*
+     * Thread context to create the vCPU thread in, which pins it to the
+     * host CPUs of the context from the start, hotplugged CPUs too.
+     */
+    DEFINE_PROP_LINK("thread-context", CPUState, thread_context,
+                     TYPE_THREAD_CONTEXT, ThreadContext *),
 #endif
     DEFINE_PROP_END_OF_LIST(),
 };
@@ -36,6 +36,7 @@ struct QCryptoTLSCreds {
 #endif
     bool verifyPeer;
     char *priority;
+    bool ktls;
 };
 
 struct QCryptoTLSCredsAnon {
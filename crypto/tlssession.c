@@ -33,6 +33,18 @@
 
 #include <gnutls/x509.h>
 
+#ifdef CONFIG_KTLS
+#include <netinet/tcp.h>
+#include <linux/tls.h>
+
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#endif
+
 
 struct QCryptoTLSSession {
     QCryptoTLSCreds *creds;
@@ -101,6 +113,7 @@ qcrypto_tls_session_new(QCryptoTLSCreds *creds,
                         Error **errp)
 {
     QCryptoTLSSession *session;
+    unsigned int flags = 0;
     int ret;
 
     session = g_new0(QCryptoTLSSession, 1);
@@ -122,10 +135,19 @@ qcrypto_tls_session_new(QCryptoTLSCreds *creds,
         goto error;
     }
 
+    /*
+     * The kernel does not handle post-handshake messages, so a TLS 1.3
+     * session ticket arriving once receive is offloaded would break
+     * the connection.  QEMU does not resume sessions anyway.
+     */
+    if (creds->ktls) {
+        flags |= GNUTLS_NO_TICKETS;
+    }
+
     if (endpoint == QCRYPTO_TLS_CREDS_ENDPOINT_SERVER) {
-        ret = gnutls_init(&session->handle, GNUTLS_SERVER);
+        ret = gnutls_init(&session->handle, GNUTLS_SERVER | flags);
     } else {
-        ret = gnutls_init(&session->handle, GNUTLS_CLIENT);
+        ret = gnutls_init(&session->handle, GNUTLS_CLIENT | flags);
     }
     if (ret < 0) {
         error_setg(errp, "Cannot initialize TLS session: %s",
@@ -552,6 +574,158 @@ qcrypto_tls_session_get_key_size(QCryptoTLSSession *session,
 }
 
 
+#ifdef CONFIG_KTLS
+typedef union {
+    struct tls_crypto_info info;
+    struct tls12_crypto_info_aes_gcm_128 aes128;
+#ifdef TLS_CIPHER_AES_GCM_256
+    struct tls12_crypto_info_aes_gcm_256 aes256;
+#endif
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+    struct tls12_crypto_info_chacha20_poly1305 chacha20;
+#endif
+} QCryptoTLSKernelInfo;
+
+/*
+ * Build the kernel TLS state of one direction of @session, as in
+ * the kTLS support of GnuTLS itself.  For TLS 1.2 AES-GCM the
+ * explicit nonce is the record sequence number, for TLS 1.3 the
+ * nonce is the 12-byte IV that is XORed with it.
+ */
+static int
+qcrypto_tls_session_ktls_info(QCryptoTLSSession *session,
+                              bool read,
+                              QCryptoTLSKernelInfo *ki,
+                              socklen_t *len)
+{
+    gnutls_cipher_algorithm_t cipher = gnutls_cipher_get(session->handle);
+    gnutls_datum_t mac_key, iv, key;
+    unsigned char seq[8];
+    uint16_t version;
+
+    switch (gnutls_protocol_get_version(session->handle)) {
+    case GNUTLS_TLS1_2:
+        version = TLS_1_2_VERSION;
+        break;
+#if GNUTLS_VERSION_NUMBER >= 0x030600
+    case GNUTLS_TLS1_3:
+        version = TLS_1_3_VERSION;
+        break;
+#endif
+    default:
+        return -1;
+    }
+
+    if (gnutls_record_get_state(session->handle, read,
+                                &mac_key, &iv, &key, seq) < 0) {
+        return -1;
+    }
+
+    memset(ki, 0, sizeof(*ki));
+    ki->info.version = version;
+
+    switch (cipher) {
+    case GNUTLS_CIPHER_AES_128_GCM:
+        if (key.size != sizeof(ki->aes128.key) || iv.size < 12) {
+            return -1;
+        }
+        ki->info.cipher_type = TLS_CIPHER_AES_GCM_128;
+        memcpy(ki->aes128.key, key.data, key.size);
+        memcpy(ki->aes128.salt, iv.data, sizeof(ki->aes128.salt));
+        memcpy(ki->aes128.iv, version == TLS_1_2_VERSION ?
+               seq : iv.data + sizeof(ki->aes128.salt),
+               sizeof(ki->aes128.iv));
+        memcpy(ki->aes128.rec_seq, seq, sizeof(ki->aes128.rec_seq));
+        *len = sizeof(ki->aes128);
+        return 0;
+#ifdef TLS_CIPHER_AES_GCM_256
+    case GNUTLS_CIPHER_AES_256_GCM:
+        if (key.size != sizeof(ki->aes256.key) || iv.size < 12) {
+            return -1;
+        }
+        ki->info.cipher_type = TLS_CIPHER_AES_GCM_256;
+        memcpy(ki->aes256.key, key.data, key.size);
+        memcpy(ki->aes256.salt, iv.data, sizeof(ki->aes256.salt));
+        memcpy(ki->aes256.iv, version == TLS_1_2_VERSION ?
+               seq : iv.data + sizeof(ki->aes256.salt),
+               sizeof(ki->aes256.iv));
+        memcpy(ki->aes256.rec_seq, seq, sizeof(ki->aes256.rec_seq));
+        *len = sizeof(ki->aes256);
+        return 0;
+#endif
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+    case GNUTLS_CIPHER_CHACHA20_POLY1305:
+        if (key.size != sizeof(ki->chacha20.key) ||
+            iv.size != sizeof(ki->chacha20.iv)) {
+            return -1;
+        }
+        ki->info.cipher_type = TLS_CIPHER_CHACHA20_POLY1305;
+        memcpy(ki->chacha20.key, key.data, key.size);
+        memcpy(ki->chacha20.iv, iv.data, iv.size);
+        memcpy(ki->chacha20.rec_seq, seq, sizeof(ki->chacha20.rec_seq));
+        *len = sizeof(ki->chacha20);
+        return 0;
+#endif
+    default:
+        return -1;
+    }
+}
+#endif
+
+
+int
+qcrypto_tls_session_enable_ktls(QCryptoTLSSession *session,
+                                int fd,
+                                Error **errp)
+{
+#ifdef CONFIG_KTLS
+    QCryptoTLSKernelInfo tx, rx;
+    socklen_t tx_len, rx_len;
+    int ret = 0;
+
+    if (!session->creds->ktls) {
+        return 0;
+    }
+
+    if (qcrypto_tls_session_ktls_info(session, false, &tx, &tx_len) < 0 ||
+        qcrypto_tls_session_ktls_info(session, true, &rx, &rx_len) < 0) {
+        error_setg(errp, "Kernel TLS does not support %s with %s",
+                   gnutls_cipher_get_name(gnutls_cipher_get(session->handle)),
+                   gnutls_protocol_get_name(
+                       gnutls_protocol_get_version(session->handle)));
+        ret = -1;
+        goto out;
+    }
+
+    if (setsockopt(fd, IPPROTO_TCP, TCP_ULP, "tls", sizeof("tls")) < 0) {
+        error_setg_errno(errp, errno, "Cannot enable kernel TLS");
+        ret = -1;
+        goto out;
+    }
+
+    /* The directions are independent, either one may be unsupported */
+    if (setsockopt(fd, SOL_TLS, TLS_TX, &tx, tx_len) == 0) {
+        ret |= QCRYPTO_TLS_KTLS_TX;
+    }
+    if (!gnutls_record_check_pending(session->handle) &&
+        setsockopt(fd, SOL_TLS, TLS_RX, &rx, rx_len) == 0) {
+        ret |= QCRYPTO_TLS_KTLS_RX;
+    }
+
+ out:
+    memset(&tx, 0, sizeof(tx));
+    memset(&rx, 0, sizeof(rx));
+    return ret;
+#else
+    if (session->creds->ktls) {
+        error_setg(errp, "Kernel TLS is not supported on this host");
+        return -1;
+    }
+    return 0;
+#endif
+}
+
+
 char *
 qcrypto_tls_session_get_peer_name(QCryptoTLSSession *session)
 {
@@ -654,6 +828,15 @@ qcrypto_tls_session_get_key_size(QCryptoTLSSession *sess,
 }
 
 
+int
+qcrypto_tls_session_enable_ktls(QCryptoTLSSession *sess,
+                                int fd,
+                                Error **errp)
+{
+    return 0;
+}
+
+
 char *
 qcrypto_tls_session_get_peer_name(QCryptoTLSSession *sess)
 {
@@ -27,6 +27,13 @@
 #include "qemu/bswap.h"
 #include "crypto/xts.h"
 
+/*
+ * Blocks passed to the cipher function at once.  AES-NI and ARMv8-CE
+ * implementations pipeline the rounds of consecutive blocks, which
+ * they cannot do when called a block at a time.
+ */
+#define XTS_BATCH 16
+
 typedef union {
     uint8_t b[XTS_BLOCK_SIZE];
     uint64_t u[2];
@@ -99,6 +106,53 @@ static inline void xts_tweak_encdec(const void *ctx,
 }
 
 
+/**
+ * xts_tweak_encdec_blocks:
+ * @param ctxt: the cipher context
+ * @param func: the cipher function
+ * @src: buffer providing @nblocks blocks of input text
+ * @dst: buffer to output @nblocks blocks of output text
+ * @nblocks: number of XTS_BLOCK_SIZE blocks
+ * @iv: the initialization vector tweak of XTS_BLOCK_SIZE bytes
+ *
+ * Encrypt/decrypt data with consecutive tweaks, calling @func for
+ * up to XTS_BATCH blocks at a time.  @src and @dst may be the same
+ * buffer and need not be aligned.
+ */
+static void xts_tweak_encdec_blocks(const void *ctx,
+                                    xts_cipher_func *func,
+                                    const uint8_t *src,
+                                    uint8_t *dst,
+                                    unsigned long nblocks,
+                                    xts_uint128 *iv)
+{
+    xts_uint128 T[XTS_BATCH], D[XTS_BATCH];
+    unsigned long i, n;
+
+    while (nblocks) {
+        n = MIN(nblocks, XTS_BATCH);
+
+        for (i = 0; i < n; i++) {
+            T[i] = *iv;
+            memcpy(&D[i], src + i * XTS_BLOCK_SIZE, XTS_BLOCK_SIZE);
+            xts_uint128_xor(&D[i], &D[i], &T[i]);
+            xts_mult_x(iv);
+        }
+
+        func(ctx, n * XTS_BLOCK_SIZE, D[0].b, D[0].b);
+
+        for (i = 0; i < n; i++) {
+            xts_uint128_xor(&D[i], &D[i], &T[i]);
+        }
+        memcpy(dst, D, n * XTS_BLOCK_SIZE);
+
+        src += n * XTS_BLOCK_SIZE;
+        dst += n * XTS_BLOCK_SIZE;
+        nblocks -= n;
+    }
+}
+
+
 void xts_decrypt(const void *datactx,
                  const void *tweakctx,
                  xts_cipher_func *encfunc,
@@ -127,24 +181,9 @@ void xts_decrypt(const void *datactx,
     /* encrypt the iv */
     encfunc(tweakctx, XTS_BLOCK_SIZE, T.b, iv);
 
-    if (QEMU_PTR_IS_ALIGNED(src, sizeof(uint64_t)) &&
-        QEMU_PTR_IS_ALIGNED(dst, sizeof(uint64_t))) {
-        xts_uint128 *S = (xts_uint128 *)src;
-        xts_uint128 *D = (xts_uint128 *)dst;
-        for (i = 0; i < lim; i++, S++, D++) {
-            xts_tweak_encdec(datactx, decfunc, S, D, &T);
-        }
-    } else {
-        xts_uint128 D;
-
-        for (i = 0; i < lim; i++) {
-            memcpy(&D, src, XTS_BLOCK_SIZE);
-            xts_tweak_encdec(datactx, decfunc, &D, &D, &T);
-            memcpy(dst, &D, XTS_BLOCK_SIZE);
-            src += XTS_BLOCK_SIZE;
-            dst += XTS_BLOCK_SIZE;
-        }
-    }
+    xts_tweak_encdec_blocks(datactx, decfunc, src, dst, lim, &T);
+    src += lim * XTS_BLOCK_SIZE;
+    dst += lim * XTS_BLOCK_SIZE;
 
     /* if length is not a multiple of XTS_BLOCK_SIZE then */
     if (mo > 0) {
@@ -203,25 +242,9 @@ void xts_encrypt(const void *datactx,
     /* encrypt the iv */
     encfunc(tweakctx, XTS_BLOCK_SIZE, T.b, iv);
 
-    if (QEMU_PTR_IS_ALIGNED(src, sizeof(uint64_t)) &&
-        QEMU_PTR_IS_ALIGNED(dst, sizeof(uint64_t))) {
-        xts_uint128 *S = (xts_uint128 *)src;
-        xts_uint128 *D = (xts_uint128 *)dst;
-        for (i = 0; i < lim; i++, S++, D++) {
-            xts_tweak_encdec(datactx, encfunc, S, D, &T);
-        }
-    } else {
-        xts_uint128 D;
-
-        for (i = 0; i < lim; i++) {
-            memcpy(&D, src, XTS_BLOCK_SIZE);
-            xts_tweak_encdec(datactx, encfunc, &D, &D, &T);
-            memcpy(dst, &D, XTS_BLOCK_SIZE);
-
-            dst += XTS_BLOCK_SIZE;
-            src += XTS_BLOCK_SIZE;
-        }
-    }
+    xts_tweak_encdec_blocks(datactx, encfunc, src, dst, lim, &T);
+    src += lim * XTS_BLOCK_SIZE;
+    dst += lim * XTS_BLOCK_SIZE;
 
     /* if length is not a multiple of XTS_BLOCK_SIZE then */
     if (mo > 0) {
@@ -526,6 +526,20 @@ static void write_data(DumpState *s, void *buf, int length, Error **errp)
     }
 }
 
+/* seek over a zero page instead of writing it, leaving a hole */
+static bool skip_zero_page(DumpState *s, uint8_t *buf, Error **errp)
+{
+    if (!s->sparse || !buffer_is_zero(buf, s->dump_info.page_size)) {
+        return false;
+    }
+    if (lseek(s->fd, s->dump_info.page_size, SEEK_CUR) == (off_t) -1) {
+        error_setg_errno(errp, errno, "dump: failed to save memory");
+    } else {
+        s->written_size += s->dump_info.page_size;
+    }
+    return true;
+}
+
 /* write the memory to vmcore. 1 page per I/O. */
 static void write_memory(DumpState *s, GuestPhysBlock *block, ram_addr_t start,
                          int64_t size, Error **errp)
@@ -534,8 +548,15 @@ static void write_memory(DumpState *s, GuestPhysBlock *block, ram_addr_t start,
     int64_t i;
 
     for (i = 0; i < size / s->dump_info.page_size; i++) {
-        write_data(s, block->host_addr + start + i * s->dump_info.page_size,
-                   s->dump_info.page_size, errp);
+        uint8_t *buf = block->host_addr + start + i * s->dump_info.page_size;
+
+        if (skip_zero_page(s, buf, errp)) {
+            if (*errp) {
+                return;
+            }
+            continue;
+        }
+        write_data(s, buf, s->dump_info.page_size, errp);
         if (*errp) {
             return;
         }
@@ -811,6 +832,18 @@ static void create_vmcore(DumpState *s, Error **errp)
 
     /* Write the section data */
     dump_end(s, errp);
+    if (*errp) {
+        return;
+    }
+
+    /* The dump may end in a hole */
+    if (s->sparse) {
+        off_t end = lseek(s->fd, 0, SEEK_CUR);
+
+        if (end == (off_t) -1 || ftruncate(s->fd, end) < 0) {
+            error_setg_errno(errp, errno, "dump: failed to save memory");
+        }
+    }
 }
 
 static int write_start_flat_header(DumpState *s)
@@ -1466,21 +1499,125 @@ static size_t get_len_buf_out(size_t page_size, uint32_t flag_compress)
     return 0;
 }
 
+/*
+ * Compress one page into @buf_out.  Returns the DUMP_DH_COMPRESSED_* flag
+ * that was used, or 0 if the page has to be saved in plaintext.  Sets
+ * *size_out to the number of bytes to save.
+ */
+static uint32_t dump_compress_page(DumpState *s, uint8_t *buf,
+                                   uint8_t *buf_out, size_t len_buf_out,
+                                   size_t *size_out, void *wrkmem)
+{
+    /*
+     * only one compression format will be used here, for
+     * s->flag_compress is set. But when compression fails to work,
+     * we fall back to save in plaintext.
+     */
+    *size_out = len_buf_out;
+    if ((s->flag_compress & DUMP_DH_COMPRESSED_ZLIB) &&
+        (compress2(buf_out, (uLongf *)size_out, buf,
+                   s->dump_info.page_size, Z_BEST_SPEED) == Z_OK) &&
+        (*size_out < s->dump_info.page_size)) {
+        return DUMP_DH_COMPRESSED_ZLIB;
+    }
+#ifdef CONFIG_LZO
+    if ((s->flag_compress & DUMP_DH_COMPRESSED_LZO) &&
+        (lzo1x_1_compress(buf, s->dump_info.page_size, buf_out,
+                          (lzo_uint *)size_out, wrkmem) == LZO_E_OK) &&
+        (*size_out < s->dump_info.page_size)) {
+        return DUMP_DH_COMPRESSED_LZO;
+    }
+#endif
+#ifdef CONFIG_SNAPPY
+    if ((s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) &&
+        (snappy_compress((char *)buf, s->dump_info.page_size,
+                         (char *)buf_out, size_out) == SNAPPY_OK) &&
+        (*size_out < s->dump_info.page_size)) {
+        return DUMP_DH_COMPRESSED_SNAPPY;
+    }
+#endif
+
+    /*
+     * fall back to save in plaintext, size_out should be
+     * assigned the target's page size
+     */
+    *size_out = s->dump_info.page_size;
+    return 0;
+}
+
+/*
+ * Pages are compressed in batches of DUMP_COMPRESS_BATCH pages per thread.
+ * The main thread fills the batches, compresses the first one itself and
+ * then writes all of them out in order, so the compression threads never
+ * touch the file.
+ */
+#define DUMP_COMPRESS_BATCH 256
+#define DUMP_COMPRESS_THREADS_MAX 64
+
+typedef struct DumpCompressWorker {
+    DumpState *s;
+    QemuThread thread;
+    QemuSemaphore sem;
+    QemuSemaphore *done;
+    bool quit;
+
+    size_t len_buf_out;
+    void *wrkmem;
+    uint8_t *scratch;           /* DUMP_COMPRESS_BATCH pages */
+    uint8_t *buf_out;           /* DUMP_COMPRESS_BATCH * len_buf_out bytes */
+    int npages;
+    uint8_t *bufs[DUMP_COMPRESS_BATCH];
+    size_t size_out[DUMP_COMPRESS_BATCH];   /* 0 for a zero page */
+    uint32_t flags[DUMP_COMPRESS_BATCH];
+} DumpCompressWorker;
+
+static void dump_compress_batch(DumpCompressWorker *w)
+{
+    DumpState *s = w->s;
+    int i;
+
+    for (i = 0; i < w->npages; i++) {
+        if (buffer_is_zero(w->bufs[i], s->dump_info.page_size)) {
+            w->size_out[i] = 0;
+            continue;
+        }
+        w->flags[i] = dump_compress_page(s, w->bufs[i],
+                                         w->buf_out + i * w->len_buf_out,
+                                         w->len_buf_out, &w->size_out[i],
+                                         w->wrkmem);
+    }
+}
+
+static void *dump_compress_thread(void *opaque)
+{
+    DumpCompressWorker *w = opaque;
+
+    for (;;) {
+        qemu_sem_wait(&w->sem);
+        if (w->quit) {
+            break;
+        }
+        dump_compress_batch(w);
+        qemu_sem_post(w->done);
+    }
+    return NULL;
+}
+
 static void write_dump_pages(DumpState *s, Error **errp)
 {
     int ret = 0;
     DataCache page_desc, page_data;
-    size_t len_buf_out, size_out;
-#ifdef CONFIG_LZO
-    lzo_bytep wrkmem = NULL;
-#endif
-    uint8_t *buf_out = NULL;
+    size_t len_buf_out;
     off_t offset_desc, offset_data;
     PageDescriptor pd, pd_zero;
     uint8_t *buf;
     GuestPhysBlock *block_iter = NULL;
     uint64_t pfn_iter;
-    g_autofree uint8_t *page = NULL;
+    int nr_workers = MAX(s->compress_threads, 1);
+    g_autofree DumpCompressWorker *workers = NULL;
+    QemuSemaphore done;
+    bool more = true;
+    int i, j;
 
     /* get offset of page_desc and page_data in dump file */
     offset_desc = s->offset_page;
@@ -1493,11 +1630,25 @@ static void write_dump_pages(DumpState *s, Error **errp)
     len_buf_out = get_len_buf_out(s->dump_info.page_size, s->flag_compress);
     assert(len_buf_out != 0);
 
+    qemu_sem_init(&done, 0);
+    workers = g_new0(DumpCompressWorker, nr_workers);
+    for (i = 0; i < nr_workers; i++) {
+        DumpCompressWorker *w = &workers[i];
+
+        w->s = s;
+        w->done = &done;
+        w->len_buf_out = len_buf_out;
 #ifdef CONFIG_LZO
-    wrkmem = g_malloc(LZO1X_1_MEM_COMPRESS);
+        w->wrkmem = g_malloc(LZO1X_1_MEM_COMPRESS);
 #endif
-
-    buf_out = g_malloc(len_buf_out);
+        w->scratch = g_malloc(DUMP_COMPRESS_BATCH * s->dump_info.page_size);
+        w->buf_out = g_malloc(DUMP_COMPRESS_BATCH * len_buf_out);
+        if (i > 0) {
+            qemu_sem_init(&w->sem, 0);
+            qemu_thread_create(&w->thread, "dump_compress",
+                               dump_compress_thread, w, QEMU_THREAD_JOINABLE);
+        }
+    }
 
     /*
      * init zero page's page_desc and page_data, because every zero page
@@ -1516,103 +1667,84 @@ static void write_dump_pages(DumpState *s, Error **errp)
     }
 
     offset_data += s->dump_info.page_size;
-    page = g_malloc(s->dump_info.page_size);
 
     /*
      * dump memory to vmcore page by page. zero page will all be resided in the
      * first page of page section
      */
-    for (buf = page; get_next_page(&block_iter, &pfn_iter, &buf, s); buf = page) {
-        /* check zero page */
-        if (buffer_is_zero(buf, s->dump_info.page_size)) {
-            ret = write_cache(&page_desc, &pd_zero, sizeof(PageDescriptor),
-                              false);
-            if (ret < 0) {
-                error_setg(errp, "dump: failed to write page desc");
-                goto out;
-            }
-        } else {
-            /*
-             * not zero page, then:
-             * 1. compress the page
-             * 2. write the compressed page into the cache of page_data
-             * 3. get page desc of the compressed page and write it into the
-             *    cache of page_desc
-             *
-             * only one compression format will be used here, for
-             * s->flag_compress is set. But when compression fails to work,
-             * we fall back to save in plaintext.
-             */
-             size_out = len_buf_out;
-             if ((s->flag_compress & DUMP_DH_COMPRESSED_ZLIB) &&
-                    (compress2(buf_out, (uLongf *)&size_out, buf,
-                               s->dump_info.page_size, Z_BEST_SPEED) == Z_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_ZLIB);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#ifdef CONFIG_LZO
-            } else if ((s->flag_compress & DUMP_DH_COMPRESSED_LZO) &&
-                    (lzo1x_1_compress(buf, s->dump_info.page_size, buf_out,
-                    (lzo_uint *)&size_out, wrkmem) == LZO_E_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_LZO);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
+    while (more) {
+        int nr_busy = 0;
+
+        for (i = 0; i < nr_workers && more; i++) {
+            DumpCompressWorker *w = &workers[i];
+
+            for (w->npages = 0; w->npages < DUMP_COMPRESS_BATCH;
+                 w->npages++) {
+                buf = w->scratch + w->npages * s->dump_info.page_size;
+                if (!get_next_page(&block_iter, &pfn_iter, &buf, s)) {
+                    more = false;
+                    break;
                 }
-#endif
-#ifdef CONFIG_SNAPPY
-            } else if ((s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) &&
-                    (snappy_compress((char *)buf, s->dump_info.page_size,
-                    (char *)buf_out, &size_out) == SNAPPY_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_SNAPPY);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
+                w->bufs[w->npages] = buf;
+            }
+            if (i > 0) {
+                qemu_sem_post(&w->sem);
+                nr_busy++;
+            }
+        }
+        dump_compress_batch(&workers[0]);
+        while (nr_busy--) {
+            qemu_sem_wait(&done);
+        }
+
+        for (i = 0; i < nr_workers; i++) {
+            DumpCompressWorker *w = &workers[i];
+
+            for (j = 0; j < w->npages; j++) {
+                /* check zero page */
+                if (w->size_out[j] == 0) {
+                    ret = write_cache(&page_desc, &pd_zero,
+                                      sizeof(PageDescriptor), false);
+                    if (ret < 0) {
+                        error_setg(errp, "dump: failed to write page desc");
+                        goto out;
+                    }
+                    s->written_size += s->dump_info.page_size;
+                    continue;
                 }
-#endif
-            } else {
+
                 /*
-                 * fall back to save in plaintext, size_out should be
-                 * assigned the target's page size
+                 * not zero page, then:
+                 * 1. write the compressed page into the cache of page_data
+                 * 2. get page desc of the compressed page and write it into
+                 *    the cache of page_desc
                  */
-                pd.flags = cpu_to_dump32(s, 0);
-                size_out = s->dump_info.page_size;
-                pd.size = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf,
-                                  s->dump_info.page_size, false);
+                ret = write_cache(&page_data,
+                                  w->flags[j] ? w->buf_out + j * len_buf_out
+                                              : w->bufs[j],
+                                  w->size_out[j], false);
                 if (ret < 0) {
                     error_setg(errp, "dump: failed to write page data");
                     goto out;
                 }
-            }
 
-            /* get and write page desc here */
-            pd.page_flags = cpu_to_dump64(s, 0);
-            pd.offset = cpu_to_dump64(s, offset_data);
-            offset_data += size_out;
+                /* get and write page desc here */
+                pd.flags = cpu_to_dump32(s, w->flags[j]);
+                pd.size = cpu_to_dump32(s, w->size_out[j]);
+                pd.page_flags = cpu_to_dump64(s, 0);
+                pd.offset = cpu_to_dump64(s, offset_data);
+                offset_data += w->size_out[j];
 
-            ret = write_cache(&page_desc, &pd, sizeof(PageDescriptor), false);
-            if (ret < 0) {
-                error_setg(errp, "dump: failed to write page desc");
-                goto out;
+                ret = write_cache(&page_desc, &pd, sizeof(PageDescriptor),
+                                  false);
+                if (ret < 0) {
+                    error_setg(errp, "dump: failed to write page desc");
+                    goto out;
+                }
+                s->written_size += s->dump_info.page_size;
             }
+            w->npages = 0;
         }
-        s->written_size += s->dump_info.page_size;
     }
 
     ret = write_cache(&page_desc, NULL, 0, true);
@@ -1630,11 +1762,20 @@ out:
     free_data_cache(&page_desc);
     free_data_cache(&page_data);
 
-#ifdef CONFIG_LZO
-    g_free(wrkmem);
-#endif
+    for (i = 0; i < nr_workers; i++) {
+        DumpCompressWorker *w = &workers[i];
 
-    g_free(buf_out);
+        if (i > 0) {
+            w->quit = true;
+            qemu_sem_post(&w->sem);
+            qemu_thread_join(&w->thread);
+            qemu_sem_destroy(&w->sem);
+        }
+        g_free(w->wrkmem);
+        g_free(w->scratch);
+        g_free(w->buf_out);
+    }
+    qemu_sem_destroy(&done);
 }
 
 static void create_kdump_vmcore(DumpState *s, Error **errp)
@@ -1811,6 +1952,18 @@ static void dump_init(DumpState *s, int fd, bool has_format,
     }
 
     s->fd = fd;
+
+    /*
+     * An ELF dump into a regular file that is still empty can leave holes
+     * for zero pages; a pipe, or a file that already has data, cannot.
+     */
+    if (!has_format || format == DUMP_GUEST_MEMORY_FORMAT_ELF) {
+        struct stat st;
+
+        s->sparse = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+                    st.st_size == 0;
+    }
+
     if (has_filter && !length) {
         error_setg(errp, "parameter 'length' expects a non-zero size");
         goto cleanup;
@@ -2062,6 +2215,8 @@ void qmp_dump_guest_memory(bool paging, const char *protocol,
                            bool has_begin, int64_t begin,
                            bool has_length, int64_t length,
                            bool has_format, DumpGuestMemoryFormat format,
+                           bool has_compress_threads,
+                           int64_t compress_threads,
                            Error **errp)
 {
     ERRP_GUARD();
@@ -2127,6 +2282,20 @@ void qmp_dump_guest_memory(bool paging, const char *protocol,
     if (has_detach) {
         detach_p = detach;
     }
+    if (has_compress_threads) {
+        if (!has_format || format == DUMP_GUEST_MEMORY_FORMAT_ELF ||
+            format == DUMP_GUEST_MEMORY_FORMAT_WIN_DMP) {
+            error_setg(errp, "'compress-threads' is only supported with "
+                       "kdump-compressed formats");
+            return;
+        }
+        if (compress_threads < 1 ||
+            compress_threads > DUMP_COMPRESS_THREADS_MAX) {
+            error_setg(errp, "'compress-threads' must be between 1 and %d",
+                       DUMP_COMPRESS_THREADS_MAX);
+            return;
+        }
+    }
 
     /* check whether lzo/snappy is supported */
 #ifndef CONFIG_LZO
@@ -2186,6 +2355,7 @@ void qmp_dump_guest_memory(bool paging, const char *protocol,
 
     s = &dump_state_global;
     dump_state_prepare(s);
+    s->compress_threads = has_compress_threads ? compress_threads : 1;
 
     dump_init(s, fd, has_format, format, paging, has_begin,
               begin, length, kdump_raw, errp);
@@ -339,20 +339,17 @@ static inline bool f64_is_inf(union_float64 a)
     return float64_is_infinity(a.s);
 }
 
+/* The part of float32_gen2() after the can_use_fpu() check */
 static inline float32
-float32_gen2(float32 xa, float32 xb, float_status *s,
-             hard_f32_op2_fn hard, soft_f32_op2_fn soft,
-             f32_check_fn pre, f32_check_fn post)
+float32_gen2_fpu(float32 xa, float32 xb, float_status *s,
+                 hard_f32_op2_fn hard, soft_f32_op2_fn soft,
+                 f32_check_fn pre, f32_check_fn post)
 {
     union_float32 ua, ub, ur;
 
     ua.s = xa;
     ub.s = xb;
 
-    if (unlikely(!can_use_fpu(s))) {
-        goto soft;
-    }
-
     float32_input_flush2(&ua.s, &ub.s, s);
     if (unlikely(!pre(ua, ub))) {
         goto soft;
@@ -370,20 +367,17 @@ float32_gen2(float32 xa, float32 xb, float_status *s,
     return soft(ua.s, ub.s, s);
 }
 
+/* The part of float64_gen2() after the can_use_fpu() check */
 static inline float64
-float64_gen2(float64 xa, float64 xb, float_status *s,
-             hard_f64_op2_fn hard, soft_f64_op2_fn soft,
-             f64_check_fn pre, f64_check_fn post)
+float64_gen2_fpu(float64 xa, float64 xb, float_status *s,
+                 hard_f64_op2_fn hard, soft_f64_op2_fn soft,
+                 f64_check_fn pre, f64_check_fn post)
 {
     union_float64 ua, ub, ur;
 
     ua.s = xa;
     ub.s = xb;
 
-    if (unlikely(!can_use_fpu(s))) {
-        goto soft;
-    }
-
     float64_input_flush2(&ua.s, &ub.s, s);
     if (unlikely(!pre(ua, ub))) {
         goto soft;
@@ -401,6 +395,165 @@ float64_gen2(float64 xa, float64 xb, float_status *s,
     return soft(ua.s, ub.s, s);
 }
 
+static inline float32
+float32_gen2(float32 xa, float32 xb, float_status *s,
+             hard_f32_op2_fn hard, soft_f32_op2_fn soft,
+             f32_check_fn pre, f32_check_fn post)
+{
+    if (unlikely(!can_use_fpu(s))) {
+        return soft(xa, xb, s);
+    }
+    return float32_gen2_fpu(xa, xb, s, hard, soft, pre, post);
+}
+
+static inline float64
+float64_gen2(float64 xa, float64 xb, float_status *s,
+             hard_f64_op2_fn hard, soft_f64_op2_fn soft,
+             f64_check_fn pre, f64_check_fn post)
+{
+    if (unlikely(!can_use_fpu(s))) {
+        return soft(xa, xb, s);
+    }
+    return float64_gen2_fpu(xa, xb, s, hard, soft, pre, post);
+}
+
+/*
+ * Array versions of the above, for vector helpers.  The inexact flag
+ * is never cleared by an operation, and the rounding mode never
+ * changed, so once can_use_fpu() holds it holds for the rest of the
+ * array and the check can be hoisted out of the loop.  Elements are
+ * processed in order, so @d may be the same array as @a or @b.
+ */
+static inline void
+float32_gen2_array(float32 *d, const float32 *a, const float32 *b,
+                   size_t n, float_status *s,
+                   hard_f32_op2_fn hard, soft_f32_op2_fn soft,
+                   f32_check_fn pre, f32_check_fn post)
+{
+    size_t i = 0;
+
+    for (; i < n && unlikely(!can_use_fpu(s)); i++) {
+        d[i] = soft(a[i], b[i], s);
+    }
+    for (; i < n; i++) {
+        d[i] = float32_gen2_fpu(a[i], b[i], s, hard, soft, pre, post);
+    }
+}
+
+static inline void
+float64_gen2_array(float64 *d, const float64 *a, const float64 *b,
+                   size_t n, float_status *s,
+                   hard_f64_op2_fn hard, soft_f64_op2_fn soft,
+                   f64_check_fn pre, f64_check_fn post)
+{
+    size_t i = 0;
+
+    for (; i < n && unlikely(!can_use_fpu(s)); i++) {
+        d[i] = soft(a[i], b[i], s);
+    }
+    for (; i < n; i++) {
+        d[i] = float64_gen2_fpu(a[i], b[i], s, hard, soft, pre, post);
+    }
+}
+
+/*
+ * Hardfloat for float16 and bfloat16, through the host's float.  With
+ * a 24-bit significand, at least twice that of either format plus
+ * two, rounding a sum, difference, product or quotient to float and
+ * then to the narrow format gives the correctly rounded result.  The
+ * conversions are done by hand: the inputs are zero or normal and so
+ * widen exactly, and results that are not normal in the narrow format
+ * take the soft path, which gets underflow right.
+ */
+static inline bool f16_is_zon(float16 a)
+{
+    return float16_is_zero(a) || float16_is_normal(a);
+}
+
+static inline bool bf16_is_zon(bfloat16 a)
+{
+    return bfloat16_is_zero(a) || bfloat16_is_normal(a);
+}
+
+static inline float hard_f16_to_f32(float16 a)
+{
+    union_float32 r;
+    uint32_t exp = (a >> 10) & 0x1f;
+
+    r.s = (uint32_t)(a & 0x8000) << 16;
+    if (exp) {
+        r.s |= (exp + 127 - 15) << 23 | (uint32_t)(a & 0x3ff) << 13;
+    }
+    return r.h;
+}
+
+static inline float hard_bf16_to_f32(bfloat16 a)
+{
+    union_float32 r;
+
+    r.s = (uint32_t)a << 16;
+    return r.h;
+}
+
+static inline bool hard_f32_to_f16(float h, float16 *ret, float_status *s)
+{
+    union_float32 u = { .h = h };
+    uint32_t sign = (u.s >> 16) & 0x8000;
+    int exp = (u.s >> 23) & 0xff;
+    uint32_t frac = u.s & 0x7fffff;
+    uint32_t rem = frac & 0x1fff;
+    uint32_t r;
+
+    if (!exp && !frac) {
+        *ret = sign;
+        return true;
+    }
+    exp -= 127 - 15;
+    if (exp < 1 || exp > 0x1f) {
+        return false;
+    }
+
+    /* Round to nearest even, a carry out of the fraction bumps exp */
+    r = exp << 10 | frac >> 13;
+    if (rem > 0x1000 || (rem == 0x1000 && (r & 1))) {
+        r++;
+    }
+    if (r >= 0x7c00) {
+        float_raise(float_flag_overflow | float_flag_inexact, s);
+        r = 0x7c00;
+    }
+    *ret = sign | r;
+    return true;
+}
+
+static inline bool hard_f32_to_bf16(float h, bfloat16 *ret, float_status *s)
+{
+    union_float32 u = { .h = h };
+    uint32_t rem = u.s & 0xffff;
+    uint32_t r = u.s >> 16;
+
+    if (!(u.s & 0x7f800000)) {
+        if (u.s & 0x7fffff) {
+            return false;
+        }
+        *ret = r;
+        return true;
+    }
+    if ((r & 0x7f80) != 0x7f80) {
+        if (rem > 0x8000 || (rem == 0x8000 && (r & 1))) {
+            r++;
+        }
+        if ((r & 0x7f80) != 0x7f80) {
+            *ret = r;
+            return true;
+        }
+    }
+    /* The host result or its rounding overflowed */
+    float_raise(float_flag_overflow | float_flag_inexact, s);
+    *ret = r & 0xff80;
+    return true;
+}
+
 /*
  * Classify a floating point number. Everything above float_class_qnan
  * is a NaN so cls >= float_class_qnan is any NaN.
@@ -1869,6 +2022,16 @@ static float16 QEMU_FLATTEN
 float16_addsub(float16 a, float16 b, float_status *status, bool subtract)
 {
     FloatParts64 pa, pb, *pr;
+    float16 r;
+
+    if (can_use_fpu(status) && f16_is_zon(a) && f16_is_zon(b)) {
+        float fb = hard_f16_to_f32(b);
+
+        if (hard_f32_to_f16(hard_f16_to_f32(a) + (subtract ? -fb : fb),
+                            &r, status)) {
+            return r;
+        }
+    }
 
     float16_unpack_canonical(&pa, a, status);
     float16_unpack_canonical(&pb, b, status);
@@ -2006,6 +2169,38 @@ float64_sub(float64 a, float64 b, float_status *s)
     return float64_addsub(a, b, s, hard_f64_sub, soft_f64_sub);
 }
 
+void QEMU_FLATTEN
+float32_add_array(float32 *d, const float32 *a, const float32 *b,
+                  size_t n, float_status *s)
+{
+    float32_gen2_array(d, a, b, n, s, hard_f32_add, soft_f32_add,
+                       f32_is_zon2, f32_addsubmul_post);
+}
+
+void QEMU_FLATTEN
+float32_sub_array(float32 *d, const float32 *a, const float32 *b,
+                  size_t n, float_status *s)
+{
+    float32_gen2_array(d, a, b, n, s, hard_f32_sub, soft_f32_sub,
+                       f32_is_zon2, f32_addsubmul_post);
+}
+
+void QEMU_FLATTEN
+float64_add_array(float64 *d, const float64 *a, const float64 *b,
+                  size_t n, float_status *s)
+{
+    float64_gen2_array(d, a, b, n, s, hard_f64_add, soft_f64_add,
+                       f64_is_zon2, f64_addsubmul_post);
+}
+
+void QEMU_FLATTEN
+float64_sub_array(float64 *d, const float64 *a, const float64 *b,
+                  size_t n, float_status *s)
+{
+    float64_gen2_array(d, a, b, n, s, hard_f64_sub, soft_f64_sub,
+                       f64_is_zon2, f64_addsubmul_post);
+}
+
 static float64 float64r32_addsub(float64 a, float64 b, float_status *status,
                                  bool subtract)
 {
@@ -2032,6 +2227,16 @@ static bfloat16 QEMU_FLATTEN
 bfloat16_addsub(bfloat16 a, bfloat16 b, float_status *status, bool subtract)
 {
     FloatParts64 pa, pb, *pr;
+    bfloat16 r;
+
+    if (can_use_fpu(status) && bf16_is_zon(a) && bf16_is_zon(b)) {
+        float fb = hard_bf16_to_f32(b);
+
+        if (hard_f32_to_bf16(hard_bf16_to_f32(a) + (subtract ? -fb : fb),
+                             &r, status)) {
+            return r;
+        }
+    }
 
     bfloat16_unpack_canonical(&pa, a, status);
     bfloat16_unpack_canonical(&pb, b, status);
@@ -2103,6 +2308,13 @@ floatx80 floatx80_sub(floatx80 a, floatx80 b, float_status *status)
 float16 QEMU_FLATTEN float16_mul(float16 a, float16 b, float_status *status)
 {
     FloatParts64 pa, pb, *pr;
+    float16 r;
+
+    if (can_use_fpu(status) && f16_is_zon(a) && f16_is_zon(b) &&
+        hard_f32_to_f16(hard_f16_to_f32(a) * hard_f16_to_f32(b),
+                        &r, status)) {
+        return r;
+    }
 
     float16_unpack_canonical(&pa, a, status);
     float16_unpack_canonical(&pb, b, status);
@@ -2159,6 +2371,22 @@ float64_mul(float64 a, float64 b, float_status *s)
                         f64_is_zon2, f64_addsubmul_post);
 }
 
+void QEMU_FLATTEN
+float32_mul_array(float32 *d, const float32 *a, const float32 *b,
+                  size_t n, float_status *s)
+{
+    float32_gen2_array(d, a, b, n, s, hard_f32_mul, soft_f32_mul,
+                       f32_is_zon2, f32_addsubmul_post);
+}
+
+void QEMU_FLATTEN
+float64_mul_array(float64 *d, const float64 *a, const float64 *b,
+                  size_t n, float_status *s)
+{
+    float64_gen2_array(d, a, b, n, s, hard_f64_mul, soft_f64_mul,
+                       f64_is_zon2, f64_addsubmul_post);
+}
+
 float64 float64r32_mul(float64 a, float64 b, float_status *status)
 {
     FloatParts64 pa, pb, *pr;
@@ -2174,6 +2402,13 @@ bfloat16 QEMU_FLATTEN
 bfloat16_mul(bfloat16 a, bfloat16 b, float_status *status)
 {
     FloatParts64 pa, pb, *pr;
+    bfloat16 r;
+
+    if (can_use_fpu(status) && bf16_is_zon(a) && bf16_is_zon(b) &&
+        hard_f32_to_bf16(hard_bf16_to_f32(a) * hard_bf16_to_f32(b),
+                         &r, status)) {
+        return r;
+    }
 
     bfloat16_unpack_canonical(&pa, a, status);
     bfloat16_unpack_canonical(&pb, b, status);
@@ -2443,6 +2678,13 @@ float128 QEMU_FLATTEN float128_muladd(float128 a, float128 b, float128 c,
 float16 float16_div(float16 a, float16 b, float_status *status)
 {
     FloatParts64 pa, pb, *pr;
+    float16 r;
+
+    if (can_use_fpu(status) && f16_is_zon(a) && float16_is_normal(b) &&
+        hard_f32_to_f16(hard_f16_to_f32(a) / hard_f16_to_f32(b),
+                        &r, status)) {
+        return r;
+    }
 
     float16_unpack_canonical(&pa, a, status);
     float16_unpack_canonical(&pb, b, status);
@@ -2533,6 +2775,22 @@ float64_div(float64 a, float64 b, float_status *s)
                         f64_div_pre, f64_div_post);
 }
 
+void QEMU_FLATTEN
+float32_div_array(float32 *d, const float32 *a, const float32 *b,
+                  size_t n, float_status *s)
+{
+    float32_gen2_array(d, a, b, n, s, hard_f32_div, soft_f32_div,
+                       f32_div_pre, f32_div_post);
+}
+
+void QEMU_FLATTEN
+float64_div_array(float64 *d, const float64 *a, const float64 *b,
+                  size_t n, float_status *s)
+{
+    float64_gen2_array(d, a, b, n, s, hard_f64_div, soft_f64_div,
+                       f64_div_pre, f64_div_post);
+}
+
 float64 float64r32_div(float64 a, float64 b, float_status *status)
 {
     FloatParts64 pa, pb, *pr;
@@ -2548,6 +2806,13 @@ bfloat16 QEMU_FLATTEN
 bfloat16_div(bfloat16 a, bfloat16 b, float_status *status)
 {
     FloatParts64 pa, pb, *pr;
+    bfloat16 r;
+
+    if (can_use_fpu(status) && bf16_is_zon(a) && bfloat16_is_normal(b) &&
+        hard_f32_to_bf16(hard_bf16_to_f32(a) / hard_bf16_to_f32(b),
+                         &r, status)) {
+        return r;
+    }
 
     bfloat16_unpack_canonical(&pa, a, status);
     bfloat16_unpack_canonical(&pb, b, status);
@@ -3039,6 +3304,45 @@ floatx80 floatx80_round_to_int(floatx80 a, float_status *status)
     return floatx80_round_pack_canonical(&p, status);
 }
 
+/*
+ * Hardfloat conversions to integer.  These have no inexact result to
+ * detect once inexact is already raised, and only need the rounded value
+ * to be checked against the range of the destination type.  Besides
+ * nearest-even, rounding towards zero is handled too since it is what C
+ * casts compile to.
+ */
+static inline bool can_use_fpu_to_int(FloatRoundMode rmode, int scale,
+                                      const float_status *s)
+{
+    if (QEMU_NO_HARDFLOAT) {
+        return false;
+    }
+    return likely(scale == 0 &&
+                  s->float_exception_flags & float_flag_inexact &&
+                  (rmode == float_round_nearest_even ||
+                   rmode == float_round_to_zero));
+}
+
+static inline float hard_f32_round_to_int(float32 a, FloatRoundMode rmode,
+                                          float_status *s)
+{
+    union_float32 ua;
+
+    ua.s = a;
+    float32_input_flush1(&ua.s, s);
+    return rmode == float_round_to_zero ? truncf(ua.h) : rintf(ua.h);
+}
+
+static inline double hard_f64_round_to_int(float64 a, FloatRoundMode rmode,
+                                           float_status *s)
+{
+    union_float64 ua;
+
+    ua.s = a;
+    float64_input_flush1(&ua.s, s);
+    return rmode == float_round_to_zero ? trunc(ua.h) : rint(ua.h);
+}
+
 /*
  * Floating-point to signed integer conversions
  */
@@ -3093,6 +3397,14 @@ int32_t float32_to_int32_scalbn(float32 a, FloatRoundMode rmode, int scale,
 {
     FloatParts64 p;
 
+    if (can_use_fpu_to_int(rmode, scale, s)) {
+        float r = hard_f32_round_to_int(a, rmode, s);
+
+        if (r >= -0x1p31f && r < 0x1p31f) {
+            return r;
+        }
+    }
+
     float32_unpack_canonical(&p, a, s);
     return parts_float_to_sint(&p, rmode, scale, INT32_MIN, INT32_MAX, s);
 }
@@ -3102,6 +3414,14 @@ int64_t float32_to_int64_scalbn(float32 a, FloatRoundMode rmode, int scale,
 {
     FloatParts64 p;
 
+    if (can_use_fpu_to_int(rmode, scale, s)) {
+        float r = hard_f32_round_to_int(a, rmode, s);
+
+        if (r >= -0x1p63f && r < 0x1p63f) {
+            return r;
+        }
+    }
+
     float32_unpack_canonical(&p, a, s);
     return parts_float_to_sint(&p, rmode, scale, INT64_MIN, INT64_MAX, s);
 }
@@ -3120,6 +3440,14 @@ int32_t float64_to_int32_scalbn(float64 a, FloatRoundMode rmode, int scale,
 {
     FloatParts64 p;
 
+    if (can_use_fpu_to_int(rmode, scale, s)) {
+        double r = hard_f64_round_to_int(a, rmode, s);
+
+        if (r >= -0x1p31 && r < 0x1p31) {
+            return r;
+        }
+    }
+
     float64_unpack_canonical(&p, a, s);
     return parts_float_to_sint(&p, rmode, scale, INT32_MIN, INT32_MAX, s);
 }
@@ -3129,6 +3457,14 @@ int64_t float64_to_int64_scalbn(float64 a, FloatRoundMode rmode, int scale,
 {
     FloatParts64 p;
 
+    if (can_use_fpu_to_int(rmode, scale, s)) {
+        double r = hard_f64_round_to_int(a, rmode, s);
+
+        if (r >= -0x1p63 && r < 0x1p63) {
+            return r;
+        }
+    }
+
     float64_unpack_canonical(&p, a, s);
     return parts_float_to_sint(&p, rmode, scale, INT64_MIN, INT64_MAX, s);
 }
@@ -3520,6 +3856,15 @@ uint32_t float32_to_uint32_scalbn(float32 a, FloatRoundMode rmode, int scale,
 {
     FloatParts64 p;
 
+    if (can_use_fpu_to_int(rmode, scale, s)) {
+        float r = hard_f32_round_to_int(a, rmode, s);
+
+        /* -0.0 converts to 0 without raising invalid */
+        if (r >= 0 && r < 0x1p32f) {
+            return r;
+        }
+    }
+
     float32_unpack_canonical(&p, a, s);
     return parts_float_to_uint(&p, rmode, scale, UINT32_MAX, s);
 }
@@ -3529,6 +3874,15 @@ uint64_t float32_to_uint64_scalbn(float32 a, FloatRoundMode rmode, int scale,
 {
     FloatParts64 p;
 
+    if (can_use_fpu_to_int(rmode, scale, s)) {
+        float r = hard_f32_round_to_int(a, rmode, s);
+
+        /* -0.0 converts to 0 without raising invalid */
+        if (r >= 0 && r < 0x1p64f) {
+            return r;
+        }
+    }
+
     float32_unpack_canonical(&p, a, s);
     return parts_float_to_uint(&p, rmode, scale, UINT64_MAX, s);
 }
@@ -3547,6 +3901,15 @@ uint32_t float64_to_uint32_scalbn(float64 a, FloatRoundMode rmode, int scale,
 {
     FloatParts64 p;
 
+    if (can_use_fpu_to_int(rmode, scale, s)) {
+        double r = hard_f64_round_to_int(a, rmode, s);
+
+        /* -0.0 converts to 0 without raising invalid */
+        if (r >= 0 && r < 0x1p32) {
+            return r;
+        }
+    }
+
     float64_unpack_canonical(&p, a, s);
     return parts_float_to_uint(&p, rmode, scale, UINT32_MAX, s);
 }
@@ -3556,6 +3919,15 @@ uint64_t float64_to_uint64_scalbn(float64 a, FloatRoundMode rmode, int scale,
 {
     FloatParts64 p;
 
+    if (can_use_fpu_to_int(rmode, scale, s)) {
+        double r = hard_f64_round_to_int(a, rmode, s);
+
+        /* -0.0 converts to 0 without raising invalid */
+        if (r >= 0 && r < 0x1p64) {
+            return r;
+        }
+    }
+
     float64_unpack_canonical(&p, a, s);
     return parts_float_to_uint(&p, rmode, scale, UINT64_MAX, s);
 }
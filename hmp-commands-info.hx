@@ -255,6 +255,20 @@ SRST
     Show memory tree.
 ERST
 
+    {
+        .name       = "mmio-stats",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show sampled MMIO/PIO access statistics per region",
+        .cmd        = hmp_info_mmio_stats,
+    },
+
+SRST
+  ``info mmio-stats``
+    Show the access counts and average latencies of the MMIO and PIO
+    regions, costliest first, as sampled with ``-machine mmio-stats``.
+ERST
+
 #if defined(CONFIG_TCG)
     {
         .name       = "jit",
@@ -11,10 +11,14 @@
 #ifndef AARCH64_ATOMIC128_CAS_H
 #define AARCH64_ATOMIC128_CAS_H
 
-/* Through gcc 10, aarch64 has no support for 128-bit atomics.  */
-#if defined(CONFIG_ATOMIC128) || defined(CONFIG_CMPXCHG128)
-#include "host/include/generic/host/atomic128-cas.h"
-#else
+#include "host/cpuinfo.h"
+
+/*
+ * Through gcc 10, aarch64 has no support for 128-bit atomics, and later
+ * compilers only use CASP when built for FEAT_LSE.  Detect it at runtime
+ * instead: under contention CASP scales much better than an exclusive
+ * load/store loop, which can keep failing on a busy cache line.
+ */
 static inline Int128 atomic16_cmpxchg(Int128 *ptr, Int128 cmp, Int128 new)
 {
     uint64_t cmpl = int128_getlo(cmp), cmph = int128_gethi(cmp);
@@ -22,6 +26,22 @@ static inline Int128 atomic16_cmpxchg(Int128 *ptr, Int128 cmp, Int128 new)
     uint64_t oldl, oldh;
     uint32_t tmp;
 
+    if (cpuinfo & CPUINFO_LSE) {
+        /* CASP takes its operands in even/odd register pairs. */
+        register uint64_t x0 asm("x0") = cmpl;
+        register uint64_t x1 asm("x1") = cmph;
+        register uint64_t x2 asm("x2") = newl;
+        register uint64_t x3 asm("x3") = newh;
+
+        asm(".arch_extension lse\n\t"
+            "caspal %[oldl], %[oldh], %[newl], %[newh], %[mem]"
+            : [mem] "+Q"(*ptr), [oldl] "+r"(x0), [oldh] "+r"(x1)
+            : [newl] "r"(x2), [newh] "r"(x3)
+            : "memory");
+
+        return int128_make128(x0, x1);
+    }
+
     asm("0: ldaxp %[oldl], %[oldh], %[mem]\n\t"
         "cmp %[oldl], %[cmpl]\n\t"
         "ccmp %[oldh], %[cmph], #0, eq\n\t"
@@ -38,8 +58,6 @@ static inline Int128 atomic16_cmpxchg(Int128 *ptr, Int128 cmp, Int128 new)
     return int128_make128(oldl, oldh);
 }
 
-# define CONFIG_CMPXCHG128 1
-# define HAVE_CMPXCHG128 1
-#endif
+#define HAVE_CMPXCHG128 1
 
 #endif /* AARCH64_ATOMIC128_CAS_H */
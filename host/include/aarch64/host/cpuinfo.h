@@ -12,6 +12,10 @@
 #define CPUINFO_AES             (1u << 3)
 #define CPUINFO_PMULL           (1u << 4)
 #define CPUINFO_BTI             (1u << 5)
+#define CPUINFO_ASIMD           (1u << 6)
+#define CPUINFO_SVE             (1u << 7)
+#define CPUINFO_SVE2            (1u << 8)
+#define CPUINFO_SVE256          (1u << 9)  /* SVE vector length is 256 */
 
 /* Initialized with a constructor. */
 extern unsigned cpuinfo;
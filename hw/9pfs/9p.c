@@ -383,6 +383,7 @@ static int coroutine_fn free_fid(V9fsPDU *pdu, V9fsFidState *fidp)
         if (fidp->fs.dir.stream != NULL) {
             retval = v9fs_co_closedir(pdu, &fidp->fs);
         }
+        g_free(fidp->fs.dir.pending);
     } else if (fidp->fid_type == P9_FID_XATTR) {
         retval = v9fs_xattr_fid_clunk(pdu, fidp);
     }
@@ -485,6 +486,8 @@ void coroutine_fn v9fs_reclaim_fd(V9fsPDU *pdu)
                 QSLIST_INSERT_HEAD(&reclaim_list, f, reclaim_next);
                 f->fs_reclaim.dir.stream = f->fs.dir.stream;
                 f->fs.dir.stream = NULL;
+                /* the reopened stream will not be behind it */
+                g_clear_pointer(&f->fs.dir.pending, g_free);
                 reclaim_count++;
             }
         }
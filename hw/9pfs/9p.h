@@ -201,6 +201,15 @@ typedef struct V9fsDir {
     CoMutex readdir_mutex_u;
     /* readdir mutex type used for 9P2000.L protocol variant */
     QemuMutex readdir_mutex_L;
+    /*
+     * Entry that the last v9fs_co_readdir_many() read but could not fit
+     * in its response, and the offset the client will continue at.  The
+     * next call at that offset starts with it and carries on with the
+     * stream, instead of seeking the stream, which drops the entries
+     * that the libc has already read ahead.
+     */
+    struct dirent *pending;
+    off_t pending_pos;
 } V9fsDir;
 
 static inline void coroutine_fn v9fs_readdir_lock(V9fsDir *dir)
@@ -73,11 +73,13 @@ do_readdir_many(V9fsPDU *pdu, V9fsFidState *fidp, struct V9fsDirEnt **entries,
                 off_t offset, int32_t maxsize, bool dostat)
 {
     V9fsState *s = pdu->s;
+    V9fsDir *dir = &fidp->fs.dir;
     V9fsString name;
     int len, err = 0;
     int32_t size = 0;
     off_t saved_dir_pos;
     struct dirent *dent;
+    g_autofree struct dirent *pending = NULL;
     struct V9fsDirEnt *e = NULL;
     V9fsPath path;
     struct stat stbuf;
@@ -94,20 +96,28 @@ do_readdir_many(V9fsPDU *pdu, V9fsFidState *fidp, struct V9fsDirEnt **entries,
      * the client would then suffer performance issues, so better log that
      * issue here.
      */
-    v9fs_readdir_lock(&fidp->fs.dir);
+    v9fs_readdir_lock(dir);
 
-    /* seek directory to requested initial position */
-    if (offset == 0) {
-        s->ops->rewinddir(&s->ctx, &fidp->fs);
+    pending = g_steal_pointer(&dir->pending);
+    if (pending && offset == dir->pending_pos) {
+        /* the stream is right behind the pending entry */
+        saved_dir_pos = offset;
     } else {
-        s->ops->seekdir(&s->ctx, &fidp->fs, offset);
-    }
+        g_clear_pointer(&pending, g_free);
 
-    /* save the directory position */
-    saved_dir_pos = s->ops->telldir(&s->ctx, &fidp->fs);
-    if (saved_dir_pos < 0) {
-        err = saved_dir_pos;
-        goto out;
+        /* seek directory to requested initial position */
+        if (offset == 0) {
+            s->ops->rewinddir(&s->ctx, &fidp->fs);
+        } else {
+            s->ops->seekdir(&s->ctx, &fidp->fs, offset);
+        }
+
+        /* save the directory position */
+        saved_dir_pos = s->ops->telldir(&s->ctx, &fidp->fs);
+        if (saved_dir_pos < 0) {
+            err = saved_dir_pos;
+            goto out;
+        }
     }
 
     while (true) {
@@ -118,9 +128,13 @@ do_readdir_many(V9fsPDU *pdu, V9fsFidState *fidp, struct V9fsDirEnt **entries,
         }
 
         /* get directory entry from fs driver */
-        err = do_readdir(pdu, fidp, &dent);
-        if (err || !dent) {
-            break;
+        if (pending && !size) {
+            dent = pending;
+        } else {
+            err = do_readdir(pdu, fidp, &dent);
+            if (err || !dent) {
+                break;
+            }
         }
 
         /*
@@ -135,6 +149,12 @@ do_readdir_many(V9fsPDU *pdu, V9fsFidState *fidp, struct V9fsDirEnt **entries,
         v9fs_string_free(&name);
         if (size + len > maxsize) {
             /* this is not an error case actually */
+            if (size) {
+                /* keep it for the next request, see V9fsDir */
+                dir->pending = dent == pending ? g_steal_pointer(&pending)
+                                               : qemu_dirent_dup(dent);
+                dir->pending_pos = saved_dir_pos;
+            }
             break;
         }
 
@@ -171,10 +191,12 @@ do_readdir_many(V9fsPDU *pdu, V9fsFidState *fidp, struct V9fsDirEnt **entries,
     }
 
     /* restore (last) saved position */
-    s->ops->seekdir(&s->ctx, &fidp->fs, saved_dir_pos);
+    if (!dir->pending) {
+        s->ops->seekdir(&s->ctx, &fidp->fs, saved_dir_pos);
+    }
 
 out:
-    v9fs_readdir_unlock(&fidp->fs.dir);
+    v9fs_readdir_unlock(dir);
     v9fs_path_free(&path);
     if (err < 0) {
         return err;
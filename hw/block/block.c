@@ -243,6 +243,7 @@ bool blkconf_apply_backend_options(BlockConf *conf, bool readonly,
 
     blk_set_enable_write_cache(blk, wce);
     blk_set_on_error(blk, rerror, werror);
+    blk_set_write_batching(blk, (uint64_t)conf->write_batch_us * SCALE_US);
 
     block_acct_setup(blk_get_stats(blk), conf->account_invalid,
                      conf->account_failed);
@@ -29,6 +29,7 @@
 #include "hw/qdev-properties.h"
 #include "hw/qdev-properties-system.h"
 #include "hw/ssi/ssi.h"
+#include "exec/memory.h"
 #include "migration/vmstate.h"
 #include "qemu/bitops.h"
 #include "qemu/log.h"
@@ -466,6 +467,10 @@ struct Flash {
     uint32_t size;
     int page_size;
 
+    /* Contents mapped for direct reads, if "memory-mapped" is set */
+    bool memory_mapped;
+    MemoryRegion mem;
+
     uint8_t state;
     uint8_t data[M25P80_INTERNAL_DATA_BUFFER_SZ];
     uint32_t len;
@@ -535,6 +540,17 @@ static inline Manufacturer get_man(Flash *s)
     }
 }
 
+/*
+ * Code may have been translated from the memory-mapped contents, which
+ * the SSI path modifies behind the back of the memory core.
+ */
+static void flash_update_mapping(Flash *s, uint32_t offset, uint32_t len)
+{
+    if (s->memory_mapped) {
+        memory_region_flush_rom_device(&s->mem, offset, len);
+    }
+}
+
 static void blk_sync_complete(void *opaque, int ret)
 {
     QEMUIOVector *iov = opaque;
@@ -627,6 +643,7 @@ static void flash_erase(Flash *s, int offset, FlashCMD cmd)
         return;
     }
     memset(s->storage + offset, 0xff, len);
+    flash_update_mapping(s, offset, len);
     flash_sync_area(s, offset, len);
 }
 
@@ -682,6 +699,7 @@ void flash_write8(Flash *s, uint32_t addr, uint8_t data)
     } else {
         s->storage[s->cur_addr] &= data;
     }
+    flash_update_mapping(s, s->cur_addr, 1);
 
     flash_sync_dirty(s, page);
     s->dirty_page = page;
@@ -1587,6 +1605,63 @@ static uint32_t m25p80_transfer8(SSIPeripheral *ss, uint32_t tx)
     return r;
 }
 
+/*
+ * Array reads are the bulk of the traffic, e.g. when booting from
+ * flash, and are served with a copy; anything else goes through the
+ * byte-wise state machine.
+ */
+static void m25p80_transfer_bulk(SSIPeripheral *ss, const uint8_t *tx,
+                                 uint8_t *rx, uint32_t len)
+{
+    Flash *s = M25P80(ss);
+    uint32_t n, r;
+
+    while (len) {
+        if (s->state == STATE_READ) {
+            n = MIN(len, s->size - s->cur_addr);
+            trace_m25p80_read_bulk(s, s->cur_addr, n);
+            if (rx) {
+                memcpy(rx, s->storage + s->cur_addr, n);
+            }
+            s->cur_addr = (s->cur_addr + n) & (s->size - 1);
+        } else {
+            n = 1;
+            r = m25p80_transfer8(ss, tx ? *tx : 0);
+            if (rx) {
+                *rx = r;
+            }
+        }
+        len -= n;
+        tx = tx ? tx + n : NULL;
+        rx = rx ? rx + n : NULL;
+    }
+}
+
+static uint64_t m25p80_mem_read(void *opaque, hwaddr addr, unsigned size)
+{
+    Flash *s = opaque;
+
+    return ldn_le_p(s->storage + addr, size);
+}
+
+static void m25p80_mem_write(void *opaque, hwaddr addr, uint64_t val,
+                             unsigned size)
+{
+    qemu_log_mask(LOG_GUEST_ERROR,
+                  "M25P80: write to memory-mapped flash at 0x%" HWADDR_PRIx
+                  ", use the SPI commands\n", addr);
+}
+
+static const MemoryRegionOps m25p80_mem_ops = {
+    .read = m25p80_mem_read,
+    .write = m25p80_mem_write,
+    .endianness = DEVICE_LITTLE_ENDIAN,
+    .valid = {
+        .min_access_size = 1,
+        .max_access_size = 8,
+    },
+};
+
 static void m25p80_write_protect_pin_irq_handler(void *opaque, int n, int level)
 {
     Flash *s = M25P80(opaque);
@@ -1606,6 +1681,14 @@ static void m25p80_realize(SSIPeripheral *ss, Error **errp)
     s->size = s->pi->sector_size * s->pi->n_sectors;
     s->dirty_page = -1;
 
+    if (s->memory_mapped) {
+        if (!memory_region_init_rom_device(&s->mem, OBJECT(s),
+                                           &m25p80_mem_ops, s, "m25p80.mem",
+                                           s->size, errp)) {
+            return;
+        }
+    }
+
     if (s->blk) {
         uint64_t perm = BLK_PERM_CONSISTENT_READ |
                         (blk_supports_write_perm(s->blk) ? BLK_PERM_WRITE : 0);
@@ -1615,7 +1698,8 @@ static void m25p80_realize(SSIPeripheral *ss, Error **errp)
         }
 
         trace_m25p80_binding(s);
-        s->storage = blk_blockalign(s->blk, s->size);
+        s->storage = s->memory_mapped ? memory_region_get_ram_ptr(&s->mem)
+                                      : blk_blockalign(s->blk, s->size);
 
         if (!blk_check_size_and_read_all(s->blk, DEVICE(s),
                                          s->storage, s->size, errp)) {
@@ -1623,7 +1707,8 @@ static void m25p80_realize(SSIPeripheral *ss, Error **errp)
         }
     } else {
         trace_m25p80_binding_no_bdrv(s);
-        s->storage = blk_blockalign(NULL, s->size);
+        s->storage = s->memory_mapped ? memory_region_get_ram_ptr(&s->mem)
+                                      : blk_blockalign(NULL, s->size);
         memset(s->storage, 0xFF, s->size);
     }
 
@@ -1662,6 +1747,7 @@ static Property m25p80_properties[] = {
     DEFINE_PROP_UINT8("spansion-cr3nv", Flash, spansion_cr3nv, 0x2),
     DEFINE_PROP_UINT8("spansion-cr4nv", Flash, spansion_cr4nv, 0x10),
     DEFINE_PROP_DRIVE("drive", Flash, blk),
+    DEFINE_PROP_BOOL("memory-mapped", Flash, memory_mapped, false),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -1799,6 +1885,7 @@ static void m25p80_class_init(ObjectClass *klass, void *data)
 
     k->realize = m25p80_realize;
     k->transfer = m25p80_transfer8;
+    k->transfer_bulk = m25p80_transfer_bulk;
     k->set_cs = m25p80_cs;
     k->cs_polarity = SSI_CS_LOW;
     dc->vmsd = &vmstate_m25p80;
@@ -1837,3 +1924,16 @@ BlockBackend *m25p80_get_blk(DeviceState *dev)
 {
     return M25P80(dev)->blk;
 }
+
+/*
+ * The contents as a ROM device region, for controllers that map the
+ * flash in their address space: reads bypass the SSI bus, writes and
+ * erases still have to use the SPI commands.  NULL unless the
+ * "memory-mapped" property is set.
+ */
+MemoryRegion *m25p80_get_memory(DeviceState *dev)
+{
+    Flash *s = M25P80(dev);
+
+    return s->memory_mapped ? &s->mem : NULL;
+}
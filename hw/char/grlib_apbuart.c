@@ -31,6 +31,10 @@
 #include "hw/char/grlib_uart.h"
 #include "hw/sysbus.h"
 #include "qemu/module.h"
+#include "qemu/main-loop.h"
+#include "qemu/log.h"
+#include "qemu/fifo8.h"
+#include "qapi/error.h"
 #include "chardev/char-fe.h"
 
 #include "trace.h"
@@ -50,6 +54,10 @@
 #define UART_RECEIVE_FIFO_HALF    (1 <<  8)
 #define UART_TRANSMIT_FIFO_FULL   (1 <<  9)
 #define UART_RECEIVE_FIFO_FULL    (1 << 10)
+#define UART_TRANSMIT_FIFO_COUNT_SHIFT 20
+#define UART_TRANSMIT_FIFO_COUNT_SIZE   6
+#define UART_RECEIVE_FIFO_COUNT_SHIFT  26
+#define UART_RECEIVE_FIFO_COUNT_SIZE    6
 
 /* UART control register fields */
 #define UART_RECEIVE_ENABLE          (1 <<  0)
@@ -74,8 +82,15 @@
 #define SCALER_OFFSET     0x0C  /* not supported */
 #define FIFO_DEBUG_OFFSET 0x10  /* not supported */
 
+/*
+ * Default receiver FIFO depth.  The real IP can only be synthesized with up
+ * to 32 entries, the larger default lets the host paste whole scripts.
+ */
 #define FIFO_LENGTH 1024
 
+/* Largest transmitter FIFO available on the GRLIB APBUART */
+#define TX_FIFO_MAX_LENGTH 32
+
 OBJECT_DECLARE_SIMPLE_TYPE(UART, GRLIB_APB_UART)
 
 struct UART {
@@ -90,72 +105,209 @@ struct UART {
     uint32_t status;
     uint32_t control;
 
-    /* FIFO */
-    char buffer[FIFO_LENGTH];
-    int  len;
-    int  current;
+    /* Receiver FIFO */
+    uint32_t rx_fifo_size;
+    Fifo8    rx_fifo;
+
+    /*
+     * Transmitter FIFO, only used when tx_fifo_size is not zero.  Otherwise
+     * each character is synchronously written to the backend.
+     */
+    uint32_t tx_fifo_size;
+    uint8_t  tx_fifo[TX_FIFO_MAX_LENGTH];
+    uint32_t tx_count;
+    QEMUBH  *tx_bh;
+    guint    tx_watch;
 };
 
-static int uart_data_to_read(UART *uart)
+static bool uart_rx_fifo_half(UART *uart)
+{
+    return fifo8_num_used(&uart->rx_fifo) * 2 >= uart->rx_fifo_size;
+}
+
+static void uart_update_rx_status(UART *uart)
 {
-    return uart->current < uart->len;
+    uint32_t count = fifo8_num_used(&uart->rx_fifo);
+
+    uart->status &= ~(UART_DATA_READY | UART_RECEIVE_FIFO_HALF |
+                      UART_RECEIVE_FIFO_FULL);
+
+    if (count) {
+        uart->status |= UART_DATA_READY;
+    }
+    if (count && uart_rx_fifo_half(uart)) {
+        uart->status |= UART_RECEIVE_FIFO_HALF;
+    }
+    if (fifo8_is_full(&uart->rx_fifo)) {
+        uart->status |= UART_RECEIVE_FIFO_FULL;
+    }
+
+    /* The count field saturates for the deeper non GRLIB FIFOs */
+    uart->status = deposit32(uart->status, UART_RECEIVE_FIFO_COUNT_SHIFT,
+                             UART_RECEIVE_FIFO_COUNT_SIZE,
+                             MIN(count, MAKE_64BIT_MASK(0,
+                                            UART_RECEIVE_FIFO_COUNT_SIZE)));
 }
 
 static char uart_pop(UART *uart)
 {
     char ret;
 
-    if (uart->len == 0) {
-        uart->status &= ~UART_DATA_READY;
+    if (fifo8_is_empty(&uart->rx_fifo)) {
         return 0;
     }
 
-    ret = uart->buffer[uart->current++];
+    ret = fifo8_pop(&uart->rx_fifo);
+    uart_update_rx_status(uart);
+
+    /* Room was made, let the backend push the rest of its data */
+    qemu_chr_fe_accept_input(&uart->chr);
+
+    return ret;
+}
 
-    if (uart->current >= uart->len) {
-        /* Flush */
-        uart->len     = 0;
-        uart->current = 0;
+static int grlib_apbuart_can_receive(void *opaque)
+{
+    UART *uart = opaque;
+
+    return fifo8_num_free(&uart->rx_fifo);
+}
+
+static void grlib_apbuart_receive(void *opaque, const uint8_t *buf, int size)
+{
+    UART *uart = opaque;
+    bool  was_half;
+    bool  irq;
+
+    if (!(uart->control & UART_RECEIVE_ENABLE)) {
+        return;
     }
 
-    if (!uart_data_to_read(uart)) {
-        uart->status &= ~UART_DATA_READY;
+    if (size > fifo8_num_free(&uart->rx_fifo)) {
+        /* Can't happen with can_receive, but don't trust the backend */
+        size = fifo8_num_free(&uart->rx_fifo);
+        uart->status |= UART_OVERRUN;
     }
 
-    return ret;
+    was_half = uart_rx_fifo_half(uart) && !fifo8_is_empty(&uart->rx_fifo);
+    fifo8_push_all(&uart->rx_fifo, buf, size);
+    uart_update_rx_status(uart);
+
+    /*
+     * Raise a single interrupt for the whole burst: on each burst when the
+     * receiver interrupt is enabled, and when the FIFO crosses the half-full
+     * level when the receiver FIFO interrupt is enabled.
+     */
+    irq = uart->control & UART_RECEIVE_INTERRUPT;
+    if ((uart->control & UART_RECEIVE_FIFO_INTERRUPT) &&
+        !was_half && uart_rx_fifo_half(uart)) {
+        irq = true;
+    }
+
+    if (irq) {
+        qemu_irq_pulse(uart->irq);
+    }
 }
 
-static void uart_add_to_fifo(UART          *uart,
-                             const uint8_t *buffer,
-                             int            length)
+static void uart_update_tx_status(UART *uart)
 {
-    if (uart->len + length > FIFO_LENGTH) {
-        abort();
+    uart->status &= ~(UART_TRANSMIT_SHIFT_EMPTY | UART_TRANSMIT_FIFO_EMPTY |
+                      UART_TRANSMIT_FIFO_HALF | UART_TRANSMIT_FIFO_FULL);
+
+    if (uart->tx_count == 0) {
+        uart->status |= UART_TRANSMIT_SHIFT_EMPTY | UART_TRANSMIT_FIFO_EMPTY;
+    }
+    if (uart->tx_count * 2 < uart->tx_fifo_size) {
+        uart->status |= UART_TRANSMIT_FIFO_HALF;
+    }
+    if (uart->tx_count == uart->tx_fifo_size) {
+        uart->status |= UART_TRANSMIT_FIFO_FULL;
     }
-    memcpy(uart->buffer + uart->len, buffer, length);
-    uart->len += length;
+
+    uart->status = deposit32(uart->status, UART_TRANSMIT_FIFO_COUNT_SHIFT,
+                             UART_TRANSMIT_FIFO_COUNT_SIZE, uart->tx_count);
 }
 
-static int grlib_apbuart_can_receive(void *opaque)
+static gboolean grlib_apbuart_xmit(void *do_not_use, GIOCondition cond,
+                                   void *opaque)
 {
     UART *uart = opaque;
+    int   ret;
 
-    return FIFO_LENGTH - uart->len;
+    uart->tx_watch = 0;
+
+    /* Instantly drain the FIFO when there's no backend */
+    if (!qemu_chr_fe_backend_connected(&uart->chr)) {
+        uart->tx_count = 0;
+        uart_update_tx_status(uart);
+        return G_SOURCE_REMOVE;
+    }
+
+    if (!uart->tx_count) {
+        return G_SOURCE_REMOVE;
+    }
+
+    ret = qemu_chr_fe_write(&uart->chr, uart->tx_fifo, uart->tx_count);
+    trace_grlib_apbuart_xmit(uart->tx_count, ret);
+
+    if (ret > 0) {
+        uart->tx_count -= ret;
+        memmove(uart->tx_fifo, uart->tx_fifo + ret, uart->tx_count);
+    }
+
+    if (uart->tx_count) {
+        /* The backend is busy, resume when it can take more */
+        uart->tx_watch = qemu_chr_fe_add_watch(&uart->chr,
+                                               G_IO_OUT | G_IO_HUP,
+                                               grlib_apbuart_xmit, uart);
+        if (!uart->tx_watch) {
+            uart->tx_count = 0;
+        }
+    }
+
+    uart_update_tx_status(uart);
+
+    /* One interrupt for the whole burst */
+    if (ret > 0 && (uart->control & (UART_TRANSMIT_INTERRUPT |
+                                     UART_TRANSMIT_FIFO_INTERRUPT))) {
+        qemu_irq_pulse(uart->irq);
+    }
+
+    return G_SOURCE_REMOVE;
 }
 
-static void grlib_apbuart_receive(void *opaque, const uint8_t *buf, int size)
+static void uart_tx_flush(UART *uart)
 {
-    UART *uart = opaque;
+    /* A pending watch already takes care of draining the FIFO */
+    if (!uart->tx_watch) {
+        grlib_apbuart_xmit(NULL, G_IO_OUT, uart);
+    }
+}
 
-    if (uart->control & UART_RECEIVE_ENABLE) {
-        uart_add_to_fifo(uart, buf, size);
+static void grlib_apbuart_tx_bh(void *opaque)
+{
+    uart_tx_flush(opaque);
+}
 
-        uart->status |= UART_DATA_READY;
+static void uart_push_tx_fifo(UART *uart, uint8_t c)
+{
+    if (uart->tx_count >= uart->tx_fifo_size) {
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "%s: transmitter FIFO overrun, character dropped\n",
+                      __func__);
+        return;
+    }
 
-        if (uart->control & UART_RECEIVE_INTERRUPT) {
-            qemu_irq_pulse(uart->irq);
-        }
+    uart->tx_fifo[uart->tx_count++] = c;
+
+    if (uart->tx_count == uart->tx_fifo_size) {
+        /* Watermark reached, flush now */
+        uart_tx_flush(uart);
+    } else {
+        qemu_bh_schedule(uart->tx_bh);
     }
+
+    uart_update_tx_status(uart);
 }
 
 static void grlib_apbuart_event(void *opaque, QEMUChrEvent event)
@@ -182,6 +334,9 @@ static uint64_t grlib_apbuart_read(void *opaque, hwaddr addr,
         return uart->status;
 
     case CONTROL_OFFSET:
+        if (uart->tx_fifo_size) {
+            return uart->control | UART_FIFO_AVAILABLE;
+        }
         return uart->control;
 
     case SCALER_OFFSET:
@@ -210,6 +365,11 @@ static void grlib_apbuart_write(void *opaque, hwaddr addr,
         if (qemu_chr_fe_backend_connected(&uart->chr) &&
             (uart->control & UART_TRANSMIT_ENABLE)) {
             c = value & 0xFF;
+            if (uart->tx_fifo_size) {
+                /* Buffered transmitter, sent from a bottom half */
+                uart_push_tx_fifo(uart, c);
+                return;
+            }
             /* XXX this blocks entire thread. Rewrite to use
              * qemu_chr_fe_write and background I/O callbacks */
             qemu_chr_fe_write_all(&uart->chr, &c, 1);
@@ -250,6 +410,23 @@ static void grlib_apbuart_realize(DeviceState *dev, Error **errp)
     UART *uart = GRLIB_APB_UART(dev);
     SysBusDevice *sbd = SYS_BUS_DEVICE(dev);
 
+    if (uart->tx_fifo_size > TX_FIFO_MAX_LENGTH) {
+        error_setg(errp, "Invalid tx-fifo-size property: %u, must be "
+                   "<= %u.", uart->tx_fifo_size, TX_FIFO_MAX_LENGTH);
+        return;
+    }
+
+    if (!uart->rx_fifo_size || uart->rx_fifo_size > FIFO_LENGTH) {
+        error_setg(errp, "Invalid rx-fifo-size property: %u, must be "
+                   "0 < rx-fifo-size <= %u.", uart->rx_fifo_size, FIFO_LENGTH);
+        return;
+    }
+
+    fifo8_create(&uart->rx_fifo, uart->rx_fifo_size);
+
+    uart->tx_bh = qemu_bh_new_guarded(grlib_apbuart_tx_bh, uart,
+                                      &dev->mem_reentrancy_guard);
+
     qemu_chr_fe_set_handlers(&uart->chr,
                              grlib_apbuart_can_receive,
                              grlib_apbuart_receive,
@@ -268,17 +445,32 @@ static void grlib_apbuart_reset(DeviceState *d)
 {
     UART *uart = GRLIB_APB_UART(d);
 
-    /* Transmitter FIFO and shift registers are always empty in QEMU */
+    /* Drop whatever was still waiting in the transmitter FIFO */
+    if (uart->tx_watch) {
+        g_source_remove(uart->tx_watch);
+        uart->tx_watch = 0;
+    }
+    uart->tx_count = 0;
+
+    /*
+     * Without a modelled transmitter FIFO, the FIFO and shift registers are
+     * always empty in QEMU.
+     */
     uart->status =  UART_TRANSMIT_FIFO_EMPTY | UART_TRANSMIT_SHIFT_EMPTY;
+    if (uart->tx_fifo_size) {
+        uart_update_tx_status(uart);
+    }
     /* Everything is off */
     uart->control = 0;
     /* Flush receive FIFO */
-    uart->len = 0;
-    uart->current = 0;
+    fifo8_reset(&uart->rx_fifo);
+    uart_update_rx_status(uart);
 }
 
 static Property grlib_apbuart_properties[] = {
     DEFINE_PROP_CHR("chrdev", UART, chr),
+    DEFINE_PROP_UINT32("tx-fifo-size", UART, tx_fifo_size, 0),
+    DEFINE_PROP_UINT32("rx-fifo-size", UART, rx_fifo_size, FIFO_LENGTH),
     DEFINE_PROP_END_OF_LIST(),
 };
 
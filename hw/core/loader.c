@@ -960,6 +960,7 @@ typedef struct Rom Rom;
 struct Rom {
     char *name;
     char *path;
+    off_t path_offset;          /* of data in path, if it can be mapped */
 
     /* datasize is the amount of memory allocated in "data". If datasize is less
      * than romsize, it means that the area from datasize to romsize is filled
@@ -1075,7 +1076,7 @@ ssize_t rom_add_file(const char *file, const char *fw_dir,
 {
     MachineClass *mc = MACHINE_GET_CLASS(qdev_get_machine());
     Rom *rom;
-    ssize_t rc;
+    GError *gerr = NULL;
     int fd = -1;
     char devpath[100];
 
@@ -1113,13 +1114,25 @@ ssize_t rom_add_file(const char *file, const char *fw_dir,
         goto err;
     }
 
+    /*
+     * Map the file rather than reading it, like load_elf() does: big
+     * images (initrds, firmware volumes) are then neither copied to the
+     * heap nor kept there for reset; the page cache backs the copy that
+     * rom_reset() writes into guest memory.  The mapping is private and
+     * writable, since board code may patch the image through rom_ptr().
+     */
     rom->datasize = rom->romsize;
-    rom->data     = g_malloc0(rom->datasize);
-    lseek(fd, 0, SEEK_SET);
-    rc = read(fd, rom->data, rom->datasize);
-    if (rc != rom->datasize) {
-        fprintf(stderr, "rom: file %-20s: read error: rc=%zd (expected %zd)\n",
-                rom->name, rc, rom->datasize);
+    rom->mapped_file = g_mapped_file_new(rom->path, true, &gerr);
+    if (!rom->mapped_file) {
+        fprintf(stderr, "rom: file %-20s: read error: %s\n",
+                rom->name, gerr->message);
+        g_error_free(gerr);
+        goto err;
+    }
+    rom->data = (uint8_t *)g_mapped_file_get_contents(rom->mapped_file);
+    if (g_mapped_file_get_length(rom->mapped_file) != rom->datasize) {
+        fprintf(stderr, "rom: file %-20s: read error: size changed\n",
+                rom->name);
         goto err;
     }
     close(fd);
@@ -1213,8 +1226,11 @@ MemoryRegion *rom_add_blob(const char *name, const void *blob, size_t len,
  * all the rom. We just allocate the first part and the rest is just zeros. This
  * is why romsize and datasize are different. Also, this function takes its own
  * reference to "mapped_file", so we don't have to allocate and copy the buffer.
+ * If "file" is not NULL, "data" is an unmodified part of "mapped_file", which
+ * was read from "file".
  */
-int rom_add_elf_program(const char *name, GMappedFile *mapped_file, void *data,
+int rom_add_elf_program(const char *name, const char *file,
+                        GMappedFile *mapped_file, void *data,
                         size_t datasize, size_t romsize, hwaddr addr,
                         AddressSpace *as)
 {
@@ -1231,6 +1247,11 @@ int rom_add_elf_program(const char *name, GMappedFile *mapped_file, void *data,
     if (mapped_file && data) {
         g_mapped_file_ref(mapped_file);
         rom->mapped_file = mapped_file;
+        if (file) {
+            rom->path = g_strdup(file);
+            rom->path_offset = (uint8_t *)data -
+                (uint8_t *)g_mapped_file_get_contents(mapped_file);
+        }
     }
 
     rom_insert(rom);
@@ -1247,6 +1268,105 @@ ssize_t rom_add_option(const char *file, int32_t bootindex)
     return rom_add_file(file, "genroms", 0, bootindex, true, NULL, NULL);
 }
 
+static bool rom_reset_done;
+
+/*
+ * With -machine map-images=on, map the page-aligned part of a file image
+ * straight into guest RAM instead of copying it, and copy only the head
+ * and tail.  The mapping is private, so guests booted from the same
+ * image share the pages they don't write through the host page cache.
+ *
+ * Replacing the pages of guest RAM is a discard followed by a refill, so
+ * it is only done where discarding is fine and the RAM is private to
+ * QEMU, and only at the first reset, before any TB was translated from
+ * the old contents.  Returns false if the image must be copied instead.
+ */
+static bool rom_map_file(Rom *rom)
+{
+    MachineState *ms = MACHINE(qdev_get_machine());
+    size_t page_size = qemu_real_host_page_size();
+    MemoryRegionSection section;
+    uint8_t *host, *start, *end;
+    off_t offset;
+    bool mapped = false;
+    void *file;
+    int fd;
+
+    if (!ms->map_images || rom_reset_done || !rom->path || rom->mr ||
+        !rom->mapped_file || ram_block_discard_is_disabled() ||
+        ram_block_discard_is_required()) {
+        return false;
+    }
+
+    section = memory_region_find(rom->as->root, rom->addr, rom->datasize);
+    if (!section.mr) {
+        return false;
+    }
+    if (int128_get64(section.size) != rom->datasize ||
+        !memory_region_is_ram(section.mr) ||
+        memory_region_is_ram_device(section.mr) ||
+        qemu_ram_is_shared(section.mr->ram_block) ||
+        qemu_ram_pagesize(section.mr->ram_block) != page_size) {
+        goto out;
+    }
+
+    host = memory_region_get_ram_ptr(section.mr) +
+           section.offset_within_region;
+    if (((uintptr_t)host - rom->path_offset) % page_size) {
+        goto out;
+    }
+    start = QEMU_ALIGN_PTR_UP(host, page_size);
+    end = QEMU_ALIGN_PTR_DOWN(host + rom->datasize, page_size);
+    if (start >= end) {
+        goto out;
+    }
+    offset = rom->path_offset + (start - host);
+
+    fd = open(rom->path, O_RDONLY | O_BINARY);
+    if (fd < 0) {
+        goto out;
+    }
+    /* Board code may have patched the image through rom_ptr() */
+    file = mmap(NULL, end - start, PROT_READ, MAP_PRIVATE, fd, offset);
+    if (file == MAP_FAILED) {
+        goto out_close;
+    }
+    if (memcmp(file, rom->data + (start - host), end - start)) {
+        munmap(file, end - start);
+        goto out_close;
+    }
+    munmap(file, end - start);
+
+    if (mmap(start, end - start, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_FIXED, fd, offset) == MAP_FAILED) {
+        /* The old mapping is still in place */
+        goto out_close;
+    }
+    if (ms->mem_merge) {
+        qemu_madvise(start, end - start, QEMU_MADV_MERGEABLE);
+    }
+    if (!ms->dump_guest_core) {
+        qemu_madvise(start, end - start, QEMU_MADV_DONTDUMP);
+    }
+    memory_region_set_dirty(section.mr,
+                            section.offset_within_region + (start - host),
+                            end - start);
+
+    address_space_write_rom(rom->as, rom->addr, MEMTXATTRS_UNSPECIFIED,
+                            rom->data, start - host);
+    address_space_write_rom(rom->as, rom->addr + (end - host),
+                            MEMTXATTRS_UNSPECIFIED, rom->data + (end - host),
+                            rom->datasize - (end - host));
+    trace_loader_map_rom(rom->name, rom->addr + (start - host), end - start);
+    mapped = true;
+
+out_close:
+    close(fd);
+out:
+    memory_region_unref(section.mr);
+    return mapped;
+}
+
 static void rom_reset(void *unused)
 {
     Rom *rom;
@@ -1279,8 +1399,11 @@ static void rom_reset(void *unused)
             memcpy(host, rom->data, rom->datasize);
             memset(host + rom->datasize, 0, rom->romsize - rom->datasize);
         } else {
-            address_space_write_rom(rom->as, rom->addr, MEMTXATTRS_UNSPECIFIED,
-                                    rom->data, rom->datasize);
+            if (!rom_map_file(rom)) {
+                address_space_write_rom(rom->as, rom->addr,
+                                        MEMTXATTRS_UNSPECIFIED,
+                                        rom->data, rom->datasize);
+            }
             address_space_set(rom->as, rom->addr + rom->datasize, 0,
                               rom->romsize - rom->datasize,
                               MEMTXATTRS_UNSPECIFIED);
@@ -1299,6 +1422,7 @@ static void rom_reset(void *unused)
 
         trace_loader_write_rom(rom->name, rom->addr, rom->datasize, rom->isrom);
     }
+    rom_reset_done = true;
 }
 
 /* Return true if two consecutive ROMs in the ROM list overlap */
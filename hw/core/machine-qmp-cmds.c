@@ -10,16 +10,21 @@
 #include "qemu/osdep.h"
 #include "hw/acpi/vmgenid.h"
 #include "hw/boards.h"
+#include "hw/qdev-core.h"
 #include "hw/intc/intc.h"
 #include "hw/mem/memory-device.h"
 #include "hw/rdma/rdma.h"
+#include "qapi/clone-visitor.h"
 #include "qapi/error.h"
 #include "qapi/qapi-builtin-visit.h"
 #include "qapi/qapi-commands-machine.h"
+#include "qapi/qapi-visit-machine.h"
+#include "qapi/qmp/dispatch.h"
 #include "qapi/qmp/qobject.h"
 #include "qapi/qobject-input-visitor.h"
 #include "qapi/type-helpers.h"
 #include "qemu/main-loop.h"
+#include "qemu/rcu.h"
 #include "qemu/uuid.h"
 #include "qom/qom-qobject.h"
 #include "sysemu/hostmem.h"
@@ -29,38 +34,153 @@
 #include "sysemu/sysemu.h"
 
 /*
- * fast means: we NEVER interrupt vCPU threads to retrieve
- * information from KVM.
+ * query-cpus-fast can run in the monitor I/O thread, without the BQL.
+ * What it cannot read safely there, the CPU list and the properties
+ * that the machine computes, is copied into a snapshot under the BQL
+ * whenever the CPU list changed, and published with RCU.
  */
-CpuInfoFastList *qmp_query_cpus_fast(Error **errp)
+typedef struct CpusFastEntry {
+    CPUState *cpu;
+    char *qom_path;
+    CpuInstanceProperties *props;
+} CpusFastEntry;
+
+typedef struct CpusFastSnapshot {
+    struct rcu_head rcu;
+    unsigned int generation;
+    int nr;
+    CpusFastEntry entries[];
+} CpusFastSnapshot;
+
+static CpusFastSnapshot *cpus_fast_snapshot;
+
+static void cpus_fast_snapshot_free(CpusFastSnapshot *snap)
+{
+    int i;
+
+    for (i = 0; i < snap->nr; i++) {
+        object_unref(OBJECT(snap->entries[i].cpu));
+        g_free(snap->entries[i].qom_path);
+        qapi_free_CpuInstanceProperties(snap->entries[i].props);
+    }
+    g_free(snap);
+}
+
+static CpuInstanceProperties *cpu_instance_props(CPUState *cpu)
 {
     MachineState *ms = MACHINE(qdev_get_machine());
     MachineClass *mc = MACHINE_GET_CLASS(ms);
-    CpuInfoFastList *head = NULL, **tail = &head;
-    SysEmuTarget target = qapi_enum_parse(&SysEmuTarget_lookup, target_name(),
-                                          -1, &error_abort);
+    CpuInstanceProperties *props;
+
+    if (!mc->cpu_index_to_instance_props) {
+        return NULL;
+    }
+    props = g_malloc0(sizeof(*props));
+    *props = mc->cpu_index_to_instance_props(ms, cpu->cpu_index);
+    return props;
+}
+
+static void cpus_fast_snapshot_sync(void)
+{
+    CpusFastSnapshot *old = cpus_fast_snapshot, *snap;
+    unsigned int generation = cpu_list_generation_id_get();
     CPUState *cpu;
+    int nr = 0;
 
+    assert(bql_locked());
+    if (!phase_check(PHASE_MACHINE_READY) ||
+        (old && old->generation == generation)) {
+        return;
+    }
+
+    CPU_FOREACH(cpu) {
+        nr++;
+    }
+    snap = g_malloc0(sizeof(*snap) + nr * sizeof(snap->entries[0]));
+    snap->generation = generation;
     CPU_FOREACH(cpu) {
-        CpuInfoFast *value = g_malloc0(sizeof(*value));
+        CpusFastEntry *entry = &snap->entries[snap->nr++];
+
+        entry->cpu = CPU(object_ref(OBJECT(cpu)));
+        entry->qom_path = object_get_canonical_path(OBJECT(cpu));
+        entry->props = cpu_instance_props(cpu);
+    }
 
-        value->cpu_index = cpu->cpu_index;
-        value->qom_path = object_get_canonical_path(OBJECT(cpu));
-        value->thread_id = cpu->thread_id;
+    qatomic_rcu_set(&cpus_fast_snapshot, snap);
+    if (old) {
+        call_rcu(old, cpus_fast_snapshot_free, rcu);
+    }
+}
+
+static void cpus_fast_snapshot_bh(void *opaque)
+{
+    cpus_fast_snapshot_sync();
+}
+
+static void __attribute__((constructor)) cpus_fast_snapshot_init(void)
+{
+    qmp_register_snapshot(cpus_fast_snapshot_sync);
+}
+
+static CpuInfoFast *cpu_info_fast(CPUState *cpu, char *qom_path,
+                                  CpuInstanceProperties *props)
+{
+    CpuInfoFast *value = g_malloc0(sizeof(*value));
+
+    value->cpu_index = cpu->cpu_index;
+    value->qom_path = qom_path;
+    value->thread_id = qatomic_read(&cpu->thread_id);
+    value->props = props;
+    value->target = qapi_enum_parse(&SysEmuTarget_lookup, target_name(),
+                                    -1, &error_abort);
+    if (cpu->cc->query_cpu_fast) {
+        cpu->cc->query_cpu_fast(cpu, value);
+    }
+    return value;
+}
+
+/*
+ * fast means: we NEVER interrupt vCPU threads to retrieve
+ * information from KVM.
+ */
+CpuInfoFastList *qmp_query_cpus_fast(Error **errp)
+{
+    CpuInfoFastList *head = NULL, **tail = &head;
+    CpusFastSnapshot *snap;
+    CPUState *cpu;
+    int i;
+
+    if (bql_locked()) {
+        CPU_FOREACH(cpu) {
+            char *qom_path = object_get_canonical_path(OBJECT(cpu));
 
-        if (mc->cpu_index_to_instance_props) {
-            CpuInstanceProperties *props;
-            props = g_malloc0(sizeof(*props));
-            *props = mc->cpu_index_to_instance_props(ms, cpu->cpu_index);
-            value->props = props;
+            QAPI_LIST_APPEND(tail, cpu_info_fast(cpu, qom_path,
+                                                 cpu_instance_props(cpu)));
         }
+        return head;
+    }
 
-        value->target = target;
-        if (cpu->cc->query_cpu_fast) {
-            cpu->cc->query_cpu_fast(cpu, value);
+    WITH_RCU_READ_LOCK_GUARD() {
+        snap = qatomic_rcu_read(&cpus_fast_snapshot);
+        if (!snap) {
+            return NULL;
         }
+        if (snap->generation != cpu_list_generation_id_get()) {
+            /* CPUs came or went outside of QMP, e.g. guest-ejected */
+            aio_bh_schedule_oneshot(qemu_get_aio_context(),
+                                    cpus_fast_snapshot_bh, NULL);
+        }
+        for (i = 0; i < snap->nr; i++) {
+            CpusFastEntry *entry = &snap->entries[i];
+            CpuInstanceProperties *props = NULL;
 
-        QAPI_LIST_APPEND(tail, value);
+            if (entry->props) {
+                props = QAPI_CLONE(CpuInstanceProperties, entry->props);
+            }
+            QAPI_LIST_APPEND(tail, cpu_info_fast(entry->cpu,
+                                                 g_strdup(entry->qom_path),
+                                                 props));
+        }
     }
 
     return head;
@@ -28,11 +28,14 @@
 #include "hw/mem/nvdimm.h"
 #include "migration/global_state.h"
 #include "exec/confidential-guest-support.h"
+#include "exec/memory-stats.h"
 #include "hw/virtio/virtio-pci.h"
 #include "hw/virtio/virtio-net.h"
 #include "audio/audio.h"
 
-GlobalProperty hw_compat_8_2[] = {};
+GlobalProperty hw_compat_8_2[] = {
+    { "migration", "zero-page-detection", "legacy"},
+};
 const size_t hw_compat_8_2_len = G_N_ELEMENTS(hw_compat_8_2);
 
 GlobalProperty hw_compat_8_1[] = {
@@ -434,6 +437,45 @@ static void machine_set_mem_merge(Object *obj, bool value, Error **errp)
     ms->mem_merge = value;
 }
 
+static bool machine_get_map_images(Object *obj, Error **errp)
+{
+    MachineState *ms = MACHINE(obj);
+
+    return ms->map_images;
+}
+
+static void machine_set_map_images(Object *obj, bool value, Error **errp)
+{
+    MachineState *ms = MACHINE(obj);
+
+    ms->map_images = value;
+}
+
+static void machine_get_mmio_stats(Object *obj, Visitor *v,
+                                   const char *name, void *opaque,
+                                   Error **errp)
+{
+    uint32_t value = qatomic_read(&memory_region_stats_period);
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void machine_set_mmio_stats(Object *obj, Visitor *v,
+                                   const char *name, void *opaque,
+                                   Error **errp)
+{
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (value & (value - 1)) {
+        error_setg(errp, "mmio-stats must be 0 or a power of two");
+        return;
+    }
+    memory_region_stats_set_period(value);
+}
+
 static bool machine_get_usb(Object *obj, Error **errp)
 {
     MachineState *ms = MACHINE(obj);
@@ -1035,6 +1077,16 @@ static void machine_class_init(ObjectClass *oc, void *data)
     object_class_property_set_description(oc, "mem-merge",
         "Enable/disable memory merge support");
 
+    object_class_property_add_bool(oc, "map-images",
+        machine_get_map_images, machine_set_map_images);
+    object_class_property_set_description(oc, "map-images",
+        "Map boot images privately into guest RAM instead of copying them");
+
+    object_class_property_add(oc, "mmio-stats", "uint32",
+        machine_get_mmio_stats, machine_set_mmio_stats, NULL, NULL);
+    object_class_property_set_description(oc, "mmio-stats",
+        "Time one in this many I/O region accesses (0: disabled)");
+
     object_class_property_add_bool(oc, "usb",
         machine_get_usb, machine_set_usb);
     object_class_property_set_description(oc, "usb",
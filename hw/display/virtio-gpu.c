@@ -690,6 +690,12 @@ static void virtio_gpu_do_set_scanout(VirtIOGPU *g,
         }
 #ifdef WIN32
         qemu_displaysurface_win32_set_handle(scanout->ds, res->handle, fb->offset);
+#else
+        /* Blob data can be mapped by the display clients, without copies */
+        if (res->blob && res->dmabuf_fd >= 0) {
+            qemu_displaysurface_set_share_fd(scanout->ds, res->dmabuf_fd,
+                                             fb->offset);
+        }
 #endif
 
         pixman_image_unref(rect);
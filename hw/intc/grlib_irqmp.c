@@ -36,6 +36,7 @@
 #include "trace.h"
 #include "qapi/error.h"
 #include "qemu/module.h"
+#include "qemu/host-utils.h"
 #include "qom/object.h"
 
 #define IRQMP_MAX_CPU 16
@@ -84,37 +85,95 @@ struct IRQMPState {
     uint32_t force[IRQMP_MAX_CPU];
     uint32_t extended[IRQMP_MAX_CPU];
 
+    /* Bitmap of the CPUs which have each interrupt unmasked */
+    uint32_t irq_cpus[MAX_PILS];
+    /* Last value driven on each CPU output */
+    uint32_t output[IRQMP_MAX_CPU];
+
     IRQMP    *parent;
 };
 
-static void grlib_irqmp_check_irqs(IRQMPState *state)
+static void grlib_irqmp_check_cpu(IRQMPState *state, unsigned int cpu)
 {
-    int i;
+    uint32_t pend = (state->pending | state->force[cpu]) & state->mask[cpu];
+    uint32_t level0 = pend & ~state->level;
+    uint32_t level1 = pend &  state->level;
+    uint32_t output;
+
+    trace_grlib_irqmp_check_irqs(state->pending, state->force[cpu],
+                                 state->mask[cpu], level1, level0);
+
+    /* Trigger level1 interrupt first and level0 if there is no level1 */
+    output = level1 ?: level0;
+    if (output != state->output[cpu]) {
+        state->output[cpu] = output;
+        qemu_set_irq(state->parent->irq[cpu], output);
+    }
+}
 
+/* Only update the CPUs in the cpus bitmap */
+static void grlib_irqmp_check_cpus(IRQMPState *state, uint32_t cpus)
+{
     assert(state != NULL);
     assert(state->parent != NULL);
 
-    for (i = 0; i < state->parent->ncpus; i++) {
-        uint32_t pend = (state->pending | state->force[i]) & state->mask[i];
-        uint32_t level0 = pend & ~state->level;
-        uint32_t level1 = pend &  state->level;
+    cpus &= MAKE_64BIT_MASK(0, state->parent->ncpus);
+    while (cpus) {
+        unsigned int cpu = ctz32(cpus);
+
+        grlib_irqmp_check_cpu(state, cpu);
+        cpus &= cpus - 1;
+    }
+}
+
+/* Bitmap of the CPUs which can be affected by a change in the irqs bitmap */
+static uint32_t grlib_irqmp_irqs_to_cpus(IRQMPState *state, uint32_t irqs)
+{
+    uint32_t cpus = 0;
+
+    while (irqs) {
+        cpus |= state->irq_cpus[ctz32(irqs)];
+        irqs &= irqs - 1;
+    }
+
+    return cpus;
+}
 
-        trace_grlib_irqmp_check_irqs(state->pending, state->force[i],
-                                     state->mask[i], level1, level0);
+static void grlib_irqmp_check_irqs(IRQMPState *state)
+{
+    grlib_irqmp_check_cpus(state, UINT32_MAX);
+}
 
-        /* Trigger level1 interrupt first and level0 if there is no level1 */
-        qemu_set_irq(state->parent->irq[i], level1 ?: level0);
+static void grlib_irqmp_set_mask(IRQMPState *state, unsigned int cpu,
+                                 uint32_t mask)
+{
+    int irq;
+
+    state->mask[cpu] = mask;
+    for (irq = 0; irq < MAX_PILS; irq++) {
+        if (mask & (1 << irq)) {
+            state->irq_cpus[irq] |= 1 << cpu;
+        } else {
+            state->irq_cpus[irq] &= ~(1 << cpu);
+        }
     }
 }
 
 static void grlib_irqmp_ack_mask(IRQMPState *state, unsigned int cpu,
                                  uint32_t mask)
 {
+    uint32_t cpus = 1 << cpu;
+
+    /* Clearing a pending interrupt can affect all the CPUs unmasking it */
+    if (state->pending & mask) {
+        cpus |= grlib_irqmp_irqs_to_cpus(state, state->pending & mask);
+    }
+
     /* Clear registers */
     state->pending  &= ~mask;
     state->force[cpu] &= ~mask;
 
-    grlib_irqmp_check_irqs(state);
+    grlib_irqmp_check_cpus(state, cpus);
 }
 
 void grlib_irqmp_ack(DeviceState *dev, unsigned int cpu, int intno)
@@ -156,7 +215,8 @@ static void grlib_irqmp_set_irq(void *opaque, int irq, int level)
         } else {
             s->pending |= 1 << irq;
         }
-        grlib_irqmp_check_irqs(s);
+        /* Only the CPUs with this interrupt unmasked can see it */
+        grlib_irqmp_check_cpus(s, s->irq_cpus[irq]);
     }
 }
 
@@ -244,6 +304,7 @@ static void grlib_irqmp_write(void *opaque, hwaddr addr,
     case LEVEL_OFFSET:
         value &= 0xFFFF << 1; /* clean up the value */
         state->level = value;
+        grlib_irqmp_check_irqs(state);
         return;
 
     case PENDING_OFFSET:
@@ -255,7 +316,7 @@ static void grlib_irqmp_write(void *opaque, hwaddr addr,
 
         value &= 0xFFFE; /* clean up the value */
         state->force[0] = value;
-        grlib_irqmp_check_irqs(irqmp->state);
+        grlib_irqmp_check_cpus(state, 1 << 0);
         return;
 
     case CLEAR_OFFSET:
@@ -295,8 +356,8 @@ static void grlib_irqmp_write(void *opaque, hwaddr addr,
         assert(cpu >= 0 && cpu < IRQMP_MAX_CPU);
 
         value &= ~1; /* clean up the value */
-        state->mask[cpu] = value;
-        grlib_irqmp_check_irqs(irqmp->state);
+        grlib_irqmp_set_mask(state, cpu, value);
+        grlib_irqmp_check_cpus(state, 1 << cpu);
         return;
     }
 
@@ -310,7 +371,7 @@ static void grlib_irqmp_write(void *opaque, hwaddr addr,
         uint32_t old   = state->force[cpu];
 
         state->force[cpu] = (old | force) & ~clear;
-        grlib_irqmp_check_irqs(irqmp->state);
+        grlib_irqmp_check_cpus(state, 1 << cpu);
         return;
     }
 
@@ -34,11 +34,6 @@
 #include "hw/irq.h"
 #include "migration/vmstate.h"
 
-typedef struct riscv_aclint_mtimer_callback {
-    RISCVAclintMTimerState *s;
-    int num;
-} riscv_aclint_mtimer_callback;
-
 static uint64_t cpu_riscv_read_rtc_raw(uint32_t timebase_freq)
 {
     return muldiv64(qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL),
@@ -69,7 +64,14 @@ static void riscv_aclint_mtimer_write_timecmp(RISCVAclintMTimerState *mtimer,
     /* Compute the relative hartid w.r.t the socket */
     hartid = hartid - mtimer->hartid_base;
 
+    /* The interrupt is already lowered and due at the same time */
+    if (mtimer->timecmp[hartid] == value &&
+        mtimer->deadline[hartid] != INT64_MAX) {
+        return;
+    }
+
     mtimer->timecmp[hartid] = value;
+    mtimer->deadline[hartid] = INT64_MAX;
     if (mtimer->timecmp[hartid] <= rtc) {
         /*
          * If we're setting an MTIMECMP value in the "past",
@@ -106,18 +108,42 @@ static void riscv_aclint_mtimer_write_timecmp(RISCVAclintMTimerState *mtimer,
         next = MIN(next, INT64_MAX);
     }
 
-    timer_mod(mtimer->timers[hartid], next);
+    /*
+     * Only move the timer earlier.  If the hart held the earliest deadline
+     * and it moved later, the timer fires early once and is armed again.
+     */
+    mtimer->deadline[hartid] = next;
+    if (next < mtimer->next_deadline) {
+        mtimer->next_deadline = next;
+        timer_mod(mtimer->timer, next);
+    }
 }
 
 /*
  * Callback used when the timer set using timer_mod expires.
- * Should raise the timer interrupt line
+ * Raises the timer interrupt line of all the harts whose deadline
+ * has passed, and arms the timer for the next one.
  */
 static void riscv_aclint_mtimer_cb(void *opaque)
 {
-    riscv_aclint_mtimer_callback *state = opaque;
+    RISCVAclintMTimerState *mtimer = opaque;
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    int64_t next = INT64_MAX;
+    int i;
+
+    for (i = 0; i < mtimer->num_harts; i++) {
+        if (mtimer->deadline[i] <= now) {
+            mtimer->deadline[i] = INT64_MAX;
+            qemu_irq_raise(mtimer->timer_irqs[i]);
+        } else {
+            next = MIN(next, mtimer->deadline[i]);
+        }
+    }
 
-    qemu_irq_raise(state->s->timer_irqs[state->num]);
+    mtimer->next_deadline = next;
+    if (next != INT64_MAX) {
+        timer_mod(mtimer->timer, next);
+    }
 }
 
 /* CPU read MTIMER register */
@@ -237,6 +263,8 @@ static void riscv_aclint_mtimer_write(void *opaque, hwaddr addr,
             if (!env) {
                 continue;
             }
+            /* All the deadlines moved with mtime */
+            mtimer->deadline[i] = INT64_MAX;
             riscv_aclint_mtimer_write_timecmp(mtimer, RISCV_CPU(cpu),
                                               mtimer->hartid_base + i,
                                               mtimer->timecmp[i]);
@@ -289,8 +317,13 @@ static void riscv_aclint_mtimer_realize(DeviceState *dev, Error **errp)
     s->timer_irqs = g_new(qemu_irq, s->num_harts);
     qdev_init_gpio_out(dev, s->timer_irqs, s->num_harts);
 
-    s->timers = g_new0(QEMUTimer *, s->num_harts);
+    s->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, &riscv_aclint_mtimer_cb, s);
     s->timecmp = g_new0(uint64_t, s->num_harts);
+    s->deadline = g_new(int64_t, s->num_harts);
+    for (i = 0; i < s->num_harts; i++) {
+        s->deadline[i] = INT64_MAX;
+    }
+    s->next_deadline = INT64_MAX;
     /* Claim timer interrupt bits */
     for (i = 0; i < s->num_harts; i++) {
         RISCVCPU *cpu = RISCV_CPU(cpu_by_arch_id(s->hartid_base + i));
@@ -376,21 +409,14 @@ DeviceState *riscv_aclint_mtimer_create(hwaddr addr, hwaddr size,
         CPUState *cpu = cpu_by_arch_id(hartid_base + i);
         RISCVCPU *rvcpu = RISCV_CPU(cpu);
         CPURISCVState *env = cpu ? cpu_env(cpu) : NULL;
-        riscv_aclint_mtimer_callback *cb =
-            g_new0(riscv_aclint_mtimer_callback, 1);
 
         if (!env) {
-            g_free(cb);
             continue;
         }
         if (provide_rdtime) {
             riscv_cpu_set_rdtime_fn(env, cpu_riscv_read_rtc, dev);
         }
 
-        cb->s = s;
-        cb->num = i;
-        s->timers[i] = timer_new_ns(QEMU_CLOCK_VIRTUAL,
-                                  &riscv_aclint_mtimer_cb, cb);
         s->timecmp[i] = 0;
 
         qdev_connect_gpio_out(dev, i,
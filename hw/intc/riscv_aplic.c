@@ -22,6 +22,7 @@
 #include "qemu/module.h"
 #include "qemu/error-report.h"
 #include "qemu/bswap.h"
+#include "qemu/bitmap.h"
 #include "exec/address-spaces.h"
 #include "hw/sysbus.h"
 #include "hw/pci/msi.h"
@@ -193,6 +194,43 @@ static uint32_t riscv_aplic_read_pending_word(RISCVAPLICState *aplic,
     return ret;
 }
 
+static uint32_t riscv_aplic_irq_idc(RISCVAPLICState *aplic, uint32_t irq)
+{
+    return (aplic->target[irq] >> APLIC_TARGET_HART_IDX_SHIFT) &
+           APLIC_TARGET_HART_IDX_MASK;
+}
+
+static unsigned long *riscv_aplic_idc_enpend(RISCVAPLICState *aplic,
+                                             uint32_t idc)
+{
+    return aplic->idc_enpend + idc * BITS_TO_LONGS(aplic->num_irqs);
+}
+
+/*
+ * Add or remove @irq from the sources that the IDC it targets scans for
+ * topi.  Must be called whenever the state or the target of @irq changes.
+ */
+static void riscv_aplic_idc_enpend_update(RISCVAPLICState *aplic,
+                                          uint32_t irq)
+{
+    uint32_t idc;
+
+    if (aplic->msimode) {
+        return;
+    }
+
+    idc = riscv_aplic_irq_idc(aplic, irq);
+    if (aplic->num_harts <= idc) {
+        return;
+    }
+
+    if ((aplic->state[irq] & APLIC_ISTATE_ENPEND) == APLIC_ISTATE_ENPEND) {
+        set_bit(irq, riscv_aplic_idc_enpend(aplic, idc));
+    } else {
+        clear_bit(irq, riscv_aplic_idc_enpend(aplic, idc));
+    }
+}
+
 static void riscv_aplic_set_pending_raw(RISCVAPLICState *aplic,
                                         uint32_t irq, bool pending)
 {
@@ -201,6 +239,7 @@ static void riscv_aplic_set_pending_raw(RISCVAPLICState *aplic,
     } else {
         aplic->state[irq] &= ~APLIC_ISTATE_PENDING;
     }
+    riscv_aplic_idc_enpend_update(aplic, irq);
 }
 
 static void riscv_aplic_set_pending(RISCVAPLICState *aplic,
@@ -271,6 +310,7 @@ static void riscv_aplic_set_enabled_raw(RISCVAPLICState *aplic,
     } else {
         aplic->state[irq] &= ~APLIC_ISTATE_ENABLED;
     }
+    riscv_aplic_idc_enpend_update(aplic, irq);
 }
 
 static void riscv_aplic_set_enabled(RISCVAPLICState *aplic,
@@ -401,26 +441,20 @@ static void riscv_aplic_msi_irq_update(RISCVAPLICState *aplic, uint32_t irq)
 static uint32_t riscv_aplic_idc_topi(RISCVAPLICState *aplic, uint32_t idc)
 {
     uint32_t best_irq, best_iprio;
-    uint32_t irq, iprio, ihartidx, ithres;
+    uint32_t irq, iprio, ithres;
+    unsigned long *enpend;
 
     if (aplic->num_harts <= idc) {
         return 0;
     }
 
+    /* Only walk the sources that are enabled, pending and target @idc */
+    enpend = riscv_aplic_idc_enpend(aplic, idc);
     ithres = aplic->ithreshold[idc];
     best_irq = best_iprio = UINT32_MAX;
-    for (irq = 1; irq < aplic->num_irqs; irq++) {
-        if ((aplic->state[irq] & APLIC_ISTATE_ENPEND) !=
-            APLIC_ISTATE_ENPEND) {
-            continue;
-        }
-
-        ihartidx = aplic->target[irq] >> APLIC_TARGET_HART_IDX_SHIFT;
-        ihartidx &= APLIC_TARGET_HART_IDX_MASK;
-        if (ihartidx != idc) {
-            continue;
-        }
-
+    for (irq = find_first_bit(enpend, aplic->num_irqs);
+         irq < aplic->num_irqs;
+         irq = find_next_bit(enpend, aplic->num_irqs, irq + 1)) {
         iprio = aplic->target[irq] & aplic->iprio_mask;
         if (ithres && iprio >= ithres) {
             continue;
@@ -429,6 +463,10 @@ static uint32_t riscv_aplic_idc_topi(RISCVAPLICState *aplic, uint32_t idc)
         if (iprio < best_iprio) {
             best_irq = irq;
             best_iprio = iprio;
+            /* Direct mode targets never hold priority 0 */
+            if (iprio == 1) {
+                break;
+            }
         }
     }
 
@@ -751,9 +789,16 @@ static void riscv_aplic_write(void *opaque, hwaddr addr, uint64_t value,
         if (aplic->msimode) {
             aplic->target[irq] = value;
         } else {
+            idc = riscv_aplic_irq_idc(aplic, irq);
+            if (idc < aplic->num_harts) {
+                clear_bit(irq, riscv_aplic_idc_enpend(aplic, idc));
+            }
             aplic->target[irq] = (value & ~APLIC_TARGET_IPRIO_MASK) |
                                  ((value & aplic->iprio_mask) ?
                                   (value & aplic->iprio_mask) : 1);
+            riscv_aplic_idc_enpend_update(aplic, irq);
+            /* Both the old and the new target may need an update */
+            idc = UINT32_MAX;
         }
     } else if (!aplic->msimode && (APLIC_IDC_BASE <= addr) &&
             (addr < (APLIC_IDC_BASE + aplic->num_harts * APLIC_IDC_SIZE))) {
@@ -821,6 +866,8 @@ static void riscv_aplic_realize(DeviceState *dev, Error **errp)
             for (i = 0; i < aplic->num_irqs; i++) {
                 aplic->target[i] = 1;
             }
+            aplic->idc_enpend = g_new0(unsigned long, aplic->num_harts *
+                                       BITS_TO_LONGS(aplic->num_irqs));
         }
         aplic->idelivery = g_new0(uint32_t, aplic->num_harts);
         aplic->iforce = g_new0(uint32_t, aplic->num_harts);
@@ -874,10 +921,28 @@ static Property riscv_aplic_properties[] = {
     DEFINE_PROP_END_OF_LIST(),
 };
 
+static int riscv_aplic_post_load(void *opaque, int version_id)
+{
+    RISCVAPLICState *aplic = opaque;
+    uint32_t irq;
+
+    if (!aplic->msimode) {
+        bitmap_zero(aplic->idc_enpend,
+                    aplic->num_harts * BITS_TO_LONGS(aplic->num_irqs) *
+                    BITS_PER_LONG);
+        for (irq = 1; irq < aplic->num_irqs; irq++) {
+            riscv_aplic_idc_enpend_update(aplic, irq);
+        }
+    }
+
+    return 0;
+}
+
 static const VMStateDescription vmstate_riscv_aplic = {
     .name = "riscv_aplic",
     .version_id = 1,
     .minimum_version_id = 1,
+    .post_load = riscv_aplic_post_load,
     .fields = (const VMStateField[]) {
             VMSTATE_UINT32(domaincfg, RISCVAPLICState),
             VMSTATE_UINT32(mmsicfgaddr, RISCVAPLICState),
@@ -22,6 +22,8 @@
 #include "qemu/module.h"
 #include "qemu/error-report.h"
 #include "qemu/bswap.h"
+#include "qemu/bitops.h"
+#include "qemu/main-loop.h"
 #include "exec/address-spaces.h"
 #include "hw/sysbus.h"
 #include "hw/pci/msi.h"
@@ -43,21 +45,71 @@
 
 #define IMSIC_EISTATE_PENDING          (1U << 0)
 #define IMSIC_EISTATE_ENABLED          (1U << 1)
-#define IMSIC_EISTATE_ENPEND           (IMSIC_EISTATE_ENABLED | \
-                                        IMSIC_EISTATE_PENDING)
+
+/*
+ * The pending bits can be set by MSI writes and changed through the CSRs
+ * from the hart at the same time, so all the updates to the words of the
+ * eip and eie bitmaps are atomic.
+ */
+static unsigned long *riscv_imsic_eix(RISCVIMSICState *imsic,
+                                      unsigned long *eix, uint32_t page)
+{
+    return eix + page * BITS_TO_LONGS(imsic->num_irqs);
+}
+
+static uint64_t riscv_imsic_eix_read(unsigned long *eix, uint32_t start,
+                                     uint32_t len)
+{
+    uint32_t i, n, shift;
+    unsigned long word;
+    uint64_t val = 0;
+
+    for (i = 0; i < len; i += n) {
+        shift = (start + i) % BITS_PER_LONG;
+        n = MIN(len - i, BITS_PER_LONG - shift);
+        word = qatomic_read(&eix[BIT_WORD(start + i)]) >> shift;
+        val |= (word & MAKE_64BIT_MASK(0, n)) << i;
+    }
+
+    return val;
+}
+
+static void riscv_imsic_eix_write(unsigned long *eix, uint32_t start,
+                                  uint32_t len, uint64_t val, uint64_t mask)
+{
+    uint32_t i, n, shift;
+    unsigned long set, clr;
+
+    for (i = 0; i < len; i += n) {
+        shift = (start + i) % BITS_PER_LONG;
+        n = MIN(len - i, BITS_PER_LONG - shift);
+        set = (unsigned long)((val & mask) >> i & MAKE_64BIT_MASK(0, n));
+        clr = (unsigned long)((~val & mask) >> i & MAKE_64BIT_MASK(0, n));
+        if (clr) {
+            qatomic_and(&eix[BIT_WORD(start + i)], ~(clr << shift));
+        }
+        if (set) {
+            qatomic_or(&eix[BIT_WORD(start + i)], set << shift);
+        }
+    }
+}
 
 static uint32_t riscv_imsic_topei(RISCVIMSICState *imsic, uint32_t page)
 {
-    uint32_t i, max_irq, base;
+    unsigned long *eip = riscv_imsic_eix(imsic, imsic->eip, page);
+    unsigned long *eie = riscv_imsic_eix(imsic, imsic->eie, page);
+    unsigned long word;
+    uint32_t i, irq, max_irq;
 
-    base = page * imsic->num_irqs;
     max_irq = (imsic->eithreshold[page] &&
                (imsic->eithreshold[page] <= imsic->num_irqs)) ?
                imsic->eithreshold[page] : imsic->num_irqs;
-    for (i = 1; i < max_irq; i++) {
-        if ((imsic->eistate[base + i] & IMSIC_EISTATE_ENPEND) ==
-                IMSIC_EISTATE_ENPEND) {
-            return (i << IMSIC_TOPEI_IID_SHIFT) | i;
+    for (i = 0; i < BITS_TO_LONGS(max_irq); i++) {
+        word = qatomic_read(&eip[i]) & qatomic_read(&eie[i]);
+        if (word) {
+            /* Bit 0 of eip0 and eie0 is never set */
+            irq = i * BITS_PER_LONG + ctzl(word);
+            return irq < max_irq ? (irq << IMSIC_TOPEI_IID_SHIFT) | irq : 0;
         }
     }
 
@@ -66,10 +118,15 @@ static uint32_t riscv_imsic_topei(RISCVIMSICState *imsic, uint32_t page)
 
 static void riscv_imsic_update(RISCVIMSICState *imsic, uint32_t page)
 {
-    if (imsic->eidelivery[page] && riscv_imsic_topei(imsic, page)) {
-        qemu_irq_raise(imsic->external_irqs[page]);
-    } else {
-        qemu_irq_lower(imsic->external_irqs[page]);
+    int8_t level;
+
+    /* Serialize with MSI writes, which may skip the update */
+    BQL_LOCK_GUARD();
+
+    level = imsic->eidelivery[page] && riscv_imsic_topei(imsic, page);
+    if (imsic->eilevel[page] != level) {
+        imsic->eilevel[page] = level;
+        qemu_set_irq(imsic->external_irqs[page], level);
     }
 }
 
@@ -113,7 +170,7 @@ static int riscv_imsic_topei_rmw(RISCVIMSICState *imsic, uint32_t page,
                                  target_ulong *val, target_ulong new_val,
                                  target_ulong wr_mask)
 {
-    uint32_t base, topei = riscv_imsic_topei(imsic, page);
+    uint32_t topei = riscv_imsic_topei(imsic, page);
 
     /* Read pending and enabled interrupt with highest priority */
     if (val) {
@@ -123,9 +180,9 @@ static int riscv_imsic_topei_rmw(RISCVIMSICState *imsic, uint32_t page,
     /* Writes ignore value and clear top pending interrupt */
     if (topei && wr_mask) {
         topei >>= IMSIC_TOPEI_IID_SHIFT;
-        base = page * imsic->num_irqs;
         if (topei) {
-            imsic->eistate[base + topei] &= ~IMSIC_EISTATE_PENDING;
+            riscv_imsic_eix_write(riscv_imsic_eix(imsic, imsic->eip, page),
+                                  topei, 1, 0, 1);
         }
 
         riscv_imsic_update(imsic, page);
@@ -139,9 +196,8 @@ static int riscv_imsic_eix_rmw(RISCVIMSICState *imsic,
                                uint32_t num, bool pend, target_ulong *val,
                                target_ulong new_val, target_ulong wr_mask)
 {
-    uint32_t i, base;
-    target_ulong mask;
-    uint32_t state = (pend) ? IMSIC_EISTATE_PENDING : IMSIC_EISTATE_ENABLED;
+    unsigned long *eix = riscv_imsic_eix(imsic,
+                                         pend ? imsic->eip : imsic->eie, page);
 
     if (xlen != 32) {
         if (num & 0x1) {
@@ -153,31 +209,15 @@ static int riscv_imsic_eix_rmw(RISCVIMSICState *imsic,
         return -EINVAL;
     }
 
-    base = (page * imsic->num_irqs) + (num * xlen);
-
     if (val) {
-        *val = 0;
-        for (i = 0; i < xlen; i++) {
-            mask = (target_ulong)1 << i;
-            *val |= (imsic->eistate[base + i] & state) ? mask : 0;
-        }
+        *val = riscv_imsic_eix_read(eix, num * xlen, xlen);
     }
 
-    for (i = 0; i < xlen; i++) {
-        /* Bit0 of eip0 and eie0 are read-only zero */
-        if (!num && !i) {
-            continue;
-        }
-
-        mask = (target_ulong)1 << i;
-        if (wr_mask & mask) {
-            if (new_val & mask) {
-                imsic->eistate[base + i] |= state;
-            } else {
-                imsic->eistate[base + i] &= ~state;
-            }
-        }
+    /* Bit0 of eip0 and eie0 are read-only zero */
+    if (!num) {
+        wr_mask &= ~(target_ulong)1;
     }
+    riscv_imsic_eix_write(eix, num * xlen, xlen, new_val, wr_mask);
 
     riscv_imsic_update(imsic, page);
     return 0;
@@ -302,13 +342,17 @@ static void riscv_imsic_write(void *opaque, hwaddr addr, uint64_t value,
     page = addr >> IMSIC_MMIO_PAGE_SHIFT;
     if ((addr & (IMSIC_MMIO_PAGE_SZ - 1)) == IMSIC_MMIO_PAGE_LE) {
         if (value && (value < imsic->num_irqs)) {
-            imsic->eistate[(page * imsic->num_irqs) + value] |=
-                                                    IMSIC_EISTATE_PENDING;
+            set_bit_atomic(value, riscv_imsic_eix(imsic, imsic->eip, page));
         }
     }
 
-    /* Update CPU external interrupt status */
-    riscv_imsic_update(imsic, page);
+    /*
+     * Update CPU external interrupt status.  Setting a pending bit cannot
+     * lower the line, so a burst of MSIs only raises it once.
+     */
+    if (imsic->eilevel[page] != 1) {
+        riscv_imsic_update(imsic, page);
+    }
 
     return;
 
@@ -340,6 +384,12 @@ static void riscv_imsic_realize(DeviceState *dev, Error **errp)
         imsic->eidelivery = g_new0(uint32_t, imsic->num_pages);
         imsic->eithreshold = g_new0(uint32_t, imsic->num_pages);
         imsic->eistate = g_new0(uint32_t, imsic->num_eistate);
+        imsic->eip = g_new0(unsigned long, imsic->num_pages *
+                            BITS_TO_LONGS(imsic->num_irqs));
+        imsic->eie = g_new0(unsigned long, imsic->num_pages *
+                            BITS_TO_LONGS(imsic->num_irqs));
+        imsic->eilevel = g_new(int8_t, imsic->num_pages);
+        memset(imsic->eilevel, -1, imsic->num_pages);
     }
 
     memory_region_init_io(&imsic->mmio, OBJECT(dev), &riscv_imsic_ops,
@@ -382,10 +432,49 @@ static Property riscv_imsic_properties[] = {
     DEFINE_PROP_END_OF_LIST(),
 };
 
+static int riscv_imsic_pre_save(void *opaque)
+{
+    RISCVIMSICState *imsic = opaque;
+    uint32_t i;
+
+    for (i = 0; i < imsic->num_eistate; i++) {
+        imsic->eistate[i] = (test_bit(i, imsic->eip) ?
+                             IMSIC_EISTATE_PENDING : 0) |
+                            (test_bit(i, imsic->eie) ?
+                             IMSIC_EISTATE_ENABLED : 0);
+    }
+
+    return 0;
+}
+
+static int riscv_imsic_post_load(void *opaque, int version_id)
+{
+    RISCVIMSICState *imsic = opaque;
+    uint32_t i;
+
+    for (i = 0; i < imsic->num_eistate; i++) {
+        if (imsic->eistate[i] & IMSIC_EISTATE_PENDING) {
+            set_bit(i, imsic->eip);
+        } else {
+            clear_bit(i, imsic->eip);
+        }
+        if (imsic->eistate[i] & IMSIC_EISTATE_ENABLED) {
+            set_bit(i, imsic->eie);
+        } else {
+            clear_bit(i, imsic->eie);
+        }
+    }
+    memset(imsic->eilevel, -1, imsic->num_pages);
+
+    return 0;
+}
+
 static const VMStateDescription vmstate_riscv_imsic = {
     .name = "riscv_imsic",
     .version_id = 1,
     .minimum_version_id = 1,
+    .pre_save = riscv_imsic_pre_save,
+    .post_load = riscv_imsic_post_load,
     .fields = (const VMStateField[]) {
             VMSTATE_VARRAY_UINT32(eidelivery, RISCVIMSICState,
                                   num_pages, 0,
@@ -23,9 +23,9 @@
 
 #include "qemu/osdep.h"
 #include "qemu/log.h"
+#include "qapi/error.h"
 #include "hw/sysbus.h"
 #include "hw/misc/grlib_ahb_apb_pnp.h"
-#include "trace.h"
 
 #define GRLIB_PNP_VENDOR_SHIFT (24)
 #define GRLIB_PNP_VENDOR_SIZE   (8)
@@ -53,11 +53,51 @@
 
 #define GRLIB_PNP_MAX_REGS         (0x1000)
 
+/*
+ * The tables are constant once the board is built, and firmware walks
+ * them at boot and whenever a driver looks for its device.  They live
+ * in the host memory of a ROM device, stored big-endian as the guest
+ * sees them, so that reads never leave the TCG fast path.
+ */
+static void grlib_pnp_set_reg(MemoryRegion *mr, unsigned int reg,
+                              uint32_t val)
+{
+    uint8_t *regs = memory_region_get_ram_ptr(mr);
+
+    stl_be_p(regs + reg * 4, val);
+}
+
+static void grlib_pnp_write(void *opaque, hwaddr addr,
+                            uint64_t val, unsigned size)
+{
+    qemu_log_mask(LOG_UNIMP, "%s not implemented\n", __func__);
+}
+
+static const MemoryRegionOps grlib_pnp_ops = {
+    .write      = grlib_pnp_write,
+    .endianness = DEVICE_BIG_ENDIAN,
+    .impl = {
+        .min_access_size = 1,
+        .max_access_size = 4,
+    },
+};
+
+static void grlib_pnp_init_mmio(SysBusDevice *sbd, MemoryRegion *mr,
+                                const char *name, Error **errp)
+{
+    if (!memory_region_init_rom_device_nomigrate(mr, OBJECT(sbd),
+                                                 &grlib_pnp_ops, NULL, name,
+                                                 GRLIB_PNP_MAX_REGS, errp)) {
+        return;
+    }
+    memset(memory_region_get_ram_ptr(mr), 0, GRLIB_PNP_MAX_REGS);
+    sysbus_init_mmio(sbd, mr);
+}
+
 typedef struct AHBPnp {
     SysBusDevice parent_obj;
     MemoryRegion iomem;
 
-    uint32_t regs[GRLIB_PNP_MAX_REGS >> 2];
     uint8_t master_count;
     uint8_t slave_count;
 } AHBPnp;
@@ -67,6 +107,7 @@ void grlib_ahb_pnp_add_entry(AHBPnp *dev, uint32_t address, uint32_t mask,
                              int type)
 {
     unsigned int reg_start;
+    uint32_t val;
 
     /*
      * AHB entries look like this:
@@ -107,65 +148,24 @@ void grlib_ahb_pnp_add_entry(AHBPnp *dev, uint32_t address, uint32_t mask,
         dev->master_count++;
     }
 
-    dev->regs[reg_start] = deposit32(dev->regs[reg_start],
-                                     GRLIB_PNP_VENDOR_SHIFT,
-                                     GRLIB_PNP_VENDOR_SIZE,
-                                     vendor);
-    dev->regs[reg_start] = deposit32(dev->regs[reg_start],
-                                     GRLIB_PNP_DEV_SHIFT,
-                                     GRLIB_PNP_DEV_SIZE,
-                                     device);
+    val = deposit32(0, GRLIB_PNP_VENDOR_SHIFT, GRLIB_PNP_VENDOR_SIZE, vendor);
+    val = deposit32(val, GRLIB_PNP_DEV_SHIFT, GRLIB_PNP_DEV_SIZE, device);
+    grlib_pnp_set_reg(&dev->iomem, reg_start, val);
     reg_start += 4;
     /* AHB Memory Space */
-    dev->regs[reg_start] = type;
-    dev->regs[reg_start] = deposit32(dev->regs[reg_start],
-                                     GRLIB_PNP_ADDR_SHIFT,
-                                     GRLIB_PNP_ADDR_SIZE,
-                                     extract32(address,
-                                               GRLIB_AHB_DEV_ADDR_SHIFT,
-                                               GRLIB_AHB_DEV_ADDR_SIZE));
-    dev->regs[reg_start] = deposit32(dev->regs[reg_start],
-                                     GRLIB_PNP_MASK_SHIFT,
-                                     GRLIB_PNP_MASK_SIZE,
-                                     mask);
+    val = deposit32(type, GRLIB_PNP_ADDR_SHIFT, GRLIB_PNP_ADDR_SIZE,
+                    extract32(address, GRLIB_AHB_DEV_ADDR_SHIFT,
+                              GRLIB_AHB_DEV_ADDR_SIZE));
+    val = deposit32(val, GRLIB_PNP_MASK_SHIFT, GRLIB_PNP_MASK_SIZE, mask);
+    grlib_pnp_set_reg(&dev->iomem, reg_start, val);
 }
 
-static uint64_t grlib_ahb_pnp_read(void *opaque, hwaddr offset, unsigned size)
-{
-    AHBPnp *ahb_pnp = GRLIB_AHB_PNP(opaque);
-    uint32_t val;
-
-    val = ahb_pnp->regs[offset >> 2];
-    val = extract32(val, (4 - (offset & 3) - size) * 8, size * 8);
-    trace_grlib_ahb_pnp_read(offset, size, val);
-
-    return val;
-}
-
-static void grlib_ahb_pnp_write(void *opaque, hwaddr addr,
-                                uint64_t val, unsigned size)
-{
-    qemu_log_mask(LOG_UNIMP, "%s not implemented\n", __func__);
-}
-
-static const MemoryRegionOps grlib_ahb_pnp_ops = {
-    .read       = grlib_ahb_pnp_read,
-    .write      = grlib_ahb_pnp_write,
-    .endianness = DEVICE_BIG_ENDIAN,
-    .impl = {
-        .min_access_size = 1,
-        .max_access_size = 4,
-    },
-};
-
 static void grlib_ahb_pnp_realize(DeviceState *dev, Error **errp)
 {
     AHBPnp *ahb_pnp = GRLIB_AHB_PNP(dev);
-    SysBusDevice *sbd = SYS_BUS_DEVICE(dev);
 
-    memory_region_init_io(&ahb_pnp->iomem, OBJECT(dev), &grlib_ahb_pnp_ops,
-                          ahb_pnp, TYPE_GRLIB_AHB_PNP, GRLIB_PNP_MAX_REGS);
-    sysbus_init_mmio(sbd, &ahb_pnp->iomem);
+    grlib_pnp_init_mmio(SYS_BUS_DEVICE(dev), &ahb_pnp->iomem,
+                        TYPE_GRLIB_AHB_PNP, errp);
 }
 
 static void grlib_ahb_pnp_class_init(ObjectClass *klass, void *data)
@@ -188,7 +188,6 @@ typedef struct APBPnp {
     SysBusDevice parent_obj;
     MemoryRegion iomem;
 
-    uint32_t regs[GRLIB_PNP_MAX_REGS >> 2];
     uint32_t entry_count;
 } APBPnp;
 
@@ -197,6 +196,7 @@ void grlib_apb_pnp_add_entry(APBPnp *dev, uint32_t address, uint32_t mask,
                              uint8_t irq, int type)
 {
     unsigned int reg_start;
+    uint32_t val;
 
     /*
      * APB entries look like this:
@@ -212,72 +212,25 @@ void grlib_apb_pnp_add_entry(APBPnp *dev, uint32_t address, uint32_t mask,
     reg_start = (dev->entry_count * GRLIB_APB_ENTRY_SIZE) >> 2;
     dev->entry_count++;
 
-    dev->regs[reg_start] = deposit32(dev->regs[reg_start],
-                                     GRLIB_PNP_VENDOR_SHIFT,
-                                     GRLIB_PNP_VENDOR_SIZE,
-                                     vendor);
-    dev->regs[reg_start] = deposit32(dev->regs[reg_start],
-                                     GRLIB_PNP_DEV_SHIFT,
-                                     GRLIB_PNP_DEV_SIZE,
-                                     device);
-    dev->regs[reg_start] = deposit32(dev->regs[reg_start],
-                                     GRLIB_PNP_VER_SHIFT,
-                                     GRLIB_PNP_VER_SIZE,
-                                     version);
-    dev->regs[reg_start] = deposit32(dev->regs[reg_start],
-                                     GRLIB_PNP_IRQ_SHIFT,
-                                     GRLIB_PNP_IRQ_SIZE,
-                                     irq);
+    val = deposit32(0, GRLIB_PNP_VENDOR_SHIFT, GRLIB_PNP_VENDOR_SIZE, vendor);
+    val = deposit32(val, GRLIB_PNP_DEV_SHIFT, GRLIB_PNP_DEV_SIZE, device);
+    val = deposit32(val, GRLIB_PNP_VER_SHIFT, GRLIB_PNP_VER_SIZE, version);
+    val = deposit32(val, GRLIB_PNP_IRQ_SHIFT, GRLIB_PNP_IRQ_SIZE, irq);
+    grlib_pnp_set_reg(&dev->iomem, reg_start, val);
     reg_start += 1;
-    dev->regs[reg_start] = type;
-    dev->regs[reg_start] = deposit32(dev->regs[reg_start],
-                                     GRLIB_PNP_ADDR_SHIFT,
-                                     GRLIB_PNP_ADDR_SIZE,
-                                     extract32(address,
-                                               GRLIB_APB_DEV_ADDR_SHIFT,
-                                               GRLIB_APB_DEV_ADDR_SIZE));
-    dev->regs[reg_start] = deposit32(dev->regs[reg_start],
-                                     GRLIB_PNP_MASK_SHIFT,
-                                     GRLIB_PNP_MASK_SIZE,
-                                     mask);
-}
-
-static uint64_t grlib_apb_pnp_read(void *opaque, hwaddr offset, unsigned size)
-{
-    APBPnp *apb_pnp = GRLIB_APB_PNP(opaque);
-    uint32_t val;
-
-    val = apb_pnp->regs[offset >> 2];
-    val = extract32(val, (4 - (offset & 3) - size) * 8, size * 8);
-    trace_grlib_apb_pnp_read(offset, size, val);
-
-    return val;
-}
-
-static void grlib_apb_pnp_write(void *opaque, hwaddr addr,
-                                uint64_t val, unsigned size)
-{
-    qemu_log_mask(LOG_UNIMP, "%s not implemented\n", __func__);
+    val = deposit32(type, GRLIB_PNP_ADDR_SHIFT, GRLIB_PNP_ADDR_SIZE,
+                    extract32(address, GRLIB_APB_DEV_ADDR_SHIFT,
+                              GRLIB_APB_DEV_ADDR_SIZE));
+    val = deposit32(val, GRLIB_PNP_MASK_SHIFT, GRLIB_PNP_MASK_SIZE, mask);
+    grlib_pnp_set_reg(&dev->iomem, reg_start, val);
 }
 
-static const MemoryRegionOps grlib_apb_pnp_ops = {
-    .read       = grlib_apb_pnp_read,
-    .write      = grlib_apb_pnp_write,
-    .endianness = DEVICE_BIG_ENDIAN,
-    .impl = {
-        .min_access_size = 1,
-        .max_access_size = 4,
-    },
-};
-
 static void grlib_apb_pnp_realize(DeviceState *dev, Error **errp)
 {
     APBPnp *apb_pnp = GRLIB_APB_PNP(dev);
-    SysBusDevice *sbd = SYS_BUS_DEVICE(dev);
 
-    memory_region_init_io(&apb_pnp->iomem, OBJECT(dev), &grlib_apb_pnp_ops,
-                          apb_pnp, TYPE_GRLIB_APB_PNP, GRLIB_PNP_MAX_REGS);
-    sysbus_init_mmio(sbd, &apb_pnp->iomem);
+    grlib_pnp_init_mmio(SYS_BUS_DEVICE(dev), &apb_pnp->iomem,
+                        TYPE_GRLIB_APB_PNP, errp);
 }
 
 static void grlib_apb_pnp_class_init(ObjectClass *klass, void *data)
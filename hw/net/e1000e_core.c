@@ -158,12 +158,25 @@ e1000e_intrmgr_on_timer(void *opaque)
     e1000e_intrmgr_fire_delayed_interrupts(timer->core);
 }
 
+/*
+ * An interrupt has just been delivered: start a new throttling interval,
+ * so that the next one is held back by a full ITR/EITR period as well.
+ */
+static inline void
+e1000e_intrmgr_restart_throttling(E1000IntrDelayTimer *timer)
+{
+    if (timer->core->mac[timer->delay_reg] != 0) {
+        e1000e_intrmgr_rearm_timer(timer);
+    }
+}
+
 static void
 e1000e_intrmgr_on_throttling_timer(void *opaque)
 {
     E1000IntrDelayTimer *timer = opaque;
 
     timer->running = false;
+    timer->postponed = false;
 
     if (timer->core->mac[IMS] & timer->core->mac[ICR]) {
         if (msi_enabled(timer->core->owner)) {
@@ -173,6 +186,7 @@ e1000e_intrmgr_on_throttling_timer(void *opaque)
             trace_e1000e_irq_legacy_notify_postponed();
             e1000e_raise_legacy_irq(timer->core);
         }
+        e1000e_intrmgr_restart_throttling(timer);
     }
 }
 
@@ -184,8 +198,15 @@ e1000e_intrmgr_on_msix_throttling_timer(void *opaque)
 
     timer->running = false;
 
+    /* Nothing was held back during the interval, so don't notify */
+    if (!timer->postponed) {
+        return;
+    }
+    timer->postponed = false;
+
     trace_e1000e_irq_msix_notify_postponed_vec(idx);
     msix_notify(timer->core->owner, idx);
+    e1000e_intrmgr_restart_throttling(timer);
 }
 
 static void
@@ -370,12 +391,14 @@ e1000e_intrmgr_fire_all_timers(E1000ECore *core)
     if (core->itr.running) {
         timer_del(core->itr.timer);
         e1000e_intrmgr_on_throttling_timer(&core->itr);
+        e1000e_intrmgr_stop_timer(&core->itr);
     }
 
     for (i = 0; i < E1000E_MSIX_VEC_NUM; i++) {
         if (core->eitr[i].running) {
             timer_del(core->eitr[i].timer);
             e1000e_intrmgr_on_msix_throttling_timer(&core->eitr[i]);
+            e1000e_intrmgr_stop_timer(&core->eitr[i]);
         }
     }
 }
@@ -426,9 +449,11 @@ e1000e_intrmgr_reset(E1000ECore *core)
     e1000e_intrmgr_stop_delay_timers(core);
 
     e1000e_intrmgr_stop_timer(&core->itr);
+    core->itr.postponed = false;
 
     for (i = 0; i < E1000E_MSIX_VEC_NUM; i++) {
         e1000e_intrmgr_stop_timer(&core->eitr[i]);
+        core->eitr[i].postponed = false;
     }
 }
 
@@ -789,15 +814,19 @@ e1000e_rx_wb_interrupt_cause(E1000ECore *core, int queue_idx,
     return (queue_idx == 0) ? E1000_ICR_RXQ0 : E1000_ICR_RXQ1;
 }
 
-static uint32_t
-e1000e_txdesc_writeback(E1000ECore *core, dma_addr_t base,
-                        struct e1000_tx_desc *dp, bool *ide, int queue_idx)
+/*
+ * Set DD in @dp if it has to be written back, which the caller does
+ * for the whole batch of descriptors at once.
+ */
+static bool
+e1000e_txdesc_writeback(E1000ECore *core, struct e1000_tx_desc *dp,
+                        bool *ide, uint32_t *cause, int queue_idx)
 {
     uint32_t txd_upper, txd_lower = le32_to_cpu(dp->lower.data);
 
     if (!(txd_lower & E1000_TXD_CMD_RS) &&
         !(core->mac[IVAR] & E1000_IVAR_TX_INT_EVERY_WB)) {
-        return 0;
+        return false;
     }
 
     *ide = (txd_lower & E1000_TXD_CMD_IDE) ? true : false;
@@ -805,9 +834,8 @@ e1000e_txdesc_writeback(E1000ECore *core, dma_addr_t base,
     txd_upper = le32_to_cpu(dp->upper.data) | E1000_TXD_STAT_DD;
 
     dp->upper.data = cpu_to_le32(txd_upper);
-    pci_dma_write(core->owner, base + ((char *)&dp->upper - (char *)dp),
-                  &dp->upper, sizeof(dp->upper));
-    return e1000e_tx_wb_interrupt_cause(core, queue_idx);
+    *cause |= e1000e_tx_wb_interrupt_cause(core, queue_idx);
+    return true;
 }
 
 typedef struct E1000ERingInfo {
@@ -870,6 +898,15 @@ e1000e_ring_free_descr_num(E1000ECore *core, const E1000ERingInfo *r)
     return 0;
 }
 
+/* Free descriptors from the head up to the tail or the end of the ring */
+static inline uint32_t
+e1000e_ring_contiguous_descr_num(E1000ECore *core, const E1000ERingInfo *r)
+{
+    uint32_t end = core->mac[r->dlen] / E1000_RING_DESC_LEN;
+
+    return MIN(e1000e_ring_free_descr_num(core, r), end - core->mac[r->dh]);
+}
+
 static inline bool
 e1000e_ring_enabled(E1000ECore *core, const E1000ERingInfo *r)
 {
@@ -924,14 +961,21 @@ e1000e_rx_ring_init(E1000ECore *core, E1000E_RxRing *rxr, int idx)
     rxr->i      = &i[idx];
 }
 
+/*
+ * Descriptors are fetched and written back in batches of up to this many,
+ * with one DMA access per contiguous segment of the ring.
+ */
+#define E1000E_DESC_BATCH   (16)
+
 static void
 e1000e_start_xmit(E1000ECore *core, const E1000E_TxRing *txr)
 {
     dma_addr_t base;
-    struct e1000_tx_desc desc;
+    struct e1000_tx_desc desc[E1000E_DESC_BATCH];
     bool ide = false;
     const E1000ERingInfo *txi = txr->i;
     uint32_t cause = E1000_ICS_TXQE;
+    uint32_t i, num, wb_first, wb_last;
 
     if (!(core->mac[TCTL] & E1000_TCTL_EN)) {
         trace_e1000e_tx_disabled();
@@ -940,16 +984,33 @@ e1000e_start_xmit(E1000ECore *core, const E1000E_TxRing *txr)
 
     while (!e1000e_ring_empty(core, txi)) {
         base = e1000e_ring_head_descr(core, txi);
+        num = MIN(e1000e_ring_contiguous_descr_num(core, txi),
+                  E1000E_DESC_BATCH);
+        num = MAX(num, 1);
+
+        pci_dma_read(core->owner, base, desc, num * sizeof(desc[0]));
+
+        wb_first = num;
+        wb_last = 0;
+        for (i = 0; i < num; i++) {
+            trace_e1000e_tx_descr((void *)(intptr_t)desc[i].buffer_addr,
+                                  desc[i].lower.data, desc[i].upper.data);
+
+            e1000e_process_tx_desc(core, txr->tx, &desc[i], txi->idx);
+            if (e1000e_txdesc_writeback(core, &desc[i], &ide, &cause,
+                                        txi->idx)) {
+                wb_first = MIN(wb_first, i);
+                wb_last = i;
+            }
+        }
 
-        pci_dma_read(core->owner, base, &desc, sizeof(desc));
-
-        trace_e1000e_tx_descr((void *)(intptr_t)desc.buffer_addr,
-                              desc.lower.data, desc.upper.data);
-
-        e1000e_process_tx_desc(core, txr->tx, &desc, txi->idx);
-        cause |= e1000e_txdesc_writeback(core, base, &desc, &ide, txi->idx);
+        if (wb_first < num) {
+            pci_dma_write(core->owner, base + wb_first * sizeof(desc[0]),
+                          &desc[wb_first],
+                          (wb_last - wb_first + 1) * sizeof(desc[0]));
+        }
 
-        e1000e_ring_advance(core, txi, 1);
+        e1000e_ring_advance(core, txi, num);
     }
 
     if (!ide || !e1000e_intrmgr_delay_tx_causes(core, &cause)) {
@@ -1348,52 +1409,70 @@ struct NetRxPkt *pkt, const E1000E_RSSInfo *rss_info,
     }
 }
 
-static inline void
-e1000e_pci_dma_write_rx_desc(E1000ECore *core, dma_addr_t addr,
-                             union e1000_rx_desc_union *desc, dma_addr_t len)
+/* Clear DD in @desc and return whether it was set */
+static inline bool
+e1000e_rx_desc_clear_dd(E1000ECore *core, union e1000_rx_desc_union *desc)
 {
-    PCIDevice *dev = core->owner;
+    uint32_t *status;
+    bool dd;
 
     if (e1000e_rx_use_legacy_descriptor(core)) {
-        struct e1000_rx_desc *d = &desc->legacy;
-        size_t offset = offsetof(struct e1000_rx_desc, status);
-        uint8_t status = d->status;
-
-        d->status &= ~E1000_RXD_STAT_DD;
-        pci_dma_write(dev, addr, desc, len);
+        dd = desc->legacy.status & E1000_RXD_STAT_DD;
+        desc->legacy.status &= ~E1000_RXD_STAT_DD;
+        return dd;
+    }
 
-        if (status & E1000_RXD_STAT_DD) {
-            d->status = status;
-            pci_dma_write(dev, addr + offset, &status, sizeof(status));
-        }
+    if (core->mac[RCTL] & E1000_RCTL_DTYP_PS) {
+        status = &desc->packet_split.wb.middle.status_error;
     } else {
-        if (core->mac[RCTL] & E1000_RCTL_DTYP_PS) {
-            union e1000_rx_desc_packet_split *d = &desc->packet_split;
-            size_t offset = offsetof(union e1000_rx_desc_packet_split,
-                wb.middle.status_error);
-            uint32_t status = d->wb.middle.status_error;
+        status = &desc->extended.wb.upper.status_error;
+    }
+    dd = *status & E1000_RXD_STAT_DD;
+    *status &= ~E1000_RXD_STAT_DD;
+    return dd;
+}
 
-            d->wb.middle.status_error &= ~E1000_RXD_STAT_DD;
-            pci_dma_write(dev, addr, desc, len);
+static void
+e1000e_pci_dma_read_rx_descs(E1000ECore *core, dma_addr_t addr,
+                             union e1000_rx_desc_union *desc, uint32_t num)
+{
+    uint8_t buf[E1000E_DESC_BATCH * sizeof(union e1000_rx_desc_union)];
+    size_t len = core->rx_desc_len;
+    uint32_t i;
 
-            if (status & E1000_RXD_STAT_DD) {
-                d->wb.middle.status_error = status;
-                pci_dma_write(dev, addr + offset, &status, sizeof(status));
-            }
-        } else {
-            union e1000_rx_desc_extended *d = &desc->extended;
-            size_t offset = offsetof(union e1000_rx_desc_extended,
-                wb.upper.status_error);
-            uint32_t status = d->wb.upper.status_error;
+    pci_dma_read(core->owner, addr, buf, num * len);
+    for (i = 0; i < num; i++) {
+        memcpy(&desc[i], buf + i * len, len);
+    }
+}
 
-            d->wb.upper.status_error &= ~E1000_RXD_STAT_DD;
-            pci_dma_write(dev, addr, desc, len);
+/*
+ * Write back @num descriptors.  The DD bits only go out with a second
+ * write, so that the guest never sees DD set in a descriptor that is
+ * partially written.
+ */
+static void
+e1000e_pci_dma_write_rx_descs(E1000ECore *core, dma_addr_t addr,
+                              union e1000_rx_desc_union *desc, uint32_t num)
+{
+    uint8_t buf[E1000E_DESC_BATCH * sizeof(union e1000_rx_desc_union)];
+    size_t len = core->rx_desc_len;
+    bool dd = false;
+    uint32_t i;
 
-            if (status & E1000_RXD_STAT_DD) {
-                d->wb.upper.status_error = status;
-                pci_dma_write(dev, addr + offset, &status, sizeof(status));
-            }
+    for (i = 0; i < num; i++) {
+        union e1000_rx_desc_union d = desc[i];
+
+        dd |= e1000e_rx_desc_clear_dd(core, &d);
+        memcpy(buf + i * len, &d, len);
+    }
+    pci_dma_write(core->owner, addr, buf, num * len);
+
+    if (dd) {
+        for (i = 0; i < num; i++) {
+            memcpy(buf + i * len, &desc[i], len);
         }
+        pci_dma_write(core->owner, addr, buf, num * len);
     }
 }
 
@@ -1511,9 +1590,10 @@ e1000e_write_packet_to_guest(E1000ECore *core, struct NetRxPkt *pkt,
                              const E1000E_RxRing *rxr,
                              const E1000E_RSSInfo *rss_info)
 {
-    PCIDevice *d = core->owner;
-    dma_addr_t base;
-    union e1000_rx_desc_union desc;
+    dma_addr_t base = 0;
+    union e1000_rx_desc_union desc[E1000E_DESC_BATCH];
+    uint32_t step = core->rx_desc_len / E1000_MIN_RX_DESC_LEN;
+    uint32_t num = 0, cur = 0;
     size_t desc_size;
     size_t desc_offset = 0;
     size_t iov_ofs = 0;
@@ -1539,17 +1619,29 @@ e1000e_write_packet_to_guest(E1000ECore *core, struct NetRxPkt *pkt,
             desc_size = core->rx_desc_buf_size;
         }
 
-        if (e1000e_ring_empty(core, rxi)) {
-            return;
-        }
+        if (cur == num) {
+            if (num) {
+                e1000e_pci_dma_write_rx_descs(core, base, desc, num);
+            }
 
-        base = e1000e_ring_head_descr(core, rxi);
+            if (e1000e_ring_empty(core, rxi)) {
+                return;
+            }
 
-        pci_dma_read(d, base, &desc, core->rx_desc_len);
+            /* Fetch the descriptors that the rest of the packet needs */
+            base = e1000e_ring_head_descr(core, rxi);
+            num = DIV_ROUND_UP(total_size - desc_offset,
+                               core->rx_desc_buf_size);
+            num = MIN(num, e1000e_ring_contiguous_descr_num(core, rxi) / step);
+            num = MAX(MIN(num, E1000E_DESC_BATCH), 1);
+            e1000e_pci_dma_read_rx_descs(core, base, desc, num);
+            cur = 0;
+        }
 
-        trace_e1000e_rx_descr(rxi->idx, base, core->rx_desc_len);
+        trace_e1000e_rx_descr(rxi->idx, base + cur * core->rx_desc_len,
+                              core->rx_desc_len);
 
-        e1000e_read_rx_descr(core, &desc, ba);
+        e1000e_read_rx_descr(core, &desc[cur], ba);
 
         if (ba[0]) {
             if (desc_offset < size) {
@@ -1623,15 +1715,16 @@ e1000e_write_packet_to_guest(E1000ECore *core, struct NetRxPkt *pkt,
             is_last = true;
         }
 
-        e1000e_write_rx_descr(core, &desc, is_last ? core->rx_pkt : NULL,
+        e1000e_write_rx_descr(core, &desc[cur], is_last ? core->rx_pkt : NULL,
                            rss_info, do_ps ? ps_hdr_len : 0, &bastate.written);
-        e1000e_pci_dma_write_rx_desc(core, base, &desc, core->rx_desc_len);
+        cur++;
 
-        e1000e_ring_advance(core, rxi,
-                            core->rx_desc_len / E1000_MIN_RX_DESC_LEN);
+        e1000e_ring_advance(core, rxi, step);
 
     } while (desc_offset < total_size);
 
+    e1000e_pci_dma_write_rx_descs(core, base, desc, cur);
+
     e1000e_update_rx_stats(core, size, total_size);
 }
 
@@ -1979,13 +2072,12 @@ e1000e_postpone_interrupt(E1000IntrDelayTimer *timer)
 {
     if (timer->running) {
         trace_e1000e_irq_postponed_by_xitr(timer->delay_reg << 2);
+        timer->postponed = true;
 
         return true;
     }
 
-    if (timer->core->mac[timer->delay_reg] != 0) {
-        e1000e_intrmgr_rearm_timer(timer);
-    }
+    e1000e_intrmgr_restart_throttling(timer);
 
     return false;
 }
@@ -3569,6 +3661,7 @@ int
 e1000e_core_post_load(E1000ECore *core)
 {
     NetClientState *nc = qemu_get_queue(core->owner_nic);
+    int i;
 
     /*
      * nc.link_down can't be migrated, so infer link_down according
@@ -3576,5 +3669,13 @@ e1000e_core_post_load(E1000ECore *core)
      */
     nc->link_down = (core->mac[STATUS] & E1000_STATUS_LU) == 0;
 
+    /*
+     * Whether an MSI-X interrupt is held back by EITR isn't migrated;
+     * assume one is, at worst the guest gets a spurious interrupt.
+     */
+    for (i = 0; i < E1000E_MSIX_VEC_NUM; i++) {
+        core->eitr[i].postponed = core->eitr[i].running;
+    }
+
     return 0;
 }
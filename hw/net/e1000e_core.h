@@ -53,6 +53,7 @@ enum { PHY_R = BIT(0),
 typedef struct E1000IntrDelayTimer_st {
     QEMUTimer *timer;
     bool running;
+    bool postponed;
     uint32_t delay_reg;
     uint32_t delay_resolution_ns;
     E1000ECore *core;
@@ -0,0 +1,803 @@
+/*
+ * GRLIB GRETH 10/100 and GRETH_GBIT Ethernet MAC
+ *
+ * The descriptor tables are 1 KiB rings of 128 two-word descriptors.
+ * Instead of fetching one descriptor per frame, the model reads them
+ * in batches, up to the end of the ring: a doorbell (setting the
+ * transmit enable bit) drains every enabled transmit descriptor, and
+ * the enabled receive descriptors are cached until frames fill them.
+ * Interrupts are raised from a bottom half, once for all the frames
+ * completed since the last one, which is what the drivers handle
+ * anyway since they acknowledge the status register in bulk.
+ *
+ * Not modelled: the EDCL debug link, RMII/GMII timing and the receive
+ * checksum offload.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/log.h"
+#include "qemu/main-loop.h"
+#include "qemu/module.h"
+#include "hw/irq.h"
+#include "hw/net/grlib_greth.h"
+#include "hw/net/mii.h"
+#include "hw/qdev-properties.h"
+#include "hw/sysbus.h"
+#include "migration/vmstate.h"
+#include "net/checksum.h"
+#include "net/eth.h"
+#include "net/net.h"
+#include "sysemu/dma.h"
+#include "trace.h"
+#include "qom/object.h"
+
+/* Registers */
+#define GRETH_CTRL          0x00
+#define GRETH_STATUS        0x04
+#define GRETH_MAC_MSB       0x08
+#define GRETH_MAC_LSB       0x0C
+#define GRETH_MDIO          0x10
+#define GRETH_TX_DESC       0x14
+#define GRETH_RX_DESC       0x18
+#define GRETH_EDCL_IP       0x1C
+#define GRETH_HASH_MSB      0x20
+#define GRETH_HASH_LSB      0x24
+#define GRETH_REG_SIZE      0x100
+
+/* Control register */
+#define CTRL_TE             (1 << 0)
+#define CTRL_RE             (1 << 1)
+#define CTRL_TI             (1 << 2)
+#define CTRL_RI             (1 << 3)
+#define CTRL_FD             (1 << 4)
+#define CTRL_PM             (1 << 5)
+#define CTRL_RS             (1 << 6)
+#define CTRL_SP             (1 << 7)
+#define CTRL_GB             (1 << 8)
+#define CTRL_PI             (1 << 10)
+#define CTRL_ME             (1 << 11)
+#define CTRL_DD             (1 << 12)
+#define CTRL_ED             (1 << 14)
+#define CTRL_MA             (1 << 25)
+#define CTRL_GA             (1 << 27)
+#define CTRL_RW_MASK        (CTRL_TE | CTRL_RE | CTRL_TI | CTRL_RI | \
+                             CTRL_FD | CTRL_PM | CTRL_SP | CTRL_PI | \
+                             CTRL_ME | CTRL_DD)
+
+/* Status register, write one to clear */
+#define STATUS_RE           (1 << 0)
+#define STATUS_TE           (1 << 1)
+#define STATUS_RI           (1 << 2)
+#define STATUS_TI           (1 << 3)
+#define STATUS_RA           (1 << 4)
+#define STATUS_TA           (1 << 5)
+#define STATUS_TS           (1 << 6)
+#define STATUS_IA           (1 << 7)
+#define STATUS_PS           (1 << 8)
+#define STATUS_MASK         0x1ff
+
+/* MDIO control register */
+#define MDIO_WR             (1 << 0)
+#define MDIO_RD             (1 << 1)
+#define MDIO_LF             (1 << 2)
+#define MDIO_BU             (1 << 3)
+#define MDIO_NV             (1 << 4)
+#define MDIO_REG_SHIFT      6
+#define MDIO_PHY_SHIFT      11
+#define MDIO_DATA_SHIFT     16
+
+/* Descriptor control word */
+#define DESC_LEN_MASK       0x7ff
+#define DESC_EN             (1 << 11)
+#define DESC_WR             (1 << 12)
+#define DESC_IE             (1 << 13)
+#define TXD_UE              (1 << 14)
+#define TXD_MO              (1 << 17)
+#define TXD_IC              (1 << 18)
+#define TXD_TC              (1 << 19)
+#define TXD_UC              (1 << 20)
+#define RXD_FT              (1 << 15)
+#define RXD_MC              (1 << 26)
+
+#define GRETH_DESC_SIZE     8
+#define GRETH_DESC_RING     1024
+#define GRETH_DESC_BATCH    16
+
+#define GRETH_FRAME_MAX     1518
+#define GRETH_TX_BUF_SIZE   2048
+
+/* Made up generic PHY, so that drivers do not apply vendor quirks */
+#define GRETH_PHY_ID1       0x0000
+#define GRETH_PHY_ID2       0x0c00
+
+OBJECT_DECLARE_SIMPLE_TYPE(GRETHState, GRLIB_GRETH)
+
+struct GRETHState {
+    SysBusDevice parent_obj;
+
+    MemoryRegion iomem;
+    qemu_irq irq;
+    QEMUBH *irq_bh;
+
+    NICState *nic;
+    NICConf conf;
+
+    /* Properties */
+    bool gbit;
+    bool big_endian;
+    uint8_t phy_addr;
+
+    /* Registers */
+    uint32_t ctrl;
+    uint32_t status;
+    uint32_t mac_msb;
+    uint32_t mac_lsb;
+    uint32_t mdio;
+    uint32_t tx_desc;
+    uint32_t rx_desc;
+    uint32_t hash_msb;
+    uint32_t hash_lsb;
+
+    /* PHY */
+    uint16_t phy_bmcr;
+    uint16_t phy_anar;
+
+    /* Frame being gathered from descriptors with the MO bit */
+    uint32_t tx_len;
+    uint32_t tx_csum;
+    uint8_t tx_buf[GRETH_TX_BUF_SIZE];
+
+    /* The backend queue is full, wait for it before sending more */
+    bool tx_wait;
+
+    /* Enabled receive descriptors, starting at rx_desc */
+    uint32_t rx_cache[GRETH_DESC_BATCH][2];
+    unsigned int rx_cache_pos;
+    unsigned int rx_cache_len;
+};
+
+static uint32_t greth_desc_word(GRETHState *s, uint32_t word)
+{
+    return s->big_endian ? be32_to_cpu(word) : le32_to_cpu(word);
+}
+
+static uint32_t greth_desc_raw(GRETHState *s, uint32_t word)
+{
+    return s->big_endian ? cpu_to_be32(word) : cpu_to_le32(word);
+}
+
+/* Next descriptor in the ring after the one at @addr */
+static uint32_t greth_next_desc(uint32_t addr, uint32_t ctl)
+{
+    uint32_t base = addr & ~(GRETH_DESC_RING - 1);
+
+    if ((ctl & DESC_WR) ||
+        (addr & (GRETH_DESC_RING - 1)) == GRETH_DESC_RING - GRETH_DESC_SIZE) {
+        return base;
+    }
+    return addr + GRETH_DESC_SIZE;
+}
+
+/* How many descriptors, at most, can be fetched at once from @addr */
+static unsigned int greth_desc_batch(uint32_t addr)
+{
+    unsigned int left = (GRETH_DESC_RING - (addr & (GRETH_DESC_RING - 1))) /
+                        GRETH_DESC_SIZE;
+
+    return MIN(left, GRETH_DESC_BATCH);
+}
+
+static void greth_irq_bh(void *opaque)
+{
+    GRETHState *s = opaque;
+
+    qemu_irq_pulse(s->irq);
+}
+
+static void greth_raise(GRETHState *s, uint32_t status, bool enabled)
+{
+    s->status |= status;
+    if (enabled) {
+        qemu_bh_schedule(s->irq_bh);
+    }
+}
+
+/* PHY */
+
+static uint16_t greth_phy_bmsr(GRETHState *s)
+{
+    NetClientState *nc = qemu_get_queue(s->nic);
+    uint16_t bmsr = MII_BMSR_100TX_FD | MII_BMSR_100TX_HD |
+                    MII_BMSR_10T_FD | MII_BMSR_10T_HD |
+                    MII_BMSR_MFPS | MII_BMSR_AUTONEG | MII_BMSR_EXTCAP;
+
+    if (s->gbit) {
+        bmsr |= MII_BMSR_EXTSTAT;
+    }
+    if (!nc->link_down) {
+        bmsr |= MII_BMSR_LINK_ST | MII_BMSR_AN_COMP;
+    }
+    return bmsr;
+}
+
+static void greth_phy_reset(GRETHState *s)
+{
+    s->phy_bmcr = MII_BMCR_AUTOEN | MII_BMCR_FD |
+                  (s->gbit ? MII_BMCR_SPEED1000 : MII_BMCR_SPEED100);
+    s->phy_anar = MII_ANAR_TXFD | MII_ANAR_TX | MII_ANAR_10FD |
+                  MII_ANAR_10 | MII_ANAR_CSMACD;
+}
+
+static uint16_t greth_phy_read(GRETHState *s, unsigned int reg)
+{
+    switch (reg) {
+    case MII_BMCR:
+        return s->phy_bmcr;
+    case MII_BMSR:
+        return greth_phy_bmsr(s);
+    case MII_PHYID1:
+        return GRETH_PHY_ID1;
+    case MII_PHYID2:
+        return GRETH_PHY_ID2;
+    case MII_ANAR:
+        return s->phy_anar;
+    case MII_ANLPAR:
+        return MII_ANLPAR_ACK | MII_ANLPAR_TXFD | MII_ANLPAR_TX |
+               MII_ANLPAR_10FD | MII_ANLPAR_10 | MII_ANLPAR_CSMACD;
+    case MII_CTRL1000:
+        return s->gbit ? MII_CTRL1000_FULL | MII_CTRL1000_HALF : 0;
+    case MII_STAT1000:
+        return s->gbit ? MII_STAT1000_FULL | MII_STAT1000_HALF : 0;
+    case MII_EXTSTAT:
+        return s->gbit ? MII_EXTSTAT_1000T_FD | MII_EXTSTAT_1000T_HD : 0;
+    default:
+        return 0;
+    }
+}
+
+static void greth_phy_write(GRETHState *s, unsigned int reg, uint16_t val)
+{
+    switch (reg) {
+    case MII_BMCR:
+        if (val & MII_BMCR_RESET) {
+            greth_phy_reset(s);
+        } else {
+            s->phy_bmcr = val & ~MII_BMCR_ANRESTART;
+        }
+        break;
+    case MII_ANAR:
+        s->phy_anar = val;
+        break;
+    default:
+        break;
+    }
+}
+
+static void greth_mdio(GRETHState *s, uint32_t val)
+{
+    unsigned int phy = extract32(val, MDIO_PHY_SHIFT, 5);
+    unsigned int reg = extract32(val, MDIO_REG_SHIFT, 5);
+    uint16_t data = extract32(val, MDIO_DATA_SHIFT, 16);
+
+    s->mdio = val & ~(MDIO_BU | MDIO_NV | MDIO_LF);
+    if (!(val & (MDIO_RD | MDIO_WR))) {
+        return;
+    }
+
+    if (phy != s->phy_addr) {
+        s->mdio = deposit32(s->mdio | MDIO_NV, MDIO_DATA_SHIFT, 16, 0xffff);
+    } else if (val & MDIO_WR) {
+        greth_phy_write(s, reg, data);
+    } else {
+        data = greth_phy_read(s, reg);
+        s->mdio = deposit32(s->mdio, MDIO_DATA_SHIFT, 16, data);
+    }
+    trace_greth_mdio(phy, reg, !!(val & MDIO_WR),
+                     extract32(s->mdio, MDIO_DATA_SHIFT, 16));
+}
+
+/* Transmitter */
+
+static void greth_transmit(GRETHState *s);
+
+static void greth_tx_done(NetClientState *nc, ssize_t len)
+{
+    GRETHState *s = qemu_get_nic_opaque(nc);
+
+    s->tx_wait = false;
+    greth_transmit(s);
+}
+
+/*
+ * Send the frame gathered in tx_buf.  If the backend had to queue it,
+ * transmission pauses until greth_tx_done().
+ */
+static void greth_send(GRETHState *s)
+{
+    NetClientState *nc = qemu_get_queue(s->nic);
+    uint32_t len = s->tx_len;
+
+    if (s->tx_csum) {
+        net_checksum_calculate(s->tx_buf, len, s->tx_csum);
+    }
+    s->tx_len = 0;
+    s->tx_csum = 0;
+
+    trace_greth_tx_frame(len);
+    if (!qemu_send_packet_async(nc, s->tx_buf, len, greth_tx_done)) {
+        s->tx_wait = true;
+    }
+}
+
+static void greth_transmit(GRETHState *s)
+{
+    MemTxAttrs attrs = MEMTXATTRS_UNSPECIFIED;
+    uint32_t desc[GRETH_DESC_BATCH][2];
+    bool irq = false;
+
+    while ((s->ctrl & CTRL_TE) && !s->tx_wait) {
+        uint32_t base = s->tx_desc;
+        unsigned int n = greth_desc_batch(base);
+        unsigned int i;
+
+        if (dma_memory_read(&address_space_memory, base, desc,
+                            n * GRETH_DESC_SIZE, attrs) != MEMTX_OK) {
+            s->ctrl &= ~CTRL_TE;
+            greth_raise(s, STATUS_TA | STATUS_TE, s->ctrl & CTRL_TI);
+            break;
+        }
+
+        for (i = 0; i < n && !s->tx_wait; i++) {
+            uint32_t ctl = greth_desc_word(s, desc[i][0]);
+            uint32_t addr = greth_desc_word(s, desc[i][1]);
+            uint32_t len = ctl & DESC_LEN_MASK;
+
+            if (!(ctl & DESC_EN)) {
+                /* The driver sets TE again when it queues more frames */
+                s->ctrl &= ~CTRL_TE;
+                break;
+            }
+
+            ctl &= ~(DESC_EN | TXD_UE);
+            if (s->tx_len + len > sizeof(s->tx_buf) ||
+                dma_memory_read(&address_space_memory, addr,
+                                s->tx_buf + s->tx_len, len,
+                                attrs) != MEMTX_OK) {
+                qemu_log_mask(LOG_GUEST_ERROR,
+                              "greth: bad transmit buffer 0x%" PRIx32
+                              " length %u\n", addr, len);
+                ctl |= TXD_UE;
+                s->tx_len = 0;
+                s->tx_csum = 0;
+                greth_raise(s, STATUS_TE, s->ctrl & CTRL_TI);
+            } else {
+                s->tx_len += len;
+                if (s->gbit) {
+                    s->tx_csum |= (ctl & TXD_IC ? CSUM_IP : 0) |
+                                  (ctl & TXD_TC ? CSUM_TCP : 0) |
+                                  (ctl & TXD_UC ? CSUM_UDP : 0);
+                }
+                if (!s->gbit || !(ctl & TXD_MO)) {
+                    greth_send(s);
+                }
+            }
+
+            desc[i][0] = greth_desc_raw(s, ctl);
+            s->tx_desc = greth_next_desc(s->tx_desc, ctl);
+            if (ctl & DESC_IE) {
+                s->status |= STATUS_TI;
+                irq |= s->ctrl & CTRL_TI;
+            }
+            if (ctl & DESC_WR) {
+                i++;
+                break;
+            }
+        }
+
+        /* Hand the whole batch back to the driver at once */
+        if (i) {
+            dma_memory_write(&address_space_memory, base, desc,
+                             i * GRETH_DESC_SIZE, attrs);
+            trace_greth_tx_batch(base, i);
+        }
+        if (i < n && !(s->ctrl & CTRL_TE)) {
+            break;
+        }
+    }
+
+    if (irq) {
+        qemu_bh_schedule(s->irq_bh);
+    }
+}
+
+/* Receiver */
+
+static void greth_rx_cache_drop(GRETHState *s)
+{
+    s->rx_cache_pos = s->rx_cache_len = 0;
+}
+
+/*
+ * Fetch the enabled descriptors from rx_desc on.  The driver does not
+ * touch them until they are handed back, so they stay valid.
+ */
+static bool greth_rx_cache_fill(GRETHState *s)
+{
+    uint32_t desc[GRETH_DESC_BATCH][2];
+    unsigned int n = greth_desc_batch(s->rx_desc);
+    unsigned int i;
+
+    greth_rx_cache_drop(s);
+    if (dma_memory_read(&address_space_memory, s->rx_desc, desc,
+                        n * GRETH_DESC_SIZE,
+                        MEMTXATTRS_UNSPECIFIED) != MEMTX_OK) {
+        s->ctrl &= ~CTRL_RE;
+        greth_raise(s, STATUS_RA | STATUS_RE, s->ctrl & CTRL_RI);
+        return false;
+    }
+
+    for (i = 0; i < n; i++) {
+        uint32_t ctl = greth_desc_word(s, desc[i][0]);
+
+        if (!(ctl & DESC_EN)) {
+            break;
+        }
+        s->rx_cache[i][0] = ctl;
+        s->rx_cache[i][1] = greth_desc_word(s, desc[i][1]);
+        if (ctl & DESC_WR) {
+            i++;
+            break;
+        }
+    }
+    s->rx_cache_len = i;
+    trace_greth_rx_batch(s->rx_desc, i);
+
+    if (!i) {
+        /* The driver sets RE again when it has refilled the ring */
+        s->ctrl &= ~CTRL_RE;
+        return false;
+    }
+    return true;
+}
+
+static bool greth_rx_filter(GRETHState *s, const uint8_t *buf)
+{
+    uint8_t mac[ETH_ALEN];
+    uint32_t bit;
+
+    if (s->ctrl & CTRL_PM) {
+        return true;
+    }
+
+    stw_be_p(mac, s->mac_msb);
+    stl_be_p(mac + 2, s->mac_lsb);
+    if (!memcmp(buf, mac, ETH_ALEN) || is_broadcast_ether_addr(buf)) {
+        return true;
+    }
+
+    if (!is_multicast_ether_addr(buf) || !(s->ctrl & CTRL_ME)) {
+        return false;
+    }
+    bit = net_crc32(buf, ETH_ALEN) & 0x3f;
+    return (bit < 32 ? s->hash_lsb : s->hash_msb) & (1u << (bit & 31));
+}
+
+static bool greth_can_receive(NetClientState *nc)
+{
+    GRETHState *s = qemu_get_nic_opaque(nc);
+
+    return s->ctrl & CTRL_RE;
+}
+
+static ssize_t greth_receive(NetClientState *nc, const uint8_t *buf,
+                             size_t size)
+{
+    GRETHState *s = qemu_get_nic_opaque(nc);
+    MemTxAttrs attrs = MEMTXATTRS_UNSPECIFIED;
+    uint32_t ctl, addr, len, raw;
+
+    if (!(s->ctrl & CTRL_RE)) {
+        return 0;
+    }
+    if (size < ETH_HLEN || !greth_rx_filter(s, buf)) {
+        return size;
+    }
+    if (s->rx_cache_pos == s->rx_cache_len && !greth_rx_cache_fill(s)) {
+        /* Keep the frame queued until the ring is refilled */
+        return 0;
+    }
+
+    ctl = s->rx_cache[s->rx_cache_pos][0];
+    addr = s->rx_cache[s->rx_cache_pos][1];
+    s->rx_cache_pos++;
+
+    ctl &= DESC_WR | DESC_IE;
+    len = size;
+    if (len > GRETH_FRAME_MAX) {
+        len = GRETH_FRAME_MAX;
+        ctl |= RXD_FT;
+    }
+    if (is_multicast_ether_addr(buf)) {
+        ctl |= RXD_MC;
+    }
+
+    if (dma_memory_write(&address_space_memory, addr, buf, len,
+                         attrs) != MEMTX_OK) {
+        greth_rx_cache_drop(s);
+        s->ctrl &= ~CTRL_RE;
+        greth_raise(s, STATUS_RA | STATUS_RE, s->ctrl & CTRL_RI);
+        return size;
+    }
+    ctl |= len;
+    raw = greth_desc_raw(s, ctl);
+    dma_memory_write(&address_space_memory, s->rx_desc, &raw, sizeof(raw),
+                     attrs);
+    trace_greth_rx_frame(s->rx_desc, addr, len);
+
+    s->rx_desc = greth_next_desc(s->rx_desc, ctl);
+    if (ctl & RXD_FT) {
+        greth_raise(s, STATUS_RE, s->ctrl & CTRL_RI);
+    } else if (ctl & DESC_IE) {
+        greth_raise(s, STATUS_RI, s->ctrl & CTRL_RI);
+    }
+    return size;
+}
+
+static void greth_set_link(NetClientState *nc)
+{
+    GRETHState *s = qemu_get_nic_opaque(nc);
+
+    trace_greth_set_link(!nc->link_down);
+    greth_raise(s, STATUS_PS, s->ctrl & CTRL_PI);
+}
+
+/* Registers */
+
+static void greth_reset_regs(GRETHState *s)
+{
+    s->ctrl = CTRL_MA | CTRL_ED | CTRL_FD |
+              (s->gbit ? CTRL_GA | CTRL_GB : CTRL_SP);
+    s->status = 0;
+    s->mdio = 0;
+    s->tx_desc = 0;
+    s->rx_desc = 0;
+    s->hash_msb = 0;
+    s->hash_lsb = 0;
+    s->tx_len = 0;
+    s->tx_csum = 0;
+    greth_rx_cache_drop(s);
+}
+
+static uint64_t greth_read(void *opaque, hwaddr addr, unsigned size)
+{
+    GRETHState *s = opaque;
+    uint32_t val;
+
+    switch (addr) {
+    case GRETH_CTRL:
+        val = s->ctrl;
+        break;
+    case GRETH_STATUS:
+        val = s->status;
+        break;
+    case GRETH_MAC_MSB:
+        val = s->mac_msb;
+        break;
+    case GRETH_MAC_LSB:
+        val = s->mac_lsb;
+        break;
+    case GRETH_MDIO:
+        val = s->mdio | (qemu_get_queue(s->nic)->link_down ? MDIO_LF : 0);
+        break;
+    case GRETH_TX_DESC:
+        val = s->tx_desc;
+        break;
+    case GRETH_RX_DESC:
+        val = s->rx_desc;
+        break;
+    case GRETH_HASH_MSB:
+        val = s->hash_msb;
+        break;
+    case GRETH_HASH_LSB:
+        val = s->hash_lsb;
+        break;
+    case GRETH_EDCL_IP:
+        val = 0;
+        break;
+    default:
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: bad offset 0x%" HWADDR_PRIx "\n",
+                      __func__, addr);
+        val = 0;
+        break;
+    }
+
+    trace_greth_read(addr, val);
+    return val;
+}
+
+static void greth_write(void *opaque, hwaddr addr, uint64_t value,
+                        unsigned size)
+{
+    GRETHState *s = opaque;
+    NetClientState *nc = qemu_get_queue(s->nic);
+    uint32_t val = value;
+
+    trace_greth_write(addr, val);
+
+    switch (addr) {
+    case GRETH_CTRL:
+        if (val & CTRL_RS) {
+            greth_reset_regs(s);
+            break;
+        }
+        s->ctrl = (s->ctrl & ~(CTRL_RW_MASK | CTRL_GB)) |
+                  (val & CTRL_RW_MASK) | (s->gbit ? val & CTRL_GB : 0);
+        if (s->ctrl & CTRL_TE) {
+            greth_transmit(s);
+        }
+        if (s->ctrl & CTRL_RE) {
+            qemu_flush_queued_packets(nc);
+        }
+        break;
+    case GRETH_STATUS:
+        s->status &= ~(val & STATUS_MASK);
+        break;
+    case GRETH_MAC_MSB:
+        s->mac_msb = val & 0xffff;
+        break;
+    case GRETH_MAC_LSB:
+        s->mac_lsb = val;
+        break;
+    case GRETH_MDIO:
+        greth_mdio(s, val);
+        break;
+    case GRETH_TX_DESC:
+        s->tx_desc = val & ~(GRETH_DESC_SIZE - 1);
+        break;
+    case GRETH_RX_DESC:
+        s->rx_desc = val & ~(GRETH_DESC_SIZE - 1);
+        greth_rx_cache_drop(s);
+        break;
+    case GRETH_HASH_MSB:
+        s->hash_msb = val;
+        break;
+    case GRETH_HASH_LSB:
+        s->hash_lsb = val;
+        break;
+    case GRETH_EDCL_IP:
+        break;
+    default:
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: bad offset 0x%" HWADDR_PRIx "\n",
+                      __func__, addr);
+        break;
+    }
+}
+
+static const MemoryRegionOps greth_ops = {
+    .read = greth_read,
+    .write = greth_write,
+    .endianness = DEVICE_NATIVE_ENDIAN,
+    .valid = {
+        .min_access_size = 4,
+        .max_access_size = 4,
+    },
+};
+
+static NetClientInfo net_greth_info = {
+    .type = NET_CLIENT_DRIVER_NIC,
+    .size = sizeof(NICState),
+    .can_receive = greth_can_receive,
+    .receive = greth_receive,
+    .link_status_changed = greth_set_link,
+};
+
+static void greth_reset(DeviceState *dev)
+{
+    GRETHState *s = GRLIB_GRETH(dev);
+    const uint8_t *mac = s->conf.macaddr.a;
+
+    greth_reset_regs(s);
+    s->mac_msb = lduw_be_p(mac);
+    s->mac_lsb = ldl_be_p(mac + 2);
+    s->tx_wait = false;
+    greth_phy_reset(s);
+}
+
+static void greth_realize(DeviceState *dev, Error **errp)
+{
+    GRETHState *s = GRLIB_GRETH(dev);
+    SysBusDevice *sbd = SYS_BUS_DEVICE(dev);
+
+    memory_region_init_io(&s->iomem, OBJECT(s), &greth_ops, s,
+                          TYPE_GRLIB_GRETH, GRETH_REG_SIZE);
+    sysbus_init_mmio(sbd, &s->iomem);
+    sysbus_init_irq(sbd, &s->irq);
+    s->irq_bh = qemu_bh_new_guarded(greth_irq_bh, s,
+                                    &dev->mem_reentrancy_guard);
+
+    qemu_macaddr_default_if_unset(&s->conf.macaddr);
+    s->nic = qemu_new_nic(&net_greth_info, &s->conf,
+                          object_get_typename(OBJECT(dev)), dev->id,
+                          &dev->mem_reentrancy_guard, s);
+    qemu_format_nic_info_str(qemu_get_queue(s->nic), s->conf.macaddr.a);
+}
+
+static void greth_unrealize(DeviceState *dev)
+{
+    GRETHState *s = GRLIB_GRETH(dev);
+
+    qemu_del_nic(s->nic);
+    qemu_bh_delete(s->irq_bh);
+}
+
+static int greth_post_load(void *opaque, int version_id)
+{
+    GRETHState *s = opaque;
+
+    if (s->tx_len > sizeof(s->tx_buf)) {
+        return -EINVAL;
+    }
+    greth_rx_cache_drop(s);
+    s->tx_wait = false;
+    return 0;
+}
+
+static const VMStateDescription vmstate_greth = {
+    .name = TYPE_GRLIB_GRETH,
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .post_load = greth_post_load,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32(ctrl, GRETHState),
+        VMSTATE_UINT32(status, GRETHState),
+        VMSTATE_UINT32(mac_msb, GRETHState),
+        VMSTATE_UINT32(mac_lsb, GRETHState),
+        VMSTATE_UINT32(mdio, GRETHState),
+        VMSTATE_UINT32(tx_desc, GRETHState),
+        VMSTATE_UINT32(rx_desc, GRETHState),
+        VMSTATE_UINT32(hash_msb, GRETHState),
+        VMSTATE_UINT32(hash_lsb, GRETHState),
+        VMSTATE_UINT16(phy_bmcr, GRETHState),
+        VMSTATE_UINT16(phy_anar, GRETHState),
+        VMSTATE_UINT32(tx_len, GRETHState),
+        VMSTATE_UINT32(tx_csum, GRETHState),
+        VMSTATE_UINT8_ARRAY(tx_buf, GRETHState, GRETH_TX_BUF_SIZE),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static Property greth_properties[] = {
+    DEFINE_NIC_PROPERTIES(GRETHState, conf),
+    DEFINE_PROP_BOOL("gbit", GRETHState, gbit, false),
+    DEFINE_PROP_BOOL("big-endian", GRETHState, big_endian, true),
+    DEFINE_PROP_UINT8("phy-addr", GRETHState, phy_addr, 0),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
+static void greth_class_init(ObjectClass *klass, void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(klass);
+
+    dc->realize = greth_realize;
+    dc->unrealize = greth_unrealize;
+    dc->reset = greth_reset;
+    dc->vmsd = &vmstate_greth;
+    device_class_set_props(dc, greth_properties);
+    set_bit(DEVICE_CATEGORY_NETWORK, dc->categories);
+}
+
+static const TypeInfo greth_info = {
+    .name          = TYPE_GRLIB_GRETH,
+    .parent        = TYPE_SYS_BUS_DEVICE,
+    .instance_size = sizeof(GRETHState),
+    .class_init    = greth_class_init,
+};
+
+static void greth_register_types(void)
+{
+    type_register_static(&greth_info);
+}
+
+type_init(greth_register_types)
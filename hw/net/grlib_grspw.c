@@ -0,0 +1,1166 @@
+/*
+ * GRLIB GRSPW2 SpaceWire codec with DMA
+ *
+ * The link is carried over a chardev, usually a socket to the GRSPW2 of
+ * another QEMU instance, so that several instances form a SpaceWire
+ * network.  Each packet or time-code on the stream is preceded by a
+ * 32-bit big-endian header:
+ *
+ *   bits 31..30   0: packet ended by EOP, 1: packet ended by EEP,
+ *                 2: time-code
+ *   bits 24..0    packet length in bytes, or the time-code value
+ *
+ * The link is running while the chardev is connected and the link is
+ * started (LS or AS set, LD clear); SpaceWire flow control maps to the
+ * chardev flow control.
+ *
+ * Setting the transmit enable bit of a DMA channel sends every enabled
+ * transmit descriptor: they are fetched up to 16 at a time and handed
+ * back with one DMA write per batch.  The header and data buffers of a
+ * packet are read into a transmit buffer that the chardev is fed from
+ * without blocking; the next descriptor waits until it has drained.
+ * Received packets are written to guest memory as they arrive, into
+ * receive descriptors that are likewise fetched in batches and cached
+ * until used.
+ * Interrupts are raised from a bottom half, once per batch.
+ *
+ * Not modelled: RMAP, CRC generation and checking, multiple ports and
+ * the interrupt distribution.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qemu/log.h"
+#include "qemu/main-loop.h"
+#include "qemu/module.h"
+#include "chardev/char-fe.h"
+#include "hw/irq.h"
+#include "hw/net/grlib_grspw.h"
+#include "hw/qdev-properties.h"
+#include "hw/qdev-properties-system.h"
+#include "hw/sysbus.h"
+#include "migration/vmstate.h"
+#include "sysemu/dma.h"
+#include "trace.h"
+#include "qom/object.h"
+
+/* Registers */
+#define GRSPW_CTRL          0x00
+#define GRSPW_STATUS        0x04
+#define GRSPW_DEFADDR       0x08
+#define GRSPW_CLKDIV        0x0C
+#define GRSPW_DESTKEY       0x10
+#define GRSPW_TIME          0x14
+#define GRSPW_DMA_BASE      0x20
+#define GRSPW_DMA_STRIDE    0x20
+#define GRSPW_DMA_CTRL      0x00
+#define GRSPW_DMA_RXMAX     0x04
+#define GRSPW_DMA_TXDESC    0x08
+#define GRSPW_DMA_RXDESC    0x0C
+#define GRSPW_DMA_ADDR      0x10
+#define GRSPW_REG_SIZE      0x100
+
+#define GRSPW_MAX_CHANNELS  4
+
+/* Control register */
+#define CTRL_LD             (1 << 0)
+#define CTRL_LS             (1 << 1)
+#define CTRL_AS             (1 << 2)
+#define CTRL_IE             (1 << 3)
+#define CTRL_TI             (1 << 4)
+#define CTRL_PM             (1 << 5)
+#define CTRL_RS             (1 << 6)
+#define CTRL_TQ             (1 << 8)
+#define CTRL_LI             (1 << 9)
+#define CTRL_TT             (1 << 10)
+#define CTRL_TR             (1 << 11)
+#define CTRL_NCH_SHIFT      27
+#define CTRL_RW_MASK        (CTRL_LD | CTRL_LS | CTRL_AS | CTRL_IE | \
+                             CTRL_PM | CTRL_TQ | CTRL_LI | CTRL_TT | \
+                             CTRL_TR)
+
+/* Status register, error and tick bits are write one to clear */
+#define STATUS_TO           (1 << 0)
+#define STATUS_CE           (1 << 1)
+#define STATUS_ER           (1 << 2)
+#define STATUS_DE           (1 << 3)
+#define STATUS_PE           (1 << 4)
+#define STATUS_IA           (1 << 7)
+#define STATUS_EE           (1 << 8)
+#define STATUS_W1C_MASK     0x1ff
+#define STATUS_LS_SHIFT     21
+
+/* Link states */
+#define LINK_ERROR_RESET    0
+#define LINK_READY          2
+#define LINK_STARTED        3
+#define LINK_RUN            5
+
+/* DMA control register */
+#define DMA_TE              (1 << 0)
+#define DMA_RE              (1 << 1)
+#define DMA_TI              (1 << 2)
+#define DMA_RI              (1 << 3)
+#define DMA_AI              (1 << 4)
+#define DMA_PS              (1 << 5)
+#define DMA_PR              (1 << 6)
+#define DMA_TA              (1 << 7)
+#define DMA_RA              (1 << 8)
+#define DMA_AT              (1 << 9)
+#define DMA_RX              (1 << 10)
+#define DMA_RD              (1 << 11)
+#define DMA_NS              (1 << 12)
+#define DMA_EN              (1 << 13)
+#define DMA_SA              (1 << 14)
+#define DMA_SP              (1 << 15)
+#define DMA_LE              (1 << 16)
+#define DMA_W1C_MASK        (DMA_PS | DMA_PR | DMA_TA | DMA_RA)
+#define DMA_RW_MASK         (DMA_TE | DMA_RE | DMA_TI | DMA_RI | DMA_AI | \
+                             DMA_AT | DMA_RD | DMA_NS | DMA_EN | DMA_SA | \
+                             DMA_SP | DMA_LE)
+
+/* Transmit descriptors: control, header address, data length, address */
+#define TXD_HLEN_MASK       0xff
+#define TXD_EN              (1 << 12)
+#define TXD_WR              (1 << 13)
+#define TXD_IE              (1 << 14)
+#define TXD_LE              (1 << 15)
+#define TXD_DLEN_MASK       0xffffff
+#define TXD_SIZE            16
+
+/* Receive descriptors: control and length, data address */
+#define RXD_LEN_MASK        0x1ffffff
+#define RXD_EN              (1 << 25)
+#define RXD_WR              (1 << 26)
+#define RXD_IE              (1 << 27)
+#define RXD_EP              (1 << 28)
+#define RXD_TR              (1u << 31)
+#define RXD_SIZE            8
+
+#define GRSPW_DESC_RING     1024
+#define GRSPW_DESC_BATCH    16
+
+/* Stream framing */
+#define HDR_TYPE_SHIFT      30
+#define HDR_EOP             0
+#define HDR_EEP             1
+#define HDR_TIME            2
+#define HDR_LEN_MASK        0x1ffffff
+#define HDR_SIZE            4
+
+/* Largest packet, and room for time-codes queued behind it */
+#define GRSPW_TX_MAX        (HDR_SIZE + TXD_HLEN_MASK + TXD_DLEN_MASK + \
+                             64 * HDR_SIZE)
+
+OBJECT_DECLARE_SIMPLE_TYPE(GRSPWState, GRLIB_GRSPW)
+
+typedef struct GRSPWChannel {
+    uint32_t ctrl;
+    uint32_t rxmax;
+    uint32_t txdesc;
+    uint32_t rxdesc;
+    uint32_t addr;
+
+    /* Enabled receive descriptors, starting at rxdesc */
+    uint32_t rx_cache[GRSPW_DESC_BATCH][2];
+    unsigned int rx_cache_pos;
+    unsigned int rx_cache_len;
+} GRSPWChannel;
+
+struct GRSPWState {
+    SysBusDevice parent_obj;
+
+    MemoryRegion iomem;
+    qemu_irq irq;
+    QEMUBH *irq_bh;
+    CharBackend chr;
+
+    /* Properties */
+    bool big_endian;
+    uint32_t num_channels;
+
+    /* Registers */
+    uint32_t ctrl;
+    uint32_t status;
+    uint32_t defaddr;
+    uint32_t clkdiv;
+    uint32_t destkey;
+    uint32_t time;
+    GRSPWChannel ch[GRSPW_MAX_CHANNELS];
+
+    bool connected;
+
+    /* Packet being received */
+    uint8_t rx_hdr[HDR_SIZE];
+    uint32_t rx_hdr_len;
+    uint32_t rx_left;           /* bytes of the packet still to come */
+    uint32_t rx_type;
+    bool rx_started;            /* the first byte has been seen */
+    int rx_chan;                /* -1 to discard the packet */
+    uint8_t rx_dest;            /* first byte, while waiting for a channel */
+    bool rx_waiting;
+    uint32_t rx_pos;            /* bytes of the packet seen so far */
+    uint32_t rx_written;        /* bytes stored in the buffer */
+    bool rx_trunc;
+    uint32_t rx_desc_ctl;
+    uint32_t rx_desc_addr;
+    uint32_t rx_buf_addr;
+
+    /* Bytes queued for the link, tx_pos of them already sent */
+    uint8_t *tx_buf;
+    uint32_t tx_size;
+    uint32_t tx_len;
+    uint32_t tx_pos;
+    guint tx_watch;
+};
+
+static uint32_t grspw_desc_word(GRSPWState *s, uint32_t word)
+{
+    return s->big_endian ? be32_to_cpu(word) : le32_to_cpu(word);
+}
+
+static uint32_t grspw_desc_raw(GRSPWState *s, uint32_t word)
+{
+    return s->big_endian ? cpu_to_be32(word) : cpu_to_le32(word);
+}
+
+static uint32_t grspw_next_desc(uint32_t addr, unsigned int size, bool wrap)
+{
+    uint32_t base = addr & ~(GRSPW_DESC_RING - 1);
+
+    if (wrap || (addr & (GRSPW_DESC_RING - 1)) == GRSPW_DESC_RING - size) {
+        return base;
+    }
+    return addr + size;
+}
+
+static unsigned int grspw_desc_batch(uint32_t addr, unsigned int size)
+{
+    unsigned int left = (GRSPW_DESC_RING - (addr & (GRSPW_DESC_RING - 1))) /
+                        size;
+
+    return MIN(left, GRSPW_DESC_BATCH);
+}
+
+static void grspw_irq_bh(void *opaque)
+{
+    GRSPWState *s = opaque;
+
+    qemu_irq_pulse(s->irq);
+}
+
+static void grspw_irq(GRSPWState *s)
+{
+    qemu_bh_schedule(s->irq_bh);
+}
+
+static bool grspw_link_running(GRSPWState *s)
+{
+    return s->connected && !(s->ctrl & CTRL_LD) &&
+           (s->ctrl & (CTRL_LS | CTRL_AS));
+}
+
+static uint32_t grspw_link_state(GRSPWState *s)
+{
+    if (grspw_link_running(s)) {
+        return LINK_RUN;
+    } else if (!(s->ctrl & CTRL_LD) && (s->ctrl & CTRL_LS)) {
+        return LINK_STARTED;
+    } else if (!(s->ctrl & CTRL_LD)) {
+        return LINK_READY;
+    }
+    return LINK_ERROR_RESET;
+}
+
+/* Transmitter */
+
+static gboolean grspw_tx_watch(void *do_not_use, GIOCondition cond,
+                               void *opaque);
+
+static bool grspw_tx_busy(GRSPWState *s)
+{
+    return s->tx_pos < s->tx_len;
+}
+
+static void grspw_tx_cancel(GRSPWState *s)
+{
+    if (s->tx_watch) {
+        g_source_remove(s->tx_watch);
+        s->tx_watch = 0;
+    }
+    s->tx_len = s->tx_pos = 0;
+}
+
+/* Make room for @len more bytes at the end of the transmit buffer */
+static uint8_t *grspw_tx_reserve(GRSPWState *s, uint32_t len)
+{
+    if (!grspw_tx_busy(s)) {
+        s->tx_len = s->tx_pos = 0;
+    }
+    if (s->tx_len + len > s->tx_size) {
+        s->tx_size = MAX(s->tx_len + len, 2 * s->tx_size);
+        s->tx_buf = g_realloc(s->tx_buf, s->tx_size);
+    }
+    s->tx_len += len;
+    return s->tx_buf + s->tx_len - len;
+}
+
+/*
+ * Send what the chardev takes of the transmit buffer without blocking,
+ * and come back for the rest once it is writable.  Returns true when
+ * the buffer is empty.
+ */
+static bool grspw_tx_flush(GRSPWState *s)
+{
+    while (grspw_tx_busy(s) && !s->tx_watch) {
+        int ret = qemu_chr_fe_write(&s->chr, s->tx_buf + s->tx_pos,
+                                    s->tx_len - s->tx_pos);
+
+        if (ret > 0) {
+            s->tx_pos += ret;
+        } else if (ret == 0 || errno == EAGAIN) {
+            s->tx_watch = qemu_chr_fe_add_watch(&s->chr, G_IO_OUT | G_IO_HUP,
+                                                grspw_tx_watch, s);
+            if (!s->tx_watch) {
+                grspw_tx_cancel(s);
+            }
+        } else {
+            /* The link goes down, what was not sent is lost */
+            grspw_tx_cancel(s);
+        }
+    }
+    return !grspw_tx_busy(s);
+}
+
+/*
+ * Build the packet of one descriptor in the transmit buffer.  The
+ * buffers are read before anything is queued, so that a DMA error does
+ * not leave half a packet on the link.
+ */
+static bool grspw_tx_packet(GRSPWState *s, dma_addr_t haddr, uint32_t hlen,
+                            dma_addr_t daddr, uint32_t dlen)
+{
+    MemTxAttrs attrs = MEMTXATTRS_UNSPECIFIED;
+    uint8_t *p = grspw_tx_reserve(s, HDR_SIZE + hlen + dlen);
+
+    if (dma_memory_read(&address_space_memory, haddr, p + HDR_SIZE, hlen,
+                        attrs) != MEMTX_OK ||
+        dma_memory_read(&address_space_memory, daddr, p + HDR_SIZE + hlen,
+                        dlen, attrs) != MEMTX_OK) {
+        s->tx_len -= HDR_SIZE + hlen + dlen;
+        return false;
+    }
+    stl_be_p(p, HDR_EOP << HDR_TYPE_SHIFT | ((hlen + dlen) & HDR_LEN_MASK));
+    return true;
+}
+
+/*
+ * Send the enabled transmit descriptors.  A descriptor is handed back
+ * once its packet is in the transmit buffer, and the next one waits
+ * until the buffer has drained.
+ */
+static void grspw_transmit(GRSPWState *s, GRSPWChannel *ch)
+{
+    MemTxAttrs attrs = MEMTXATTRS_UNSPECIFIED;
+    uint32_t desc[GRSPW_DESC_BATCH][4];
+
+    while ((ch->ctrl & DMA_TE) && grspw_link_running(s) &&
+           grspw_tx_flush(s)) {
+        uint32_t base = ch->txdesc;
+        unsigned int n = grspw_desc_batch(base, TXD_SIZE);
+        unsigned int i;
+        bool stop = false;
+
+        if (dma_memory_read(&address_space_memory, base, desc,
+                            n * TXD_SIZE, attrs) != MEMTX_OK) {
+            ch->ctrl = (ch->ctrl & ~DMA_TE) | DMA_TA;
+            if (ch->ctrl & DMA_AI) {
+                grspw_irq(s);
+            }
+            break;
+        }
+
+        for (i = 0; i < n && !stop; i++) {
+            uint32_t ctl = grspw_desc_word(s, desc[i][0]);
+            uint32_t haddr = grspw_desc_word(s, desc[i][1]);
+            uint32_t dlen = grspw_desc_word(s, desc[i][2]) & TXD_DLEN_MASK;
+            uint32_t daddr = grspw_desc_word(s, desc[i][3]);
+            uint32_t hlen = ctl & TXD_HLEN_MASK;
+
+            if (!(ctl & TXD_EN)) {
+                /* The driver sets TE again when it queues more packets */
+                ch->ctrl &= ~DMA_TE;
+                break;
+            }
+
+            trace_grspw_tx_packet(ch - s->ch, hlen, dlen);
+            ctl &= ~(TXD_EN | TXD_LE);
+            if (!grspw_tx_packet(s, haddr, hlen, daddr, dlen)) {
+                ctl |= TXD_LE;
+                if (ch->ctrl & DMA_AT) {
+                    ch->ctrl &= ~DMA_TE;
+                    stop = true;
+                }
+            } else if (!grspw_tx_flush(s)) {
+                stop = true;
+            }
+
+            desc[i][0] = grspw_desc_raw(s, ctl);
+            ch->ctrl |= DMA_PS;
+            if ((ctl & TXD_IE) && (ch->ctrl & DMA_TI)) {
+                grspw_irq(s);
+            }
+            ch->txdesc = grspw_next_desc(ch->txdesc, TXD_SIZE, ctl & TXD_WR);
+            if (ctl & TXD_WR) {
+                i++;
+                break;
+            }
+        }
+
+        if (i) {
+            dma_memory_write(&address_space_memory, base, desc,
+                             i * TXD_SIZE, attrs);
+            trace_grspw_tx_batch(ch - s->ch, base, i);
+        }
+    }
+}
+
+static void grspw_transmit_all(GRSPWState *s)
+{
+    int i;
+
+    for (i = 0; i < s->num_channels; i++) {
+        grspw_transmit(s, &s->ch[i]);
+    }
+}
+
+static gboolean grspw_tx_watch(void *do_not_use, GIOCondition cond,
+                               void *opaque)
+{
+    GRSPWState *s = opaque;
+
+    s->tx_watch = 0;
+    if (grspw_tx_flush(s)) {
+        grspw_transmit_all(s);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+/* A time-code that finds a packet in flight follows it */
+static void grspw_send_time(GRSPWState *s)
+{
+    if (grspw_link_running(s) && (s->ctrl & CTRL_TT)) {
+        s->time = (s->time & 0xc0) | ((s->time + 1) & 0x3f);
+        if (s->tx_len + HDR_SIZE > GRSPW_TX_MAX) {
+            return;
+        }
+        stl_be_p(grspw_tx_reserve(s, HDR_SIZE),
+                 HDR_TIME << HDR_TYPE_SHIFT | (s->time & 0xff));
+        grspw_tx_flush(s);
+    }
+}
+
+/* Receiver */
+
+static void grspw_rx_cache_drop(GRSPWChannel *ch)
+{
+    ch->rx_cache_pos = ch->rx_cache_len = 0;
+}
+
+static bool grspw_rx_cache_fill(GRSPWState *s, GRSPWChannel *ch)
+{
+    uint32_t desc[GRSPW_DESC_BATCH][2];
+    unsigned int n = grspw_desc_batch(ch->rxdesc, RXD_SIZE);
+    unsigned int i;
+
+    grspw_rx_cache_drop(ch);
+    if (dma_memory_read(&address_space_memory, ch->rxdesc, desc,
+                        n * RXD_SIZE, MEMTXATTRS_UNSPECIFIED) != MEMTX_OK) {
+        ch->ctrl = (ch->ctrl & ~DMA_RE) | DMA_RA;
+        if (ch->ctrl & DMA_AI) {
+            grspw_irq(s);
+        }
+        return false;
+    }
+
+    for (i = 0; i < n; i++) {
+        uint32_t ctl = grspw_desc_word(s, desc[i][0]);
+
+        if (!(ctl & RXD_EN)) {
+            break;
+        }
+        ch->rx_cache[i][0] = ctl;
+        ch->rx_cache[i][1] = grspw_desc_word(s, desc[i][1]);
+        if (ctl & RXD_WR) {
+            i++;
+            break;
+        }
+    }
+    ch->rx_cache_len = i;
+    trace_grspw_rx_batch(ch - s->ch, ch->rxdesc, i);
+
+    if (!i) {
+        /* No descriptors available, until the driver sets RD again */
+        ch->ctrl &= ~DMA_RD;
+        return false;
+    }
+    return true;
+}
+
+static bool grspw_rx_ready(GRSPWState *s, GRSPWChannel *ch)
+{
+    if (!(ch->ctrl & DMA_RE) || !(ch->ctrl & DMA_RD)) {
+        return false;
+    }
+    return ch->rx_cache_pos < ch->rx_cache_len || grspw_rx_cache_fill(s, ch);
+}
+
+/* The channel a packet for logical address @dest goes to, or -1 */
+static int grspw_rx_match(GRSPWState *s, uint8_t dest)
+{
+    int i;
+
+    for (i = 0; i < s->num_channels; i++) {
+        GRSPWChannel *ch = &s->ch[i];
+        uint32_t reg = ch->ctrl & DMA_EN ? ch->addr : s->defaddr;
+        uint8_t addr = extract32(reg, 0, 8);
+        uint8_t mask = extract32(reg, 8, 8);
+
+        if (!((dest ^ addr) & ~mask)) {
+            return i;
+        }
+    }
+    return s->ctrl & CTRL_PM ? 0 : -1;
+}
+
+/*
+ * Pick the channel and descriptor for the packet whose first byte is
+ * rx_dest.  Returns false if the packet has to wait for a descriptor.
+ */
+static bool grspw_rx_start(GRSPWState *s)
+{
+    int chan = grspw_rx_match(s, s->rx_dest);
+    GRSPWChannel *ch;
+
+    s->rx_started = true;
+    s->rx_waiting = false;
+    s->rx_chan = -1;
+    if (chan < 0) {
+        s->status |= STATUS_IA;
+        return true;
+    }
+
+    ch = &s->ch[chan];
+    if (!grspw_rx_ready(s, ch)) {
+        /* Spill the packet, unless told to wait for descriptors */
+        if (ch->ctrl & DMA_NS) {
+            s->rx_started = false;
+            s->rx_waiting = true;
+            return false;
+        }
+        return true;
+    }
+
+    s->rx_chan = chan;
+    s->rx_desc_addr = ch->rxdesc;
+    s->rx_desc_ctl = ch->rx_cache[ch->rx_cache_pos][0];
+    s->rx_buf_addr = ch->rx_cache[ch->rx_cache_pos][1];
+    ch->rx_cache_pos++;
+    s->rx_written = 0;
+    s->rx_trunc = false;
+    ch->ctrl |= DMA_RX;
+    return true;
+}
+
+static void grspw_rx_finish(GRSPWState *s)
+{
+    GRSPWChannel *ch;
+    uint32_t ctl, raw;
+
+    if (s->rx_chan < 0) {
+        return;
+    }
+
+    ch = &s->ch[s->rx_chan];
+    ctl = (s->rx_desc_ctl & (RXD_WR | RXD_IE)) | s->rx_written;
+    if (s->rx_type == HDR_EEP) {
+        ctl |= RXD_EP;
+    }
+    if (s->rx_trunc) {
+        ctl |= RXD_TR;
+    }
+    raw = grspw_desc_raw(s, ctl);
+    dma_memory_write(&address_space_memory, s->rx_desc_addr, &raw,
+                     sizeof(raw), MEMTXATTRS_UNSPECIFIED);
+    trace_grspw_rx_packet(s->rx_chan, s->rx_desc_addr, s->rx_written);
+
+    ch->rxdesc = grspw_next_desc(s->rx_desc_addr, RXD_SIZE, ctl & RXD_WR);
+    ch->ctrl = (ch->ctrl & ~DMA_RX) | DMA_PR;
+    if ((ctl & RXD_IE) && (ch->ctrl & DMA_RI)) {
+        grspw_irq(s);
+    }
+    s->rx_chan = -1;
+}
+
+/*
+ * Store packet bytes, stripping the address and protocol ID if asked.
+ * The first byte of a packet always comes on its own.
+ */
+static void grspw_rx_data(GRSPWState *s, const uint8_t *buf, uint32_t len)
+{
+    GRSPWChannel *ch = &s->ch[s->rx_chan];
+    uint32_t room;
+
+    if ((s->rx_pos == 0 && (ch->ctrl & DMA_SA)) ||
+        (s->rx_pos == 1 && (ch->ctrl & DMA_SP))) {
+        buf++;
+        len--;
+    }
+
+    room = (ch->rxmax & RXD_LEN_MASK) - s->rx_written;
+    if (len > room) {
+        len = room;
+        s->rx_trunc = true;
+    }
+    if (len && dma_memory_write(&address_space_memory,
+                                s->rx_buf_addr + s->rx_written, buf, len,
+                                MEMTXATTRS_UNSPECIFIED) != MEMTX_OK) {
+        ch->ctrl |= DMA_RA;
+        if (ch->ctrl & DMA_AI) {
+            grspw_irq(s);
+        }
+        len = 0;
+    }
+    s->rx_written += len;
+}
+
+static void grspw_rx_bytes(GRSPWState *s, const uint8_t *buf, uint32_t len)
+{
+    if (s->rx_chan >= 0) {
+        grspw_rx_data(s, buf, len);
+    }
+    s->rx_pos += len;
+    s->rx_left -= len;
+    if (!s->rx_left) {
+        grspw_rx_finish(s);
+    }
+}
+
+static int grspw_can_receive(void *opaque)
+{
+    GRSPWState *s = opaque;
+
+    if (s->rx_waiting) {
+        return 0;
+    } else if (!s->rx_left) {
+        return HDR_SIZE - s->rx_hdr_len;
+    } else if (!s->rx_started) {
+        /* The destination address selects where the rest goes */
+        return 1;
+    }
+    return s->rx_left;
+}
+
+static void grspw_receive(void *opaque, const uint8_t *buf, int size)
+{
+    GRSPWState *s = opaque;
+
+    while (size > 0 && !s->rx_waiting) {
+        uint32_t n, hdr;
+
+        if (!s->rx_left) {
+            n = MIN(size, HDR_SIZE - s->rx_hdr_len);
+            memcpy(s->rx_hdr + s->rx_hdr_len, buf, n);
+            s->rx_hdr_len += n;
+            buf += n;
+            size -= n;
+            if (s->rx_hdr_len < HDR_SIZE) {
+                break;
+            }
+
+            s->rx_hdr_len = 0;
+            hdr = ldl_be_p(s->rx_hdr);
+            s->rx_type = hdr >> HDR_TYPE_SHIFT;
+            if (s->rx_type == HDR_TIME) {
+                if (grspw_link_running(s) && (s->ctrl & CTRL_TR)) {
+                    s->time = hdr & 0xff;
+                    s->status |= STATUS_TO;
+                    if (s->ctrl & CTRL_TQ) {
+                        grspw_irq(s);
+                    }
+                }
+                continue;
+            }
+            s->rx_left = hdr & HDR_LEN_MASK;
+            s->rx_pos = 0;
+            s->rx_chan = -1;
+            /* Without a running link, the packet is discarded */
+            s->rx_started = !grspw_link_running(s);
+            continue;
+        }
+
+        if (!s->rx_started) {
+            s->rx_dest = buf[0];
+            buf++;
+            size--;
+            if (!grspw_rx_start(s)) {
+                break;
+            }
+            grspw_rx_bytes(s, &s->rx_dest, 1);
+            continue;
+        }
+
+        n = MIN(size, s->rx_left);
+        grspw_rx_bytes(s, buf, n);
+        buf += n;
+        size -= n;
+    }
+}
+
+/* Resume a packet that waits for receive descriptors, if it can */
+static void grspw_rx_kick(GRSPWState *s)
+{
+    if (s->rx_waiting) {
+        if (!grspw_rx_start(s)) {
+            return;
+        }
+        grspw_rx_bytes(s, &s->rx_dest, 1);
+    }
+    qemu_chr_fe_accept_input(&s->chr);
+}
+
+static void grspw_event(void *opaque, QEMUChrEvent event)
+{
+    GRSPWState *s = opaque;
+    bool was_running = grspw_link_running(s);
+
+    switch (event) {
+    case CHR_EVENT_OPENED:
+        s->connected = true;
+        break;
+    case CHR_EVENT_CLOSED:
+        s->connected = false;
+        grspw_tx_cancel(s);
+        /* A packet cut short by a link error ends with an EEP */
+        s->rx_type = HDR_EEP;
+        grspw_rx_finish(s);
+        s->rx_hdr_len = 0;
+        s->rx_left = 0;
+        s->rx_waiting = false;
+        break;
+    default:
+        return;
+    }
+
+    trace_grspw_link(s->connected);
+    if (was_running && !grspw_link_running(s)) {
+        s->status |= STATUS_DE;
+        if ((s->ctrl & CTRL_IE) && (s->ctrl & CTRL_LI)) {
+            grspw_irq(s);
+        }
+    } else if (!was_running && grspw_link_running(s)) {
+        if (s->ctrl & CTRL_IE) {
+            grspw_irq(s);
+        }
+        grspw_transmit_all(s);
+    }
+}
+
+/* Registers */
+
+static void grspw_reset_regs(GRSPWState *s)
+{
+    int i;
+
+    s->ctrl = (s->num_channels - 1) << CTRL_NCH_SHIFT;
+    s->status = 0;
+    s->defaddr = 0xfe;
+    s->clkdiv = 0;
+    s->destkey = 0;
+    s->time = 0;
+    for (i = 0; i < GRSPW_MAX_CHANNELS; i++) {
+        GRSPWChannel *ch = &s->ch[i];
+
+        ch->ctrl = 0;
+        ch->rxmax = 0;
+        ch->txdesc = 0;
+        ch->rxdesc = 0;
+        ch->addr = 0xfe;
+        grspw_rx_cache_drop(ch);
+    }
+    s->rx_chan = -1;
+    s->rx_waiting = false;
+    grspw_tx_cancel(s);
+}
+
+static uint64_t grspw_read(void *opaque, hwaddr addr, unsigned size)
+{
+    GRSPWState *s = opaque;
+    GRSPWChannel *ch;
+    uint32_t val = 0;
+
+    switch (addr) {
+    case GRSPW_CTRL:
+        val = s->ctrl;
+        break;
+    case GRSPW_STATUS:
+        val = s->status | grspw_link_state(s) << STATUS_LS_SHIFT;
+        break;
+    case GRSPW_DEFADDR:
+        val = s->defaddr;
+        break;
+    case GRSPW_CLKDIV:
+        val = s->clkdiv;
+        break;
+    case GRSPW_DESTKEY:
+        val = s->destkey;
+        break;
+    case GRSPW_TIME:
+        val = s->time;
+        break;
+    default:
+        if (addr < GRSPW_DMA_BASE ||
+            addr >= GRSPW_DMA_BASE + s->num_channels * GRSPW_DMA_STRIDE) {
+            qemu_log_mask(LOG_GUEST_ERROR,
+                          "%s: bad offset 0x%" HWADDR_PRIx "\n",
+                          __func__, addr);
+            break;
+        }
+        ch = &s->ch[(addr - GRSPW_DMA_BASE) / GRSPW_DMA_STRIDE];
+        switch ((addr - GRSPW_DMA_BASE) % GRSPW_DMA_STRIDE) {
+        case GRSPW_DMA_CTRL:
+            val = ch->ctrl;
+            break;
+        case GRSPW_DMA_RXMAX:
+            val = ch->rxmax;
+            break;
+        case GRSPW_DMA_TXDESC:
+            val = ch->txdesc;
+            break;
+        case GRSPW_DMA_RXDESC:
+            val = ch->rxdesc;
+            break;
+        case GRSPW_DMA_ADDR:
+            val = ch->addr;
+            break;
+        default:
+            break;
+        }
+        break;
+    }
+
+    trace_grspw_read(addr, val);
+    return val;
+}
+
+static void grspw_dma_write(GRSPWState *s, GRSPWChannel *ch, hwaddr reg,
+                            uint32_t val)
+{
+    switch (reg) {
+    case GRSPW_DMA_CTRL:
+        ch->ctrl = (ch->ctrl & ~(DMA_RW_MASK | (val & DMA_W1C_MASK))) |
+                   (val & DMA_RW_MASK);
+        if (ch->ctrl & DMA_TE) {
+            grspw_transmit(s, ch);
+        }
+        if ((ch->ctrl & DMA_RE) && (ch->ctrl & DMA_RD)) {
+            grspw_rx_kick(s);
+        }
+        break;
+    case GRSPW_DMA_RXMAX:
+        ch->rxmax = val & RXD_LEN_MASK & ~3;
+        break;
+    case GRSPW_DMA_TXDESC:
+        ch->txdesc = val & ~(TXD_SIZE - 1);
+        break;
+    case GRSPW_DMA_RXDESC:
+        ch->rxdesc = val & ~(RXD_SIZE - 1);
+        grspw_rx_cache_drop(ch);
+        break;
+    case GRSPW_DMA_ADDR:
+        ch->addr = val & 0xffff;
+        break;
+    default:
+        break;
+    }
+}
+
+static void grspw_write(void *opaque, hwaddr addr, uint64_t value,
+                        unsigned size)
+{
+    GRSPWState *s = opaque;
+    uint32_t val = value;
+    bool was_running = grspw_link_running(s);
+
+    trace_grspw_write(addr, val);
+
+    switch (addr) {
+    case GRSPW_CTRL:
+        if (val & CTRL_RS) {
+            grspw_reset_regs(s);
+            break;
+        }
+        s->ctrl = (s->ctrl & ~CTRL_RW_MASK) | (val & CTRL_RW_MASK);
+        if (val & CTRL_TI) {
+            grspw_send_time(s);
+        }
+        if (!was_running && grspw_link_running(s)) {
+            grspw_transmit_all(s);
+            grspw_rx_kick(s);
+        }
+        break;
+    case GRSPW_STATUS:
+        s->status &= ~(val & STATUS_W1C_MASK);
+        break;
+    case GRSPW_DEFADDR:
+        s->defaddr = val & 0xffff;
+        break;
+    case GRSPW_CLKDIV:
+        s->clkdiv = val & 0xffff;
+        break;
+    case GRSPW_DESTKEY:
+        s->destkey = val & 0xff;
+        break;
+    case GRSPW_TIME:
+        s->time = val & 0xff;
+        break;
+    default:
+        if (addr < GRSPW_DMA_BASE ||
+            addr >= GRSPW_DMA_BASE + s->num_channels * GRSPW_DMA_STRIDE) {
+            qemu_log_mask(LOG_GUEST_ERROR,
+                          "%s: bad offset 0x%" HWADDR_PRIx "\n",
+                          __func__, addr);
+            break;
+        }
+        grspw_dma_write(s, &s->ch[(addr - GRSPW_DMA_BASE) / GRSPW_DMA_STRIDE],
+                        (addr - GRSPW_DMA_BASE) % GRSPW_DMA_STRIDE, val);
+        break;
+    }
+}
+
+static const MemoryRegionOps grspw_ops = {
+    .read = grspw_read,
+    .write = grspw_write,
+    .endianness = DEVICE_NATIVE_ENDIAN,
+    .valid = {
+        .min_access_size = 4,
+        .max_access_size = 4,
+    },
+};
+
+static void grspw_reset(DeviceState *dev)
+{
+    GRSPWState *s = GRLIB_GRSPW(dev);
+
+    grspw_reset_regs(s);
+    s->rx_hdr_len = 0;
+    s->rx_left = 0;
+}
+
+static void grspw_realize(DeviceState *dev, Error **errp)
+{
+    GRSPWState *s = GRLIB_GRSPW(dev);
+    SysBusDevice *sbd = SYS_BUS_DEVICE(dev);
+
+    if (!s->num_channels || s->num_channels > GRSPW_MAX_CHANNELS) {
+        error_setg(errp, "dma-channels must be between 1 and %d",
+                   GRSPW_MAX_CHANNELS);
+        return;
+    }
+
+    memory_region_init_io(&s->iomem, OBJECT(s), &grspw_ops, s,
+                          TYPE_GRLIB_GRSPW, GRSPW_REG_SIZE);
+    sysbus_init_mmio(sbd, &s->iomem);
+    sysbus_init_irq(sbd, &s->irq);
+    s->irq_bh = qemu_bh_new_guarded(grspw_irq_bh, s,
+                                    &dev->mem_reentrancy_guard);
+
+    qemu_chr_fe_set_handlers(&s->chr, grspw_can_receive, grspw_receive,
+                             grspw_event, NULL, s, NULL, true);
+}
+
+static void grspw_unrealize(DeviceState *dev)
+{
+    GRSPWState *s = GRLIB_GRSPW(dev);
+
+    grspw_tx_cancel(s);
+    g_free(s->tx_buf);
+    qemu_chr_fe_deinit(&s->chr, false);
+    qemu_bh_delete(s->irq_bh);
+}
+
+static int grspw_post_load(void *opaque, int version_id)
+{
+    GRSPWState *s = opaque;
+    int i;
+
+    if (s->rx_chan < -1 || s->rx_chan >= (int)s->num_channels ||
+        s->rx_hdr_len >= HDR_SIZE || s->rx_type > HDR_TIME ||
+        s->rx_left > HDR_LEN_MASK || s->rx_pos > HDR_LEN_MASK - s->rx_left ||
+        s->rx_written > s->rx_pos) {
+        return -EINVAL;
+    }
+    if (s->rx_chan >= 0 &&
+        s->rx_written > (s->ch[s->rx_chan].rxmax & RXD_LEN_MASK)) {
+        return -EINVAL;
+    }
+    for (i = 0; i < GRSPW_MAX_CHANNELS; i++) {
+        grspw_rx_cache_drop(&s->ch[i]);
+    }
+    return 0;
+}
+
+static bool grspw_tx_needed(void *opaque)
+{
+    return grspw_tx_busy(opaque);
+}
+
+/* Only the bytes still to be sent go into the stream */
+static int grspw_tx_pre_save(void *opaque)
+{
+    GRSPWState *s = opaque;
+
+    memmove(s->tx_buf, s->tx_buf + s->tx_pos, s->tx_len - s->tx_pos);
+    s->tx_len -= s->tx_pos;
+    s->tx_pos = 0;
+    return 0;
+}
+
+static int grspw_tx_pre_load(void *opaque)
+{
+    GRSPWState *s = opaque;
+
+    /* The buffer is allocated by the stream */
+    grspw_tx_cancel(s);
+    g_free(s->tx_buf);
+    s->tx_buf = NULL;
+    s->tx_size = 0;
+    return 0;
+}
+
+static bool grspw_tx_len_valid(void *opaque, int version_id)
+{
+    GRSPWState *s = opaque;
+
+    return s->tx_len <= GRSPW_TX_MAX;
+}
+
+static int grspw_tx_post_load(void *opaque, int version_id)
+{
+    GRSPWState *s = opaque;
+
+    s->tx_size = s->tx_len;
+    s->tx_pos = 0;
+    if (!grspw_tx_busy(s)) {
+        return 0;
+    }
+    /* Resume sending once the chardev is writable */
+    s->tx_watch = qemu_chr_fe_add_watch(&s->chr, G_IO_OUT | G_IO_HUP,
+                                        grspw_tx_watch, s);
+    if (!s->tx_watch) {
+        grspw_tx_cancel(s);
+    }
+    return 0;
+}
+
+static const VMStateDescription vmstate_grspw_tx = {
+    .name = TYPE_GRLIB_GRSPW "/tx",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .needed = grspw_tx_needed,
+    .pre_save = grspw_tx_pre_save,
+    .pre_load = grspw_tx_pre_load,
+    .post_load = grspw_tx_post_load,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32(tx_len, GRSPWState),
+        VMSTATE_VALIDATE("tx_len is valid", grspw_tx_len_valid),
+        VMSTATE_VBUFFER_ALLOC_UINT32(tx_buf, GRSPWState, 1, NULL, tx_len),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static const VMStateDescription vmstate_grspw_channel = {
+    .name = TYPE_GRLIB_GRSPW "/channel",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32(ctrl, GRSPWChannel),
+        VMSTATE_UINT32(rxmax, GRSPWChannel),
+        VMSTATE_UINT32(txdesc, GRSPWChannel),
+        VMSTATE_UINT32(rxdesc, GRSPWChannel),
+        VMSTATE_UINT32(addr, GRSPWChannel),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static const VMStateDescription vmstate_grspw = {
+    .name = TYPE_GRLIB_GRSPW,
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .post_load = grspw_post_load,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32(ctrl, GRSPWState),
+        VMSTATE_UINT32(status, GRSPWState),
+        VMSTATE_UINT32(defaddr, GRSPWState),
+        VMSTATE_UINT32(clkdiv, GRSPWState),
+        VMSTATE_UINT32(destkey, GRSPWState),
+        VMSTATE_UINT32(time, GRSPWState),
+        VMSTATE_STRUCT_ARRAY(ch, GRSPWState, GRSPW_MAX_CHANNELS, 1,
+                             vmstate_grspw_channel, GRSPWChannel),
+        VMSTATE_BOOL(connected, GRSPWState),
+        VMSTATE_UINT8_ARRAY(rx_hdr, GRSPWState, HDR_SIZE),
+        VMSTATE_UINT32(rx_hdr_len, GRSPWState),
+        VMSTATE_UINT32(rx_left, GRSPWState),
+        VMSTATE_UINT32(rx_type, GRSPWState),
+        VMSTATE_BOOL(rx_started, GRSPWState),
+        VMSTATE_INT32(rx_chan, GRSPWState),
+        VMSTATE_UINT8(rx_dest, GRSPWState),
+        VMSTATE_BOOL(rx_waiting, GRSPWState),
+        VMSTATE_UINT32(rx_pos, GRSPWState),
+        VMSTATE_UINT32(rx_written, GRSPWState),
+        VMSTATE_BOOL(rx_trunc, GRSPWState),
+        VMSTATE_UINT32(rx_desc_ctl, GRSPWState),
+        VMSTATE_UINT32(rx_desc_addr, GRSPWState),
+        VMSTATE_UINT32(rx_buf_addr, GRSPWState),
+        VMSTATE_END_OF_LIST()
+    },
+    .subsections = (const VMStateDescription * const []) {
+        &vmstate_grspw_tx,
+        NULL
+    }
+};
+
+static Property grspw_properties[] = {
+    DEFINE_PROP_CHR("chardev", GRSPWState, chr),
+    DEFINE_PROP_UINT32("dma-channels", GRSPWState, num_channels, 1),
+    DEFINE_PROP_BOOL("big-endian", GRSPWState, big_endian, true),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
+static void grspw_class_init(ObjectClass *klass, void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(klass);
+
+    dc->realize = grspw_realize;
+    dc->unrealize = grspw_unrealize;
+    dc->reset = grspw_reset;
+    dc->vmsd = &vmstate_grspw;
+    device_class_set_props(dc, grspw_properties);
+    set_bit(DEVICE_CATEGORY_NETWORK, dc->categories);
+}
+
+static const TypeInfo grspw_info = {
+    .name          = TYPE_GRLIB_GRSPW,
+    .parent        = TYPE_SYS_BUS_DEVICE,
+    .instance_size = sizeof(GRSPWState),
+    .class_init    = grspw_class_init,
+};
+
+static void grspw_register_types(void)
+{
+    type_register_static(&grspw_info);
+}
+
+type_init(grspw_register_types)
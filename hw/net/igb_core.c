@@ -168,6 +168,18 @@ igb_intmgr_timer_pause(IGBIntrDelayTimer *timer)
     }
 }
 
+/*
+ * An interrupt has just been delivered: start a new throttling interval,
+ * so that the next one is held back by a full EITR period as well.
+ */
+static inline void
+igb_intrmgr_restart_throttling(IGBIntrDelayTimer *timer)
+{
+    if (timer->core->mac[timer->delay_reg] != 0) {
+        igb_intrmgr_rearm_timer(timer);
+    }
+}
+
 static void
 igb_intrmgr_on_msix_throttling_timer(void *opaque)
 {
@@ -176,8 +188,15 @@ igb_intrmgr_on_msix_throttling_timer(void *opaque)
 
     timer->running = false;
 
+    /* Nothing was held back during the interval, so don't notify */
+    if (!timer->postponed) {
+        return;
+    }
+    timer->postponed = false;
+
     trace_e1000e_irq_msix_notify_postponed_vec(idx);
     igb_msix_notify(timer->core, idx);
+    igb_intrmgr_restart_throttling(timer);
 }
 
 static void
@@ -231,7 +250,10 @@ igb_intrmgr_reset(IGBCore *core)
         if (core->eitr[i].running) {
             timer_del(core->eitr[i].timer);
             igb_intrmgr_on_msix_throttling_timer(&core->eitr[i]);
+            timer_del(core->eitr[i].timer);
+            core->eitr[i].running = false;
         }
+        core->eitr[i].postponed = false;
     }
 }
 
@@ -768,6 +790,15 @@ igb_ring_free_descr_num(IGBCore *core, const E1000ERingInfo *r)
     return 0;
 }
 
+/* Free descriptors from the head up to the tail or the end of the ring */
+static inline uint32_t
+igb_ring_contiguous_descr_num(IGBCore *core, const E1000ERingInfo *r)
+{
+    uint32_t end = core->mac[r->dlen] / E1000_RING_DESC_LEN;
+
+    return MIN(igb_ring_free_descr_num(core, r), end - core->mac[r->dh]);
+}
+
 static inline bool
 igb_ring_enabled(IGBCore *core, const E1000ERingInfo *r)
 {
@@ -844,39 +875,29 @@ igb_rx_ring_init(IGBCore *core, E1000E_RxRing *rxr, int idx)
     rxr->i      = &i[idx];
 }
 
-static uint32_t
-igb_txdesc_writeback(IGBCore *core, dma_addr_t base,
-                     union e1000_adv_tx_desc *tx_desc,
-                     const E1000ERingInfo *txi)
+/*
+ * Set DD in @tx_desc if it has to be written back.  The caller writes
+ * back the whole batch of descriptors, or the head pointer when head
+ * write-back is enabled, at once.
+ */
+static bool
+igb_txdesc_writeback(IGBCore *core, union e1000_adv_tx_desc *tx_desc,
+                     const E1000ERingInfo *txi, bool head_wb, uint32_t *eic)
 {
-    PCIDevice *d;
     uint32_t cmd_type_len = le32_to_cpu(tx_desc->read.cmd_type_len);
-    uint64_t tdwba;
-
-    tdwba = core->mac[E1000_TDWBAL(txi->idx) >> 2];
-    tdwba |= (uint64_t)core->mac[E1000_TDWBAH(txi->idx) >> 2] << 32;
 
     if (!(cmd_type_len & E1000_TXD_CMD_RS)) {
-        return 0;
-    }
-
-    d = pcie_sriov_get_vf_at_index(core->owner, txi->idx % 8);
-    if (!d) {
-        d = core->owner;
+        return false;
     }
 
-    if (tdwba & 1) {
-        uint32_t buffer = cpu_to_le32(core->mac[txi->dh]);
-        pci_dma_write(d, tdwba & ~3, &buffer, sizeof(buffer));
-    } else {
+    if (!head_wb) {
         uint32_t status = le32_to_cpu(tx_desc->wb.status) | E1000_TXD_STAT_DD;
 
         tx_desc->wb.status = cpu_to_le32(status);
-        pci_dma_write(d, base + offsetof(union e1000_adv_tx_desc, wb),
-            &tx_desc->wb, sizeof(tx_desc->wb));
     }
 
-    return igb_tx_wb_eic(core, txi->idx);
+    *eic |= igb_tx_wb_eic(core, txi->idx);
+    return true;
 }
 
 static inline bool
@@ -891,14 +912,22 @@ igb_tx_enabled(IGBCore *core, const E1000ERingInfo *txi)
         (core->mac[TXDCTL0 + (qn * 16)] & E1000_TXDCTL_QUEUE_ENABLE);
 }
 
+/*
+ * Descriptors are fetched and written back in batches of up to this many,
+ * with one DMA access per contiguous segment of the ring.
+ */
+#define IGB_DESC_BATCH  (16)
+
 static void
 igb_start_xmit(IGBCore *core, const IGB_TxRing *txr)
 {
     PCIDevice *d;
     dma_addr_t base;
-    union e1000_adv_tx_desc desc;
+    union e1000_adv_tx_desc desc[IGB_DESC_BATCH];
     const E1000ERingInfo *txi = txr->i;
     uint32_t eic = 0;
+    uint32_t i, num, wb_first, wb_last;
+    uint64_t tdwba;
 
     if (!igb_tx_enabled(core, txi)) {
         trace_e1000e_tx_disabled();
@@ -910,17 +939,44 @@ igb_start_xmit(IGBCore *core, const IGB_TxRing *txr)
         d = core->owner;
     }
 
+    tdwba = core->mac[E1000_TDWBAL(txi->idx) >> 2];
+    tdwba |= (uint64_t)core->mac[E1000_TDWBAH(txi->idx) >> 2] << 32;
+
     while (!igb_ring_empty(core, txi)) {
         base = igb_ring_head_descr(core, txi);
+        num = MIN(igb_ring_contiguous_descr_num(core, txi), IGB_DESC_BATCH);
+        num = MAX(num, 1);
+
+        pci_dma_read(d, base, desc, num * sizeof(desc[0]));
+
+        wb_first = num;
+        wb_last = 0;
+        for (i = 0; i < num; i++) {
+            trace_e1000e_tx_descr((void *)(intptr_t)desc[i].read.buffer_addr,
+                                  desc[i].read.cmd_type_len,
+                                  desc[i].wb.status);
+
+            igb_process_tx_desc(core, d, txr->tx, &desc[i], txi->idx);
+            if (igb_txdesc_writeback(core, &desc[i], txi, tdwba & 1, &eic)) {
+                wb_first = MIN(wb_first, i);
+                wb_last = i;
+            }
+        }
 
-        pci_dma_read(d, base, &desc, sizeof(desc));
+        igb_ring_advance(core, txi, num);
 
-        trace_e1000e_tx_descr((void *)(intptr_t)desc.read.buffer_addr,
-                              desc.read.cmd_type_len, desc.wb.status);
+        if (wb_first == num) {
+            continue;
+        }
 
-        igb_process_tx_desc(core, d, txr->tx, &desc, txi->idx);
-        igb_ring_advance(core, txi, 1);
-        eic |= igb_txdesc_writeback(core, base, &desc, txi);
+        if (tdwba & 1) {
+            uint32_t buffer = cpu_to_le32(core->mac[txi->dh]);
+            pci_dma_write(d, tdwba & ~3, &buffer, sizeof(buffer));
+        } else {
+            pci_dma_write(d, base + wb_first * sizeof(desc[0]),
+                          &desc[wb_first],
+                          (wb_last - wb_first + 1) * sizeof(desc[0]));
+        }
     }
 
     if (eic) {
@@ -1608,35 +1664,64 @@ igb_write_rx_descr(IGBCore *core,
     }
 }
 
-static inline void
-igb_pci_dma_write_rx_desc(IGBCore *core, PCIDevice *dev, dma_addr_t addr,
-                          union e1000_rx_desc_union *desc, dma_addr_t len)
+/* Clear DD in @desc and return whether it was set */
+static inline bool
+igb_rx_desc_clear_dd(IGBCore *core, union e1000_rx_desc_union *desc)
 {
+    bool dd;
+
     if (igb_rx_use_legacy_descriptor(core)) {
-        struct e1000_rx_desc *d = &desc->legacy;
-        size_t offset = offsetof(struct e1000_rx_desc, status);
-        uint8_t status = d->status;
+        dd = desc->legacy.status & E1000_RXD_STAT_DD;
+        desc->legacy.status &= ~E1000_RXD_STAT_DD;
+    } else {
+        dd = desc->adv.wb.upper.status_error & E1000_RXD_STAT_DD;
+        desc->adv.wb.upper.status_error &= ~E1000_RXD_STAT_DD;
+    }
 
-        d->status &= ~E1000_RXD_STAT_DD;
-        pci_dma_write(dev, addr, desc, len);
+    return dd;
+}
 
-        if (status & E1000_RXD_STAT_DD) {
-            d->status = status;
-            pci_dma_write(dev, addr + offset, &status, sizeof(status));
-        }
-    } else {
-        union e1000_adv_rx_desc *d = &desc->adv;
-        size_t offset =
-            offsetof(union e1000_adv_rx_desc, wb.upper.status_error);
-        uint32_t status = d->wb.upper.status_error;
+static void
+igb_pci_dma_read_rx_descs(IGBCore *core, PCIDevice *dev, dma_addr_t addr,
+                          union e1000_rx_desc_union *desc, uint32_t num)
+{
+    uint8_t buf[IGB_DESC_BATCH * sizeof(union e1000_rx_desc_union)];
+    size_t len = core->rx_desc_len;
+    uint32_t i;
+
+    pci_dma_read(dev, addr, buf, num * len);
+    for (i = 0; i < num; i++) {
+        memcpy(&desc[i], buf + i * len, len);
+    }
+}
+
+/*
+ * Write back @num descriptors.  The DD bits only go out with a second
+ * write, so that the guest never sees DD set in a descriptor that is
+ * partially written.
+ */
+static void
+igb_pci_dma_write_rx_descs(IGBCore *core, PCIDevice *dev, dma_addr_t addr,
+                           union e1000_rx_desc_union *desc, uint32_t num)
+{
+    uint8_t buf[IGB_DESC_BATCH * sizeof(union e1000_rx_desc_union)];
+    size_t len = core->rx_desc_len;
+    bool dd = false;
+    uint32_t i;
 
-        d->wb.upper.status_error &= ~E1000_RXD_STAT_DD;
-        pci_dma_write(dev, addr, desc, len);
+    for (i = 0; i < num; i++) {
+        union e1000_rx_desc_union d = desc[i];
 
-        if (status & E1000_RXD_STAT_DD) {
-            d->wb.upper.status_error = status;
-            pci_dma_write(dev, addr + offset, &status, sizeof(status));
+        dd |= igb_rx_desc_clear_dd(core, &d);
+        memcpy(buf + i * len, &d, len);
+    }
+    pci_dma_write(dev, addr, buf, num * len);
+
+    if (dd) {
+        for (i = 0; i < num; i++) {
+            memcpy(buf + i * len, &desc[i], len);
         }
+        pci_dma_write(dev, addr, buf, num * len);
     }
 }
 
@@ -1916,10 +2001,12 @@ igb_write_packet_to_guest(IGBCore *core, struct NetRxPkt *pkt,
                           uint16_t etqf, bool ts)
 {
     PCIDevice *d;
-    dma_addr_t base;
-    union e1000_rx_desc_union desc;
+    dma_addr_t base = 0;
+    union e1000_rx_desc_union desc[IGB_DESC_BATCH];
     const E1000ERingInfo *rxi;
     size_t rx_desc_len;
+    uint32_t step;
+    uint32_t num = 0, cur = 0;
 
     IGBPacketRxDMAState pdma_st = {0};
     pdma_st.is_first = true;
@@ -1928,6 +2015,7 @@ igb_write_packet_to_guest(IGBCore *core, struct NetRxPkt *pkt,
 
     rxi = rxr->i;
     rx_desc_len = core->rx_desc_len;
+    step = rx_desc_len / E1000_MIN_RX_DESC_LEN;
     pdma_st.rx_desc_packet_buf_size = igb_rxbufsize(core, rxi);
     pdma_st.rx_desc_header_buf_size = igb_rxhdrbufsize(core, rxi);
     pdma_st.iov = net_rx_pkt_get_iovec(pkt);
@@ -1942,15 +2030,28 @@ igb_write_packet_to_guest(IGBCore *core, struct NetRxPkt *pkt,
         memset(&pdma_st.bastate, 0, sizeof(IGBBAState));
         bool is_last = false;
 
-        if (igb_ring_empty(core, rxi)) {
-            return;
+        if (cur == num) {
+            if (num) {
+                igb_pci_dma_write_rx_descs(core, d, base, desc, num);
+            }
+
+            if (igb_ring_empty(core, rxi)) {
+                return;
+            }
+
+            /* Fetch the descriptors that the rest of the packet needs */
+            base = igb_ring_head_descr(core, rxi);
+            num = DIV_ROUND_UP(pdma_st.total_size - pdma_st.desc_offset,
+                               pdma_st.rx_desc_packet_buf_size);
+            num = MIN(num, igb_ring_contiguous_descr_num(core, rxi) / step);
+            num = MAX(MIN(num, IGB_DESC_BATCH), 1);
+            igb_pci_dma_read_rx_descs(core, d, base, desc, num);
+            cur = 0;
         }
 
-        base = igb_ring_head_descr(core, rxi);
-        pci_dma_read(d, base, &desc, rx_desc_len);
-        trace_e1000e_rx_descr(rxi->idx, base, rx_desc_len);
+        trace_e1000e_rx_descr(rxi->idx, base + cur * rx_desc_len, rx_desc_len);
 
-        igb_read_rx_descr(core, &desc, &pdma_st, rxi);
+        igb_read_rx_descr(core, &desc[cur], &pdma_st, rxi);
 
         igb_write_to_rx_buffers(core, pkt, d, &pdma_st);
         pdma_st.desc_offset += pdma_st.desc_size;
@@ -1958,16 +2059,18 @@ igb_write_packet_to_guest(IGBCore *core, struct NetRxPkt *pkt,
             is_last = true;
         }
 
-        igb_write_rx_descr(core, &desc,
+        igb_write_rx_descr(core, &desc[cur],
                            is_last ? pkt : NULL,
                            rss_info,
                            etqf, ts,
                            &pdma_st,
                            rxi);
-        igb_pci_dma_write_rx_desc(core, d, base, &desc, rx_desc_len);
-        igb_ring_advance(core, rxi, rx_desc_len / E1000_MIN_RX_DESC_LEN);
+        cur++;
+        igb_ring_advance(core, rxi, step);
     } while (pdma_st.desc_offset < pdma_st.total_size);
 
+    igb_pci_dma_write_rx_descs(core, d, base, desc, cur);
+
     igb_update_rx_stats(core, rxi, pdma_st.size, pdma_st.total_size);
 }
 
@@ -2262,13 +2365,12 @@ igb_postpone_interrupt(IGBIntrDelayTimer *timer)
 {
     if (timer->running) {
         trace_e1000e_irq_postponed_by_xitr(timer->delay_reg << 2);
+        timer->postponed = true;
 
         return true;
     }
 
-    if (timer->core->mac[timer->delay_reg] != 0) {
-        igb_intrmgr_rearm_timer(timer);
-    }
+    igb_intrmgr_restart_throttling(timer);
 
     return false;
 }
@@ -4579,6 +4681,7 @@ int
 igb_core_post_load(IGBCore *core)
 {
     NetClientState *nc = qemu_get_queue(core->owner_nic);
+    int i;
 
     /*
      * nc.link_down can't be migrated, so infer link_down according
@@ -4586,5 +4689,13 @@ igb_core_post_load(IGBCore *core)
      */
     nc->link_down = (core->mac[STATUS] & E1000_STATUS_LU) == 0;
 
+    /*
+     * Whether an interrupt is held back by EITR isn't migrated; assume
+     * one is, at worst the guest gets a spurious interrupt.
+     */
+    for (i = 0; i < IGB_INTR_NUM; i++) {
+        core->eitr[i].postponed = core->eitr[i].running;
+    }
+
     return 0;
 }
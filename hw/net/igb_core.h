@@ -58,6 +58,7 @@ enum { PHY_R = BIT(0),
 typedef struct IGBIntrDelayTimer_st {
     QEMUTimer *timer;
     bool running;
+    bool postponed;
     uint32_t delay_reg;
     uint32_t delay_resolution_ns;
     IGBCore *core;
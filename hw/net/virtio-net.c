@@ -13,6 +13,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu/atomic.h"
+#include "qemu/defer-call.h"
 #include "qemu/iov.h"
 #include "qemu/log.h"
 #include "qemu/main-loop.h"
@@ -1457,22 +1458,27 @@ static uint16_t virtio_net_handle_rss(VirtIONet *n,
     }
     n->rss_data.enabled = true;
 
-    if (!n->rss_data.populate_hash) {
-        if (!virtio_net_attach_epbf_rss(n)) {
-            /* EBPF must be loaded for vhost */
-            if (get_vhost_net(qemu_get_queue(n->nic)->peer)) {
-                warn_report("Can't load eBPF RSS for vhost");
-                goto error;
-            }
-            /* fallback to software RSS */
-            warn_report("Can't load eBPF RSS - fallback to software RSS");
-            n->rss_data.enabled_software_rss = true;
-        }
-    } else {
+    /*
+     * eBPF only selects the queue, so hash reports are always computed in
+     * software.  Still let the backend steer packets in that case, so that
+     * they arrive on the right queue instead of being redirected here.
+     */
+    if (virtio_net_attach_epbf_rss(n)) {
+        n->rss_data.enabled_software_rss = n->rss_data.populate_hash;
+    } else if (n->rss_data.populate_hash) {
         /* use software RSS for hash populating */
         /* and detach eBPF if was loaded before */
         virtio_net_detach_epbf_rss(n);
         n->rss_data.enabled_software_rss = true;
+    } else {
+        /* EBPF must be loaded for vhost */
+        if (get_vhost_net(qemu_get_queue(n->nic)->peer)) {
+            warn_report("Can't load eBPF RSS for vhost");
+            goto error;
+        }
+        /* fallback to software RSS */
+        warn_report("Can't load eBPF RSS - fallback to software RSS");
+        n->rss_data.enabled_software_rss = true;
     }
 
     trace_virtio_net_rss_enable(n->rss_data.hash_types,
@@ -1888,6 +1894,28 @@ static int virtio_net_process_rss(NetClientState *nc, const uint8_t *buf,
     return (index == new_index) ? -1 : new_index;
 }
 
+static VirtQueueElement *virtio_net_rx_pop(VirtIONetQueue *q, size_t i)
+{
+    if (i < VIRTIO_NET_RX_SLOTS) {
+        void *slot = q->rx_slots + i * q->rx_slot_size;
+
+        if (virtqueue_pop_batch(q->rx_vq, sizeof(VirtQueueElement), slot,
+                                q->rx_slot_size, 1)) {
+            return slot;
+        }
+    }
+    return virtqueue_pop(q->rx_vq, sizeof(VirtQueueElement));
+}
+
+static void virtio_net_rx_free(VirtIONetQueue *q, VirtQueueElement *elem)
+{
+    void *slots_end = q->rx_slots + VIRTIO_NET_RX_SLOTS * q->rx_slot_size;
+
+    if ((void *)elem < q->rx_slots || (void *)elem >= slots_end) {
+        g_free(elem);
+    }
+}
+
 static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
                                       size_t size, bool no_rss)
 {
@@ -1895,7 +1923,7 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
     VirtIONetQueue *q = virtio_net_get_subqueue(nc);
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
     VirtQueueElement *elems[VIRTQUEUE_MAX_SIZE];
-    size_t lens[VIRTQUEUE_MAX_SIZE];
+    unsigned int lens[VIRTQUEUE_MAX_SIZE];
     struct iovec mhdr_sg[VIRTQUEUE_MAX_SIZE];
     struct virtio_net_hdr_mrg_rxbuf mhdr;
     unsigned mhdr_cnt = 0;
@@ -1937,7 +1965,7 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
             goto err;
         }
 
-        elem = virtqueue_pop(q->rx_vq, sizeof(VirtQueueElement));
+        elem = virtio_net_rx_pop(q, i);
         if (!elem) {
             if (i) {
                 virtio_error(vdev, "virtio-net unexpected empty queue: "
@@ -1956,7 +1984,7 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
             virtio_error(vdev,
                          "virtio-net receive queue contains no in buffers");
             virtqueue_detach_element(q->rx_vq, elem, 0);
-            g_free(elem);
+            virtio_net_rx_free(q, elem);
             err = -1;
             goto err;
         }
@@ -1994,7 +2022,7 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
          * Otherwise, drop it. */
         if (!n->mergeable_rx_bufs && offset < size) {
             virtqueue_unpop(q->rx_vq, elem, total);
-            g_free(elem);
+            virtio_net_rx_free(q, elem);
             err = size;
             goto err;
         }
@@ -2011,13 +2039,11 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
                      &mhdr.num_buffers, sizeof mhdr.num_buffers);
     }
 
+    /* signal other side */
+    virtqueue_push_batch(q->rx_vq, elems, lens, i);
     for (j = 0; j < i; j++) {
-        /* signal other side */
-        virtqueue_fill(q->rx_vq, elems[j], lens[j], j);
-        g_free(elems[j]);
+        virtio_net_rx_free(q, elems[j]);
     }
-
-    virtqueue_flush(q->rx_vq, i);
     virtio_notify(vdev, q->rx_vq);
 
     return size;
@@ -2025,7 +2051,7 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
 err:
     for (j = 0; j < i; j++) {
         virtqueue_detach_element(q->rx_vq, elems[j], lens[j]);
-        g_free(elems[j]);
+        virtio_net_rx_free(q, elems[j]);
     }
 
     return err;
@@ -2678,7 +2704,7 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
 }
 
 /* TX */
-static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
+static int32_t virtio_net_do_flush_tx(VirtIONetQueue *q)
 {
     VirtIONet *n = q->n;
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
@@ -2753,8 +2779,19 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
             out_sg = sg;
         }
 
-        ret = qemu_sendv_packet_async(qemu_get_subqueue(n->nic, queue_index),
-                                      out_sg, out_num, virtio_net_tx_complete);
+        /*
+         * Unless the header was swapped into @vhdr, everything points to
+         * guest memory, which stays mapped until virtio_net_tx_complete().
+         */
+        if (n->has_vnet_hdr && n->needs_vnet_hdr_swap) {
+            ret = qemu_sendv_packet_async(
+                qemu_get_subqueue(n->nic, queue_index),
+                out_sg, out_num, virtio_net_tx_complete);
+        } else {
+            ret = qemu_sendv_packet_async_nocopy(
+                qemu_get_subqueue(n->nic, queue_index),
+                out_sg, out_num, virtio_net_tx_complete);
+        }
         if (ret == 0) {
             virtio_queue_set_notification(q->tx_vq, 0);
             q->async_tx.elem = elem;
@@ -2773,6 +2810,18 @@ drop:
     return num_packets;
 }
 
+static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
+{
+    int32_t ret;
+
+    /* Let the backend write out the whole burst at once */
+    defer_call_begin();
+    ret = virtio_net_do_flush_tx(q);
+    defer_call_end();
+
+    return ret;
+}
+
 static void virtio_net_tx_timer(void *opaque);
 
 static void virtio_net_handle_tx_timer(VirtIODevice *vdev, VirtQueue *vq)
@@ -2947,6 +2996,10 @@ static void virtio_net_add_queue(VirtIONet *n, int index)
                                                   &DEVICE(vdev)->mem_reentrancy_guard);
     }
 
+    n->vqs[index].rx_slot_size =
+        virtqueue_element_size(sizeof(VirtQueueElement), VIRTIO_NET_RX_SLOT_SG);
+    n->vqs[index].rx_slots = g_malloc(VIRTIO_NET_RX_SLOTS *
+                                      n->vqs[index].rx_slot_size);
     n->vqs[index].tx_waiting = 0;
     n->vqs[index].n = n;
 }
@@ -2969,6 +3022,8 @@ static void virtio_net_del_queue(VirtIONet *n, int index)
     }
     q->tx_waiting = 0;
     virtio_del_queue(vdev, index * 2 + 1);
+    g_free(q->rx_slots);
+    q->rx_slots = NULL;
 }
 
 static void virtio_net_change_num_queue_pairs(VirtIONet *n, int new_max_queue_pairs)
@@ -3078,15 +3133,13 @@ static int virtio_net_post_load_device(void *opaque, int version_id)
 
     if (n->rss_data.enabled) {
         n->rss_data.enabled_software_rss = n->rss_data.populate_hash;
-        if (!n->rss_data.populate_hash) {
-            if (!virtio_net_attach_epbf_rss(n)) {
-                if (get_vhost_net(qemu_get_queue(n->nic)->peer)) {
-                    warn_report("Can't post-load eBPF RSS for vhost");
-                } else {
-                    warn_report("Can't post-load eBPF RSS - "
-                                "fallback to software RSS");
-                    n->rss_data.enabled_software_rss = true;
-                }
+        if (!virtio_net_attach_epbf_rss(n) && !n->rss_data.populate_hash) {
+            if (get_vhost_net(qemu_get_queue(n->nic)->peer)) {
+                warn_report("Can't post-load eBPF RSS for vhost");
+            } else {
+                warn_report("Can't post-load eBPF RSS - "
+                            "fallback to software RSS");
+                n->rss_data.enabled_software_rss = true;
             }
         }
 
@@ -201,6 +201,8 @@
 #include "sysemu/sysemu.h"
 #include "sysemu/block-backend.h"
 #include "sysemu/hostmem.h"
+#include "block/aio-wait.h"
+#include "hw/block/iothread-vq-mapping.h"
 #include "hw/pci/msix.h"
 #include "hw/pci/pcie_sriov.h"
 #include "migration/vmstate.h"
@@ -254,6 +256,8 @@ static const uint32_t nvme_feature_cap[NVME_FID_MAX] = {
     [NVME_ERROR_RECOVERY]           = NVME_FEAT_CAP_CHANGE | NVME_FEAT_CAP_NS,
     [NVME_VOLATILE_WRITE_CACHE]     = NVME_FEAT_CAP_CHANGE,
     [NVME_NUMBER_OF_QUEUES]         = NVME_FEAT_CAP_CHANGE,
+    [NVME_INTERRUPT_COALESCING]     = NVME_FEAT_CAP_CHANGE,
+    [NVME_INTERRUPT_VECTOR_CONF]    = NVME_FEAT_CAP_CHANGE,
     [NVME_ASYNCHRONOUS_EVENT_CONF]  = NVME_FEAT_CAP_CHANGE,
     [NVME_TIMESTAMP]                = NVME_FEAT_CAP_CHANGE,
     [NVME_HOST_BEHAVIOR_SUPPORT]    = NVME_FEAT_CAP_CHANGE,
@@ -634,14 +638,37 @@ static void nvme_inc_sq_head(NvmeSQueue *sq)
     sq->head = (sq->head + 1) % sq->size;
 }
 
+/* The head is written by nvme_process_db() with the BQL held */
 static uint8_t nvme_cq_full(NvmeCQueue *cq)
 {
-    return (cq->tail + 1) % cq->size == cq->head;
+    return (cq->tail + 1) % cq->size == qatomic_read(&cq->head);
 }
 
+/* The tail is written by nvme_process_db() with the BQL held */
 static uint8_t nvme_sq_empty(NvmeSQueue *sq)
 {
-    return sq->head == sq->tail;
+    return sq->head == qatomic_read(&sq->tail);
+}
+
+static bool nvme_cq_in_iothread(NvmeCQueue *cq)
+{
+    return cq->ctx != qemu_get_aio_context();
+}
+
+/*
+ * Run @cb in @ctx and wait for it to finish.  Used to tear down state that
+ * is owned by a queue running in an iothread.
+ *
+ * Context: BQL held
+ */
+static void nvme_run_in_aio_context(AioContext *ctx, QEMUBHFunc *cb,
+                                    void *opaque)
+{
+    if (ctx == qemu_get_aio_context()) {
+        cb(opaque);
+    } else {
+        aio_wait_bh_oneshot(ctx, cb, opaque);
+    }
 }
 
 static void nvme_irq_check(NvmeCtrl *n)
@@ -664,7 +691,10 @@ static void nvme_irq_assert(NvmeCtrl *n, NvmeCQueue *cq)
     PCIDevice *pci = PCI_DEVICE(n);
 
     if (cq->irq_enabled) {
-        if (msix_enabled(pci)) {
+        if (nvme_cq_in_iothread(cq) && !bql_locked()) {
+            /* see nvme_cq_irq_notifier() */
+            event_notifier_set(&cq->irq_notifier);
+        } else if (msix_enabled(pci)) {
             trace_pci_nvme_irq_msix(cq->vector);
             msix_notify(pci, cq->vector);
         } else {
@@ -680,12 +710,17 @@ static void nvme_irq_assert(NvmeCtrl *n, NvmeCQueue *cq)
 
 static void nvme_irq_deassert(NvmeCtrl *n, NvmeCQueue *cq)
 {
+    /* iothread queues require MSI-X, there is nothing to deassert */
+    if (nvme_cq_in_iothread(cq) && !bql_locked()) {
+        return;
+    }
+
     if (cq->irq_enabled) {
         if (msix_enabled(PCI_DEVICE(n))) {
             return;
         } else {
             assert(cq->vector < 32);
-            if (!n->cq_pending) {
+            if (!qatomic_read(&n->cq_pending)) {
                 n->irq_status &= ~(1 << cq->vector);
             }
             nvme_irq_check(n);
@@ -1466,11 +1501,11 @@ static inline void nvme_blk_write(BlockBackend *blk, int64_t offset,
     }
 }
 
-static void nvme_update_cq_eventidx(const NvmeCQueue *cq)
+static void nvme_update_cq_eventidx(const NvmeCQueue *cq, uint32_t eventidx)
 {
-    trace_pci_nvme_update_cq_eventidx(cq->cqid, cq->head);
+    trace_pci_nvme_update_cq_eventidx(cq->cqid, eventidx);
 
-    stl_le_pci_dma(PCI_DEVICE(cq->ctrl), cq->ei_addr, cq->head,
+    stl_le_pci_dma(PCI_DEVICE(cq->ctrl), cq->ei_addr, eventidx,
                    MEMTXATTRS_UNSPECIFIED);
 }
 
@@ -1482,12 +1517,64 @@ static void nvme_update_cq_head(NvmeCQueue *cq)
     trace_pci_nvme_update_cq_head(cq->cqid, cq->head);
 }
 
+/*
+ * Return true if the interrupt for @posted new entries in @cq should be
+ * delayed according to the Interrupt Coalescing feature.  Coalescing never
+ * applies to the admin queue.
+ */
+static bool nvme_cq_coalesce(NvmeCtrl *n, NvmeCQueue *cq, uint32_t posted)
+{
+    uint16_t intc = n->features.int_coalescing;
+    uint8_t thr = NVME_INTC_THR(intc);
+    uint8_t time = NVME_INTC_TIME(intc);
+
+    if (!cq->cqid || !cq->irq_enabled || !thr || !time ||
+        test_bit(cq->vector, n->features.intvc_cd)) {
+        return false;
+    }
+
+    if (!posted) {
+        /* the timer raises the interrupt if one is still pending */
+        return cq->coalesced != 0;
+    }
+
+    /* the aggregation threshold is a 0's based value */
+    cq->coalesced += posted;
+    if (cq->coalesced > thr) {
+        cq->coalesced = 0;
+        timer_del(cq->coalesce_timer);
+        return false;
+    }
+
+    trace_pci_nvme_irq_coalesced(cq->cqid, cq->coalesced);
+
+    if (!timer_pending(cq->coalesce_timer)) {
+        int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+
+        timer_mod(cq->coalesce_timer, now + time * 100 * SCALE_US);
+    }
+
+    return true;
+}
+
+/* The aggregation time has passed, runs in the AioContext of the queue */
+static void nvme_cq_coalesce_timer_cb(void *opaque)
+{
+    NvmeCQueue *cq = opaque;
+
+    cq->coalesced = 0;
+    if (cq->tail != cq->head) {
+        nvme_irq_assert(cq->ctrl, cq);
+    }
+}
+
 static void nvme_post_cqes(void *opaque)
 {
     NvmeCQueue *cq = opaque;
     NvmeCtrl *n = cq->ctrl;
     NvmeRequest *req, *next;
     bool pending = cq->head != cq->tail;
+    uint32_t posted = 0;
     int ret;
 
     QTAILQ_FOREACH_SAFE(req, &cq->req_list, entry, next) {
@@ -1495,7 +1582,7 @@ static void nvme_post_cqes(void *opaque)
         hwaddr addr;
 
         if (n->dbbuf_enabled) {
-            nvme_update_cq_eventidx(cq);
+            nvme_update_cq_eventidx(cq, cq->head);
             nvme_update_cq_head(cq);
         }
 
@@ -1520,13 +1607,28 @@ static void nvme_post_cqes(void *opaque)
         nvme_inc_cq_tail(cq);
         nvme_sg_unmap(&req->sg);
         QTAILQ_INSERT_TAIL(&sq->req_list, req, entry);
+        posted++;
+    }
+
+    /*
+     * Unless completions are waiting for room in the queue, or the pin-based
+     * interrupt has to be deasserted, the head is only needed when posting.
+     * Move the event index out of reach so that the guest can consume the
+     * entries without ringing the head doorbell.
+     */
+    if (posted && n->dbbuf_enabled && cq->cqid && QTAILQ_EMPTY(&cq->req_list) &&
+        msix_enabled(PCI_DEVICE(n))) {
+        nvme_update_cq_eventidx(cq, cq->tail);
     }
+
     if (cq->tail != cq->head) {
         if (cq->irq_enabled && !pending) {
-            n->cq_pending++;
+            qatomic_inc(&n->cq_pending);
         }
 
-        nvme_irq_assert(n, cq);
+        if (!nvme_cq_coalesce(n, cq, posted)) {
+            nvme_irq_assert(n, cq);
+        }
     }
 }
 
@@ -4499,7 +4601,7 @@ static void nvme_cq_notifier(EventNotifier *e)
 
     if (cq->tail == cq->head) {
         if (cq->irq_enabled) {
-            n->cq_pending--;
+            qatomic_dec(&n->cq_pending);
         }
 
         nvme_irq_deassert(n, cq);
@@ -4508,6 +4610,16 @@ static void nvme_cq_notifier(EventNotifier *e)
     qemu_bh_schedule(cq->bh);
 }
 
+static void nvme_cq_set_notifier_handler(NvmeCQueue *cq,
+                                         EventNotifierHandler *handler)
+{
+    if (nvme_cq_in_iothread(cq)) {
+        aio_set_event_notifier(cq->ctx, &cq->notifier, handler, NULL, NULL);
+    } else {
+        event_notifier_set_handler(&cq->notifier, handler);
+    }
+}
+
 static int nvme_init_cq_ioeventfd(NvmeCQueue *cq)
 {
     NvmeCtrl *n = cq->ctrl;
@@ -4519,13 +4631,26 @@ static int nvme_init_cq_ioeventfd(NvmeCQueue *cq)
         return ret;
     }
 
-    event_notifier_set_handler(&cq->notifier, nvme_cq_notifier);
+    nvme_cq_set_notifier_handler(cq, nvme_cq_notifier);
     memory_region_add_eventfd(&n->iomem,
                               0x1000 + offset, 4, false, 0, &cq->notifier);
 
     return 0;
 }
 
+/*
+ * Completion queues that run in an iothread raise their interrupt from the
+ * main loop, which holds the BQL that MSI-X and INTx injection need.
+ */
+static void nvme_cq_irq_notifier(EventNotifier *e)
+{
+    NvmeCQueue *cq = container_of(e, NvmeCQueue, irq_notifier);
+
+    if (event_notifier_test_and_clear(e)) {
+        nvme_irq_assert(cq->ctrl, cq);
+    }
+}
+
 static void nvme_sq_notifier(EventNotifier *e)
 {
     NvmeSQueue *sq = container_of(e, NvmeSQueue, notifier);
@@ -4537,6 +4662,16 @@ static void nvme_sq_notifier(EventNotifier *e)
     nvme_process_sq(sq);
 }
 
+static void nvme_sq_set_notifier_handler(NvmeSQueue *sq,
+                                         EventNotifierHandler *handler)
+{
+    if (sq->ctx != qemu_get_aio_context()) {
+        aio_set_event_notifier(sq->ctx, &sq->notifier, handler, NULL, NULL);
+    } else {
+        event_notifier_set_handler(&sq->notifier, handler);
+    }
+}
+
 static int nvme_init_sq_ioeventfd(NvmeSQueue *sq)
 {
     NvmeCtrl *n = sq->ctrl;
@@ -4548,23 +4683,36 @@ static int nvme_init_sq_ioeventfd(NvmeSQueue *sq)
         return ret;
     }
 
-    event_notifier_set_handler(&sq->notifier, nvme_sq_notifier);
+    nvme_sq_set_notifier_handler(sq, nvme_sq_notifier);
     memory_region_add_eventfd(&n->iomem,
                               0x1000 + offset, 4, false, 0, &sq->notifier);
 
     return 0;
 }
 
+/* Stop fetching commands from @sq, runs in the AioContext of the queue */
+static void nvme_stop_sq_bh(void *opaque)
+{
+    NvmeSQueue *sq = opaque;
+
+    if (sq->bh) {
+        qemu_bh_delete(sq->bh);
+        sq->bh = NULL;
+    }
+    if (sq->ioeventfd_enabled) {
+        nvme_sq_set_notifier_handler(sq, NULL);
+    }
+}
+
 static void nvme_free_sq(NvmeSQueue *sq, NvmeCtrl *n)
 {
     uint16_t offset = sq->sqid << 3;
 
     n->sq[sq->sqid] = NULL;
-    qemu_bh_delete(sq->bh);
+    nvme_run_in_aio_context(sq->ctx, nvme_stop_sq_bh, sq);
     if (sq->ioeventfd_enabled) {
         memory_region_del_eventfd(&n->iomem,
                                   0x1000 + offset, 4, false, 0, &sq->notifier);
-        event_notifier_set_handler(&sq->notifier, NULL);
         event_notifier_cleanup(&sq->notifier);
     }
     g_free(sq->io_req);
@@ -4573,13 +4721,31 @@ static void nvme_free_sq(NvmeSQueue *sq, NvmeCtrl *n)
     }
 }
 
+/* Unlink @sq from its completion queue, runs in the AioContext of the queue */
+static void nvme_unlink_sq_bh(void *opaque)
+{
+    NvmeSQueue *sq = opaque;
+    NvmeCQueue *cq = sq->ctrl->cq[sq->cqid];
+    NvmeRequest *r, *next;
+
+    QTAILQ_REMOVE(&cq->sq_list, sq, entry);
+
+    nvme_post_cqes(cq);
+    QTAILQ_FOREACH_SAFE(r, &cq->req_list, entry, next) {
+        if (r->sq == sq) {
+            QTAILQ_REMOVE(&cq->req_list, r, entry);
+            QTAILQ_INSERT_TAIL(&sq->req_list, r, entry);
+        }
+    }
+}
+
 static uint16_t nvme_del_sq(NvmeCtrl *n, NvmeRequest *req)
 {
     NvmeDeleteQ *c = (NvmeDeleteQ *)&req->cmd;
-    NvmeRequest *r, *next;
+    NvmeRequest *r;
     NvmeSQueue *sq;
-    NvmeCQueue *cq;
     uint16_t qid = le16_to_cpu(c->qid);
+    int i;
 
     if (unlikely(!qid || nvme_check_sqid(n, qid))) {
         trace_pci_nvme_err_invalid_del_sq(qid);
@@ -4589,6 +4755,21 @@ static uint16_t nvme_del_sq(NvmeCtrl *n, NvmeRequest *req)
     trace_pci_nvme_del_sq(qid);
 
     sq = n->sq[qid];
+    if (sq->ctx != qemu_get_aio_context()) {
+        /*
+         * The requests of the queue complete in its iothread, so wait for
+         * them instead of cancelling them from here.
+         */
+        nvme_run_in_aio_context(sq->ctx, nvme_stop_sq_bh, sq);
+        for (i = 1; i <= NVME_MAX_NAMESPACES; i++) {
+            NvmeNamespace *ns = nvme_ns(n, i);
+
+            if (ns) {
+                nvme_ns_drain(ns);
+            }
+        }
+    }
+
     while (!QTAILQ_EMPTY(&sq->out_req_list)) {
         r = QTAILQ_FIRST(&sq->out_req_list);
         assert(r->aiocb);
@@ -4598,16 +4779,7 @@ static uint16_t nvme_del_sq(NvmeCtrl *n, NvmeRequest *req)
     assert(QTAILQ_EMPTY(&sq->out_req_list));
 
     if (!nvme_check_cqid(n, sq->cqid)) {
-        cq = n->cq[sq->cqid];
-        QTAILQ_REMOVE(&cq->sq_list, sq, entry);
-
-        nvme_post_cqes(cq);
-        QTAILQ_FOREACH_SAFE(r, &cq->req_list, entry, next) {
-            if (r->sq == sq) {
-                QTAILQ_REMOVE(&cq->req_list, r, entry);
-                QTAILQ_INSERT_TAIL(&sq->req_list, r, entry);
-            }
-        }
+        nvme_run_in_aio_context(sq->ctx, nvme_unlink_sq_bh, sq);
     }
 
     nvme_free_sq(sq, n);
@@ -4635,8 +4807,16 @@ static void nvme_init_sq(NvmeSQueue *sq, NvmeCtrl *n, uint64_t dma_addr,
         QTAILQ_INSERT_TAIL(&(sq->req_list), &sq->io_req[i], entry);
     }
 
-    sq->bh = qemu_bh_new_guarded(nvme_process_sq, sq,
-                                 &DEVICE(sq->ctrl)->mem_reentrancy_guard);
+    assert(n->cq[cqid]);
+    cq = n->cq[cqid];
+    sq->ctx = cq->ctx;
+
+    if (nvme_cq_in_iothread(cq)) {
+        sq->bh = aio_bh_new(sq->ctx, nvme_process_sq, sq);
+    } else {
+        sq->bh = qemu_bh_new_guarded(nvme_process_sq, sq,
+                                     &DEVICE(sq->ctrl)->mem_reentrancy_guard);
+    }
 
     if (n->dbbuf_enabled) {
         sq->db_addr = n->dbbuf_dbs + (sqid << 3);
@@ -4649,8 +4829,6 @@ static void nvme_init_sq(NvmeSQueue *sq, NvmeCtrl *n, uint64_t dma_addr,
         }
     }
 
-    assert(n->cq[cqid]);
-    cq = n->cq[cqid];
     QTAILQ_INSERT_TAIL(&(cq->sq_list), sq, entry);
     n->sq[sqid] = sq;
 }
@@ -4704,10 +4882,10 @@ static void nvme_set_blk_stats(NvmeNamespace *ns, struct nvme_stats *stats)
 {
     BlockAcctStats *s = blk_get_stats(ns->blkconf.blk);
 
-    stats->units_read += s->nr_bytes[BLOCK_ACCT_READ];
-    stats->units_written += s->nr_bytes[BLOCK_ACCT_WRITE];
-    stats->read_commands += s->nr_ops[BLOCK_ACCT_READ];
-    stats->write_commands += s->nr_ops[BLOCK_ACCT_WRITE];
+    stats->units_read += stat64_get(&s->nr_bytes[BLOCK_ACCT_READ]);
+    stats->units_written += stat64_get(&s->nr_bytes[BLOCK_ACCT_WRITE]);
+    stats->read_commands += stat64_get(&s->nr_ops[BLOCK_ACCT_READ]);
+    stats->write_commands += stat64_get(&s->nr_ops[BLOCK_ACCT_WRITE]);
 }
 
 static uint16_t nvme_smart_info(NvmeCtrl *n, uint8_t rae, uint32_t buf_len,
@@ -5209,19 +5387,34 @@ static uint16_t nvme_get_log(NvmeCtrl *n, NvmeRequest *req)
     }
 }
 
+/* Stop posting to @cq, runs in the AioContext of the queue */
+static void nvme_stop_cq_bh(void *opaque)
+{
+    NvmeCQueue *cq = opaque;
+
+    qemu_bh_delete(cq->bh);
+    timer_free(cq->coalesce_timer);
+    if (cq->ioeventfd_enabled) {
+        nvme_cq_set_notifier_handler(cq, NULL);
+    }
+}
+
 static void nvme_free_cq(NvmeCQueue *cq, NvmeCtrl *n)
 {
     PCIDevice *pci = PCI_DEVICE(n);
     uint16_t offset = (cq->cqid << 3) + (1 << 2);
 
     n->cq[cq->cqid] = NULL;
-    qemu_bh_delete(cq->bh);
+    nvme_run_in_aio_context(cq->ctx, nvme_stop_cq_bh, cq);
     if (cq->ioeventfd_enabled) {
         memory_region_del_eventfd(&n->iomem,
                                   0x1000 + offset, 4, false, 0, &cq->notifier);
-        event_notifier_set_handler(&cq->notifier, NULL);
         event_notifier_cleanup(&cq->notifier);
     }
+    if (nvme_cq_in_iothread(cq)) {
+        event_notifier_set_handler(&cq->irq_notifier, NULL);
+        event_notifier_cleanup(&cq->irq_notifier);
+    }
     if (msix_enabled(pci)) {
         msix_vector_unuse(pci, cq->vector);
     }
@@ -5248,7 +5441,7 @@ static uint16_t nvme_del_cq(NvmeCtrl *n, NvmeRequest *req)
     }
 
     if (cq->irq_enabled && cq->tail != cq->head) {
-        n->cq_pending--;
+        qatomic_dec(&n->cq_pending);
     }
 
     nvme_irq_deassert(n, cq);
@@ -5274,8 +5467,14 @@ static void nvme_init_cq(NvmeCQueue *cq, NvmeCtrl *n, uint64_t dma_addr,
     cq->irq_enabled = irq_enabled;
     cq->vector = vector;
     cq->head = cq->tail = 0;
+    cq->ctx = cqid && n->cq_aio_context ? n->cq_aio_context[cqid - 1] :
+                                          qemu_get_aio_context();
     QTAILQ_INIT(&cq->req_list);
     QTAILQ_INIT(&cq->sq_list);
+    if (nvme_cq_in_iothread(cq)) {
+        event_notifier_init(&cq->irq_notifier, 0);
+        event_notifier_set_handler(&cq->irq_notifier, nvme_cq_irq_notifier);
+    }
     if (n->dbbuf_enabled) {
         cq->db_addr = n->dbbuf_dbs + (cqid << 3) + (1 << 2);
         cq->ei_addr = n->dbbuf_eis + (cqid << 3) + (1 << 2);
@@ -5287,8 +5486,14 @@ static void nvme_init_cq(NvmeCQueue *cq, NvmeCtrl *n, uint64_t dma_addr,
         }
     }
     n->cq[cqid] = cq;
-    cq->bh = qemu_bh_new_guarded(nvme_post_cqes, cq,
-                                 &DEVICE(cq->ctrl)->mem_reentrancy_guard);
+    cq->coalesce_timer = aio_timer_new(cq->ctx, QEMU_CLOCK_VIRTUAL, SCALE_NS,
+                                       nvme_cq_coalesce_timer_cb, cq);
+    if (nvme_cq_in_iothread(cq)) {
+        cq->bh = aio_bh_new(cq->ctx, nvme_post_cqes, cq);
+    } else {
+        cq->bh = qemu_bh_new_guarded(nvme_post_cqes, cq,
+                                     &DEVICE(cq->ctrl)->mem_reentrancy_guard);
+    }
 }
 
 static uint16_t nvme_create_cq(NvmeCtrl *n, NvmeRequest *req)
@@ -5328,6 +5533,12 @@ static uint16_t nvme_create_cq(NvmeCtrl *n, NvmeRequest *req)
         trace_pci_nvme_err_invalid_create_cq_vector(vector);
         return NVME_INVALID_IRQ_VECTOR | NVME_DNR;
     }
+    if (unlikely(!msix_enabled(PCI_DEVICE(n)) && n->cq_aio_context &&
+                 NVME_CQ_FLAGS_IEN(qflags))) {
+        /* pin-based interrupts are not supported with iothreads */
+        trace_pci_nvme_err_invalid_create_cq_vector(vector);
+        return NVME_INVALID_IRQ_VECTOR | NVME_DNR;
+    }
     if (unlikely(vector >= n->conf_msix_qsize)) {
         trace_pci_nvme_err_invalid_create_cq_vector(vector);
         return NVME_INVALID_IRQ_VECTOR | NVME_DNR;
@@ -5978,6 +6189,9 @@ static uint16_t nvme_get_feature(NvmeCtrl *n, NvmeRequest *req)
         }
         trace_pci_nvme_getfeat_vwcache(result ? "enabled" : "disabled");
         goto out;
+    case NVME_INTERRUPT_COALESCING:
+        result = n->features.int_coalescing;
+        goto out;
     case NVME_ASYNCHRONOUS_EVENT_CONF:
         result = n->features.async_config;
         goto out;
@@ -6042,7 +6256,9 @@ defaults:
         }
 
         result = iv;
-        if (iv == n->admin_cq.vector) {
+        if (iv == n->admin_cq.vector ||
+            (sel == NVME_GETFEAT_SELECT_CURRENT &&
+             test_bit(iv, n->features.intvc_cd))) {
             result |= NVME_INTVC_NOCOALESCING;
         }
         break;
@@ -6257,6 +6473,26 @@ static uint16_t nvme_set_feature(NvmeCtrl *n, NvmeRequest *req)
         req->cqe.result = cpu_to_le32((n->conf_ioqpairs - 1) |
                                       ((n->conf_ioqpairs - 1) << 16));
         break;
+    case NVME_INTERRUPT_COALESCING:
+        trace_pci_nvme_setfeat_intc(NVME_INTC_THR(dw11), NVME_INTC_TIME(dw11));
+        n->features.int_coalescing = dw11 & 0xffff;
+        break;
+    case NVME_INTERRUPT_VECTOR_CONF: {
+        uint16_t iv = dw11 & 0xffff;
+        bool cd = dw11 & NVME_INTVC_NOCOALESCING;
+
+        if (iv >= n->conf_ioqpairs + 1) {
+            return NVME_INVALID_FIELD | NVME_DNR;
+        }
+
+        trace_pci_nvme_setfeat_intvc(iv, cd);
+        if (cd) {
+            set_bit(iv, n->features.intvc_cd);
+        } else {
+            clear_bit(iv, n->features.intvc_cd);
+        }
+        break;
+    }
     case NVME_ASYNCHRONOUS_EVENT_CONF:
         n->features.async_config = dw11;
         break;
@@ -6405,6 +6641,10 @@ static uint16_t nvme_ns_attachment(NvmeCtrl *n, NvmeRequest *req)
                 return NVME_NS_PRIVATE | NVME_DNR;
             }
 
+            if (!nvme_ns_iothread_capable(ctrl, ns)) {
+                return NVME_NS_CTRL_LIST_INVALID | NVME_DNR;
+            }
+
             nvme_attach_ns(ctrl, ns);
             nvme_select_iocs_ns(ctrl, ns);
 
@@ -6804,9 +7044,38 @@ static uint16_t nvme_virt_mngmt(NvmeCtrl *n, NvmeRequest *req)
     }
 }
 
+/* Runs in the AioContext of the queue */
+static void nvme_dbbuf_config_sq_bh(void *opaque)
+{
+    NvmeSQueue *sq = opaque;
+    NvmeCtrl *n = sq->ctrl;
+
+    /*
+     * CAP.DSTRD is 0, so offset of ith sq db_addr is (i<<3)
+     * nvme_process_db() uses this hard-coded way to calculate
+     * doorbell offsets. Be consistent with that here.
+     */
+    sq->db_addr = n->dbbuf_dbs + (sq->sqid << 3);
+    sq->ei_addr = n->dbbuf_eis + (sq->sqid << 3);
+    stl_le_pci_dma(PCI_DEVICE(n), sq->db_addr, sq->tail,
+                   MEMTXATTRS_UNSPECIFIED);
+}
+
+/* Runs in the AioContext of the queue */
+static void nvme_dbbuf_config_cq_bh(void *opaque)
+{
+    NvmeCQueue *cq = opaque;
+    NvmeCtrl *n = cq->ctrl;
+
+    /* CAP.DSTRD is 0, so offset of ith cq db_addr is (i<<3)+(1<<2) */
+    cq->db_addr = n->dbbuf_dbs + (cq->cqid << 3) + (1 << 2);
+    cq->ei_addr = n->dbbuf_eis + (cq->cqid << 3) + (1 << 2);
+    stl_le_pci_dma(PCI_DEVICE(n), cq->db_addr, cq->head,
+                   MEMTXATTRS_UNSPECIFIED);
+}
+
 static uint16_t nvme_dbbuf_config(NvmeCtrl *n, const NvmeRequest *req)
 {
-    PCIDevice *pci = PCI_DEVICE(n);
     uint64_t dbs_addr = le64_to_cpu(req->cmd.dptr.prp1);
     uint64_t eis_addr = le64_to_cpu(req->cmd.dptr.prp2);
     int i;
@@ -6819,21 +7088,13 @@ static uint16_t nvme_dbbuf_config(NvmeCtrl *n, const NvmeRequest *req)
     /* Save shadow buffer base addr for use during queue creation */
     n->dbbuf_dbs = dbs_addr;
     n->dbbuf_eis = eis_addr;
-    n->dbbuf_enabled = true;
 
     for (i = 0; i < n->params.max_ioqpairs + 1; i++) {
         NvmeSQueue *sq = n->sq[i];
         NvmeCQueue *cq = n->cq[i];
 
         if (sq) {
-            /*
-             * CAP.DSTRD is 0, so offset of ith sq db_addr is (i<<3)
-             * nvme_process_db() uses this hard-coded way to calculate
-             * doorbell offsets. Be consistent with that here.
-             */
-            sq->db_addr = dbs_addr + (i << 3);
-            sq->ei_addr = eis_addr + (i << 3);
-            stl_le_pci_dma(pci, sq->db_addr, sq->tail, MEMTXATTRS_UNSPECIFIED);
+            nvme_run_in_aio_context(sq->ctx, nvme_dbbuf_config_sq_bh, sq);
 
             if (n->params.ioeventfd && sq->sqid != 0) {
                 if (!nvme_init_sq_ioeventfd(sq)) {
@@ -6843,10 +7104,7 @@ static uint16_t nvme_dbbuf_config(NvmeCtrl *n, const NvmeRequest *req)
         }
 
         if (cq) {
-            /* CAP.DSTRD is 0, so offset of ith cq db_addr is (i<<3)+(1<<2) */
-            cq->db_addr = dbs_addr + (i << 3) + (1 << 2);
-            cq->ei_addr = eis_addr + (i << 3) + (1 << 2);
-            stl_le_pci_dma(pci, cq->db_addr, cq->head, MEMTXATTRS_UNSPECIFIED);
+            nvme_run_in_aio_context(cq->ctx, nvme_dbbuf_config_cq_bh, cq);
 
             if (n->params.ioeventfd && cq->cqid != 0) {
                 if (!nvme_init_cq_ioeventfd(cq)) {
@@ -6856,6 +7114,12 @@ static uint16_t nvme_dbbuf_config(NvmeCtrl *n, const NvmeRequest *req)
         }
     }
 
+    /*
+     * Only enable the shadow doorbells once the addresses are set up, queues
+     * that run in an iothread may look at them at any time.
+     */
+    n->dbbuf_enabled = true;
+
     trace_pci_nvme_dbbuf_config(dbs_addr, eis_addr);
 
     return NVME_SUCCESS;
@@ -7082,6 +7346,16 @@ static void nvme_ctrl_reset(NvmeCtrl *n, NvmeResetType rst)
     NvmeNamespace *ns;
     int i;
 
+    /*
+     * Queues in iothreads keep fetching commands while the namespaces are
+     * drained; stop them first.
+     */
+    for (i = 0; i < n->params.max_ioqpairs + 1; i++) {
+        if (n->sq[i] != NULL) {
+            nvme_run_in_aio_context(n->sq[i]->ctx, nvme_stop_sq_bh, n->sq[i]);
+        }
+    }
+
     for (i = 1; i <= NVME_MAX_NAMESPACES; i++) {
         ns = nvme_ns(n, i);
         if (!ns) {
@@ -7626,7 +7900,7 @@ static void nvme_process_db(NvmeCtrl *n, hwaddr addr, int val)
         trace_pci_nvme_mmio_doorbell_cq(cq->cqid, new_head);
 
         start_sqs = nvme_cq_full(cq) ? 1 : 0;
-        cq->head = new_head;
+        qatomic_set(&cq->head, new_head);
         if (!qid && n->dbbuf_enabled) {
             stl_le_pci_dma(pci, cq->db_addr, cq->head, MEMTXATTRS_UNSPECIFIED);
         }
@@ -7640,7 +7914,7 @@ static void nvme_process_db(NvmeCtrl *n, hwaddr addr, int val)
 
         if (cq->tail == cq->head) {
             if (cq->irq_enabled) {
-                n->cq_pending--;
+                qatomic_dec(&n->cq_pending);
             }
 
             nvme_irq_deassert(n, cq);
@@ -7686,7 +7960,7 @@ static void nvme_process_db(NvmeCtrl *n, hwaddr addr, int val)
 
         trace_pci_nvme_mmio_doorbell_sq(sq->sqid, new_tail);
 
-        sq->tail = new_tail;
+        qatomic_set(&sq->tail, new_tail);
         if (!qid && n->dbbuf_enabled) {
             /*
              * The spec states "the host shall also update the controller's
@@ -7823,6 +8097,13 @@ static bool nvme_check_params(NvmeCtrl *n, Error **errp)
         return false;
     }
 
+    if (params->iothread_vq_mapping_list && n->subsys &&
+        n->subsys->endgrp.fdp.enabled) {
+        error_setg(errp, "iothread-vq-mapping is not supported with "
+                   "flexible data placement");
+        return false;
+    }
+
     if (params->sriov_max_vfs) {
         if (!n->subsys) {
             error_setg(errp, "subsystem is required for the use of SR-IOV");
@@ -7922,6 +8203,8 @@ static void nvme_init_state(NvmeCtrl *n)
     n->features.temp_thresh_hi = NVME_TEMPERATURE_WARNING;
     n->starttime_ms = qemu_clock_get_ms(QEMU_CLOCK_VIRTUAL);
     n->aer_reqs = g_new0(NvmeRequest *, n->params.aerl + 1);
+    n->features.intvc_cd = bitmap_new(MAX(n->params.msix_qsize,
+                                          n->params.max_ioqpairs + 1));
     QTAILQ_INIT(&n->aer_queue);
 
     list->numcntl = cpu_to_le16(max_vfs);
@@ -8319,6 +8602,17 @@ static void nvme_realize(PCIDevice *pci_dev, Error **errp)
         return;
     }
 
+    if (n->params.iothread_vq_mapping_list) {
+        n->cq_aio_context = g_new(AioContext *, n->params.max_ioqpairs);
+        if (!iothread_vq_mapping_apply(n->params.iothread_vq_mapping_list,
+                                       n->cq_aio_context,
+                                       n->params.max_ioqpairs, errp)) {
+            g_free(n->cq_aio_context);
+            n->cq_aio_context = NULL;
+            return;
+        }
+    }
+
     qbus_init(&n->bus, sizeof(NvmeBus), TYPE_NVME_BUS, dev, dev->id);
 
     if (nvme_init_subsys(n, errp)) {
@@ -8365,6 +8659,12 @@ static void nvme_exit(PCIDevice *pci_dev)
     g_free(n->cq);
     g_free(n->sq);
     g_free(n->aer_reqs);
+    g_free(n->features.intvc_cd);
+
+    if (n->cq_aio_context) {
+        iothread_vq_mapping_cleanup(n->params.iothread_vq_mapping_list);
+        g_free(n->cq_aio_context);
+    }
 
     if (n->params.cmb_size_mb) {
         g_free(n->cmb.buf);
@@ -8400,6 +8700,8 @@ static Property nvme_props[] = {
     DEFINE_PROP_BOOL("use-intel-id", NvmeCtrl, params.use_intel_id, false),
     DEFINE_PROP_BOOL("legacy-cmb", NvmeCtrl, params.legacy_cmb, false),
     DEFINE_PROP_BOOL("ioeventfd", NvmeCtrl, params.ioeventfd, false),
+    DEFINE_PROP_IOTHREAD_VQ_MAPPING_LIST("iothread-vq-mapping", NvmeCtrl,
+                                         params.iothread_vq_mapping_list),
     DEFINE_PROP_UINT8("zoned.zasl", NvmeCtrl, params.zasl, 0),
     DEFINE_PROP_BOOL("zoned.auto_transition", NvmeCtrl,
                      params.auto_transition_zones, true),
@@ -744,6 +744,12 @@ static void nvme_ns_realize(DeviceState *dev, Error **errp)
         return;
     }
 
+    if (!nvme_ns_iothread_capable(n, ns)) {
+        error_setg(errp, "zoned namespaces are not supported with "
+                   "iothread-vq-mapping");
+        return;
+    }
+
     if (!nsid) {
         for (i = 1; i <= NVME_MAX_NAMESPACES; i++) {
             if (nvme_ns(n, i) || nvme_subsys_ns(subsys, i)) {
@@ -778,7 +784,8 @@ static void nvme_ns_realize(DeviceState *dev, Error **errp)
             for (i = 0; i < ARRAY_SIZE(subsys->ctrls); i++) {
                 NvmeCtrl *ctrl = subsys->ctrls[i];
 
-                if (ctrl && ctrl != SUBSYS_SLOT_RSVD) {
+                if (ctrl && ctrl != SUBSYS_SLOT_RSVD &&
+                    nvme_ns_iothread_capable(ctrl, ns)) {
                     nvme_attach_ns(ctrl, ns);
                 }
             }
@@ -21,6 +21,7 @@
 #include "qemu/uuid.h"
 #include "hw/pci/pci_device.h"
 #include "hw/block/block.h"
+#include "qapi/qapi-types-virtio.h"
 
 #include "block/nvme.h"
 
@@ -470,6 +471,7 @@ typedef struct NvmeSQueue {
     uint64_t    dma_addr;
     uint64_t    db_addr;
     uint64_t    ei_addr;
+    AioContext  *ctx;     /* same as the completion queue */
     QEMUBH      *bh;
     EventNotifier notifier;
     bool        ioeventfd_enabled;
@@ -491,9 +493,15 @@ typedef struct NvmeCQueue {
     uint64_t    dma_addr;
     uint64_t    db_addr;
     uint64_t    ei_addr;
+    AioContext  *ctx;
     QEMUBH      *bh;
     EventNotifier notifier;
     bool        ioeventfd_enabled;
+    /* set by an iothread to raise the interrupt from the main loop */
+    EventNotifier irq_notifier;
+    /* entries posted since the last interrupt, see nvme_cq_coalesce() */
+    uint32_t    coalesced;
+    QEMUTimer   *coalesce_timer;
     QTAILQ_HEAD(, NvmeSQueue) sq_list;
     QTAILQ_HEAD(, NvmeRequest) req_list;
 } NvmeCQueue;
@@ -522,6 +530,7 @@ typedef struct NvmeParams {
     uint16_t sriov_vi_flexible;
     uint8_t  sriov_max_vq_per_vf;
     uint8_t  sriov_max_vi_per_vf;
+    IOThreadVirtQueueMappingList *iothread_vq_mapping_list;
 } NvmeParams;
 
 typedef struct NvmeCtrl {
@@ -552,6 +561,9 @@ typedef struct NvmeCtrl {
     uint64_t    dbbuf_eis;
     bool        dbbuf_enabled;
 
+    /* AioContext of each I/O queue pair, NULL without iothread-vq-mapping */
+    AioContext  **cq_aio_context;
+
     struct {
         MemoryRegion mem;
         uint8_t      *buf;
@@ -594,6 +606,9 @@ typedef struct NvmeCtrl {
 
         uint32_t                async_config;
         NvmeHostBehaviorSupport hbs;
+        uint16_t                int_coalescing;
+        /* vectors with the Coalescing Disable bit set */
+        unsigned long           *intvc_cd;
     } features;
 
     NvmePriCtrlCap  pri_ctrl_cap;
@@ -618,6 +633,15 @@ static inline NvmeNamespace *nvme_ns(NvmeCtrl *n, uint32_t nsid)
     return n->namespaces[nsid];
 }
 
+/*
+ * The zone state of a zoned namespace is not protected against concurrent
+ * access, so it cannot be used from I/O queues that run in iothreads.
+ */
+static inline bool nvme_ns_iothread_capable(NvmeCtrl *n, NvmeNamespace *ns)
+{
+    return !n->cq_aio_context || !ns->params.zoned;
+}
+
 static inline NvmeCQueue *nvme_cq(NvmeRequest *req)
 {
     NvmeSQueue *sq = req->sq;
@@ -0,0 +1,417 @@
+/*
+ * QEMU RISC-V GRLIB NOEL-V generic board
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This board wires the GRLIB APB peripherals already used by the LEON3
+ * machine (APBUART, GPTIMER, IRQMP and the AHB/APB plug and play areas)
+ * to RISC-V harts, following the memory map of the NOEL-V reference
+ * designs.  The harts get a CLINT (or the full ACLINT set) and the
+ * peripherals are routed either through a PLIC or through the IRQMP.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "qemu/error-report.h"
+#include "qapi/error.h"
+#include "hw/boards.h"
+#include "hw/irq.h"
+#include "hw/loader.h"
+#include "hw/sysbus.h"
+#include "hw/qdev-properties.h"
+#include "hw/qdev-properties-system.h"
+#include "target/riscv/cpu.h"
+#include "hw/riscv/riscv_hart.h"
+#include "hw/riscv/noelv.h"
+#include "hw/riscv/boot.h"
+#include "hw/intc/riscv_aclint.h"
+#include "hw/intc/sifive_plic.h"
+#include "hw/intc/grlib_irqmp.h"
+#include "hw/timer/grlib_gptimer.h"
+#include "hw/char/grlib_uart.h"
+#include "hw/misc/grlib_ahb_apb_pnp.h"
+#include "hw/net/grlib_greth.h"
+#include "hw/net/grlib_grspw.h"
+#include "net/net.h"
+#include "sysemu/sysemu.h"
+#include "sysemu/reset.h"
+#include "sysemu/tcg.h"
+
+/* Default system clock.  */
+#define NOELV_CPU_CLK (50 * 1000 * 1000)
+
+#define NOELV_APBUART_FIFO_SIZE 32
+
+static const MemMapEntry noelv_memmap[] = {
+    [NOELV_RAM] =         { 0x00000000, 0xc0000000 },
+    [NOELV_MROM] =        { 0xc0000000,     0x1000 },
+    [NOELV_CLINT] =       { 0xe0000000,    0x10000 },
+    [NOELV_ACLINT_SSWI] = { 0xe0010000,     0x4000 },
+    [NOELV_PLIC] =        { 0xf8000000,  0x4000000 },
+    [NOELV_GPTIMER] =     { 0xfc000000,      0x100 },
+    [NOELV_APBUART] =     { 0xfc001000,      0x100 },
+    [NOELV_IRQMP] =       { 0xfc002000,      0x100 },
+    [NOELV_GRETH] =       { 0xfc003000,      0x100 },
+    [NOELV_GRSPW] =       { 0xfc004000,      0x100 },
+    [NOELV_APB_PNP] =     { 0xfc0ff000,     0x1000 },
+    [NOELV_AHB_PNP] =     { 0xfffff000,     0x1000 },
+};
+
+/*
+ * The IRQMP drives its per-CPU output with the number of the highest
+ * pending interrupt, as expected by the SPARC PIL input.  A RISC-V hart
+ * only has a level sensitive external interrupt line: the guest reads the
+ * IRQMP pending register from its trap handler and acknowledges the
+ * interrupt through the IRQMP clear register.
+ */
+static void noelv_irqmp_set_meip(void *opaque, int n, int level)
+{
+    RISCVCPU *cpu = opaque;
+
+    qemu_set_irq(qdev_get_gpio_in(DEVICE(cpu), IRQ_M_EXT), level != 0);
+}
+
+static qemu_irq noelv_get_irq(NOELVState *s, int irq)
+{
+    if (s->have_irqmp) {
+        return qdev_get_gpio_in(s->irqmp, irq);
+    }
+
+    return qdev_get_gpio_in(s->plic, irq);
+}
+
+static void noelv_board_init(MachineState *machine)
+{
+    const MemMapEntry *memmap = noelv_memmap;
+    NOELVState *s = RISCV_NOELV_MACHINE(machine);
+    MemoryRegion *system_memory = get_system_memory();
+    MemoryRegion *mask_rom = g_new(MemoryRegion, 1);
+    target_ulong start_addr = memmap[NOELV_RAM].base;
+    target_ulong firmware_end_addr = memmap[NOELV_RAM].base;
+    target_ulong kernel_start_addr;
+    uint64_t kernel_entry = 0;
+    bool firmware_loaded = false;
+    char *plic_hart_config;
+    int hart_count = machine->smp.cpus;
+    DeviceState *dev;
+    AHBPnp *ahb_pnp;
+    APBPnp *apb_pnp;
+    int i;
+
+    if (!tcg_enabled() && s->have_aclint) {
+        error_report("'aclint' is only available with TCG acceleration");
+        exit(1);
+    }
+
+    if (!tcg_enabled() && s->park_harts) {
+        error_report("'park-harts' is only available with TCG acceleration");
+        exit(1);
+    }
+
+    if (machine->ram_size > memmap[NOELV_RAM].size) {
+        error_report("Too much memory for this machine: %" PRId64 "MB,"
+                     " maximum %" PRId64 "MB",
+                     machine->ram_size / MiB,
+                     memmap[NOELV_RAM].size / MiB);
+        exit(1);
+    }
+
+    /* Harts, the reset vector is overridden by noelv_machine_reset() */
+    object_initialize_child(OBJECT(machine), "soc", &s->soc,
+                            TYPE_RISCV_HART_ARRAY);
+    object_property_set_str(OBJECT(&s->soc), "cpu-type", machine->cpu_type,
+                            &error_abort);
+    object_property_set_int(OBJECT(&s->soc), "num-harts", hart_count,
+                            &error_abort);
+    object_property_set_int(OBJECT(&s->soc), "resetvec",
+                            memmap[NOELV_MROM].base, &error_abort);
+    sysbus_realize(SYS_BUS_DEVICE(&s->soc), &error_fatal);
+
+    /* Core Local Interruptor (timer and IPI) */
+    riscv_aclint_swi_create(memmap[NOELV_CLINT].base, 0, hart_count, false);
+    riscv_aclint_mtimer_create(memmap[NOELV_CLINT].base +
+                                   RISCV_ACLINT_SWI_SIZE,
+                               RISCV_ACLINT_DEFAULT_MTIMER_SIZE, 0, hart_count,
+                               RISCV_ACLINT_DEFAULT_MTIMECMP,
+                               RISCV_ACLINT_DEFAULT_MTIME,
+                               RISCV_ACLINT_DEFAULT_TIMEBASE_FREQ, true);
+    if (s->have_aclint) {
+        riscv_aclint_swi_create(memmap[NOELV_ACLINT_SSWI].base, 0,
+                                hart_count, true);
+    }
+
+    /* Plug and play areas */
+    ahb_pnp = GRLIB_AHB_PNP(qdev_new(TYPE_GRLIB_AHB_PNP));
+    sysbus_realize_and_unref(SYS_BUS_DEVICE(ahb_pnp), &error_fatal);
+    sysbus_mmio_map(SYS_BUS_DEVICE(ahb_pnp), 0, memmap[NOELV_AHB_PNP].base);
+    for (i = 0; i < hart_count; i++) {
+        grlib_ahb_pnp_add_entry(ahb_pnp, 0, 0, GRLIB_VENDOR_GAISLER,
+                                GRLIB_NOELV_DEV, GRLIB_AHB_MASTER,
+                                GRLIB_CPU_AREA);
+    }
+
+    apb_pnp = GRLIB_APB_PNP(qdev_new(TYPE_GRLIB_APB_PNP));
+    sysbus_realize_and_unref(SYS_BUS_DEVICE(apb_pnp), &error_fatal);
+    sysbus_mmio_map(SYS_BUS_DEVICE(apb_pnp), 0, memmap[NOELV_APB_PNP].base);
+    grlib_ahb_pnp_add_entry(ahb_pnp, memmap[NOELV_APB_PNP].base, 0xFFF,
+                            GRLIB_VENDOR_GAISLER, GRLIB_APBMST_DEV,
+                            GRLIB_AHB_SLAVE, GRLIB_AHBMEM_AREA);
+
+    /* Interrupt controller for the APB peripherals */
+    if (s->have_irqmp) {
+        s->irqmp = qdev_new(TYPE_GRLIB_IRQMP);
+        object_property_set_int(OBJECT(s->irqmp), "ncpus", hart_count,
+                                &error_fatal);
+        sysbus_realize_and_unref(SYS_BUS_DEVICE(s->irqmp), &error_fatal);
+        sysbus_mmio_map(SYS_BUS_DEVICE(s->irqmp), 0,
+                        memmap[NOELV_IRQMP].base);
+
+        for (i = 0; i < hart_count; i++) {
+            qdev_connect_gpio_out_named(s->irqmp, "grlib-irq", i,
+                                        qemu_allocate_irq(noelv_irqmp_set_meip,
+                                                          &s->soc.harts[i],
+                                                          0));
+        }
+
+        grlib_apb_pnp_add_entry(apb_pnp, memmap[NOELV_IRQMP].base, 0xFFF,
+                                GRLIB_VENDOR_GAISLER, GRLIB_IRQMP_DEV,
+                                2, 0, GRLIB_APBIO_AREA);
+    } else {
+        plic_hart_config = riscv_plic_hart_config_string(hart_count);
+        s->plic = sifive_plic_create(memmap[NOELV_PLIC].base,
+                                     plic_hart_config, hart_count, 0,
+                                     NOELV_PLIC_NUM_SOURCES,
+                                     NOELV_PLIC_NUM_PRIORITIES,
+                                     NOELV_PLIC_PRIORITY_BASE,
+                                     NOELV_PLIC_PENDING_BASE,
+                                     NOELV_PLIC_ENABLE_BASE,
+                                     NOELV_PLIC_ENABLE_STRIDE,
+                                     NOELV_PLIC_CONTEXT_BASE,
+                                     NOELV_PLIC_CONTEXT_STRIDE,
+                                     memmap[NOELV_PLIC].size);
+        g_free(plic_hart_config);
+    }
+
+    /* Timers */
+    dev = qdev_new(TYPE_GRLIB_GPTIMER);
+    qdev_prop_set_uint32(dev, "nr-timers", NOELV_GPTIMER_COUNT);
+    qdev_prop_set_uint32(dev, "frequency", NOELV_CPU_CLK);
+    qdev_prop_set_uint32(dev, "irq-line", NOELV_GPTIMER_IRQ);
+    qdev_prop_set_bit(dev, "tickless", true);
+    sysbus_realize_and_unref(SYS_BUS_DEVICE(dev), &error_fatal);
+    sysbus_mmio_map(SYS_BUS_DEVICE(dev), 0, memmap[NOELV_GPTIMER].base);
+    for (i = 0; i < NOELV_GPTIMER_COUNT; i++) {
+        sysbus_connect_irq(SYS_BUS_DEVICE(dev), i,
+                           noelv_get_irq(s, NOELV_GPTIMER_IRQ + i));
+    }
+    grlib_apb_pnp_add_entry(apb_pnp, memmap[NOELV_GPTIMER].base, 0xFFF,
+                            GRLIB_VENDOR_GAISLER, GRLIB_GPTIMER_DEV,
+                            0, NOELV_GPTIMER_IRQ, GRLIB_APBIO_AREA);
+
+    /* UART */
+    dev = qdev_new(TYPE_GRLIB_APB_UART);
+    qdev_prop_set_chr(dev, "chrdev", serial_hd(0));
+    qdev_prop_set_uint32(dev, "tx-fifo-size", NOELV_APBUART_FIFO_SIZE);
+    sysbus_realize_and_unref(SYS_BUS_DEVICE(dev), &error_fatal);
+    sysbus_mmio_map(SYS_BUS_DEVICE(dev), 0, memmap[NOELV_APBUART].base);
+    sysbus_connect_irq(SYS_BUS_DEVICE(dev), 0,
+                       noelv_get_irq(s, NOELV_APBUART_IRQ));
+    grlib_apb_pnp_add_entry(apb_pnp, memmap[NOELV_APBUART].base, 0xFFF,
+                            GRLIB_VENDOR_GAISLER, GRLIB_APBUART_DEV, 1,
+                            NOELV_APBUART_IRQ, GRLIB_APBIO_AREA);
+
+    /* SpaceWire, linked with -global grlib-grspw.chardev=<id> */
+    dev = qdev_new(TYPE_GRLIB_GRSPW);
+    qdev_prop_set_bit(dev, "big-endian", false);
+    sysbus_realize_and_unref(SYS_BUS_DEVICE(dev), &error_fatal);
+    sysbus_mmio_map(SYS_BUS_DEVICE(dev), 0, memmap[NOELV_GRSPW].base);
+    sysbus_connect_irq(SYS_BUS_DEVICE(dev), 0,
+                       noelv_get_irq(s, NOELV_GRSPW_IRQ));
+    grlib_ahb_pnp_add_entry(ahb_pnp, 0, 0, GRLIB_VENDOR_GAISLER,
+                            GRLIB_GRSPW2_DEV, GRLIB_AHB_MASTER,
+                            GRLIB_CPU_AREA);
+    grlib_apb_pnp_add_entry(apb_pnp, memmap[NOELV_GRSPW].base, 0xFFF,
+                            GRLIB_VENDOR_GAISLER, GRLIB_GRSPW2_DEV, 0,
+                            NOELV_GRSPW_IRQ, GRLIB_APBIO_AREA);
+
+    /* Ethernet, only if a NIC is configured */
+    dev = qemu_create_nic_device(TYPE_GRLIB_GRETH, true, NULL);
+    if (dev) {
+        qdev_prop_set_bit(dev, "big-endian", false);
+        sysbus_realize_and_unref(SYS_BUS_DEVICE(dev), &error_fatal);
+        sysbus_mmio_map(SYS_BUS_DEVICE(dev), 0, memmap[NOELV_GRETH].base);
+        sysbus_connect_irq(SYS_BUS_DEVICE(dev), 0,
+                           noelv_get_irq(s, NOELV_GRETH_IRQ));
+        grlib_ahb_pnp_add_entry(ahb_pnp, 0, 0, GRLIB_VENDOR_GAISLER,
+                                GRLIB_GRETH_DEV, GRLIB_AHB_MASTER,
+                                GRLIB_CPU_AREA);
+        grlib_apb_pnp_add_entry(apb_pnp, memmap[NOELV_GRETH].base, 0xFFF,
+                                GRLIB_VENDOR_GAISLER, GRLIB_GRETH_DEV, 0,
+                                NOELV_GRETH_IRQ, GRLIB_APBIO_AREA);
+    }
+
+    /* RAM */
+    memory_region_add_subregion(system_memory, memmap[NOELV_RAM].base,
+                                machine->ram);
+
+    /* Boot ROM */
+    memory_region_init_rom(mask_rom, NULL, "riscv.noelv.mrom",
+                           memmap[NOELV_MROM].size, &error_fatal);
+    memory_region_add_subregion(system_memory, memmap[NOELV_MROM].base,
+                                mask_rom);
+
+    /* Firmware (usually the bare-metal application itself) */
+    if (machine->firmware && strcmp(machine->firmware, "none")) {
+        firmware_end_addr = riscv_load_firmware(machine->firmware,
+                                                memmap[NOELV_RAM].base,
+                                                NULL);
+        firmware_loaded = true;
+    }
+
+    if (machine->kernel_filename) {
+        kernel_start_addr = riscv_calc_kernel_start_addr(&s->soc,
+                                                         firmware_end_addr);
+        kernel_entry = riscv_load_kernel(machine, &s->soc, kernel_start_addr,
+                                         false, NULL);
+        if (!firmware_loaded) {
+            /* No firmware, jump straight into the application. */
+            start_addr = kernel_entry;
+        }
+    }
+
+    /*
+     * There is no code in the boot ROM, only the OpenSBI fw_dynamic info
+     * that a2 points to.  The harts are set up directly at reset.
+     */
+    riscv_rom_copy_firmware_info(machine, memmap[NOELV_MROM].base,
+                                 memmap[NOELV_MROM].size, 0, kernel_entry);
+    s->start_addr = start_addr;
+    s->fw_dyn_addr = memmap[NOELV_MROM].base;
+}
+
+/*
+ * Put every hart straight at the entry point with the registers the
+ * boot ROM of the other RISC-V boards would have set up: a0 holds the
+ * hart ID, a1 the device tree (none here) and a2 the fw_dynamic info.
+ * With park-harts=on, the harts other than hart 0 are left halted until
+ * their CLINT MSIP bit is set, instead of running a wait loop in the
+ * guest; they then start at the same entry point.
+ */
+static void noelv_machine_reset(MachineState *machine, ShutdownCause reason)
+{
+    NOELVState *s = RISCV_NOELV_MACHINE(machine);
+    int i;
+
+    qemu_devices_reset(reason);
+
+    for (i = 0; i < s->soc.num_harts; i++) {
+        RISCVCPU *cpu = &s->soc.harts[i];
+        CPURISCVState *env = &cpu->env;
+
+        env->pc = s->start_addr;
+        env->gpr[xA0] = env->mhartid;
+        env->gpr[xA1] = 0;
+        env->gpr[xA2] = s->fw_dyn_addr;
+
+        if (s->park_harts && i != 0) {
+            /* mstatus.MIE is clear: the IPI wakes the hart up, no trap */
+            env->mie |= MIP_MSIP;
+            CPU(cpu)->halted = 1;
+        }
+    }
+}
+
+static bool noelv_get_aclint(Object *obj, Error **errp)
+{
+    NOELVState *s = RISCV_NOELV_MACHINE(obj);
+
+    return s->have_aclint;
+}
+
+static void noelv_set_aclint(Object *obj, bool value, Error **errp)
+{
+    NOELVState *s = RISCV_NOELV_MACHINE(obj);
+
+    s->have_aclint = value;
+}
+
+static bool noelv_get_irqmp(Object *obj, Error **errp)
+{
+    NOELVState *s = RISCV_NOELV_MACHINE(obj);
+
+    return s->have_irqmp;
+}
+
+static void noelv_set_irqmp(Object *obj, bool value, Error **errp)
+{
+    NOELVState *s = RISCV_NOELV_MACHINE(obj);
+
+    s->have_irqmp = value;
+}
+
+static bool noelv_get_park_harts(Object *obj, Error **errp)
+{
+    NOELVState *s = RISCV_NOELV_MACHINE(obj);
+
+    return s->park_harts;
+}
+
+static void noelv_set_park_harts(Object *obj, bool value, Error **errp)
+{
+    NOELVState *s = RISCV_NOELV_MACHINE(obj);
+
+    s->park_harts = value;
+}
+
+static void noelv_machine_instance_init(Object *obj)
+{
+}
+
+static void noelv_machine_class_init(ObjectClass *oc, void *data)
+{
+    MachineClass *mc = MACHINE_CLASS(oc);
+
+    mc->desc = "RISC-V GRLIB NOEL-V generic board";
+    mc->init = noelv_board_init;
+    mc->reset = noelv_machine_reset;
+    mc->max_cpus = NOELV_CPUS_MAX;
+    mc->default_cpu_type = TYPE_RISCV_CPU_BASE;
+    mc->default_ram_id = "riscv.noelv.ram";
+
+    object_class_property_add_bool(oc, "aclint", noelv_get_aclint,
+                                   noelv_set_aclint);
+    object_class_property_set_description(oc, "aclint",
+                                          "(TCG only) Set on/off to "
+                                          "add the ACLINT SSWI device next "
+                                          "to the CLINT");
+
+    object_class_property_add_bool(oc, "irqmp", noelv_get_irqmp,
+                                   noelv_set_irqmp);
+    object_class_property_set_description(oc, "irqmp",
+                                          "Set on/off to route the APB "
+                                          "interrupts through a GRLIB IRQMP "
+                                          "instead of a PLIC");
+
+    object_class_property_add_bool(oc, "park-harts", noelv_get_park_harts,
+                                   noelv_set_park_harts);
+    object_class_property_set_description(oc, "park-harts",
+                                          "(TCG only) Set on/off to keep "
+                                          "the secondary harts halted until "
+                                          "they get a machine software "
+                                          "interrupt");
+}
+
+static const TypeInfo noelv_machine_typeinfo = {
+    .name       = TYPE_RISCV_NOELV_MACHINE,
+    .parent     = TYPE_MACHINE,
+    .class_init = noelv_machine_class_init,
+    .instance_init = noelv_machine_instance_init,
+    .instance_size = sizeof(NOELVState),
+};
+
+static void noelv_machine_init_register_types(void)
+{
+    type_register_static(&noelv_machine_typeinfo);
+}
+
+type_init(noelv_machine_init_register_types)
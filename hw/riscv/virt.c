@@ -44,6 +44,7 @@
 #include "hw/platform-bus.h"
 #include "chardev/char.h"
 #include "sysemu/device_tree.h"
+#include <libfdt.h>
 #include "sysemu/sysemu.h"
 #include "sysemu/tcg.h"
 #include "sysemu/kvm.h"
@@ -218,15 +219,18 @@ static void create_fdt_socket_cpus(RISCVVirtState *s, int socket,
     MachineState *ms = MACHINE(s);
     bool is_32_bit = riscv_is_32bit(&s->soc[0]);
     uint8_t satp_mode_max;
+    g_autofree uint32_t *cpu_phandles = g_new(uint32_t,
+                                              s->soc[socket].num_harts);
+    int clust_offset;
 
     for (cpu = s->soc[socket].num_harts - 1; cpu >= 0; cpu--) {
         RISCVCPU *cpu_ptr = &s->soc[socket].harts[cpu];
         g_autofree char *cpu_name = NULL;
-        g_autofree char *core_name = NULL;
         g_autofree char *intc_name = NULL;
         g_autofree char *sv_name = NULL;
 
         cpu_phandle = (*phandle)++;
+        cpu_phandles[cpu] = cpu_phandle;
 
         cpu_name = g_strdup_printf("/cpus/cpu@%d",
             s->soc[socket].hartid_base + cpu);
@@ -274,10 +278,29 @@ static void create_fdt_socket_cpus(RISCVVirtState *s, int socket,
             "riscv,cpu-intc");
         qemu_fdt_setprop(ms->fdt, intc_name, "interrupt-controller", NULL, 0);
         qemu_fdt_setprop_cell(ms->fdt, intc_name, "#interrupt-cells", 1);
+    }
+
+    /*
+     * The CPU nodes above go in front of cpu-map, and finding the
+     * cluster by path means skipping all of them.  Doing that for every
+     * core made this quadratic in the number of harts, so look the
+     * cluster up once and add the cores by offset.  Adding nodes inside
+     * the cluster does not move it.
+     */
+    clust_offset = fdt_path_offset(ms->fdt, clust_name);
+    for (cpu = s->soc[socket].num_harts - 1; cpu >= 0; cpu--) {
+        g_autofree char *core_name = g_strdup_printf("core%d", cpu);
+        int offset = fdt_add_subnode(ms->fdt, clust_offset, core_name);
+        int ret = offset;
 
-        core_name = g_strdup_printf("%s/core%d", clust_name, cpu);
-        qemu_fdt_add_subnode(ms->fdt, core_name);
-        qemu_fdt_setprop_cell(ms->fdt, core_name, "cpu", cpu_phandle);
+        if (offset >= 0) {
+            ret = fdt_setprop_cell(ms->fdt, offset, "cpu", cpu_phandles[cpu]);
+        }
+        if (ret < 0) {
+            error_report("%s: Couldn't create %s/%s: %s", __func__,
+                         clust_name, core_name, fdt_strerror(ret));
+            exit(1);
+        }
     }
 }
 
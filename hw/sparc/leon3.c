@@ -46,6 +46,9 @@
 #include "hw/char/grlib_uart.h"
 #include "hw/intc/grlib_irqmp.h"
 #include "hw/misc/grlib_ahb_apb_pnp.h"
+#include "hw/net/grlib_greth.h"
+#include "hw/net/grlib_grspw.h"
+#include "net/net.h"
 
 /* Default system clock.  */
 #define CPU_CLK (40 * 1000 * 1000)
@@ -65,6 +68,12 @@
 #define LEON3_TIMER_IRQ    (6)
 #define LEON3_TIMER_COUNT  (2)
 
+#define LEON3_GRETH_OFFSET (0x80000E00)
+#define LEON3_GRETH_IRQ    (12)
+
+#define LEON3_GRSPW_OFFSET (0x80000A00)
+#define LEON3_GRSPW_IRQ    (10)
+
 #define LEON3_APB_PNP_OFFSET (0x800FF000)
 #define LEON3_AHB_PNP_OFFSET (0xFFFFF000)
 
@@ -209,6 +218,11 @@ static void leon3_set_pil_in(void *opaque, int n, int level)
 
     assert(env != NULL);
 
+    if (env->pil_in == pil_in) {
+        /* interrupt_index only depends on pil_in, nothing to update */
+        return;
+    }
+
     env->pil_in = pil_in;
 
     if (env->pil_in && (env->interrupt_index == 0 ||
@@ -431,6 +445,34 @@ static void leon3_generic_hw_init(MachineState *machine)
     grlib_apb_pnp_add_entry(apb_pnp, LEON3_UART_OFFSET, 0xFFF,
                             GRLIB_VENDOR_GAISLER, GRLIB_APBUART_DEV, 1,
                             LEON3_UART_IRQ, GRLIB_APBIO_AREA);
+
+    /* SpaceWire, linked with -global grlib-grspw.chardev=<id> */
+    dev = qdev_new(TYPE_GRLIB_GRSPW);
+    sysbus_realize_and_unref(SYS_BUS_DEVICE(dev), &error_fatal);
+    sysbus_mmio_map(SYS_BUS_DEVICE(dev), 0, LEON3_GRSPW_OFFSET);
+    sysbus_connect_irq(SYS_BUS_DEVICE(dev), 0,
+                       qdev_get_gpio_in(irqmpdev, LEON3_GRSPW_IRQ));
+    grlib_ahb_pnp_add_entry(ahb_pnp, 0, 0, GRLIB_VENDOR_GAISLER,
+                            GRLIB_GRSPW2_DEV, GRLIB_AHB_MASTER,
+                            GRLIB_CPU_AREA);
+    grlib_apb_pnp_add_entry(apb_pnp, LEON3_GRSPW_OFFSET, 0xFFF,
+                            GRLIB_VENDOR_GAISLER, GRLIB_GRSPW2_DEV, 0,
+                            LEON3_GRSPW_IRQ, GRLIB_APBIO_AREA);
+
+    /* Ethernet, only if a NIC is configured */
+    dev = qemu_create_nic_device(TYPE_GRLIB_GRETH, true, NULL);
+    if (dev) {
+        sysbus_realize_and_unref(SYS_BUS_DEVICE(dev), &error_fatal);
+        sysbus_mmio_map(SYS_BUS_DEVICE(dev), 0, LEON3_GRETH_OFFSET);
+        sysbus_connect_irq(SYS_BUS_DEVICE(dev), 0,
+                           qdev_get_gpio_in(irqmpdev, LEON3_GRETH_IRQ));
+        grlib_ahb_pnp_add_entry(ahb_pnp, 0, 0, GRLIB_VENDOR_GAISLER,
+                                GRLIB_GRETH_DEV, GRLIB_AHB_MASTER,
+                                GRLIB_CPU_AREA);
+        grlib_apb_pnp_add_entry(apb_pnp, LEON3_GRETH_OFFSET, 0xFFF,
+                                GRLIB_VENDOR_GAISLER, GRLIB_GRETH_DEV, 0,
+                                LEON3_GRETH_IRQ, GRLIB_APBIO_AREA);
+    }
 }
 
 static void leon3_generic_machine_init(MachineClass *mc)
@@ -482,23 +482,21 @@ static uint64_t aspeed_smc_flash_read(void *opaque, hwaddr addr, unsigned size)
 {
     AspeedSMCFlash *fl = opaque;
     AspeedSMCState *s = fl->controller;
+    uint8_t buf[8];
     uint64_t ret = 0;
-    int i;
 
     switch (aspeed_smc_flash_mode(fl)) {
     case CTRL_USERMODE:
-        for (i = 0; i < size; i++) {
-            ret |= (uint64_t) ssi_transfer(s->spi, 0x0) << (8 * i);
-        }
+        ssi_transfer_bulk(s->spi, NULL, buf, size);
+        ret = ldn_le_p(buf, size);
         break;
     case CTRL_READMODE:
     case CTRL_FREADMODE:
         aspeed_smc_flash_select(fl);
         aspeed_smc_flash_setup(fl, addr);
 
-        for (i = 0; i < size; i++) {
-            ret |= (uint64_t) ssi_transfer(s->spi, 0x0) << (8 * i);
-        }
+        ssi_transfer_bulk(s->spi, NULL, buf, size);
+        ret = ldn_le_p(buf, size);
 
         aspeed_smc_flash_unselect(fl);
         break;
@@ -148,6 +148,7 @@ static uint64_t npcm7xx_fiu_flash_read(void *opaque, hwaddr addr,
 {
     NPCM7xxFIUFlash *f = opaque;
     NPCM7xxFIUState *fiu = f->fiu;
+    uint8_t buf[8];
     uint64_t value = 0;
     uint32_t drd_cfg;
     int dummy_cycles;
@@ -187,9 +188,8 @@ static uint64_t npcm7xx_fiu_flash_read(void *opaque, hwaddr addr,
         ssi_transfer(fiu->spi, 0);
     }
 
-    for (i = 0; i < size; i++) {
-        value = deposit64(value, 8 * i, 8, ssi_transfer(fiu->spi, 0));
-    }
+    ssi_transfer_bulk(fiu->spi, NULL, buf, size);
+    value = ldn_le_p(buf, size);
 
     trace_npcm7xx_fiu_flash_read(DEVICE(fiu)->canonical_path, fiu->active_cs,
                                  addr, size, value);
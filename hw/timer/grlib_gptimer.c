@@ -32,6 +32,7 @@
 #include "hw/ptimer.h"
 #include "hw/qdev-properties.h"
 #include "qemu/module.h"
+#include "qemu/host-utils.h"
 
 #include "trace.h"
 #include "qom/object.h"
@@ -69,6 +70,14 @@ struct GPTimer {
     int          id;
     GPTimerUnit *unit;
 
+    /*
+     * Tickless mode: while the timer is enabled with its interrupt masked,
+     * no host timer is armed and the counter is derived from the virtual
+     * clock when read.
+     */
+    bool     lazy;
+    int64_t  start_ns;
+
     /* registers */
     uint32_t counter;
     uint32_t reload;
@@ -83,6 +92,8 @@ struct GPTimerUnit {
     uint32_t nr_timers;         /* Number of timers available */
     uint32_t freq_hz;           /* System frequency */
     uint32_t irq_line;          /* Base irq line */
+    bool     tickless;          /* Only arm the timers that can interrupt */
+    uint32_t tick_freq;         /* Timer frequency after the prescaler */
 
     GPTimer *timers;
 
@@ -102,6 +113,53 @@ static void grlib_gptimer_tx_commit(GPTimer *timer)
     ptimer_transaction_commit(timer->ptimer);
 }
 
+/* Counter value of a lazily running timer */
+static uint32_t grlib_gptimer_lazy_count(GPTimer *timer)
+{
+    int64_t  now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    uint64_t ticks;
+
+    assert(timer->lazy);
+
+    ticks = muldiv64(now - timer->start_ns, timer->unit->tick_freq,
+                     NANOSECONDS_PER_SECOND);
+
+    if (ticks <= timer->counter) {
+        return timer->counter - ticks;
+    }
+
+    if (!(timer->config & GPTIMER_RESTART)) {
+        /* Stopped at underflow */
+        return 0;
+    }
+
+    /* The first underflow takes counter + 1 ticks, then reload + 1 each */
+    ticks -= (uint64_t)timer->counter + 1;
+
+    return timer->reload - ticks % ((uint64_t)timer->reload + 1);
+}
+
+/*
+ * Tickless mode only: latch the current counter value in timer->counter,
+ * so that the timer can be reprogrammed from where it is.
+ *
+ * Must be called within grlib_gptimer_tx_begin/commit block
+ */
+static void grlib_gptimer_sync(GPTimer *timer)
+{
+    uint64_t count;
+
+    if (timer->lazy) {
+        timer->counter = grlib_gptimer_lazy_count(timer);
+        timer->lazy = false;
+        /* Keep reading the latched value until the timer is started again */
+        ptimer_set_count(timer->ptimer, (uint64_t)timer->counter + 1);
+    } else if (timer->config & GPTIMER_ENABLE) {
+        count = ptimer_get_count(timer->ptimer);
+        timer->counter = count ? count - 1 : 0;
+    }
+}
+
 /* Must be called within grlib_gptimer_tx_begin/commit block */
 static void grlib_gptimer_enable(GPTimer *timer)
 {
@@ -109,6 +167,7 @@ static void grlib_gptimer_enable(GPTimer *timer)
 
 
     ptimer_stop(timer->ptimer);
+    timer->lazy = false;
 
     if (!(timer->config & GPTIMER_ENABLE)) {
         /* Timer disabled */
@@ -116,6 +175,17 @@ static void grlib_gptimer_enable(GPTimer *timer)
         return;
     }
 
+    if (timer->unit->tickless && !(timer->config & GPTIMER_INT_ENABLE)) {
+        /*
+         * Nobody can observe the underflow but a counter read, don't arm
+         * anything and compute the counter on demand.
+         */
+        trace_grlib_gptimer_lazy(timer->id, timer->counter);
+        timer->lazy = true;
+        timer->start_ns = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+        return;
+    }
+
     /* ptimer is triggered when the counter reach 0 but GPTimer is triggered at
        underflow. Set count + 1 to simulate the GPTimer behavior. */
 
@@ -151,6 +221,18 @@ static void grlib_gptimer_set_scaler(GPTimerUnit *unit, uint32_t scaler)
 
     trace_grlib_gptimer_set_scaler(scaler, value);
 
+    for (i = 0; i < unit->nr_timers; i++) {
+        GPTimer *timer = &unit->timers[i];
+
+        if (timer->lazy) {
+            /* Restart counting from the current value at the new rate */
+            timer->counter = grlib_gptimer_lazy_count(timer);
+            timer->start_ns = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+        }
+    }
+
+    unit->tick_freq = value;
+
     for (i = 0; i < unit->nr_timers; i++) {
         ptimer_transaction_begin(unit->timers[i].ptimer);
         ptimer_set_freq(unit->timers[i].ptimer, value);
@@ -214,7 +296,11 @@ static uint64_t grlib_gptimer_read(void *opaque, hwaddr addr,
         /* GPTimer registers */
         switch (timer_addr) {
         case COUNTER_OFFSET:
-            value = ptimer_get_count(unit->timers[id].ptimer);
+            if (unit->timers[id].lazy) {
+                value = grlib_gptimer_lazy_count(&unit->timers[id]);
+            } else {
+                value = ptimer_get_count(unit->timers[id].ptimer);
+            }
             trace_grlib_gptimer_readl(id, addr, value);
             return value;
 
@@ -301,15 +387,20 @@ static void grlib_gptimer_write(void *opaque, hwaddr addr,
                 value |= unit->timers[id].config & GPTIMER_INT_PENDING;
             }
 
+            grlib_gptimer_tx_begin(&unit->timers[id]);
+            if (unit->tickless) {
+                /* Carry the current count over the new configuration */
+                grlib_gptimer_sync(&unit->timers[id]);
+            }
+
             unit->timers[id].config = value;
 
             /* gptimer_restart calls gptimer_enable, so if "enable" and "load"
                bits are present, we just have to call restart. */
 
-            grlib_gptimer_tx_begin(&unit->timers[id]);
             if (value & GPTIMER_LOAD) {
                 grlib_gptimer_restart(&unit->timers[id]);
-            } else if (value & GPTIMER_ENABLE) {
+            } else if ((value & GPTIMER_ENABLE) || unit->tickless) {
                 grlib_gptimer_enable(&unit->timers[id]);
             }
 
@@ -348,6 +439,7 @@ static void grlib_gptimer_reset(DeviceState *d)
 
     unit->scaler = 0;
     unit->reload = 0;
+    unit->tick_freq = unit->freq_hz;
 
     unit->config  = unit->nr_timers;
     unit->config |= unit->irq_line << 3;
@@ -361,6 +453,7 @@ static void grlib_gptimer_reset(DeviceState *d)
         timer->counter = 0;
         timer->reload = 0;
         timer->config = 0;
+        timer->lazy = false;
         ptimer_transaction_begin(timer->ptimer);
         ptimer_stop(timer->ptimer);
         ptimer_set_count(timer->ptimer, 0);
@@ -407,6 +500,7 @@ static Property grlib_gptimer_properties[] = {
     DEFINE_PROP_UINT32("frequency", GPTimerUnit, freq_hz,   40000000),
     DEFINE_PROP_UINT32("irq-line",  GPTimerUnit, irq_line,  8),
     DEFINE_PROP_UINT32("nr-timers", GPTimerUnit, nr_timers, 2),
+    DEFINE_PROP_BOOL("tickless",    GPTimerUnit, tickless,  false),
     DEFINE_PROP_END_OF_LIST(),
 };
 
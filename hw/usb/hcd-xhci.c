@@ -127,7 +127,6 @@
 
 #define ERDP_EHB        (1<<3)
 
-#define TRB_SIZE 16
 typedef struct XHCITRB {
     uint64_t parameter;
     uint32_t status;
@@ -612,6 +611,52 @@ static inline int xhci_running(XHCIState *xhci)
     return !(xhci->usbsts & USBSTS_HCH);
 }
 
+/* Write the events queued for interrupter @v to the event ring */
+static void xhci_event_batch_flush(XHCIState *xhci, int v)
+{
+    XHCIInterrupter *intr = &xhci->intr[v];
+
+    if (!intr->ev_batch_len) {
+        return;
+    }
+    if (dma_memory_write(xhci->as, intr->ev_batch_addr, intr->ev_batch,
+                         TRB_SIZE * intr->ev_batch_len,
+                         MEMTXATTRS_UNSPECIFIED) != MEMTX_OK) {
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: DMA memory access failed!\n",
+                      __func__);
+        xhci_die(xhci);
+    }
+    intr->ev_batch_len = 0;
+}
+
+/*
+ * Between xhci_event_batch_begin() and xhci_event_batch_end(), events
+ * are queued and written to the event ring with as few DMA accesses as
+ * possible, and each interrupter is raised at most once, at the end.
+ */
+static void xhci_event_batch_begin(XHCIState *xhci)
+{
+    xhci->event_batch++;
+}
+
+static void xhci_event_batch_end(XHCIState *xhci)
+{
+    int v;
+
+    assert(xhci->event_batch);
+    if (--xhci->event_batch) {
+        return;
+    }
+
+    for (v = 0; v < xhci->numintrs; v++) {
+        xhci_event_batch_flush(xhci, v);
+        if (xhci->intr[v].ev_batch_raise) {
+            xhci->intr[v].ev_batch_raise = false;
+            xhci_intr_raise(xhci, v);
+        }
+    }
+}
+
 static void xhci_write_event(XHCIState *xhci, XHCIEvent *event, int v)
 {
     XHCIInterrupter *intr = &xhci->intr[v];
@@ -632,8 +677,20 @@ static void xhci_write_event(XHCIState *xhci, XHCIEvent *event, int v)
                                ev_trb.status, ev_trb.control);
 
     addr = intr->er_start + TRB_SIZE*intr->er_ep_idx;
-    if (dma_memory_write(xhci->as, addr, &ev_trb, TRB_SIZE,
-                         MEMTXATTRS_UNSPECIFIED) != MEMTX_OK) {
+    if (xhci->event_batch) {
+        if (intr->ev_batch_len == XHCI_TRB_BATCH ||
+            (intr->ev_batch_len &&
+             addr != intr->ev_batch_addr + TRB_SIZE * intr->ev_batch_len)) {
+            xhci_event_batch_flush(xhci, v);
+        }
+        if (!intr->ev_batch_len) {
+            intr->ev_batch_addr = addr;
+        }
+        memcpy(intr->ev_batch + TRB_SIZE * intr->ev_batch_len, &ev_trb,
+               TRB_SIZE);
+        intr->ev_batch_len++;
+    } else if (dma_memory_write(xhci->as, addr, &ev_trb, TRB_SIZE,
+                                MEMTXATTRS_UNSPECIFIED) != MEMTX_OK) {
         qemu_log_mask(LOG_GUEST_ERROR, "%s: DMA memory access failed!\n",
                       __func__);
         xhci_die(xhci);
@@ -681,7 +738,11 @@ static void xhci_event(XHCIState *xhci, XHCIEvent *event, int v)
         xhci_write_event(xhci, event, v);
     }
 
-    xhci_intr_raise(xhci, v);
+    if (xhci->event_batch) {
+        intr->ev_batch_raise = true;
+    } else {
+        xhci_intr_raise(xhci, v);
+    }
 }
 
 static void xhci_ring_init(XHCIState *xhci, XHCIRing *ring,
@@ -689,6 +750,41 @@ static void xhci_ring_init(XHCIState *xhci, XHCIRing *ring,
 {
     ring->dequeue = base;
     ring->ccs = 1;
+    ring->prefetch_len = 0;
+}
+
+/*
+ * Read the TRB at @addr.  TRBs are read ahead in blocks of up to
+ * XHCI_TRB_BATCH that stop at a page boundary, and kept until the next
+ * kick of the ring drops them: the guest may rewrite TRBs it still owns
+ * and rings the doorbell after doing so.
+ */
+static bool xhci_ring_read_trb(XHCIState *xhci, XHCIRing *ring,
+                               dma_addr_t addr, XHCITRB *trb)
+{
+    if (addr < ring->prefetch_addr ||
+        addr + TRB_SIZE > ring->prefetch_addr + ring->prefetch_len) {
+        unsigned int len = MIN(XHCI_TRB_BATCH * TRB_SIZE,
+                               4096 - (addr & 4095));
+
+        len = MAX(len, TRB_SIZE);
+        if (dma_memory_read(xhci->as, addr, ring->prefetch, len,
+                            MEMTXATTRS_UNSPECIFIED) != MEMTX_OK) {
+            len = TRB_SIZE;
+            if (dma_memory_read(xhci->as, addr, ring->prefetch, len,
+                                MEMTXATTRS_UNSPECIFIED) != MEMTX_OK) {
+                ring->prefetch_len = 0;
+                qemu_log_mask(LOG_GUEST_ERROR,
+                              "%s: DMA memory access failed!\n", __func__);
+                return false;
+            }
+        }
+        ring->prefetch_addr = addr;
+        ring->prefetch_len = len;
+    }
+
+    memcpy(trb, ring->prefetch + (addr - ring->prefetch_addr), TRB_SIZE);
+    return true;
 }
 
 static TRBType xhci_ring_fetch(XHCIState *xhci, XHCIRing *ring, XHCITRB *trb,
@@ -698,10 +794,7 @@ static TRBType xhci_ring_fetch(XHCIState *xhci, XHCIRing *ring, XHCITRB *trb,
 
     while (1) {
         TRBType type;
-        if (dma_memory_read(xhci->as, ring->dequeue, trb, TRB_SIZE,
-                            MEMTXATTRS_UNSPECIFIED) != MEMTX_OK) {
-            qemu_log_mask(LOG_GUEST_ERROR, "%s: DMA memory access failed!\n",
-                          __func__);
+        if (!xhci_ring_read_trb(xhci, ring, ring->dequeue, trb)) {
             return 0;
         }
         trb->addr = ring->dequeue;
@@ -738,7 +831,7 @@ static TRBType xhci_ring_fetch(XHCIState *xhci, XHCIRing *ring, XHCITRB *trb,
     }
 }
 
-static int xhci_ring_chain_length(XHCIState *xhci, const XHCIRing *ring)
+static int xhci_ring_chain_length(XHCIState *xhci, XHCIRing *ring)
 {
     XHCITRB trb;
     int length = 0;
@@ -750,10 +843,7 @@ static int xhci_ring_chain_length(XHCIState *xhci, const XHCIRing *ring)
 
     do {
         TRBType type;
-        if (dma_memory_read(xhci->as, dequeue, &trb, TRB_SIZE,
-                        MEMTXATTRS_UNSPECIFIED) != MEMTX_OK) {
-            qemu_log_mask(LOG_GUEST_ERROR, "%s: DMA memory access failed!\n",
-                          __func__);
+        if (!xhci_ring_read_trb(xhci, ring, dequeue, &trb)) {
             return -1;
         }
         le64_to_cpus(&trb.parameter);
@@ -1960,6 +2050,8 @@ static void xhci_kick_epctx(XHCIEPContext *epctx, unsigned int streamid)
         return;
     }
 
+    ring->prefetch_len = 0;
+    xhci_event_batch_begin(xhci);
     epctx->kick_active++;
     while (1) {
         length = xhci_ring_chain_length(xhci, ring);
@@ -1988,6 +2080,7 @@ static void xhci_kick_epctx(XHCIEPContext *epctx, unsigned int streamid)
                 xhci_die(xhci);
                 xhci_ep_free_xfer(xfer);
                 epctx->kick_active--;
+                xhci_event_batch_end(xhci);
                 return;
             }
         }
@@ -2024,6 +2117,7 @@ static void xhci_kick_epctx(XHCIEPContext *epctx, unsigned int streamid)
         }
     }
     epctx->kick_active--;
+    xhci_event_batch_end(xhci);
 
     ep = xhci_epid_to_usbep(epctx);
     if (ep) {
@@ -2485,6 +2579,8 @@ static void xhci_process_commands(XHCIState *xhci)
 
     xhci->crcr_low |= CRCR_CRR;
 
+    xhci->cmd_ring.prefetch_len = 0;
+    xhci_event_batch_begin(xhci);
     while ((type = xhci_ring_fetch(xhci, &xhci->cmd_ring, &trb, &addr))) {
         event.ptr = addr;
         switch (type) {
@@ -2598,9 +2694,10 @@ static void xhci_process_commands(XHCIState *xhci)
 
         if (count++ > COMMAND_LIMIT) {
             trace_usb_xhci_enforced_limit("commands");
-            return;
+            break;
         }
     }
+    xhci_event_batch_end(xhci);
 }
 
 static bool xhci_port_have_device(XHCIPort *port)
@@ -32,6 +32,11 @@ OBJECT_DECLARE_SIMPLE_TYPE(XHCIState, XHCI)
 /* Very pessimistic, let's hope it's enough for all cases */
 #define EV_QUEUE (((3 * 24) + 16) * XHCI_MAXSLOTS)
 
+#define TRB_SIZE 16
+
+/* TRBs fetched, and events written, with one DMA access */
+#define XHCI_TRB_BATCH 16
+
 typedef struct XHCIStreamContext XHCIStreamContext;
 typedef struct XHCIEPContext XHCIEPContext;
 
@@ -120,6 +125,11 @@ typedef enum TRBCCode {
 typedef struct XHCIRing {
     dma_addr_t dequeue;
     bool ccs;
+
+    /* TRBs read ahead by the current kick, see xhci_ring_read_trb() */
+    dma_addr_t prefetch_addr;
+    unsigned int prefetch_len;
+    uint8_t prefetch[XHCI_TRB_BATCH * TRB_SIZE];
 } XHCIRing;
 
 typedef struct XHCIPort {
@@ -166,6 +176,12 @@ typedef struct XHCIInterrupter {
     uint32_t er_size;
     unsigned int er_ep_idx;
 
+    /* events held back by xhci_event_batch_begin() */
+    dma_addr_t ev_batch_addr;
+    unsigned int ev_batch_len;
+    bool ev_batch_raise;
+    uint8_t ev_batch[XHCI_TRB_BATCH * TRB_SIZE];
+
     /* kept for live migration compat only */
     bool er_full_unused;
     XHCIEvent ev_buffer[EV_QUEUE];
@@ -219,6 +235,9 @@ typedef struct XHCIState {
 
     XHCIRing cmd_ring;
 
+    /* nesting depth of xhci_event_batch_begin() */
+    unsigned int event_batch;
+
     bool nec_quirks;
 } XHCIState;
 
@@ -34,6 +34,8 @@
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
 #include "qemu/range.h"
+#include "qemu/thread.h"
+#include "qemu/units.h"
 #include "sysemu/kvm.h"
 #include "sysemu/reset.h"
 #include "sysemu/runstate.h"
@@ -567,6 +569,144 @@ static bool vfio_get_section_iova_range(VFIOContainerBase *bcontainer,
     return true;
 }
 
+static void vfio_listener_region_add_fail(VFIOContainerBase *bcontainer,
+                                          MemoryRegion *mr, Error *err)
+{
+    if (memory_region_is_ram_device(mr)) {
+        error_reportf_err(err, "PCI p2p may not work: ");
+        return;
+    }
+    /*
+     * On the initfn path, store the first error in the container so we
+     * can gracefully fail.  Runtime, there's not much we can do other
+     * than throw a hardware error.
+     */
+    if (!bcontainer->initialized) {
+        if (!bcontainer->error) {
+            error_propagate_prepend(&bcontainer->error, err,
+                                    "Region %s: ", memory_region_name(mr));
+        } else {
+            error_free(err);
+        }
+    } else {
+        error_report_err(err);
+        hw_error("vfio: DMA mapping failed, unable to continue");
+    }
+}
+
+/*
+ * Pinning guest RAM dominates the DMA map time.  With backends that can
+ * pin concurrently, RAM sections are split in chunks at region_add time
+ * and the chunks are mapped by several threads when the memory
+ * transaction commits.  The chunks are aligned, so that the IOMMU can
+ * still use its largest pages.
+ */
+#define VFIO_DMA_MAP_CHUNK          (1 * GiB)
+#define VFIO_DMA_MAP_THREADS_MAX    16
+
+typedef struct VFIODMAMapJob {
+    MemoryRegion *mr;
+    hwaddr iova;
+    hwaddr size;
+    void *vaddr;
+    bool readonly;
+    int ret;
+} VFIODMAMapJob;
+
+typedef struct VFIODMAMapBatch {
+    VFIOContainerBase *bcontainer;
+    GArray *jobs;
+    unsigned int next;
+} VFIODMAMapBatch;
+
+static void vfio_dma_map_defer(VFIOContainerBase *bcontainer,
+                               MemoryRegionSection *section,
+                               hwaddr iova, hwaddr size, void *vaddr)
+{
+    if (!bcontainer->dma_map_jobs) {
+        bcontainer->dma_map_jobs = g_array_new(false, false,
+                                               sizeof(VFIODMAMapJob));
+    }
+
+    while (size) {
+        hwaddr len = MIN(VFIO_DMA_MAP_CHUNK -
+                         (iova & (VFIO_DMA_MAP_CHUNK - 1)), size);
+        VFIODMAMapJob job = {
+            .mr = section->mr,
+            .iova = iova,
+            .size = len,
+            .vaddr = vaddr,
+            .readonly = section->readonly,
+        };
+
+        g_array_append_val(bcontainer->dma_map_jobs, job);
+        iova += len;
+        vaddr += len;
+        size -= len;
+    }
+}
+
+static void *vfio_dma_map_thread(void *opaque)
+{
+    VFIODMAMapBatch *batch = opaque;
+    unsigned int i;
+
+    while ((i = qatomic_fetch_inc(&batch->next)) < batch->jobs->len) {
+        VFIODMAMapJob *job = &g_array_index(batch->jobs, VFIODMAMapJob, i);
+
+        job->ret = vfio_container_dma_map(batch->bcontainer, job->iova,
+                                          job->size, job->vaddr,
+                                          job->readonly);
+    }
+
+    return NULL;
+}
+
+static void vfio_listener_commit(MemoryListener *listener)
+{
+    VFIOContainerBase *bcontainer = container_of(listener, VFIOContainerBase,
+                                                 listener);
+    VFIODMAMapBatch batch = {
+        .bcontainer = bcontainer,
+        .jobs = bcontainer->dma_map_jobs,
+    };
+    g_autofree QemuThread *threads = NULL;
+    unsigned int i, nr_threads;
+
+    if (!batch.jobs || !batch.jobs->len) {
+        return;
+    }
+
+    nr_threads = MIN(batch.jobs->len, VFIO_DMA_MAP_THREADS_MAX);
+    nr_threads = MIN(nr_threads, MAX(sysconf(_SC_NPROCESSORS_ONLN), 1));
+    trace_vfio_listener_commit(batch.jobs->len, nr_threads);
+
+    /* The calling thread takes its share of the jobs too */
+    threads = g_new(QemuThread, nr_threads);
+    for (i = 1; i < nr_threads; i++) {
+        qemu_thread_create(&threads[i], "vfio-dma-map", vfio_dma_map_thread,
+                           &batch, QEMU_THREAD_JOINABLE);
+    }
+    vfio_dma_map_thread(&batch);
+    for (i = 1; i < nr_threads; i++) {
+        qemu_thread_join(&threads[i]);
+    }
+
+    for (i = 0; i < batch.jobs->len; i++) {
+        VFIODMAMapJob *job = &g_array_index(batch.jobs, VFIODMAMapJob, i);
+        Error *err = NULL;
+
+        if (job->ret) {
+            error_setg(&err, "vfio_container_dma_map(%p, 0x%"HWADDR_PRIx", "
+                       "0x%"HWADDR_PRIx", %p) = %d (%s)",
+                       bcontainer, job->iova, job->size, job->vaddr,
+                       job->ret, strerror(-job->ret));
+            vfio_listener_region_add_fail(bcontainer, job->mr, err);
+        }
+    }
+    g_array_set_size(batch.jobs, 0);
+}
+
 static void vfio_listener_region_add(MemoryListener *listener,
                                      MemoryRegionSection *section)
 {
@@ -689,6 +829,10 @@ static void vfio_listener_region_add(MemoryListener *listener,
                 pgmask + 1);
             return;
         }
+    } else if (bcontainer->dma_map_parallel) {
+        vfio_dma_map_defer(bcontainer, section, iova, int128_get64(llsize),
+                           vaddr);
+        return;
     }
 
     ret = vfio_container_dma_map(bcontainer, iova, int128_get64(llsize),
@@ -709,27 +853,7 @@ static void vfio_listener_region_add(MemoryListener *listener,
     return;
 
 fail:
-    if (memory_region_is_ram_device(section->mr)) {
-        error_reportf_err(err, "PCI p2p may not work: ");
-        return;
-    }
-    /*
-     * On the initfn path, store the first error in the container so we
-     * can gracefully fail.  Runtime, there's not much we can do other
-     * than throw a hardware error.
-     */
-    if (!bcontainer->initialized) {
-        if (!bcontainer->error) {
-            error_propagate_prepend(&bcontainer->error, err,
-                                    "Region %s: ",
-                                    memory_region_name(section->mr));
-        } else {
-            error_free(err);
-        }
-    } else {
-        error_report_err(err);
-        hw_error("vfio: DMA mapping failed, unable to continue");
-    }
+    vfio_listener_region_add_fail(bcontainer, section->mr, err);
 }
 
 static void vfio_listener_region_del(MemoryListener *listener,
@@ -1355,6 +1479,7 @@ static void vfio_listener_log_sync(MemoryListener *listener,
 
 const MemoryListener vfio_memory_listener = {
     .name = "vfio",
+    .commit = vfio_listener_commit,
     .region_add = vfio_listener_region_add,
     .region_del = vfio_listener_region_del,
     .log_global_start = vfio_listener_log_global_start,
@@ -79,6 +79,8 @@ void vfio_container_init(VFIOContainerBase *bcontainer, VFIOAddressSpace *space,
     bcontainer->error = NULL;
     bcontainer->dirty_pages_supported = false;
     bcontainer->dma_max_mappings = 0;
+    bcontainer->dma_map_parallel = false;
+    bcontainer->dma_map_jobs = NULL;
     bcontainer->iova_ranges = NULL;
     QLIST_INIT(&bcontainer->giommu_list);
     QLIST_INIT(&bcontainer->vrdl_list);
@@ -98,6 +100,9 @@ void vfio_container_destroy(VFIOContainerBase *bcontainer)
     }
 
     g_list_free_full(bcontainer->iova_ranges, g_free);
+    if (bcontainer->dma_map_jobs) {
+        g_array_unref(bcontainer->dma_map_jobs);
+    }
 }
 
 static const TypeInfo types[] = {
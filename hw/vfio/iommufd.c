@@ -392,6 +392,12 @@ static int iommufd_cdev_attach(const char *name, VFIODevice *vbasedev,
         bcontainer->pgsizes = qemu_real_host_page_size();
     }
 
+    /*
+     * Unlike type1, which holds a container-wide lock while pinning,
+     * iommufd pins the pages of separate mappings concurrently.
+     */
+    bcontainer->dma_map_parallel = true;
+
     bcontainer->listener = vfio_memory_listener;
     memory_listener_register(&bcontainer->listener, bcontainer->space->as);
 
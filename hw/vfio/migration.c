@@ -10,7 +10,9 @@
 #include "qemu/osdep.h"
 #include "qemu/main-loop.h"
 #include "qemu/cutils.h"
+#include "qemu/lockable.h"
 #include "qemu/units.h"
+#include "qemu/stats64.h"
 #include "qemu/error-report.h"
 #include <linux/vfio.h>
 #include <sys/ioctl.h>
@@ -48,6 +50,35 @@
 #define VFIO_MIG_FLAG_DEV_SETUP_STATE   (0xffffffffef100003ULL)
 #define VFIO_MIG_FLAG_DEV_DATA_STATE    (0xffffffffef100004ULL)
 #define VFIO_MIG_FLAG_DEV_INIT_DATA_SENT (0xffffffffef100005ULL)
+#define VFIO_MIG_FLAG_DEV_MULTIFD_DATA  (0xffffffffef100006ULL)
+
+/*
+ * With x-migration-multifd-transfer, the stop-copy data is sent as
+ * numbered packets through the multifd channels, which the destination
+ * writes to the device in order.  The last packet has no data.
+ */
+#define VFIO_DEVICE_STATE_PACKET_VERSION    1
+#define VFIO_DEVICE_STATE_PACKET_FLAG_LAST  (1 << 0)
+
+/*
+ * Packets received ahead of the next one to load are queued.  The
+ * multifd channels don't run that far apart; a packet further ahead
+ * comes from a corrupt stream.
+ */
+#define VFIO_DEVICE_STATE_MAX_PENDING       (64 * 1024)
+
+typedef struct VFIODeviceStatePacket {
+    uint32_t version;
+    uint32_t idx;
+    uint32_t flags;
+    uint8_t data[];
+} QEMU_PACKED VFIODeviceStatePacket;
+
+typedef struct VFIOStateBuffer {
+    void *data;
+    size_t len;
+    bool last;
+} VFIOStateBuffer;
 
 /*
  * This is an arbitrary size based on migration of mlx5 devices, where typically
@@ -56,7 +87,7 @@
  */
 #define VFIO_MIG_DEFAULT_DATA_BUFFER_SIZE (1 * MiB)
 
-static int64_t bytes_transferred;
+static Stat64 bytes_transferred;
 
 static const char *mig_state_to_str(enum vfio_device_mig_state state)
 {
@@ -307,7 +338,7 @@ static ssize_t vfio_save_block(QEMUFile *f, VFIOMigration *migration)
     qemu_put_be64(f, VFIO_MIG_FLAG_DEV_DATA_STATE);
     qemu_put_be64(f, data_size);
     qemu_put_buffer(f, migration->data_buffer, data_size);
-    bytes_transferred += data_size;
+    stat64_add(&bytes_transferred, data_size);
 
     trace_vfio_save_block(migration->vbasedev->name, data_size);
 
@@ -346,6 +377,31 @@ static bool vfio_precopy_supported(VFIODevice *vbasedev)
     return migration->mig_flags & VFIO_MIGRATION_PRE_COPY;
 }
 
+/*
+ * Decide whether the stop-copy data goes through multifd.  Snapshots use
+ * the main stream in any case.
+ */
+static int vfio_multifd_setup(VFIODevice *vbasedev)
+{
+    VFIOMigration *migration = vbasedev->migration;
+
+    migration->multifd_transfer = false;
+    if (!vbasedev->migration_multifd_transfer ||
+        runstate_check(RUN_STATE_SAVE_VM) ||
+        runstate_check(RUN_STATE_RESTORE_VM)) {
+        return 0;
+    }
+
+    if (!multifd_device_state_supported()) {
+        error_report("%s: x-migration-multifd-transfer requires multifd "
+                     "migration without postcopy", vbasedev->name);
+        return -EINVAL;
+    }
+
+    migration->multifd_transfer = true;
+    return 0;
+}
+
 /* ---------------------------------------------------------------------- */
 
 static int vfio_save_prepare(void *opaque, Error **errp)
@@ -375,6 +431,13 @@ static int vfio_save_prepare(void *opaque, Error **errp)
         return -EOPNOTSUPP;
     }
 
+    if (vbasedev->migration_multifd_transfer &&
+        !multifd_device_state_supported()) {
+        error_setg(errp, "%s: x-migration-multifd-transfer requires multifd "
+                   "migration", vbasedev->name);
+        return -EOPNOTSUPP;
+    }
+
     return 0;
 }
 
@@ -383,6 +446,12 @@ static int vfio_save_setup(QEMUFile *f, void *opaque)
     VFIODevice *vbasedev = opaque;
     VFIOMigration *migration = vbasedev->migration;
     uint64_t stop_copy_size = VFIO_MIG_DEFAULT_DATA_BUFFER_SIZE;
+    int ret;
+
+    ret = vfio_multifd_setup(vbasedev);
+    if (ret) {
+        return ret;
+    }
 
     qemu_put_be64(f, VFIO_MIG_FLAG_DEV_SETUP_STATE);
 
@@ -397,8 +466,6 @@ static int vfio_save_setup(QEMUFile *f, void *opaque)
     }
 
     if (vfio_precopy_supported(vbasedev)) {
-        int ret;
-
         switch (migration->device_state) {
         case VFIO_DEVICE_STATE_RUNNING:
             ret = vfio_migration_set_state(vbasedev, VFIO_DEVICE_STATE_PRE_COPY,
@@ -443,6 +510,7 @@ static void vfio_save_cleanup(void *opaque)
     migration->precopy_init_size = 0;
     migration->precopy_dirty_size = 0;
     migration->initial_data_sent = false;
+    migration->multifd_transfer = false;
     vfio_migration_cleanup(vbasedev);
     trace_vfio_save_cleanup(vbasedev->name);
 }
@@ -542,6 +610,13 @@ static int vfio_save_complete_precopy(QEMUFile *f, void *opaque)
     ssize_t data_size;
     int ret;
 
+    if (vbasedev->migration->multifd_transfer) {
+        /* vfio_save_complete_precopy_thread() sends the data */
+        qemu_put_be64(f, VFIO_MIG_FLAG_DEV_MULTIFD_DATA);
+        qemu_put_be64(f, VFIO_MIG_FLAG_END_OF_STATE);
+        return qemu_file_get_error(f);
+    }
+
     /* We reach here with device state STOP or STOP_COPY only */
     ret = vfio_migration_set_state(vbasedev, VFIO_DEVICE_STATE_STOP_COPY,
                                    VFIO_DEVICE_STATE_STOP);
@@ -567,6 +642,75 @@ static int vfio_save_complete_precopy(QEMUFile *f, void *opaque)
     return ret;
 }
 
+/*
+ * Send the stop-copy data through multifd, in parallel with RAM and with
+ * the other devices.  This runs before vfio_save_complete_precopy(), and
+ * the config space still goes through the main stream afterwards.
+ */
+static int vfio_save_complete_precopy_thread(const char *idstr,
+                                             uint32_t instance_id,
+                                             void *opaque, Error **errp)
+{
+    VFIODevice *vbasedev = opaque;
+    VFIOMigration *migration = vbasedev->migration;
+    uint32_t idx = 0;
+    int ret;
+
+    if (!migration->multifd_transfer) {
+        return 0;
+    }
+
+    /* We reach here with device state STOP or STOP_COPY only */
+    ret = vfio_migration_set_state(vbasedev, VFIO_DEVICE_STATE_STOP_COPY,
+                                   VFIO_DEVICE_STATE_STOP);
+    if (ret) {
+        error_setg_errno(errp, -ret, "%s: failed to enter STOP_COPY",
+                         vbasedev->name);
+        return ret;
+    }
+
+    while (true) {
+        VFIODeviceStatePacket *packet;
+        ssize_t data_size;
+
+        packet = g_malloc(sizeof(*packet) + migration->data_buffer_size);
+        data_size = read(migration->data_fd, packet->data,
+                         migration->data_buffer_size);
+        if (data_size < 0) {
+            ret = -errno;
+            g_free(packet);
+            error_setg_errno(errp, -ret, "%s: failed to read device state",
+                             vbasedev->name);
+            return ret;
+        }
+
+        packet->version = cpu_to_be32(VFIO_DEVICE_STATE_PACKET_VERSION);
+        packet->idx = cpu_to_be32(idx);
+        packet->flags = cpu_to_be32(data_size ? 0 :
+                                    VFIO_DEVICE_STATE_PACKET_FLAG_LAST);
+
+        /* multifd frees the packet */
+        if (!multifd_queue_device_state(idstr, instance_id, (char *)packet,
+                                        sizeof(*packet) + data_size)) {
+            error_setg(errp, "%s: failed to queue device state",
+                       vbasedev->name);
+            return -EIO;
+        }
+        stat64_add(&bytes_transferred, data_size);
+        trace_vfio_save_complete_precopy_thread_block(vbasedev->name, idx,
+                                                      data_size);
+        idx++;
+
+        if (!data_size) {
+            break;
+        }
+    }
+
+    trace_vfio_save_complete_precopy_thread(vbasedev->name, idx);
+
+    return 0;
+}
+
 static void vfio_save_state(QEMUFile *f, void *opaque)
 {
     VFIODevice *vbasedev = opaque;
@@ -580,18 +724,200 @@ static void vfio_save_state(QEMUFile *f, void *opaque)
     }
 }
 
+static void vfio_state_buffer_free(gpointer data)
+{
+    VFIOStateBuffer *lb = data;
+
+    if (lb) {
+        g_free(lb->data);
+        g_free(lb);
+    }
+}
+
+/*
+ * Called from the multifd receive threads with the packets sent by
+ * vfio_save_complete_precopy_thread(), in any order.
+ */
+static int vfio_load_state_buffer(void *opaque, char *data, size_t len,
+                                  Error **errp)
+{
+    VFIODevice *vbasedev = opaque;
+    VFIOMigration *migration = vbasedev->migration;
+    VFIODeviceStatePacket *packet = (VFIODeviceStatePacket *)data;
+    VFIOStateBuffer *lb;
+    uint32_t idx;
+
+    if (!migration->multifd_transfer) {
+        error_setg(errp, "%s: got device state through multifd, but "
+                   "x-migration-multifd-transfer is off", vbasedev->name);
+        return -EINVAL;
+    }
+
+    if (len < sizeof(*packet) ||
+        be32_to_cpu(packet->version) != VFIO_DEVICE_STATE_PACKET_VERSION) {
+        error_setg(errp, "%s: invalid device state packet", vbasedev->name);
+        return -EINVAL;
+    }
+
+    idx = be32_to_cpu(packet->idx);
+
+    QEMU_LOCK_GUARD(&migration->load_bufs_mutex);
+    if (idx >= migration->load_buf_idx &&
+        idx - migration->load_buf_idx >= VFIO_DEVICE_STATE_MAX_PENDING) {
+        error_setg(errp, "%s: device state packet %u too far ahead of %u",
+                   vbasedev->name, idx, migration->load_buf_idx);
+        return -EINVAL;
+    }
+    if (idx < migration->load_buf_idx ||
+        (idx < migration->load_bufs->len &&
+         g_ptr_array_index(migration->load_bufs, idx))) {
+        error_setg(errp, "%s: duplicate device state packet %u",
+                   vbasedev->name, idx);
+        return -EINVAL;
+    }
+
+    if (idx >= migration->load_bufs->len) {
+        g_ptr_array_set_size(migration->load_bufs, idx + 1);
+    }
+    lb = g_new(VFIOStateBuffer, 1);
+    lb->len = len - sizeof(*packet);
+    lb->data = g_memdup2(packet->data, lb->len);
+    lb->last = be32_to_cpu(packet->flags) & VFIO_DEVICE_STATE_PACKET_FLAG_LAST;
+    g_ptr_array_index(migration->load_bufs, idx) = lb;
+    qemu_cond_broadcast(&migration->load_bufs_cond);
+
+    trace_vfio_load_state_buffer(vbasedev->name, idx, lb->len);
+
+    return 0;
+}
+
+/*
+ * Write the packets received through multifd to the device, in order.
+ * This only starts once the main stream has reached the stop-copy phase,
+ * so that all the pre-copy data, which uses the main stream, is in.
+ */
+static void *vfio_load_bufs_thread(void *opaque)
+{
+    VFIODevice *vbasedev = opaque;
+    VFIOMigration *migration = vbasedev->migration;
+    bool last = false;
+    int ret = 0;
+
+    qemu_mutex_lock(&migration->load_bufs_mutex);
+    while (!last && !ret && !migration->load_bufs_quit) {
+        uint32_t idx = migration->load_buf_idx;
+        VFIOStateBuffer *lb = NULL;
+
+        if (idx < migration->load_bufs->len) {
+            lb = g_ptr_array_index(migration->load_bufs, idx);
+        }
+        if (!lb) {
+            qemu_cond_wait(&migration->load_bufs_cond,
+                           &migration->load_bufs_mutex);
+            continue;
+        }
+
+        g_ptr_array_index(migration->load_bufs, idx) = NULL;
+        migration->load_buf_idx++;
+        qemu_mutex_unlock(&migration->load_bufs_mutex);
+
+        if (qemu_write_full(migration->data_fd, lb->data, lb->len) !=
+            lb->len) {
+            ret = -errno;
+        }
+        trace_vfio_load_state_device_data(vbasedev->name, lb->len, ret);
+        last = lb->last;
+        vfio_state_buffer_free(lb);
+
+        qemu_mutex_lock(&migration->load_bufs_mutex);
+    }
+
+    migration->load_bufs_ret = ret ?: (last ? 0 : -ECANCELED);
+    migration->load_bufs_done = true;
+    qemu_cond_broadcast(&migration->load_bufs_cond);
+    qemu_mutex_unlock(&migration->load_bufs_mutex);
+
+    return NULL;
+}
+
+/* Wait until all the stop-copy data has been written to the device */
+static int vfio_load_bufs_wait(VFIODevice *vbasedev)
+{
+    VFIOMigration *migration = vbasedev->migration;
+
+    if (!migration->load_bufs_thread_started) {
+        error_report("%s: no device state received through multifd",
+                     vbasedev->name);
+        return -EINVAL;
+    }
+
+    QEMU_LOCK_GUARD(&migration->load_bufs_mutex);
+    while (!migration->load_bufs_done) {
+        qemu_cond_wait(&migration->load_bufs_cond,
+                       &migration->load_bufs_mutex);
+    }
+    if (migration->load_bufs_ret) {
+        error_report("%s: failed to load device state, err=%d (%s)",
+                     vbasedev->name, migration->load_bufs_ret,
+                     strerror(-migration->load_bufs_ret));
+    }
+
+    return migration->load_bufs_ret;
+}
+
 static int vfio_load_setup(QEMUFile *f, void *opaque)
 {
     VFIODevice *vbasedev = opaque;
+    VFIOMigration *migration = vbasedev->migration;
+    int ret;
+
+    ret = vfio_multifd_setup(vbasedev);
+    if (ret) {
+        return ret;
+    }
+
+    if (migration->multifd_transfer) {
+        qemu_mutex_init(&migration->load_bufs_mutex);
+        qemu_cond_init(&migration->load_bufs_cond);
+        migration->load_bufs = g_ptr_array_new_with_free_func(
+            vfio_state_buffer_free);
+        migration->load_buf_idx = 0;
+        migration->load_bufs_done = false;
+        migration->load_bufs_quit = false;
+        migration->load_bufs_ret = 0;
+    }
 
     return vfio_migration_set_state(vbasedev, VFIO_DEVICE_STATE_RESUMING,
-                                   vbasedev->migration->device_state);
+                                   migration->device_state);
+}
+
+static void vfio_load_bufs_cleanup(VFIODevice *vbasedev)
+{
+    VFIOMigration *migration = vbasedev->migration;
+
+    if (migration->load_bufs_thread_started) {
+        WITH_QEMU_LOCK_GUARD(&migration->load_bufs_mutex) {
+            migration->load_bufs_quit = true;
+            qemu_cond_broadcast(&migration->load_bufs_cond);
+        }
+        qemu_thread_join(&migration->load_bufs_thread);
+        migration->load_bufs_thread_started = false;
+    }
+
+    g_ptr_array_unref(migration->load_bufs);
+    migration->load_bufs = NULL;
+    qemu_cond_destroy(&migration->load_bufs_cond);
+    qemu_mutex_destroy(&migration->load_bufs_mutex);
+    migration->multifd_transfer = false;
 }
 
 static int vfio_load_cleanup(void *opaque)
 {
     VFIODevice *vbasedev = opaque;
 
+    if (vbasedev->migration->multifd_transfer) {
+        vfio_load_bufs_cleanup(vbasedev);
+    }
     vfio_migration_cleanup(vbasedev);
     trace_vfio_load_cleanup(vbasedev->name);
 
@@ -612,6 +938,12 @@ static int vfio_load_state(QEMUFile *f, void *opaque, int version_id)
         switch (data) {
         case VFIO_MIG_FLAG_DEV_CONFIG_STATE:
         {
+            if (vbasedev->migration->multifd_transfer) {
+                ret = vfio_load_bufs_wait(vbasedev);
+                if (ret) {
+                    return ret;
+                }
+            }
             return vfio_load_device_config_state(f, opaque);
         }
         case VFIO_MIG_FLAG_DEV_SETUP_STATE:
@@ -638,6 +970,23 @@ static int vfio_load_state(QEMUFile *f, void *opaque, int version_id)
             }
             break;
         }
+        case VFIO_MIG_FLAG_DEV_MULTIFD_DATA:
+        {
+            VFIOMigration *migration = vbasedev->migration;
+
+            if (!migration->multifd_transfer ||
+                migration->load_bufs_thread_started) {
+                error_report("%s: unexpected multifd device state",
+                             vbasedev->name);
+                return -EINVAL;
+            }
+
+            qemu_thread_create(&migration->load_bufs_thread,
+                               "vfio-load-bufs", vfio_load_bufs_thread,
+                               vbasedev, QEMU_THREAD_JOINABLE);
+            migration->load_bufs_thread_started = true;
+            break;
+        }
         case VFIO_MIG_FLAG_DEV_INIT_DATA_SENT:
         {
             if (!vfio_precopy_supported(vbasedev) ||
@@ -686,10 +1035,12 @@ static const SaveVMHandlers savevm_vfio_handlers = {
     .is_active_iterate = vfio_is_active_iterate,
     .save_live_iterate = vfio_save_iterate,
     .save_live_complete_precopy = vfio_save_complete_precopy,
+    .save_live_complete_precopy_thread = vfio_save_complete_precopy_thread,
     .save_state = vfio_save_state,
     .load_setup = vfio_load_setup,
     .load_cleanup = vfio_load_cleanup,
     .load_state = vfio_load_state,
+    .load_state_buffer = vfio_load_state_buffer,
     .switchover_ack_needed = vfio_switchover_ack_needed,
 };
 
@@ -899,12 +1250,12 @@ static int vfio_block_migration(VFIODevice *vbasedev, Error *err, Error **errp)
 
 int64_t vfio_mig_bytes_transferred(void)
 {
-    return bytes_transferred;
+    return stat64_get(&bytes_transferred);
 }
 
 void vfio_reset_bytes_transferred(void)
 {
-    bytes_transferred = 0;
+    stat64_set(&bytes_transferred, 0);
 }
 
 /*
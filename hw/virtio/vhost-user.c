@@ -361,6 +361,33 @@ static int process_message_reply(struct vhost_dev *dev,
     return msg_reply.payload.u64 ? -EIO : 0;
 }
 
+/*
+ * Collect the replies to @n messages of type @request that were sent with
+ * VHOST_USER_NEED_REPLY_MASK, without waiting for each reply in turn.  All
+ * replies are read even if the backend reports a failure, so that the
+ * connection stays in sync.
+ */
+static int process_message_replies(struct vhost_dev *dev,
+                                   VhostUserRequest request, int n)
+{
+    VhostUserMsg msg = {
+        .hdr.request = request,
+        .hdr.flags = VHOST_USER_NEED_REPLY_MASK,
+    };
+    int ret = 0;
+
+    while (n--) {
+        int r = process_message_reply(dev, &msg);
+
+        if (r == -EIO) {
+            ret = r;
+        } else if (r < 0) {
+            return r;
+        }
+    }
+    return ret;
+}
+
 static bool vhost_user_per_device_request(VhostUserRequest request)
 {
     switch (request) {
@@ -491,6 +518,19 @@ static MemoryRegion *vhost_user_get_mr_data(uint64_t addr, ram_addr_t *offset,
     return mr;
 }
 
+/*
+ * The backend maps guest memory from the file descriptor, so it only sees
+ * the guest's view of memory if the mapping in QEMU is shared.
+ */
+static void vhost_user_check_shared(MemoryRegion *mr)
+{
+    if (!qemu_ram_is_shared(mr->ram_block)) {
+        warn_report_once("vhost-user: memory region %s is not shared, the "
+                         "backend will not see its contents; use share=on",
+                         mr->name);
+    }
+}
+
 static void vhost_user_fill_msg_region(VhostUserMemoryRegion *dst,
                                        struct vhost_memory_region *src,
                                        uint64_t mmap_offset)
@@ -521,6 +561,7 @@ static int vhost_user_fill_set_mem_table_msg(struct vhost_user *u,
 
         mr = vhost_user_get_mr_data(reg->userspace_addr, &offset, &fd);
         if (fd > 0) {
+            vhost_user_check_shared(mr);
             if (track_ramblocks) {
                 assert(*fd_num < VHOST_MEMORY_BASELINE_NREGIONS);
                 trace_vhost_user_set_mem_table_withfd(*fd_num, mr->name,
@@ -660,12 +701,12 @@ static void scrub_shadow_regions(struct vhost_dev *dev,
 
 static int send_remove_regions(struct vhost_dev *dev,
                                struct scrub_regions *remove_reg,
-                               int nr_rem_reg, VhostUserMsg *msg,
-                               bool reply_supported)
+                               int nr_rem_reg, VhostUserMsg *msg)
 {
     struct vhost_user *u = dev->opaque;
     struct vhost_memory_region *shadow_reg;
     int i, fd, shadow_reg_idx, ret;
+    int nr_replies = 0;
     ram_addr_t offset;
     VhostUserMemoryRegion region_buffer;
 
@@ -690,17 +731,14 @@ static int send_remove_regions(struct vhost_dev *dev,
                 return ret;
             }
 
-            if (reply_supported) {
-                ret = process_message_reply(dev, msg);
-                if (ret) {
-                    return ret;
-                }
+            if (msg->hdr.flags & VHOST_USER_NEED_REPLY_MASK) {
+                nr_replies++;
             }
         }
 
         /*
-         * At this point we know the backend has unmapped the region. It is now
-         * safe to remove it from the shadow table.
+         * The backend handles messages in order, so once all replies are in
+         * it has unmapped the region; no one uses the shadow table before.
          */
         memmove(&u->shadow_regions[shadow_reg_idx],
                 &u->shadow_regions[shadow_reg_idx + 1],
@@ -709,16 +747,17 @@ static int send_remove_regions(struct vhost_dev *dev,
         u->num_shadow_regions--;
     }
 
-    return 0;
+    return process_message_replies(dev, VHOST_USER_REM_MEM_REG, nr_replies);
 }
 
 static int send_add_regions(struct vhost_dev *dev,
                             struct scrub_regions *add_reg, int nr_add_reg,
                             VhostUserMsg *msg, uint64_t *shadow_pcb,
-                            bool reply_supported, bool track_ramblocks)
+                            bool track_ramblocks)
 {
     struct vhost_user *u = dev->opaque;
     int i, fd, ret, reg_idx, reg_fd_idx;
+    int nr_replies = 0;
     struct vhost_memory_region *reg;
     MemoryRegion *mr;
     ram_addr_t offset;
@@ -733,6 +772,7 @@ static int send_add_regions(struct vhost_dev *dev,
         mr = vhost_user_get_mr_data(reg->userspace_addr, &offset, &fd);
 
         if (fd > 0) {
+            vhost_user_check_shared(mr);
             if (track_ramblocks) {
                 trace_vhost_user_set_mem_table_withfd(reg_fd_idx, mr->name,
                                                       reg->memory_size,
@@ -795,11 +835,8 @@ static int send_add_regions(struct vhost_dev *dev,
                                  dev->mem->regions[reg_idx].guest_phys_addr);
                     return -EPROTO;
                 }
-            } else if (reply_supported) {
-                ret = process_message_reply(dev, msg);
-                if (ret) {
-                    return ret;
-                }
+            } else if (msg->hdr.flags & VHOST_USER_NEED_REPLY_MASK) {
+                nr_replies++;
             }
         } else if (track_ramblocks) {
             u->region_rb_offset[reg_idx] = 0;
@@ -807,10 +844,9 @@ static int send_add_regions(struct vhost_dev *dev,
         }
 
         /*
-         * At this point, we know the backend has mapped in the new
-         * region, if the region has a valid file descriptor.
-         *
-         * The region should now be added to the shadow table.
+         * The region should now be added to the shadow table.  Without
+         * postcopy the replies are only collected at the end, the backend
+         * handles the messages in order.
          */
         u->shadow_regions[u->num_shadow_regions].guest_phys_addr =
             reg->guest_phys_addr;
@@ -821,12 +857,11 @@ static int send_add_regions(struct vhost_dev *dev,
         u->num_shadow_regions++;
     }
 
-    return 0;
+    return process_message_replies(dev, VHOST_USER_ADD_MEM_REG, nr_replies);
 }
 
 static int vhost_user_add_remove_regions(struct vhost_dev *dev,
                                          VhostUserMsg *msg,
-                                         bool reply_supported,
                                          bool track_ramblocks)
 {
     struct vhost_user *u = dev->opaque;
@@ -843,8 +878,7 @@ static int vhost_user_add_remove_regions(struct vhost_dev *dev,
                          shadow_pcb, track_ramblocks);
 
     if (nr_rem_reg) {
-        ret = send_remove_regions(dev, rem_reg, nr_rem_reg, msg,
-                                  reply_supported);
+        ret = send_remove_regions(dev, rem_reg, nr_rem_reg, msg);
         if (ret < 0) {
             goto err;
         }
@@ -852,7 +886,7 @@ static int vhost_user_add_remove_regions(struct vhost_dev *dev,
 
     if (nr_add_reg) {
         ret = send_add_regions(dev, add_reg, nr_add_reg, msg, shadow_pcb,
-                               reply_supported, track_ramblocks);
+                               track_ramblocks);
         if (ret < 0) {
             goto err;
         }
@@ -889,7 +923,6 @@ err:
 
 static int vhost_user_set_mem_table_postcopy(struct vhost_dev *dev,
                                              struct vhost_memory *mem,
-                                             bool reply_supported,
                                              bool config_mem_slots)
 {
     struct vhost_user *u = dev->opaque;
@@ -915,7 +948,7 @@ static int vhost_user_set_mem_table_postcopy(struct vhost_dev *dev,
     }
 
     if (config_mem_slots) {
-        ret = vhost_user_add_remove_regions(dev, &msg, reply_supported, true);
+        ret = vhost_user_add_remove_regions(dev, &msg, true);
         if (ret < 0) {
             return ret;
         }
@@ -1020,8 +1053,7 @@ static int vhost_user_set_mem_table(struct vhost_dev *dev,
          * Postcopy has enough differences that it's best done in it's own
          * version
          */
-        return vhost_user_set_mem_table_postcopy(dev, mem, reply_supported,
-                                                 config_mem_slots);
+        return vhost_user_set_mem_table_postcopy(dev, mem, config_mem_slots);
     }
 
     VhostUserMsg msg = {
@@ -1033,7 +1065,7 @@ static int vhost_user_set_mem_table(struct vhost_dev *dev,
     }
 
     if (config_mem_slots) {
-        ret = vhost_user_add_remove_regions(dev, &msg, reply_supported, false);
+        ret = vhost_user_add_remove_regions(dev, &msg, false);
         if (ret < 0) {
             return ret;
         }
@@ -18,13 +18,17 @@
 #include "qemu/module.h"
 #include "qemu/timer.h"
 #include "qemu/madvise.h"
+#include "block/aio-wait.h"
+#include "block/thread-pool.h"
 #include "hw/virtio/virtio.h"
 #include "hw/mem/pc-dimm.h"
 #include "hw/qdev-properties.h"
 #include "hw/boards.h"
 #include "sysemu/balloon.h"
+#include "sysemu/runstate.h"
 #include "hw/virtio/virtio-balloon.h"
 #include "exec/address-spaces.h"
+#include "exec/ramblock.h"
 #include "qapi/error.h"
 #include "qapi/qapi-events-machine.h"
 #include "qapi/visitor.h"
@@ -325,23 +329,139 @@ static void balloon_stats_set_poll_interval(Object *obj, Visitor *v,
     balloon_stats_change_timer(s, 0);
 }
 
+/*
+ * Free page reports are discarded on the thread pool, so that big
+ * madvise()/fallocate() calls do not stall the main loop.  All elements
+ * that are available when the queue is kicked go in one batch, adjacent
+ * ranges merged, and are pushed back once their pages are gone: the
+ * guest may reuse them right after that.
+ */
+typedef struct VirtIOBalloonDiscard {
+    RAMBlock *rb;
+    ram_addr_t offset;
+    size_t size;
+} VirtIOBalloonDiscard;
+
+typedef struct VirtIOBalloonReport {
+    VirtIOBalloon *dev;
+    GPtrArray *elems;
+    GArray *ranges;
+} VirtIOBalloonReport;
+
+static void virtio_balloon_report_add(VirtIOBalloonReport *report,
+                                      RAMBlock *rb, ram_addr_t offset,
+                                      size_t size)
+{
+    VirtIOBalloonDiscard *last = NULL;
+
+    if (report->ranges->len) {
+        last = &g_array_index(report->ranges, VirtIOBalloonDiscard,
+                              report->ranges->len - 1);
+    }
+    if (last && last->rb == rb && last->offset + last->size == offset) {
+        last->size += size;
+        return;
+    }
+
+    /* Keep the block around until the discard is done */
+    memory_region_ref(rb->mr);
+    g_array_append_vals(report->ranges, &(VirtIOBalloonDiscard) {
+        .rb = rb, .offset = offset, .size = size,
+    }, 1);
+}
+
+static int virtio_balloon_report_work(void *opaque)
+{
+    VirtIOBalloonReport *report = opaque;
+    unsigned int i;
+
+    for (i = 0; i < report->ranges->len; i++) {
+        VirtIOBalloonDiscard *d = &g_array_index(report->ranges,
+                                                 VirtIOBalloonDiscard, i);
+
+        ram_block_discard_range(d->rb, d->offset, d->size);
+    }
+    return 0;
+}
+
+static void virtio_balloon_handle_report(VirtIODevice *vdev, VirtQueue *vq);
+
+static void virtio_balloon_report_done(void *opaque, int ret)
+{
+    VirtIOBalloonReport *report = opaque;
+    VirtIOBalloon *dev = report->dev;
+    VirtIODevice *vdev = VIRTIO_DEVICE(dev);
+    unsigned int i;
+
+    for (i = 0; i < report->ranges->len; i++) {
+        VirtIOBalloonDiscard *d = &g_array_index(report->ranges,
+                                                 VirtIOBalloonDiscard, i);
+
+        memory_region_unref(d->rb->mr);
+    }
+    for (i = 0; i < report->elems->len; i++) {
+        VirtQueueElement *elem = g_ptr_array_index(report->elems, i);
+
+        virtqueue_push(dev->reporting_vq, elem, 0);
+        g_free(elem);
+    }
+    virtio_notify(vdev, dev->reporting_vq);
+
+    g_ptr_array_free(report->elems, true);
+    g_array_free(report->ranges, true);
+    g_free(report);
+
+    if (dev->report_in_flight) {
+        dev->report_in_flight = false;
+        aio_wait_kick();
+        /* Pick up what the guest reported meanwhile */
+        if (vdev->vm_running) {
+            virtio_balloon_handle_report(vdev, dev->reporting_vq);
+        }
+    }
+}
+
+/*
+ * Wait for reported pages being discarded, before the queue is reset or
+ * its state migrated.
+ */
+static void virtio_balloon_report_drain(VirtIOBalloon *dev)
+{
+    AIO_WAIT_WHILE(qemu_get_aio_context(), dev->report_in_flight);
+}
+
 static void virtio_balloon_handle_report(VirtIODevice *vdev, VirtQueue *vq)
 {
     VirtIOBalloon *dev = VIRTIO_BALLOON(vdev);
+    VirtIOBalloonReport *report;
     VirtQueueElement *elem;
+    bool discard;
+
+    /* virtio_balloon_report_done() comes back for the rest */
+    if (dev->report_in_flight) {
+        return;
+    }
+
+    /*
+     * When we discard the page it has the effect of removing the page
+     * from the hypervisor itself and causing it to be zeroed when it
+     * is returned to us. So we must not discard the page if it is
+     * accessible by another device or process, or if the guest is
+     * expecting it to retain a non-zero value.
+     */
+    discard = !virtio_balloon_inhibited() && !dev->poison_val;
+
+    report = g_new0(VirtIOBalloonReport, 1);
+    report->dev = dev;
+    report->elems = g_ptr_array_new();
+    report->ranges = g_array_new(false, false, sizeof(VirtIOBalloonDiscard));
 
     while ((elem = virtqueue_pop(vq, sizeof(VirtQueueElement)))) {
         unsigned int i;
 
-        /*
-         * When we discard the page it has the effect of removing the page
-         * from the hypervisor itself and causing it to be zeroed when it
-         * is returned to us. So we must not discard the page if it is
-         * accessible by another device or process, or if the guest is
-         * expecting it to retain a non-zero value.
-         */
-        if (virtio_balloon_inhibited() || dev->poison_val) {
-            goto skip_element;
+        g_ptr_array_add(report->elems, elem);
+        if (!discard) {
+            continue;
         }
 
         for (i = 0; i < elem->in_num; i++) {
@@ -376,14 +496,18 @@ static void virtio_balloon_handle_report(VirtIODevice *vdev, VirtQueue *vq)
                 continue;
             }
 
-            ram_block_discard_range(rb, ram_offset, size);
+            virtio_balloon_report_add(report, rb, ram_offset, size);
         }
+    }
 
-skip_element:
-        virtqueue_push(vq, elem, 0);
-        virtio_notify(vdev, vq);
-        g_free(elem);
+    if (!report->elems->len || !report->ranges->len) {
+        virtio_balloon_report_done(report, 0);
+        return;
     }
+
+    dev->report_in_flight = true;
+    thread_pool_submit_aio(virtio_balloon_report_work, report,
+                           virtio_balloon_report_done, report);
 }
 
 static void virtio_balloon_handle_output(VirtIODevice *vdev, VirtQueue *vq)
@@ -896,14 +1020,44 @@ static void virtio_balloon_device_realize(DeviceState *dev, Error **errp)
                                            virtio_balloon_handle_report);
     }
 
+    /* After virtio_init(), so that vm_running is up to date on resume */
+    s->vmstate = qemu_add_vm_change_state_handler(
+        virtio_balloon_vm_state_change, s);
+
     reset_stats(s);
 }
 
+/*
+ * Reports that completed while the VM was stopped did not look at the
+ * queue again, and the guest will not kick for what it queued meanwhile.
+ * Likewise for free page hints that arrived while the iothread was
+ * blocked.
+ */
+static void virtio_balloon_vm_state_change(void *opaque, bool running,
+                                           RunState state)
+{
+    VirtIOBalloon *s = opaque;
+    VirtIODevice *vdev = VIRTIO_DEVICE(s);
+
+    if (!running || !(vdev->status & VIRTIO_CONFIG_S_DRIVER_OK)) {
+        return;
+    }
+
+    if (s->reporting_vq) {
+        virtio_balloon_handle_report(vdev, s->reporting_vq);
+    }
+    if (virtio_balloon_free_page_support(s)) {
+        qemu_bh_schedule(s->free_page_bh);
+    }
+}
+
 static void virtio_balloon_device_unrealize(DeviceState *dev)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(dev);
     VirtIOBalloon *s = VIRTIO_BALLOON(dev);
 
+    qemu_del_vm_change_state_handler(s->vmstate);
+    virtio_balloon_report_drain(s);
     if (s->free_page_bh) {
         qemu_bh_delete(s->free_page_bh);
         object_unref(OBJECT(s->iothread));
@@ -929,6 +1083,8 @@ static void virtio_balloon_device_reset(VirtIODevice *vdev)
 {
     VirtIOBalloon *s = VIRTIO_BALLOON(vdev);
 
+    virtio_balloon_report_drain(s);
+
     if (virtio_balloon_free_page_support(s)) {
         virtio_balloon_free_page_stop(s);
     }
@@ -946,6 +1102,11 @@ static void virtio_balloon_set_status(VirtIODevice *vdev, uint8_t status)
 {
     VirtIOBalloon *s = VIRTIO_BALLOON(vdev);
 
+    /* Complete the reports in flight before the device state is saved */
+    if (!vdev->vm_running) {
+        virtio_balloon_report_drain(s);
+    }
+
     if (!s->stats_vq_elem && vdev->vm_running &&
         (status & VIRTIO_CONFIG_S_DRIVER_OK) && virtqueue_rewind(s->svq, 1)) {
         /* poll stats queue for the element we have discarded when the VM
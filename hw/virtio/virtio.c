@@ -119,6 +119,11 @@ typedef struct VRingPackedDescEvent {
 struct VirtQueue
 {
     VRing vring;
+    /*
+     * Packed rings stage the elements of virtqueue_fill() here.  With
+     * VIRTIO_F_IN_ORDER this instead tracks the buffers in flight, indexed
+     * by the ring position they were made available at.
+     */
     VirtQueueElement *used_elems;
 
     /* Next head to pop */
@@ -910,6 +915,146 @@ static void virtqueue_packed_fill_desc(VirtQueue *vq,
     vring_packed_desc_write(vq->vdev, &desc, &caches->desc, head, strict_order);
 }
 
+/*
+ * With VIRTIO_F_IN_ORDER the device must use buffers in the order they were
+ * made available.  Devices may still complete requests out of order, so
+ * virtqueue_fill() only marks the element as done and virtqueue_flush()
+ * writes out the longest run of completed buffers at the head of the queue.
+ */
+static void virtqueue_ordered_record(VirtQueue *vq, unsigned int pos,
+                                     const VirtQueueElement *elem)
+{
+    vq->used_elems[pos] = (VirtQueueElement) {
+        .index = elem->index,
+        .ndescs = elem->ndescs,
+        .in_num = elem->in_num,
+    };
+}
+
+static void virtqueue_ordered_fill(VirtQueue *vq, const VirtQueueElement *elem,
+                                   unsigned int len)
+{
+    unsigned int i = vq->used_idx % vq->vring.num;
+    unsigned int n = 0;
+
+    while (n < vq->inuse) {
+        VirtQueueElement *e = &vq->used_elems[i];
+
+        if (e->index == elem->index && !e->in_order_filled) {
+            e->len = len;
+            e->in_order_filled = true;
+            return;
+        }
+        n += e->ndescs;
+        i += e->ndescs;
+        if (i >= vq->vring.num) {
+            i -= vq->vring.num;
+        }
+    }
+
+    virtio_error(vq->vdev, "Buffer %u is not in flight", elem->index);
+}
+
+/*
+ * May buffer @e be returned to the guest without a used ring entry of its
+ * own?  The entry for a later buffer implicitly returns all buffers before
+ * it, but the driver then has no length for them, so this only applies to
+ * buffers the device cannot write to.  @next is the following position.
+ */
+static bool virtqueue_ordered_skip(VirtQueue *vq, const VirtQueueElement *e,
+                                   unsigned int next, unsigned int done)
+{
+    return e->in_num == 0 && done < vq->inuse &&
+           vq->used_elems[next].in_order_filled;
+}
+
+/* Write used ring entries for the completed run, return its length */
+static unsigned int virtqueue_ordered_split_write(VirtQueue *vq)
+{
+    uint16_t start = vq->used_idx;
+    unsigned int n = 0;
+    VRingUsedElem uelem;
+
+    while (n < vq->inuse) {
+        uint16_t idx = vq->used_idx + n;
+        VirtQueueElement *e = &vq->used_elems[idx % vq->vring.num];
+
+        if (!e->in_order_filled) {
+            break;
+        }
+        e->in_order_filled = false;
+        n++;
+        idx++;
+        if (virtqueue_ordered_skip(vq, e, idx % vq->vring.num, n)) {
+            continue;
+        }
+
+        uelem.id = e->index;
+        uelem.len = e->len;
+        vring_used_write(vq, &uelem, start % vq->vring.num);
+        start = idx;
+    }
+    return n;
+}
+
+/* Same for packed rings; the return value counts descriptors */
+static unsigned int virtqueue_ordered_packed_write(VirtQueue *vq)
+{
+    VirtQueueElement *head = NULL;
+    unsigned int i = vq->used_idx;
+    unsigned int start = 0, ndescs = 0;
+
+    while (ndescs < vq->inuse) {
+        VirtQueueElement *e = &vq->used_elems[i];
+
+        if (!e->in_order_filled) {
+            break;
+        }
+        e->in_order_filled = false;
+        ndescs += e->ndescs;
+        i += e->ndescs;
+        if (i >= vq->vring.num) {
+            i -= vq->vring.num;
+        }
+        if (virtqueue_ordered_skip(vq, e, i, ndescs)) {
+            continue;
+        }
+
+        /* The first descriptor makes the batch visible, write it last */
+        if (start == 0) {
+            head = e;
+        } else {
+            virtqueue_packed_fill_desc(vq, e, start, false);
+        }
+        start = ndescs;
+    }
+
+    if (head) {
+        virtqueue_packed_fill_desc(vq, head, 0, true);
+    }
+    return ndescs;
+}
+
+/*
+ * Rebuild the in-flight tracking of a split ring from the avail ring after
+ * migration.  Whether the device may write to a buffer is not known here, so
+ * none of them is returned without its own used entry.
+ */
+static void virtqueue_ordered_restore(VirtQueue *vq)
+{
+    unsigned int n;
+
+    for (n = 0; n < vq->inuse; n++) {
+        unsigned int pos = (uint16_t)(vq->used_idx + n) % vq->vring.num;
+
+        vq->used_elems[pos] = (VirtQueueElement) {
+            .index = vring_avail_ring(vq, pos),
+            .ndescs = 1,
+            .in_num = 1,
+        };
+    }
+}
+
 /* Called within rcu_read_lock().  */
 void virtqueue_fill(VirtQueue *vq, const VirtQueueElement *elem,
                     unsigned int len, unsigned int idx)
@@ -922,7 +1067,9 @@ void virtqueue_fill(VirtQueue *vq, const VirtQueueElement *elem,
         return;
     }
 
-    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_IN_ORDER)) {
+        virtqueue_ordered_fill(vq, elem, len);
+    } else if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
         virtqueue_packed_fill(vq, elem, len, idx);
     } else {
         virtqueue_split_fill(vq, elem, len, idx);
@@ -938,6 +1085,13 @@ static void virtqueue_split_flush(VirtQueue *vq, unsigned int count)
         return;
     }
 
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_IN_ORDER)) {
+        count = virtqueue_ordered_split_write(vq);
+        if (!count) {
+            return;
+        }
+    }
+
     /* Make sure buffer is written before we update index. */
     smp_wmb();
     trace_virtqueue_flush(vq, count);
@@ -957,12 +1111,17 @@ static void virtqueue_packed_flush(VirtQueue *vq, unsigned int count)
         return;
     }
 
-    for (i = 1; i < count; i++) {
-        virtqueue_packed_fill_desc(vq, &vq->used_elems[i], i, false);
-        ndescs += vq->used_elems[i].ndescs;
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_IN_ORDER)) {
+        ndescs = virtqueue_ordered_packed_write(vq);
+    } else {
+        /* Used descriptors are placed @ndescs apart, like available ones */
+        ndescs = vq->used_elems[0].ndescs;
+        for (i = 1; i < count; i++) {
+            virtqueue_packed_fill_desc(vq, &vq->used_elems[i], ndescs, false);
+            ndescs += vq->used_elems[i].ndescs;
+        }
+        virtqueue_packed_fill_desc(vq, &vq->used_elems[0], 0, true);
     }
-    virtqueue_packed_fill_desc(vq, &vq->used_elems[0], 0, true);
-    ndescs += vq->used_elems[0].ndescs;
 
     vq->inuse -= ndescs;
     vq->used_idx += ndescs;
@@ -995,6 +1154,29 @@ void virtqueue_push(VirtQueue *vq, const VirtQueueElement *elem,
     virtqueue_flush(vq, 1);
 }
 
+/*
+ * virtqueue_push_batch:
+ * @vq: the #VirtQueue
+ * @elems: the elements to return to the guest
+ * @lens: the number of bytes written to each element
+ * @count: the number of elements
+ *
+ * Like virtqueue_push() for each element, but with a single update of the
+ * used index.  The caller still decides whether to notify the guest, once
+ * for the whole batch.
+ */
+void virtqueue_push_batch(VirtQueue *vq, VirtQueueElement *const *elems,
+                          const unsigned int *lens, unsigned int count)
+{
+    unsigned int i;
+
+    RCU_READ_LOCK_GUARD();
+    for (i = 0; i < count; i++) {
+        virtqueue_fill(vq, elems[i], lens[i], i);
+    }
+    virtqueue_flush(vq, count);
+}
+
 /* Called within rcu_read_lock().  */
 static int virtqueue_num_heads(VirtQueue *vq, unsigned int idx)
 {
@@ -1473,29 +1655,64 @@ void virtqueue_map(VirtIODevice *vdev, VirtQueueElement *elem)
                                                                         false);
 }
 
-static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_num)
+/*
+ * Lay out an element with @out_num and @in_num entries in @mem, which must
+ * be at least virtqueue_element_size(@sz, @out_num + @in_num) bytes.
+ */
+static void *virtqueue_init_element(void *mem, size_t sz, unsigned out_num,
+                                    unsigned in_num)
 {
-    VirtQueueElement *elem;
+    VirtQueueElement *elem = mem;
     size_t in_addr_ofs = QEMU_ALIGN_UP(sz, __alignof__(elem->in_addr[0]));
     size_t out_addr_ofs = in_addr_ofs + in_num * sizeof(elem->in_addr[0]);
     size_t out_addr_end = out_addr_ofs + out_num * sizeof(elem->out_addr[0]);
     size_t in_sg_ofs = QEMU_ALIGN_UP(out_addr_end, __alignof__(elem->in_sg[0]));
     size_t out_sg_ofs = in_sg_ofs + in_num * sizeof(elem->in_sg[0]);
-    size_t out_sg_end = out_sg_ofs + out_num * sizeof(elem->out_sg[0]);
 
     assert(sz >= sizeof(VirtQueueElement));
-    elem = g_malloc(out_sg_end);
-    trace_virtqueue_alloc_element(elem, sz, in_num, out_num);
     elem->out_num = out_num;
     elem->in_num = in_num;
-    elem->in_addr = (void *)elem + in_addr_ofs;
-    elem->out_addr = (void *)elem + out_addr_ofs;
-    elem->in_sg = (void *)elem + in_sg_ofs;
-    elem->out_sg = (void *)elem + out_sg_ofs;
+    elem->in_addr = mem + in_addr_ofs;
+    elem->out_addr = mem + out_addr_ofs;
+    elem->in_sg = mem + in_sg_ofs;
+    elem->out_sg = mem + out_sg_ofs;
     return elem;
 }
 
-static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
+/*
+ * virtqueue_element_size:
+ * @sz: the size of the structure that embeds the #VirtQueueElement
+ * @num_sg: the total number of in and out scatter-gather entries
+ *
+ * Returns: the number of bytes taken by an element with up to @num_sg
+ * entries, rounded up so that elements can be stored back to back.
+ */
+size_t virtqueue_element_size(size_t sz, unsigned int num_sg)
+{
+    VirtQueueElement *elem;
+    size_t addr_ofs = QEMU_ALIGN_UP(sz, __alignof__(elem->in_addr[0]));
+    size_t addr_end = addr_ofs + num_sg * sizeof(elem->in_addr[0]);
+    size_t sg_ofs = QEMU_ALIGN_UP(addr_end, __alignof__(elem->in_sg[0]));
+    size_t sg_end = sg_ofs + num_sg * sizeof(elem->in_sg[0]);
+
+    return QEMU_ALIGN_UP(sg_end, __alignof__(max_align_t));
+}
+
+static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_num)
+{
+    VirtQueueElement *elem;
+
+    elem = g_malloc(virtqueue_element_size(sz, out_num + in_num));
+    trace_virtqueue_alloc_element(elem, sz, in_num, out_num);
+    return virtqueue_init_element(elem, sz, out_num, in_num);
+}
+
+/*
+ * Pop an element into @buf if it is not NULL.  If the element does not fit
+ * in @buf_size bytes, it is left in the ring and NULL is returned.
+ */
+static void *virtqueue_split_pop(VirtQueue *vq, size_t sz, void *buf,
+                                 size_t buf_size)
 {
     unsigned int i, head, max;
     VRingMemoryRegionCaches *caches;
@@ -1609,7 +1826,17 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
     }
 
     /* Now copy what we have collected and mapped */
-    elem = virtqueue_alloc_element(sz, out_num, in_num);
+    if (!buf) {
+        elem = virtqueue_alloc_element(sz, out_num, in_num);
+    } else if (virtqueue_element_size(sz, out_num + in_num) <= buf_size) {
+        elem = virtqueue_init_element(buf, sz, out_num, in_num);
+    } else {
+        vq->last_avail_idx--;
+        if (virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
+            vring_set_avail_event(vq, vq->last_avail_idx);
+        }
+        goto err_undo_map;
+    }
     elem->index = head;
     elem->ndescs = 1;
     for (i = 0; i < out_num; i++) {
@@ -1621,6 +1848,10 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
         elem->in_sg[i] = iov[out_num + i];
     }
 
+    if (virtio_vdev_has_feature(vdev, VIRTIO_F_IN_ORDER)) {
+        virtqueue_ordered_record(vq, (uint16_t)(vq->last_avail_idx - 1) %
+                                     vq->vring.num, elem);
+    }
     vq->inuse++;
 
     trace_virtqueue_pop(vq, elem, elem->in_num, elem->out_num);
@@ -1634,7 +1865,8 @@ err_undo_map:
     goto done;
 }
 
-static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
+static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz, void *buf,
+                                  size_t buf_size)
 {
     unsigned int i, max;
     VRingMemoryRegionCaches *caches;
@@ -1737,7 +1969,13 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
     } while (rc == VIRTQUEUE_READ_DESC_MORE);
 
     /* Now copy what we have collected and mapped */
-    elem = virtqueue_alloc_element(sz, out_num, in_num);
+    if (!buf) {
+        elem = virtqueue_alloc_element(sz, out_num, in_num);
+    } else if (virtqueue_element_size(sz, out_num + in_num) <= buf_size) {
+        elem = virtqueue_init_element(buf, sz, out_num, in_num);
+    } else {
+        goto err_undo_map;
+    }
     for (i = 0; i < out_num; i++) {
         elem->out_addr[i] = addr[i];
         elem->out_sg[i] = iov[i];
@@ -1749,6 +1987,9 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
 
     elem->index = id;
     elem->ndescs = (desc_cache == &indirect_desc_cache) ? 1 : elem_entries;
+    if (virtio_vdev_has_feature(vdev, VIRTIO_F_IN_ORDER)) {
+        virtqueue_ordered_record(vq, vq->last_avail_idx, elem);
+    }
     vq->last_avail_idx += elem->ndescs;
     vq->inuse += elem->ndescs;
 
@@ -1778,12 +2019,50 @@ void *virtqueue_pop(VirtQueue *vq, size_t sz)
     }
 
     if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
-        return virtqueue_packed_pop(vq, sz);
+        return virtqueue_packed_pop(vq, sz, NULL, 0);
     } else {
-        return virtqueue_split_pop(vq, sz);
+        return virtqueue_split_pop(vq, sz, NULL, 0);
     }
 }
 
+/*
+ * virtqueue_pop_batch:
+ * @vq: the #VirtQueue
+ * @sz: the size of the structure that embeds the #VirtQueueElement
+ * @slots: storage for @max elements of @slot_size bytes each
+ * @slot_size: the size of one slot, see virtqueue_element_size()
+ * @max: the maximum number of elements to pop
+ *
+ * Pop up to @max elements like virtqueue_pop(), but build them in @slots
+ * instead of allocating each of them.  The elements do not need to be
+ * freed, the slots can be reused once the elements have been pushed or
+ * detached.  Popping stops early at an element whose scatter-gather lists
+ * do not fit in a slot; that element can be popped with virtqueue_pop().
+ *
+ * Returns: the number of elements stored in @slots.
+ */
+unsigned int virtqueue_pop_batch(VirtQueue *vq, size_t sz, void *slots,
+                                 size_t slot_size, unsigned int max)
+{
+    bool packed = virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED);
+    unsigned int i;
+
+    if (virtio_device_disabled(vq->vdev)) {
+        return 0;
+    }
+
+    RCU_READ_LOCK_GUARD();
+    for (i = 0; i < max; i++) {
+        void *buf = slots + i * slot_size;
+
+        if (!(packed ? virtqueue_packed_pop(vq, sz, buf, slot_size) :
+                       virtqueue_split_pop(vq, sz, buf, slot_size))) {
+            break;
+        }
+    }
+    return i;
+}
+
 static unsigned int virtqueue_packed_drop_all(VirtQueue *vq)
 {
     VRingMemoryRegionCaches *caches;
@@ -1821,6 +2100,10 @@ static unsigned int virtqueue_packed_drop_all(VirtQueue *vq)
                                                vq->vring.num, &idx, false)) {
             ++elem.ndescs;
         }
+        if (virtio_vdev_has_feature(vdev, VIRTIO_F_IN_ORDER)) {
+            virtqueue_ordered_record(vq, vq->last_avail_idx, &elem);
+        }
+        vq->inuse += elem.ndescs;
         /*
          * immediately push the element, nothing to unmap
          * as both in_num and out_num are set to 0.
@@ -1840,7 +2123,7 @@ static unsigned int virtqueue_packed_drop_all(VirtQueue *vq)
 static unsigned int virtqueue_split_drop_all(VirtQueue *vq)
 {
     unsigned int dropped = 0;
-    VirtQueueElement elem = {};
+    VirtQueueElement elem = { .ndescs = 1 };
     VirtIODevice *vdev = vq->vdev;
     bool fEventIdx = virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX);
 
@@ -1851,6 +2134,10 @@ static unsigned int virtqueue_split_drop_all(VirtQueue *vq)
         if (!virtqueue_get_head(vq, vq->last_avail_idx, &elem.index)) {
             break;
         }
+        if (virtio_vdev_has_feature(vdev, VIRTIO_F_IN_ORDER)) {
+            virtqueue_ordered_record(vq, vq->last_avail_idx % vq->vring.num,
+                                     &elem);
+        }
         vq->inuse++;
         vq->last_avail_idx++;
         if (fEventIdx) {
@@ -3164,6 +3451,9 @@ virtio_load(VirtIODevice *vdev, QEMUFile *f, int version_id)
                              vdev->vq[i].used_idx);
                 return -1;
             }
+            if (virtio_vdev_has_feature(vdev, VIRTIO_F_IN_ORDER)) {
+                virtqueue_ordered_restore(&vdev->vq[i]);
+            }
         }
     }
 
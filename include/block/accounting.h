@@ -26,6 +26,7 @@
 #define BLOCK_ACCOUNTING_H
 
 #include "qemu/timed-average.h"
+#include "qemu/stats64.h"
 #include "qemu/thread.h"
 #include "qapi/qapi-types-common.h"
 
@@ -79,19 +80,39 @@ typedef struct BlockLatencyHistogram {
     uint64_t *bins;
 } BlockLatencyHistogram;
 
+/*
+ * The latency of every request is also counted in a histogram with fixed
+ * bins: bin i < BLOCK_LATENCY_HDR_SUB is for a latency of i ns, after that
+ * each power of two is split into BLOCK_LATENCY_HDR_SUB bins of the same
+ * width, so that no bin is wider than 1/BLOCK_LATENCY_HDR_SUB of its
+ * lower bound.  Latencies of 2^BLOCK_LATENCY_HDR_MAX_BITS ns (about 69
+ * seconds) and more go in the last bin.
+ */
+#define BLOCK_LATENCY_HDR_SUB_BITS  3
+#define BLOCK_LATENCY_HDR_SUB       (1 << BLOCK_LATENCY_HDR_SUB_BITS)
+#define BLOCK_LATENCY_HDR_MAX_BITS  36
+#define BLOCK_LATENCY_HDR_BINS \
+    ((BLOCK_LATENCY_HDR_MAX_BITS - BLOCK_LATENCY_HDR_SUB_BITS + 1) * \
+     BLOCK_LATENCY_HDR_SUB)
+
 struct BlockAcctStats {
+    /*
+     * Protects intervals and latency_histogram.  The counters are
+     * updated without it.
+     */
     QemuMutex lock;
-    uint64_t nr_bytes[BLOCK_MAX_IOTYPE];
-    uint64_t nr_ops[BLOCK_MAX_IOTYPE];
-    uint64_t invalid_ops[BLOCK_MAX_IOTYPE];
-    uint64_t failed_ops[BLOCK_MAX_IOTYPE];
-    uint64_t total_time_ns[BLOCK_MAX_IOTYPE];
-    uint64_t merged[BLOCK_MAX_IOTYPE];
-    int64_t last_access_time_ns;
+    Stat64 nr_bytes[BLOCK_MAX_IOTYPE];
+    Stat64 nr_ops[BLOCK_MAX_IOTYPE];
+    Stat64 invalid_ops[BLOCK_MAX_IOTYPE];
+    Stat64 failed_ops[BLOCK_MAX_IOTYPE];
+    Stat64 total_time_ns[BLOCK_MAX_IOTYPE];
+    Stat64 merged[BLOCK_MAX_IOTYPE];
+    Stat64 last_access_time_ns;
     QSLIST_HEAD(, BlockAcctTimedStats) intervals;
     bool account_invalid;
     bool account_failed;
     BlockLatencyHistogram latency_histogram[BLOCK_MAX_IOTYPE];
+    Stat64 latency_hdr[BLOCK_MAX_IOTYPE][BLOCK_LATENCY_HDR_BINS];
 };
 
 typedef struct BlockAcctCookie {
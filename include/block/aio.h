@@ -20,6 +20,7 @@
 #include "qemu/coroutine-core.h"
 #include "qemu/queue.h"
 #include "qemu/event_notifier.h"
+#include "qemu/stats64.h"
 #include "qemu/thread.h"
 #include "qemu/timer.h"
 #include "block/graph-lock.h"
@@ -217,6 +218,7 @@ struct AioContext {
     /* State for file descriptor monitoring using Linux io_uring */
     struct io_uring fdmon_io_uring;
     AioHandlerSList submit_list;
+    bool fdmon_io_uring_multishot; /* use multishot IORING_OP_POLL_ADD? */
 #endif
 
     /* TimerLists for calling timers - one per clock type.  Has its own
@@ -227,12 +229,32 @@ struct AioContext {
     /* Number of AioHandlers without .io_poll() */
     int poll_disable_cnt;
 
-    /* Polling mode parameters */
+    /*
+     * Polling mode parameters.  Each AioHandler adapts its own polling
+     * time, and poll_ns is the longest of them at the last aio_poll().
+     */
     int64_t poll_ns;        /* current polling time in nanoseconds */
     int64_t poll_max_ns;    /* maximum polling time in nanoseconds */
     int64_t poll_grow;      /* polling time growth factor */
     int64_t poll_shrink;    /* polling time shrink factor */
 
+    /*
+     * Polling statistics.  Written by the AioContext's home thread and
+     * read by query-stats from any thread.  The wait statistics are only
+     * collected while polling is enabled.
+     */
+    Stat64 poll_window_ns;  /* copy of poll_ns */
+    Stat64 poll_hits;       /* polling found an event */
+    Stat64 poll_misses;     /* polling ended without finding an event */
+    Stat64 poll_time_ns;    /* total time spent polling */
+    Stat64 waits;           /* aio_poll() calls that waited for an event */
+    Stat64 wait_time_ns;    /* total time those calls took to see it */
+    int poll_handlers;      /* size of the polling set */
+
+    /* Coroutines created in this context's thread, see qemu-coroutine.c */
+    Stat64 coroutine_pool_hits;
+    Stat64 coroutine_pool_misses;
+
     /* AIO engine parameters */
     int64_t aio_max_batch;  /* maximum number of requests in a batch */
 
@@ -706,6 +728,18 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
  */
 void aio_context_set_aio_params(AioContext *ctx, int64_t max_batch);
 
+/**
+ * aio_context_enable_sqpoll:
+ * @ctx: the aio context
+ * @cpu: host CPU to pin the kernel polling thread to, or -1
+ * @errp: pointer to Error*, to store an error if it happens.
+ *
+ * Let a kernel thread poll the io_uring used for file descriptor
+ * monitoring, which saves system calls in aio_poll() at the cost of a
+ * host CPU.  Must be called before @ctx is run by any thread.
+ */
+bool aio_context_enable_sqpoll(AioContext *ctx, int cpu, Error **errp);
+
 /**
  * aio_context_set_thread_pool_params:
  * @ctx: the aio context
@@ -98,4 +98,22 @@ BdrvDirtyBitmap *block_copy_dirty_bitmap(BlockCopyState *s);
 int64_t block_copy_cluster_size(BlockCopyState *s);
 void block_copy_set_skip_unallocated(BlockCopyState *s, bool skip);
 
+/*
+ * Let block_copy() return as soon as the data has been read from the
+ * source, and write it to the target in the background.  At most @bytes
+ * are buffered this way, further requests are copied synchronously.  Zero
+ * (the default) disables write-behind.  block_copy_async() is not affected.
+ *
+ * Must be called prior to any actual copy request.
+ */
+void block_copy_set_write_behind(BlockCopyState *s, int64_t bytes);
+
+/*
+ * Wait until all background writes intersecting @offset/@bytes have reached
+ * the target.  Returns the first error of any background write, 0 if there
+ * was none.
+ */
+int coroutine_fn block_copy_wait_write_behind(BlockCopyState *s,
+                                              int64_t offset, int64_t bytes);
+
 #endif /* BLOCK_COPY_H */
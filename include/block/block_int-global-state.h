@@ -69,7 +69,7 @@ void stream_start(const char *job_id, BlockDriverState *bs,
                   bool backing_mask_protocol,
                   BlockDriverState *bottom,
                   int creation_flags, int64_t speed,
-                  BlockdevOnError on_error,
+                  BlockdevOnError on_error, int max_workers,
                   const char *filter_node_name,
                   Error **errp);
 
@@ -73,6 +73,8 @@ int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
                                   QEMUIOVector *qiov, int type);
 void luring_detach_aio_context(LuringState *s, AioContext *old_context);
 void luring_attach_aio_context(LuringState *s, AioContext *new_context);
+void luring_register_buf(void *host, size_t size);
+void luring_unregister_buf(void *host, size_t size);
 #endif
 
 #ifdef _WIN32
@@ -49,6 +49,13 @@ typedef struct ThrottleGroupMember {
      */
     unsigned int restart_pending;
 
+    /* Tokens taken from the group ahead of time, which admit requests
+     * without the ThrottleGroup lock.  Accessed with atomic operations.
+     * UINT32_MAX cache_bytes means that no bps limit applies.
+     */
+    uint32_t     cache_ops[THROTTLE_MAX];
+    uint32_t     cache_bytes[THROTTLE_MAX];
+
     /* The following fields are protected by the ThrottleGroup lock.
      * See the ThrottleGroup documentation for details.
      * throttle_state tells us if I/O limits are configured. */
@@ -32,6 +32,7 @@
 #include "qom/object.h"
 
 #define TCP_MAX_FDS 16
+#define TCP_COALESCE_MAX 4096
 
 typedef struct {
     char buf[21];
@@ -78,6 +79,10 @@ struct SocketChardev {
     bool connect_err_reported;
 
     QIOTask *connect_task;
+
+    uint32_t coalesce_ms;
+    GByteArray *coalesce_buf;
+    GSource *coalesce_timer;
 };
 typedef struct SocketChardev SocketChardev;
 
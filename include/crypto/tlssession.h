@@ -315,6 +315,30 @@ qcrypto_tls_session_get_handshake_status(QCryptoTLSSession *sess);
 int qcrypto_tls_session_get_key_size(QCryptoTLSSession *sess,
                                      Error **errp);
 
+#define QCRYPTO_TLS_KTLS_TX  (1 << 0)
+#define QCRYPTO_TLS_KTLS_RX  (1 << 1)
+
+/**
+ * qcrypto_tls_session_enable_ktls:
+ * @sess: the TLS session object
+ * @fd: the socket that carries the session
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * If the credentials of @sess have the "ktls" property set,
+ * hand the record keys of the completed handshake to the
+ * kernel TLS implementation of @fd.  For each direction that
+ * is offloaded, the caller must from then on read or write
+ * plain data on @fd instead of using qcrypto_tls_session_read()
+ * or qcrypto_tls_session_write().  Receive is not offloaded
+ * while the session still buffers received data.
+ *
+ * Returns: a mask of QCRYPTO_TLS_KTLS_TX and QCRYPTO_TLS_KTLS_RX
+ * for the offloaded directions, or -1 on error, in which case
+ * the session is unchanged
+ */
+int qcrypto_tls_session_enable_ktls(QCryptoTLSSession *sess, int fd,
+                                    Error **errp);
+
 /**
  * qcrypto_tls_session_get_peer_name:
  * @sess: the TLS session object
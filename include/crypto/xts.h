@@ -29,6 +29,10 @@
 
 #define XTS_BLOCK_SIZE 16
 
+/*
+ * Encrypts or decrypts @length bytes, a multiple of XTS_BLOCK_SIZE,
+ * block by block as in ECB mode.
+ */
 typedef void xts_cipher_func(const void *ctx,
                              size_t length,
                              uint8_t *dst,
@@ -0,0 +1,39 @@
+/*
+ * Sampled access statistics for I/O memory regions
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.
+ */
+
+#ifndef EXEC_MEMORY_STATS_H
+#define EXEC_MEMORY_STATS_H
+
+#include "exec/memory.h"
+
+/*
+ * One in memory_region_stats_period accesses dispatched to an I/O region
+ * is timed, counted for the whole period and put in the latency
+ * histogram of the region.  0 disables sampling.
+ */
+extern uint32_t memory_region_stats_period;
+
+/* @period must be 0 or a power of two */
+void memory_region_stats_set_period(uint32_t period);
+
+/* Returns the period if the access about to be dispatched is sampled */
+static inline uint32_t memory_region_stats_sample(void)
+{
+    static __thread uint32_t tick;
+    uint32_t period = qatomic_read(&memory_region_stats_period);
+
+    if (likely(!period) || (++tick & (period - 1))) {
+        return 0;
+    }
+    return period;
+}
+
+void memory_region_stats_account(MemoryRegion *mr, bool is_write,
+                                 uint32_t period, int64_t latency_ns);
+void memory_region_stats_free(MemoryRegion *mr);
+
+#endif
@@ -56,7 +56,9 @@ static inline void clear_bmap_set(RAMBlock *rb, uint64_t start,
 {
     uint8_t shift = rb->clear_bmap_shift;
 
-    bitmap_set(rb->clear_bmap, start >> shift, clear_bmap_size(npages, shift));
+    /* Parts of a RAMBlock can be synced in parallel */
+    bitmap_set_atomic(rb->clear_bmap, start >> shift,
+                      clear_bmap_size(npages, shift));
 }
 
 /**
@@ -490,15 +492,22 @@ uint64_t cpu_physical_memory_sync_dirty_bitmap(RAMBlock *rb,
                 &ram_list.dirty_memory[DIRTY_MEMORY_MIGRATION])->blocks;
 
         for (k = page; k < page + nr; k++) {
+            unsigned long bits = 0;
+
             if (src[idx][offset]) {
-                unsigned long bits = qatomic_xchg(&src[idx][offset], 0);
                 unsigned long new_dirty;
+                bits = qatomic_xchg(&src[idx][offset], 0);
                 new_dirty = ~dest[k];
                 dest[k] |= bits;
                 new_dirty &= bits;
                 num_dirty += ctpopl(new_dirty);
             }
 
+            if (rb->hotmap) {
+                rb->hotmap[k] = bits & rb->dirty_hist[k];
+                rb->dirty_hist[k] = bits;
+            }
+
             if (++offset >= BITS_TO_LONGS(DIRTY_MEMORY_BLOCK_SIZE)) {
                 offset = 0;
                 idx++;
@@ -521,13 +530,26 @@ uint64_t cpu_physical_memory_sync_dirty_bitmap(RAMBlock *rb,
         ram_addr_t offset = rb->offset;
 
         for (addr = 0; addr < length; addr += TARGET_PAGE_SIZE) {
-            if (cpu_physical_memory_test_and_clear_dirty(
+            long k = (start + addr) >> TARGET_PAGE_BITS;
+            bool dirty = cpu_physical_memory_test_and_clear_dirty(
                         start + addr + offset,
                         TARGET_PAGE_SIZE,
-                        DIRTY_MEMORY_MIGRATION)) {
-                long k = (start + addr) >> TARGET_PAGE_BITS;
-                if (!test_and_set_bit(k, dest)) {
-                    num_dirty++;
+                        DIRTY_MEMORY_MIGRATION);
+
+            if (dirty && !test_and_set_bit(k, dest)) {
+                num_dirty++;
+            }
+
+            if (rb->hotmap) {
+                if (dirty && test_bit(k, rb->dirty_hist)) {
+                    set_bit(k, rb->hotmap);
+                } else {
+                    clear_bit(k, rb->hotmap);
+                }
+                if (dirty) {
+                    set_bit(k, rb->dirty_hist);
+                } else {
+                    clear_bit(k, rb->dirty_hist);
                 }
             }
         }
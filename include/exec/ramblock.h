@@ -66,6 +66,27 @@ struct RAMBlock {
     unsigned long *clear_bmap;
     uint8_t clear_bmap_shift;
 
+    /*
+     * Only allocated with the defer-hot-pages migration capability.
+     * dirty_hist has the pages dirtied since the previous global sync,
+     * and hotmap the pages dirtied both in the last and in the previous
+     * sync period.  During the iterative phase of precopy, the pages in
+     * hotmap are left dirty in bmap and are only sent at the end.  Both
+     * are protected by ram_state.bitmap_mutex like bmap.
+     */
+    unsigned long *dirty_hist;
+    unsigned long *hotmap;
+
+    /*
+     * With the mapped-ram migration capability, every page of the block
+     * has a fixed place in the migration file, starting at pages_offset.
+     * file_bmap has the pages that are present in the file; it is
+     * written at bitmap_offset when the migration completes.
+     */
+    unsigned long *file_bmap;
+    off_t bitmap_offset;
+    uint64_t pages_offset;
+
     /*
      * RAM block length that corresponds to the used_length on the migration
      * source (after RAM block sizes were synchronized). Especially, after
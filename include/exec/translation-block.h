@@ -88,6 +88,18 @@ struct TranslationBlock {
     uint16_t size;
     uint16_t icount;
 
+    /*
+     * Number of executions left before a block translated without
+     * optimization is translated again, or 0 for an optimized block.
+     * Such blocks are never chained, so that each execution is counted.
+     */
+    uint16_t warmup;
+    /*
+     * Set on the translation that replaces a warmed-up block; the
+     * translator may then follow direct jumps (translator_follow_jump).
+     */
+    bool hot;
+
     struct tb_tc tc;
 
     /*
@@ -159,6 +159,18 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
  */
 bool translator_use_goto_tb(DisasContextBase *db, vaddr dest);
 
+/**
+ * translator_follow_jump
+ * @db: Disassembly context
+ * @dest: target pc of an unconditional direct jump
+ *
+ * Return true if translation may continue at @dest instead of ending
+ * the TB with a goto_tb.  This is only allowed in hot TBs, and only for
+ * forward jumps within the page, so that the guest code of the TB still
+ * lies between pc_first and pc_next.
+ */
+bool translator_follow_jump(DisasContextBase *db, vaddr dest);
+
 /**
  * translator_io_start
  * @db: Disassembly context
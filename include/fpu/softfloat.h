@@ -598,6 +598,15 @@ float32 float32_div(float32, float32, float_status *status);
 float32 float32_rem(float32, float32, float_status *status);
 float32 float32_muladd(float32, float32, float32, int, float_status *status);
 float32 float32_sqrt(float32, float_status *status);
+/* d[i] = a[i] op b[i] for 0 <= i < n; d may alias a or b exactly */
+void float32_add_array(float32 *d, const float32 *a, const float32 *b,
+                       size_t n, float_status *status);
+void float32_sub_array(float32 *d, const float32 *a, const float32 *b,
+                       size_t n, float_status *status);
+void float32_mul_array(float32 *d, const float32 *a, const float32 *b,
+                       size_t n, float_status *status);
+void float32_div_array(float32 *d, const float32 *a, const float32 *b,
+                       size_t n, float_status *status);
 float32 float32_exp2(float32, float_status *status);
 float32 float32_log2(float32, float_status *status);
 FloatRelation float32_compare(float32, float32, float_status *status);
@@ -793,6 +802,15 @@ float64 float64_div(float64, float64, float_status *status);
 float64 float64_rem(float64, float64, float_status *status);
 float64 float64_muladd(float64, float64, float64, int, float_status *status);
 float64 float64_sqrt(float64, float_status *status);
+/* d[i] = a[i] op b[i] for 0 <= i < n; d may alias a or b exactly */
+void float64_add_array(float64 *d, const float64 *a, const float64 *b,
+                       size_t n, float_status *status);
+void float64_sub_array(float64 *d, const float64 *a, const float64 *b,
+                       size_t n, float_status *status);
+void float64_mul_array(float64 *d, const float64 *a, const float64 *b,
+                       size_t n, float_status *status);
+void float64_div_array(float64 *d, const float64 *a, const float64 *b,
+                       size_t n, float_status *status);
 float64 float64_log2(float64, float_status *status);
 FloatRelation float64_compare(float64, float64, float_status *status);
 FloatRelation float64_compare_quiet(float64, float64, float_status *status);
@@ -79,5 +79,6 @@ extern const VMStateDescription vmstate_ecc_state;
 /* m25p80.c */
 
 BlockBackend *m25p80_get_blk(DeviceState *dev);
+MemoryRegion *m25p80_get_memory(DeviceState *dev);
 
 #endif
@@ -0,0 +1,39 @@
+/*
+ * IOThread queue mapping for multiqueue block devices
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef HW_BLOCK_IOTHREAD_VQ_MAPPING_H
+#define HW_BLOCK_IOTHREAD_VQ_MAPPING_H
+
+#include "qapi/qapi-types-virtio.h"
+
+/**
+ * iothread_vq_mapping_apply:
+ * @list: The mapping of queues to IOThreads.
+ * @vq_aio_context: The array of AioContext pointers to fill in.
+ * @num_queues: The length of @vq_aio_context.
+ * @errp: If an error occurs, a pointer to the area to store the error.
+ *
+ * Fill in the AioContext for each queue in the @vq_aio_context array given
+ * the iothread-vq-mapping parameter in @list.  A reference is taken on each
+ * IOThread, drop them with iothread_vq_mapping_cleanup().
+ *
+ * Returns: %true on success, %false on failure.
+ **/
+bool iothread_vq_mapping_apply(IOThreadVirtQueueMappingList *list,
+                               AioContext **vq_aio_context,
+                               uint16_t num_queues,
+                               Error **errp);
+
+/**
+ * iothread_vq_mapping_cleanup:
+ * @list: The mapping of queues to IOThreads.
+ *
+ * Release the IOThread references taken by iothread_vq_mapping_apply().
+ **/
+void iothread_vq_mapping_cleanup(IOThreadVirtQueueMappingList *list);
+
+#endif /* HW_BLOCK_IOTHREAD_VQ_MAPPING_H */
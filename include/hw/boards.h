@@ -370,6 +370,7 @@ struct MachineState {
     char *dt_compatible;
     bool dump_guest_core;
     bool mem_merge;
+    bool map_images;
     bool usb;
     bool usb_disabled;
     char *firmware;
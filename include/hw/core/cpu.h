@@ -81,6 +81,19 @@ DECLARE_CLASS_CHECKERS(CPUClass, CPU,
     typedef struct ArchCPU CpuInstanceType; \
     OBJECT_DECLARE_TYPE(ArchCPU, CpuClassType, CPU_MODULE_OBJ_NAME);
 
+/*
+ * Reasons for a vCPU to leave the generated code and go back to the
+ * TCG execution loop, counted in CPUState.tcg_exits.
+ */
+typedef enum TCGExitCause {
+    TCG_EXIT_CAUSE_EXCEPTION,   /* cpu_loop_exit with an exception */
+    TCG_EXIT_CAUSE_INTERRUPT,   /* interrupt taken by cpu_exec_interrupt */
+    TCG_EXIT_CAUSE_TB_MISS,     /* no TB for the next pc, translated one */
+    TCG_EXIT_CAUSE_IO,          /* TB rewound to recompile an I/O insn */
+    TCG_EXIT_CAUSE_REQUEST,     /* exit_request, e.g. from another thread */
+    TCG_EXIT_CAUSE__MAX
+} TCGExitCause;
+
 typedef enum MMUAccessType {
     MMU_DATA_LOAD  = 0,
     MMU_DATA_STORE = 1,
@@ -199,8 +212,12 @@ struct CPUClass {
  */
 #define NB_MMU_MODES 16
 
-/* Use a fully associative victim tlb of 8 entries. */
+/*
+ * By default, use a fully associative victim tlb of 8 entries.
+ * The tcg accelerator properties can make it larger and set associative.
+ */
 #define CPU_VTLB_SIZE 8
+#define CPU_VTLB_MAX_SIZE 4096
 
 /*
  * The full TLB entry, which is not accessed by generated TCG code,
@@ -283,8 +300,8 @@ typedef struct CPUTLBDesc {
     /* The next index to use in the tlb victim table.  */
     size_t vindex;
     /* The tlb victim table, in two parts.  */
-    CPUTLBEntry vtable[CPU_VTLB_SIZE];
-    CPUTLBEntryFull vfulltlb[CPU_VTLB_SIZE];
+    CPUTLBEntry *vtable;
+    CPUTLBEntryFull *vfulltlb;
     CPUTLBEntryFull *fulltlb;
 } CPUTLBDesc;
 
@@ -308,6 +325,18 @@ typedef struct CPUTLBCommon {
     size_t full_flush_count;
     size_t part_flush_count;
     size_t elide_flush_count;
+    /* Slow path lookups, and how many of them hit in the victim tlb. */
+    size_t miss_count;
+    size_t victim_hit_count;
+    /*
+     * Flushes that other vCPUs queued for this one in the _synced
+     * operations, pushed and drained without locks, and the number of
+     * flushes this vCPU queued that are not done yet.  The event wakes
+     * the vCPU while it waits for the latter.
+     */
+    QSLIST_HEAD(, TLBShootdown) shootdown;
+    int shootdown_pending;
+    QemuEvent shootdown_event;
 } CPUTLBCommon;
 
 /*
@@ -421,6 +450,8 @@ struct qemu_work_item;
  * @crash_occurred: Indicates the OS reported a crash (panic) for this CPU
  * @singlestep_enabled: Flags for single-stepping.
  * @icount_extra: Instructions until next timer event.
+ * @icount_io_pending: Instructions of the current TB that were charged to
+ *   the icount budget but do not run before the current I/O access.
  * @neg.can_do_io: True if memory-mapped IO is allowed.
  * @cpu_ases: Pointer to array of CPUAddressSpaces (which define the
  *            AddressSpaces this CPU has)
@@ -445,6 +476,9 @@ struct qemu_work_item;
  *    ring is enabled.
  * @kvm_fetch_index: Keeps the index that we last fetched from the per-vCPU
  *    dirty ring structure.
+ * @tcg_exits: Number of returns to the TCG execution loop, per cause.
+ * @tcg_atomic_steps: Number of instructions run with all other vCPUs
+ *    stopped, because the host could not perform their atomic operation.
  *
  * State of one CPU core or thread.
  *
@@ -486,6 +520,7 @@ struct CPUState {
     int singlestep_enabled;
     int64_t icount_budget;
     int64_t icount_extra;
+    int64_t icount_io_pending;
     uint64_t random_seed;
     sigjmp_buf jmp_env;
 
@@ -496,8 +531,11 @@ struct CPUState {
     int num_ases;
     AddressSpace *as;
     MemoryRegion *memory;
+    ThreadContext *thread_context;
 
     CPUJumpCache *tb_jmp_cache;
+    uint64_t tcg_exits[TCG_EXIT_CAUSE__MAX];
+    uint64_t tcg_atomic_steps;
 
     GArray *gdb_regs;
     int gdb_num_regs;
@@ -543,9 +543,13 @@ static ssize_t glue(load_elf, SZ)(const char *name, int fd,
 
                     /*
                      * rom_add_elf_program() takes its own reference to
-                     * 'mapped_file'.
+                     * 'mapped_file'.  The segment can only be mapped from
+                     * the file if it was not patched above.
                      */
-                    rom_add_elf_program(label, mapped_file, data, file_size,
+                    rom_add_elf_program(label,
+                                        translate_fn || data_swab ? NULL
+                                                                  : name,
+                                        mapped_file, data, file_size,
                                         mem_size, addr, as);
                 } else {
                     MemTxResult res;
@@ -33,7 +33,12 @@ typedef struct RISCVAclintMTimerState {
     SysBusDevice parent_obj;
     uint64_t time_delta;
     uint64_t *timecmp;
-    QEMUTimer **timers;
+    /* A single host timer drives the interrupts of all the harts */
+    QEMUTimer *timer;
+    /* Virtual clock deadline of each hart interrupt, or INT64_MAX */
+    int64_t *deadline;
+    /* Deadline the timer is armed for, or INT64_MAX */
+    int64_t next_deadline;
 
     /*< public >*/
     MemoryRegion mmio;
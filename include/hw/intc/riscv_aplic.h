@@ -53,6 +53,8 @@ struct RISCVAPLICState {
     uint32_t *idelivery;
     uint32_t *iforce;
     uint32_t *ithreshold;
+    /* Direct mode: enabled and pending sources targeting each hart */
+    unsigned long *idc_enpend;
 
     /* topology */
 #define QEMU_APLIC_MAX_CHILDREN        16
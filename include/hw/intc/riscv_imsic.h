@@ -55,6 +55,15 @@ struct RISCVIMSICState {
     uint32_t *eithreshold;
     uint32_t *eistate;
 
+    /*
+     * Pending and enabled bits of each page, num_irqs bits per page.
+     * eistate is only kept up to date across migration.
+     */
+    unsigned long *eip;
+    unsigned long *eie;
+    /* Level of each output line, or -1 if it has to be set again */
+    int8_t *eilevel;
+
     /* config */
     bool mmode;
     uint32_t hartid;
@@ -279,7 +279,8 @@ MemoryRegion *rom_add_blob(const char *name, const void *blob, size_t len,
                            FWCfgCallback fw_callback,
                            void *callback_opaque, AddressSpace *as,
                            bool read_only);
-int rom_add_elf_program(const char *name, GMappedFile *mapped_file, void *data,
+int rom_add_elf_program(const char *name, const char *file,
+                        GMappedFile *mapped_file, void *data,
                         size_t datasize, size_t romsize, hwaddr addr,
                         AddressSpace *as);
 int rom_check_and_register_reset(void);
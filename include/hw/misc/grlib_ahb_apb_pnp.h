@@ -46,6 +46,9 @@ void grlib_apb_pnp_add_entry(APBPnp *dev, uint32_t address, uint32_t mask,
 #define GRLIB_APBUART_DEV    (0x0C)
 #define GRLIB_IRQMP_DEV      (0x0D)
 #define GRLIB_GPTIMER_DEV    (0x11)
+#define GRLIB_GRETH_DEV      (0x1D)
+#define GRLIB_GRSPW2_DEV     (0x29)
+#define GRLIB_NOELV_DEV      (0xBD)
 /* TYPE */
 #define GRLIB_CPU_AREA       (0x00)
 #define GRLIB_APBIO_AREA     (0x01)
@@ -0,0 +1,12 @@
+/*
+ * GRLIB GRETH Ethernet MAC
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef GRLIB_GRETH_H
+#define GRLIB_GRETH_H
+
+#define TYPE_GRLIB_GRETH "grlib-greth"
+
+#endif
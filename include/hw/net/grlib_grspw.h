@@ -0,0 +1,12 @@
+/*
+ * GRLIB GRSPW2 SpaceWire codec
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef GRLIB_GRSPW_H
+#define GRLIB_GRSPW_H
+
+#define TYPE_GRLIB_GRSPW "grlib-grspw"
+
+#endif
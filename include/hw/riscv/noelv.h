@@ -0,0 +1,74 @@
+/*
+ * QEMU RISC-V GRLIB NOEL-V generic board
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef HW_RISCV_NOELV_H
+#define HW_RISCV_NOELV_H
+
+#include "hw/riscv/riscv_hart.h"
+#include "hw/sysbus.h"
+#include "hw/boards.h"
+#include "qom/object.h"
+
+#define NOELV_CPUS_MAX 8
+
+#define TYPE_RISCV_NOELV_MACHINE MACHINE_TYPE_NAME("noelv-generic")
+typedef struct NOELVState NOELVState;
+DECLARE_INSTANCE_CHECKER(NOELVState, RISCV_NOELV_MACHINE,
+                         TYPE_RISCV_NOELV_MACHINE)
+
+struct NOELVState {
+    /*< private >*/
+    MachineState parent;
+
+    /*< public >*/
+    RISCVHartArrayState soc;
+    DeviceState *plic;
+    DeviceState *irqmp;
+
+    bool have_aclint;
+    bool have_irqmp;
+    bool park_harts;
+
+    /* Boot state, set up directly in the harts at reset */
+    target_ulong start_addr;
+    hwaddr fw_dyn_addr;
+};
+
+enum {
+    NOELV_RAM,
+    NOELV_MROM,
+    NOELV_CLINT,
+    NOELV_ACLINT_SSWI,
+    NOELV_PLIC,
+    NOELV_GPTIMER,
+    NOELV_APBUART,
+    NOELV_IRQMP,
+    NOELV_GRETH,
+    NOELV_GRSPW,
+    NOELV_APB_PNP,
+    NOELV_AHB_PNP,
+};
+
+/* Interrupt lines, both on the PLIC and on the IRQMP */
+enum {
+    NOELV_APBUART_IRQ = 1,
+    NOELV_GPTIMER_IRQ = 2,
+    NOELV_GRETH_IRQ = 5,
+    NOELV_GRSPW_IRQ = 6,
+};
+
+#define NOELV_GPTIMER_COUNT 2
+
+#define NOELV_PLIC_NUM_SOURCES 32
+#define NOELV_PLIC_NUM_PRIORITIES 7
+#define NOELV_PLIC_PRIORITY_BASE 0x00
+#define NOELV_PLIC_PENDING_BASE 0x1000
+#define NOELV_PLIC_ENABLE_BASE 0x2000
+#define NOELV_PLIC_ENABLE_STRIDE 0x80
+#define NOELV_PLIC_CONTEXT_BASE 0x200000
+#define NOELV_PLIC_CONTEXT_STRIDE 0x1000
+
+#endif /* HW_RISCV_NOELV_H */
@@ -54,6 +54,16 @@ struct SSIPeripheralClass {
      * always be called for the device for every txrx access to the parent bus
      */
     uint32_t (*transfer_raw)(SSIPeripheral *dev, uint32_t val);
+
+    /*
+     * Optional, for 8-bit devices that can move a whole buffer at once.
+     * Called by ssi_transfer_bulk() instead of one transfer per byte,
+     * with the same CS rules as transfer.  @tx is NULL to send zeroes
+     * and @rx is NULL to discard what the device returns.  Devices
+     * that override transfer_raw always get the byte loop.
+     */
+    void (*transfer_bulk)(SSIPeripheral *dev, const uint8_t *tx,
+                          uint8_t *rx, uint32_t len);
 };
 
 struct SSIPeripheral {
@@ -112,6 +122,19 @@ SSIBus *ssi_create_bus(DeviceState *parent, const char *name);
 
 uint32_t ssi_transfer(SSIBus *bus, uint32_t val);
 
+/**
+ * ssi_transfer_bulk: transfer a buffer of bytes
+ * @bus: SSI bus
+ * @tx: bytes to send, or NULL to send zeroes
+ * @rx: where to store the bytes received, or NULL
+ * @len: number of bytes
+ *
+ * Equivalent to calling ssi_transfer() for each byte of @tx, but lets
+ * peripherals that implement transfer_bulk copy the data in one go.
+ */
+void ssi_transfer_bulk(SSIBus *bus, const uint8_t *tx, uint8_t *rx,
+                       uint32_t len);
+
 DeviceState *ssi_get_cs(SSIBus *bus, uint8_t cs_index);
 
 #endif
@@ -71,6 +71,18 @@ typedef struct VFIOMigration {
     uint64_t precopy_init_size;
     uint64_t precopy_dirty_size;
     bool initial_data_sent;
+    /* The stop-copy data goes through multifd, see vfio_multifd_setup() */
+    bool multifd_transfer;
+    /* Destination side of the multifd transfer */
+    QemuMutex load_bufs_mutex;
+    QemuCond load_bufs_cond;
+    GPtrArray *load_bufs;
+    uint32_t load_buf_idx;
+    QemuThread load_bufs_thread;
+    bool load_bufs_thread_started;
+    bool load_bufs_done;
+    bool load_bufs_quit;
+    int load_bufs_ret;
 } VFIOMigration;
 
 struct VFIOGroup;
@@ -115,6 +127,7 @@ typedef struct VFIODevice {
     bool no_mmap;
     bool ram_block_discard_allowed;
     OnOffAuto enable_migration;
+    bool migration_multifd_transfer;
     VFIODeviceOps *ops;
     unsigned int num_irqs;
     unsigned int num_regions;
@@ -71,6 +71,9 @@ struct VirtIOBalloon {
 
     bool qemu_4_0_config_size;
     uint32_t poison_val;
+    /* Reported free pages are being discarded on the thread pool */
+    bool report_in_flight;
+    VMChangeStateEntry *vmstate;
 };
 
 #endif
@@ -136,6 +136,14 @@ typedef struct VirtioNetRscChain {
 /* Maximum packet size we can receive from tap device: header + 64k */
 #define VIRTIO_NET_MAX_BUFSIZE (sizeof(struct virtio_net_hdr) + (64 * KiB))
 
+/*
+ * Receive buffers are popped into preallocated slots, one packet needs one
+ * slot per buffer.  Only buffers with more descriptors than this, or packets
+ * that need more slots, are allocated.
+ */
+#define VIRTIO_NET_RX_SLOTS     64
+#define VIRTIO_NET_RX_SLOT_SG   4
+
 #define VIRTIO_NET_RSS_MAX_KEY_SIZE     40
 #define VIRTIO_NET_RSS_MAX_TABLE_LEN    128
 
@@ -160,6 +168,8 @@ typedef struct VirtIONetQueue {
     struct {
         VirtQueueElement *elem;
     } async_tx;
+    void *rx_slots;
+    size_t rx_slot_size;
     struct VirtIONet *n;
 } VirtIONetQueue;
 
@@ -262,4 +262,39 @@ qio_channel_socket_accept(QIOChannelSocket *ioc,
                           Error **errp);
 
 
+/**
+ * qio_channel_socket_set_zero_copy:
+ * @ioc: the socket channel object
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Enable QIO_CHANNEL_WRITE_FLAG_ZERO_COPY on a connected socket,
+ * such as one returned by qio_channel_socket_accept().  Sockets
+ * connected with qio_channel_socket_connect_sync() already have
+ * it enabled where the host supports it.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int
+qio_channel_socket_set_zero_copy(QIOChannelSocket *ioc,
+                                 Error **errp);
+
+
+/**
+ * qio_channel_socket_zero_copy_done:
+ * @ioc: the socket channel object
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Collect the completion notifications of zero copy writes that are
+ * available, without blocking, unlike qio_channel_flush().  The
+ * buffers of the first N zero copy writes on @ioc can be reused once
+ * this returns N or more.
+ *
+ * Returns: the number of zero copy writes that have completed, or -1
+ * on error
+ */
+ssize_t
+qio_channel_socket_zero_copy_done(QIOChannelSocket *ioc,
+                                  Error **errp);
+
+
 #endif /* QIO_CHANNEL_SOCKET_H */
@@ -35,6 +35,8 @@ OBJECT_DECLARE_TYPE(QIOChannel, QIOChannelClass,
 #define QIO_CHANNEL_WRITE_FLAG_ZERO_COPY 0x1
 
 #define QIO_CHANNEL_READ_FLAG_MSG_PEEK 0x1
+/* Hint that the caller wants all of the buffer, see MSG_WAITALL */
+#define QIO_CHANNEL_READ_FLAG_WAITALL 0x2
 
 typedef enum QIOChannelFeature QIOChannelFeature;
 
@@ -44,6 +46,7 @@ enum QIOChannelFeature {
     QIO_CHANNEL_FEATURE_LISTEN,
     QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY,
     QIO_CHANNEL_FEATURE_READ_MSG_PEEK,
+    QIO_CHANNEL_FEATURE_SEEKABLE,
 };
 
 
@@ -149,6 +152,16 @@ struct QIOChannelClass {
                                   void *opaque);
     int (*io_flush)(QIOChannel *ioc,
                     Error **errp);
+    ssize_t (*io_pwritev)(QIOChannel *ioc,
+                          const struct iovec *iov,
+                          size_t niov,
+                          off_t offset,
+                          Error **errp);
+    ssize_t (*io_preadv)(QIOChannel *ioc,
+                         const struct iovec *iov,
+                         size_t niov,
+                         off_t offset,
+                         Error **errp);
 };
 
 /* General I/O handling functions */
@@ -630,6 +643,74 @@ off_t qio_channel_io_seek(QIOChannel *ioc,
                           int whence,
                           Error **errp);
 
+/**
+ * qio_channel_pwritev:
+ * @ioc: the channel object
+ * @iov: the array of memory regions to write data from
+ * @niov: the length of the @iov array
+ * @offset: the position in the channel to write to
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Write data to the IO channel at @offset, without changing the
+ * current I/O position.  Like qio_channel_writev(), this may write
+ * less data than requested.
+ *
+ * It is an error to call this unless qio_channel_has_feature()
+ * returns a true value for the QIO_CHANNEL_FEATURE_SEEKABLE
+ * constant.
+ *
+ * Returns: the number of bytes written, or -1 on error
+ */
+ssize_t qio_channel_pwritev(QIOChannel *ioc, const struct iovec *iov,
+                            size_t niov, off_t offset, Error **errp);
+
+/**
+ * qio_channel_pwrite:
+ * @ioc: the channel object
+ * @buf: the memory region to write data from
+ * @buflen: the number of bytes in @buf
+ * @offset: the position in the channel to write to
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Behaves as qio_channel_pwritev() with a single memory region.
+ */
+ssize_t qio_channel_pwrite(QIOChannel *ioc, char *buf, size_t buflen,
+                           off_t offset, Error **errp);
+
+/**
+ * qio_channel_preadv:
+ * @ioc: the channel object
+ * @iov: the array of memory regions to read data into
+ * @niov: the length of the @iov array
+ * @offset: the position in the channel to read from
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Read data from the IO channel at @offset, without changing the
+ * current I/O position.  Like qio_channel_readv(), this may read
+ * less data than requested.
+ *
+ * It is an error to call this unless qio_channel_has_feature()
+ * returns a true value for the QIO_CHANNEL_FEATURE_SEEKABLE
+ * constant.
+ *
+ * Returns: the number of bytes read, 0 at end of file, or -1 on error
+ */
+ssize_t qio_channel_preadv(QIOChannel *ioc, const struct iovec *iov,
+                           size_t niov, off_t offset, Error **errp);
+
+/**
+ * qio_channel_pread:
+ * @ioc: the channel object
+ * @buf: the memory region to read data into
+ * @buflen: the number of bytes in @buf
+ * @offset: the position in the channel to read from
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Behaves as qio_channel_preadv() with a single memory region.
+ */
+ssize_t qio_channel_pread(QIOChannel *ioc, char *buf, size_t buflen,
+                          off_t offset, Error **errp);
+
 
 /**
  * qio_channel_create_watch:
@@ -80,4 +80,9 @@ bool migration_in_bg_snapshot(void);
 /* migration/block-dirty-bitmap.c */
 void dirty_bitmap_mig_init(void);
 
+/* migration/multifd.c */
+bool multifd_device_state_supported(void);
+bool multifd_queue_device_state(const char *idstr, uint32_t instance_id,
+                                char *data, size_t len);
+
 #endif
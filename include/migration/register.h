@@ -29,6 +29,17 @@ typedef struct SaveVMHandlers {
     void (*save_cleanup)(void *opaque);
     int (*save_live_complete_postcopy)(QEMUFile *f, void *opaque);
     int (*save_live_complete_precopy)(QEMUFile *f, void *opaque);
+    /*
+     * save_live_complete_precopy_thread runs outside the BQL, in a thread
+     * of its own started before the save_live_complete_precopy handlers,
+     * when multifd_device_state_supported().  It can send device state
+     * with multifd_queue_device_state() under @idstr and @instance_id,
+     * which arrives on the destination through load_state_buffer.  All
+     * of them finish before the last multifd sync of RAM.
+     */
+    int (*save_live_complete_precopy_thread)(const char *idstr,
+                                             uint32_t instance_id,
+                                             void *opaque, Error **errp);
 
     /* This runs both outside and inside the BQL.  */
     bool (*is_active)(void *opaque);
@@ -72,6 +83,14 @@ typedef struct SaveVMHandlers {
     void (*state_pending_exact)(void *opaque, uint64_t *must_precopy,
                                 uint64_t *can_postcopy);
     LoadStateHandler *load_state;
+    /*
+     * Called outside the BQL, from the multifd receive threads, with each
+     * buffer queued by save_live_complete_precopy_thread on the source.
+     * The buffers can come in any order and @data is only valid for the
+     * duration of the call.
+     */
+    int (*load_state_buffer)(void *opaque, char *data, size_t len,
+                             Error **errp);
     int (*load_setup)(QEMUFile *f, void *opaque);
     int (*load_cleanup)(void *opaque);
     /* Called when postcopy migration wants to resume from failure */
@@ -68,4 +68,26 @@ bool delete_snapshot(const char *name,
  */
 void load_snapshot_resume(RunState state);
 
+/**
+ * save_device_state_buffer: Save the state of all devices except RAM.
+ * @state: buffer that receives the device state
+ * @errp: pointer to error object
+ *
+ * Meant for short lived checkpoints that only live within this QEMU
+ * process; the caller saves guest RAM itself.  Must be called with the
+ * VM stopped.
+ * On success, return %true.
+ * On failure, store an error through @errp and return %false.
+ */
+bool save_device_state_buffer(GByteArray *state, Error **errp);
+
+/**
+ * load_device_state_buffer: Load state saved by save_device_state_buffer().
+ * @state: buffer with the device state
+ * @errp: pointer to error object
+ * On success, return %true.
+ * On failure, store an error through @errp and return %false.
+ */
+bool load_device_state_buffer(GByteArray *state, Error **errp);
+
 #endif
@@ -198,6 +198,16 @@ struct VMStateDescription {
      * a QEMU_VM_SECTION_START section.
      */
     bool early_setup;
+    /*
+     * With the parallel-load migration capability, the state of this
+     * VMSD is sent with its length in front, and the destination loads
+     * it on a worker thread after all the other device state, when it
+     * reaches the end of the stream or the next command.  Loading the
+     * fields and post_load must then only touch the device's own state,
+     * must not need the BQL, and no other device may depend on this one
+     * in its own post_load.
+     */
+    bool load_parallel;
     int version_id;
     int minimum_version_id;
     MigrationPriority priority;
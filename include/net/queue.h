@@ -32,6 +32,11 @@ typedef void (NetPacketSent) (NetClientState *sender, ssize_t ret);
 
 #define QEMU_NET_PACKET_FLAG_NONE  0
 #define QEMU_NET_PACKET_FLAG_RAW  (1<<0)
+/*
+ * The packet data stays valid until the sent callback is called, so it
+ * does not need to be copied if the packet is queued.
+ */
+#define QEMU_NET_PACKET_FLAG_NOCOPY (1<<1)
 
 /* Returns:
  *   >0 - success
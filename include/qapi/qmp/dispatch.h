@@ -25,6 +25,7 @@ typedef enum QmpCommandOptions
     QCO_ALLOW_OOB             =  (1U << 1),
     QCO_ALLOW_PRECONFIG       =  (1U << 2),
     QCO_COROUTINE             =  (1U << 3),
+    QCO_NO_BQL                =  (1U << 4),
 } QmpCommandOptions;
 
 typedef struct QmpCommand
@@ -59,6 +60,16 @@ QDict *coroutine_mixed_fn qmp_dispatch(const QmpCommandList *cmds, QObject *requ
                                        bool allow_oob, Monitor *cur_mon);
 bool qmp_is_oob(const QDict *dict);
 
+/*
+ * Commands with QCO_NO_BQL read state that is published for them under
+ * the BQL.  The monitor calls the registered functions, with the BQL
+ * held, after every command that ran under the BQL.
+ */
+typedef void QmpSnapshotSyncFunc(void);
+
+void qmp_register_snapshot(QmpSnapshotSyncFunc *sync);
+void qmp_sync_snapshots(void);
+
 typedef void (*qmp_cmd_callback_fn)(const QmpCommand *cmd, void *opaque);
 
 void qmp_for_each_command(const QmpCommandList *cmds, qmp_cmd_callback_fn fn,
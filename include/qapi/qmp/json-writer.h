@@ -14,7 +14,12 @@
 #ifndef JSON_WRITER_H
 #define JSON_WRITER_H
 
+typedef void JSONWriterFlushFunc(void *opaque, const char *buf, size_t len);
+
 JSONWriter *json_writer_new(bool pretty);
+JSONWriter *json_writer_new_stream(bool pretty, JSONWriterFlushFunc *flush,
+                                   void *opaque);
+void json_writer_flush(JSONWriter *writer);
 const char *json_writer_get(JSONWriter *);
 GString *json_writer_get_and_free(JSONWriter *);
 void json_writer_free(JSONWriter *);
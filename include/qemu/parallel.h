@@ -0,0 +1,44 @@
+/*
+ * Split loops over a set of worker threads
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef QEMU_PARALLEL_H
+#define QEMU_PARALLEL_H
+
+typedef struct QemuParallel QemuParallel;
+typedef void QemuParallelFunc(void *opaque, unsigned int index);
+
+/**
+ * qemu_parallel_new: create a set of worker threads
+ * @name: prefix of the thread names
+ * @nr_threads: number of threads to create besides the caller of
+ *     qemu_parallel_run(); must be at least 1
+ *
+ * The threads are registered with RCU, but do not hold the BQL.
+ */
+QemuParallel *qemu_parallel_new(const char *name, unsigned int nr_threads);
+
+/**
+ * qemu_parallel_free: stop and free the worker threads of @p
+ * @p: the worker threads, or NULL
+ */
+void qemu_parallel_free(QemuParallel *p);
+
+/**
+ * qemu_parallel_run: run a loop over the worker threads
+ * @p: the worker threads, or NULL to run everything in the caller
+ * @n: number of iterations
+ * @func: function to call for each iteration
+ * @opaque: first argument of @func
+ *
+ * Call @func(@opaque, i) for each i from 0 to @n - 1, in no particular
+ * order and spread over the caller and the worker threads, and return
+ * when all the calls have returned.  Only one loop can run at a time
+ * on @p.
+ */
+void qemu_parallel_run(QemuParallel *p, unsigned int n,
+                       QemuParallelFunc *func, void *opaque);
+
+#endif /* QEMU_PARALLEL_H */
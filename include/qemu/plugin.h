@@ -74,6 +74,7 @@ enum plugin_dyn_cb_type {
 enum plugin_dyn_cb_subtype {
     PLUGIN_CB_REGULAR,
     PLUGIN_CB_INLINE,
+    PLUGIN_CB_COND,
     PLUGIN_N_CB_SUBTYPES,
 };
 
@@ -88,15 +89,42 @@ struct qemu_plugin_dyn_cb {
     enum plugin_dyn_cb_subtype type;
     /* @rw applies to mem callbacks only (both regular and inline) */
     enum qemu_plugin_mem_rw rw;
+    /*
+     * @flags and @regs apply to udata and conditional callbacks.  @regs
+     * lists the registers to sync before the call, and is allocated with
+     * tcg_malloc() since it is only needed until the TB is generated.
+     */
+    enum qemu_plugin_cb_flags flags;
+    struct qemu_plugin_register **regs;
+    size_t n_regs;
     /* fields specific to each dyn_cb type go here */
     union {
         struct {
             enum qemu_plugin_op op;
+            /* per-vCPU target; if @entry.score is NULL, @userp is used */
+            qemu_plugin_u64 entry;
             uint64_t imm;
         } inline_insn;
+        struct {
+            enum qemu_plugin_cond cond;
+            qemu_plugin_u64 entry;
+            uint64_t imm;
+        } cond;
     };
 };
 
+/* Register handles are the index of a TCG global, plus one */
+static inline int plugin_register_global(struct qemu_plugin_register *reg)
+{
+    return (uintptr_t)reg - 1;
+}
+
+/* One element of @data per vCPU, indexed by cpu_index */
+struct qemu_plugin_scoreboard {
+    GArray *data;
+    QLIST_ENTRY(qemu_plugin_scoreboard) entry;
+};
+
 /* Internal context for instrumenting an instruction */
 struct qemu_plugin_insn {
     GByteArray *data;
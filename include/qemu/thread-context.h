@@ -49,6 +49,10 @@ struct ThreadContext {
     int init_cpu_nbits;
 };
 
+/*
+ * Create a thread that inherits the CPU affinity of @tc.  With a NULL
+ * @tc this is just qemu_thread_create().
+ */
 void thread_context_create_thread(ThreadContext *tc, QemuThread *thread,
                                   const char *name,
                                   void *(*start_routine)(void *), void *arg,
@@ -24,6 +24,7 @@ typedef struct VuFdWatch {
     int fd; /*kick fd*/
     void *pvt;
     vu_watch_cb cb;
+    VuVirtq *vq; /* the virtqueue, if this is its kick fd */
     QTAILQ_ENTRY(VuFdWatch) next;
 } VuFdWatch;
 
@@ -31,7 +32,8 @@ typedef struct VuFdWatch {
  * VuServer:
  * A vhost-user server instance with user-defined VuDevIface callbacks.
  * Vhost-user device backends can be implemented using VuServer. VuDevIface
- * callbacks and virtqueue kicks run in the given AioContext.
+ * callbacks and virtqueue kicks run in the given AioContext, unless the
+ * virtqueues are given AioContexts of their own.
  */
 typedef struct {
     QIONetListener *listener;
@@ -40,12 +42,18 @@ typedef struct {
     int max_queues;
     const VuDevIface *vu_iface;
 
+    /* Virtqueue n runs in vq_ctxs[n % nr_vq_ctxs], if there are any */
+    AioContext **vq_ctxs;
+    int nr_vq_ctxs;
+    unsigned int vq_pausing; /* atomic */
+
     unsigned int in_flight; /* atomic */
 
     /* Protected by ctx lock */
     bool in_qio_channel_yield;
     bool wait_idle;
     bool quiescing;
+    bool vqs_paused;
     VuDev vu_dev;
     QIOChannel *ioc; /* The I/O channel with the client */
     QIOChannelSocket *sioc; /* The underlying data channel with the client */
@@ -57,6 +65,8 @@ typedef struct {
 bool vhost_user_server_start(VuServer *server,
                              SocketAddress *unix_socket,
                              AioContext *ctx,
+                             AioContext **vq_ctxs,
+                             int nr_vq_ctxs,
                              uint16_t max_queues,
                              const VuDevIface *vu_iface,
                              Error **errp);
@@ -40,6 +40,17 @@ int qemu_semihosting_console_read(CPUState *cs, void *buf, int len);
  */
 int qemu_semihosting_console_write(void *buf, int len);
 
+/**
+ * qemu_semihosting_console_flush:
+ *
+ * Write out the output that qemu_semihosting_console_write() has
+ * buffered.  This happens by itself on a newline, before reading
+ * from the console and at exit.
+ *
+ * Returns: false on an i/o error.
+ */
+bool qemu_semihosting_console_flush(void);
+
 /*
  * qemu_semihosting_console_block_until_ready:
  * @cs: CPUState
@@ -89,6 +89,7 @@ void blk_set_on_error(BlockBackend *blk, BlockdevOnError on_read_error,
 bool blk_supports_write_perm(BlockBackend *blk);
 bool blk_is_sg(BlockBackend *blk);
 void blk_set_enable_write_cache(BlockBackend *blk, bool wce);
+void blk_set_write_batching(BlockBackend *blk, uint64_t deadline_ns);
 int blk_get_flags(BlockBackend *blk);
 bool blk_op_is_blocked(BlockBackend *blk, BlockOpType op, Error **errp);
 void blk_op_unblock(BlockBackend *blk, BlockOpType op, Error *reason);
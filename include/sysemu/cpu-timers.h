@@ -32,6 +32,8 @@ typedef enum {
 
 #if defined(CONFIG_TCG) && !defined(CONFIG_USER_ONLY)
 extern ICountMode use_icount;
+/* I/O instructions do not end TBs, see -icount iosync=tb */
+extern bool icount_iosync_tb;
 #define icount_enabled() (use_icount)
 #else
 #define icount_enabled() ICOUNT_DISABLED
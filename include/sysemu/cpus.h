@@ -19,6 +19,8 @@ void dummy_start_vcpu_thread(CPUState *);
 /* For temporary buffers for forming a name */
 #define VCPU_THREAD_NAME_SIZE 16
 
+void cpu_thread_create(CPUState *cpu, const char *name,
+                       void *(*start_routine)(void *));
 void cpus_kick_thread(CPUState *cpu);
 bool cpu_work_list_empty(CPUState *cpu);
 bool cpu_thread_is_idle(CPUState *cpu);
@@ -196,6 +196,8 @@ typedef struct DumpState {
     off_t offset_page;          /* offset of page part in vmcore */
     size_t num_dumpable;        /* number of page that can be dumped */
     uint32_t flag_compress;     /* indicate the compression format */
+    int compress_threads;       /* threads compressing kdump pages */
+    bool sparse;                /* leave holes for zero pages (ELF) */
     DumpStatus status;          /* current dump status */
 
     bool has_format;              /* whether format is provided */
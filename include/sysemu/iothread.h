@@ -38,6 +38,13 @@ struct IOThread {
     int64_t poll_max_ns;
     int64_t poll_grow;
     int64_t poll_shrink;
+
+    /* io_uring SQPOLL for fd monitoring, set up when the thread starts */
+    bool sqpoll;
+    int64_t sqpoll_cpu;         /* -1 if the kernel thread is not pinned */
+
+    /* creates the thread, with its CPU affinity, if set */
+    ThreadContext *thread_context;
 };
 typedef struct IOThread IOThread;
 
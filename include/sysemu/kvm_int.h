@@ -12,6 +12,7 @@
 #include "exec/memory.h"
 #include "qapi/qapi-types-common.h"
 #include "qemu/accel.h"
+#include "qemu/parallel.h"
 #include "qemu/queue.h"
 #include "sysemu/kvm.h"
 
@@ -65,6 +66,8 @@ struct KVMDirtyRingReaper {
     QemuThread reaper_thr;
     volatile uint64_t reaper_iteration; /* iteration number of reaper thr */
     volatile enum KVMDirtyRingReaperState reaper_state; /* reap thr state */
+    /* Threads sharing the rings when all of them are reaped, or NULL */
+    QemuParallel *reap_threads;
 };
 struct KVMState
 {
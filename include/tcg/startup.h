@@ -36,6 +36,19 @@
  */
 void tcg_init(size_t tb_size, int splitwx, unsigned max_cpus);
 
+/**
+ * tcg_region_set_layout: Configure the JIT buffer layout
+ * @hugepages: align the buffer and its regions to huge pages
+ * @region_size: size of each region in bytes, or 0 for the default
+ * @cold_code: keep the slow paths apart from the translated blocks
+ *
+ * Must be called before tcg_init().  @region_size is a hint: there is
+ * still at least one region per vCPU thread.  @cold_code is ignored if
+ * the host backend cannot branch far enough to its slow paths.
+ */
+void tcg_region_set_layout(bool hugepages, size_t region_size,
+                           bool cold_code);
+
 /**
  * tcg_register_thread: Register this thread with the TCG runtime
  *
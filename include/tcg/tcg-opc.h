@@ -309,6 +309,16 @@ DEF(last_generic, 0, 0, 0, TCG_OPF_NOT_PRESENT)
 /* These opcodes are only for use between the tci generator and interpreter. */
 DEF(tci_movi, 1, 0, 1, TCG_OPF_NOT_PRESENT)
 DEF(tci_movl, 1, 0, 1, TCG_OPF_NOT_PRESENT)
+/*
+ * Superinstructions: the first insn with its opcode replaced, followed
+ * by the second insn unchanged.
+ */
+DEF(tci_brcond_i32, 1, 2, 1, TCG_OPF_NOT_PRESENT)  /* setcond + brcond */
+DEF(tci_brcond_i64, 1, 2, 1, TCG_OPF_NOT_PRESENT)
+DEF(tci_ld32_add, 1, 1, 1, TCG_OPF_NOT_PRESENT)    /* ld_i32 + add */
+DEF(tci_ld64_add, 1, 1, 1, TCG_OPF_NOT_PRESENT)    /* ld_i64 + add */
+DEF(tci_ld32_st32, 1, 1, 1, TCG_OPF_NOT_PRESENT)   /* ld_i32 + st_i32 */
+DEF(tci_ld64_st64, 1, 1, 1, TCG_OPF_NOT_PRESENT)   /* ld_i64 + st_i64 */
 #endif
 
 #undef DATA64_ARGS
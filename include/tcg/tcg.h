@@ -215,10 +215,14 @@ struct TCGLabel {
     bool present;
     bool has_value;
     uint16_t id;
+    /* number of forward branches seen by the register allocator */
+    uint16_t nb_edges;
     union {
         uintptr_t value;
         const tcg_insn_unit *value_ptr;
     } u;
+    /* globals held in each host register on all of those branches */
+    struct TCGTemp **entry_regs;
     QSIMPLEQ_HEAD(, TCGLabelUse) branches;
     QSIMPLEQ_HEAD(, TCGRelocation) relocs;
     QSIMPLEQ_ENTRY(TCGLabel) next;
@@ -519,6 +523,10 @@ struct TCGContext {
     /* Threshold to flush the translated code buffer.  */
     void *code_gen_highwater;
 
+    /* Out of line code, if kept apart from the TBs, and its threshold.  */
+    void *code_gen_cold_ptr;
+    void *code_gen_cold_highwater;
+
     /* Track which vCPU triggers events */
     CPUState *cpu;                      /* *_trans */
 
@@ -546,6 +554,9 @@ struct TCGContext {
     struct qemu_plugin_insn *plugin_insn;
 #endif
 
+    /* If set, new ops are inserted before this op instead of at the end */
+    TCGOp *emit_before_op;
+
     GHashTable *const_table[TCG_TYPE_COUNT];
     TCGTempSet free_temps[TCG_TYPE_COUNT];
     TCGTemp temps[TCG_MAX_TEMPS]; /* globals first, temps after */
@@ -731,6 +742,9 @@ static inline void tcg_set_insn_start_param(TCGOp *op, int arg, uint64_t v)
 /* The last op that was emitted.  */
 static inline TCGOp *tcg_last_op(void)
 {
+    if (tcg_ctx->emit_before_op) {
+        return QTAILQ_PREV(tcg_ctx->emit_before_op, link);
+    }
     return QTAILQ_LAST(&tcg_ctx->ops);
 }
 
@@ -755,9 +769,11 @@ void tcg_pool_reset(TCGContext *s);
 TranslationBlock *tcg_tb_alloc(TCGContext *s);
 
 void tcg_region_reset_all(void);
+bool tcg_region_evict(void (*func)(TranslationBlock *tb));
 
 size_t tcg_code_size(void);
 size_t tcg_code_capacity(void);
+size_t tcg_region_fill(uint64_t *fill, size_t max);
 
 void tcg_tb_insert(TranslationBlock *tb);
 void tcg_tb_remove(TranslationBlock *tb);
@@ -26,6 +26,10 @@ typedef struct DisplaySurface {
 #ifdef WIN32
     HANDLE handle;
     uint32_t handle_offset;
+#else
+    /* fd that can be mmapped by other processes to read the data, or -1 */
+    int share_fd;
+    uint32_t share_offset;
 #endif
 } DisplaySurface;
 
@@ -40,6 +44,9 @@ DisplaySurface *qemu_create_placeholder_surface(int w, int h,
 #ifdef WIN32
 void qemu_displaysurface_win32_set_handle(DisplaySurface *surface,
                                           HANDLE h, uint32_t offset);
+#else
+void qemu_displaysurface_set_share_fd(DisplaySurface *surface,
+                                      int fd, uint32_t offset);
 #endif
 
 DisplaySurface *qemu_create_displaysurface(int width, int height);
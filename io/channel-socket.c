@@ -164,15 +164,8 @@ int qio_channel_socket_connect_sync(QIOChannelSocket *ioc,
         return -1;
     }
 
-#ifdef QEMU_MSG_ZEROCOPY
-    int ret, v = 1;
-    ret = setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &v, sizeof(v));
-    if (ret == 0) {
-        /* Zero copy available on host */
-        qio_channel_set_feature(QIO_CHANNEL(ioc),
-                                QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY);
-    }
-#endif
+    /* Use zero copy if available on host */
+    qio_channel_socket_set_zero_copy(ioc, NULL);
 
     qio_channel_set_feature(QIO_CHANNEL(ioc),
                             QIO_CHANNEL_FEATURE_READ_MSG_PEEK);
@@ -528,6 +521,9 @@ static ssize_t qio_channel_socket_readv(QIOChannel *ioc,
     if (flags & QIO_CHANNEL_READ_FLAG_MSG_PEEK) {
         sflags |= MSG_PEEK;
     }
+    if (flags & QIO_CHANNEL_READ_FLAG_WAITALL) {
+        sflags |= MSG_WAITALL;
+    }
 
  retry:
     ret = recvmsg(sioc->fd, &msg, sflags);
@@ -724,11 +720,34 @@ static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
 #endif /* WIN32 */
 
 
+int qio_channel_socket_set_zero_copy(QIOChannelSocket *ioc,
+                                     Error **errp)
+{
 #ifdef QEMU_MSG_ZEROCOPY
-static int qio_channel_socket_flush(QIOChannel *ioc,
-                                    Error **errp)
+    int v = 1;
+
+    if (setsockopt(ioc->fd, SOL_SOCKET, SO_ZEROCOPY, &v, sizeof(v)) < 0) {
+        error_setg_errno(errp, errno, "Unable to enable zero copy");
+        return -1;
+    }
+    qio_channel_set_feature(QIO_CHANNEL(ioc),
+                            QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY);
+    return 0;
+#else
+    error_setg(errp, "Zero copy is not supported on this host");
+    return -1;
+#endif
+}
+
+#ifdef QEMU_MSG_ZEROCOPY
+/*
+ * Collect zero copy completions; if @block, wait until all writes so far
+ * have completed.  Returns 1 if all writes were copied by the kernel
+ * after all, 0 if some used zero copy, -1 on error.
+ */
+static int qio_channel_socket_reap(QIOChannelSocket *sioc, bool block,
+                                   Error **errp)
 {
-    QIOChannelSocket *sioc = QIO_CHANNEL_SOCKET(ioc);
     struct msghdr msg = {};
     struct sock_extended_err *serr;
     struct cmsghdr *cm;
@@ -751,8 +770,11 @@ static int qio_channel_socket_flush(QIOChannel *ioc,
         if (received < 0) {
             switch (errno) {
             case EAGAIN:
+                if (!block) {
+                    return ret;
+                }
                 /* Nothing on errqueue, wait until something is available */
-                qio_channel_wait(ioc, G_IO_ERR);
+                qio_channel_wait(QIO_CHANNEL(sioc), G_IO_ERR);
                 continue;
             case EINTR:
                 continue;
@@ -800,8 +822,25 @@ static int qio_channel_socket_flush(QIOChannel *ioc,
     return ret;
 }
 
+static int qio_channel_socket_flush(QIOChannel *ioc,
+                                    Error **errp)
+{
+    return qio_channel_socket_reap(QIO_CHANNEL_SOCKET(ioc), true, errp);
+}
+
 #endif /* QEMU_MSG_ZEROCOPY */
 
+ssize_t qio_channel_socket_zero_copy_done(QIOChannelSocket *ioc,
+                                          Error **errp)
+{
+#ifdef QEMU_MSG_ZEROCOPY
+    if (qio_channel_socket_reap(ioc, false, errp) < 0) {
+        return -1;
+    }
+#endif
+    return ioc->zero_copy_sent;
+}
+
 static int
 qio_channel_socket_set_blocking(QIOChannel *ioc,
                                 bool enabled,
@@ -21,7 +21,9 @@
 #include "qemu/osdep.h"
 #include "qapi/error.h"
 #include "qemu/module.h"
+#include "qemu/error-report.h"
 #include "io/channel-tls.h"
+#include "io/channel-socket.h"
 #include "trace.h"
 #include "qemu/atomic.h"
 
@@ -155,6 +157,32 @@ static gboolean qio_channel_tls_handshake_io(QIOChannel *ioc,
                                              GIOCondition condition,
                                              gpointer user_data);
 
+/*
+ * With kernel TLS, data is read and written in the clear on the
+ * socket and the kernel does the record layer.  A failure leaves
+ * the session as it was and merely keeps the work in GnuTLS.
+ */
+static void qio_channel_tls_enable_ktls(QIOChannelTLS *ioc)
+{
+    Error *err = NULL;
+    int ret;
+
+    if (!object_dynamic_cast(OBJECT(ioc->master), TYPE_QIO_CHANNEL_SOCKET)) {
+        return;
+    }
+
+    ret = qcrypto_tls_session_enable_ktls(ioc->session,
+                                          QIO_CHANNEL_SOCKET(ioc->master)->fd,
+                                          &err);
+    if (ret < 0) {
+        warn_report_err(err);
+        return;
+    }
+    trace_qio_channel_tls_ktls(ioc, ret);
+    ioc->ktls = ret;
+}
+
+
 static void qio_channel_tls_handshake_task(QIOChannelTLS *ioc,
                                            QIOTask *task,
                                            GMainContext *context)
@@ -178,6 +206,7 @@ static void qio_channel_tls_handshake_task(QIOChannelTLS *ioc,
             qio_task_set_error(task, err);
         } else {
             trace_qio_channel_tls_credentials_allow(ioc);
+            qio_channel_tls_enable_ktls(ioc);
         }
         qio_task_complete(task);
     } else {
@@ -272,6 +301,11 @@ static ssize_t qio_channel_tls_readv(QIOChannel *ioc,
     size_t i;
     ssize_t got = 0;
 
+    if (tioc->ktls & QCRYPTO_TLS_KTLS_RX) {
+        return qio_channel_readv_full(tioc->master, iov, niov, NULL, NULL,
+                                      flags, errp);
+    }
+
     for (i = 0 ; i < niov ; i++) {
         ssize_t ret = qcrypto_tls_session_read(tioc->session,
                                                iov[i].iov_base,
@@ -314,6 +348,11 @@ static ssize_t qio_channel_tls_writev(QIOChannel *ioc,
     size_t i;
     ssize_t done = 0;
 
+    if (tioc->ktls & QCRYPTO_TLS_KTLS_TX) {
+        return qio_channel_writev_full(tioc->master, iov, niov, NULL, 0,
+                                       flags, errp);
+    }
+
     for (i = 0 ; i < niov ; i++) {
         ssize_t ret = qcrypto_tls_session_write(tioc->session,
                                                 iov[i].iov_base,
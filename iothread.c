@@ -24,6 +24,7 @@
 #include "qemu/error-report.h"
 #include "qemu/rcu.h"
 #include "qemu/main-loop.h"
+#include "qemu/thread-context.h"
 
 
 #ifdef CONFIG_POSIX
@@ -103,6 +104,7 @@ static void iothread_instance_init(Object *obj)
     IOThread *iothread = IOTHREAD(obj);
 
     iothread->poll_max_ns = IOTHREAD_POLL_MAX_NS_DEFAULT;
+    iothread->sqpoll_cpu = -1;
     iothread->thread_id = -1;
     qemu_sem_init(&iothread->init_done_sem, 0);
     /* By default, we don't run gcontext */
@@ -207,11 +209,21 @@ static void iothread_init(EventLoopBase *base, Error **errp)
         return;
     }
 
-    /* This assumes we are called from a thread with useful CPU affinity for us
-     * to inherit.
+    if (iothread->sqpoll &&
+        !aio_context_enable_sqpoll(iothread->ctx, iothread->sqpoll_cpu,
+                                   errp)) {
+        aio_context_unref(iothread->ctx);
+        iothread->ctx = NULL;
+        return;
+    }
+
+    /*
+     * Without a thread context, this assumes we are called from a thread
+     * with useful CPU affinity for us to inherit.
      */
-    qemu_thread_create(&iothread->thread, thread_name, iothread_run,
-                       iothread, QEMU_THREAD_JOINABLE);
+    thread_context_create_thread(iothread->thread_context, &iothread->thread,
+                                 thread_name, iothread_run, iothread,
+                                 QEMU_THREAD_JOINABLE);
 
     /* Wait for initialization to complete */
     while (iothread->thread_id == -1) {
@@ -292,6 +304,61 @@ static void iothread_set_poll_param(Object *obj, Visitor *v,
     }
 }
 
+static bool iothread_get_sqpoll(Object *obj, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    return iothread->sqpoll;
+}
+
+static void iothread_set_sqpoll(Object *obj, bool value, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    if (iothread->ctx) {
+        error_setg(errp, "sqpoll cannot be changed after creation");
+        return;
+    }
+    iothread->sqpoll = value;
+}
+
+static void iothread_get_sqpoll_cpu(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    visit_type_int64(v, name, &iothread->sqpoll_cpu, errp);
+}
+
+static void iothread_set_sqpoll_cpu(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    int64_t value;
+
+    if (iothread->ctx) {
+        error_setg(errp, "%s cannot be changed after creation", name);
+        return;
+    }
+    if (!visit_type_int64(v, name, &value, errp)) {
+        return;
+    }
+    if (value < -1 || value > INT_MAX) {
+        error_setg(errp, "%s value must be in range [-1, %d]", name, INT_MAX);
+        return;
+    }
+    iothread->sqpoll_cpu = value;
+}
+
+static void iothread_check_thread_context(const Object *obj,
+                                          const char *name, Object *val,
+                                          Error **errp)
+{
+    if (IOTHREAD(obj)->ctx) {
+        error_setg(errp, "%s cannot be changed after creation", name);
+    }
+}
+
 static void iothread_class_init(ObjectClass *klass, void *class_data)
 {
     EventLoopBaseClass *bc = EVENT_LOOP_BASE_CLASS(klass);
@@ -311,6 +378,19 @@ static void iothread_class_init(ObjectClass *klass, void *class_data)
                               iothread_get_poll_param,
                               iothread_set_poll_param,
                               NULL, &poll_shrink_info);
+    object_class_property_add_bool(klass, "sqpoll", iothread_get_sqpoll,
+                                   iothread_set_sqpoll);
+    object_class_property_add(klass, "sqpoll-cpu", "int",
+                              iothread_get_sqpoll_cpu,
+                              iothread_set_sqpoll_cpu,
+                              NULL, NULL);
+    object_class_property_add_link(klass, "thread-context",
+                                   TYPE_THREAD_CONTEXT,
+                                   offsetof(IOThread, thread_context),
+                                   iothread_check_thread_context,
+                                   OBJ_PROP_LINK_STRONG);
+    object_class_property_set_description(klass, "thread-context",
+        "Context to create the thread in, for its CPU affinity");
 }
 
 static const TypeInfo iothread_info = {
@@ -540,6 +540,37 @@ abi_long target_mmap(abi_ulong start, abi_ulong len, int target_prot,
     real_start = start & qemu_host_page_mask;
     host_offset = offset & qemu_host_page_mask;
 
+    /*
+     * With matching page sizes and no reserved_va, mmap_find_vma() would
+     * just probe the address the kernel picks for the hint and keep it.
+     * Map the real thing right away instead of reserving the area first
+     * and then replacing the reservation.
+     */
+    if (!(flags & (MAP_FIXED | MAP_FIXED_NOREPLACE)) && !reserved_va &&
+        qemu_host_page_size == TARGET_PAGE_SIZE &&
+        qemu_real_host_page_size() == TARGET_PAGE_SIZE) {
+        abi_ulong hint = real_start ? real_start : mmap_next_start;
+        void *p;
+
+        p = mmap(g2h_untagged(hint), len, target_to_host_prot(target_prot),
+                 flags, fd, offset);
+        if (p == MAP_FAILED) {
+            goto fail;
+        }
+        if (h2g_valid(p + len - 1)) {
+            start = h2g(p);
+            if (hint == mmap_next_start && start >= task_unmapped_base) {
+                mmap_next_start = start + len;
+            }
+            last = start + len - 1;
+            passthrough_start = start;
+            passthrough_last = last;
+            goto the_end1;
+        }
+        /* Outside of the guest address space, do it the hard way */
+        munmap(p, len);
+    }
+
     /*
      * If the user is asking for the kernel to find a location, do that
      * before we truncate the length for mapping files below.
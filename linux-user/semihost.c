@@ -48,3 +48,9 @@ int qemu_semihosting_console_write(void *buf, int len)
 {
     return fwrite(buf, 1, len, stderr);
 }
+
+bool qemu_semihosting_console_flush(void)
+{
+    /* Output is not buffered in user mode */
+    return true;
+}
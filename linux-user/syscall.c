@@ -13626,6 +13626,54 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
     return ret;
 }
 
+/*
+ * Syscalls that take no pointers and whose arguments and results need no
+ * conversion on any ABI.  They are handled here, before the strace and
+ * the big switch of do_syscall1() get involved.  Returns false if @num
+ * is not one of them.
+ */
+static inline bool do_syscall_passthrough(int num, abi_long arg1,
+                                          abi_long *ret)
+{
+    switch (num) {
+#ifdef TARGET_NR_getpid
+    case TARGET_NR_getpid:
+        *ret = get_errno(getpid());
+        return true;
+#endif
+#ifdef TARGET_NR_getppid
+    case TARGET_NR_getppid:
+        *ret = get_errno(getppid());
+        return true;
+#endif
+    case TARGET_NR_gettid:
+        *ret = get_errno(sys_gettid());
+        return true;
+    case TARGET_NR_getpgid:
+        *ret = get_errno(getpgid(arg1));
+        return true;
+    case TARGET_NR_getsid:
+        *ret = get_errno(getsid(arg1));
+        return true;
+    case TARGET_NR_sched_yield:
+        *ret = get_errno(sched_yield());
+        return true;
+    case TARGET_NR_fsync:
+        *ret = get_errno(fsync(arg1));
+        return true;
+#ifdef TARGET_NR_fdatasync
+    case TARGET_NR_fdatasync:
+        *ret = get_errno(fdatasync(arg1));
+        return true;
+#endif
+    case TARGET_NR_umask:
+        *ret = get_errno(umask(arg1));
+        return true;
+    default:
+        return false;
+    }
+}
+
 abi_long do_syscall(CPUArchState *cpu_env, int num, abi_long arg1,
                     abi_long arg2, abi_long arg3, abi_long arg4,
                     abi_long arg5, abi_long arg6, abi_long arg7,
@@ -13651,6 +13699,13 @@ abi_long do_syscall(CPUArchState *cpu_env, int num, abi_long arg1,
     record_syscall_start(cpu, num, arg1,
                          arg2, arg3, arg4, arg5, arg6, arg7, arg8);
 
+    /* Plugins and gdb still see these, only strace needs the long way */
+    if (likely(!qemu_loglevel_mask(LOG_STRACE)) &&
+        do_syscall_passthrough(num, arg1, &ret)) {
+        record_syscall_return(cpu, num, ret);
+        return ret;
+    }
+
     if (unlikely(qemu_loglevel_mask(LOG_STRACE))) {
         print_syscall(cpu_env, num, arg1, arg2, arg3, arg4, arg5, arg6);
     }
@@ -22,6 +22,7 @@
 #include "migration/channel-block.h"
 #include "qapi/error.h"
 #include "block/block.h"
+#include "qemu/main-loop.h"
 #include "trace.h"
 
 QIOChannelBlock *
@@ -85,6 +86,9 @@ qio_channel_block_writev(QIOChannel *ioc,
     QEMUIOVector qiov;
     int ret;
 
+    /* A live snapshot-save writes from a thread that does not hold it */
+    BQL_LOCK_GUARD();
+
     qemu_iovec_init_external(&qiov, (struct iovec *)iov, niov);
     ret = bdrv_writev_vmstate(bioc->bs, &qiov, bioc->offset);
     if (ret < 0) {
@@ -0,0 +1,182 @@
+/*
+ * In-memory VM snapshots
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qapi/qapi-commands-migration.h"
+#include "exec/memory.h"
+#include "exec/ramblock.h"
+#include "exec/target_page.h"
+#include "exec/tb-flush.h"
+#include "hw/core/cpu.h"
+#include "migration/misc.h"
+#include "migration/snapshot.h"
+#include "sysemu/replay.h"
+#include "sysemu/runstate.h"
+
+/*
+ * The snapshot keeps a full copy of each migratable RAM block and the
+ * device state.  Dirty logging stays on from the save onwards, so that a
+ * load only has to copy back the pages written since the previous save
+ * or load.  Going back to the same state over and over, as a test runner
+ * does, then costs little more than the guest's own working set.
+ */
+
+typedef struct MemSnapshotBlock {
+    RAMBlock *rb;
+    ram_addr_t size;
+    uint8_t *copy;
+} MemSnapshotBlock;
+
+static GArray *mem_snapshot_blocks;
+static GByteArray *mem_snapshot_devices;
+
+static DirtyBitmapSnapshot *mem_snapshot_dirty(RAMBlock *rb, ram_addr_t size)
+{
+    return memory_region_snapshot_and_clear_dirty(rb->mr, 0, size,
+                                                  DIRTY_MEMORY_MIGRATION);
+}
+
+static int mem_snapshot_add_block(RAMBlock *rb, void *opaque)
+{
+    MemSnapshotBlock block = {
+        .rb = rb,
+        .size = qemu_ram_get_used_length(rb),
+    };
+
+    if (!qemu_ram_is_migratable(rb)) {
+        return 0;
+    }
+
+    /* The VM is stopped: whatever was dirty so far is in the copy */
+    g_free(mem_snapshot_dirty(rb, block.size));
+    block.copy = g_memdup2(qemu_ram_get_host_addr(rb), block.size);
+    g_array_append_val(mem_snapshot_blocks, block);
+    return 0;
+}
+
+static void mem_snapshot_free(void)
+{
+    guint i;
+
+    if (!mem_snapshot_blocks) {
+        return;
+    }
+    for (i = 0; i < mem_snapshot_blocks->len; i++) {
+        g_free(g_array_index(mem_snapshot_blocks, MemSnapshotBlock, i).copy);
+    }
+    g_array_free(mem_snapshot_blocks, true);
+    g_byte_array_free(mem_snapshot_devices, true);
+    mem_snapshot_blocks = NULL;
+    mem_snapshot_devices = NULL;
+    memory_global_dirty_log_stop(GLOBAL_DIRTY_MEM_SNAPSHOT);
+}
+
+static bool mem_snapshot_check(Error **errp)
+{
+    if (!migration_is_idle()) {
+        error_setg(errp, "In-memory snapshots cannot be used "
+                   "while a migration is in progress");
+        return false;
+    }
+    if (replay_mode != REPLAY_MODE_NONE) {
+        error_setg(errp, "In-memory snapshots are not supported "
+                   "with record/replay");
+        return false;
+    }
+    return true;
+}
+
+static bool mem_snapshot_blocks_match(Error **errp)
+{
+    guint i;
+
+    for (i = 0; i < mem_snapshot_blocks->len; i++) {
+        MemSnapshotBlock *block = &g_array_index(mem_snapshot_blocks,
+                                                 MemSnapshotBlock, i);
+        RAMBlock *rb = qemu_ram_block_by_name(block->rb->idstr);
+
+        if (rb != block->rb || qemu_ram_get_used_length(rb) != block->size) {
+            error_setg(errp, "RAM block '%s' changed since the snapshot "
+                       "was saved", block->rb->idstr);
+            return false;
+        }
+    }
+    return true;
+}
+
+void qmp_x_snapshot_mem_save(Error **errp)
+{
+    bool was_running = runstate_is_running();
+
+    if (!mem_snapshot_check(errp)) {
+        return;
+    }
+
+    vm_stop(RUN_STATE_SAVE_VM);
+    mem_snapshot_free();
+
+    mem_snapshot_devices = g_byte_array_new();
+    mem_snapshot_blocks = g_array_new(false, false, sizeof(MemSnapshotBlock));
+    memory_global_dirty_log_start(GLOBAL_DIRTY_MEM_SNAPSHOT);
+    qemu_ram_foreach_block(mem_snapshot_add_block, NULL);
+
+    if (!save_device_state_buffer(mem_snapshot_devices, errp)) {
+        mem_snapshot_free();
+    }
+
+    if (was_running) {
+        vm_start();
+    }
+}
+
+void qmp_x_snapshot_mem_load(Error **errp)
+{
+    bool was_running = runstate_is_running();
+    size_t page_size = qemu_target_page_size();
+    guint i;
+
+    if (!mem_snapshot_devices) {
+        error_setg(errp, "No in-memory snapshot was saved");
+        return;
+    }
+    if (!mem_snapshot_check(errp) || !mem_snapshot_blocks_match(errp)) {
+        return;
+    }
+
+    vm_stop(RUN_STATE_RESTORE_VM);
+
+    /* Same as load_snapshot(), minus the disks */
+    qemu_system_reset(SHUTDOWN_CAUSE_SNAPSHOT_LOAD);
+
+    for (i = 0; i < mem_snapshot_blocks->len; i++) {
+        MemSnapshotBlock *block = &g_array_index(mem_snapshot_blocks,
+                                                 MemSnapshotBlock, i);
+        uint8_t *host = qemu_ram_get_host_addr(block->rb);
+        g_autofree DirtyBitmapSnapshot *snap =
+            mem_snapshot_dirty(block->rb, block->size);
+        ram_addr_t offset;
+
+        for (offset = 0; offset < block->size; offset += page_size) {
+            if (memory_region_snapshot_get_dirty(block->rb->mr, snap,
+                                                 offset, page_size)) {
+                memcpy(host + offset, block->copy + offset, page_size);
+            }
+        }
+    }
+
+    /* Translated code may no longer match the restored RAM */
+    tb_flush(first_cpu);
+
+    if (!load_device_state_buffer(mem_snapshot_devices, errp)) {
+        return;
+    }
+
+    if (was_running) {
+        vm_start();
+    }
+}
@@ -392,6 +392,17 @@ void hmp_info_migrate_parameters(Monitor *mon, const QDict *qdict)
         monitor_printf(mon, "%s: %s\n",
             MigrationParameter_str(MIGRATION_PARAMETER_MODE),
             qapi_enum_lookup(&MigMode_lookup, params->mode));
+
+        assert(params->has_zero_page_detection);
+        monitor_printf(mon, "%s: %s\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_ZERO_PAGE_DETECTION),
+            qapi_enum_lookup(&ZeroPageDetection_lookup,
+                             params->zero_page_detection));
+
+        assert(params->has_postcopy_prefetch_pages);
+        monitor_printf(mon, "%s: %u\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_POSTCOPY_PREFETCH_PAGES),
+            params->postcopy_prefetch_pages);
     }
 
     qapi_free_MigrationParameters(params);
@@ -681,6 +692,15 @@ void hmp_migrate_set_parameter(Monitor *mon, const QDict *qdict)
         p->has_mode = true;
         visit_type_MigMode(v, param, &p->mode, &err);
         break;
+    case MIGRATION_PARAMETER_ZERO_PAGE_DETECTION:
+        p->has_zero_page_detection = true;
+        visit_type_ZeroPageDetection(v, param, &p->zero_page_detection,
+                                     &err);
+        break;
+    case MIGRATION_PARAMETER_POSTCOPY_PREFETCH_PAGES:
+        p->has_postcopy_prefetch_pages = true;
+        visit_type_uint8(v, param, &p->postcopy_prefetch_pages, &err);
+        break;
     default:
         assert(0);
     }
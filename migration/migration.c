@@ -142,6 +142,11 @@ static bool transport_supports_multi_channels(MigrationAddress *addr)
     return false;
 }
 
+static bool transport_supports_seeking(MigrationAddress *addr)
+{
+    return addr->transport == MIGRATION_ADDRESS_TYPE_FILE;
+}
+
 static bool
 migration_channels_and_transport_compatible(MigrationAddress *addr,
                                             Error **errp)
@@ -152,6 +157,11 @@ migration_channels_and_transport_compatible(MigrationAddress *addr,
         return false;
     }
 
+    if (migrate_mapped_ram() && !transport_supports_seeking(addr)) {
+        error_setg(errp, "Migration requires seekable transport (e.g. file)");
+        return false;
+    }
+
     return true;
 }
 
@@ -365,9 +375,9 @@ static void migrate_generate_event(int new_state)
  * Send a message on the return channel back to the source
  * of the migration.
  */
-static int migrate_send_rp_message(MigrationIncomingState *mis,
-                                   enum mig_rp_message_type message_type,
-                                   uint16_t len, void *data)
+static int migrate_send_rp_message_full(MigrationIncomingState *mis,
+                                        enum mig_rp_message_type message_type,
+                                        uint16_t len, void *data, bool flush)
 {
     int ret = 0;
 
@@ -386,6 +396,24 @@ static int migrate_send_rp_message(MigrationIncomingState *mis,
     qemu_put_be16(mis->to_src_file, (unsigned int)message_type);
     qemu_put_be16(mis->to_src_file, len);
     qemu_put_buffer(mis->to_src_file, data, len);
+    return flush ? qemu_fflush(mis->to_src_file) : 0;
+}
+
+static int migrate_send_rp_message(MigrationIncomingState *mis,
+                                   enum mig_rp_message_type message_type,
+                                   uint16_t len, void *data)
+{
+    return migrate_send_rp_message_full(mis, message_type, len, data, true);
+}
+
+/* Push out messages that were queued with flush=false */
+int migrate_send_rp_flush(MigrationIncomingState *mis)
+{
+    QEMU_LOCK_GUARD(&mis->rp_mutex);
+
+    if (!mis->to_src_file) {
+        return -EIO;
+    }
     return qemu_fflush(mis->to_src_file);
 }
 
@@ -393,13 +421,14 @@ static int migrate_send_rp_message(MigrationIncomingState *mis,
  *   rb: the RAMBlock to request the page in
  *   Start: Address offset within the RB
  *   Len: Length in bytes required - must be a multiple of pagesize
+ *   Flush: false to leave the message queued for migrate_send_rp_flush()
  */
 int migrate_send_rp_message_req_pages(MigrationIncomingState *mis,
-                                      RAMBlock *rb, ram_addr_t start)
+                                      RAMBlock *rb, ram_addr_t start,
+                                      size_t len, bool flush)
 {
     uint8_t bufc[12 + 1 + 255]; /* start (8), len (4), rbname up to 256 */
     size_t msglen = 12; /* start + len */
-    size_t len = qemu_ram_pagesize(rb);
     enum mig_rp_message_type msg_type;
     const char *rbname;
     int rbname_len;
@@ -428,14 +457,38 @@ int migrate_send_rp_message_req_pages(MigrationIncomingState *mis,
         msg_type = MIG_RP_MSG_REQ_PAGES;
     }
 
-    return migrate_send_rp_message(mis, msg_type, msglen, bufc);
+    return migrate_send_rp_message_full(mis, msg_type, msglen, bufc, flush);
+}
+
+/*
+ * Length of the request for the faulting page at @start: the page
+ * itself, followed by up to postcopy-prefetch-pages host pages of @rb
+ * that have not been received yet.  Prefetched pages are not added to
+ * the page request tree, as no vCPU is waiting for them.
+ */
+static size_t migrate_req_pages_len(RAMBlock *rb, ram_addr_t start)
+{
+    size_t pagesize = qemu_ram_pagesize(rb);
+    unsigned int nr = migrate_postcopy_prefetch_pages();
+    size_t len = pagesize;
+
+    /* The length of the request is sent as 32 bits */
+    nr = MIN(nr, UINT32_MAX / pagesize - 1);
+    while (nr-- && start + len < rb->postcopy_length &&
+           !ramblock_recv_bitmap_test_byte_offset(rb, start + len)) {
+        len += pagesize;
+    }
+
+    return len;
 }
 
 int migrate_send_rp_req_pages(MigrationIncomingState *mis,
-                              RAMBlock *rb, ram_addr_t start, uint64_t haddr)
+                              RAMBlock *rb, ram_addr_t start, uint64_t haddr,
+                              bool flush)
 {
     void *aligned = (void *)(uintptr_t)ROUND_DOWN(haddr, qemu_ram_pagesize(rb));
     bool received = false;
+    size_t len;
 
     WITH_QEMU_LOCK_GUARD(&mis->page_request_mutex) {
         received = ramblock_recv_bitmap_test_byte_offset(rb, start);
@@ -459,7 +512,10 @@ int migrate_send_rp_req_pages(MigrationIncomingState *mis,
         return 0;
     }
 
-    return migrate_send_rp_message_req_pages(mis, rb, start);
+    len = migrate_req_pages_len(rb, start);
+    trace_migrate_send_rp_req_pages(qemu_ram_get_idstr(rb), start, len);
+
+    return migrate_send_rp_message_req_pages(mis, rb, start, len, flush);
 }
 
 static bool migration_colo_enabled;
@@ -13,6 +13,7 @@
 #include "qemu/osdep.h"
 #include <zstd.h>
 #include "qemu/rcu.h"
+#include "qemu/timer.h"
 #include "exec/ramblock.h"
 #include "exec/target_page.h"
 #include "qapi/error.h"
@@ -33,8 +34,29 @@ struct zstd_data {
     uint8_t *zbuff;
     /* size of compressed buffer */
     uint32_t zbuff_len;
+    /* adaptive level control, send side of zstd-adaptive only */
+    bool adaptive;
+    /* level used for compressible packets, and its upper bound */
+    int level;
+    int max_level;
+    /* level currently set on zcs */
+    int cur_level;
+    /* time spent compressing and elapsed over the current window */
+    int64_t busy_ns;
+    int64_t period_ns;
+    int64_t last_ns;
+    uint32_t window;
 };
 
+/*
+ * Number of packets over which the compression time of a channel is
+ * measured before its level is adjusted.
+ */
+#define ZSTD_ADAPTIVE_WINDOW 16
+
+/* Number of bytes sampled per packet to estimate its entropy */
+#define ZSTD_ADAPTIVE_SAMPLES 1024
+
 /* Multifd zstd compression */
 
 /**
@@ -47,12 +69,17 @@ struct zstd_data {
  * @p: Params for the channel that we are using
  * @errp: pointer to an error
  */
-static int zstd_send_setup(MultiFDSendParams *p, Error **errp)
+static int zstd_send_setup_common(MultiFDSendParams *p, bool adaptive,
+                                  Error **errp)
 {
     struct zstd_data *z = g_new0(struct zstd_data, 1);
     int res;
 
     p->data = z;
+    z->adaptive = adaptive;
+    z->max_level = migrate_multifd_zstd_level() ?: ZSTD_CLEVEL_DEFAULT;
+    z->level = z->max_level;
+    z->cur_level = migrate_multifd_zstd_level();
     z->zcs = ZSTD_createCStream();
     if (!z->zcs) {
         g_free(z);
@@ -80,6 +107,16 @@ static int zstd_send_setup(MultiFDSendParams *p, Error **errp)
     return 0;
 }
 
+static int zstd_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    return zstd_send_setup_common(p, false, errp);
+}
+
+static int zstd_adaptive_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    return zstd_send_setup_common(p, true, errp);
+}
+
 /**
  * zstd_send_cleanup: cleanup send side
  *
@@ -100,6 +137,77 @@ static void zstd_send_cleanup(MultiFDSendParams *p, Error **errp)
     p->data = NULL;
 }
 
+/*
+ * Estimate whether the pages of a packet are worth compressing, from a
+ * sample of their bytes.  For random data, such as pages the guest has
+ * already compressed or encrypted, the number of pairs of equal bytes
+ * in the sample is close to 1/256 of all pairs; anything zstd can
+ * shrink has many more.
+ */
+static bool zstd_adaptive_incompressible(MultiFDSendParams *p)
+{
+    MultiFDPages_t *pages = p->pages;
+    uint32_t hist[256] = { 0 };
+    uint32_t per_page, stride, n = 0;
+    uint64_t pairs = 0;
+    uint32_t i, j;
+
+    if (!pages->normal_num) {
+        return false;
+    }
+    per_page = MIN(DIV_ROUND_UP(ZSTD_ADAPTIVE_SAMPLES, pages->normal_num),
+                   p->page_size);
+    stride = p->page_size / per_page;
+
+    for (i = 0; i < pages->normal_num; i++) {
+        const uint8_t *page = p->pages->block->host + pages->offset[i];
+
+        for (j = 0; j < per_page; j++) {
+            hist[page[j * stride]]++;
+        }
+        n += per_page;
+    }
+    if (n < ZSTD_ADAPTIVE_SAMPLES) {
+        return false;
+    }
+
+    for (i = 0; i < ARRAY_SIZE(hist); i++) {
+        pairs += (uint64_t)hist[i] * (hist[i] - 1);
+    }
+    /* Less than twice the collisions of uniformly random bytes */
+    return pairs * 256 < (uint64_t)n * (n - 1) * 2;
+}
+
+/*
+ * Adjust the level of compressible packets once per window.  When
+ * compressing takes nearly all of the time of the channel, the channel
+ * is CPU bound and the migration goes faster with a lower level.  When
+ * the channel spends most of its time writing to a slow link or
+ * waiting for pages, a higher level costs nothing and saves bandwidth.
+ */
+static void zstd_adaptive_account(struct zstd_data *z, int64_t start_ns)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+
+    if (z->last_ns) {
+        z->busy_ns += now - start_ns;
+        z->period_ns += now - z->last_ns;
+    }
+    z->last_ns = now;
+
+    if (++z->window < ZSTD_ADAPTIVE_WINDOW) {
+        return;
+    }
+    if (z->busy_ns * 10 > z->period_ns * 9) {
+        z->level = MAX(z->level - 1, 1);
+    } else if (z->busy_ns * 2 < z->period_ns) {
+        z->level = MIN(z->level + 1, z->max_level);
+    }
+    z->window = 0;
+    z->busy_ns = 0;
+    z->period_ns = 0;
+}
+
 /**
  * zstd_send_prepare: prepare date to be able to send
  *
@@ -115,20 +223,45 @@ static int zstd_send_prepare(MultiFDSendParams *p, Error **errp)
 {
     MultiFDPages_t *pages = p->pages;
     struct zstd_data *z = p->data;
+    int64_t start_ns = 0;
     int ret;
     uint32_t i;
 
     multifd_send_prepare_header(p);
 
+    /*
+     * The adaptive method ends a frame with each packet, so that the
+     * level can be changed from one packet to the next.  The receive
+     * side does not care, a stream can hold any number of frames.
+     */
+    if (z->adaptive) {
+        int level = z->level;
+
+        start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+        if (zstd_adaptive_incompressible(p)) {
+            level = ZSTD_minCLevel();
+        }
+        if (level != z->cur_level) {
+            ret = ZSTD_CCtx_setParameter(z->zcs, ZSTD_c_compressionLevel,
+                                         level);
+            if (ZSTD_isError(ret)) {
+                error_setg(errp, "multifd %u: setting level %d failed: %s",
+                           p->id, level, ZSTD_getErrorName(ret));
+                return -1;
+            }
+            z->cur_level = level;
+        }
+    }
+
     z->out.dst = z->zbuff;
     z->out.size = z->zbuff_len;
     z->out.pos = 0;
 
-    for (i = 0; i < pages->num; i++) {
+    for (i = 0; i < pages->normal_num; i++) {
         ZSTD_EndDirective flush = ZSTD_e_continue;
 
-        if (i == pages->num - 1) {
-            flush = ZSTD_e_flush;
+        if (i == pages->normal_num - 1) {
+            flush = z->adaptive ? ZSTD_e_end : ZSTD_e_flush;
         }
         z->in.src = p->pages->block->host + pages->offset[i];
         z->in.size = p->page_size;
@@ -139,14 +272,17 @@ static int zstd_send_prepare(MultiFDSendParams *p, Error **errp)
          *
          * We need to loop while:
          * - return is > 0
-         * - there is input available
+         * - there is input available, or we are flushing or ending
+         *   the frame, which can take more than one call
          * - there is output space free
          */
         do {
             ret = ZSTD_compressStream2(z->zcs, &z->out, &z->in, flush);
-        } while (ret > 0 && (z->in.size - z->in.pos > 0)
+        } while (ret > 0 && (z->in.size - z->in.pos > 0 ||
+                             flush != ZSTD_e_continue)
                          && (z->out.size - z->out.pos > 0));
-        if (ret > 0 && (z->in.size - z->in.pos > 0)) {
+        if (ret > 0 && (z->in.size - z->in.pos > 0 ||
+                        flush != ZSTD_e_continue)) {
             error_setg(errp, "multifd %u: compressStream buffer too small",
                        p->id);
             return -1;
@@ -165,6 +301,10 @@ static int zstd_send_prepare(MultiFDSendParams *p, Error **errp)
 
     multifd_send_fill_packet(p);
 
+    if (z->adaptive) {
+        zstd_adaptive_account(z, start_ns);
+    }
+
     return 0;
 }
 
@@ -313,9 +453,21 @@ static MultiFDMethods multifd_zstd_ops = {
     .recv_pages = zstd_recv_pages
 };
 
+/* Same stream as zstd on the wire, only the sender differs */
+static MultiFDMethods multifd_zstd_adaptive_ops = {
+    .send_setup = zstd_adaptive_send_setup,
+    .send_cleanup = zstd_send_cleanup,
+    .send_prepare = zstd_send_prepare,
+    .recv_setup = zstd_recv_setup,
+    .recv_cleanup = zstd_recv_cleanup,
+    .recv_pages = zstd_recv_pages
+};
+
 static void multifd_zstd_register(void)
 {
     multifd_register_ops(MULTIFD_COMPRESSION_ZSTD, &multifd_zstd_ops);
+    multifd_register_ops(MULTIFD_COMPRESSION_ZSTD_ADAPTIVE,
+                         &multifd_zstd_adaptive_ops);
 }
 
 migration_init(multifd_zstd_register);
@@ -11,7 +11,9 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/cutils.h"
 #include "qemu/rcu.h"
+#include "qemu/thread-context.h"
 #include "exec/target_page.h"
 #include "sysemu/sysemu.h"
 #include "exec/ramblock.h"
@@ -20,6 +22,7 @@
 #include "ram.h"
 #include "migration.h"
 #include "migration-stats.h"
+#include "migration/misc.h"
 #include "socket.h"
 #include "tls.h"
 #include "qemu-file.h"
@@ -30,6 +33,7 @@
 #include "qemu/yank.h"
 #include "io/channel-socket.h"
 #include "yank_functions.h"
+#include "savevm.h"
 
 /* Multiple fd's */
 
@@ -69,6 +73,11 @@ struct {
     QemuSemaphore channels_created;
     /* send channels ready */
     QemuSemaphore channels_ready;
+    /*
+     * Serializes the choice of a channel between the migration thread
+     * and the threads that send device state.
+     */
+    QemuMutex channel_lock;
     /*
      * Have we already run terminate threads.  There is a race when it
      * happens that we got one error while we are exiting.
@@ -134,13 +143,13 @@ static int nocomp_send_prepare(MultiFDSendParams *p, Error **errp)
         multifd_send_prepare_header(p);
     }
 
-    for (int i = 0; i < pages->num; i++) {
+    for (int i = 0; i < pages->normal_num; i++) {
         p->iov[p->iovs_num].iov_base = pages->block->host + pages->offset[i];
         p->iov[p->iovs_num].iov_len = p->page_size;
         p->iovs_num++;
     }
 
-    p->next_packet_size = pages->num * p->page_size;
+    p->next_packet_size = pages->normal_num * p->page_size;
     p->flags |= MULTIFD_FLAG_NOCOMP;
 
     multifd_send_fill_packet(p);
@@ -236,6 +245,7 @@ static void multifd_pages_reset(MultiFDPages_t *pages)
      * overwritten later when reused.
      */
     pages->num = 0;
+    pages->normal_num = 0;
     pages->block = NULL;
 }
 
@@ -326,12 +336,14 @@ void multifd_send_fill_packet(MultiFDSendParams *p)
 {
     MultiFDPacket_t *packet = p->packet;
     MultiFDPages_t *pages = p->pages;
+    uint32_t zero_num = pages->num - pages->normal_num;
     uint64_t packet_num;
     int i;
 
     packet->flags = cpu_to_be32(p->flags);
     packet->pages_alloc = cpu_to_be32(p->pages->allocated);
-    packet->normal_pages = cpu_to_be32(pages->num);
+    packet->normal_pages = cpu_to_be32(pages->normal_num);
+    packet->zero_pages = cpu_to_be32(zero_num);
     packet->next_packet_size = cpu_to_be32(p->next_packet_size);
 
     packet_num = qatomic_fetch_inc(&multifd_send_state->packet_num);
@@ -349,10 +361,11 @@ void multifd_send_fill_packet(MultiFDSendParams *p)
     }
 
     p->packets_sent++;
-    p->total_normal_pages += pages->num;
+    p->total_normal_pages += pages->normal_num;
+    p->total_zero_pages += zero_num;
 
-    trace_multifd_send(p->id, packet_num, pages->num, p->flags,
-                       p->next_packet_size);
+    trace_multifd_send(p->id, packet_num, pages->normal_num, zero_num,
+                       p->flags, p->next_packet_size);
 }
 
 static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
@@ -398,15 +411,28 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
         return -1;
     }
 
+    /*
+     * Senders without zero page detection in the channels leave this
+     * field, formerly reserved, to zero.
+     */
+    p->zero_num = be32_to_cpu(packet->zero_pages);
+    if (p->zero_num > packet->pages_alloc - p->normal_num) {
+        error_setg(errp, "multifd: received packet "
+                   "with %u zero pages and expected maximum zero pages are %u",
+                   p->zero_num, packet->pages_alloc - p->normal_num) ;
+        return -1;
+    }
+
     p->next_packet_size = be32_to_cpu(packet->next_packet_size);
     p->packet_num = be64_to_cpu(packet->packet_num);
     p->packets_recved++;
     p->total_normal_pages += p->normal_num;
+    p->total_zero_pages += p->zero_num;
 
-    trace_multifd_recv(p->id, p->packet_num, p->normal_num, p->flags,
-                       p->next_packet_size);
+    trace_multifd_recv(p->id, p->packet_num, p->normal_num, p->zero_num,
+                       p->flags, p->next_packet_size);
 
-    if (p->normal_num == 0) {
+    if (p->normal_num == 0 && p->zero_num == 0) {
         return 0;
     }
 
@@ -432,9 +458,58 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
         p->normal[i] = offset;
     }
 
+    for (i = 0; i < p->zero_num; i++) {
+        uint64_t offset = be64_to_cpu(packet->offset[p->normal_num + i]);
+
+        if (offset > (p->block->used_length - p->page_size)) {
+            error_setg(errp, "multifd: offset too long %" PRIu64
+                       " (max " RAM_ADDR_FMT ")",
+                       offset, p->block->used_length);
+            return -1;
+        }
+        p->zero[i] = offset;
+    }
+
     return 0;
 }
 
+/*
+ * Move the zero pages among those queued on @p to the end of the offset
+ * array and count the others, whose data needs to be sent.  Doing this
+ * here spreads the cost of scanning the pages over all the channels,
+ * instead of leaving it to the migration thread.
+ */
+static void multifd_send_zero_page_detect(MultiFDSendParams *p)
+{
+    MultiFDPages_t *pages = p->pages;
+    uint8_t *host = pages->block->host;
+    uint32_t i = 0, j = pages->num;
+
+    if (migrate_zero_page_detection() != ZERO_PAGE_DETECTION_MULTIFD) {
+        pages->normal_num = pages->num;
+        return;
+    }
+
+    while (i < j) {
+        ram_addr_t offset = pages->offset[i];
+
+        if (!buffer_is_zero(host + offset, p->page_size)) {
+            i++;
+            continue;
+        }
+        pages->offset[i] = pages->offset[--j];
+        pages->offset[j] = offset;
+    }
+    pages->normal_num = i;
+}
+
+static void multifd_recv_zero_page_process(MultiFDRecvParams *p)
+{
+    for (int i = 0; i < p->zero_num; i++) {
+        ram_handle_zero(p->host + p->zero[i], p->page_size);
+    }
+}
+
 static bool multifd_send_should_exit(void)
 {
     return qatomic_read(&multifd_send_state->exiting);
@@ -453,38 +528,25 @@ static void multifd_send_kick_main(MultiFDSendParams *p)
 }
 
 /*
- * How we use multifd_send_state->pages and channel->pages?
- *
- * We create a pages for each channel, and a main one.  Each time that
- * we need to send a batch of pages we interchange the ones between
- * multifd_send_state and the channel that is sending it.  There are
- * two reasons for that:
- *    - to not have to do so many mallocs during migration
- *    - to make easier to know what to free at the end of migration
- *
- * This way we always know who is the owner of each "pages" struct,
- * and we don't need any locking.  It belongs to the migration thread
- * or to the channel thread.  Switching is safe because the migration
- * thread is using the channel mutex when changing it, and the channel
- * have to had finish with its own, otherwise pending_job can't be
- * false.
- *
- * Returns true if succeed, false otherwise.
+ * Wait for a channel without a pending job and return it with the
+ * channel_lock held, or NULL if multifd is exiting.  The job is handed
+ * over with multifd_send_release_channel().
  */
-static bool multifd_send_pages(void)
+static MultiFDSendParams *multifd_send_acquire_channel(void)
 {
-    int i;
     static int next_channel;
-    MultiFDSendParams *p = NULL; /* make happy gcc */
-    MultiFDPages_t *pages = multifd_send_state->pages;
+    MultiFDSendParams *p;
+    int i;
 
     if (multifd_send_should_exit()) {
-        return false;
+        return NULL;
     }
 
     /* We wait here, until at least one channel is ready */
     qemu_sem_wait(&multifd_send_state->channels_ready);
 
+    qemu_mutex_lock(&multifd_send_state->channel_lock);
+
     /*
      * next_channel can remain from a previous migration that was
      * using more channels, so ensure it doesn't overflow if the
@@ -493,7 +555,8 @@ static bool multifd_send_pages(void)
     next_channel %= migrate_multifd_channels();
     for (i = next_channel;; i = (i + 1) % migrate_multifd_channels()) {
         if (multifd_send_should_exit()) {
-            return false;
+            qemu_mutex_unlock(&multifd_send_state->channel_lock);
+            return NULL;
         }
         p = &multifd_send_state->params[i];
         /*
@@ -511,19 +574,131 @@ static bool multifd_send_pages(void)
      * qatomic_store_release() in multifd_send_thread().
      */
     smp_mb_acquire();
-    assert(!p->pages->num);
-    multifd_send_state->pages = p->pages;
-    p->pages = pages;
+    return p;
+}
+
+static void multifd_send_release_channel(MultiFDSendParams *p)
+{
     /*
-     * Making sure p->pages is setup before marking pending_job=true. Pairs
+     * Making sure the job is setup before marking pending_job=true. Pairs
      * with the qatomic_load_acquire() in multifd_send_thread().
      */
     qatomic_store_release(&p->pending_job, true);
+    qemu_mutex_unlock(&multifd_send_state->channel_lock);
     qemu_sem_post(&p->sem);
+}
+
+/*
+ * How we use multifd_send_state->pages and channel->pages?
+ *
+ * We create a pages for each channel, and a main one.  Each time that
+ * we need to send a batch of pages we interchange the ones between
+ * multifd_send_state and the channel that is sending it.  There are
+ * two reasons for that:
+ *    - to not have to do so many mallocs during migration
+ *    - to make easier to know what to free at the end of migration
+ *
+ * This way we always know who is the owner of each "pages" struct,
+ * and we don't need any locking.  It belongs to the migration thread
+ * or to the channel thread.  Switching is safe because the migration
+ * thread is using the channel mutex when changing it, and the channel
+ * have to had finish with its own, otherwise pending_job can't be
+ * false.
+ *
+ * Returns true if succeed, false otherwise.
+ */
+static bool multifd_send_pages(void)
+{
+    MultiFDSendParams *p;
+    MultiFDPages_t *pages = multifd_send_state->pages;
+
+    p = multifd_send_acquire_channel();
+    if (!p) {
+        return false;
+    }
+
+    assert(!p->pages->num && !p->device_state);
+    multifd_send_state->pages = p->pages;
+    p->pages = pages;
+    multifd_send_release_channel(p);
 
     return true;
 }
 
+bool multifd_device_state_supported(void)
+{
+    return migrate_multifd() && !migrate_postcopy_ram();
+}
+
+/*
+ * Send @len bytes of device state at @data through the next free channel.
+ * The buffer is consumed, it must come from g_malloc() and is freed once
+ * sent.  On the destination it is passed to the load_state_buffer handler
+ * of the SaveStateEntry @idstr, @instance_id.  Buffers can arrive in any
+ * order there, since they go through several channels.
+ *
+ * This can be called from any thread, in parallel with the migration
+ * thread sending RAM.  Returns false if multifd is exiting.
+ */
+bool multifd_queue_device_state(const char *idstr, uint32_t instance_id,
+                                char *data, size_t len)
+{
+    MultiFDDeviceState_t *state = g_new0(MultiFDDeviceState_t, 1);
+    MultiFDSendParams *p;
+
+    pstrcpy(state->idstr, sizeof(state->idstr), idstr);
+    state->instance_id = instance_id;
+    state->data = data;
+    state->len = len;
+
+    p = multifd_send_acquire_channel();
+    if (!p) {
+        g_free(state->data);
+        g_free(state);
+        return false;
+    }
+
+    assert(!p->pages->num && !p->device_state);
+    p->device_state = state;
+    multifd_send_release_channel(p);
+
+    return true;
+}
+
+static int multifd_send_device_state(MultiFDSendParams *p, Error **errp)
+{
+    MultiFDDeviceState_t *state = p->device_state;
+    MultiFDPacketDeviceState_t packet = {
+        .hdr.magic = cpu_to_be32(MULTIFD_MAGIC),
+        .hdr.version = cpu_to_be32(MULTIFD_VERSION),
+        .hdr.flags = cpu_to_be32(MULTIFD_FLAG_DEVICE_STATE),
+        .instance_id = cpu_to_be32(state->instance_id),
+        .next_packet_size = cpu_to_be64(state->len),
+    };
+    struct iovec iov[] = {
+        { .iov_base = &packet, .iov_len = sizeof(packet) },
+        { .iov_base = state->data, .iov_len = state->len },
+    };
+    int ret;
+
+    pstrcpy(packet.idstr, sizeof(packet.idstr), state->idstr);
+
+    /* No zero copy, the buffer is freed right away */
+    ret = qio_channel_writev_all(p->c, iov, ARRAY_SIZE(iov), errp);
+    if (ret == 0) {
+        stat64_add(&mig_stats.multifd_bytes, sizeof(packet) + state->len);
+        p->packets_sent++;
+        trace_multifd_send_device_state(p->id, state->idstr,
+                                        state->instance_id, state->len);
+    }
+
+    g_free(state->data);
+    g_free(state);
+    p->device_state = NULL;
+
+    return ret;
+}
+
 static inline bool multifd_queue_empty(MultiFDPages_t *pages)
 {
     return pages->num == 0;
@@ -659,6 +834,11 @@ static bool multifd_send_cleanup_channel(MultiFDSendParams *p, Error **errp)
     p->name = NULL;
     multifd_pages_clear(p->pages);
     p->pages = NULL;
+    if (p->device_state) {
+        g_free(p->device_state->data);
+        g_free(p->device_state);
+        p->device_state = NULL;
+    }
     p->packet_len = 0;
     g_free(p->packet);
     p->packet = NULL;
@@ -673,6 +853,7 @@ static void multifd_send_cleanup_state(void)
 {
     qemu_sem_destroy(&multifd_send_state->channels_created);
     qemu_sem_destroy(&multifd_send_state->channels_ready);
+    qemu_mutex_destroy(&multifd_send_state->channel_lock);
     g_free(multifd_send_state->params);
     multifd_send_state->params = NULL;
     multifd_pages_clear(multifd_send_state->pages);
@@ -807,9 +988,19 @@ static void *multifd_send_thread(void *opaque)
         if (qatomic_load_acquire(&p->pending_job)) {
             MultiFDPages_t *pages = p->pages;
 
+            if (p->device_state) {
+                ret = multifd_send_device_state(p, &local_err);
+                if (ret != 0) {
+                    break;
+                }
+                qatomic_store_release(&p->pending_job, false);
+                continue;
+            }
+
             p->iovs_num = 0;
             assert(pages->num);
 
+            multifd_send_zero_page_detect(p);
             ret = multifd_send_state->ops->send_prepare(p, &local_err);
             if (ret != 0) {
                 break;
@@ -823,6 +1014,9 @@ static void *multifd_send_thread(void *opaque)
 
             stat64_add(&mig_stats.multifd_bytes,
                        p->next_packet_size + p->packet_len);
+            stat64_add(&mig_stats.normal_pages, pages->normal_num);
+            stat64_add(&mig_stats.zero_pages,
+                       pages->num - pages->normal_num);
 
             multifd_pages_reset(p->pages);
             p->next_packet_size = 0;
@@ -866,7 +1060,8 @@ out:
 
     rcu_unregister_thread();
     migration_threads_remove(thread);
-    trace_multifd_send_thread_end(p->id, p->packets_sent, p->total_normal_pages);
+    trace_multifd_send_thread_end(p->id, p->packets_sent, p->total_normal_pages,
+                                  p->total_zero_pages);
 
     return NULL;
 }
@@ -926,8 +1121,9 @@ static bool multifd_channel_connect(MultiFDSendParams *p,
     p->c = ioc;
 
     p->thread_created = true;
-    qemu_thread_create(&p->thread, p->name, multifd_send_thread, p,
-                       QEMU_THREAD_JOINABLE);
+    thread_context_create_thread(migrate_worker_thread_context(), &p->thread,
+                                 p->name, multifd_send_thread, p,
+                                 QEMU_THREAD_JOINABLE);
     return true;
 }
 
@@ -1010,6 +1206,7 @@ bool multifd_send_setup(void)
     multifd_send_state->pages = multifd_pages_init(page_count);
     qemu_sem_init(&multifd_send_state->channels_created, 0);
     qemu_sem_init(&multifd_send_state->channels_ready, 0);
+    qemu_mutex_init(&multifd_send_state->channel_lock);
     qatomic_set(&multifd_send_state->exiting, 0);
     multifd_send_state->ops = multifd_ops[migrate_multifd_compression()];
 
@@ -1132,6 +1329,8 @@ static void multifd_recv_cleanup_channel(MultiFDRecvParams *p)
     p->iov = NULL;
     g_free(p->normal);
     p->normal = NULL;
+    g_free(p->zero);
+    p->zero = NULL;
     multifd_recv_state->ops->recv_cleanup(p);
 }
 
@@ -1198,15 +1397,73 @@ void multifd_recv_sync_main(void)
     trace_multifd_recv_sync_main(multifd_recv_state->packet_num);
 }
 
+/*
+ * Receive the rest of a device state packet, whose header is at the start
+ * of p->packet, and hand the state to its SaveStateEntry.
+ */
+/* @have bytes of the packet are already in p->packet */
+static int multifd_recv_device_state(MultiFDRecvParams *p, size_t have,
+                                     Error **errp)
+{
+    MultiFDPacketDeviceState_t packet;
+    g_autofree char *data = NULL;
+    uint32_t instance_id;
+    uint64_t len;
+
+    memcpy(&packet, p->packet, have);
+    if (have < sizeof(packet) &&
+        qio_channel_read_all(p->c, (char *)&packet + have,
+                             sizeof(packet) - have, errp)) {
+        return -1;
+    }
+
+    if (be32_to_cpu(packet.hdr.magic) != MULTIFD_MAGIC ||
+        be32_to_cpu(packet.hdr.version) != MULTIFD_VERSION) {
+        error_setg(errp, "multifd: received device state packet "
+                   "with magic %x version %u",
+                   be32_to_cpu(packet.hdr.magic),
+                   be32_to_cpu(packet.hdr.version));
+        return -1;
+    }
+
+    packet.idstr[sizeof(packet.idstr) - 1] = 0;
+    instance_id = be32_to_cpu(packet.instance_id);
+    len = be64_to_cpu(packet.next_packet_size);
+
+    data = g_try_malloc(len);
+    if (len && !data) {
+        error_setg(errp, "multifd: cannot allocate %" PRIu64 " bytes of "
+                   "device state for %s", len, packet.idstr);
+        return -1;
+    }
+    if (qio_channel_read_all(p->c, data, len, errp)) {
+        return -1;
+    }
+
+    p->packets_recved++;
+    trace_multifd_recv_device_state(p->id, packet.idstr, instance_id, len);
+
+    return qemu_loadvm_load_state_buffer(packet.idstr, instance_id,
+                                         data, len, errp);
+}
+
 static void *multifd_recv_thread(void *opaque)
 {
     MultiFDRecvParams *p = opaque;
     Error *local_err = NULL;
+    size_t head;
     int ret;
 
     trace_multifd_recv_thread_start(p->id);
     rcu_register_thread();
 
+    /*
+     * Read as much of the packet up front as both layouts have, so that
+     * a packet of pages costs one read for the header and one for the
+     * pages.
+     */
+    head = MIN(p->packet_len, sizeof(MultiFDPacketDeviceState_t));
+
     while (true) {
         uint32_t flags;
 
@@ -1214,12 +1471,29 @@ static void *multifd_recv_thread(void *opaque)
             break;
         }
 
-        ret = qio_channel_read_all_eof(p->c, (void *)p->packet,
-                                       p->packet_len, &local_err);
+        ret = qio_channel_read_all_eof(p->c, (void *)p->packet, head,
+                                       &local_err);
         if (ret == 0 || ret == -1) {   /* 0: EOF  -1: Error */
             break;
         }
 
+        /* Device state packets have a layout of their own */
+        if (be32_to_cpu(p->packet->flags) & MULTIFD_FLAG_DEVICE_STATE) {
+            ret = multifd_recv_device_state(p, head, &local_err);
+            if (ret) {
+                break;
+            }
+            continue;
+        }
+
+        if (head < p->packet_len) {
+            ret = qio_channel_read_all(p->c, (char *)p->packet + head,
+                                       p->packet_len - head, &local_err);
+            if (ret) {
+                break;
+            }
+        }
+
         qemu_mutex_lock(&p->mutex);
         ret = multifd_recv_unfill_packet(p, &local_err);
         if (ret) {
@@ -1239,6 +1513,10 @@ static void *multifd_recv_thread(void *opaque)
             }
         }
 
+        if (p->zero_num) {
+            multifd_recv_zero_page_process(p);
+        }
+
         if (flags & MULTIFD_FLAG_SYNC) {
             qemu_sem_post(&multifd_recv_state->sem_sync);
             qemu_sem_wait(&p->sem_sync);
@@ -1251,7 +1529,9 @@ static void *multifd_recv_thread(void *opaque)
     }
 
     rcu_unregister_thread();
-    trace_multifd_recv_thread_end(p->id, p->packets_recved, p->total_normal_pages);
+    trace_multifd_recv_thread_end(p->id, p->packets_recved,
+                                  p->total_normal_pages,
+                                  p->total_zero_pages);
 
     return NULL;
 }
@@ -1270,6 +1550,10 @@ int multifd_recv_setup(Error **errp)
         return 0;
     }
 
+    /* multifd_recv_thread() reads the header first */
+    QEMU_BUILD_BUG_ON(offsetof(MultiFDPacket_t, pages_alloc) !=
+                      sizeof(MultiFDPacketHdr_t));
+
     thread_count = migrate_multifd_channels();
     multifd_recv_state = g_malloc0(sizeof(*multifd_recv_state));
     multifd_recv_state->params = g_new0(MultiFDRecvParams, thread_count);
@@ -1290,6 +1574,7 @@ int multifd_recv_setup(Error **errp)
         p->name = g_strdup_printf("multifdrecv_%d", i);
         p->iov = g_new0(struct iovec, page_count);
         p->normal = g_new0(ram_addr_t, page_count);
+        p->zero = g_new0(ram_addr_t, page_count);
         p->page_count = page_count;
         p->page_size = qemu_target_page_size();
     }
@@ -1355,7 +1640,8 @@ void multifd_recv_new_channel(QIOChannel *ioc, Error **errp)
     object_ref(OBJECT(ioc));
 
     p->thread_created = true;
-    qemu_thread_create(&p->thread, p->name, multifd_recv_thread, p,
-                       QEMU_THREAD_JOINABLE);
+    thread_context_create_thread(migrate_worker_thread_context(), &p->thread,
+                                 p->name, multifd_recv_thread, p,
+                                 QEMU_THREAD_JOINABLE);
     qatomic_inc(&multifd_recv_state->count);
 }
@@ -34,10 +34,21 @@ bool multifd_queue_page(RAMBlock *block, ram_addr_t offset);
 #define MULTIFD_FLAG_ZLIB (1 << 1)
 #define MULTIFD_FLAG_ZSTD (2 << 1)
 
+/* The packet carries device state, as MultiFDPacketDeviceState_t */
+#define MULTIFD_FLAG_DEVICE_STATE (1 << 4)
+
 /* This value needs to be a multiple of qemu_target_page_size() */
 #define MULTIFD_PACKET_SIZE (512 * 1024)
 
+/* Common start of all the packets */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t flags;
+} __attribute__((packed)) MultiFDPacketHdr_t;
+
 typedef struct {
+    /* Same layout as MultiFDPacketHdr_t */
     uint32_t magic;
     uint32_t version;
     uint32_t flags;
@@ -48,17 +59,44 @@ typedef struct {
     /* size of the next packet that contains pages */
     uint32_t next_packet_size;
     uint64_t packet_num;
-    uint64_t unused[4];    /* Reserved for future use */
+    /* zero pages */
+    uint32_t zero_pages;
+    uint32_t unused32[1];    /* Reserved for future use */
+    uint64_t unused64[3];    /* Reserved for future use */
     char ramblock[256];
+    /*
+     * This array contains the pointers to:
+     *  - normal pages (initial normal_pages entries)
+     *  - zero pages (following zero_pages entries)
+     */
     uint64_t offset[];
 } __attribute__((packed)) MultiFDPacket_t;
 
+typedef struct {
+    MultiFDPacketHdr_t hdr;
+    /* SaveStateEntry the state is for */
+    uint32_t instance_id;
+    char idstr[256];
+    /* size of the device state data that follows */
+    uint64_t next_packet_size;
+} __attribute__((packed)) MultiFDPacketDeviceState_t;
+
+/* A device state buffer queued with multifd_queue_device_state() */
+typedef struct {
+    char idstr[256];
+    uint32_t instance_id;
+    char *data;
+    size_t len;
+} MultiFDDeviceState_t;
+
 typedef struct {
     /* number of used pages */
     uint32_t num;
+    /* number of normal pages, the rest of the used pages are zero */
+    uint32_t normal_num;
     /* number of allocated pages */
     uint32_t allocated;
-    /* offset of each page */
+    /* offset of each page, normal pages first */
     ram_addr_t *offset;
     RAMBlock *block;
 } MultiFDPages_t;
@@ -113,6 +151,11 @@ typedef struct {
      * pending_job != 0 -> multifd_channel can use it.
      */
     MultiFDPages_t *pages;
+    /*
+     * Device state to send instead of the pages, when not NULL.  Owned
+     * by the channel while pending_job is set, like 'pages'.
+     */
+    MultiFDDeviceState_t *device_state;
 
     /* thread local variables. No locking required */
 
@@ -124,6 +167,8 @@ typedef struct {
     uint64_t packets_sent;
     /* non zero pages sent through this channel */
     uint64_t total_normal_pages;
+    /* zero pages sent through this channel */
+    uint64_t total_zero_pages;
     /* buffers to send */
     struct iovec *iov;
     /* number of iovs used */
@@ -178,12 +223,18 @@ typedef struct {
     uint8_t *host;
     /* non zero pages recv through this channel */
     uint64_t total_normal_pages;
+    /* zero pages recv through this channel */
+    uint64_t total_zero_pages;
     /* buffers to recv */
     struct iovec *iov;
     /* Pages that are not zero */
     ram_addr_t *normal;
     /* num of non zero pages */
     uint32_t normal_num;
+    /* Pages that are zero */
+    ram_addr_t *zero;
+    /* num of zero pages */
+    uint32_t zero_num;
     /* used for de-compression methods */
     void *data;
 } MultiFDRecvParams;
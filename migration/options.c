@@ -29,6 +29,7 @@
 #include "ram.h"
 #include "options.h"
 #include "sysemu/kvm.h"
+#include "qemu/thread-context.h"
 
 /* Maximum migrate downtime set to 2000 seconds */
 #define MAX_MIGRATE_DOWNTIME_SECONDS 2000
@@ -65,6 +66,10 @@
 /* 0: means nocompress, 1: best speed, ... 20: best compress ratio */
 #define DEFAULT_MIGRATE_MULTIFD_ZSTD_LEVEL 1
 
+/* Host pages requested after a postcopy fault, 0 means no prefetch */
+#define DEFAULT_MIGRATE_POSTCOPY_PREFETCH_PAGES 0
+#define MAX_MIGRATE_POSTCOPY_PREFETCH_PAGES 64
+
 /* Background transfer rate for postcopy, 0 means unlimited, note
  * that page requests can still exceed this limit.
  */
@@ -100,6 +105,9 @@ Property migration_properties[] = {
                       clear_bitmap_shift, CLEAR_BITMAP_SHIFT_DEFAULT),
     DEFINE_PROP_BOOL("x-preempt-pre-7-2", MigrationState,
                      preempt_pre_7_2, false),
+    DEFINE_PROP_LINK("worker-thread-context", MigrationState,
+                     worker_thread_context, TYPE_THREAD_CONTEXT,
+                     ThreadContext *),
 
     /* Migration parameters */
     DEFINE_PROP_UINT8("x-compress-level", MigrationState,
@@ -179,6 +187,12 @@ Property migration_properties[] = {
     DEFINE_PROP_MIG_MODE("mode", MigrationState,
                       parameters.mode,
                       MIG_MODE_NORMAL),
+    DEFINE_PROP_ZERO_PAGE_DETECTION("zero-page-detection", MigrationState,
+                       parameters.zero_page_detection,
+                       ZERO_PAGE_DETECTION_MULTIFD),
+    DEFINE_PROP_UINT8("postcopy-prefetch-pages", MigrationState,
+                      parameters.postcopy_prefetch_pages,
+                      DEFAULT_MIGRATE_POSTCOPY_PREFETCH_PAGES),
 
     /* Migration capabilities */
     DEFINE_PROP_MIG_CAP("x-xbzrle", MIGRATION_CAPABILITY_XBZRLE),
@@ -204,6 +218,12 @@ Property migration_properties[] = {
     DEFINE_PROP_MIG_CAP("x-switchover-ack",
                         MIGRATION_CAPABILITY_SWITCHOVER_ACK),
     DEFINE_PROP_MIG_CAP("x-dirty-limit", MIGRATION_CAPABILITY_DIRTY_LIMIT),
+    DEFINE_PROP_MIG_CAP("x-defer-hot-pages",
+                        MIGRATION_CAPABILITY_DEFER_HOT_PAGES),
+    DEFINE_PROP_MIG_CAP("x-mapped-ram", MIGRATION_CAPABILITY_MAPPED_RAM),
+    DEFINE_PROP_MIG_CAP("x-lazy-load", MIGRATION_CAPABILITY_LAZY_LOAD),
+    DEFINE_PROP_MIG_CAP("x-parallel-load",
+                        MIGRATION_CAPABILITY_PARALLEL_LOAD),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -242,6 +262,13 @@ bool migrate_compress(void)
     return s->capabilities[MIGRATION_CAPABILITY_COMPRESS];
 }
 
+bool migrate_defer_hot_pages(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_DEFER_HOT_PAGES];
+}
+
 bool migrate_dirty_bitmaps(void)
 {
     MigrationState *s = migrate_get_current();
@@ -277,6 +304,27 @@ bool migrate_late_block_activate(void)
     return s->capabilities[MIGRATION_CAPABILITY_LATE_BLOCK_ACTIVATE];
 }
 
+bool migrate_lazy_load(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_LAZY_LOAD];
+}
+
+bool migrate_parallel_load(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_PARALLEL_LOAD];
+}
+
+bool migrate_mapped_ram(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_MAPPED_RAM];
+}
+
 bool migrate_multifd(void)
 {
     MigrationState *s = migrate_get_current();
@@ -377,6 +425,13 @@ bool migrate_multifd_flush_after_each_section(void)
     return s->multifd_flush_after_each_section;
 }
 
+ThreadContext *migrate_worker_thread_context(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->worker_thread_context;
+}
+
 bool migrate_postcopy(void)
 {
     return migrate_postcopy_ram() || migrate_dirty_bitmaps();
@@ -452,7 +507,8 @@ INITIALIZE_MIGRATE_CAPS_SET(check_caps_background_snapshot,
     MIGRATION_CAPABILITY_XBZRLE,
     MIGRATION_CAPABILITY_X_COLO,
     MIGRATION_CAPABILITY_VALIDATE_UUID,
-    MIGRATION_CAPABILITY_ZERO_COPY_SEND);
+    MIGRATION_CAPABILITY_ZERO_COPY_SEND,
+    MIGRATION_CAPABILITY_DEFER_HOT_PAGES);
 
 static bool migrate_incoming_started(void)
 {
@@ -636,6 +692,11 @@ bool migrate_caps_check(bool *old_caps, bool *new_caps, Error **errp)
             error_setg(errp, "Multifd is not compatible with xbzrle");
             return false;
         }
+        /* Multifd writes to guest RAM directly, bypassing the COLO cache */
+        if (new_caps[MIGRATION_CAPABILITY_X_COLO]) {
+            error_setg(errp, "Multifd is not compatible with COLO");
+            return false;
+        }
     }
 
     if (new_caps[MIGRATION_CAPABILITY_COMPRESS]) {
@@ -645,6 +706,50 @@ bool migrate_caps_check(bool *old_caps, bool *new_caps, Error **errp)
         }
     }
 
+    if (new_caps[MIGRATION_CAPABILITY_MAPPED_RAM]) {
+        if (new_caps[MIGRATION_CAPABILITY_XBZRLE]) {
+            error_setg(errp,
+                       "Mapped-ram migration is incompatible with xbzrle");
+            return false;
+        }
+
+        if (new_caps[MIGRATION_CAPABILITY_COMPRESS]) {
+            error_setg(errp,
+                       "Mapped-ram migration is incompatible with compression");
+            return false;
+        }
+
+        if (new_caps[MIGRATION_CAPABILITY_MULTIFD]) {
+            error_setg(errp,
+                       "Mapped-ram migration is incompatible with multifd");
+            return false;
+        }
+
+        if (new_caps[MIGRATION_CAPABILITY_POSTCOPY_RAM]) {
+            error_setg(errp,
+                       "Mapped-ram migration is incompatible with postcopy");
+            return false;
+        }
+
+        if (new_caps[MIGRATION_CAPABILITY_BACKGROUND_SNAPSHOT]) {
+            error_setg(errp, "Mapped-ram migration is incompatible with "
+                       "background snapshot");
+            return false;
+        }
+    }
+
+    if (new_caps[MIGRATION_CAPABILITY_LAZY_LOAD]) {
+        if (!new_caps[MIGRATION_CAPABILITY_MAPPED_RAM]) {
+            error_setg(errp, "Lazy load requires the mapped-ram capability");
+            return false;
+        }
+
+        if (!ram_lazy_load_available()) {
+            error_setg(errp, "Lazy load is not supported by host kernel");
+            return false;
+        }
+    }
+
     return true;
 }
 
@@ -830,6 +935,13 @@ uint64_t migrate_max_postcopy_bandwidth(void)
     return s->parameters.max_postcopy_bandwidth;
 }
 
+uint8_t migrate_postcopy_prefetch_pages(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->parameters.postcopy_prefetch_pages;
+}
+
 MigMode migrate_mode(void)
 {
     MigrationState *s = migrate_get_current();
@@ -903,6 +1015,13 @@ uint64_t migrate_xbzrle_cache_size(void)
     return s->parameters.xbzrle_cache_size;
 }
 
+ZeroPageDetection migrate_zero_page_detection(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->parameters.zero_page_detection;
+}
+
 /* parameter setters */
 
 void migrate_set_block_incremental(bool value)
@@ -1013,6 +1132,10 @@ MigrationParameters *qmp_query_migrate_parameters(Error **errp)
     params->vcpu_dirty_limit = s->parameters.vcpu_dirty_limit;
     params->has_mode = true;
     params->mode = s->parameters.mode;
+    params->has_zero_page_detection = true;
+    params->zero_page_detection = s->parameters.zero_page_detection;
+    params->has_postcopy_prefetch_pages = true;
+    params->postcopy_prefetch_pages = s->parameters.postcopy_prefetch_pages;
 
     return params;
 }
@@ -1049,6 +1172,8 @@ void migrate_params_init(MigrationParameters *params)
     params->has_x_vcpu_dirty_limit_period = true;
     params->has_vcpu_dirty_limit = true;
     params->has_mode = true;
+    params->has_zero_page_detection = true;
+    params->has_postcopy_prefetch_pages = true;
 }
 
 /*
@@ -1235,6 +1360,15 @@ bool migrate_params_check(MigrationParameters *params, Error **errp)
         return false;
     }
 
+    if (params->has_postcopy_prefetch_pages &&
+        params->postcopy_prefetch_pages > MAX_MIGRATE_POSTCOPY_PREFETCH_PAGES) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE,
+                   "postcopy_prefetch_pages",
+                   "a value between 0 and "
+                   stringify(MAX_MIGRATE_POSTCOPY_PREFETCH_PAGES));
+        return false;
+    }
+
     return true;
 }
 
@@ -1350,6 +1484,14 @@ static void migrate_params_test_apply(MigrateSetParameters *params,
     if (params->has_mode) {
         dest->mode = params->mode;
     }
+
+    if (params->has_zero_page_detection) {
+        dest->zero_page_detection = params->zero_page_detection;
+    }
+
+    if (params->has_postcopy_prefetch_pages) {
+        dest->postcopy_prefetch_pages = params->postcopy_prefetch_pages;
+    }
 }
 
 static void migrate_params_apply(MigrateSetParameters *params, Error **errp)
@@ -1494,6 +1636,15 @@ static void migrate_params_apply(MigrateSetParameters *params, Error **errp)
     if (params->has_mode) {
         s->parameters.mode = params->mode;
     }
+
+    if (params->has_zero_page_detection) {
+        s->parameters.zero_page_detection = params->zero_page_detection;
+    }
+
+    if (params->has_postcopy_prefetch_pages) {
+        s->parameters.postcopy_prefetch_pages =
+            params->postcopy_prefetch_pages;
+    }
 }
 
 void qmp_migrate_set_parameters(MigrateSetParameters *params, Error **errp)
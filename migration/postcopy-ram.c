@@ -44,6 +44,9 @@
  */
 #define MAX_DISCARDS_PER_COMMAND 12
 
+/* Userfault messages read at a time by the fault thread */
+#define POSTCOPY_FAULT_BATCH 64
+
 struct PostcopyDiscardState {
     const char *ramblock_name;
     uint16_t cur_entry;
@@ -762,7 +765,7 @@ int postcopy_wake_shared(struct PostCopyFD *pcfd,
 }
 
 static int postcopy_request_page(MigrationIncomingState *mis, RAMBlock *rb,
-                                 ram_addr_t start, uint64_t haddr)
+                                 ram_addr_t start, uint64_t haddr, bool flush)
 {
     void *aligned = (void *)(uintptr_t)ROUND_DOWN(haddr, qemu_ram_pagesize(rb));
 
@@ -781,7 +784,7 @@ static int postcopy_request_page(MigrationIncomingState *mis, RAMBlock *rb,
         return received ? 0 : postcopy_place_page_zero(mis, aligned, rb);
     }
 
-    return migrate_send_rp_req_pages(mis, rb, start, haddr);
+    return migrate_send_rp_req_pages(mis, rb, start, haddr, flush);
 }
 
 /*
@@ -802,7 +805,7 @@ int postcopy_request_shared_page(struct PostCopyFD *pcfd, RAMBlock *rb,
                                         qemu_ram_get_idstr(rb), rb_offset);
         return postcopy_wake_shared(pcfd, client_addr, rb);
     }
-    postcopy_request_page(mis, rb, aligned_rbo, client_addr);
+    postcopy_request_page(mis, rb, aligned_rbo, client_addr, true);
     return 0;
 }
 
@@ -962,13 +965,103 @@ static void postcopy_pause_fault_thread(MigrationIncomingState *mis)
 /*
  * Handle faults detected by the USERFAULT markings
  */
+/*
+ * Request the pages for a batch of faults read from the userfaultfd.
+ * Several faults on the same host page are requested once.  Pages
+ * that a vCPU waits for are requested first: a blocked vCPU stalls
+ * the guest, while other threads (iothreads, vhost) can usually
+ * wait.  The requests go out on the return path with a single flush.
+ *
+ * Returns 0 on success, -1 if the faults cannot be handled.
+ */
+static int postcopy_ram_fault_batch(MigrationIncomingState *mis,
+                                    struct uffd_msg *msgs, int nr)
+{
+    struct {
+        RAMBlock *rb;
+        ram_addr_t offset;
+        uint64_t haddr;
+        bool vcpu;
+    } req[POSTCOPY_FAULT_BATCH];
+    int nr_req = 0;
+    int i, j, pass;
+
+    for (i = 0; i < nr; i++) {
+        struct uffd_msg *msg = &msgs[i];
+        uint64_t haddr = msg->arg.pagefault.address;
+        uint32_t ptid = msg->arg.pagefault.feat.ptid;
+        ram_addr_t rb_offset;
+        RAMBlock *rb;
+        bool vcpu;
+
+        if (msg->event != UFFD_EVENT_PAGEFAULT) {
+            error_report("%s: Read unexpected event %ud from userfaultfd",
+                         __func__, msg->event);
+            continue; /* It's not a page fault, shouldn't happen */
+        }
+
+        rb = qemu_ram_block_from_host((void *)(uintptr_t)haddr, true,
+                                      &rb_offset);
+        if (!rb) {
+            error_report("postcopy_ram_fault_thread: Fault outside guest: %"
+                         PRIx64, haddr);
+            return -1;
+        }
+
+        rb_offset = ROUND_DOWN(rb_offset, qemu_ram_pagesize(rb));
+        trace_postcopy_ram_fault_thread_request(haddr, qemu_ram_get_idstr(rb),
+                                                rb_offset, ptid);
+        mark_postcopy_blocktime_begin((uintptr_t)haddr, ptid, rb);
+
+        /* Without UFFD_FEATURE_THREAD_ID all faults look alike */
+        vcpu = ptid && get_mem_fault_cpu_index(ptid) >= 0;
+        for (j = 0; j < nr_req; j++) {
+            if (req[j].rb == rb && req[j].offset == rb_offset) {
+                break;
+            }
+        }
+        if (j < nr_req) {
+            req[j].vcpu |= vcpu;
+            continue;
+        }
+        req[nr_req].rb = rb;
+        req[nr_req].offset = rb_offset;
+        req[nr_req].haddr = haddr;
+        req[nr_req].vcpu = vcpu;
+        nr_req++;
+    }
+
+    /*
+     * Send the requests to the source - we want to request one of our
+     * host page sizes (which is >= TPS).  Failures may be network
+     * failures, so wait for recovery, which resends whatever is in the
+     * page request tree, and go on.
+     */
+    for (pass = 0; pass < 2; pass++) {
+        for (j = 0; j < nr_req; j++) {
+            if (req[j].vcpu != (pass == 0)) {
+                continue;
+            }
+            while (postcopy_request_page(mis, req[j].rb, req[j].offset,
+                                         req[j].haddr, false)) {
+                postcopy_pause_fault_thread(mis);
+            }
+        }
+    }
+    while (nr_req && migrate_send_rp_flush(mis)) {
+        postcopy_pause_fault_thread(mis);
+    }
+
+    return 0;
+}
+
 static void *postcopy_ram_fault_thread(void *opaque)
 {
     MigrationIncomingState *mis = opaque;
+    struct uffd_msg msgs[POSTCOPY_FAULT_BATCH];
     struct uffd_msg msg;
     int ret;
     size_t index;
-    RAMBlock *rb = NULL;
 
     trace_postcopy_ram_fault_thread_entry();
     rcu_register_thread();
@@ -995,7 +1088,6 @@ static void *postcopy_ram_fault_thread(void *opaque)
     }
 
     while (true) {
-        ram_addr_t rb_offset;
         int poll_result;
 
         /*
@@ -1036,8 +1128,9 @@ static void *postcopy_ram_fault_thread(void *opaque)
 
         if (pfd[0].revents) {
             poll_result--;
-            ret = read(mis->userfault_fd, &msg, sizeof(msg));
-            if (ret != sizeof(msg)) {
+            /* A read returns as many queued faults as fit */
+            ret = read(mis->userfault_fd, msgs, sizeof(msgs));
+            if (ret < 0) {
                 if (errno == EAGAIN) {
                     /*
                      * if a wake up happens on the other thread just after
@@ -1045,54 +1138,19 @@ static void *postcopy_ram_fault_thread(void *opaque)
                      */
                     continue;
                 }
-                if (ret < 0) {
-                    error_report("%s: Failed to read full userfault "
-                                 "message: %s",
-                                 __func__, strerror(errno));
-                    break;
-                } else {
-                    error_report("%s: Read %d bytes from userfaultfd "
-                                 "expected %zd",
-                                 __func__, ret, sizeof(msg));
-                    break; /* Lost alignment, don't know what we'd read next */
-                }
+                error_report("%s: Failed to read userfault messages: %s",
+                             __func__, strerror(errno));
+                break;
             }
-            if (msg.event != UFFD_EVENT_PAGEFAULT) {
-                error_report("%s: Read unexpected event %ud from userfaultfd",
-                             __func__, msg.event);
-                continue; /* It's not a page fault, shouldn't happen */
+            if (ret % sizeof(msgs[0])) {
+                error_report("%s: Read %d bytes from userfaultfd, "
+                             "not a multiple of %zd",
+                             __func__, ret, sizeof(msgs[0]));
+                break; /* Lost alignment, don't know what we'd read next */
             }
-
-            rb = qemu_ram_block_from_host(
-                     (void *)(uintptr_t)msg.arg.pagefault.address,
-                     true, &rb_offset);
-            if (!rb) {
-                error_report("postcopy_ram_fault_thread: Fault outside guest: %"
-                             PRIx64, (uint64_t)msg.arg.pagefault.address);
+            if (postcopy_ram_fault_batch(mis, msgs, ret / sizeof(msgs[0]))) {
                 break;
             }
-
-            rb_offset = ROUND_DOWN(rb_offset, qemu_ram_pagesize(rb));
-            trace_postcopy_ram_fault_thread_request(msg.arg.pagefault.address,
-                                                qemu_ram_get_idstr(rb),
-                                                rb_offset,
-                                                msg.arg.pagefault.feat.ptid);
-            mark_postcopy_blocktime_begin(
-                    (uintptr_t)(msg.arg.pagefault.address),
-                                msg.arg.pagefault.feat.ptid, rb);
-
-retry:
-            /*
-             * Send the request to the source - we want to request one
-             * of our host page sizes (which is >= TPS)
-             */
-            ret = postcopy_request_page(mis, rb, rb_offset,
-                                        msg.arg.pagefault.address);
-            if (ret) {
-                /* May be network failure, try to wait for recovery */
-                postcopy_pause_fault_thread(mis);
-                goto retry;
-            }
         }
 
         /* Now handle any requests from external processes on shared memory */
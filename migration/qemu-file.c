@@ -447,6 +447,109 @@ void qemu_put_buffer(QEMUFile *f, const uint8_t *buf, size_t size)
     }
 }
 
+/*
+ * Write @buflen bytes of @buf at offset @pos of the underlying channel,
+ * bypassing the buffer.  The current position of @f is not changed.
+ */
+void qemu_put_buffer_at(QEMUFile *f, const uint8_t *buf, size_t buflen,
+                        off_t pos)
+{
+    Error *err = NULL;
+    size_t done = 0;
+
+    if (f->last_error) {
+        return;
+    }
+
+    while (done < buflen) {
+        ssize_t ret = qio_channel_pwrite(f->ioc, (char *)buf + done,
+                                         buflen - done, pos + done, &err);
+        if (ret < 0) {
+            qemu_file_set_error_obj(f, -EIO, err);
+            return;
+        }
+        done += ret;
+    }
+
+    stat64_add(&mig_stats.qemu_file_transferred, buflen);
+}
+
+/*
+ * Read @buflen bytes at offset @pos of the underlying channel into
+ * @buf, bypassing the buffer.  The current position of @f is not
+ * changed.  Returns the number of bytes read, which is less than
+ * @buflen only on error or at the end of the file.
+ */
+size_t qemu_get_buffer_at(QEMUFile *f, uint8_t *buf, size_t buflen,
+                          off_t pos)
+{
+    Error *err = NULL;
+    size_t done = 0;
+
+    if (f->last_error) {
+        return 0;
+    }
+
+    while (done < buflen) {
+        ssize_t ret = qio_channel_pread(f->ioc, (char *)buf + done,
+                                        buflen - done, pos + done, &err);
+        if (ret < 0) {
+            qemu_file_set_error_obj(f, -EIO, err);
+            break;
+        }
+        if (ret == 0) {
+            qemu_file_set_error(f, -EIO);
+            break;
+        }
+        done += ret;
+    }
+
+    return done;
+}
+
+/*
+ * Move the current position of @f within the underlying channel.  Any
+ * pending output is flushed first, and any buffered input dropped.
+ */
+void qemu_set_offset(QEMUFile *f, off_t off, int whence)
+{
+    Error *err = NULL;
+
+    if (qemu_file_is_writable(f)) {
+        qemu_fflush(f);
+    } else {
+        /* Drop all cached buffers if existed; will trigger a re-fill later */
+        f->buf_index = 0;
+        f->buf_size = 0;
+    }
+
+    if (qio_channel_io_seek(f->ioc, off, whence, &err) < 0) {
+        qemu_file_set_error_obj(f, -EIO, err);
+    }
+}
+
+/* Return the position of @f within the underlying channel, or -1 */
+off_t qemu_get_offset(QEMUFile *f)
+{
+    Error *err = NULL;
+    off_t ret;
+
+    qemu_fflush(f);
+
+    ret = qio_channel_io_seek(f->ioc, 0, SEEK_CUR, &err);
+    if (ret < 0) {
+        qemu_file_set_error_obj(f, -EIO, err);
+        return -1;
+    }
+
+    /* Buffered input has been read from the channel, but not consumed */
+    if (!qemu_file_is_writable(f)) {
+        ret -= f->buf_size - f->buf_index;
+    }
+
+    return ret;
+}
+
 void qemu_put_byte(QEMUFile *f, int v)
 {
     if (f->last_error) {
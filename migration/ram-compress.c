@@ -28,6 +28,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
+#include "qemu/thread-context.h"
 
 #include "ram-compress.h"
 
@@ -193,9 +194,10 @@ int compress_threads_save_setup(void)
         comp_param[i].quit = false;
         qemu_mutex_init(&comp_param[i].mutex);
         qemu_cond_init(&comp_param[i].cond);
-        qemu_thread_create(compress_threads + i, "compress",
-                           do_data_compress, comp_param + i,
-                           QEMU_THREAD_JOINABLE);
+        thread_context_create_thread(migrate_worker_thread_context(),
+                                     compress_threads + i, "compress",
+                                     do_data_compress, comp_param + i,
+                                     QEMU_THREAD_JOINABLE);
     }
     return 0;
 
@@ -472,9 +474,10 @@ int compress_threads_load_setup(QEMUFile *f)
         qemu_cond_init(&decomp_param[i].cond);
         decomp_param[i].done = true;
         decomp_param[i].quit = false;
-        qemu_thread_create(decompress_threads + i, "decompress",
-                           do_data_decompress, decomp_param + i,
-                           QEMU_THREAD_JOINABLE);
+        thread_context_create_thread(migrate_worker_thread_context(),
+                                     decompress_threads + i, "decompress",
+                                     do_data_decompress, decomp_param + i,
+                                     QEMU_THREAD_JOINABLE);
     }
     return 0;
 exit:
@@ -32,6 +32,7 @@
 #include "qemu/bitmap.h"
 #include "qemu/madvise.h"
 #include "qemu/main-loop.h"
+#include "qemu/parallel.h"
 #include "xbzrle.h"
 #include "ram-compress.h"
 #include "ram.h"
@@ -67,7 +68,9 @@
 #include "hw/boards.h" /* for machine_dump_guest_core() */
 
 #if defined(__linux__)
+#include <sys/ioctl.h>
 #include "qemu/userfaultfd.h"
+#include "io/channel-file.h"
 #endif /* defined(__linux__) */
 
 /***********************************************************/
@@ -94,6 +97,30 @@
 #define RAM_SAVE_FLAG_MULTIFD_FLUSH    0x200
 /* We can't use any flag that is bigger than 0x200 */
 
+/*
+ * mapped-ram: each RAMBlock header in the stream is followed by a
+ * MappedRamHeader, then by the bitmap of the pages present in the file
+ * and, at the next MAPPED_RAM_FILE_OFFSET_ALIGNMENT boundary, by the
+ * pages themselves at their offset in the block.  The stream goes on
+ * after the last page of the block.
+ */
+#define MAPPED_RAM_HDR_VERSION 1
+#define MAPPED_RAM_FILE_OFFSET_ALIGNMENT 0x100000
+
+struct MappedRamHeader {
+    uint32_t version;
+    /* the target's page size, for the offsets in the bitmap */
+    uint64_t page_size;
+    uint64_t bitmap_offset;
+    uint64_t pages_offset;
+} QEMU_PACKED;
+typedef struct MappedRamHeader MappedRamHeader;
+
+/* Pages of a RAMBlock are written or read in jobs of this many bytes */
+#define MAPPED_RAM_CHUNK        (256ULL << 20)
+/* Threads doing the I/O, including the migration or incoming thread */
+#define MAPPED_RAM_THREADS      8
+
 XBZRLECacheStats xbzrle_counters;
 
 /* used by the search for pages to send */
@@ -374,6 +401,8 @@ struct RAMState {
     uint64_t target_page_count;
     /* number of dirty bits in the bitmap */
     uint64_t migration_dirty_pages;
+    /* number of dirty pages held back until the final stage */
+    uint64_t hot_pages;
     /*
      * Protects:
      * - dirty/clear bitmap
@@ -394,6 +423,13 @@ struct RAMState {
      * RAM migration.
      */
     unsigned int postcopy_bmap_sync_requested;
+
+    /* Threads for migration_bitmap_sync on large guests, or NULL */
+    QemuParallel *dirty_sync_threads;
+    /* Threads writing pages to the file with mapped-ram, or NULL */
+    QemuParallel *mapped_ram_threads;
+    /* Array of DirtySyncJob, reused by each sync */
+    GArray *dirty_sync_jobs;
 };
 typedef struct RAMState RAMState;
 
@@ -680,6 +716,17 @@ static int save_xbzrle_page(RAMState *rs, PageSearchStatus *pss,
     return 1;
 }
 
+/*
+ * Whether the pages in RAMBlock->hotmap are held back.  This is only
+ * done during the iterative phase of precopy; in the final stage and
+ * in postcopy every dirty page has to be sent.
+ */
+static bool ram_defer_hot_pages(RAMState *rs)
+{
+    return migrate_defer_hot_pages() && !rs->last_stage &&
+           !migration_in_postcopy() && !migration_in_colo_state();
+}
+
 /**
  * pss_find_next_dirty: find the next dirty page of current ramblock
  *
@@ -713,6 +760,14 @@ static void pss_find_next_dirty(PageSearchStatus *pss)
     }
 
     pss->page = find_next_bit(bitmap, size, pss->page);
+
+    /* Skip the pages that are held back until the final stage */
+    if (rb->hotmap && ram_defer_hot_pages(ram_state)) {
+        while (pss->page < size && test_bit(pss->page, rb->hotmap)) {
+            pss->page = find_next_zero_bit(rb->hotmap, size, pss->page);
+            pss->page = find_next_bit(bitmap, size, pss->page);
+        }
+    }
 }
 
 static void migration_clear_memory_region_dirty_bitmap(RAMBlock *rb,
@@ -814,11 +869,33 @@ static inline bool migration_bitmap_clear_dirty(RAMState *rs,
     ret = test_and_clear_bit(page, rb->bmap);
     if (ret) {
         rs->migration_dirty_pages--;
+        if (rb->hotmap && test_and_clear_bit(page, rb->hotmap)) {
+            rs->hot_pages--;
+        }
     }
 
     return ret;
 }
 
+/*
+ * Clear @num pages starting at @start, which must all be dirty, from the
+ * migration bitmap of @rb.
+ */
+static void colo_bitmap_clear_dirty(RAMState *rs, RAMBlock *rb,
+                                    unsigned long start, unsigned long num)
+{
+    if (rb->clear_bmap) {
+        migration_clear_memory_region_dirty_bitmap_range(rb, start, num);
+    }
+
+    bitmap_clear(rb->bmap, start, num);
+    rs->migration_dirty_pages -= num;
+    if (rb->hotmap) {
+        rs->hot_pages -= bitmap_count_one_with_offset(rb->hotmap, start, num);
+        bitmap_clear(rb->hotmap, start, num);
+    }
+}
+
 static void dirty_bitmap_clear_section(MemoryRegionSection *section,
                                        void *opaque)
 {
@@ -904,6 +981,78 @@ static void ramblock_sync_dirty_bitmap(RAMState *rs, RAMBlock *rb)
     rs->num_dirty_pages_period += new_dirty_pages;
 }
 
+/*
+ * On large guests the dirty bitmap sync is split into jobs, each
+ * covering DIRTY_SYNC_CHUNK bytes of a RAMBlock, or one chunk of its
+ * clear bitmap if that is larger.  The jobs then never share a word
+ * of RAMBlock->bmap, and only set bits of the clear bitmap atomically.
+ */
+#define DIRTY_SYNC_CHUNK            (1ULL << 30)
+/* Guest RAM for each thread syncing the dirty bitmap */
+#define DIRTY_SYNC_RAM_PER_THREAD   (64ULL << 30)
+#define DIRTY_SYNC_THREADS_MAX      8
+
+typedef struct DirtySyncJob {
+    RAMBlock *block;
+    ram_addr_t start;
+    ram_addr_t length;
+    uint64_t new_dirty_pages;
+} DirtySyncJob;
+
+static void ram_sync_dirty_bitmap_job(void *opaque, unsigned int i)
+{
+    DirtySyncJob *job = &g_array_index((GArray *)opaque, DirtySyncJob, i);
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        job->new_dirty_pages =
+            cpu_physical_memory_sync_dirty_bitmap(job->block, job->start,
+                                                  job->length);
+    }
+}
+
+/* Called with RCU critical section and bitmap_mutex held */
+static void ram_sync_dirty_bitmaps(RAMState *rs)
+{
+    GArray *jobs = rs->dirty_sync_jobs;
+    RAMBlock *block;
+
+    if (!rs->dirty_sync_threads) {
+        RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+            ramblock_sync_dirty_bitmap(rs, block);
+        }
+        return;
+    }
+
+    g_array_set_size(jobs, 0);
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        ram_addr_t chunk = DIRTY_SYNC_CHUNK;
+
+        if (block->clear_bmap) {
+            chunk = MAX(chunk, (ram_addr_t)TARGET_PAGE_SIZE
+                               << block->clear_bmap_shift);
+        }
+        for (ram_addr_t start = 0; start < block->used_length;
+             start += chunk) {
+            DirtySyncJob job = {
+                .block = block,
+                .start = start,
+                .length = MIN(chunk, block->used_length - start),
+            };
+            g_array_append_val(jobs, job);
+        }
+    }
+
+    qemu_parallel_run(rs->dirty_sync_threads, jobs->len,
+                      ram_sync_dirty_bitmap_job, jobs);
+
+    for (unsigned int i = 0; i < jobs->len; i++) {
+        DirtySyncJob *job = &g_array_index(jobs, DirtySyncJob, i);
+
+        rs->migration_dirty_pages += job->new_dirty_pages;
+        rs->num_dirty_pages_period += job->new_dirty_pages;
+    }
+}
+
 /**
  * ram_pagesize_summary: calculate all the pagesizes of a VM
  *
@@ -1033,7 +1182,6 @@ static void migration_trigger_throttle(RAMState *rs)
 
 static void migration_bitmap_sync(RAMState *rs, bool last_stage)
 {
-    RAMBlock *block;
     int64_t end_time;
 
     stat64_add(&mig_stats.dirty_sync_count, 1);
@@ -1047,15 +1195,23 @@ static void migration_bitmap_sync(RAMState *rs, bool last_stage)
 
     qemu_mutex_lock(&rs->bitmap_mutex);
     WITH_RCU_READ_LOCK_GUARD() {
-        RAMBLOCK_FOREACH_NOT_IGNORED(block) {
-            ramblock_sync_dirty_bitmap(rs, block);
-        }
+        ram_sync_dirty_bitmaps(rs);
         stat64_set(&mig_stats.dirty_bytes_last_sync, ram_bytes_remaining());
+        if (migrate_defer_hot_pages()) {
+            RAMBlock *block;
+
+            rs->hot_pages = 0;
+            RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+                rs->hot_pages += bitmap_count_one(block->hotmap,
+                                    block->used_length >> TARGET_PAGE_BITS);
+            }
+        }
     }
     qemu_mutex_unlock(&rs->bitmap_mutex);
 
     memory_global_after_dirty_log_sync();
-    trace_migration_bitmap_sync_end(rs->num_dirty_pages_period);
+    trace_migration_bitmap_sync_end(rs->num_dirty_pages_period,
+                                    rs->hot_pages);
 
     end_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
 
@@ -1123,10 +1279,21 @@ static int save_zero_page(RAMState *rs, PageSearchStatus *pss,
     QEMUFile *file = pss->pss_channel;
     int len = 0;
 
+    if (migrate_zero_page_detection() == ZERO_PAGE_DETECTION_NONE) {
+        return 0;
+    }
+
     if (!buffer_is_zero(p, TARGET_PAGE_SIZE)) {
         return 0;
     }
 
+    if (migrate_mapped_ram()) {
+        /* Zero pages are left out of the file, which starts out zeroed */
+        clear_bit(offset >> TARGET_PAGE_BITS, pss->block->file_bmap);
+        stat64_add(&mig_stats.zero_pages, 1);
+        return 1;
+    }
+
     len += save_page_header(pss, file, pss->block, offset | RAM_SAVE_FLAG_ZERO);
     qemu_put_byte(file, 0);
     len += 1;
@@ -1190,6 +1357,15 @@ static int save_normal_page(PageSearchStatus *pss, RAMBlock *block,
 {
     QEMUFile *file = pss->pss_channel;
 
+    if (migrate_mapped_ram()) {
+        qemu_put_buffer_at(file, buf, TARGET_PAGE_SIZE,
+                           block->pages_offset + offset);
+        set_bit(offset >> TARGET_PAGE_BITS, block->file_bmap);
+        ram_transferred_add(TARGET_PAGE_SIZE);
+        stat64_add(&mig_stats.normal_pages, 1);
+        return 1;
+    }
+
     ram_transferred_add(save_page_header(pss, pss->pss_channel, block,
                                          offset | RAM_SAVE_FLAG_PAGE));
     if (async) {
@@ -1252,10 +1428,10 @@ static int ram_save_page(RAMState *rs, PageSearchStatus *pss)
 
 static int ram_save_multifd_page(RAMBlock *block, ram_addr_t offset)
 {
+    /* The channel accounts the page once it knows whether it is zero */
     if (!multifd_queue_page(block, offset)) {
         return -1;
     }
-    stat64_add(&mig_stats.normal_pages, 1);
 
     return 1;
 }
@@ -2055,10 +2231,6 @@ static int ram_save_target_page_legacy(RAMState *rs, PageSearchStatus *pss)
         return 1;
     }
 
-    if (save_zero_page(rs, pss, offset)) {
-        return 1;
-    }
-
     /*
      * Do not use multifd in postcopy as one whole host page should be
      * placed.  Meanwhile postcopy requires atomic update of pages, so even
@@ -2066,9 +2238,18 @@ static int ram_save_target_page_legacy(RAMState *rs, PageSearchStatus *pss)
      * still see partially copied pages which is data corruption.
      */
     if (migrate_multifd() && !migration_in_postcopy()) {
+        /* Zero pages are then found by the multifd channels */
+        if (migrate_zero_page_detection() != ZERO_PAGE_DETECTION_MULTIFD &&
+            save_zero_page(rs, pss, offset)) {
+            return 1;
+        }
         return ram_save_multifd_page(block, offset);
     }
 
+    if (save_zero_page(rs, pss, offset)) {
+        return 1;
+    }
+
     return ram_save_page(rs, pss);
 }
 
@@ -2364,6 +2545,9 @@ static void ram_state_cleanup(RAMState **rsp)
 {
     if (*rsp) {
         migration_page_queue_free(*rsp);
+        qemu_parallel_free((*rsp)->dirty_sync_threads);
+        qemu_parallel_free((*rsp)->mapped_ram_threads);
+        g_array_free((*rsp)->dirty_sync_jobs, true);
         qemu_mutex_destroy(&(*rsp)->bitmap_mutex);
         qemu_mutex_destroy(&(*rsp)->src_page_req_mutex);
         g_free(*rsp);
@@ -2412,6 +2596,12 @@ static void ram_save_cleanup(void *opaque)
         block->clear_bmap = NULL;
         g_free(block->bmap);
         block->bmap = NULL;
+        g_free(block->dirty_hist);
+        block->dirty_hist = NULL;
+        g_free(block->hotmap);
+        block->hotmap = NULL;
+        g_free(block->file_bmap);
+        block->file_bmap = NULL;
     }
 
     xbzrle_cleanup();
@@ -2723,6 +2913,8 @@ err_out:
 
 static int ram_state_init(RAMState **rsp)
 {
+    unsigned int nr_sync_threads;
+
     *rsp = g_try_new0(RAMState, 1);
 
     if (!*rsp) {
@@ -2743,6 +2935,15 @@ static int ram_state_init(RAMState **rsp)
     (*rsp)->migration_dirty_pages = (*rsp)->ram_bytes_total >> TARGET_PAGE_BITS;
     ram_state_reset(*rsp);
 
+    /* The migration thread takes a share of the sync too */
+    nr_sync_threads = MIN((*rsp)->ram_bytes_total / DIRTY_SYNC_RAM_PER_THREAD,
+                          DIRTY_SYNC_THREADS_MAX);
+    if (nr_sync_threads > 1) {
+        (*rsp)->dirty_sync_threads = qemu_parallel_new("mig/dirtysync",
+                                                       nr_sync_threads - 1);
+    }
+    (*rsp)->dirty_sync_jobs = g_array_new(false, false, sizeof(DirtySyncJob));
+
     return 0;
 }
 
@@ -2781,6 +2982,13 @@ static void ram_list_init_bitmaps(void)
             bitmap_set(block->bmap, 0, pages);
             block->clear_bmap_shift = shift;
             block->clear_bmap = bitmap_new(clear_bmap_size(pages, shift));
+            if (migrate_defer_hot_pages()) {
+                block->dirty_hist = bitmap_new(pages);
+                block->hotmap = bitmap_new(pages);
+            }
+            if (migrate_mapped_ram()) {
+                block->file_bmap = bitmap_new(pages);
+            }
         }
     }
 }
@@ -2923,6 +3131,225 @@ void qemu_guest_free_page_hint(void *addr, size_t len)
  * granularity of these critical sections.
  */
 
+/*
+ * With mapped-ram the pages of each RAMBlock are written and read in
+ * parallel, one MappedRamJob for each MAPPED_RAM_CHUNK bytes.  The jobs
+ * never share a word of the bitmaps of the block.
+ */
+typedef struct MappedRamJob {
+    RAMBlock *block;
+    QIOChannel *ioc;
+    /* Range of pages of @block */
+    unsigned long start;
+    unsigned long end;
+    /* Pages present in the file, when loading */
+    unsigned long *bitmap;
+    uint64_t normal_pages;
+    uint64_t zero_pages;
+    Error *err;
+} MappedRamJob;
+
+static void mapped_ram_add_jobs(GArray *jobs, RAMBlock *block,
+                                QIOChannel *ioc, unsigned long *bitmap)
+{
+    unsigned long pages = block->used_length >> TARGET_PAGE_BITS;
+    unsigned long chunk = MAPPED_RAM_CHUNK >> TARGET_PAGE_BITS;
+
+    for (unsigned long start = 0; start < pages; start += chunk) {
+        MappedRamJob job = {
+            .block = block,
+            .ioc = ioc,
+            .start = start,
+            .end = MIN(start + chunk, pages),
+            .bitmap = bitmap,
+        };
+        g_array_append_val(jobs, job);
+    }
+}
+
+/*
+ * Run @func on all of @jobs.  Returns 0, or -1 with @errp set to the
+ * error of the first failed job.
+ */
+static int mapped_ram_run_jobs(QemuParallel *threads, GArray *jobs,
+                               QemuParallelFunc *func, Error **errp)
+{
+    int ret = 0;
+
+    qemu_parallel_run(threads, jobs->len, func, jobs);
+
+    for (unsigned int i = 0; i < jobs->len; i++) {
+        MappedRamJob *job = &g_array_index(jobs, MappedRamJob, i);
+
+        if (job->err) {
+            if (!ret) {
+                error_propagate(errp, job->err);
+                ret = -1;
+            } else {
+                error_free(job->err);
+            }
+            job->err = NULL;
+        }
+    }
+
+    return ret;
+}
+
+static int mapped_ram_pwrite(QIOChannel *ioc, uint8_t *buf, size_t len,
+                             off_t pos, Error **errp)
+{
+    while (len) {
+        ssize_t ret = qio_channel_pwrite(ioc, (char *)buf, len, pos, errp);
+
+        if (ret < 0) {
+            return -1;
+        }
+        buf += ret;
+        len -= ret;
+        pos += ret;
+    }
+
+    return 0;
+}
+
+/* Write each run of dirty pages that are not zero with a single call */
+static void mapped_ram_save_job(void *opaque, unsigned int i)
+{
+    MappedRamJob *job = &g_array_index((GArray *)opaque, MappedRamJob, i);
+    RAMBlock *block = job->block;
+    bool detect_zero =
+        migrate_zero_page_detection() != ZERO_PAGE_DETECTION_NONE;
+    unsigned long page, run;
+
+    page = find_next_bit(block->bmap, job->end, job->start);
+    while (page < job->end) {
+        ram_addr_t offset = (ram_addr_t)page << TARGET_PAGE_BITS;
+
+        for (run = page; run < job->end && test_bit(run, block->bmap);
+             run++) {
+            if (detect_zero &&
+                buffer_is_zero(block->host + (run << TARGET_PAGE_BITS),
+                               TARGET_PAGE_SIZE)) {
+                break;
+            }
+            set_bit(run, block->file_bmap);
+        }
+
+        if (run == page) {
+            clear_bit(page, block->file_bmap);
+            job->zero_pages++;
+            run++;
+        } else if (mapped_ram_pwrite(job->ioc, block->host + offset,
+                                     (run - page) << TARGET_PAGE_BITS,
+                                     block->pages_offset + offset,
+                                     &job->err) < 0) {
+            return;
+        } else {
+            job->normal_pages += run - page;
+        }
+
+        page = find_next_bit(block->bmap, job->end, run);
+    }
+}
+
+/*
+ * Write all the dirty pages at once with the mapped-ram threads, when
+ * the guest is not running and the rate limit is pointless.
+ *
+ * Called with the RCU critical section and bitmap_mutex held.
+ */
+static int ram_save_mapped_ram_all(RAMState *rs, QEMUFile *f)
+{
+    g_autoptr(GArray) jobs = g_array_new(false, false, sizeof(MappedRamJob));
+    QIOChannel *ioc = qemu_file_get_ioc(f);
+    uint64_t normal_pages = 0, zero_pages = 0;
+    Error *err = NULL;
+    RAMBlock *block;
+    int ret;
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        unsigned long pages = block->used_length >> TARGET_PAGE_BITS;
+
+        /* Further writes by the guest must show up in the next sync */
+        migration_clear_memory_region_dirty_bitmap_range(block, 0, pages);
+        mapped_ram_add_jobs(jobs, block, ioc, NULL);
+    }
+
+    ret = mapped_ram_run_jobs(rs->mapped_ram_threads, jobs,
+                              mapped_ram_save_job, &err);
+    if (ret < 0) {
+        qemu_file_set_error_obj(f, -EIO, err);
+        return -EIO;
+    }
+
+    for (unsigned int i = 0; i < jobs->len; i++) {
+        MappedRamJob *job = &g_array_index(jobs, MappedRamJob, i);
+
+        normal_pages += job->normal_pages;
+        zero_pages += job->zero_pages;
+    }
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        unsigned long pages = block->used_length >> TARGET_PAGE_BITS;
+
+        bitmap_clear(block->bmap, 0, pages);
+        if (block->hotmap) {
+            bitmap_clear(block->hotmap, 0, pages);
+        }
+    }
+    rs->migration_dirty_pages = 0;
+    rs->hot_pages = 0;
+
+    stat64_add(&mig_stats.normal_pages, normal_pages);
+    stat64_add(&mig_stats.zero_pages, zero_pages);
+    stat64_add(&mig_stats.qemu_file_transferred,
+               normal_pages * TARGET_PAGE_SIZE);
+    ram_transferred_add(normal_pages * TARGET_PAGE_SIZE);
+
+    return 0;
+}
+
+/*
+ * Write the header of @block, and leave room in the file for its
+ * bitmap and its pages.
+ */
+static void mapped_ram_setup_ramblock(QEMUFile *f, RAMBlock *block)
+{
+    MappedRamHeader header = { 0 };
+    long num_pages = block->used_length >> TARGET_PAGE_BITS;
+    size_t bitmap_size = BITS_TO_LONGS(num_pages) * sizeof(unsigned long);
+
+    block->bitmap_offset = qemu_get_offset(f) + sizeof(header);
+    block->pages_offset = ROUND_UP(block->bitmap_offset + bitmap_size,
+                                   MAPPED_RAM_FILE_OFFSET_ALIGNMENT);
+
+    header.version = cpu_to_be32(MAPPED_RAM_HDR_VERSION);
+    header.page_size = cpu_to_be64(TARGET_PAGE_SIZE);
+    header.bitmap_offset = cpu_to_be64(block->bitmap_offset);
+    header.pages_offset = cpu_to_be64(block->pages_offset);
+    qemu_put_buffer(f, (uint8_t *)&header, sizeof(header));
+
+    /* The stream goes on after the pages */
+    qemu_set_offset(f, block->pages_offset + block->used_length, SEEK_SET);
+}
+
+/* Write the bitmaps of the pages present in the file */
+static void mapped_ram_save_bitmaps(QEMUFile *f)
+{
+    RAMBlock *block;
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        long num_pages = block->used_length >> TARGET_PAGE_BITS;
+        size_t bitmap_size = BITS_TO_LONGS(num_pages) * sizeof(unsigned long);
+        g_autofree unsigned long *le_bitmap = bitmap_new(num_pages);
+
+        bitmap_to_le(le_bitmap, block->file_bmap, num_pages);
+        qemu_put_buffer_at(f, (uint8_t *)le_bitmap, bitmap_size,
+                           block->bitmap_offset);
+        ram_transferred_add(bitmap_size);
+    }
+}
+
 /**
  * ram_save_setup: Setup RAM for migration
  *
@@ -2965,9 +3392,17 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
             if (migrate_ignore_shared()) {
                 qemu_put_be64(f, block->mr->addr);
             }
+            if (migrate_mapped_ram()) {
+                mapped_ram_setup_ramblock(f, block);
+            }
         }
     }
 
+    if (migrate_mapped_ram() && !(*rsp)->mapped_ram_threads) {
+        (*rsp)->mapped_ram_threads = qemu_parallel_new("mig/mapped-ram",
+                                                     MAPPED_RAM_THREADS - 1);
+    }
+
     ret = rdma_registration_start(f, RAM_CONTROL_SETUP);
     if (ret < 0) {
         qemu_file_set_error(f, ret);
@@ -3044,6 +3479,16 @@ static int ram_save_iterate(QEMUFile *f, void *opaque)
                 goto out;
             }
 
+            /*
+             * A stopped guest cannot dirty its memory again, so write
+             * it out in one go.
+             */
+            if (migrate_mapped_ram() && !runstate_is_running()) {
+                ret = ram_save_mapped_ram_all(rs, f);
+                done = 1;
+                goto out;
+            }
+
             t0 = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
             i = 0;
             while ((ret = migration_rate_exceeded(f)) == 0 ||
@@ -3158,6 +3603,13 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
 
         /* flush all remaining blocks regardless of rate limiting */
         qemu_mutex_lock(&rs->bitmap_mutex);
+        if (migrate_mapped_ram()) {
+            ret = ram_save_mapped_ram_all(rs, f);
+            if (ret < 0) {
+                qemu_mutex_unlock(&rs->bitmap_mutex);
+                return ret;
+            }
+        }
         while (true) {
             int pages;
 
@@ -3175,6 +3627,10 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
 
         compress_flush_data();
 
+        if (migrate_mapped_ram()) {
+            mapped_ram_save_bitmaps(f);
+        }
+
         ret = rdma_registration_stop(f, RAM_CONTROL_FINISH);
         if (ret < 0) {
             qemu_file_set_error(f, ret);
@@ -3182,6 +3638,12 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
         }
     }
 
+    /* Device state sent through multifd is flushed by the sync below */
+    ret = qemu_savevm_state_complete_precopy_join_threads();
+    if (ret < 0) {
+        return ret;
+    }
+
     ret = multifd_send_sync_main();
     if (ret < 0) {
         return ret;
@@ -3202,6 +3664,14 @@ static void ram_state_pending_estimate(void *opaque, uint64_t *must_precopy,
 
     uint64_t remaining_size = rs->migration_dirty_pages * TARGET_PAGE_SIZE;
 
+    /*
+     * Held back pages are not sent by the next iterations, so leave
+     * them out and let ram_state_pending_exact decide when to stop.
+     */
+    if (ram_defer_hot_pages(rs)) {
+        remaining_size -= rs->hot_pages * TARGET_PAGE_SIZE;
+    }
+
     if (migrate_postcopy_ram()) {
         /* We can do postcopy, and all the data is postcopiable */
         *can_postcopy += remaining_size;
@@ -3769,11 +4239,7 @@ void colo_flush_ram_cache(void)
                 num = 0;
                 block = QLIST_NEXT_RCU(block, next);
             } else {
-                unsigned long i = 0;
-
-                for (i = 0; i < num; i++) {
-                    migration_bitmap_clear_dirty(ram_state, block, offset + i);
-                }
+                colo_bitmap_clear_dirty(ram_state, block, offset, num);
                 dst_host = block->host
                          + (((ram_addr_t)offset) << TARGET_PAGE_BITS);
                 src_host = block->colo_cache
@@ -3787,7 +4253,433 @@ void colo_flush_ram_cache(void)
     trace_colo_flush_ram_cache_end();
 }
 
-static int parse_ramblock(QEMUFile *f, RAMBlock *block, ram_addr_t length)
+static int mapped_ram_pread(QIOChannel *ioc, uint8_t *buf, size_t len,
+                            off_t pos, Error **errp)
+{
+    while (len) {
+        ssize_t ret = qio_channel_pread(ioc, (char *)buf, len, pos, errp);
+
+        if (ret < 0) {
+            return -1;
+        }
+        if (ret == 0) {
+            error_setg(errp, "Unexpected end of migration file");
+            return -1;
+        }
+        buf += ret;
+        len -= ret;
+        pos += ret;
+    }
+
+    return 0;
+}
+
+/* Read each run of pages present in the file with a single call */
+static void mapped_ram_load_job(void *opaque, unsigned int i)
+{
+    MappedRamJob *job = &g_array_index((GArray *)opaque, MappedRamJob, i);
+    RAMBlock *block = job->block;
+    unsigned long page, run;
+
+    page = find_next_bit(job->bitmap, job->end, job->start);
+    while (page < job->end) {
+        ram_addr_t offset = (ram_addr_t)page << TARGET_PAGE_BITS;
+        void *host = host_from_ram_block_offset(block, offset);
+
+        run = find_next_zero_bit(job->bitmap, job->end, page);
+        if (!host) {
+            error_setg(&job->err, "Illegal RAM offset " RAM_ADDR_FMT
+                       " in block %s", offset, block->idstr);
+            return;
+        }
+        if (mapped_ram_pread(job->ioc, host,
+                             (run - page) << TARGET_PAGE_BITS,
+                             block->pages_offset + offset, &job->err) < 0) {
+            return;
+        }
+
+        page = find_next_bit(job->bitmap, job->end, run);
+    }
+}
+
+#if defined(__linux__)
+/*
+ * lazy-load: instead of reading the pages of a mapped-ram file before the
+ * guest starts, register guest RAM with userfaultfd and go on with the
+ * device state at once.  A fault thread reads each page from the file the
+ * first time it is touched, and a prefetch thread copies in all the others
+ * in the background.  When that is done, RAM is unregistered and behaves
+ * normally again.
+ */
+typedef struct MappedRamLazyBlock {
+    RAMBlock *block;
+    /* Pages present in the file */
+    unsigned long *bitmap;
+} MappedRamLazyBlock;
+
+static struct {
+    int uffd;
+    /* A dup of the migration file, which outlives the incoming migration */
+    int fd;
+    GArray *blocks;
+    size_t max_page_size;
+    QemuThread fault_thread;
+    QemuThread prefetch_thread;
+    bool done;
+} mapped_ram_lazy = { .uffd = -1, .fd = -1 };
+
+/* The prefetch thread copies in this much at a time */
+#define MAPPED_RAM_LAZY_CHUNK   (2 * MiB)
+
+bool ram_lazy_load_available(void)
+{
+    uint64_t uffd_features;
+
+    return uffd_query_features(&uffd_features) == 0;
+}
+
+static MappedRamLazyBlock *mapped_ram_lazy_find(RAMBlock *block)
+{
+    for (guint i = 0; i < mapped_ram_lazy.blocks->len; i++) {
+        MappedRamLazyBlock *lb = &g_array_index(mapped_ram_lazy.blocks,
+                                                MappedRamLazyBlock, i);
+
+        if (lb->block == block) {
+            return lb;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Read @len bytes at @offset of the block from the file into @buf.  There
+ * is no way to report an error to the guest, so failing is fatal.
+ */
+static void mapped_ram_lazy_read(MappedRamLazyBlock *lb, ram_addr_t offset,
+                                 size_t len, uint8_t *buf)
+{
+    RAMBlock *block = lb->block;
+    unsigned long end = (offset + len) >> TARGET_PAGE_BITS;
+    unsigned long page, run;
+
+    memset(buf, 0, len);
+    page = find_next_bit(lb->bitmap, end, offset >> TARGET_PAGE_BITS);
+    while (page < end) {
+        ram_addr_t start = (ram_addr_t)page << TARGET_PAGE_BITS;
+        uint8_t *p = buf + (start - offset);
+        off_t pos = block->pages_offset + start;
+        size_t n;
+
+        run = find_next_zero_bit(lb->bitmap, end, page);
+        for (n = (run - page) << TARGET_PAGE_BITS; n; ) {
+            ssize_t ret = pread(mapped_ram_lazy.fd, p, n, pos);
+
+            if (ret < 0 && errno == EINTR) {
+                continue;
+            }
+            if (ret <= 0) {
+                error_report("lazy-load: could not read block %s at "
+                             RAM_ADDR_FMT " from the migration file",
+                             block->idstr, start);
+                exit(EXIT_FAILURE);
+            }
+            p += ret;
+            n -= ret;
+            pos += ret;
+        }
+        page = find_next_bit(lb->bitmap, end, run);
+    }
+}
+
+/* Returns false if part of the range was there already */
+static bool mapped_ram_lazy_place(void *host, void *buf, size_t len)
+{
+    struct uffdio_copy copy = {
+        .dst = (uintptr_t)host,
+        .src = (uintptr_t)buf,
+        .len = len,
+    };
+
+    while (ioctl(mapped_ram_lazy.uffd, UFFDIO_COPY, &copy)) {
+        if (errno == EEXIST) {
+            return false;
+        }
+        if (errno != EAGAIN) {
+            error_report("lazy-load: could not place RAM at %p: %s",
+                         host, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        copy.copy = 0;
+    }
+    return true;
+}
+
+static void *mapped_ram_lazy_fault_thread(void *opaque)
+{
+    g_autofree uint8_t *buf = g_malloc(mapped_ram_lazy.max_page_size);
+
+    rcu_register_thread();
+    while (!qatomic_read(&mapped_ram_lazy.done)) {
+        struct uffd_msg msg;
+        MappedRamLazyBlock *lb = NULL;
+        RAMBlock *block;
+        ram_addr_t offset;
+
+        if (!uffd_poll_events(mapped_ram_lazy.uffd, 100) ||
+            uffd_read_events(mapped_ram_lazy.uffd, &msg, 1) != 1 ||
+            msg.event != UFFD_EVENT_PAGEFAULT) {
+            continue;
+        }
+
+        WITH_RCU_READ_LOCK_GUARD() {
+            block = qemu_ram_block_from_host(
+                (void *)(uintptr_t)msg.arg.pagefault.address, false, &offset);
+            if (block) {
+                lb = mapped_ram_lazy_find(block);
+            }
+        }
+        if (!lb) {
+            error_report("lazy-load: fault at 0x%" PRIx64
+                         " outside of guest RAM",
+                         (uint64_t)msg.arg.pagefault.address);
+            exit(EXIT_FAILURE);
+        }
+
+        offset = QEMU_ALIGN_DOWN(offset, block->page_size);
+        mapped_ram_lazy_read(lb, offset, block->page_size, buf);
+        if (!mapped_ram_lazy_place(block->host + offset, buf,
+                                   block->page_size)) {
+            /* The prefetch thread got there first */
+            uffd_wakeup(mapped_ram_lazy.uffd, block->host + offset,
+                        block->page_size);
+        }
+    }
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static void *mapped_ram_lazy_prefetch_thread(void *opaque)
+{
+    g_autofree uint8_t *buf = NULL;
+
+    rcu_register_thread();
+    for (guint i = 0; i < mapped_ram_lazy.blocks->len; i++) {
+        MappedRamLazyBlock *lb = &g_array_index(mapped_ram_lazy.blocks,
+                                                MappedRamLazyBlock, i);
+        RAMBlock *block = lb->block;
+        size_t chunk = MAX(MAPPED_RAM_LAZY_CHUNK, block->page_size);
+
+        g_free(buf);
+        buf = g_malloc(chunk);
+        for (ram_addr_t offset = 0; offset < block->used_length;
+             offset += chunk) {
+            size_t len = MIN(chunk, block->used_length - offset);
+            unsigned long page = offset >> TARGET_PAGE_BITS;
+            unsigned long end = (offset + len) >> TARGET_PAGE_BITS;
+
+            /* Pages missing from the file are zero, let them fault */
+            if (find_next_bit(lb->bitmap, end, page) == end) {
+                continue;
+            }
+
+            mapped_ram_lazy_read(lb, offset, len, buf);
+            if (mapped_ram_lazy_place(block->host + offset, buf, len)) {
+                continue;
+            }
+            /* The guest touched some of it, go page by page */
+            for (size_t o = 0; o < len; o += block->page_size) {
+                mapped_ram_lazy_place(block->host + offset + o, buf + o,
+                                      block->page_size);
+            }
+        }
+    }
+
+    /*
+     * Everything that is still missing is zero.  Unregistering wakes up
+     * whoever waits for such a page, and it just gets a fresh anonymous one.
+     */
+    qatomic_set(&mapped_ram_lazy.done, true);
+    qemu_thread_join(&mapped_ram_lazy.fault_thread);
+    for (guint i = 0; i < mapped_ram_lazy.blocks->len; i++) {
+        MappedRamLazyBlock *lb = &g_array_index(mapped_ram_lazy.blocks,
+                                                MappedRamLazyBlock, i);
+
+        uffd_unregister_memory(mapped_ram_lazy.uffd, lb->block->host,
+                               lb->block->used_length);
+        g_free(lb->bitmap);
+    }
+    g_array_free(mapped_ram_lazy.blocks, true);
+    mapped_ram_lazy.blocks = NULL;
+    uffd_close_fd(mapped_ram_lazy.uffd);
+    close(mapped_ram_lazy.fd);
+    mapped_ram_lazy.uffd = -1;
+    mapped_ram_lazy.fd = -1;
+    rcu_unregister_thread();
+    return NULL;
+}
+
+/*
+ * Register @block for lazy loading, taking ownership of @bitmap.  Returns
+ * false, without an error, if the block has to be read up front.
+ */
+static bool mapped_ram_lazy_add(RAMBlock *block, QIOChannel *ioc,
+                                unsigned long *bitmap, Error **errp)
+{
+    MappedRamLazyBlock lb = { .block = block, .bitmap = bitmap };
+
+    /* Discarding shared memory would punch holes in its backend */
+    if (!migrate_lazy_load() || qemu_ram_is_shared(block) ||
+        !object_dynamic_cast(OBJECT(ioc), TYPE_QIO_CHANNEL_FILE)) {
+        return false;
+    }
+
+    if (!mapped_ram_lazy.blocks) {
+        mapped_ram_lazy.uffd = uffd_create_fd(0, true);
+        if (mapped_ram_lazy.uffd < 0) {
+            error_setg(errp, "lazy-load: could not create userfaultfd");
+            return false;
+        }
+        mapped_ram_lazy.fd = dup(QIO_CHANNEL_FILE(ioc)->fd);
+        if (mapped_ram_lazy.fd < 0) {
+            error_setg_errno(errp, errno, "lazy-load: could not dup fd");
+            uffd_close_fd(mapped_ram_lazy.uffd);
+            mapped_ram_lazy.uffd = -1;
+            return false;
+        }
+        mapped_ram_lazy.blocks = g_array_new(false, false,
+                                             sizeof(MappedRamLazyBlock));
+        mapped_ram_lazy.done = false;
+    }
+
+    /* Nothing may be mapped yet, or it would not fault */
+    if (ram_block_discard_range(block, 0, block->used_length)) {
+        error_setg(errp, "lazy-load: could not discard block %s",
+                   block->idstr);
+        return false;
+    }
+    if (uffd_register_memory(mapped_ram_lazy.uffd, block->host,
+                             block->used_length,
+                             UFFDIO_REGISTER_MODE_MISSING, NULL)) {
+        error_setg(errp, "lazy-load: could not register block %s",
+                   block->idstr);
+        return false;
+    }
+
+    mapped_ram_lazy.max_page_size = MAX(mapped_ram_lazy.max_page_size,
+                                        block->page_size);
+    g_array_append_val(mapped_ram_lazy.blocks, lb);
+    return true;
+}
+
+/* Start serving faults once all of RAM is registered */
+static void mapped_ram_lazy_start(void)
+{
+    if (!mapped_ram_lazy.blocks) {
+        return;
+    }
+    qemu_thread_create(&mapped_ram_lazy.fault_thread, "mig/lazy-fault",
+                       mapped_ram_lazy_fault_thread, NULL,
+                       QEMU_THREAD_JOINABLE);
+    qemu_thread_create(&mapped_ram_lazy.prefetch_thread, "mig/lazy-fetch",
+                       mapped_ram_lazy_prefetch_thread, NULL,
+                       QEMU_THREAD_DETACHED);
+}
+#else
+bool ram_lazy_load_available(void)
+{
+    return false;
+}
+
+static bool mapped_ram_lazy_add(RAMBlock *block, QIOChannel *ioc,
+                                unsigned long *bitmap, Error **errp)
+{
+    return false;
+}
+
+static void mapped_ram_lazy_start(void)
+{
+}
+#endif /* defined(__linux__) */
+
+/*
+ * Read the pages of @block from the file with @threads, and move the
+ * stream past them.  Pages missing from the file are zero, and are
+ * left untouched.  With lazy-load, the pages are only read once the
+ * guest runs.
+ */
+static int parse_ramblock_mapped_ram(QEMUFile *f, RAMBlock *block,
+                                     ram_addr_t length, QemuParallel *threads)
+{
+    g_autoptr(GArray) jobs = g_array_new(false, false, sizeof(MappedRamJob));
+    long num_pages = length >> TARGET_PAGE_BITS;
+    size_t bitmap_size = BITS_TO_LONGS(num_pages) * sizeof(unsigned long);
+    g_autofree unsigned long *le_bitmap = bitmap_new(num_pages);
+    g_autofree unsigned long *bitmap = bitmap_new(num_pages);
+    MappedRamHeader header;
+    Error *local_err = NULL;
+
+    if (qemu_get_buffer(f, (uint8_t *)&header, sizeof(header)) !=
+        sizeof(header)) {
+        error_report("Could not read mapped-ram header of block %s",
+                     block->idstr);
+        return -EINVAL;
+    }
+
+    header.version = be32_to_cpu(header.version);
+    header.page_size = be64_to_cpu(header.page_size);
+    header.bitmap_offset = be64_to_cpu(header.bitmap_offset);
+    header.pages_offset = be64_to_cpu(header.pages_offset);
+
+    if (header.version > MAPPED_RAM_HDR_VERSION) {
+        error_report("Mapped-ram header of block %s has version %" PRIu32
+                     ", expected %d or lower", block->idstr, header.version,
+                     MAPPED_RAM_HDR_VERSION);
+        return -EINVAL;
+    }
+    if (header.page_size != TARGET_PAGE_SIZE) {
+        error_report("Mapped-ram page size of block %s is %" PRIu64
+                     ", expected %d", block->idstr, header.page_size,
+                     TARGET_PAGE_SIZE);
+        return -EINVAL;
+    }
+    if (!QEMU_IS_ALIGNED(header.pages_offset,
+                         MAPPED_RAM_FILE_OFFSET_ALIGNMENT)) {
+        error_report("Mapped-ram pages of block %s are at unaligned offset "
+                     "0x%" PRIx64, block->idstr, header.pages_offset);
+        return -EINVAL;
+    }
+
+    if (qemu_get_buffer_at(f, (uint8_t *)le_bitmap, bitmap_size,
+                           header.bitmap_offset) != bitmap_size) {
+        error_report("Could not read mapped-ram bitmap of block %s",
+                     block->idstr);
+        return -EINVAL;
+    }
+    bitmap_from_le(bitmap, le_bitmap, num_pages);
+
+    block->pages_offset = header.pages_offset;
+    if (mapped_ram_lazy_add(block, qemu_file_get_ioc(f), bitmap,
+                            &local_err)) {
+        bitmap = NULL;
+    } else if (local_err) {
+        error_report_err(local_err);
+        return -EIO;
+    } else {
+        mapped_ram_add_jobs(jobs, block, qemu_file_get_ioc(f), bitmap);
+        if (mapped_ram_run_jobs(threads, jobs, mapped_ram_load_job,
+                                &local_err) < 0) {
+            error_report_err(local_err);
+            return -EIO;
+        }
+    }
+
+    qemu_set_offset(f, header.pages_offset + length, SEEK_SET);
+
+    return qemu_file_get_error(f);
+}
+
+static int parse_ramblock(QEMUFile *f, RAMBlock *block, ram_addr_t length,
+                          QemuParallel *threads)
 {
     int ret = 0;
     /* ADVISE is earlier, it shows the source has the postcopy capability on */
@@ -3830,6 +4722,12 @@ static int parse_ramblock(QEMUFile *f, RAMBlock *block, ram_addr_t length)
             return -EINVAL;
         }
     }
+    if (migrate_mapped_ram()) {
+        ret = parse_ramblock_mapped_ram(f, block, length, threads);
+        if (ret < 0) {
+            return ret;
+        }
+    }
     ret = rdma_block_notification_handle(f, block->idstr);
     if (ret < 0) {
         qemu_file_set_error(f, ret);
@@ -3840,8 +4738,13 @@ static int parse_ramblock(QEMUFile *f, RAMBlock *block, ram_addr_t length)
 
 static int parse_ramblocks(QEMUFile *f, ram_addr_t total_ram_bytes)
 {
+    QemuParallel *threads = NULL;
     int ret = 0;
 
+    if (migrate_mapped_ram()) {
+        threads = qemu_parallel_new("mig/mapped-ram", MAPPED_RAM_THREADS - 1);
+    }
+
     /* Synchronize RAM block list */
     while (!ret && total_ram_bytes) {
         RAMBlock *block;
@@ -3855,7 +4758,7 @@ static int parse_ramblocks(QEMUFile *f, ram_addr_t total_ram_bytes)
 
         block = qemu_ram_block_by_name(id);
         if (block) {
-            ret = parse_ramblock(f, block, length);
+            ret = parse_ramblock(f, block, length, threads);
         } else {
             error_report("Unknown ramblock \"%s\", cannot accept "
                          "migration", id);
@@ -3864,6 +4767,11 @@ static int parse_ramblocks(QEMUFile *f, ram_addr_t total_ram_bytes)
         total_ram_bytes -= length;
     }
 
+    qemu_parallel_free(threads);
+    if (!ret) {
+        mapped_ram_lazy_start();
+    }
+
     return ret;
 }
 
@@ -53,7 +53,10 @@
 #include "trace.h"
 #include "qemu/iov.h"
 #include "qemu/job.h"
+#include "qemu/parallel.h"
 #include "qemu/main-loop.h"
+#include "qemu/rcu.h"
+#include "qemu/units.h"
 #include "block/snapshot.h"
 #include "qemu/cutils.h"
 #include "io/channel-buffer.h"
@@ -95,6 +98,9 @@ enum qemu_vm_cmd {
 };
 
 #define MAX_VM_CMD_PACKAGED_SIZE UINT32_MAX
+
+/* Worker threads for the parallel-load sections, including the caller */
+#define PARALLEL_LOAD_THREADS   8
 static struct mig_cmd_args {
     ssize_t     len; /* -1 = variable */
     const char *name;
@@ -229,8 +235,17 @@ typedef struct SaveState {
     uint32_t caps_count;
     MigrationCapability *capabilities;
     QemuUUID uuid;
+    /* SaveCompleteThread running save_live_complete_precopy_thread */
+    GSList *complete_threads;
 } SaveState;
 
+typedef struct SaveCompleteThread {
+    QemuThread thread;
+    SaveStateEntry *se;
+    int ret;
+    Error *err;
+} SaveCompleteThread;
+
 static SaveState savevm_state = {
     .handlers = QTAILQ_HEAD_INITIALIZER(savevm_state.handlers),
     .handler_pri_head = { [MIG_PRI_DEFAULT ... MIG_PRI_MAX] = NULL },
@@ -956,6 +971,153 @@ static int vmstate_load(QEMUFile *f, SaveStateEntry *se)
     return vmstate_load_state(f, se->vmsd, se->opaque, se->load_version_id);
 }
 
+/*
+ * A QEMU_VM_SECTION_BUFFERED section that waits for a worker thread
+ */
+typedef struct ParallelLoad {
+    SaveStateEntry *se;
+    QIOChannelBuffer *bioc;
+    int ret;
+} ParallelLoad;
+
+static GPtrArray *parallel_loads;
+
+static void parallel_load_free(gpointer p)
+{
+    ParallelLoad *job = p;
+
+    object_unref(OBJECT(job->bioc));
+    g_free(job);
+}
+
+static int parallel_load_one(ParallelLoad *job)
+{
+    QEMUFile *f = qemu_file_new_input(QIO_CHANNEL(job->bioc));
+    int ret;
+
+    ret = vmstate_load(f, job->se);
+    if (!ret) {
+        ret = qemu_file_get_error(f);
+    }
+    qemu_fclose(f);
+    return ret;
+}
+
+static void parallel_load_func(void *opaque, unsigned int index)
+{
+    ParallelLoad *job = g_ptr_array_index(parallel_loads, index);
+
+    job->ret = parallel_load_one(job);
+}
+
+/*
+ * Read the data of a QEMU_VM_SECTION_BUFFERED section, and load it now
+ * unless the device lets it wait for qemu_loadvm_parallel_flush().
+ */
+static int vmstate_load_buffered(QEMUFile *f, SaveStateEntry *se)
+{
+    ParallelLoad *job;
+    uint32_t len;
+    int ret;
+
+    len = qemu_get_be32(f);
+    ret = qemu_file_get_error(f);
+    if (ret) {
+        return ret;
+    }
+
+    job = g_new0(ParallelLoad, 1);
+    job->se = se;
+    job->bioc = qio_channel_buffer_new(len);
+    qio_channel_set_name(QIO_CHANNEL(job->bioc), "migration-section-buffer");
+    if (qemu_get_buffer(f, job->bioc->data, len) != len) {
+        parallel_load_free(job);
+        ret = qemu_file_get_error(f);
+        return ret ? ret : -EIO;
+    }
+    job->bioc->usage = len;
+
+    if (!se->vmsd || !se->vmsd->load_parallel || se->vmsd->early_setup) {
+        ret = parallel_load_one(job);
+        parallel_load_free(job);
+        return ret;
+    }
+
+    if (!parallel_loads) {
+        parallel_loads = g_ptr_array_new_with_free_func(parallel_load_free);
+    }
+    g_ptr_array_add(parallel_loads, job);
+    return 0;
+}
+
+/*
+ * Load the sections that vmstate_load_buffered() queued, spread over
+ * worker threads.
+ */
+static int qemu_loadvm_parallel_flush(void)
+{
+    QemuParallel *threads = NULL;
+    unsigned int nr_threads, i;
+    int ret = 0;
+
+    if (!parallel_loads || !parallel_loads->len) {
+        return 0;
+    }
+
+    nr_threads = MIN(parallel_loads->len, PARALLEL_LOAD_THREADS);
+    if (nr_threads > 1) {
+        threads = qemu_parallel_new("mig/load", nr_threads - 1);
+    }
+    qemu_parallel_run(threads, parallel_loads->len, parallel_load_func, NULL);
+    qemu_parallel_free(threads);
+
+    for (i = 0; i < parallel_loads->len; i++) {
+        ParallelLoad *job = g_ptr_array_index(parallel_loads, i);
+
+        trace_qemu_loadvm_parallel_load(job->se->idstr, job->ret);
+        if (job->ret < 0 && !ret) {
+            error_report("error while loading state for instance 0x%"PRIx32
+                         " of device '%s'", job->se->instance_id,
+                         job->se->idstr);
+            ret = job->ret;
+        }
+    }
+    g_ptr_array_set_size(parallel_loads, 0);
+    return ret;
+}
+
+static void qemu_loadvm_parallel_discard(void)
+{
+    if (parallel_loads) {
+        g_ptr_array_set_size(parallel_loads, 0);
+    }
+}
+
+/*
+ * Write the data of @se to @f with its length in front, so that the
+ * destination can hand it to a worker thread.
+ */
+static int vmstate_save_buffered(QEMUFile *f, SaveStateEntry *se,
+                                 JSONWriter *vmdesc, Error **errp)
+{
+    QIOChannelBuffer *bioc = qio_channel_buffer_new(4096);
+    QEMUFile *fb;
+    int ret;
+
+    qio_channel_set_name(QIO_CHANNEL(bioc), "migration-section-buffer");
+    fb = qemu_file_new_output(QIO_CHANNEL(bioc));
+    ret = vmstate_save_state_with_err(fb, se->vmsd, se->opaque, vmdesc,
+                                      errp);
+    qemu_fflush(fb);
+    if (!ret) {
+        qemu_put_be32(f, bioc->usage);
+        qemu_put_buffer(f, bioc->data, bioc->usage);
+    }
+    qemu_fclose(fb);
+    object_unref(OBJECT(bioc));
+    return ret;
+}
+
 static void vmstate_save_old_style(QEMUFile *f, SaveStateEntry *se,
                                    JSONWriter *vmdesc)
 {
@@ -985,6 +1147,7 @@ static void save_section_header(QEMUFile *f, SaveStateEntry *se,
     qemu_put_be32(f, se->section_id);
 
     if (section_type == QEMU_VM_SECTION_FULL ||
+        section_type == QEMU_VM_SECTION_BUFFERED ||
         section_type == QEMU_VM_SECTION_START) {
         /* ID string */
         size_t len = strlen(se->idstr);
@@ -1013,6 +1176,7 @@ static int vmstate_save(QEMUFile *f, SaveStateEntry *se, JSONWriter *vmdesc)
     int ret;
     Error *local_err = NULL;
     MigrationState *s = migrate_get_current();
+    bool buffered;
 
     if ((!se->ops || !se->ops->save_state) && !se->vmsd) {
         return 0;
@@ -1022,8 +1186,12 @@ static int vmstate_save(QEMUFile *f, SaveStateEntry *se, JSONWriter *vmdesc)
         return 0;
     }
 
+    buffered = se->vmsd && se->vmsd->load_parallel &&
+               !se->vmsd->early_setup && migrate_parallel_load();
+
     trace_savevm_section_start(se->idstr, se->section_id);
-    save_section_header(f, se, QEMU_VM_SECTION_FULL);
+    save_section_header(f, se, buffered ? QEMU_VM_SECTION_BUFFERED
+                                        : QEMU_VM_SECTION_FULL);
     if (vmdesc) {
         json_writer_start_object(vmdesc, NULL);
         json_writer_str(vmdesc, "name", se->idstr);
@@ -1034,7 +1202,12 @@ static int vmstate_save(QEMUFile *f, SaveStateEntry *se, JSONWriter *vmdesc)
     if (!se->vmsd) {
         vmstate_save_old_style(f, se, vmdesc);
     } else {
-        ret = vmstate_save_state_with_err(f, se->vmsd, se->opaque, vmdesc, &local_err);
+        if (buffered) {
+            ret = vmstate_save_buffered(f, se, vmdesc, &local_err);
+        } else {
+            ret = vmstate_save_state_with_err(f, se->vmsd, se->opaque,
+                                              vmdesc, &local_err);
+        }
         if (ret) {
             migrate_set_error(s, local_err);
             error_report_err(local_err);
@@ -1488,6 +1661,86 @@ void qemu_savevm_state_complete_postcopy(QEMUFile *f)
     qemu_fflush(f);
 }
 
+static void *savevm_complete_precopy_thread(void *opaque)
+{
+    SaveCompleteThread *t = opaque;
+    SaveStateEntry *se = t->se;
+
+    rcu_register_thread();
+    t->ret = se->ops->save_live_complete_precopy_thread(se->idstr,
+                                                        se->instance_id,
+                                                        se->opaque, &t->err);
+    rcu_unregister_thread();
+
+    return NULL;
+}
+
+/*
+ * Start the save_live_complete_precopy_thread handlers, which send device
+ * state through multifd while the migration thread goes on with RAM and
+ * the other devices.
+ */
+static void qemu_savevm_state_complete_precopy_start_threads(void)
+{
+    SaveStateEntry *se;
+
+    if (!multifd_device_state_supported()) {
+        return;
+    }
+
+    QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
+        SaveCompleteThread *t;
+
+        if (!se->ops || !se->ops->save_live_complete_precopy_thread) {
+            continue;
+        }
+        if (se->ops->is_active && !se->ops->is_active(se->opaque)) {
+            continue;
+        }
+
+        t = g_new0(SaveCompleteThread, 1);
+        t->se = se;
+        qemu_thread_create(&t->thread, "mig/src/devstate",
+                           savevm_complete_precopy_thread, t,
+                           QEMU_THREAD_JOINABLE);
+        savevm_state.complete_threads =
+            g_slist_prepend(savevm_state.complete_threads, t);
+    }
+}
+
+/*
+ * Wait for the threads started by qemu_savevm_state_complete_precopy().
+ * RAM calls this before the last multifd sync, so that the device state
+ * is flushed to the multifd channels with the RAM.  Returns the first
+ * error of the handlers, if any.
+ */
+int qemu_savevm_state_complete_precopy_join_threads(void)
+{
+    MigrationState *ms = migrate_get_current();
+    GSList *l;
+    int ret = 0;
+
+    for (l = savevm_state.complete_threads; l; l = l->next) {
+        SaveCompleteThread *t = l->data;
+
+        qemu_thread_join(&t->thread);
+        if (t->ret < 0 && !ret && t->err) {
+            migrate_set_error(ms, t->err);
+            error_report_err(t->err);
+        } else {
+            error_free(t->err);
+        }
+        if (t->ret < 0 && !ret) {
+            ret = t->ret;
+        }
+        g_free(t);
+    }
+    g_slist_free(savevm_state.complete_threads);
+    savevm_state.complete_threads = NULL;
+
+    return ret;
+}
+
 static
 int qemu_savevm_state_complete_precopy_iterable(QEMUFile *f, bool in_postcopy)
 {
@@ -1495,6 +1748,10 @@ int qemu_savevm_state_complete_precopy_iterable(QEMUFile *f, bool in_postcopy)
     SaveStateEntry *se;
     int ret;
 
+    if (!in_postcopy) {
+        qemu_savevm_state_complete_precopy_start_threads();
+    }
+
     QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
         if (!se->ops ||
             (in_postcopy && se->ops->has_postcopy &&
@@ -1519,6 +1776,7 @@ int qemu_savevm_state_complete_precopy_iterable(QEMUFile *f, bool in_postcopy)
         save_section_footer(f, se);
         if (ret < 0) {
             qemu_file_set_error(f, ret);
+            qemu_savevm_state_complete_precopy_join_threads();
             return -1;
         }
         end_ts_each = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
@@ -1526,6 +1784,13 @@ int qemu_savevm_state_complete_precopy_iterable(QEMUFile *f, bool in_postcopy)
                                     end_ts_each - start_ts_each);
     }
 
+    /* Normally already done by RAM */
+    ret = qemu_savevm_state_complete_precopy_join_threads();
+    if (ret < 0) {
+        qemu_file_set_error(f, ret);
+        return -1;
+    }
+
     trace_vmstate_downtime_checkpoint("src-iterable-saved");
 
     return 0;
@@ -1698,11 +1963,11 @@ void qemu_savevm_state_cleanup(void)
     }
 }
 
-static int qemu_savevm_state(QEMUFile *f, Error **errp)
+/* Set up the state sections; the guest may still be running */
+static int qemu_savevm_state_start(QEMUFile *f, Error **errp)
 {
     int ret;
     MigrationState *ms = migrate_get_current();
-    MigrationStatus status;
 
     if (migration_is_running(ms->state)) {
         error_setg(errp, QERR_MIGRATION_ACTIVE);
@@ -1722,6 +1987,15 @@ static int qemu_savevm_state(QEMUFile *f, Error **errp)
 
     qemu_savevm_state_header(f);
     qemu_savevm_state_setup(f);
+    return 0;
+}
+
+/* Write out everything that is left; the guest must be stopped */
+static int qemu_savevm_state_finish(QEMUFile *f, Error **errp)
+{
+    int ret;
+    MigrationState *ms = migrate_get_current();
+    MigrationStatus status;
 
     while (qemu_file_get_error(f) == 0) {
         if (qemu_savevm_state_iterate(f, false) > 0) {
@@ -1753,6 +2027,17 @@ static int qemu_savevm_state(QEMUFile *f, Error **errp)
     return ret;
 }
 
+static int qemu_savevm_state(QEMUFile *f, Error **errp)
+{
+    int ret;
+
+    ret = qemu_savevm_state_start(f, errp);
+    if (ret) {
+        return ret;
+    }
+    return qemu_savevm_state_finish(f, errp);
+}
+
 void qemu_savevm_live_state(QEMUFile *f)
 {
     /* save QEMU_VM_SECTION_END section */
@@ -2219,7 +2504,8 @@ static gboolean postcopy_sync_page_req(gpointer key, gpointer value,
         return FALSE;
     }
 
-    ret = migrate_send_rp_message_req_pages(mis, rb, rb_offset);
+    ret = migrate_send_rp_message_req_pages(mis, rb, rb_offset,
+                                            qemu_ram_pagesize(rb), true);
     if (ret) {
         /* Please refer to above comment. */
         error_report("%s: send rp message failed for addr %p",
@@ -2554,7 +2840,8 @@ static int
 qemu_loadvm_section_start_full(QEMUFile *f, MigrationIncomingState *mis,
                                uint8_t type)
 {
-    bool trace_downtime = (type == QEMU_VM_SECTION_FULL);
+    bool trace_downtime = (type == QEMU_VM_SECTION_FULL ||
+                           type == QEMU_VM_SECTION_BUFFERED);
     uint32_t instance_id, version_id, section_id;
     int64_t start_ts, end_ts;
     SaveStateEntry *se;
@@ -2609,7 +2896,11 @@ qemu_loadvm_section_start_full(QEMUFile *f, MigrationIncomingState *mis,
         start_ts = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
     }
 
-    ret = vmstate_load(f, se);
+    if (type == QEMU_VM_SECTION_BUFFERED) {
+        ret = vmstate_load_buffered(f, se);
+    } else {
+        ret = vmstate_load(f, se);
+    }
     if (ret < 0) {
         error_report("error while loading state for instance 0x%"PRIx32" of"
                      " device '%s'", instance_id, idstr);
@@ -2864,6 +3155,7 @@ retry:
         switch (section_type) {
         case QEMU_VM_SECTION_START:
         case QEMU_VM_SECTION_FULL:
+        case QEMU_VM_SECTION_BUFFERED:
             ret = qemu_loadvm_section_start_full(f, mis, section_type);
             if (ret < 0) {
                 goto out;
@@ -2877,6 +3169,11 @@ retry:
             }
             break;
         case QEMU_VM_COMMAND:
+            /* Commands may start the VM, finish loading the devices first */
+            ret = qemu_loadvm_parallel_flush();
+            if (ret < 0) {
+                goto out;
+            }
             ret = loadvm_process_command(f);
             trace_qemu_loadvm_state_section_command(ret);
             if ((ret < 0) || (ret == LOADVM_QUIT)) {
@@ -2885,6 +3182,7 @@ retry:
             break;
         case QEMU_VM_EOF:
             /* This is the end of migration */
+            ret = qemu_loadvm_parallel_flush();
             goto out;
         default:
             error_report("Unknown savevm section type %d", section_type);
@@ -2895,6 +3193,7 @@ retry:
 
 out:
     if (ret < 0) {
+        qemu_loadvm_parallel_discard();
         qemu_file_set_error(f, ret);
 
         /* Cancel bitmaps incoming regardless of recovery */
@@ -3018,6 +3317,30 @@ int qemu_load_device_state(QEMUFile *f)
     return 0;
 }
 
+/*
+ * Pass device state received through multifd to the load_state_buffer
+ * handler of its SaveStateEntry.  Called from the multifd receive threads.
+ */
+int qemu_loadvm_load_state_buffer(const char *idstr, uint32_t instance_id,
+                                  char *buf, size_t len, Error **errp)
+{
+    SaveStateEntry *se = find_se(idstr, instance_id);
+
+    if (!se) {
+        error_setg(errp, "Unknown idstr %s or instance id %u for device "
+                   "state buffer", idstr, instance_id);
+        return -EINVAL;
+    }
+
+    if (!se->ops || !se->ops->load_state_buffer) {
+        error_setg(errp, "%s instance %u cannot load device state buffers",
+                   idstr, instance_id);
+        return -EINVAL;
+    }
+
+    return se->ops->load_state_buffer(se->opaque, buf, len, errp);
+}
+
 int qemu_loadvm_approve_switchover(void)
 {
     MigrationIncomingState *mis = migration_incoming_get_current();
@@ -3036,31 +3359,30 @@ int qemu_loadvm_approve_switchover(void)
     return migrate_send_rp_switchover_ack(mis);
 }
 
-bool save_snapshot(const char *name, bool overwrite, const char *vmstate,
-                  bool has_devices, strList *devices, Error **errp)
+/* Checks done before the guest is stopped; returns the vmstate node */
+static BlockDriverState *save_snapshot_prepare(const char *name,
+                                               bool overwrite,
+                                               const char *vmstate,
+                                               bool has_devices,
+                                               strList *devices,
+                                               Error **errp)
 {
-    BlockDriverState *bs;
-    QEMUSnapshotInfo sn1, *sn = &sn1;
-    int ret = -1, ret2;
-    QEMUFile *f;
-    RunState saved_state = runstate_get();
-    uint64_t vm_state_size;
-    g_autoptr(GDateTime) now = g_date_time_new_now_local();
+    int ret2;
 
     GLOBAL_STATE_CODE();
 
     if (migration_is_blocked(errp)) {
-        return false;
+        return NULL;
     }
 
     if (!replay_can_snapshot()) {
         error_setg(errp, "Record/replay does not allow making snapshot "
                    "right now. Try once more later.");
-        return false;
+        return NULL;
     }
 
     if (!bdrv_all_can_snapshot(has_devices, devices, errp)) {
-        return false;
+        return NULL;
     }
 
     /* Delete old snapshots of the same name */
@@ -3068,26 +3390,39 @@ bool save_snapshot(const char *name, bool overwrite, const char *vmstate,
         if (overwrite) {
             if (bdrv_all_delete_snapshot(name, has_devices,
                                          devices, errp) < 0) {
-                return false;
+                return NULL;
             }
         } else {
             ret2 = bdrv_all_has_snapshot(name, has_devices, devices, errp);
             if (ret2 < 0) {
-                return false;
+                return NULL;
             }
             if (ret2 == 1) {
                 error_setg(errp,
                            "Snapshot '%s' already exists in one or more devices",
                            name);
-                return false;
+                return NULL;
             }
         }
     }
 
-    bs = bdrv_all_find_vmstate_bs(vmstate, has_devices, devices, errp);
-    if (bs == NULL) {
-        return false;
-    }
+    return bdrv_all_find_vmstate_bs(vmstate, has_devices, devices, errp);
+}
+
+/*
+ * Stop the guest, write the VM state to @bs and snapshot the disks.  If
+ * @f is not NULL, it already holds the part of the VM state that was
+ * saved while the guest was running.
+ */
+static bool save_snapshot_finish(BlockDriverState *bs, const char *name,
+                                 QEMUFile *f, bool has_devices,
+                                 strList *devices, Error **errp)
+{
+    QEMUSnapshotInfo sn1, *sn = &sn1;
+    int ret = -1, ret2;
+    RunState saved_state = runstate_get();
+    uint64_t vm_state_size;
+    g_autoptr(GDateTime) now = g_date_time_new_now_local();
 
     global_state_store();
     vm_stop(RUN_STATE_SAVE_VM);
@@ -3114,12 +3449,16 @@ bool save_snapshot(const char *name, bool overwrite, const char *vmstate,
     }
 
     /* save the VM state */
-    f = qemu_fopen_bdrv(bs, 1);
-    if (!f) {
-        error_setg(errp, "Could not open VM state file");
-        goto the_end;
+    if (f) {
+        ret = qemu_savevm_state_finish(f, errp);
+    } else {
+        f = qemu_fopen_bdrv(bs, 1);
+        if (!f) {
+            error_setg(errp, "Could not open VM state file");
+            goto the_end;
+        }
+        ret = qemu_savevm_state(f, errp);
     }
-    ret = qemu_savevm_state(f, errp);
     vm_state_size = qemu_file_transferred(f);
     ret2 = qemu_fclose(f);
     if (ret < 0) {
@@ -3146,6 +3485,19 @@ bool save_snapshot(const char *name, bool overwrite, const char *vmstate,
     return ret == 0;
 }
 
+bool save_snapshot(const char *name, bool overwrite, const char *vmstate,
+                  bool has_devices, strList *devices, Error **errp)
+{
+    BlockDriverState *bs;
+
+    bs = save_snapshot_prepare(name, overwrite, vmstate, has_devices,
+                               devices, errp);
+    if (!bs) {
+        return false;
+    }
+    return save_snapshot_finish(bs, name, NULL, has_devices, devices, errp);
+}
+
 void qmp_xen_save_devices_state(const char *filename, bool has_live, bool live,
                                 Error **errp)
 {
@@ -3318,6 +3670,64 @@ void load_snapshot_resume(RunState state)
     }
 }
 
+bool save_device_state_buffer(GByteArray *state, Error **errp)
+{
+    QIOChannelBuffer *bioc = qio_channel_buffer_new(4096);
+    QEMUFile *f;
+    int ret;
+
+    qio_channel_set_name(QIO_CHANNEL(bioc), "device-state-buffer");
+    f = qemu_file_new_output(QIO_CHANNEL(bioc));
+    ret = qemu_save_device_state(f);
+    qemu_fflush(f);
+    if (ret == 0) {
+        g_byte_array_set_size(state, 0);
+        g_byte_array_append(state, bioc->data, bioc->usage);
+    } else {
+        error_setg_errno(errp, -ret, "Error while saving device state");
+    }
+    qemu_fclose(f);
+    object_unref(OBJECT(bioc));
+    return ret == 0;
+}
+
+bool load_device_state_buffer(GByteArray *state, Error **errp)
+{
+    MigrationIncomingState *mis = migration_incoming_get_current();
+    QIOChannelBuffer *bioc = qio_channel_buffer_new(state->len);
+    QEMUFile *f;
+    int ret;
+
+    qio_channel_set_name(QIO_CHANNEL(bioc), "device-state-buffer");
+    memcpy(bioc->data, state->data, state->len);
+    bioc->usage = state->len;
+    f = qemu_file_new_input(QIO_CHANNEL(bioc));
+    object_unref(OBJECT(bioc));
+
+    /* qemu_save_device_state() writes the header outside of COLO */
+    if (qemu_get_be32(f) != QEMU_VM_FILE_MAGIC ||
+        qemu_get_be32(f) != QEMU_VM_FILE_VERSION) {
+        error_setg(errp, "Invalid device state buffer");
+        qemu_fclose(f);
+        return false;
+    }
+
+    mis->from_src_file = f;
+    if (!yank_register_instance(MIGRATION_YANK_INSTANCE, errp)) {
+        mis->from_src_file = NULL;
+        qemu_fclose(f);
+        return false;
+    }
+    ret = qemu_load_device_state(f);
+    migration_incoming_state_destroy();
+
+    if (ret < 0) {
+        error_setg(errp, "Error %d while loading device state", ret);
+        return false;
+    }
+    return true;
+}
+
 bool delete_snapshot(const char *name, bool has_devices,
                      strList *devices, Error **errp)
 {
@@ -3368,8 +3778,23 @@ typedef struct SnapshotJob {
     Coroutine *co;
     Error **errp;
     bool ret;
+
+    /* live snapshot-save */
+    bool live;
+    BlockDriverState *bs;
+    QEMUFile *f;
+    QemuThread thread;
 } SnapshotJob;
 
+/*
+ * A live snapshot-save copies RAM like a precopy migration does, while the
+ * guest keeps running, until what is left is below this or it took as many
+ * passes.  The guest is then stopped for the remaining dirty pages, the
+ * device state and the disk snapshots.
+ */
+#define SNAPSHOT_LIVE_THRESHOLD (64 * MiB)
+#define SNAPSHOT_LIVE_MAX_PASSES 8
+
 static void qmp_snapshot_job_free(SnapshotJob *s)
 {
     g_free(s->tag);
@@ -3426,13 +3851,87 @@ static void snapshot_delete_job_bh(void *opaque)
     aio_co_wake(s->co);
 }
 
+static void snapshot_save_live_end_bh(void *opaque)
+{
+    SnapshotJob *s = opaque;
+
+    qemu_thread_join(&s->thread);
+    s->ret = save_snapshot_finish(s->bs, s->tag, s->f, true, s->devices,
+                                  s->errp);
+    job_progress_update(&s->common, 1);
+
+    qmp_snapshot_job_free(s);
+    aio_co_wake(s->co);
+}
+
+/* Runs without the BQL, like the migration thread */
+static void *snapshot_save_live_thread(void *opaque)
+{
+    SnapshotJob *s = opaque;
+    int passes = 0;
+
+    rcu_register_thread();
+    while (qemu_file_get_error(s->f) == 0) {
+        uint64_t must_precopy = 0, can_postcopy = 0;
+
+        if (qemu_savevm_state_iterate(s->f, false) <= 0) {
+            continue;
+        }
+
+        /* End of a pass: pick up what the guest dirtied meanwhile */
+        qemu_savevm_state_pending_exact(&must_precopy, &can_postcopy);
+        if (must_precopy + can_postcopy <= SNAPSHOT_LIVE_THRESHOLD ||
+            ++passes == SNAPSHOT_LIVE_MAX_PASSES) {
+            break;
+        }
+    }
+    rcu_unregister_thread();
+
+    aio_bh_schedule_oneshot(qemu_get_aio_context(),
+                            snapshot_save_live_end_bh, s);
+    return NULL;
+}
+
+static void snapshot_save_live_start_bh(void *opaque)
+{
+    Job *job = opaque;
+    SnapshotJob *s = container_of(job, SnapshotJob, common);
+
+    job_progress_set_remaining(&s->common, 1);
+    s->bs = save_snapshot_prepare(s->tag, false, s->vmstate, true,
+                                  s->devices, s->errp);
+    if (!s->bs) {
+        goto fail;
+    }
+
+    s->f = qemu_fopen_bdrv(s->bs, 1);
+    if (!s->f) {
+        error_setg(s->errp, "Could not open VM state file");
+        goto fail;
+    }
+    if (qemu_savevm_state_start(s->f, s->errp) < 0) {
+        qemu_fclose(s->f);
+        goto fail;
+    }
+
+    qemu_thread_create(&s->thread, "snapshot_save", snapshot_save_live_thread,
+                       s, QEMU_THREAD_JOINABLE);
+    return;
+
+fail:
+    s->ret = false;
+    qmp_snapshot_job_free(s);
+    aio_co_wake(s->co);
+}
+
 static int coroutine_fn snapshot_save_job_run(Job *job, Error **errp)
 {
     SnapshotJob *s = container_of(job, SnapshotJob, common);
     s->errp = errp;
     s->co = qemu_coroutine_self();
     aio_bh_schedule_oneshot(qemu_get_aio_context(),
-                            snapshot_save_job_bh, job);
+                            s->live ? snapshot_save_live_start_bh
+                                    : snapshot_save_job_bh, job);
     qemu_coroutine_yield();
     return s->ret ? 0 : -1;
 }
@@ -3483,6 +3982,7 @@ void qmp_snapshot_save(const char *job_id,
                        const char *tag,
                        const char *vmstate,
                        strList *devices,
+                       bool has_live, bool live,
                        Error **errp)
 {
     SnapshotJob *s;
@@ -3497,6 +3997,7 @@ void qmp_snapshot_save(const char *job_id,
     s->tag = g_strdup(tag);
     s->vmstate = g_strdup(vmstate);
     s->devices = QAPI_CLONE(strList, devices);
+    s->live = has_live && live;
 
     job_start(&s->common);
 }
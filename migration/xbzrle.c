@@ -15,13 +15,20 @@
 #include "qemu/host-utils.h"
 #include "xbzrle.h"
 
-#if defined(CONFIG_AVX512BW_OPT)
-#include <immintrin.h>
+#if defined(CONFIG_AVX512BW_OPT) || \
+    (defined(__aarch64__) && defined(__ARM_NEON))
 #include "host/cpuinfo.h"
 
-static int __attribute__((target("avx512bw")))
-xbzrle_encode_buffer_avx512(uint8_t *old_buf, uint8_t *new_buf, int slen,
-                            uint8_t *dst, int dlen)
+/*
+ * Encode 64 bytes at a time.  @cmpeq returns a mask with bit N set if
+ * byte N is the same in the two buffers, for the first @len <= 64
+ * bytes; the other bits are ignored.
+ */
+static inline __attribute__((always_inline)) int
+xbzrle_encode_buffer_64(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                        uint8_t *dst, int dlen,
+                        uint64_t (*cmpeq)(const uint8_t *, const uint8_t *,
+                                          int))
 {
     uint32_t zrun_len = 0, nzrun_len = 0;
     int d = 0, i = 0, num = 0;
@@ -31,23 +38,13 @@ xbzrle_encode_buffer_avx512(uint8_t *old_buf, uint8_t *new_buf, int slen,
     /* countResidual is tail of data, i.e., countResidual = slen % 64 */
     uint32_t count_residual = slen & 0b111111;
     bool never_same = true;
-    uint64_t mask_residual = 1;
-    mask_residual <<= count_residual;
-    mask_residual -= 1;
-    __m512i r = _mm512_set1_epi32(0);
 
     while (count512s) {
         int bytes_to_check = 64;
-        uint64_t mask = 0xffffffffffffffff;
         if (count512s == 1) {
             bytes_to_check = count_residual;
-            mask = mask_residual;
         }
-        __m512i old_data = _mm512_mask_loadu_epi8(r,
-                                                  mask, old_buf + i);
-        __m512i new_data = _mm512_mask_loadu_epi8(r,
-                                                  mask, new_buf + i);
-        uint64_t comp = _mm512_cmpeq_epi8_mask(old_data, new_data);
+        uint64_t comp = cmpeq(old_buf + i, new_buf + i, bytes_to_check);
         count512s--;
 
         bool is_same = (comp & 0x1);
@@ -137,6 +134,71 @@ xbzrle_encode_buffer_avx512(uint8_t *old_buf, uint8_t *new_buf, int slen,
     return d;
 }
 
+#ifdef CONFIG_AVX512BW_OPT
+#include <immintrin.h>
+
+#define XBZRLE_ACCEL_BIT CPUINFO_AVX512BW
+
+static inline uint64_t __attribute__((target("avx512bw"), always_inline))
+xbzrle_cmpeq_avx512(const uint8_t *old_buf, const uint8_t *new_buf, int len)
+{
+    uint64_t mask = len < 64 ? (1ull << len) - 1 : -1ull;
+    __m512i r = _mm512_set1_epi32(0);
+    __m512i old_data = _mm512_mask_loadu_epi8(r, mask, old_buf);
+    __m512i new_data = _mm512_mask_loadu_epi8(r, mask, new_buf);
+
+    return _mm512_cmpeq_epi8_mask(old_data, new_data);
+}
+
+static int __attribute__((target("avx512bw")))
+xbzrle_encode_buffer_accel(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                           uint8_t *dst, int dlen)
+{
+    return xbzrle_encode_buffer_64(old_buf, new_buf, slen, dst, dlen,
+                                   xbzrle_cmpeq_avx512);
+}
+#else
+#include <arm_neon.h>
+
+#define XBZRLE_ACCEL_BIT CPUINFO_ASIMD
+
+static inline __attribute__((always_inline)) uint64_t
+xbzrle_cmpeq_neon(const uint8_t *old_buf, const uint8_t *new_buf, int len)
+{
+    static const uint8_t weight[16] = {
+        1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128
+    };
+    uint8x16_t w = vld1q_u8(weight);
+    uint8x16_t m[4];
+
+    if (unlikely(len < 64)) {
+        uint64_t comp = 0;
+
+        for (int i = 0; i < len; i++) {
+            comp |= (uint64_t)(old_buf[i] == new_buf[i]) << i;
+        }
+        return comp;
+    }
+
+    for (int i = 0; i < 4; i++) {
+        m[i] = vceqq_u8(vld1q_u8(old_buf + i * 16),
+                        vld1q_u8(new_buf + i * 16)) & w;
+    }
+    /* Three rounds of pairwise adds gather one bit per byte.  */
+    m[0] = vpaddq_u8(vpaddq_u8(m[0], m[1]), vpaddq_u8(m[2], m[3]));
+    m[0] = vpaddq_u8(m[0], m[0]);
+    return vgetq_lane_u64(vreinterpretq_u64_u8(m[0]), 0);
+}
+
+static int
+xbzrle_encode_buffer_accel(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                           uint8_t *dst, int dlen)
+{
+    return xbzrle_encode_buffer_64(old_buf, new_buf, slen, dst, dlen,
+                                   xbzrle_cmpeq_neon);
+}
+#endif
+
 static int xbzrle_encode_buffer_int(uint8_t *old_buf, uint8_t *new_buf,
                                     int slen, uint8_t *dst, int dlen);
 
@@ -145,8 +207,8 @@ static int (*accel_func)(uint8_t *, uint8_t *, int, uint8_t *, int);
 static void __attribute__((constructor)) init_accel(void)
 {
     unsigned info = cpuinfo_init();
-    if (info & CPUINFO_AVX512BW) {
-        accel_func = xbzrle_encode_buffer_avx512;
+    if (info & XBZRLE_ACCEL_BIT) {
+        accel_func = xbzrle_encode_buffer_accel;
     } else {
         accel_func = xbzrle_encode_buffer_int;
     }
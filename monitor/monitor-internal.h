@@ -151,6 +151,8 @@ typedef struct {
     QemuMutex qmp_queue_lock;
     /* Input queue that holds all the parsed QMP requests */
     GQueue *qmp_requests;
+    /* An in-band request has been dequeued and is not finished yet */
+    bool qmp_dispatching;
 } MonitorQMP;
 
 /**
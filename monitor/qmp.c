@@ -129,19 +129,30 @@ static void monitor_qmp_cleanup_queue_and_resume(MonitorQMP *mon)
 
 }
 
+static void qmp_send_json(void *opaque, const char *buf, size_t len)
+{
+    MonitorQMP *mon = opaque;
+
+    monitor_puts_locked(&mon->common, buf);
+}
+
 void qmp_send_response(MonitorQMP *mon, const QDict *rsp)
 {
     const QObject *data = QOBJECT(rsp);
-    GString *json;
 
-    json = qobject_to_json_pretty(data, mon->pretty);
-    assert(json != NULL);
-    trace_monitor_qmp_respond(mon, json->str);
+    if (trace_event_get_state_backends(TRACE_MONITOR_QMP_RESPOND)) {
+        g_autoptr(GString) json = qobject_to_json_pretty(data, mon->pretty);
 
-    g_string_append_c(json, '\n');
-    monitor_puts(&mon->common, json->str);
+        trace_monitor_qmp_respond(mon, json->str);
+    }
 
-    g_string_free(json, true);
+    /*
+     * Write the response to the output buffer as it is generated, rather
+     * than building all of it first.  The lock keeps it in one piece.
+     */
+    QEMU_LOCK_GUARD(&mon->common.mon_lock);
+    qobject_to_json_stream(data, mon->pretty, qmp_send_json, mon);
+    monitor_puts_locked(&mon->common, "\n");
 }
 
 /*
@@ -157,8 +168,8 @@ static void monitor_qmp_respond(MonitorQMP *mon, QDict *rsp)
 }
 
 /*
- * Runs outside of coroutine context for OOB commands, but in
- * coroutine context for everything else.
+ * Runs outside of coroutine context for OOB and BQL-free commands, but
+ * in coroutine context for everything else.
  */
 static void monitor_qmp_dispatch(MonitorQMP *mon, QObject *req)
 {
@@ -212,6 +223,7 @@ static QMPRequest *monitor_qmp_requests_pop_any_with_lock(void)
         req_obj = g_queue_pop_head(qmp_mon->qmp_requests);
         if (req_obj) {
             /* With the lock of corresponding queue held */
+            qmp_mon->qmp_dispatching = true;
             break;
         }
         qemu_mutex_unlock(&qmp_mon->qmp_queue_lock);
@@ -342,6 +354,15 @@ void coroutine_fn monitor_qmp_dispatcher_co(void *data)
             qobject_unref(rsp);
         }
 
+        /*
+         * Let BQL-free queries see what this command did; they can run
+         * again once qmp_dispatching is clear.
+         */
+        qmp_sync_snapshots();
+        WITH_QEMU_LOCK_GUARD(&mon->qmp_queue_lock) {
+            mon->qmp_dispatching = false;
+        }
+
         if (!oob_enabled) {
             monitor_resume(&mon->common);
         }
@@ -361,6 +382,28 @@ void qmp_dispatcher_co_wake(void)
     }
 }
 
+/*
+ * Can @qdict run right away in the monitor I/O thread?  Only commands
+ * marked 'no-bql' can, and only while no in-band command of this
+ * monitor is queued or running, so that replies stay in order.
+ */
+static bool monitor_qmp_can_run_without_bql(MonitorQMP *mon, QDict *qdict)
+{
+    const char *name = qdict_get_try_str(qdict, "execute");
+    const QmpCommand *cmd;
+
+    if (!mon->common.use_io_thread || !name) {
+        return false;
+    }
+    cmd = qmp_find_command(mon->commands, name);
+    if (!cmd || !(cmd->options & QCO_NO_BQL)) {
+        return false;
+    }
+
+    QEMU_LOCK_GUARD(&mon->qmp_queue_lock);
+    return g_queue_is_empty(mon->qmp_requests) && !mon->qmp_dispatching;
+}
+
 static void handle_qmp_command(void *opaque, QObject *req, Error *err)
 {
     MonitorQMP *mon = opaque;
@@ -390,6 +433,13 @@ static void handle_qmp_command(void *opaque, QObject *req, Error *err)
         return;
     }
 
+    if (qdict && monitor_qmp_can_run_without_bql(mon, qdict)) {
+        trace_monitor_qmp_cmd_no_bql(qdict_get_try_str(qdict, "execute"));
+        monitor_qmp_dispatch(mon, req);
+        qobject_unref(req);
+        return;
+    }
+
     req_obj = g_new0(QMPRequest, 1);
     req_obj->mon = mon;
     req_obj->req = req;
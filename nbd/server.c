@@ -23,6 +23,7 @@
 #include "block/export.h"
 #include "block/dirty-bitmap.h"
 #include "qapi/error.h"
+#include "sysemu/iothread.h"
 #include "qemu/queue.h"
 #include "trace.h"
 #include "nbd-internal.h"
@@ -85,6 +86,13 @@ struct NBDRequestData {
     bool complete;
 };
 
+/* A read buffer that was sent with zero copy and may still be in use */
+typedef struct NBDZeroCopyBuf {
+    void *data;
+    ssize_t seq; /* free once this many zero copy writes have completed */
+    QSIMPLEQ_ENTRY(NBDZeroCopyBuf) next;
+} NBDZeroCopyBuf;
+
 struct NBDExport {
     BlockExport common;
 
@@ -101,6 +109,13 @@ struct NBDExport {
     bool allocation_depth;
     BdrvDirtyBitmap **export_bitmaps;
     size_t nr_export_bitmaps;
+
+    /* Contexts that new clients are distributed over, round-robin */
+    AioContext **client_ctxs;
+    size_t nr_client_ctxs;
+    size_t next_client_ctx;
+
+    bool zero_copy;
 };
 
 static QTAILQ_HEAD(, NBDExport) exports = QTAILQ_HEAD_INITIALIZER(exports);
@@ -128,6 +143,7 @@ struct NBDClient {
     QemuMutex lock;
 
     NBDExport *exp;
+    AioContext *ctx; /* where requests run; NULL to follow the export */
     QCryptoTLSCreds *tlscreds;
     char *tlsauthz;
     QIOChannelSocket *sioc; /* The underlying data channel */
@@ -138,6 +154,10 @@ struct NBDClient {
     CoMutex send_lock;
     Coroutine *send_coroutine;
 
+    bool zero_copy; /* send large reads with MSG_ZEROCOPY */
+    QSIMPLEQ_HEAD(, NBDZeroCopyBuf) zero_copy_bufs; /* protected by lock */
+    unsigned nr_zero_copy_bufs; /* protected by lock */
+
     bool read_yielding; /* protected by lock */
     bool quiescing; /* protected by lock */
 
@@ -157,6 +177,11 @@ struct NBDClient {
 
 static void nbd_client_receive_next_request(NBDClient *client);
 
+static AioContext *nbd_client_aio_context(NBDClient *client)
+{
+    return client->ctx ?: client->exp->common.ctx;
+}
+
 /* Basic flow for negotiation
 
    Server         Client
@@ -1510,12 +1535,48 @@ static int coroutine_fn nbd_receive_request(NBDClient *client, NBDRequest *reque
 
 #define MAX_NBD_REQUESTS 16
 
+/* Reads smaller than this are cheaper to copy than to pin for zero copy */
+#define NBD_ZERO_COPY_MIN_SIZE (64 * KiB)
+/* Buffers kept waiting for zero copy completion, before we stop using it */
+#define NBD_MAX_ZERO_COPY_BUFS (4 * MAX_NBD_REQUESTS)
+
 /* Runs in export AioContext and main loop thread */
 void nbd_client_get(NBDClient *client)
 {
     qatomic_inc(&client->refcount);
 }
 
+/*
+ * Free the zero copy buffers whose writes are among the first @done
+ * completed ones.  Called with client->lock held, or on the last reference.
+ */
+static void nbd_client_free_zero_copy_bufs(NBDClient *client, ssize_t done)
+{
+    NBDZeroCopyBuf *buf;
+
+    while ((buf = QSIMPLEQ_FIRST(&client->zero_copy_bufs)) &&
+           buf->seq <= done) {
+        QSIMPLEQ_REMOVE_HEAD(&client->zero_copy_bufs, next);
+        client->nr_zero_copy_bufs--;
+        qemu_vfree(buf->data);
+        g_free(buf);
+    }
+}
+
+/* Called with client->lock held */
+static void nbd_client_reap_zero_copy(NBDClient *client)
+{
+    ssize_t done;
+
+    if (QSIMPLEQ_EMPTY(&client->zero_copy_bufs)) {
+        return;
+    }
+    done = qio_channel_socket_zero_copy_done(client->sioc, NULL);
+    if (done >= 0) {
+        nbd_client_free_zero_copy_bufs(client, done);
+    }
+}
+
 void nbd_client_put(NBDClient *client)
 {
     assert(qemu_in_main_thread());
@@ -1537,6 +1598,8 @@ void nbd_client_put(NBDClient *client)
             blk_exp_unref(&client->exp->common);
         }
         g_free(client->contexts.bitmaps);
+        /* The socket is closed, so nothing will be sent from these */
+        nbd_client_free_zero_copy_bufs(client, SSIZE_MAX);
         qemu_mutex_destroy(&client->lock);
         g_free(client);
     }
@@ -1609,7 +1672,21 @@ static void nbd_request_put(NBDRequestData *req)
 {
     NBDClient *client = req->client;
 
-    if (req->data) {
+    if (req->data && client->zero_copy &&
+        client->sioc->zero_copy_queued > client->sioc->zero_copy_sent) {
+        /*
+         * The buffer may have gone out with zero copy, and the kernel
+         * may still be reading it.  We do not track which request sent
+         * what, so keep it until every zero copy write so far is done.
+         */
+        NBDZeroCopyBuf *buf = g_new(NBDZeroCopyBuf, 1);
+
+        buf->data = req->data;
+        buf->seq = client->sioc->zero_copy_queued;
+        QSIMPLEQ_INSERT_TAIL(&client->zero_copy_bufs, buf, next);
+        client->nr_zero_copy_bufs++;
+        nbd_client_reap_zero_copy(client);
+    } else if (req->data) {
         qemu_vfree(req->data);
     }
     g_free(req);
@@ -1709,7 +1786,7 @@ static bool nbd_drained_poll(void *opaque)
                  * qio_channel_yield().
                  */
                 if (client->recv_coroutine != NULL && client->read_yielding) {
-                    aio_bh_schedule_oneshot(nbd_export_aio_context(client->exp),
+                    aio_bh_schedule_oneshot(nbd_client_aio_context(client),
                                             nbd_wake_read_bh, client);
                 }
 
@@ -1759,6 +1836,7 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
     uint64_t perm, shared_perm;
     bool readonly = !exp_args->writable;
     BlockDirtyBitmapOrStrList *bitmaps;
+    strList *iothreads;
     size_t i;
     int ret;
 
@@ -1819,6 +1897,23 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
 
     bdrv_graph_rdlock_main_loop();
 
+    for (iothreads = arg->iothreads; iothreads; iothreads = iothreads->next) {
+        exp->nr_client_ctxs++;
+    }
+    exp->client_ctxs = g_new(AioContext *, exp->nr_client_ctxs);
+    for (i = 0, iothreads = arg->iothreads; iothreads;
+         i++, iothreads = iothreads->next)
+    {
+        IOThread *iothread = iothread_by_id(iothreads->value);
+
+        if (!iothread) {
+            ret = -EINVAL;
+            error_setg(errp, "iothread \"%s\" not found", iothreads->value);
+            goto fail;
+        }
+        exp->client_ctxs[i] = iothread_get_aio_context(iothread);
+    }
+
     for (bitmaps = arg->bitmaps; bitmaps; bitmaps = bitmaps->next) {
         exp->nr_export_bitmaps++;
     }
@@ -1887,6 +1982,7 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
     }
 
     exp->allocation_depth = arg->allocation_depth;
+    exp->zero_copy = arg->zero_copy;
 
     /*
      * We need to inhibit request queuing in the block layer to ensure we can
@@ -1907,6 +2003,7 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
 
 fail:
     bdrv_graph_rdunlock_main_loop();
+    g_free(exp->client_ctxs);
     g_free(exp->export_bitmaps);
     g_free(exp->name);
     g_free(exp->description);
@@ -1977,6 +2074,7 @@ static void nbd_export_delete(BlockExport *blk_exp)
     for (i = 0; i < exp->nr_export_bitmaps; i++) {
         bdrv_dirty_bitmap_set_busy(exp->export_bitmaps[i], false);
     }
+    g_free(exp->client_ctxs);
 }
 
 const BlockExportDriver blk_exp_nbd = {
@@ -2004,6 +2102,47 @@ static int coroutine_fn nbd_co_send_iov(NBDClient *client, struct iovec *iov,
     return ret;
 }
 
+/*
+ * Like nbd_co_send_iov(), but the last element of @iov is data read from
+ * the export, which is sent with zero copy if the client uses it.
+ */
+static int coroutine_fn nbd_co_send_read_iov(NBDClient *client,
+                                             struct iovec *iov,
+                                             unsigned niov, Error **errp)
+{
+    bool zero_copy = false;
+    int ret;
+
+    if (client->zero_copy && iov[niov - 1].iov_len >= NBD_ZERO_COPY_MIN_SIZE) {
+        WITH_QEMU_LOCK_GUARD(&client->lock) {
+            nbd_client_reap_zero_copy(client);
+            zero_copy = client->nr_zero_copy_bufs < NBD_MAX_ZERO_COPY_BUFS;
+        }
+    }
+    if (!zero_copy) {
+        return nbd_co_send_iov(client, iov, niov, errp);
+    }
+
+    qemu_co_mutex_lock(&client->send_lock);
+    client->send_coroutine = qemu_coroutine_self();
+
+    /* The headers are on the stack, so only the data can skip the copy */
+    qio_channel_set_cork(client->ioc, true);
+    ret = qio_channel_writev_all(client->ioc, iov, niov - 1, errp);
+    if (ret == 0) {
+        ret = qio_channel_writev_full_all(client->ioc, &iov[niov - 1], 1,
+                                          NULL, 0,
+                                          QIO_CHANNEL_WRITE_FLAG_ZERO_COPY,
+                                          errp);
+    }
+    qio_channel_set_cork(client->ioc, false);
+
+    client->send_coroutine = NULL;
+    qemu_co_mutex_unlock(&client->send_lock);
+
+    return ret < 0 ? -EIO : 0;
+}
+
 static inline void set_be_simple_reply(NBDSimpleReply *reply, uint64_t error,
                                        uint64_t cookie)
 {
@@ -2035,6 +2174,9 @@ static int coroutine_fn nbd_co_send_simple_reply(NBDClient *client,
                                    nbd_err_lookup(nbd_err), len);
     set_be_simple_reply(&reply, nbd_err, request->cookie);
 
+    if (len) {
+        return nbd_co_send_read_iov(client, iov, 2, errp);
+    }
     return nbd_co_send_iov(client, iov, 2, errp);
 }
 
@@ -2116,7 +2258,7 @@ static int coroutine_fn nbd_co_send_chunk_read(NBDClient *client,
                  NBD_REPLY_TYPE_OFFSET_DATA, request);
     stq_be_p(&chunk.offset, offset);
 
-    return nbd_co_send_iov(client, iov, 3, errp);
+    return nbd_co_send_read_iov(client, iov, 3, errp);
 }
 
 static int coroutine_fn nbd_co_send_chunk_error(NBDClient *client,
@@ -3147,7 +3289,8 @@ static void nbd_client_receive_next_request(NBDClient *client)
         !client->quiescing) {
         nbd_client_get(client);
         client->recv_coroutine = qemu_coroutine_create(nbd_trip, client);
-        aio_co_schedule(client->exp->common.ctx, client->recv_coroutine);
+        aio_co_schedule(nbd_client_aio_context(client),
+                        client->recv_coroutine);
     }
 }
 
@@ -3166,6 +3309,23 @@ static coroutine_fn void nbd_co_client_start(void *opaque)
         return;
     }
 
+    /*
+     * The block layer accepts requests from any thread, so the requests of
+     * a client can be handled in an iothread other than the export's.
+     */
+    if (client->exp->nr_client_ctxs) {
+        NBDExport *exp = client->exp;
+
+        client->ctx = exp->client_ctxs[exp->next_client_ctx];
+        exp->next_client_ctx = (exp->next_client_ctx + 1) % exp->nr_client_ctxs;
+    }
+
+    /* TLS has to encrypt into a buffer of its own anyway */
+    if (client->exp->zero_copy && client->ioc == QIO_CHANNEL(client->sioc)) {
+        client->zero_copy =
+            qio_channel_socket_set_zero_copy(client->sioc, NULL) == 0;
+    }
+
     WITH_QEMU_LOCK_GUARD(&client->lock) {
         nbd_client_receive_next_request(client);
     }
@@ -3198,6 +3358,7 @@ void nbd_client_new(QIOChannelSocket *sioc,
     client->ioc = QIO_CHANNEL(sioc);
     object_ref(OBJECT(client->ioc));
     client->close_fn = close_fn;
+    QSIMPLEQ_INIT(&client->zero_copy_bufs);
 
     co = qemu_coroutine_create(nbd_co_client_start, client);
     qemu_coroutine_enter(co);
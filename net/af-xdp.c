@@ -52,10 +52,18 @@ typedef struct AFXDPState {
     uint32_t             n_queues;
     uint32_t             xdp_flags;
     bool                 inhibit;
+    bool                 busy_poll;
 } AFXDPState;
 
 #define AF_XDP_BATCH_SIZE 64
 
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+#ifndef SO_BUSY_POLL_BUDGET
+#define SO_BUSY_POLL_BUDGET 70
+#endif
+
 static void af_xdp_send(void *opaque);
 static void af_xdp_writable(void *opaque);
 
@@ -124,14 +132,21 @@ static void af_xdp_writable(void *opaque)
 {
     AFXDPState *s = opaque;
 
+    if (s->busy_poll) {
+        /* Run the device Tx queue, once for all packets queued so far. */
+        sendto(xsk_socket__fd(s->xsk), NULL, 0, MSG_DONTWAIT, NULL, 0);
+    }
+
     /* Try to recover buffers that are already sent. */
     af_xdp_complete_tx(s);
 
     /*
      * Unregister the handler, unless we still have packets to transmit
-     * and kernel needs a wake up.
+     * and kernel needs a wake up.  With busy polling, keep going until
+     * all of them are done.
      */
-    if (!s->outstanding_tx || !xsk_ring_prod__needs_wakeup(&s->tx)) {
+    if (!s->outstanding_tx ||
+        (!s->busy_poll && !xsk_ring_prod__needs_wakeup(&s->tx))) {
         af_xdp_write_poll(s, false);
     }
 
@@ -139,10 +154,15 @@ static void af_xdp_writable(void *opaque)
     qemu_flush_queued_packets(&s->nc);
 }
 
-static ssize_t af_xdp_receive(NetClientState *nc,
-                              const uint8_t *buf, size_t size)
+/*
+ * Packets are copied straight from the guest buffers to the umem frame,
+ * instead of being linearized into a temporary buffer first.
+ */
+static ssize_t af_xdp_receive_iov(NetClientState *nc,
+                                  const struct iovec *iov, int iovcnt)
 {
     AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+    size_t size = iov_size(iov, iovcnt);
     struct xdp_desc *desc;
     uint32_t idx;
     void *data;
@@ -169,18 +189,30 @@ static ssize_t af_xdp_receive(NetClientState *nc,
     desc->len = size;
 
     data = xsk_umem__get_data(s->buffer, desc->addr);
-    memcpy(data, buf, size);
+    iov_to_buf(iov, iovcnt, 0, data, size);
 
     xsk_ring_prod__submit(&s->tx, 1);
     s->outstanding_tx++;
 
-    if (xsk_ring_prod__needs_wakeup(&s->tx)) {
+    /* With busy polling the kernel only transmits when kicked. */
+    if (s->busy_poll || xsk_ring_prod__needs_wakeup(&s->tx)) {
         af_xdp_write_poll(s, true);
     }
 
     return size;
 }
 
+static ssize_t af_xdp_receive(NetClientState *nc,
+                              const uint8_t *buf, size_t size)
+{
+    struct iovec iov = {
+        .iov_base = (void *)buf,
+        .iov_len = size,
+    };
+
+    return af_xdp_receive_iov(nc, &iov, 1);
+}
+
 /*
  * Complete a previous send (backend --> guest) and enable the
  * fd_read callback.
@@ -221,6 +253,11 @@ static void af_xdp_send(void *opaque)
     uint32_t i, n_rx, idx = 0;
     AFXDPState *s = opaque;
 
+    if (s->busy_poll) {
+        /* Run the device Rx queue, interrupts are deferred meanwhile. */
+        recvfrom(xsk_socket__fd(s->xsk), NULL, 0, MSG_DONTWAIT, NULL, NULL);
+    }
+
     n_rx = xsk_ring_cons__peek(&s->rx, AF_XDP_BATCH_SIZE, &idx);
     if (!n_rx) {
         return;
@@ -323,7 +360,7 @@ static int af_xdp_umem_create(AFXDPState *s, int sock_fd, Error **errp)
 
     s->pool = g_new(uint64_t, n_descs);
     /* Fill the pool in the opposite order, because it's a LIFO queue. */
-    for (i = n_descs; i >= 0; i--) {
+    for (i = n_descs - 1; i >= 0; i--) {
         s->pool[i] = i * XSK_UMEM__DEFAULT_FRAME_SIZE;
     }
     s->n_pool = n_descs;
@@ -333,6 +370,35 @@ static int af_xdp_umem_create(AFXDPState *s, int sock_fd, Error **errp)
     return 0;
 }
 
+static int af_xdp_busy_poll_setup(AFXDPState *s, int64_t usecs, Error **errp)
+{
+    int fd = xsk_socket__fd(s->xsk);
+    int val = 1;
+
+    if (setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &val, sizeof(val))) {
+        goto fail;
+    }
+
+    val = usecs;
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &val, sizeof(val))) {
+        goto fail;
+    }
+
+    val = AF_XDP_BATCH_SIZE;
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL_BUDGET, &val, sizeof(val))) {
+        goto fail;
+    }
+
+    s->busy_poll = true;
+    return 0;
+
+fail:
+    error_setg_errno(errp, errno,
+                     "failed to enable busy polling for %s queue_index: %d",
+                     s->ifname, s->nc.queue_index);
+    return -1;
+}
+
 static int af_xdp_socket_create(AFXDPState *s,
                                 const NetdevAFXDPOptions *opts, Error **errp)
 {
@@ -354,6 +420,10 @@ static int af_xdp_socket_create(AFXDPState *s,
         cfg.bind_flags |= XDP_COPY;
     }
 
+    if (opts->has_zero_copy && opts->zero_copy) {
+        cfg.bind_flags |= XDP_ZEROCOPY;
+    }
+
     queue_id = s->nc.queue_index;
     if (opts->has_start_queue && opts->start_queue > 0) {
         queue_id += opts->start_queue;
@@ -393,6 +463,10 @@ static int af_xdp_socket_create(AFXDPState *s,
 
     s->xdp_flags = cfg.xdp_flags;
 
+    if (opts->has_busy_poll && opts->busy_poll) {
+        return af_xdp_busy_poll_setup(s, opts->busy_poll, errp);
+    }
+
     return 0;
 }
 
@@ -401,6 +475,7 @@ static NetClientInfo net_af_xdp_info = {
     .type = NET_CLIENT_DRIVER_AF_XDP,
     .size = sizeof(AFXDPState),
     .receive = af_xdp_receive,
+    .receive_iov = af_xdp_receive_iov,
     .poll = af_xdp_poll,
     .cleanup = af_xdp_cleanup,
 };
@@ -465,6 +540,19 @@ int net_init_af_xdp(const Netdev *netdev,
         return -1;
     }
 
+    if (opts->has_force_copy && opts->force_copy &&
+        opts->has_zero_copy && opts->zero_copy) {
+        error_setg(errp, "'force-copy=on' and 'zero-copy=on' are exclusive");
+        return -1;
+    }
+
+    if (opts->has_busy_poll &&
+        (opts->busy_poll < 0 || opts->busy_poll > INT_MAX)) {
+        error_setg(errp, "invalid busy-poll timeout (%" PRIi64 ") for '%s'",
+                   opts->busy_poll, opts->ifname);
+        return -1;
+    }
+
     if ((opts->has_inhibit && opts->inhibit) != !!opts->sock_fds) {
         error_setg(errp, "'inhibit=on' requires 'sock-fds' and vice versa");
         return -1;
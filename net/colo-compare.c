@@ -129,6 +129,15 @@ struct CompareState {
     GQueue conn_list;
     /* Record the connection without repetition */
     GHashTable *connection_track_table;
+    /*
+     * The connection of the last packet, primary and secondary packets of
+     * a flow usually come in bursts.  Connections are only freed when
+     * connection_get() resets the table, so this stays valid.
+     */
+    Connection *last_conn;
+    ConnectionKey last_key;
+    /* Packets created before this are old, see colo_old_packet_check() */
+    int64_t old_packet_deadline;
 
     IOThread *iothread;
     GMainContext *worker_context;
@@ -266,9 +275,15 @@ static int packet_enqueue(CompareState *s, int mode, Connection **con)
     }
     fill_connection_key(pkt, &key, false);
 
-    conn = connection_get(s->connection_track_table,
-                          &key,
-                          &s->conn_list);
+    if (s->last_conn && connection_key_equal(&key, &s->last_key)) {
+        conn = s->last_conn;
+    } else {
+        conn = connection_get(s->connection_track_table,
+                              &key,
+                              &s->conn_list);
+        s->last_conn = conn;
+        s->last_key = key;
+    }
 
     if (!conn->processing) {
         g_queue_push_tail(&s->conn_list, conn);
@@ -599,11 +614,9 @@ static int colo_packet_compare_other(Packet *spkt, Packet *ppkt)
                                        ppkt->size - offset);
 }
 
-static int colo_old_packet_check_one(Packet *pkt, int64_t *check_time)
+static int colo_old_packet_check_one(Packet *pkt, int64_t *deadline)
 {
-    int64_t now = qemu_clock_get_ms(QEMU_CLOCK_HOST);
-
-    if ((now - pkt->creation_ms) > (*check_time)) {
+    if (pkt->creation_ms < *deadline) {
         trace_colo_old_packet_check_found(pkt->creation_ms);
         return 0;
     } else {
@@ -621,21 +634,32 @@ void colo_compare_unregister_notifier(Notifier *notify)
     notifier_remove(notify);
 }
 
-static int colo_old_packet_check_one_conn(Connection *conn,
-                                          CompareState *s)
+/*
+ * Return true if @queue holds an old packet.  Only TCP packets are sorted
+ * by sequence number, the other queues are in arrival order and it is
+ * enough to look at the first packet.
+ */
+static bool colo_old_packet_check_queue(Connection *conn, GQueue *queue,
+                                        int64_t *deadline)
 {
-    if (!g_queue_is_empty(&conn->primary_list)) {
-        if (g_queue_find_custom(&conn->primary_list,
-                                &s->compare_timeout,
-                                (GCompareFunc)colo_old_packet_check_one))
-            goto out;
+    if (g_queue_is_empty(queue)) {
+        return false;
     }
+    if (conn->ip_proto != IPPROTO_TCP) {
+        return !colo_old_packet_check_one(g_queue_peek_head(queue), deadline);
+    }
+    return g_queue_find_custom(queue, deadline,
+                               (GCompareFunc)colo_old_packet_check_one);
+}
 
-    if (!g_queue_is_empty(&conn->secondary_list)) {
-        if (g_queue_find_custom(&conn->secondary_list,
-                                &s->compare_timeout,
-                                (GCompareFunc)colo_old_packet_check_one))
-            goto out;
+static int colo_old_packet_check_one_conn(Connection *conn,
+                                          CompareState *s)
+{
+    if (colo_old_packet_check_queue(conn, &conn->primary_list,
+                                    &s->old_packet_deadline) ||
+        colo_old_packet_check_queue(conn, &conn->secondary_list,
+                                    &s->old_packet_deadline)) {
+        goto out;
     }
 
     return 1;
@@ -655,6 +679,9 @@ static void colo_old_packet_check(void *opaque)
 {
     CompareState *s = opaque;
 
+    s->old_packet_deadline = qemu_clock_get_ms(QEMU_CLOCK_HOST) -
+                             (int64_t)s->compare_timeout;
+
     /*
      * If we find one old packet, stop finding job and notify
      * COLO frame do checkpoint.
@@ -858,9 +858,11 @@ static ssize_t qemu_deliver_packet_iov(NetClientState *sender,
     return ret;
 }
 
-ssize_t qemu_sendv_packet_async(NetClientState *sender,
-                                const struct iovec *iov, int iovcnt,
-                                NetPacketSent *sent_cb)
+static ssize_t qemu_sendv_packet_async_with_flags(NetClientState *sender,
+                                                  unsigned flags,
+                                                  const struct iovec *iov,
+                                                  int iovcnt,
+                                                  NetPacketSent *sent_cb)
 {
     NetQueue *queue;
     size_t size = iov_size(iov, iovcnt);
@@ -876,22 +878,43 @@ ssize_t qemu_sendv_packet_async(NetClientState *sender,
 
     /* Let filters handle the packet first */
     ret = filter_receive_iov(sender, NET_FILTER_DIRECTION_TX, sender,
-                             QEMU_NET_PACKET_FLAG_NONE, iov, iovcnt, sent_cb);
+                             flags, iov, iovcnt, sent_cb);
     if (ret) {
         return ret;
     }
 
     ret = filter_receive_iov(sender->peer, NET_FILTER_DIRECTION_RX, sender,
-                             QEMU_NET_PACKET_FLAG_NONE, iov, iovcnt, sent_cb);
+                             flags, iov, iovcnt, sent_cb);
     if (ret) {
         return ret;
     }
 
     queue = sender->peer->incoming_queue;
 
-    return qemu_net_queue_send_iov(queue, sender,
-                                   QEMU_NET_PACKET_FLAG_NONE,
-                                   iov, iovcnt, sent_cb);
+    return qemu_net_queue_send_iov(queue, sender, flags, iov, iovcnt, sent_cb);
+}
+
+ssize_t qemu_sendv_packet_async(NetClientState *sender,
+                                const struct iovec *iov, int iovcnt,
+                                NetPacketSent *sent_cb)
+{
+    return qemu_sendv_packet_async_with_flags(sender,
+                                              QEMU_NET_PACKET_FLAG_NONE,
+                                              iov, iovcnt, sent_cb);
+}
+
+/*
+ * Like qemu_sendv_packet_async(), but the buffers described by @iov (not
+ * the @iov array itself) must stay valid until @sent_cb is called if the
+ * packet is queued.  The packet is then queued without copying it.
+ */
+ssize_t qemu_sendv_packet_async_nocopy(NetClientState *sender,
+                                       const struct iovec *iov, int iovcnt,
+                                       NetPacketSent *sent_cb)
+{
+    return qemu_sendv_packet_async_with_flags(sender,
+                                              QEMU_NET_PACKET_FLAG_NOCOPY,
+                                              iov, iovcnt, sent_cb);
 }
 
 ssize_t
@@ -23,6 +23,7 @@
 
 #include "qemu/osdep.h"
 #include "net/queue.h"
+#include "qemu/iov.h"
 #include "qemu/queue.h"
 #include "net/net.h"
 
@@ -46,6 +47,11 @@ struct NetPacket {
     unsigned flags;
     int size;
     NetPacketSent *sent_cb;
+    /*
+     * If non-zero, @data holds this many iovecs that point to the sender's
+     * buffers (QEMU_NET_PACKET_FLAG_NOCOPY) instead of the packet itself.
+     */
+    int iovcnt;
     uint8_t data[];
 };
 
@@ -107,6 +113,7 @@ static void qemu_net_queue_append(NetQueue *queue,
     packet->flags = flags;
     packet->size = size;
     packet->sent_cb = sent_cb;
+    packet->iovcnt = 0;
     memcpy(packet->data, buf, size);
 
     queue->nq_count++;
@@ -127,6 +134,21 @@ void qemu_net_queue_append_iov(NetQueue *queue,
     if (queue->nq_count >= queue->nq_maxlen && !sent_cb) {
         return; /* drop if queue full and no callback */
     }
+
+    if ((flags & QEMU_NET_PACKET_FLAG_NOCOPY) && sent_cb && iovcnt) {
+        packet = g_malloc(sizeof(NetPacket) + iovcnt * sizeof(*iov));
+        packet->sender = sender;
+        packet->sent_cb = sent_cb;
+        packet->flags = flags;
+        packet->size = iov_size(iov, iovcnt);
+        packet->iovcnt = iovcnt;
+        memcpy(packet->data, iov, iovcnt * sizeof(*iov));
+
+        queue->nq_count++;
+        QTAILQ_INSERT_TAIL(&queue->packets, packet, entry);
+        return;
+    }
+
     for (i = 0; i < iovcnt; i++) {
         max_len += iov[i].iov_len;
     }
@@ -134,8 +156,9 @@ void qemu_net_queue_append_iov(NetQueue *queue,
     packet = g_malloc(sizeof(NetPacket) + max_len);
     packet->sender = sender;
     packet->sent_cb = sent_cb;
-    packet->flags = flags;
+    packet->flags = flags & ~QEMU_NET_PACKET_FLAG_NOCOPY;
     packet->size = 0;
+    packet->iovcnt = 0;
 
     for (i = 0; i < iovcnt; i++) {
         size_t len = iov[i].iov_len;
@@ -283,11 +306,19 @@ bool qemu_net_queue_flush(NetQueue *queue)
         QTAILQ_REMOVE(&queue->packets, packet, entry);
         queue->nq_count--;
 
-        ret = qemu_net_queue_deliver(queue,
-                                     packet->sender,
-                                     packet->flags,
-                                     packet->data,
-                                     packet->size);
+        if (packet->iovcnt) {
+            ret = qemu_net_queue_deliver_iov(queue,
+                                             packet->sender,
+                                             packet->flags,
+                                             (struct iovec *)packet->data,
+                                             packet->iovcnt);
+        } else {
+            ret = qemu_net_queue_deliver(queue,
+                                         packet->sender,
+                                         packet->flags,
+                                         packet->data,
+                                         packet->size);
+        }
         if (ret == 0) {
             queue->nq_count++;
             QTAILQ_INSERT_HEAD(&queue->packets, packet, entry);
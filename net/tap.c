@@ -39,14 +39,43 @@
 #include "sysemu/sysemu.h"
 #include "qapi/error.h"
 #include "qemu/cutils.h"
+#include "qemu/defer-call.h"
 #include "qemu/error-report.h"
+#include "qemu/iov.h"
 #include "qemu/main-loop.h"
 #include "qemu/sockets.h"
 
 #include "net/tap.h"
+#include "trace.h"
 
 #include "net/vhost_net.h"
 
+#ifdef CONFIG_LINUX_IO_URING
+#include <liburing.h>
+
+/*
+ * Small packets are copied to a batch and written with io_uring, so that a
+ * burst of them costs a single system call.  The batch is submitted at the
+ * end of the sender's defer_call_begin()/defer_call_end() section, e.g. a
+ * virtio-net transmit queue flush, or at once outside of one.  Copying
+ * larger packets, GSO ones in particular, would cost more than the write,
+ * so they still go out with writev().
+ *
+ * Writes that find the tap queue full stay in the batch and are submitted
+ * again once the fd is writable; new packets are held back meanwhile, as
+ * with writev().  Failed and short writes drop the packet and are counted.
+ */
+#define TAP_TX_BATCH_SIZE 64
+#define TAP_TX_BATCH_BUF_SIZE 2048
+
+typedef struct TapTxBatch {
+    struct io_uring ring;
+    unsigned int count;
+    size_t len[TAP_TX_BATCH_SIZE];
+    uint8_t buf[TAP_TX_BATCH_SIZE][TAP_TX_BATCH_BUF_SIZE];
+} TapTxBatch;
+#endif
+
 typedef struct TAPState {
     NetClientState nc;
     int fd;
@@ -62,6 +91,11 @@ typedef struct TAPState {
     VHostNetState *vhost_net;
     unsigned host_vnet_hdr_len;
     Notifier exit;
+#ifdef CONFIG_LINUX_IO_URING
+    TapTxBatch *tx_batch;
+    bool tx_batch_failed;
+    uint64_t tx_batch_dropped;
+#endif
 } TAPState;
 
 static void launch_script(const char *setup_script, const char *ifname,
@@ -90,19 +124,168 @@ static void tap_write_poll(TAPState *s, bool enable)
     tap_update_fd_handler(s);
 }
 
+#ifdef CONFIG_LINUX_IO_URING
+static void tap_tx_batch_submit(void *opaque);
+#endif
+
 static void tap_writable(void *opaque)
 {
     TAPState *s = opaque;
 
     tap_write_poll(s, false);
 
+#ifdef CONFIG_LINUX_IO_URING
+    tap_tx_batch_submit(s);
+    if (s->write_poll) {
+        return;
+    }
+#endif
+
     qemu_flush_queued_packets(&s->nc);
 }
 
+#ifdef CONFIG_LINUX_IO_URING
+static void tap_tx_batch_free(TAPState *s)
+{
+    io_uring_queue_exit(&s->tx_batch->ring);
+    g_free(s->tx_batch);
+    s->tx_batch = NULL;
+}
+
+static void tap_tx_batch_submit(void *opaque)
+{
+    TAPState *s = opaque;
+    TapTxBatch *b = s->tx_batch;
+    struct io_uring_cqe *cqe;
+    bool retry[TAP_TX_BATCH_SIZE] = { };
+    unsigned int i, n;
+    int ret;
+
+    /* With write_poll set, tap_writable() submits once there is room */
+    if (!b || !b->count || s->write_poll) {
+        return;
+    }
+
+    for (i = 0; i < b->count; i++) {
+        struct io_uring_sqe *sqe = io_uring_get_sqe(&b->ring);
+
+        assert(sqe);
+        io_uring_prep_write(sqe, s->fd, b->buf[i], b->len[i], 0);
+        io_uring_sqe_set_data(sqe, (void *)(uintptr_t)i);
+    }
+
+    do {
+        ret = io_uring_submit_and_wait(&b->ring, b->count);
+    } while (ret == -EINTR);
+
+    if (ret < 0) {
+        /* Stop batching, but do not lose the packets */
+        warn_report_once("tap: io_uring submission failed, not batching "
+                         "transmitted packets anymore: %s", strerror(-ret));
+        for (i = 0; i < b->count; i++) {
+            if (RETRY_ON_EINTR(write(s->fd, b->buf[i], b->len[i])) < 0) {
+                break;
+            }
+        }
+        tap_tx_batch_free(s);
+        s->tx_batch_failed = true;
+        return;
+    }
+
+    /* The buffers are reused, wait until every write is done */
+    for (i = 0; i < ret; i++) {
+        uintptr_t idx;
+        int r, res;
+
+        do {
+            r = io_uring_wait_cqe(&b->ring, &cqe);
+        } while (r == -EINTR);
+        if (r < 0) {
+            break;
+        }
+        idx = (uintptr_t)io_uring_cqe_get_data(cqe);
+        res = cqe->res;
+        io_uring_cqe_seen(&b->ring, cqe);
+
+        if (res == -EAGAIN || res == -EINTR) {
+            retry[idx] = true;
+        } else if (res != b->len[idx]) {
+            /* Like writev(), a failed write drops the packet */
+            s->tx_batch_dropped++;
+            trace_tap_tx_batch_drop(s, res, s->tx_batch_dropped);
+        }
+    }
+
+    /* Keep the packets that did not fit, in order, for tap_writable() */
+    for (i = n = 0; i < b->count; i++) {
+        if (retry[i]) {
+            if (i != n) {
+                memcpy(b->buf[n], b->buf[i], b->len[i]);
+                b->len[n] = b->len[i];
+            }
+            n++;
+        }
+    }
+    b->count = n;
+    if (n) {
+        tap_write_poll(s, true);
+    }
+}
+
+/* Queue a packet in the batch, return -1 if it must be written directly */
+static ssize_t tap_tx_batch_add(TAPState *s, const struct iovec *iov,
+                                int iovcnt)
+{
+    size_t size = iov_size(iov, iovcnt);
+    TapTxBatch *b;
+
+    if (size > TAP_TX_BATCH_BUF_SIZE || s->tx_batch_failed) {
+        /* Keep the packet order */
+        tap_tx_batch_submit(s);
+        return s->tx_batch && s->tx_batch->count ? 0 : -1;
+    }
+
+    if (!s->tx_batch) {
+        s->tx_batch = g_new0(TapTxBatch, 1);
+        if (io_uring_queue_init(TAP_TX_BATCH_SIZE, &s->tx_batch->ring, 0)) {
+            g_free(s->tx_batch);
+            s->tx_batch = NULL;
+            s->tx_batch_failed = true;
+            return -1;
+        }
+    }
+
+    b = s->tx_batch;
+    if (b->count == TAP_TX_BATCH_SIZE) {
+        tap_tx_batch_submit(s);
+        if (!s->tx_batch) {
+            return -1;
+        }
+        if (b->count == TAP_TX_BATCH_SIZE) {
+            /* Full of writes waiting for room, queue this one */
+            return 0;
+        }
+    }
+
+    b->len[b->count] = iov_to_buf(iov, iovcnt, 0, b->buf[b->count], size);
+    b->count++;
+
+    defer_call(tap_tx_batch_submit, s);
+    return size;
+}
+#endif
+
 static ssize_t tap_write_packet(TAPState *s, const struct iovec *iov, int iovcnt)
 {
     ssize_t len;
 
+#ifdef CONFIG_LINUX_IO_URING
+    len = tap_tx_batch_add(s, iov, iovcnt);
+    if (len >= 0) {
+        return len;
+    }
+#endif
+
     len = RETRY_ON_EINTR(writev(s->fd, iov, iovcnt));
 
     if (len == -1 && errno == EAGAIN) {
@@ -358,6 +541,12 @@ static void tap_cleanup(NetClientState *nc)
 
     tap_read_poll(s, false);
     tap_write_poll(s, false);
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->tx_batch) {
+        tap_tx_batch_submit(s);
+        tap_tx_batch_free(s);
+    }
+#endif
     close(s->fd);
     s->fd = -1;
 }
@@ -94,6 +94,19 @@ void qemu_plugin_register_vcpu_tb_exec_cb(struct qemu_plugin_tb *tb,
     }
 }
 
+void qemu_plugin_register_vcpu_tb_exec_cb_with_regs(
+    struct qemu_plugin_tb *tb,
+    qemu_plugin_vcpu_udata_cb_t cb,
+    struct qemu_plugin_register **regs,
+    size_t n_regs,
+    void *udata)
+{
+    if (!tb->mem_only) {
+        plugin_register_dyn_cb__udata_regs(&tb->cbs[PLUGIN_CB_REGULAR],
+                                           cb, regs, n_regs, udata);
+    }
+}
+
 void qemu_plugin_register_vcpu_tb_exec_inline(struct qemu_plugin_tb *tb,
                                               enum qemu_plugin_op op,
                                               void *ptr, uint64_t imm)
@@ -103,6 +116,37 @@ void qemu_plugin_register_vcpu_tb_exec_inline(struct qemu_plugin_tb *tb,
     }
 }
 
+void qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+    struct qemu_plugin_tb *tb,
+    enum qemu_plugin_op op,
+    qemu_plugin_u64 entry,
+    uint64_t imm)
+{
+    if (!tb->mem_only) {
+        plugin_register_inline_op_on_entry(&tb->cbs[PLUGIN_CB_INLINE],
+                                           0, op, entry, imm);
+    }
+}
+
+void qemu_plugin_register_vcpu_tb_exec_cond_cb(struct qemu_plugin_tb *tb,
+                                               qemu_plugin_vcpu_udata_cb_t cb,
+                                               enum qemu_plugin_cb_flags flags,
+                                               enum qemu_plugin_cond cond,
+                                               qemu_plugin_u64 entry,
+                                               uint64_t imm,
+                                               void *udata)
+{
+    if (cond == QEMU_PLUGIN_COND_NEVER || tb->mem_only) {
+        return;
+    }
+    if (cond == QEMU_PLUGIN_COND_ALWAYS) {
+        qemu_plugin_register_vcpu_tb_exec_cb(tb, cb, flags, udata);
+        return;
+    }
+    plugin_register_dyn_cond_cb__udata(&tb->cbs[PLUGIN_CB_COND], cb, flags,
+                                       cond, entry, imm, udata);
+}
+
 void qemu_plugin_register_vcpu_insn_exec_cb(struct qemu_plugin_insn *insn,
                                             qemu_plugin_vcpu_udata_cb_t cb,
                                             enum qemu_plugin_cb_flags flags,
@@ -114,6 +158,20 @@ void qemu_plugin_register_vcpu_insn_exec_cb(struct qemu_plugin_insn *insn,
     }
 }
 
+void qemu_plugin_register_vcpu_insn_exec_cb_with_regs(
+    struct qemu_plugin_insn *insn,
+    qemu_plugin_vcpu_udata_cb_t cb,
+    struct qemu_plugin_register **regs,
+    size_t n_regs,
+    void *udata)
+{
+    if (!insn->mem_only) {
+        plugin_register_dyn_cb__udata_regs(
+            &insn->cbs[PLUGIN_CB_INSN][PLUGIN_CB_REGULAR],
+            cb, regs, n_regs, udata);
+    }
+}
+
 void qemu_plugin_register_vcpu_insn_exec_inline(struct qemu_plugin_insn *insn,
                                                 enum qemu_plugin_op op,
                                                 void *ptr, uint64_t imm)
@@ -124,6 +182,39 @@ void qemu_plugin_register_vcpu_insn_exec_inline(struct qemu_plugin_insn *insn,
     }
 }
 
+void qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+    struct qemu_plugin_insn *insn,
+    enum qemu_plugin_op op,
+    qemu_plugin_u64 entry,
+    uint64_t imm)
+{
+    if (!insn->mem_only) {
+        plugin_register_inline_op_on_entry(
+            &insn->cbs[PLUGIN_CB_INSN][PLUGIN_CB_INLINE], 0, op, entry, imm);
+    }
+}
+
+void qemu_plugin_register_vcpu_insn_exec_cond_cb(
+    struct qemu_plugin_insn *insn,
+    qemu_plugin_vcpu_udata_cb_t cb,
+    enum qemu_plugin_cb_flags flags,
+    enum qemu_plugin_cond cond,
+    qemu_plugin_u64 entry,
+    uint64_t imm,
+    void *udata)
+{
+    if (cond == QEMU_PLUGIN_COND_NEVER || insn->mem_only) {
+        return;
+    }
+    if (cond == QEMU_PLUGIN_COND_ALWAYS) {
+        qemu_plugin_register_vcpu_insn_exec_cb(insn, cb, flags, udata);
+        return;
+    }
+    plugin_register_dyn_cond_cb__udata(
+        &insn->cbs[PLUGIN_CB_INSN][PLUGIN_CB_COND], cb, flags, cond, entry,
+        imm, udata);
+}
+
 
 /*
  * We always plant memory instrumentation because they don't finalise until
@@ -148,6 +239,17 @@ void qemu_plugin_register_vcpu_mem_inline(struct qemu_plugin_insn *insn,
                               rw, op, ptr, imm);
 }
 
+void qemu_plugin_register_vcpu_mem_inline_per_vcpu(
+    struct qemu_plugin_insn *insn,
+    enum qemu_plugin_mem_rw rw,
+    enum qemu_plugin_op op,
+    qemu_plugin_u64 entry,
+    uint64_t imm)
+{
+    plugin_register_inline_op_on_entry(
+        &insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_INLINE], rw, op, entry, imm);
+}
+
 void qemu_plugin_register_vcpu_tb_trans_cb(qemu_plugin_id_t id,
                                            qemu_plugin_vcpu_tb_trans_cb_t cb)
 {
@@ -372,6 +474,117 @@ int qemu_plugin_n_max_vcpus(void)
 #endif
 }
 
+/*
+ * Scoreboards
+ */
+
+struct qemu_plugin_scoreboard *qemu_plugin_scoreboard_new(size_t element_size)
+{
+    return plugin_scoreboard_new(element_size);
+}
+
+void qemu_plugin_scoreboard_free(struct qemu_plugin_scoreboard *score)
+{
+    plugin_scoreboard_free(score);
+}
+
+void *qemu_plugin_scoreboard_find(struct qemu_plugin_scoreboard *score,
+                                  unsigned int vcpu_index)
+{
+    g_assert(vcpu_index < score->data->len);
+    return score->data->data +
+           vcpu_index * g_array_get_element_size(score->data);
+}
+
+static uint64_t *plugin_u64_address(qemu_plugin_u64 entry,
+                                    unsigned int vcpu_index)
+{
+    char *ptr = qemu_plugin_scoreboard_find(entry.score, vcpu_index);
+    return (uint64_t *)(ptr + entry.offset);
+}
+
+void qemu_plugin_u64_add(qemu_plugin_u64 entry, unsigned int vcpu_index,
+                         uint64_t added)
+{
+    *plugin_u64_address(entry, vcpu_index) += added;
+}
+
+uint64_t qemu_plugin_u64_get(qemu_plugin_u64 entry, unsigned int vcpu_index)
+{
+    return *plugin_u64_address(entry, vcpu_index);
+}
+
+void qemu_plugin_u64_set(qemu_plugin_u64 entry, unsigned int vcpu_index,
+                         uint64_t val)
+{
+    *plugin_u64_address(entry, vcpu_index) = val;
+}
+
+uint64_t qemu_plugin_u64_sum(qemu_plugin_u64 entry)
+{
+    uint64_t total = 0;
+    unsigned int i;
+
+    for (i = 0; i < plugin_num_vcpus(); i++) {
+        total += qemu_plugin_u64_get(entry, i);
+    }
+    return total;
+}
+
+/*
+ * Registers
+ *
+ * Registers are the TCG globals of the frontend.  A handle holds the
+ * global's index in the TCG context, which is the same in all of them;
+ * the value is read from its canonical location in CPUArchState.
+ */
+
+struct qemu_plugin_register *qemu_plugin_find_register(const char *name)
+{
+    TCGContext *s = tcg_ctx;
+    size_t len = strlen(name);
+    int i;
+
+    if (!s) {
+        return NULL;
+    }
+
+    for (i = 0; i < s->nb_globals; i++) {
+        TCGTemp *ts = &s->temps[i];
+
+        if (ts->kind != TEMP_GLOBAL || ts->temp_subindex ||
+            (ts->base_type != TCG_TYPE_I32 && ts->base_type != TCG_TYPE_I64)) {
+            continue;
+        }
+        /* On 32-bit hosts 64-bit globals are split as name_0 and name_1 */
+        if (strncmp(ts->name, name, len) == 0 &&
+            (ts->name[len] == '\0' ||
+             (ts->base_type != ts->type && !strcmp(ts->name + len, "_0")))) {
+            return (struct qemu_plugin_register *)(uintptr_t)(i + 1);
+        }
+    }
+    return NULL;
+}
+
+int qemu_plugin_read_register(struct qemu_plugin_register *reg,
+                              void *buf, size_t size)
+{
+    TCGTemp *ts = &tcg_ctx->temps[plugin_register_global(reg)];
+    TCGTemp *base = ts->mem_base;
+    size_t reg_size = ts->base_type == TCG_TYPE_I64 ? 8 : 4;
+    char *ptr = (char *)cpu_env(current_cpu);
+
+    if (size < reg_size) {
+        return -1;
+    }
+    if (base->kind != TEMP_FIXED) {
+        /* e.g. windowed registers live behind a pointer in CPUArchState */
+        ptr = *(char **)(ptr + base->mem_offset);
+    }
+    memcpy(buf, ptr + ts->mem_offset, reg_size);
+    return reg_size;
+}
+
 /*
  * Plugin output
  */
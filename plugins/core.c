@@ -208,11 +208,60 @@ plugin_register_cb_udata(qemu_plugin_id_t id, enum qemu_plugin_event ev,
     do_plugin_register_cb(id, ev, func, udata);
 }
 
+/*
+ * Make room in all scoreboards for the entry of @cpu.  Translated code
+ * has the address of the scoreboards built in, so the other vCPUs must
+ * be stopped while they move and all TBs flushed before they resume.
+ *
+ * This only happens in user mode, where new vCPUs are created by the
+ * thread of an existing one; qemu_plugin_load_list() makes room for
+ * all possible vCPUs in system mode.
+ */
+static void plugin_grow_scoreboards__locked(CPUState *cpu)
+{
+    size_t scoreboard_size = plugin.scoreboard_alloc_size;
+    struct qemu_plugin_scoreboard *score;
+
+    if (cpu->cpu_index < scoreboard_size) {
+        return;
+    }
+
+    while (cpu->cpu_index >= scoreboard_size) {
+        scoreboard_size *= 2;
+    }
+
+    if (QLIST_EMPTY(&plugin.scoreboards)) {
+        /* just update size for future scoreboards */
+        plugin.scoreboard_alloc_size = scoreboard_size;
+        return;
+    }
+
+    /* start_exclusive() must not be called with plugin.lock held */
+    qemu_rec_mutex_unlock(&plugin.lock);
+    start_exclusive();
+    qemu_rec_mutex_lock(&plugin.lock);
+
+    /* another vCPU may have grown the scoreboards in the meantime */
+    if (scoreboard_size > plugin.scoreboard_alloc_size) {
+        QLIST_FOREACH(score, &plugin.scoreboards, entry) {
+            g_array_set_size(score->data, scoreboard_size);
+        }
+        plugin.scoreboard_alloc_size = scoreboard_size;
+        /* flush right away, from the exclusive section */
+        tb_flush(current_cpu ? current_cpu : cpu);
+    }
+
+    end_exclusive();
+}
+
 void qemu_plugin_vcpu_init_hook(CPUState *cpu)
 {
     bool success;
 
     qemu_rec_mutex_lock(&plugin.lock);
+    qatomic_set(&plugin.num_vcpus,
+                MAX(plugin.num_vcpus, cpu->cpu_index + 1));
+    plugin_grow_scoreboards__locked(cpu);
     plugin_cpu_update__locked(&cpu->cpu_index, NULL, NULL);
     success = g_hash_table_insert(plugin.cpu_ht, &cpu->cpu_index,
                                   &cpu->cpu_index);
@@ -289,6 +338,24 @@ void plugin_register_inline_op(GArray **arr,
     dyn_cb->type = PLUGIN_CB_INLINE;
     dyn_cb->rw = rw;
     dyn_cb->inline_insn.op = op;
+    dyn_cb->inline_insn.entry = (qemu_plugin_u64) {};
+    dyn_cb->inline_insn.imm = imm;
+}
+
+void plugin_register_inline_op_on_entry(GArray **arr,
+                                        enum qemu_plugin_mem_rw rw,
+                                        enum qemu_plugin_op op,
+                                        qemu_plugin_u64 entry,
+                                        uint64_t imm)
+{
+    struct qemu_plugin_dyn_cb *dyn_cb;
+
+    dyn_cb = plugin_get_dyn_cb(arr);
+    dyn_cb->userp = NULL;
+    dyn_cb->type = PLUGIN_CB_INLINE;
+    dyn_cb->rw = rw;
+    dyn_cb->inline_insn.op = op;
+    dyn_cb->inline_insn.entry = entry;
     dyn_cb->inline_insn.imm = imm;
 }
 
@@ -300,9 +367,47 @@ void plugin_register_dyn_cb__udata(GArray **arr,
     struct qemu_plugin_dyn_cb *dyn_cb = plugin_get_dyn_cb(arr);
 
     dyn_cb->userp = udata;
-    /* Note flags are discarded as unused. */
     dyn_cb->f.vcpu_udata = cb;
     dyn_cb->type = PLUGIN_CB_REGULAR;
+    dyn_cb->flags = flags;
+    dyn_cb->n_regs = 0;
+}
+
+void
+plugin_register_dyn_cb__udata_regs(GArray **arr,
+                                   qemu_plugin_vcpu_udata_cb_t cb,
+                                   struct qemu_plugin_register *const *regs,
+                                   size_t n_regs, void *udata)
+{
+    struct qemu_plugin_dyn_cb *dyn_cb = plugin_get_dyn_cb(arr);
+
+    dyn_cb->userp = udata;
+    dyn_cb->f.vcpu_udata = cb;
+    dyn_cb->type = PLUGIN_CB_REGULAR;
+    dyn_cb->flags = QEMU_PLUGIN_CB_NO_REGS;
+    dyn_cb->regs = tcg_malloc(n_regs * sizeof(*regs));
+    memcpy(dyn_cb->regs, regs, n_regs * sizeof(*regs));
+    dyn_cb->n_regs = n_regs;
+}
+
+void plugin_register_dyn_cond_cb__udata(GArray **arr,
+                                        qemu_plugin_vcpu_udata_cb_t cb,
+                                        enum qemu_plugin_cb_flags flags,
+                                        enum qemu_plugin_cond cond,
+                                        qemu_plugin_u64 entry,
+                                        uint64_t imm,
+                                        void *udata)
+{
+    struct qemu_plugin_dyn_cb *dyn_cb = plugin_get_dyn_cb(arr);
+
+    dyn_cb->userp = udata;
+    dyn_cb->f.vcpu_udata = cb;
+    dyn_cb->type = PLUGIN_CB_COND;
+    dyn_cb->flags = flags;
+    dyn_cb->n_regs = 0;
+    dyn_cb->cond.cond = cond;
+    dyn_cb->cond.entry = entry;
+    dyn_cb->cond.imm = imm;
 }
 
 void plugin_register_vcpu_mem_cb(GArray **arr,
@@ -430,10 +535,16 @@ void qemu_plugin_flush_cb(void)
     plugin_cb__simple(QEMU_PLUGIN_EV_FLUSH);
 }
 
-void exec_inline_op(struct qemu_plugin_dyn_cb *cb)
+void exec_inline_op(struct qemu_plugin_dyn_cb *cb, int cpu_index)
 {
+    qemu_plugin_u64 entry = cb->inline_insn.entry;
     uint64_t *val = cb->userp;
 
+    if (entry.score) {
+        char *base = qemu_plugin_scoreboard_find(entry.score, cpu_index);
+        val = (uint64_t *)(base + entry.offset);
+    }
+
     switch (cb->inline_insn.op) {
     case QEMU_PLUGIN_INLINE_ADD_U64:
         *val += cb->inline_insn.imm;
@@ -465,7 +576,7 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
                            vaddr, cb->userp);
             break;
         case PLUGIN_CB_INLINE:
-            exec_inline_op(cb);
+            exec_inline_op(cb, cpu->cpu_index);
             break;
         default:
             g_assert_not_reached();
@@ -550,6 +661,34 @@ void qemu_plugin_user_postfork(bool is_child)
     }
 }
 
+struct qemu_plugin_scoreboard *plugin_scoreboard_new(size_t element_size)
+{
+    struct qemu_plugin_scoreboard *score =
+        g_malloc0(sizeof(struct qemu_plugin_scoreboard));
+
+    score->data = g_array_new(false, true, element_size);
+
+    QEMU_LOCK_GUARD(&plugin.lock);
+    g_array_set_size(score->data, plugin.scoreboard_alloc_size);
+    QLIST_INSERT_HEAD(&plugin.scoreboards, score, entry);
+    return score;
+}
+
+void plugin_scoreboard_free(struct qemu_plugin_scoreboard *score)
+{
+    WITH_QEMU_LOCK_GUARD(&plugin.lock) {
+        QLIST_REMOVE(score, entry);
+    }
+
+    g_array_free(score->data, true);
+    g_free(score);
+}
+
+unsigned int plugin_num_vcpus(void)
+{
+    return qatomic_read(&plugin.num_vcpus);
+}
+
 static bool plugin_dyn_cb_arr_cmp(const void *ap, const void *bp)
 {
     return ap == bp;
@@ -566,6 +705,8 @@ static void __attribute__((__constructor__)) plugin_init(void)
     plugin.id_ht = g_hash_table_new(g_int64_hash, g_int64_equal);
     plugin.cpu_ht = g_hash_table_new(g_int_hash, g_int_equal);
     QTAILQ_INIT(&plugin.ctxs);
+    QLIST_INIT(&plugin.scoreboards);
+    plugin.scoreboard_alloc_size = 16; /* avoid frequent reallocation */
     qht_init(&plugin.dyn_cb_arr_ht, plugin_dyn_cb_arr_cmp, 16,
              QHT_MODE_AUTO_RESIZE);
     atexit(qemu_plugin_atexit_cb);
@@ -299,6 +299,10 @@ int qemu_plugin_load_list(QemuPluginList *head, Error **errp)
     info->system_emulation = true;
     info->system.smp_vcpus = ms->smp.cpus;
     info->system.max_vcpus = ms->smp.max_cpus;
+
+    /* vCPUs are hotplugged from the main loop, don't grow scoreboards then */
+    plugin.scoreboard_alloc_size = MAX(plugin.scoreboard_alloc_size,
+                                       ms->smp.max_cpus);
 #else
     info->system_emulation = false;
 #endif
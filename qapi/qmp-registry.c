@@ -15,6 +15,14 @@
 #include "qemu/osdep.h"
 #include "qapi/qmp/dispatch.h"
 
+typedef struct QmpSnapshot {
+    QmpSnapshotSyncFunc *sync;
+    QSLIST_ENTRY(QmpSnapshot) next;
+} QmpSnapshot;
+
+static QSLIST_HEAD(, QmpSnapshot) qmp_snapshots =
+    QSLIST_HEAD_INITIALIZER(qmp_snapshots);
+
 void qmp_register_command(QmpCommandList *cmds, const char *name,
                           QmpCommandFunc *fn, QmpCommandOptions options,
                           unsigned special_features)
@@ -23,6 +31,8 @@ void qmp_register_command(QmpCommandList *cmds, const char *name,
 
     /* QCO_COROUTINE and QCO_ALLOW_OOB are incompatible for now */
     assert(!((options & QCO_COROUTINE) && (options & QCO_ALLOW_OOB)));
+    /* QCO_NO_BQL commands may run outside of coroutine context */
+    assert(!((options & QCO_COROUTINE) && (options & QCO_NO_BQL)));
 
     cmd->name = name;
     cmd->fn = fn;
@@ -93,3 +103,20 @@ void qmp_for_each_command(const QmpCommandList *cmds, qmp_cmd_callback_fn fn,
         fn(cmd, opaque);
     }
 }
+
+void qmp_register_snapshot(QmpSnapshotSyncFunc *sync)
+{
+    QmpSnapshot *snap = g_new0(QmpSnapshot, 1);
+
+    snap->sync = sync;
+    QSLIST_INSERT_HEAD(&qmp_snapshots, snap, next);
+}
+
+void qmp_sync_snapshots(void)
+{
+    QmpSnapshot *snap;
+
+    QSLIST_FOREACH(snap, &qmp_snapshots, next) {
+        snap->sync();
+    }
+}
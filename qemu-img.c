@@ -1155,6 +1155,11 @@ static int64_t find_nonzero(const uint8_t *buf, int64_t n)
     int64_t i;
     int64_t end = QEMU_ALIGN_DOWN(n, BDRV_SECTOR_SIZE);
 
+    /* The common case: check all of it at full speed */
+    if (buffer_is_zero(buf, n)) {
+        return -1;
+    }
+
     for (i = 0; i < end; i += BDRV_SECTOR_SIZE) {
         if (!buffer_is_zero(buf + i, BDRV_SECTOR_SIZE)) {
             return i;
@@ -1292,6 +1297,12 @@ static int compare_buffers(const uint8_t *buf1, const uint8_t *buf2,
     if (!chsize) {
         chsize = BDRV_SECTOR_SIZE;
     }
+    /* The common case, where one memcmp over everything is much faster */
+    if (!memcmp(buf1, buf2, bytes)) {
+        *pnum = bytes;
+        return 0;
+    }
+
     i = MIN(bytes, chsize);
 
     res = !!memcmp(buf1, buf2, i);
@@ -1310,6 +1321,53 @@ static int compare_buffers(const uint8_t *buf1, const uint8_t *buf2,
 
 #define IO_BUF_SIZE (2 * MiB)
 
+/* qemu-img compare reads both images at once, in larger pieces */
+#define COMPARE_BUF_SIZE (16 * MiB)
+
+typedef struct CompareRead {
+    BlockBackend *blk;
+    const char *filename;
+    QEMUIOVector qiov;
+    int ret;
+} CompareRead;
+
+static void compare_read_cb(void *opaque, int ret)
+{
+    CompareRead *r = opaque;
+
+    r->ret = ret;
+}
+
+/*
+ * Read @bytes at @offset of both images, with the two requests in flight
+ * together.  Returns 0 on success, and 4 (the exit status for read errors)
+ * after emitting an error message.
+ */
+static int compare_read_both(CompareRead *r, int64_t offset, int64_t bytes,
+                             uint8_t *buf1, uint8_t *buf2)
+{
+    uint8_t *bufs[2] = { buf1, buf2 };
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        qemu_iovec_init_buf(&r[i].qiov, bufs[i], bytes);
+        r[i].ret = -EINPROGRESS;
+        blk_aio_preadv(r[i].blk, offset, &r[i].qiov, 0, compare_read_cb,
+                       &r[i]);
+    }
+    while (r[0].ret == -EINPROGRESS || r[1].ret == -EINPROGRESS) {
+        main_loop_wait(false);
+    }
+    for (i = 0; i < 2; i++) {
+        if (r[i].ret < 0) {
+            error_report("Error while reading offset %" PRId64 " of %s: %s",
+                         offset, r[i].filename, strerror(-r[i].ret));
+            return 4;
+        }
+    }
+    return 0;
+}
+
 /*
  * Check if passed sectors are empty (not allocated or contain only 0 bytes)
  *
@@ -1363,7 +1421,10 @@ static int img_compare(int argc, char **argv)
     int64_t total_size1, total_size2;
     uint8_t *buf1 = NULL, *buf2 = NULL;
     int64_t pnum1, pnum2;
+    int64_t end1 = 0, end2 = 0;
+    int status1 = 0, status2 = 0;
     int allocated1, allocated2;
+    CompareRead reads[2];
     int ret = 0; /* return value - 0 Ident, 1 Different, >1 Error */
     bool progress = false, quiet = false, strict = false;
     int flags;
@@ -1481,8 +1542,10 @@ static int img_compare(int argc, char **argv)
     bs1 = blk_bs(blk1);
     bs2 = blk_bs(blk2);
 
-    buf1 = blk_blockalign(blk1, IO_BUF_SIZE);
-    buf2 = blk_blockalign(blk2, IO_BUF_SIZE);
+    buf1 = blk_blockalign(blk1, COMPARE_BUF_SIZE);
+    buf2 = blk_blockalign(blk2, COMPARE_BUF_SIZE);
+    reads[0] = (CompareRead) { .blk = blk1, .filename = filename1 };
+    reads[1] = (CompareRead) { .blk = blk2, .filename = filename2 };
     total_size1 = blk_getlength(blk1);
     if (total_size1 < 0) {
         error_report("Can't get size of %s: %s",
@@ -1509,30 +1572,43 @@ static int img_compare(int argc, char **argv)
     }
 
     while (offset < total_size) {
-        int status1, status2;
-
-        status1 = bdrv_block_status_above(bs1, NULL, offset,
-                                          total_size1 - offset, &pnum1, NULL,
-                                          NULL);
-        if (status1 < 0) {
-            ret = 3;
-            error_report("Sector allocation test failed for %s", filename1);
-            goto out;
+        /*
+         * The status of each image is kept until its extent is used up,
+         * so a long extent in one image is only queried once even if the
+         * other image is fragmented.  With a NULL base, the whole backing
+         * chain is taken into account.
+         */
+        if (offset >= end1) {
+            status1 = bdrv_block_status_above(bs1, NULL, offset,
+                                              total_size1 - offset, &pnum1,
+                                              NULL, NULL);
+            if (status1 < 0) {
+                ret = 3;
+                error_report("Sector allocation test failed for %s",
+                             filename1);
+                goto out;
+            }
+            assert(pnum1);
+            end1 = offset + pnum1;
         }
         allocated1 = status1 & BDRV_BLOCK_ALLOCATED;
 
-        status2 = bdrv_block_status_above(bs2, NULL, offset,
-                                          total_size2 - offset, &pnum2, NULL,
-                                          NULL);
-        if (status2 < 0) {
-            ret = 3;
-            error_report("Sector allocation test failed for %s", filename2);
-            goto out;
+        if (offset >= end2) {
+            status2 = bdrv_block_status_above(bs2, NULL, offset,
+                                              total_size2 - offset, &pnum2,
+                                              NULL, NULL);
+            if (status2 < 0) {
+                ret = 3;
+                error_report("Sector allocation test failed for %s",
+                             filename2);
+                goto out;
+            }
+            assert(pnum2);
+            end2 = offset + pnum2;
         }
         allocated2 = status2 & BDRV_BLOCK_ALLOCATED;
 
-        assert(pnum1 && pnum2);
-        chunk = MIN(pnum1, pnum2);
+        chunk = MIN(end1, end2) - offset;
 
         if (strict) {
             if (status1 != status2) {
@@ -1548,21 +1624,9 @@ static int img_compare(int argc, char **argv)
             if (allocated1) {
                 int64_t pnum;
 
-                chunk = MIN(chunk, IO_BUF_SIZE);
-                ret = blk_pread(blk1, offset, chunk, buf1, 0);
-                if (ret < 0) {
-                    error_report("Error while reading offset %" PRId64
-                                 " of %s: %s",
-                                 offset, filename1, strerror(-ret));
-                    ret = 4;
-                    goto out;
-                }
-                ret = blk_pread(blk2, offset, chunk, buf2, 0);
-                if (ret < 0) {
-                    error_report("Error while reading offset %" PRId64
-                                 " of %s: %s",
-                                 offset, filename2, strerror(-ret));
-                    ret = 4;
+                chunk = MIN(chunk, COMPARE_BUF_SIZE);
+                ret = compare_read_both(reads, offset, chunk, buf1, buf2);
+                if (ret) {
                     goto out;
                 }
                 ret = compare_buffers(buf1, buf2, chunk, 0, &pnum);
@@ -1574,7 +1638,7 @@ static int img_compare(int argc, char **argv)
                 }
             }
         } else {
-            chunk = MIN(chunk, IO_BUF_SIZE);
+            chunk = MIN(chunk, COMPARE_BUF_SIZE);
             if (allocated1) {
                 ret = check_empty_sectors(blk1, offset, chunk,
                                           filename1, buf1, quiet);
@@ -1615,7 +1679,7 @@ static int img_compare(int argc, char **argv)
 
             }
             if (ret & BDRV_BLOCK_ALLOCATED && !(ret & BDRV_BLOCK_ZERO)) {
-                chunk = MIN(chunk, IO_BUF_SIZE);
+                chunk = MIN(chunk, COMPARE_BUF_SIZE);
                 ret = check_empty_sectors(blk_over, offset, chunk,
                                           filename_over, buf1, quiet);
                 if (ret) {
@@ -1667,6 +1731,17 @@ enum ImgConvertBlockStatus {
 #define MAX_COROUTINES 16
 #define CONVERT_THROTTLE_GROUP "img_convert"
 
+/*
+ * Maximum number of extents remembered from the allocation pass; block
+ * status is queried again for the rest of the image.
+ */
+#define MAX_CONVERT_EXTENTS (1 << 20)
+
+typedef struct ImgConvertExtent {
+    int64_t end;
+    enum ImgConvertBlockStatus status;
+} ImgConvertExtent;
+
 typedef struct ImgConvertState {
     BlockBackend **src;
     int64_t *src_sectors;
@@ -1679,6 +1754,9 @@ typedef struct ImgConvertState {
     int64_t wr_offs;
     enum ImgConvertBlockStatus status;
     int64_t sector_next_status;
+    GArray *extents;        /* ImgConvertExtent, filled by the first pass */
+    bool extents_ready;     /* use @extents instead of querying again */
+    guint extent_cur;
     BlockBackend *target;
     bool has_zero_init;
     bool compressed;
@@ -1713,6 +1791,56 @@ static void convert_select_part(ImgConvertState *s, int64_t sector_num,
     }
 }
 
+/*
+ * Remember the block status found by the allocation pass, so that the copy
+ * does not have to query it again.  Adjacent extents with the same status
+ * are merged, which also lets copy_range work on long runs of data.
+ */
+static void convert_record_extent(ImgConvertState *s, int64_t sector_num)
+{
+    ImgConvertExtent *last = NULL;
+    ImgConvertExtent e = {
+        .end = s->sector_next_status,
+        .status = s->status,
+    };
+
+    if (!s->extents) {
+        return;
+    }
+    if (s->extents->len) {
+        last = &g_array_index(s->extents, ImgConvertExtent,
+                              s->extents->len - 1);
+        if (last->end != sector_num) {
+            return;
+        }
+        if (last->status == e.status) {
+            last->end = e.end;
+            return;
+        }
+    } else if (sector_num != 0) {
+        return;
+    }
+    if (s->extents->len < MAX_CONVERT_EXTENTS) {
+        g_array_append_val(s->extents, e);
+    }
+}
+
+/* Take the status of @sector_num from the map, if it covers it */
+static void convert_lookup_extent(ImgConvertState *s, int64_t sector_num)
+{
+    while (s->extent_cur < s->extents->len) {
+        ImgConvertExtent *e = &g_array_index(s->extents, ImgConvertExtent,
+                                             s->extent_cur);
+
+        if (e->end > sector_num) {
+            s->status = e->status;
+            s->sector_next_status = e->end;
+            return;
+        }
+        s->extent_cur++;
+    }
+}
+
 static int coroutine_mixed_fn GRAPH_RDLOCK
 convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
 {
@@ -1735,6 +1863,10 @@ convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
         }
     }
 
+    if (s->sector_next_status <= sector_num && s->extents_ready) {
+        convert_lookup_extent(s, sector_num);
+    }
+
     if (s->sector_next_status <= sector_num) {
         uint64_t offset = (sector_num - src_cur_offset) * BDRV_SECTOR_SIZE;
         int64_t count;
@@ -1798,10 +1930,14 @@ convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
         }
 
         s->sector_next_status = sector_num + n;
+        if (!s->extents_ready) {
+            convert_record_extent(s, sector_num);
+        }
     }
 
     n = MIN(n, s->sector_next_status - sector_num);
-    if (s->status == BLK_DATA) {
+    if (s->status == BLK_DATA && !s->copy_range) {
+        /* copy_range needs no buffer, so it can take the whole extent */
         n = MIN(n, s->buf_sectors);
     }
 
@@ -1969,6 +2105,36 @@ static int coroutine_fn convert_co_copy_range(ImgConvertState *s, int64_t sector
     return 0;
 }
 
+/*
+ * Copy through @buf a range that was meant for copy_range, and so may be
+ * larger than the buffer.
+ */
+static int coroutine_fn convert_co_copy_bounce(ImgConvertState *s,
+                                               int64_t sector_num,
+                                               int nb_sectors, uint8_t *buf)
+{
+    int n, ret;
+
+    while (nb_sectors > 0) {
+        n = MIN(nb_sectors, s->buf_sectors);
+        ret = convert_co_read(s, sector_num, n, buf);
+        if (ret < 0) {
+            error_report("error while reading at byte %lld: %s",
+                         sector_num * BDRV_SECTOR_SIZE, strerror(-ret));
+            return ret;
+        }
+        ret = convert_co_write(s, sector_num, n, buf, BLK_DATA);
+        if (ret < 0) {
+            error_report("error while writing at byte %lld: %s",
+                         sector_num * BDRV_SECTOR_SIZE, strerror(-ret));
+            return ret;
+        }
+        sector_num += n;
+        nb_sectors -= n;
+    }
+    return 0;
+}
+
 static void coroutine_fn convert_co_do_copy(void *opaque)
 {
     ImgConvertState *s = opaque;
@@ -2053,15 +2219,22 @@ retry:
                 }
                 if (ret) {
                     s->copy_range = false;
-                    goto retry;
+                    if (n <= s->buf_sectors) {
+                        goto retry;
+                    }
+                    ret = convert_co_copy_bounce(s, sector_num, n, buf);
+                    if (ret < 0) {
+                        s->ret = ret;
+                    }
                 }
             } else {
                 ret = convert_co_write(s, sector_num, n, buf, status);
-            }
-            if (ret < 0) {
-                error_report("error while writing at byte %lld: %s",
-                             sector_num * BDRV_SECTOR_SIZE, strerror(-ret));
-                s->ret = ret;
+                if (ret < 0) {
+                    error_report("error while writing at byte %lld: %s",
+                                 sector_num * BDRV_SECTOR_SIZE,
+                                 strerror(-ret));
+                    s->ret = ret;
+                }
             }
         }
 
@@ -2115,12 +2288,18 @@ static int convert_do_copy(ImgConvertState *s)
         s->buf_sectors = s->cluster_sectors;
     }
 
+    /*
+     * Map the allocation status of the source once, then let the copy
+     * coroutines work from the map instead of querying it again.
+     */
+    s->extents = g_array_new(false, false, sizeof(ImgConvertExtent));
     while (sector_num < s->total_sectors) {
         bdrv_graph_rdlock_main_loop();
         n = convert_iteration_sectors(s, sector_num);
         bdrv_graph_rdunlock_main_loop();
         if (n < 0) {
-            return n;
+            ret = n;
+            goto out;
         }
         if (s->status == BLK_DATA || (!s->min_sparse && s->status == BLK_ZERO))
         {
@@ -2131,6 +2310,8 @@ static int convert_do_copy(ImgConvertState *s)
 
     /* Do the copy */
     s->sector_next_status = 0;
+    s->extents_ready = true;
+    s->extent_cur = 0;
     s->ret = -EINPROGRESS;
 
     qemu_co_mutex_init(&s->lock);
@@ -2148,11 +2329,16 @@ static int convert_do_copy(ImgConvertState *s)
         /* signal EOF to align */
         ret = blk_pwrite_compressed(s->target, 0, 0, NULL);
         if (ret < 0) {
-            return ret;
+            goto out;
         }
     }
+    ret = s->ret;
 
-    return s->ret;
+out:
+    g_array_free(s->extents, true);
+    s->extents = NULL;
+    s->extents_ready = false;
+    return ret;
 }
 
 /* Check that bitmaps can be copied, or output an error */
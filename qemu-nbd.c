@@ -40,6 +40,7 @@
 #include "qapi/qmp/qdict.h"
 #include "qapi/qmp/qstring.h"
 #include "qom/object_interfaces.h"
+#include "sysemu/iothread.h"
 #include "io/channel-socket.h"
 #include "io/net-listener.h"
 #include "crypto/init.h"
@@ -70,6 +71,8 @@
 #define QEMU_NBD_OPT_PID_FILE      265
 #define QEMU_NBD_OPT_SELINUX_LABEL 266
 #define QEMU_NBD_OPT_TLSHOSTNAME   267
+#define QEMU_NBD_OPT_IOTHREADS     268
+#define QEMU_NBD_OPT_ZERO_COPY     269
 
 #define MBR_SIZE 512
 
@@ -97,6 +100,8 @@ static void usage(const char *name)
 "  -k, --socket=PATH         path to the unix socket\n"
 "                            (default '"SOCKET_PATH"')\n"
 "  -e, --shared=NUM          device can be shared by NUM clients (default '1')\n"
+"      --iothreads=NUM       spread client connections over NUM threads\n"
+"      --zero-copy           send read data with MSG_ZEROCOPY\n"
 "  -t, --persistent          don't exit on the last connection\n"
 "  -v, --verbose             display extra debugging information\n"
 "  -x, --export-name=NAME    expose export by name (default is empty string)\n"
@@ -569,6 +574,8 @@ int main(int argc, char **argv)
         { "description", required_argument, NULL, 'D' },
         { "tls-creds", required_argument, NULL, QEMU_NBD_OPT_TLSCREDS },
         { "tls-hostname", required_argument, NULL, QEMU_NBD_OPT_TLSHOSTNAME },
+        { "iothreads", required_argument, NULL, QEMU_NBD_OPT_IOTHREADS },
+        { "zero-copy", no_argument, NULL, QEMU_NBD_OPT_ZERO_COPY },
         { "tls-authz", required_argument, NULL, QEMU_NBD_OPT_TLSAUTHZ },
         { "image-opts", no_argument, NULL, QEMU_NBD_OPT_IMAGE_OPTS },
         { "trace", required_argument, NULL, 'T' },
@@ -602,6 +609,9 @@ int main(int argc, char **argv)
     unsigned socket_activation;
     const char *pid_file_name = NULL;
     const char *selinux_label = NULL;
+    int iothreads = 0, i;
+    bool zero_copy = false;
+    strList *iothread_ids = NULL;
     BlockExportOptions *export_opts;
     struct NbdClientOpts opts = {
         .fork_process = false,
@@ -791,6 +801,16 @@ int main(int argc, char **argv)
         case QEMU_NBD_OPT_TLSHOSTNAME:
             tlshostname = optarg;
             break;
+        case QEMU_NBD_OPT_IOTHREADS:
+            if (qemu_strtoi(optarg, NULL, 0, &iothreads) < 0 ||
+                iothreads < 0) {
+                error_report("Invalid number of iothreads '%s'", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case QEMU_NBD_OPT_ZERO_COPY:
+            zero_copy = true;
+            break;
         case QEMU_NBD_OPT_IMAGE_OPTS:
             imageOpts = true;
             break;
@@ -1151,6 +1171,14 @@ int main(int argc, char **argv)
 
     nbd_server_is_qemu_nbd(shared);
 
+    /* The threads must be created after forking, so that they survive */
+    for (i = iothreads - 1; i >= 0; i--) {
+        g_autofree char *id = g_strdup_printf("qemu-nbd-iothread%d", i);
+
+        iothread_create(id, &error_fatal);
+        QAPI_LIST_PREPEND(iothread_ids, g_strdup(id));
+    }
+
     export_opts = g_new(BlockExportOptions, 1);
     *export_opts = (BlockExportOptions) {
         .type               = BLOCK_EXPORT_TYPE_NBD,
@@ -1167,6 +1195,9 @@ int main(int argc, char **argv)
             .bitmaps              = bitmaps,
             .has_allocation_depth = alloc_depth,
             .allocation_depth     = alloc_depth,
+            .iothreads            = iothread_ids,
+            .has_zero_copy        = zero_copy,
+            .zero_copy            = zero_copy,
         },
     };
     blk_exp_add(export_opts, &error_fatal);
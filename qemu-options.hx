@@ -32,6 +32,8 @@ DEF("machine", HAS_ARG, QEMU_OPTION_machine, \
     "                vmport=on|off|auto controls emulation of vmport (default: auto)\n"
     "                dump-guest-core=on|off include guest memory in a core dump (default=on)\n"
     "                mem-merge=on|off controls memory merge support (default: on)\n"
+    "                map-images=on|off maps boot images into guest RAM (default: off)\n"
+    "                mmio-stats=n times one in n MMIO/PIO accesses (default: 0, off)\n"
     "                aes-key-wrap=on|off controls support for AES key wrapping (default=on)\n"
     "                dea-key-wrap=on|off controls support for DEA key wrapping (default=on)\n"
     "                suppress-vmdesc=on|off disables self-describing migration (default=off)\n"
@@ -79,6 +81,26 @@ SRST
         supported by the host, de-duplicates identical memory pages
         among VMs instances (enabled by default).
 
+    ``map-images=on|off``
+        Map kernel, firmware and other images loaded from files into
+        guest RAM with a private file mapping instead of copying them.
+        Guests booted from the same image then share the pages that
+        they do not modify through the host page cache, from the start
+        and without waiting for KSM. Only the page-aligned part of an
+        unmodified image is mapped, and only at the first reset; RAM
+        with ``share=on``, huge pages, or memory that is pinned (VFIO)
+        or managed by its backend gets the image copied as usual
+        (disabled by default).
+
+    ``mmio-stats=n``
+        Time one in ``n`` accesses dispatched to MMIO and PIO regions,
+        where ``n`` is a power of two, and account them per memory
+        region. The access counts, total times and latency histograms
+        are reported by ``query-stats`` with the ``memory-region``
+        target and by ``info mmio-stats``. The property can be changed
+        at run time with ``qom-set``. 0, the default, disables
+        sampling.
+
     ``aes-key-wrap=on|off``
         Enables or disables AES key wrapping support on s390-ccw hosts.
         This feature controls whether AES wrapping keys will be created
@@ -185,8 +207,16 @@ DEF("accel", HAS_ARG, QEMU_OPTION_accel,
     "                kernel-irqchip=on|off|split controls accelerated irqchip support (default=on)\n"
     "                kvm-shadow-mem=size of KVM shadow MMU in bytes\n"
     "                one-insn-per-tb=on|off (one guest instruction per TCG translation block)\n"
+    "                profile=file,profile-hz=n (write a sampled TCG guest profile to file)\n"
     "                split-wx=on|off (enable TCG split w^x mapping)\n"
+    "                tb-cache=file (keep TCG translation blocks between runs)\n"
     "                tb-size=n (TCG translation block cache size)\n"
+    "                tb-hugepages=on|off (back the TCG translation block cache with huge pages)\n"
+    "                tb-cold-code=on|off (keep TCG slow paths apart from the translation blocks)\n"
+    "                tb-region-size=n (size of each region of the TCG translation block cache)\n"
+    "                tb-warmup=n (TCG executions of a translation block before it is optimized)\n"
+    "                tlb-victim-size=n,tlb-victim-ways=n (TCG victim TLB geometry)\n"
+    "                tlb-min-bits=n (log2 of the minimum TCG TLB size)\n"
     "                dirty-ring-size=n (KVM dirty ring GFN count, default 0)\n"
     "                eager-split-size=n (KVM Eager Page Split chunk size, default 0, disabled. ARM only)\n"
     "                notify-vmexit=run|internal-error|disable,notify-window=n (enable notify VM exit and set notify window, x86 only)\n"
@@ -230,6 +260,78 @@ SRST
     ``tb-size=n``
         Controls the size (in MiB) of the TCG translation block cache.
 
+    ``tb-hugepages=on|off``
+        Aligns the TCG translation block cache, and the regions it is
+        split into, to 2 MiB so that the host can back them with huge
+        pages.  With ``split-wx=on`` both mappings are aligned, and
+        hugetlbfs pages are used if the host has any reserved.  This
+        cuts the iTLB misses of guests that run a lot of different code.
+        Guard pages between the regions are not used in this mode.
+        The default is off.
+
+    ``tb-cold-code=on|off``
+        Keeps the out of line slow paths of guest loads and stores in the
+        last quarter of each region of the TCG translation block cache,
+        instead of right after the translation block that uses them.  The
+        fast paths of the blocks then sit closer together, which helps
+        the host instruction cache and branch predictors on guests with
+        a large working set, at the cost of less flexible use of the
+        cache.  The slow paths are not shown by ``-d out_asm``.  Only
+        supported on x86 hosts, and ignored elsewhere.  The default is
+        off.
+
+    ``tb-region-size=n``
+        Sets the size (in MiB) of each of the regions that the TCG
+        translation block cache is split into.  Each vCPU thread
+        translates into a region of its own and takes a new one when it
+        is full, so smaller regions waste less space when some vCPUs
+        translate much more code than others.  There is always at least
+        one region per vCPU thread.  The default is to pick a size based
+        on the cache size and the number of vCPUs.  Only available in
+        system emulation.
+
+    ``tb-warmup=n``
+        Translates new blocks without running the TCG optimizer, and
+        translates each block again with full optimization after it has
+        been executed ``n`` times.  Blocks that are still warming up are not
+        chained to each other.  This lowers the translation latency of code
+        that only runs a few times, such as when a new process starts.  On
+        targets that support it, the optimized translation also follows
+        direct jumps forward within the page, making a larger block.  The
+        default is 0, which optimizes every block when it is first
+        translated.  At most 65535.
+
+    ``tlb-victim-size=n,tlb-victim-ways=n``
+        Sets the number of entries of the second level (victim) TLB that
+        backs the software TLB of each MMU mode, and its associativity.
+        Both must be powers of 2.  The default is a fully associative TLB
+        of 8 entries.  A set associative victim TLB can be made much larger
+        at the same lookup cost.  Misses and victim TLB hits are reported
+        by ``info jit``.  Only available in system emulation.
+
+    ``tlb-min-bits=n``
+        Sets the log2 of the minimum number of entries of the software TLB
+        of each MMU mode.  The TLB is still resized dynamically, but it does
+        not shrink below this size.  Only available in system emulation.
+
+    ``tb-cache=file``
+        Records the translation blocks that are live when QEMU exits in
+        ``file``, and translates them again when the guest starts running
+        on the next invocation, instead of as each block is first reached.
+        A block is only translated again if its guest code is unchanged at
+        the same address, so the cache can be shared between runs of
+        different guest images.  Only available in system emulation.
+
+    ``profile=file,profile-hz=n``
+        Samples the vCPU threads ``n`` times per second of the CPU time
+        they use (1000 by default) and writes the guest functions they
+        were running to ``file`` when QEMU exits, in the folded format
+        that flame graph tools read: one ``cpuN;function count`` line per
+        function.  Functions are named after the symbols of the ELF
+        images that QEMU loaded; time spent outside translated code,
+        for instance in helpers, counts as ``[qemu]``.  Only available in
+        system emulation on Linux x86-64, AArch64 and RISC-V hosts.
+
     ``thread=single|multi``
         Controls number of TCG threads. When the TCG is multi-threaded
         there will be one thread per vCPU therefore taking advantage of
@@ -2628,6 +2730,13 @@ SRST
     ``power-control=on|off``
         Permit the remote client to issue shutdown, reboot or reset power
         control requests.
+
+    ``encode-threads=n``
+        Encode the rectangles of each framebuffer update with up to n
+        threads (default 1, at most 16).  Not used with the zlib, ZRLE
+        and ZYWRLE encodings.  With more than one thread, tight encoding
+        resets its zlib streams for every rectangle, trading some
+        compression ratio for encoding throughput.
 ERST
 
 ARCHHEADING(, QEMU_ARCH_I386)
@@ -2903,10 +3012,13 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
 #endif
 #ifdef CONFIG_AF_XDP
     "-netdev af-xdp,id=str,ifname=name[,mode=native|skb][,force-copy=on|off]\n"
+    "         [,zero-copy=on|off][,busy-poll=usecs]\n"
     "         [,queues=n][,start-queue=m][,inhibit=on|off][,sock-fds=x:y:...:z]\n"
     "                attach to the existing network interface 'name' with AF_XDP socket\n"
     "                use 'mode=MODE' to specify an XDP program attach mode\n"
     "                use 'force-copy=on|off' to force XDP copy mode even if device supports zero-copy (default: off)\n"
+    "                use 'zero-copy=on|off' to fail if the device does not support zero-copy (default: off)\n"
+    "                use 'busy-poll=usecs' to busy poll the device queues (default: 0, off)\n"
     "                use 'inhibit=on|off' to inhibit loading of a default XDP program (default: off)\n"
     "                with inhibit=on,\n"
     "                  use 'sock-fds' to provide file descriptors for already open AF_XDP sockets\n"
@@ -3416,7 +3528,7 @@ SRST
         # launch QEMU instance
         |qemu_system| linux.img -nic vde,sock=/tmp/myswitch
 
-``-netdev af-xdp,id=str,ifname=name[,mode=native|skb][,force-copy=on|off][,queues=n][,start-queue=m][,inhibit=on|off][,sock-fds=x:y:...:z]``
+``-netdev af-xdp,id=str,ifname=name[,mode=native|skb][,force-copy=on|off][,zero-copy=on|off][,busy-poll=usecs][,queues=n][,start-queue=m][,inhibit=on|off][,sock-fds=x:y:...:z]``
     Configure AF_XDP backend to connect to a network interface 'name'
     using AF_XDP socket.  A specific program attach mode for a default
     XDP program can be forced with 'mode', defaults to best-effort,
@@ -3425,6 +3537,14 @@ SRST
     defaults to 1.  Traffic arriving on non-configured device queues will
     not be delivered to the network backend.
 
+    'zero-copy=on' makes the setup fail if the device cannot use the
+    socket buffers directly, instead of silently falling back to copy
+    mode.  'busy-poll' sets the socket busy poll timeout and makes QEMU
+    drive the device queues itself whenever it services the socket, so
+    that the driver can keep interrupts disabled under load.  It works
+    best together with the ``napi_defer_hard_irqs`` and
+    ``gro_flush_timeout`` settings of the interface.
+
     .. parsed-literal::
 
         # set number of queues to 4
@@ -3532,16 +3652,18 @@ DEF("chardev", HAS_ARG, QEMU_OPTION_chardev,
     "-chardev null,id=id[,mux=on|off][,logfile=PATH][,logappend=on|off]\n"
     "-chardev socket,id=id[,host=host],port=port[,to=to][,ipv4=on|off][,ipv6=on|off][,nodelay=on|off]\n"
     "         [,server=on|off][,wait=on|off][,telnet=on|off][,websocket=on|off][,reconnect=seconds][,mux=on|off]\n"
-    "         [,logfile=PATH][,logappend=on|off][,tls-creds=ID][,tls-authz=ID] (tcp)\n"
+    "         [,coalesce-ms=ms][,logfile=PATH][,logappend=on|off][,tls-creds=ID][,tls-authz=ID] (tcp)\n"
     "-chardev socket,id=id,path=path[,server=on|off][,wait=on|off][,telnet=on|off][,websocket=on|off][,reconnect=seconds]\n"
-    "         [,mux=on|off][,logfile=PATH][,logappend=on|off][,abstract=on|off][,tight=on|off] (unix)\n"
+    "         [,mux=on|off][,logfile=PATH][,logappend=on|off][,abstract=on|off][,tight=on|off]\n"
+    "         [,coalesce-ms=ms] (unix)\n"
     "-chardev udp,id=id[,host=host],port=port[,localaddr=localaddr]\n"
     "         [,localport=localport][,ipv4=on|off][,ipv6=on|off][,mux=on|off]\n"
     "         [,logfile=PATH][,logappend=on|off]\n"
     "-chardev msmouse,id=id[,mux=on|off][,logfile=PATH][,logappend=on|off]\n"
     "-chardev vc,id=id[[,width=width][,height=height]][[,cols=cols][,rows=rows]]\n"
     "         [,mux=on|off][,logfile=PATH][,logappend=on|off]\n"
-    "-chardev ringbuf,id=id[,size=size][,logfile=PATH][,logappend=on|off]\n"
+    "-chardev ringbuf,id=id[,size=size][,path=path]\n"
+    "         [,logfile=PATH][,logappend=on|off]\n"
     "-chardev file,id=id,path=path[,input-path=input-file][,mux=on|off][,logfile=PATH][,logappend=on|off]\n"
     "-chardev pipe,id=id,path=path[,mux=on|off][,logfile=PATH][,logappend=on|off]\n"
 #ifdef _WIN32
@@ -3644,7 +3766,7 @@ The available backends are:
     A void device. This device will not emit any data, and will drop any
     data it receives. The null backend does not take any options.
 
-``-chardev socket,id=id[,TCP options or unix options][,server=on|off][,wait=on|off][,telnet=on|off][,websocket=on|off][,reconnect=seconds][,tls-creds=id][,tls-authz=id]``
+``-chardev socket,id=id[,TCP options or unix options][,server=on|off][,wait=on|off][,telnet=on|off][,websocket=on|off][,reconnect=seconds][,coalesce-ms=ms][,tls-creds=id][,tls-authz=id]``
     Create a two-way stream socket, which can be either a TCP or a unix
     socket. A unix socket will be created if ``path`` is specified.
     Behaviour is undefined if TCP options are specified for a unix
@@ -3666,6 +3788,11 @@ The available backends are:
     seconds and then attempt to reconnect. Zero disables reconnecting,
     and is the default.
 
+    ``coalesce-ms`` holds the output back for up to this many
+    milliseconds, so that frontends writing a byte at a time do not
+    cost a syscall per byte. Zero, the default, sends every write
+    immediately.
+
     ``tls-creds`` requests enablement of the TLS protocol for
     encryption, and specifies the id of the TLS credentials to use for
     the handshake. The credentials must be previously created with the
@@ -3741,10 +3868,16 @@ The available backends are:
     ``cols`` and ``rows`` specify that the console be sized to fit a
     text console with the given dimensions.
 
-``-chardev ringbuf,id=id[,size=size]``
+``-chardev ringbuf,id=id[,size=size][,path=path]``
     Create a ring buffer with fixed size ``size``. size must be a power
     of two and defaults to ``64K``.
 
+    ``path`` places the ring buffer in a file, which is created or
+    truncated, so that other processes can ``mmap`` it and follow the
+    output without going through the monitor.  The file starts with a
+    64 byte header, ``struct RingBufShm`` in ``chardev/char-ringbuf.c``,
+    that describes how to read it without locking.
+
 ``-chardev file,id=id,path=path[,input-path=input-path]``
     Log all traffic received from the guest to a file.
 
@@ -4650,13 +4783,13 @@ SRST
 ERST
 
 DEF("icount", HAS_ARG, QEMU_OPTION_icount, \
-    "-icount [shift=N|auto][,align=on|off][,sleep=on|off][,rr=record|replay,rrfile=<filename>[,rrsnapshot=<snapshot>]]\n" \
+    "-icount [shift=N|auto][,align=on|off][,sleep=on|off][,iosync=insn|tb][,rr=record|replay,rrfile=<filename>[,rrsnapshot=<snapshot>][,rrcheckpoint=<n>]]\n" \
     "                enable virtual instruction counter with 2^N clock ticks per\n" \
     "                instruction, enable aligning the host and virtual clocks\n" \
     "                or disable real time cpu sleeping, and optionally enable\n" \
     "                record-and-replay mode\n", QEMU_ARCH_ALL)
 SRST
-``-icount [shift=N|auto][,align=on|off][,sleep=on|off][,rr=record|replay,rrfile=filename[,rrsnapshot=snapshot]]``
+``-icount [shift=N|auto][,align=on|off][,sleep=on|off][,iosync=insn|tb][,rr=record|replay,rrfile=filename[,rrsnapshot=snapshot][,rrcheckpoint=n]]``
     Enable virtual instruction counter. The virtual cpu will execute one
     instruction every 2^N ns of virtual time. If ``auto`` is specified
     then the virtual cpu speed will be automatically adjusted to keep
@@ -4690,6 +4823,17 @@ SRST
     depends on the host machine). The default if icount is enabled
     is ``align=off``.
 
+    ``iosync`` selects how device accesses are kept in step with the
+    instruction counter. With the default ``iosync=insn``, a translation
+    block is cut short at every instruction that touches a device, which
+    costs a retranslation and an exit from the generated code each time.
+    With ``iosync=tb``, the instruction runs in place and only the
+    instruction count is corrected for the access, so device models see
+    the same time; however, interrupts raised by the access are taken at
+    the end of the translation block rather than right after the
+    instruction. Execution is still deterministic, but it differs from
+    ``iosync=insn`` and cannot be used with record/replay.
+
     When the ``rr`` option is specified deterministic record/replay is
     enabled. The ``rrfile=`` option must also be provided to
     specify the path to the replay log. In record mode data is written
@@ -4698,6 +4842,10 @@ SRST
     name. In record mode, a new VM snapshot with the given name is created
     at the start of execution recording. In replay mode this option
     specifies the snapshot name used to load the initial VM state.
+    In replay mode, ``rrcheckpoint=n`` keeps an in-memory checkpoint of
+    the VM every ``n`` instructions, which makes seeking backwards
+    during reverse debugging much faster. Checkpoints do not include
+    disk contents, so they are only used when no disk is writable.
 ERST
 
 DEF("watchdog-action", HAS_ARG, QEMU_OPTION_watchdog_action, \
@@ -5215,6 +5363,28 @@ SRST
 
         The ``share`` boolean option is on by default with memfd.
 
+    ``-object memory-backend-zpool,id=id,merge=on|off,dump=on|off,prealloc=on|off,size=size,host-nodes=host-nodes,policy=default|preferred|bind|interleave,scan-interval=ms,scan-pages=n,cold-age=n,compress-level=n``
+        Creates an anonymous memory backend object that compresses idle
+        guest pages into a pool inside QEMU, and decompresses them when
+        the guest touches them again. (Linux only, requires zstd)
+
+        Every ``scan-interval`` milliseconds (1000 by default) a scanner
+        visits ``scan-pages`` pages (16384 by default) and
+        write-protects them with userfaultfd. A page that is not written
+        for ``cold-age`` passes (8 by default) is compressed at zstd
+        level ``compress-level`` (1 by default) and dropped from the
+        host. Reads are not tracked, so pages that are only read are
+        compressed and faulted back once every ``cold-age`` passes.
+        The ``evicted-pages`` and ``pool-size`` read-only properties
+        report the number of compressed pages and the size of the pool.
+
+        The backend uses userfaultfd itself and cannot be combined with
+        postcopy migration, background snapshots or devices that pin
+        guest memory such as VFIO. ``share=on`` is not supported.
+
+        Please refer to ``memory-backend-file`` for a description of the
+        other options.
+
     ``-object iommufd,id=id[,fd=fd]``
         Creates an iommufd backend which allows control of DMA mapping
         through the ``/dev/iommu`` device.
@@ -48,7 +48,8 @@ void json_message_process_token(JSONLexer *lexer, GString *input,
                                 JSONTokenType type, int x, int y);
 
 /* json-parser.c */
-JSONToken *json_token(JSONTokenType type, int x, int y, GString *tokstr);
-QObject *json_parser_parse(GQueue *tokens, va_list *ap, Error **errp);
+void json_token_push(GByteArray *tokens, JSONTokenType type, int x, int y,
+                     GString *tokstr);
+QObject *json_parser_parse(GByteArray *tokens, va_list *ap, Error **errp);
 
 #endif
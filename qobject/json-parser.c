@@ -24,17 +24,24 @@
 #include "qapi/qmp/qstring.h"
 #include "json-parser-int.h"
 
+/*
+ * The tokens of a message are stored back to back in one buffer, which
+ * the streamer reuses from one message to the next.  @size is the
+ * offset of the next token.
+ */
 struct JSONToken {
     JSONTokenType type;
     int x;
     int y;
+    unsigned int size;
     char str[];
 };
 
 typedef struct JSONParserContext {
     Error *err;
     JSONToken *current;
-    GQueue *buf;
+    GByteArray *buf;
+    unsigned int pos;
     va_list *ap;
 } JSONParserContext;
 
@@ -239,16 +246,21 @@ out:
  * parser_context_pop_token is deleted as soon as parser_context_pop_token
  * is called again.
  */
-static JSONToken *parser_context_pop_token(JSONParserContext *ctxt)
+static JSONToken *parser_context_peek_token(JSONParserContext *ctxt)
 {
-    g_free(ctxt->current);
-    ctxt->current = g_queue_pop_head(ctxt->buf);
-    return ctxt->current;
+    if (ctxt->pos == ctxt->buf->len) {
+        return NULL;
+    }
+    return (JSONToken *)(ctxt->buf->data + ctxt->pos);
 }
 
-static JSONToken *parser_context_peek_token(JSONParserContext *ctxt)
+static JSONToken *parser_context_pop_token(JSONParserContext *ctxt)
 {
-    return g_queue_peek_head(ctxt->buf);
+    ctxt->current = parser_context_peek_token(ctxt);
+    if (ctxt->current) {
+        ctxt->pos += ctxt->current->size;
+    }
+    return ctxt->current;
 }
 
 /**
@@ -559,32 +571,33 @@ static QObject *parse_value(JSONParserContext *ctxt)
     }
 }
 
-JSONToken *json_token(JSONTokenType type, int x, int y, GString *tokstr)
+void json_token_push(GByteArray *tokens, JSONTokenType type, int x, int y,
+                     GString *tokstr)
 {
-    JSONToken *token = g_malloc(sizeof(JSONToken) + tokstr->len + 1);
+    unsigned int pos = tokens->len;
+    unsigned int size = QEMU_ALIGN_UP(sizeof(JSONToken) + tokstr->len + 1,
+                                      __alignof__(JSONToken));
+    JSONToken *token;
 
+    g_byte_array_set_size(tokens, pos + size);
+    token = (JSONToken *)(tokens->data + pos);
     token->type = type;
-    memcpy(token->str, tokstr->str, tokstr->len);
-    token->str[tokstr->len] = 0;
     token->x = x;
     token->y = y;
-    return token;
+    token->size = size;
+    memcpy(token->str, tokstr->str, tokstr->len);
+    token->str[tokstr->len] = 0;
 }
 
-QObject *json_parser_parse(GQueue *tokens, va_list *ap, Error **errp)
+QObject *json_parser_parse(GByteArray *tokens, va_list *ap, Error **errp)
 {
     JSONParserContext ctxt = { .buf = tokens, .ap = ap };
     QObject *result;
 
     result = parse_value(&ctxt);
-    assert(ctxt.err || g_queue_is_empty(ctxt.buf));
+    assert(ctxt.err || ctxt.pos == tokens->len);
 
     error_propagate(errp, ctxt.err);
 
-    while (!g_queue_is_empty(ctxt.buf)) {
-        parser_context_pop_token(&ctxt);
-    }
-    g_free(ctxt.current);
-
     return result;
 }
@@ -19,13 +19,18 @@
 #define MAX_TOKEN_COUNT (2ULL << 20)
 #define MAX_NESTING (1 << 10)
 
+/* Token buffers up to this size are kept for the next message */
+#define TOKENS_KEEP_SIZE (64 * 1024)
+
 static void json_message_free_tokens(JSONMessageParser *parser)
 {
-    JSONToken *token;
-
-    while ((token = g_queue_pop_head(&parser->tokens))) {
-        g_free(token);
+    if (parser->tokens->len > TOKENS_KEEP_SIZE) {
+        g_byte_array_unref(parser->tokens);
+        parser->tokens = g_byte_array_new();
+    } else {
+        g_byte_array_set_size(parser->tokens, 0);
     }
+    parser->token_count = 0;
 }
 
 void json_message_process_token(JSONLexer *lexer, GString *input,
@@ -34,7 +39,6 @@ void json_message_process_token(JSONLexer *lexer, GString *input,
     JSONMessageParser *parser = container_of(lexer, JSONMessageParser, lexer);
     QObject *json = NULL;
     Error *err = NULL;
-    JSONToken *token;
 
     switch (type) {
     case JSON_LCURLY:
@@ -53,10 +57,10 @@ void json_message_process_token(JSONLexer *lexer, GString *input,
         error_setg(&err, "JSON parse error, stray '%s'", input->str);
         goto out_emit;
     case JSON_END_OF_INPUT:
-        if (g_queue_is_empty(&parser->tokens)) {
+        if (!parser->token_count) {
             return;
         }
-        json = json_parser_parse(&parser->tokens, parser->ap, &err);
+        json = json_parser_parse(parser->tokens, parser->ap, &err);
         goto out_emit;
     default:
         break;
@@ -70,7 +74,7 @@ void json_message_process_token(JSONLexer *lexer, GString *input,
         error_setg(&err, "JSON token size limit exceeded");
         goto out_emit;
     }
-    if (g_queue_get_length(&parser->tokens) + 1 > MAX_TOKEN_COUNT) {
+    if (parser->token_count + 1 > MAX_TOKEN_COUNT) {
         error_setg(&err, "JSON token count limit exceeded");
         goto out_emit;
     }
@@ -79,17 +83,16 @@ void json_message_process_token(JSONLexer *lexer, GString *input,
         goto out_emit;
     }
 
-    token = json_token(type, x, y, input);
+    json_token_push(parser->tokens, type, x, y, input);
+    parser->token_count++;
     parser->token_size += input->len;
 
-    g_queue_push_tail(&parser->tokens, token);
-
     if ((parser->brace_count > 0 || parser->bracket_count > 0)
         && parser->brace_count >= 0 && parser->bracket_count >= 0) {
         return;
     }
 
-    json = json_parser_parse(&parser->tokens, parser->ap, &err);
+    json = json_parser_parse(parser->tokens, parser->ap, &err);
 
 out_emit:
     parser->brace_count = 0;
@@ -109,7 +112,8 @@ void json_message_parser_init(JSONMessageParser *parser,
     parser->ap = ap;
     parser->brace_count = 0;
     parser->bracket_count = 0;
-    g_queue_init(&parser->tokens);
+    parser->tokens = g_byte_array_new();
+    parser->token_count = 0;
     parser->token_size = 0;
 
     json_lexer_init(&parser->lexer, !!ap);
@@ -124,11 +128,12 @@ void json_message_parser_feed(JSONMessageParser *parser,
 void json_message_parser_flush(JSONMessageParser *parser)
 {
     json_lexer_flush(&parser->lexer);
-    assert(g_queue_is_empty(&parser->tokens));
+    assert(!parser->token_count);
 }
 
 void json_message_parser_destroy(JSONMessageParser *parser)
 {
     json_lexer_destroy(&parser->lexer);
-    json_message_free_tokens(parser);
+    g_byte_array_unref(parser->tokens);
+    parser->tokens = NULL;
 }
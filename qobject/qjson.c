@@ -226,6 +226,16 @@ GString *qobject_to_json_pretty(const QObject *obj, bool pretty)
     return json_writer_get_and_free(writer);
 }
 
+void qobject_to_json_stream(const QObject *obj, bool pretty,
+                            JSONWriterFlushFunc *flush, void *opaque)
+{
+    g_autoptr(JSONWriter) writer = json_writer_new_stream(pretty, flush,
+                                                          opaque);
+
+    to_json(writer, NULL, obj);
+    json_writer_flush(writer);
+}
+
 GString *qobject_to_json(const QObject *obj)
 {
     return qobject_to_json_pretty(obj, false);
@@ -1123,22 +1123,53 @@ typedef struct OCFData
     void *opaque;
 } OCFData;
 
+/*
+ * Can @type implement @target?  Answered from the TypeInfo names only,
+ * so that enumerating, say, the machine types does not initialize the
+ * class of every type that was registered.
+ */
+static bool type_may_implement(TypeImpl *type, TypeImpl *target)
+{
+    int i;
+
+    for (; type; type = type_get_parent(type)) {
+        if (type == target) {
+            return true;
+        }
+        for (i = 0; i < type->num_interfaces; i++) {
+            TypeImpl *iface = type_get_by_name(type->interfaces[i].typename);
+
+            if (iface && type_is_ancestor(iface, target)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
 static void object_class_foreach_tramp(gpointer key, gpointer value,
                                        gpointer opaque)
 {
     OCFData *data = opaque;
     TypeImpl *type = value;
+    TypeImpl *target = NULL;
     ObjectClass *k;
 
-    type_initialize(type);
-    k = type->class;
-
     if (!data->include_abstract && type->abstract) {
         return;
     }
 
-    if (data->implements_type && 
-        !object_class_dynamic_cast(k, data->implements_type)) {
+    if (data->implements_type) {
+        target = type_get_by_name(data->implements_type);
+        if (!target || !type_may_implement(type, target)) {
+            return;
+        }
+    }
+
+    type_initialize(type);
+    k = type->class;
+
+    if (target && !object_class_dynamic_cast(k, data->implements_type)) {
         return;
     }
 
@@ -0,0 +1,367 @@
+/*
+ * replay-checkpoint.c
+ *
+ * In-memory checkpoints for seeking during replay
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qemu/error-report.h"
+#include "qemu/main-loop.h"
+#include "qemu/timer.h"
+#include "sysemu/replay.h"
+#include "sysemu/runstate.h"
+#include "sysemu/block-backend.h"
+#include "exec/memory.h"
+#include "exec/ramblock.h"
+#include "exec/target_page.h"
+#include "exec/tb-flush.h"
+#include "hw/core/cpu.h"
+#include "migration/snapshot.h"
+#include "replay-internal.h"
+
+/*
+ * Checkpoints are taken every replay_checkpoint_interval instructions of
+ * the replay.  The first one holds a full copy of guest RAM; each of the
+ * others only holds the pages that were dirtied since the one before, as
+ * they were when the checkpoint was taken.  All of them hold the full
+ * device state, which is small.
+ *
+ * RAM always derives from one checkpoint C, the newest one taken or the
+ * last one restored, plus the pages dirty right now.  Restoring
+ * checkpoint N only needs to write back those pages and the pages of the
+ * checkpoints between C and N.  The content of each of them at N is in
+ * the newest checkpoint up to N that saved the page.  After a snapshot
+ * load, C is unknown and all of RAM is written back.
+ *
+ * The replay is deterministic, so checkpoints stay valid after seeking
+ * back, and new ones are only taken past the newest one.  Disk contents
+ * are not part of a checkpoint, so checkpoints are not used when the
+ * guest can write to a disk.
+ */
+
+/* Older checkpoints are merged once there are more than this */
+#define REPLAY_MAX_CHECKPOINTS 256
+
+typedef struct ReplayCheckpoint {
+    uint64_t icount;
+    GByteArray *devices;
+    /* one table per RAM block, page index -> page contents */
+    GHashTable **pages;
+} ReplayCheckpoint;
+
+typedef struct ReplayRAMBlock {
+    RAMBlock *rb;
+    uint8_t *base;      /* RAM at the first checkpoint */
+    uint64_t npages;
+} ReplayRAMBlock;
+
+uint64_t replay_checkpoint_interval;
+
+static GArray *replay_blocks;
+static GPtrArray *replay_checkpoints;
+static QEMUTimer *replay_checkpoint_timer;
+static uint64_t replay_next_checkpoint = -1ULL;
+static bool replay_checkpoint_broken;
+/* Index of the checkpoint that RAM derives from, or -1 if unknown */
+static int replay_checkpoint_current = -1;
+
+static int replay_add_ram_block(RAMBlock *rb, void *opaque)
+{
+    ReplayRAMBlock block = {
+        .rb = rb,
+        .npages = qemu_ram_get_used_length(rb) / qemu_target_page_size(),
+    };
+
+    if (qemu_ram_is_migratable(rb)) {
+        g_array_append_val(replay_blocks, block);
+    }
+    return 0;
+}
+
+static ReplayCheckpoint *replay_checkpoint_new(void)
+{
+    ReplayCheckpoint *cp = g_new0(ReplayCheckpoint, 1);
+    guint i;
+
+    cp->devices = g_byte_array_new();
+    cp->pages = g_new(GHashTable *, replay_blocks->len);
+    for (i = 0; i < replay_blocks->len; i++) {
+        cp->pages[i] = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+    }
+    return cp;
+}
+
+static void replay_checkpoint_free(gpointer opaque)
+{
+    ReplayCheckpoint *cp = opaque;
+    guint i;
+
+    for (i = 0; i < replay_blocks->len; i++) {
+        g_hash_table_destroy(cp->pages[i]);
+    }
+    g_free(cp->pages);
+    g_byte_array_free(cp->devices, true);
+    g_free(cp);
+}
+
+static ReplayCheckpoint *replay_checkpoint_get(guint n)
+{
+    return g_ptr_array_index(replay_checkpoints, n);
+}
+
+/* Return the dirty bitmap of @block since the last call, and clear it */
+static DirtyBitmapSnapshot *replay_snapshot_dirty(ReplayRAMBlock *block)
+{
+    ram_addr_t size = qemu_ram_get_used_length(block->rb);
+
+    return memory_region_snapshot_and_clear_dirty(block->rb->mr, 0, size,
+                                                  DIRTY_MEMORY_MIGRATION);
+}
+
+static bool replay_page_dirty(ReplayRAMBlock *block, DirtyBitmapSnapshot *snap,
+                              uint64_t page)
+{
+    size_t page_size = qemu_target_page_size();
+
+    return memory_region_snapshot_get_dirty(block->rb->mr, snap,
+                                            page * page_size, page_size);
+}
+
+/*
+ * Merge checkpoint N into the next one: pages that were not dirtied in
+ * between had the same contents at both.
+ */
+static void replay_checkpoint_merge(guint n)
+{
+    ReplayCheckpoint *cp = replay_checkpoint_get(n);
+    ReplayCheckpoint *next = replay_checkpoint_get(n + 1);
+    GHashTableIter iter;
+    gpointer key, value;
+    guint i;
+
+    for (i = 0; i < replay_blocks->len; i++) {
+        g_hash_table_iter_init(&iter, cp->pages[i]);
+        while (g_hash_table_iter_next(&iter, &key, &value)) {
+            if (!g_hash_table_contains(next->pages[i], key)) {
+                g_hash_table_iter_steal(&iter);
+                g_hash_table_insert(next->pages[i], key, value);
+            }
+        }
+    }
+    g_ptr_array_remove_index(replay_checkpoints, n);
+}
+
+static bool replay_checkpoint_take(Error **errp)
+{
+    ReplayCheckpoint *cp = replay_checkpoint_new();
+    size_t page_size = qemu_target_page_size();
+    bool first = replay_checkpoints->len == 0;
+    guint i;
+    uint64_t page;
+
+    for (i = 0; i < replay_blocks->len; i++) {
+        ReplayRAMBlock *block = &g_array_index(replay_blocks,
+                                               ReplayRAMBlock, i);
+        uint8_t *host = qemu_ram_get_host_addr(block->rb);
+        g_autofree DirtyBitmapSnapshot *snap = replay_snapshot_dirty(block);
+
+        if (first) {
+            block->base = g_memdup2(host, block->npages * page_size);
+            continue;
+        }
+        for (page = 0; page < block->npages; page++) {
+            if (replay_page_dirty(block, snap, page)) {
+                g_hash_table_insert(cp->pages[i], (gpointer)(uintptr_t)page,
+                                    g_memdup2(host + page * page_size,
+                                              page_size));
+            }
+        }
+    }
+
+    if (!save_device_state_buffer(cp->devices, errp)) {
+        replay_checkpoint_free(cp);
+        return false;
+    }
+
+    cp->icount = replay_get_current_icount();
+    g_ptr_array_add(replay_checkpoints, cp);
+    if (replay_checkpoints->len > REPLAY_MAX_CHECKPOINTS) {
+        /* keep the base, lose resolution in the distant past */
+        replay_checkpoint_merge(1);
+    }
+    replay_checkpoint_current = replay_checkpoints->len - 1;
+    return true;
+}
+
+static void replay_checkpoint_timer_cb(void *opaque)
+{
+    Error *err = NULL;
+
+    /*
+     * Give up for now if the VM was stopped, e.g. by a replay break, or
+     * there are async events in flight; we come back at the next block.
+     */
+    if (!runstate_is_running() || !replay_can_snapshot()) {
+        return;
+    }
+
+    vm_stop(RUN_STATE_SAVE_VM);
+    if (!replay_checkpoint_take(&err)) {
+        error_report_err(err);
+        warn_report("replay: disabling in-memory checkpoints");
+        replay_checkpoint_broken = true;
+    } else {
+        replay_next_checkpoint = replay_get_current_icount() +
+                                 replay_checkpoint_interval;
+    }
+    vm_start();
+}
+
+void replay_checkpoint_check(uint64_t icount)
+{
+    if (icount >= replay_next_checkpoint && !replay_checkpoint_broken) {
+        /* Cannot stop the VM from the vCPU thread */
+        timer_mod_ns(replay_checkpoint_timer,
+                     qemu_clock_get_ns(QEMU_CLOCK_REALTIME));
+    }
+}
+
+static bool replay_checkpoint_disks_writable(void)
+{
+    BlockBackend *blk;
+
+    for (blk = blk_all_next(NULL); blk; blk = blk_all_next(blk)) {
+        if (blk_is_inserted(blk) && blk_is_writable(blk)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void replay_checkpoint_init(void)
+{
+    if (replay_mode != REPLAY_MODE_PLAY || !replay_checkpoint_interval) {
+        return;
+    }
+    if (replay_checkpoint_disks_writable()) {
+        warn_report("replay: in-memory checkpoints do not cover disks, "
+                    "not using them because a disk is writable");
+        return;
+    }
+
+    replay_blocks = g_array_new(false, false, sizeof(ReplayRAMBlock));
+    qemu_ram_foreach_block(replay_add_ram_block, NULL);
+    replay_checkpoints =
+        g_ptr_array_new_with_free_func(replay_checkpoint_free);
+    replay_checkpoint_timer = timer_new_ns(QEMU_CLOCK_REALTIME,
+                                           replay_checkpoint_timer_cb, NULL);
+    memory_global_dirty_log_start(GLOBAL_DIRTY_REPLAY);
+    replay_next_checkpoint = 0;
+}
+
+int64_t replay_checkpoint_find(uint64_t icount)
+{
+    int64_t res = -1;
+    guint i;
+
+    for (i = 0; replay_checkpoints && i < replay_checkpoints->len; i++) {
+        uint64_t cp_icount = replay_checkpoint_get(i)->icount;
+
+        if (cp_icount > icount) {
+            break;
+        }
+        res = cp_icount;
+    }
+    return res;
+}
+
+/* Copy the contents of @page at checkpoint N back into @block */
+static void replay_restore_page(guint n, guint block_idx, uint64_t page)
+{
+    ReplayRAMBlock *block = &g_array_index(replay_blocks, ReplayRAMBlock,
+                                           block_idx);
+    size_t page_size = qemu_target_page_size();
+    uint8_t *host = qemu_ram_get_host_addr(block->rb);
+    const uint8_t *src = NULL;
+
+    for (; n > 0 && !src; n--) {
+        src = g_hash_table_lookup(replay_checkpoint_get(n)->pages[block_idx],
+                                  (gpointer)(uintptr_t)page);
+    }
+    if (!src) {
+        src = block->base + page * page_size;
+    }
+    memcpy(host + page * page_size, src, page_size);
+}
+
+void replay_checkpoint_forget(void)
+{
+    replay_checkpoint_current = -1;
+}
+
+bool replay_checkpoint_restore(uint64_t icount, Error **errp)
+{
+    ReplayCheckpoint *cp = NULL;
+    guint n, i, later, first, last;
+    uint64_t page;
+
+    for (n = 0; n < replay_checkpoints->len; n++) {
+        if (replay_checkpoint_get(n)->icount == icount) {
+            cp = replay_checkpoint_get(n);
+            break;
+        }
+    }
+    assert(cp);
+
+    /* The checkpoints whose pages changed between the current one and N */
+    if (replay_checkpoint_current < 0) {
+        first = last = 0;
+    } else {
+        first = MIN(n, replay_checkpoint_current) + 1;
+        last = MAX(n, replay_checkpoint_current);
+    }
+
+    /* Same as load_snapshot(), minus the disks */
+    replay_flush_events();
+    qemu_system_reset(SHUTDOWN_CAUSE_SNAPSHOT_LOAD);
+
+    for (i = 0; i < replay_blocks->len; i++) {
+        ReplayRAMBlock *block = &g_array_index(replay_blocks,
+                                               ReplayRAMBlock, i);
+        g_autofree DirtyBitmapSnapshot *snap = replay_snapshot_dirty(block);
+        g_autoptr(GHashTable) changed = g_hash_table_new(NULL, NULL);
+        GHashTableIter iter;
+        gpointer key;
+
+        for (page = 0; page < block->npages; page++) {
+            if (replay_checkpoint_current < 0 ||
+                replay_page_dirty(block, snap, page)) {
+                replay_restore_page(n, i, page);
+            }
+        }
+        for (later = first; later <= last && first; later++) {
+            ReplayCheckpoint *next = replay_checkpoint_get(later);
+
+            g_hash_table_iter_init(&iter, next->pages[i]);
+            while (g_hash_table_iter_next(&iter, &key, NULL)) {
+                g_hash_table_add(changed, key);
+            }
+        }
+        g_hash_table_iter_init(&iter, changed);
+        while (g_hash_table_iter_next(&iter, &key, NULL)) {
+            replay_restore_page(n, i, (uintptr_t)key);
+        }
+    }
+
+    replay_checkpoint_current = n;
+
+    /* Translated code may no longer match the restored RAM */
+    tb_flush(first_cpu);
+
+    return load_device_state_buffer(cp->devices, errp);
+}
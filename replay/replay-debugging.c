@@ -179,7 +179,8 @@ fail:
 static void replay_seek(int64_t icount, QEMUTimerCB callback, Error **errp)
 {
     char *snapshot = NULL;
-    int64_t snapshot_icount;
+    int64_t snapshot_icount = -1;
+    int64_t checkpoint_icount;
 
     if (replay_mode != REPLAY_MODE_PLAY) {
         error_setg(errp, "replay must be enabled to seek");
@@ -187,14 +188,23 @@ static void replay_seek(int64_t icount, QEMUTimerCB callback, Error **errp)
     }
 
     snapshot = replay_find_nearest_snapshot(icount, &snapshot_icount);
-    if (snapshot) {
+    checkpoint_icount = replay_checkpoint_find(icount);
+    if (checkpoint_icount >= 0 && checkpoint_icount >= snapshot_icount) {
+        /* In-memory checkpoints are much cheaper to load */
+        if (icount < replay_get_current_icount()
+            || replay_get_current_icount() < checkpoint_icount) {
+            vm_stop(RUN_STATE_RESTORE_VM);
+            replay_checkpoint_restore(checkpoint_icount, errp);
+        }
+    } else if (snapshot) {
         if (icount < replay_get_current_icount()
             || replay_get_current_icount() < snapshot_icount) {
             vm_stop(RUN_STATE_RESTORE_VM);
             load_snapshot(snapshot, NULL, false, NULL, errp);
+            replay_checkpoint_forget();
         }
-        g_free(snapshot);
     }
+    g_free(snapshot);
     if (replay_get_current_icount() <= icount) {
         replay_break(icount, callback, NULL);
         vm_start();
@@ -267,6 +267,7 @@ void replay_advance_current_icount(uint64_t current_icount)
                 qemu_notify_event();
             }
         }
+        replay_checkpoint_check(replay_state.current_icount);
         /* Execution reached the break step */
         if (replay_break_icount == replay_state.current_icount) {
             /* Cannot make callback directly from the vCPU thread */
@@ -212,4 +212,20 @@ G_NORETURN void replay_sync_error(const char *error);
    to make cached timers available for post_load functions. */
 void replay_vmstate_register(void);
 
+/* In-memory checkpoints */
+
+/*! Instructions between checkpoints, 0 when disabled */
+extern uint64_t replay_checkpoint_interval;
+
+/*! Starts taking checkpoints if they are enabled */
+void replay_checkpoint_init(void);
+/*! Schedules a checkpoint if one is due at @icount */
+void replay_checkpoint_check(uint64_t icount);
+/*! Returns the icount of the last checkpoint up to @icount, or -1 */
+int64_t replay_checkpoint_find(uint64_t icount);
+/*! Restores the checkpoint taken at @icount, VM must be stopped */
+bool replay_checkpoint_restore(uint64_t icount, Error **errp);
+/*! Tells that RAM was loaded from elsewhere, e.g. from a snapshot */
+void replay_checkpoint_forget(void);
+
 #endif
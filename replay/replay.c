@@ -415,6 +415,11 @@ void replay_configure(QemuOpts *opts)
         exit(1);
     }
 
+    if (g_strcmp0(qemu_opt_get(opts, "iosync"), "tb") == 0) {
+        error_report("Record/replay needs icount iosync=insn");
+        exit(1);
+    }
+
     fname = qemu_opt_get(opts, "rrfile");
     if (!fname) {
         error_report("File name not specified for replay");
@@ -422,6 +427,7 @@ void replay_configure(QemuOpts *opts)
     }
 
     replay_snapshot = g_strdup(qemu_opt_get(opts, "rrsnapshot"));
+    replay_checkpoint_interval = qemu_opt_get_number(opts, "rrcheckpoint", 0);
     replay_vmstate_register();
     replay_enable(fname, mode);
 
@@ -444,7 +450,7 @@ void replay_start(void)
         exit(1);
     }
 
-    /* Timer for snapshotting will be set up here. */
+    replay_checkpoint_init();
 
     replay_enable_events();
 }
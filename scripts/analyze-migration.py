@@ -564,6 +564,7 @@ class MigrationDump(object):
     QEMU_VM_SUBSECTION    = 0x05
     QEMU_VM_VMDESCRIPTION = 0x06
     QEMU_VM_CONFIGURATION = 0x07
+    QEMU_VM_SECTION_BUFFERED = 0x09
     QEMU_VM_SECTION_FOOTER= 0x7e
 
     def __init__(self, filename):
@@ -613,11 +614,16 @@ def read(self, desc_only = False, dump_memory = False, write_memory = False):
                 section = ConfigurationSection(file, config_desc)
                 section.read()
                 ramargs['ignore_shared'] = section.has_capability('x-ignore-shared')
-            elif section_type == self.QEMU_VM_SECTION_START or section_type == self.QEMU_VM_SECTION_FULL:
+            elif section_type in (self.QEMU_VM_SECTION_START,
+                                  self.QEMU_VM_SECTION_FULL,
+                                  self.QEMU_VM_SECTION_BUFFERED):
                 section_id = file.read32()
                 name = file.readstr()
                 instance_id = file.read32()
                 version_id = file.read32()
+                if section_type == self.QEMU_VM_SECTION_BUFFERED:
+                    # Length of the data, which follows as usual
+                    file.read32()
                 section_key = (name, instance_id)
                 classdesc = self.section_classes[section_key]
                 section = classdesc[0](file, version_id, classdesc[1], section_key)
@@ -0,0 +1,78 @@
+#!/usr/bin/env python3
+#
+# Decode a binary trace of the execlog plugin
+#
+# The output follows the text format of the plugin, with memory accesses
+# printed on their own lines after the instruction.
+#
+# SPDX-License-Identifier: GPL-2.0-or-later
+
+import argparse
+import struct
+import sys
+
+EXECLOG_MAGIC = 0x474f4c4345584551
+EXECLOG_VERSION = 1
+
+REC_INSN = 1
+REC_LOAD = 2
+REC_STORE = 3
+REC_DISAS = 4
+
+EXECLOG_MEM_IO = 0x40
+
+
+def decode(f, out):
+    hdr = f.read(16)
+    if len(hdr) < 16:
+        sys.exit("execlog-decode: file too short")
+
+    for endian in ('<', '>'):
+        magic, version, _ = struct.unpack(endian + 'QII', hdr)
+        if magic == EXECLOG_MAGIC:
+            break
+    else:
+        sys.exit("execlog-decode: not an execlog trace")
+    if version != EXECLOG_VERSION:
+        sys.exit("execlog-decode: unsupported version %d" % version)
+
+    rec_fmt = struct.Struct(endian + 'HHIQ')
+    u64 = struct.Struct(endian + 'Q')
+    disas = {}
+
+    while True:
+        rec = f.read(rec_fmt.size)
+        if len(rec) < rec_fmt.size:
+            break
+        rtype, cpu, data, addr = rec_fmt.unpack(rec)
+
+        if rtype == REC_DISAS:
+            text = f.read((data + 8) & ~7)
+            disas[addr] = text[:data].decode('utf-8', 'replace')
+        elif rtype == REC_INSN:
+            out.write('%u, 0x%x, 0x%x, "%s"\n' %
+                      (cpu, addr, data, disas.get(addr, '')))
+        elif rtype in (REC_LOAD, REC_STORE):
+            paddr, = u64.unpack(f.read(u64.size))
+            kind = 'store' if rtype == REC_STORE else 'load'
+            if paddr == (1 << 64) - 1:
+                out.write('%u, %s, 0x%08x\n' % (cpu, kind, addr))
+            else:
+                dev = 'IO' if data & EXECLOG_MEM_IO else 'RAM'
+                out.write('%u, %s, 0x%08x, %s\n' % (cpu, kind, paddr, dev))
+        else:
+            sys.exit("execlog-decode: bad record type %d" % rtype)
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Decode a binary trace of the execlog plugin')
+    parser.add_argument('trace', help='trace file written with binary=')
+    args = parser.parse_args()
+
+    with open(args.trace, 'rb') as f:
+        decode(f, sys.stdout)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,224 @@
+#!/usr/bin/env python3
+#
+# Benchmark firmware and OS boots on the GRLIB machines
+#
+# Boots reference workloads (bare-metal CoreMark, RTEMS hello, Linux to
+# userspace) on leon3_generic or noelv-generic and reports, for each of
+# them, the time until a completion message shows up on the first UART.
+# The time to the first UART byte, the host CPU time and the CoreMark
+# score, when there is one, are recorded alongside.  With --insn-plugin,
+# every workload also gets one extra run under tests/plugin/insn.c to
+# count the guest instructions, from which guest MIPS are computed.
+#
+# The images are not part of the tree; pass them with --workload.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+import argparse
+import json
+import os
+import re
+import select
+import shlex
+import statistics
+import subprocess
+import tempfile
+import time
+
+import simplebench
+from results_to_text import results_to_text
+
+
+ARCHS = {
+    'sparc': ['-M', 'leon3_generic'],
+    'riscv64': ['-M', 'noelv-generic'],
+}
+
+# Message printed on the UART once the workload is done
+KINDS = {
+    'coremark': r'CoreMark 1\.0 : [0-9.]+',
+    'rtems-hello': r'\*\*\* END OF TEST HELLO',
+    'linux': r'login: |/ # ',
+}
+
+COREMARK_SCORE = re.compile(rb'Iterations/Sec\s*:\s*([0-9.]+)')
+
+
+def cpu_seconds(pid):
+    """Return user + system CPU time of a running process"""
+    with open(f'/proc/{pid}/stat') as f:
+        fields = f.read().rpartition(')')[2].split()
+    return (int(fields[11]) + int(fields[12])) / os.sysconf('SC_CLK_TCK')
+
+
+def boot(env, case, extra_args=()):
+    """Boot the workload once and time it
+
+    Returns a dict with the times in seconds since QEMU was started.
+    Raises RuntimeError on failure or timeout.
+    """
+    args = [env['qemu-binary']] + ARCHS[env['arch']] + env['qemu-args']
+    args += ['-display', 'none', '-monitor', 'none', '-serial', 'stdio',
+             '-kernel', case['image']]
+    args += case['args'] + list(extra_args)
+    done = re.compile(case['done'].encode())
+
+    output = b''
+    first_byte = None
+    with tempfile.TemporaryFile() as err:
+        start = time.monotonic()
+        p = subprocess.Popen(args, stdin=subprocess.DEVNULL,
+                             stdout=subprocess.PIPE, stderr=err)
+        try:
+            while True:
+                left = start + env['timeout'] - time.monotonic()
+                if left <= 0:
+                    raise RuntimeError('timeout, last output: ' +
+                                       output[-200:].decode(errors='replace'))
+                if not select.select([p.stdout], [], [], left)[0]:
+                    continue
+                data = os.read(p.stdout.fileno(), 4096)
+                now = time.monotonic()
+                if not data:
+                    err.seek(0)
+                    raise RuntimeError(f'qemu exited: {p.wait()}: ' +
+                                       err.read().decode(errors='replace'))
+                if first_byte is None:
+                    first_byte = now - start
+                output += data
+                if done.search(output):
+                    break
+            result = {
+                'seconds': now - start,
+                'first-byte': first_byte,
+                'cpu-seconds': cpu_seconds(p.pid),
+            }
+        finally:
+            p.terminate()
+            p.wait()
+            p.stdout.close()
+
+    m = COREMARK_SCORE.search(output)
+    if m:
+        result['coremark'] = float(m.group(1))
+    return result
+
+
+def count_insns(env, case):
+    """Count the guest instructions of one boot with the insn plugin"""
+    with tempfile.NamedTemporaryFile() as log:
+        boot(env, case, ['-plugin', f"{env['insn-plugin']},inline=on",
+                         '-d', 'plugin', '-D', log.name])
+        m = re.search(rb'insns: ([0-9]+)', log.read())
+    if not m:
+        raise RuntimeError('no instruction count from the insn plugin')
+    return int(m.group(1))
+
+
+def bench_func(env, case):
+    try:
+        if env['insn-plugin'] and env['id'] not in case['insns']:
+            case['insns'][env['id']] = count_insns(env, case)
+        result = boot(env, case)
+    except RuntimeError as e:
+        return {'error': str(e)}
+
+    insns = case['insns'].get(env['id'])
+    if insns:
+        result['mips'] = insns / result['seconds'] / 1e6
+    return result
+
+
+def print_details(result):
+    """Print the averages of the values that results_to_text() skips"""
+    keys = ('first-byte', 'cpu-seconds', 'mips', 'coremark')
+    for case in result['cases']:
+        for env in result['envs']:
+            runs = [r for r in result['tab'][case['id']][env['id']]['runs']
+                    if 'seconds' in r]
+            values = [f'{k}={statistics.mean(r[k] for r in runs):.3f}'
+                      for k in keys if runs and all(k in r for r in runs)]
+            print(f"{case['id']} :: {env['id']}: {' '.join(values)}")
+
+
+def main():
+    p = argparse.ArgumentParser(
+        description='Report boot times of reference workloads on the '
+                    'GRLIB machines.  Pass several binaries to compare '
+                    'them.')
+    p.add_argument('--arch', choices=ARCHS.keys(), required=True)
+    p.add_argument('--workload', action='append', required=True,
+                   metavar='NAME:KIND:IMAGE',
+                   help='image to pass to -kernel; KIND is one of '
+                        f'{", ".join(KINDS)} and selects the completion '
+                        'message; may be repeated')
+    p.add_argument('--done', action='append', default=[],
+                   metavar='NAME:REGEX',
+                   help='override the completion message of a workload')
+    p.add_argument('--guest-args', action='append', default=[],
+                   metavar='NAME:ARGS',
+                   help='extra arguments for a workload, e.g. '
+                        '"linux:-append console=ttyS0 -m 256"')
+    p.add_argument('--count', type=int, default=3,
+                   help='runs per cell (default 3)')
+    p.add_argument('--timeout', type=float, default=300,
+                   help='seconds before a boot is failed (default 300)')
+    p.add_argument('--insn-plugin',
+                   help='path to libinsn.so, to compute guest MIPS')
+    p.add_argument('--qemu-args', default='',
+                   help='extra arguments, e.g. "-accel tcg,tb-size=64"')
+    p.add_argument('--json', help='also dump the results to this file')
+    p.add_argument('binaries', nargs='+', metavar='[LABEL:]QEMU',
+                   help='qemu-system binary to benchmark')
+    args = p.parse_args()
+
+    envs = []
+    for b in args.binaries:
+        label, _, path = b.rpartition(':')
+        envs.append({
+            'id': label or path,
+            'arch': args.arch,
+            'qemu-binary': path,
+            'qemu-args': args.qemu_args.split(),
+            'insn-plugin': args.insn_plugin,
+            'timeout': args.timeout,
+        })
+
+    done = dict(d.split(':', 1) for d in args.done)
+    guest_args = dict(a.split(':', 1) for a in args.guest_args)
+    cases = []
+    for w in args.workload:
+        name, kind, image = w.split(':', 2)
+        if kind not in KINDS:
+            p.error(f'unknown workload kind {kind}')
+        cases.append({
+            'id': name,
+            'image': image,
+            'done': done.get(name, KINDS[kind]),
+            'args': shlex.split(guest_args.get(name, '')),
+            'insns': {},
+        })
+
+    result = simplebench.bench(bench_func, envs, cases, count=args.count)
+    print('Seconds until the workload is done:')
+    print(results_to_text(result))
+    print_details(result)
+    if args.json:
+        with open(args.json, 'w') as f:
+            json.dump(result, f, indent=4)
+
+
+if __name__ == '__main__':
+    main()
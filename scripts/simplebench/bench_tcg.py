@@ -0,0 +1,151 @@
+#!/usr/bin/env python3
+#
+# Benchmark TCG translation and execution hot paths
+#
+# Runs the kernels of tests/tcg/riscv64/bench.S or
+# tests/tcg/sparc/system/bench.c, built by "make check-tcg", and reports
+# host nanoseconds per guest instruction for each of them.  Every
+# measurement is the difference between a long run and a one-iteration
+# run, which cancels QEMU startup and the first translation.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+import argparse
+import json
+import subprocess
+import time
+
+import simplebench
+from results_to_text import results_to_text
+
+
+# Kernel number, name, guest instructions per iteration and default
+# iteration count, as in the guest sources.
+ARCHS = {
+    'riscv64': {
+        'args': ['-M', 'virt', '-cpu', 'rv64,v=true', '-display', 'none',
+                 '-semihosting'],
+        'kernel': '-device loader,file={}',
+        'params': 0x80f00000,
+        'big-endian': False,
+        'cases': [
+            (1, 'ldst', 66, 2000000),
+            (2, 'tlb-fill', 36, 200000),
+            (3, 'tb-gen', 135, 20000),
+            (4, 'rvv-unit-stride', 34, 1000000),
+            (5, 'fma', 34, 2000000),
+        ],
+    },
+    'sparc': {
+        'args': ['-M', 'leon3_generic', '-display', 'none',
+                 '-serial', 'null'],
+        'kernel': '-kernel {}',
+        'params': 0x40f00000,
+        'big-endian': True,
+        'cases': [
+            (1, 'ldst', 67, 2000000),
+            (2, 'tlb-fill', 37, 200000),
+            (3, 'tb-gen', 137, 20000),
+            (4, 'fpu', 35, 2000000),
+        ],
+    },
+}
+
+
+def run_guest(env, case, iters):
+    arch = ARCHS[env['arch']]
+    be = 'on' if arch['big-endian'] else 'off'
+    args = [env['qemu-binary']] + arch['args'] + env['qemu-args']
+    args += arch['kernel'].format(env['guest']).split()
+    for i, val in enumerate((case['kernel'], iters)):
+        args += ['-device', f"loader,addr={arch['params'] + 4 * i:#x},"
+                 f'data={val},data-len=4,data-be={be}']
+
+    start = time.monotonic()
+    p = subprocess.run(args, stdout=subprocess.PIPE,
+                       stderr=subprocess.STDOUT, universal_newlines=True)
+    elapsed = time.monotonic() - start
+
+    if p.returncode != 0:
+        raise RuntimeError(f'qemu failed: {p.returncode}: {p.stdout}')
+    return elapsed
+
+
+def bench_func(env, case):
+    """Return ns per guest instruction, as seconds per 10^9 instructions"""
+    iters = case['iters']
+    try:
+        base = run_guest(env, case, 1)
+        total = run_guest(env, case, iters)
+    except RuntimeError as e:
+        return {'error': str(e)}
+
+    insns = (iters - 1) * case['insns']
+    return {'seconds': (total - base) / insns * 1e9}
+
+
+def main():
+    p = argparse.ArgumentParser(
+        description='Report host ns per guest instruction for the TCG '
+                    'micro-benchmark kernels.  Pass several binaries to '
+                    'compare them.')
+    p.add_argument('--arch', choices=ARCHS.keys(), required=True)
+    p.add_argument('--guest', required=True,
+                   help='bench binary built by "make check-tcg"')
+    p.add_argument('--count', type=int, default=3,
+                   help='runs per cell (default 3)')
+    p.add_argument('--scale', type=float, default=1.0,
+                   help='multiply the iteration counts')
+    p.add_argument('--kernel', action='append',
+                   help='only run this kernel, may be repeated')
+    p.add_argument('--qemu-args', default='',
+                   help='extra arguments, e.g. "-accel tcg,tb-size=64"')
+    p.add_argument('--json', help='also dump the results to this file')
+    p.add_argument('binaries', nargs='+', metavar='[LABEL:]QEMU',
+                   help='qemu-system binary to benchmark')
+    args = p.parse_args()
+
+    envs = []
+    for b in args.binaries:
+        label, _, path = b.rpartition(':')
+        envs.append({
+            'id': label or path,
+            'arch': args.arch,
+            'qemu-binary': path,
+            'qemu-args': args.qemu_args.split(),
+            'guest': args.guest,
+        })
+
+    cases = []
+    for kernel, name, insns, iters in ARCHS[args.arch]['cases']:
+        if args.kernel and name not in args.kernel:
+            continue
+        cases.append({
+            'id': name,
+            'kernel': kernel,
+            'insns': insns,
+            'iters': max(2, round(iters * args.scale)),
+        })
+
+    result = simplebench.bench(bench_func, envs, cases, count=args.count)
+    print('Host ns per guest instruction:')
+    print(results_to_text(result))
+    if args.json:
+        with open(args.json, 'w') as f:
+            json.dump(result, f, indent=4)
+
+
+if __name__ == '__main__':
+    main()
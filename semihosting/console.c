@@ -26,6 +26,11 @@
 #include "qemu/main-loop.h"
 #include "qapi/error.h"
 #include "qemu/fifo8.h"
+#include "qemu/notify.h"
+#include "sysemu/sysemu.h"
+
+#define FIFO_SIZE   1024
+#define OUT_SIZE    4096
 
 /* Access to this structure is protected by the BQL */
 typedef struct SemihostingConsole {
@@ -34,12 +39,17 @@ typedef struct SemihostingConsole {
     GSList              *sleeping_cpus;
     bool                got;
     Fifo8               fifo;
+    /*
+     * Output is held back until a newline, a read from the console or
+     * exit, so that SYS_WRITEC does not cost a host write per character.
+     */
+    char                out[OUT_SIZE];
+    int                 out_len;
+    Notifier            exit_notifier;
 } SemihostingConsole;
 
 static SemihostingConsole console;
 
-#define FIFO_SIZE   1024
-
 static int console_can_read(void *opaque)
 {
     SemihostingConsole *c = opaque;
@@ -80,6 +90,9 @@ void qemu_semihosting_console_block_until_ready(CPUState *cs)
 
     g_assert(bql_locked());
 
+    /* The guest may be waiting for input after a prompt */
+    qemu_semihosting_console_flush();
+
     /* Block if the fifo is completely empty. */
     if (fifo8_is_empty(&c->fifo)) {
         c->sleeping_cpus = g_slist_prepend(c->sleeping_cpus, cs);
@@ -90,6 +103,33 @@ void qemu_semihosting_console_block_until_ready(CPUState *cs)
     }
 }
 
+static int console_write_out(const void *buf, int len)
+{
+    if (console.chr) {
+        int r = qemu_chr_write_all(console.chr, buf, len);
+        return r < 0 ? 0 : r;
+    } else {
+        return fwrite(buf, 1, len, stderr);
+    }
+}
+
+bool qemu_semihosting_console_flush(void)
+{
+    SemihostingConsole *c = &console;
+    int len = c->out_len;
+
+    if (!len) {
+        return true;
+    }
+    c->out_len = 0;
+    return console_write_out(c->out, len) == len;
+}
+
+static void console_exit_notify(Notifier *n, void *data)
+{
+    qemu_semihosting_console_flush();
+}
+
 int qemu_semihosting_console_read(CPUState *cs, void *buf, int len)
 {
     SemihostingConsole *c = &console;
@@ -108,12 +148,24 @@ int qemu_semihosting_console_read(CPUState *cs, void *buf, int len)
 
 int qemu_semihosting_console_write(void *buf, int len)
 {
-    if (console.chr) {
-        int r = qemu_chr_write_all(console.chr, (uint8_t *)buf, len);
-        return r < 0 ? 0 : r;
-    } else {
-        return fwrite(buf, 1, len, stderr);
+    SemihostingConsole *c = &console;
+
+    if (len > OUT_SIZE - c->out_len) {
+        if (!qemu_semihosting_console_flush()) {
+            return 0;
+        }
+        if (len > OUT_SIZE) {
+            return console_write_out(buf, len);
+        }
     }
+
+    memcpy(c->out + c->out_len, buf, len);
+    c->out_len += len;
+
+    if (memchr(buf, '\n', len) && !qemu_semihosting_console_flush()) {
+        return 0;
+    }
+    return len;
 }
 
 void qemu_semihosting_console_init(Chardev *chr)
@@ -129,5 +181,8 @@ void qemu_semihosting_console_init(Chardev *chr)
                                  NULL, true);
     }
 
+    console.exit_notifier.notify = console_exit_notify;
+    qemu_add_exit_notifier(&console.exit_notifier);
+
     qemu_semihosting_guestfd_init();
 }
@@ -11,11 +11,41 @@
 #include "exec/exec-all.h"
 #include "semihosting/uaccess.h"
 
+/*
+ * Copy from guest RAM through the TLB, a page at a time, which spares
+ * cpu_memory_rw_debug() its page table walks for the buffers that the
+ * guest has just written.  Returns false if some page is not RAM or
+ * not mapped, and leaves those to the slow path.
+ */
+static bool uaccess_read_fast(CPUArchState *env, target_ulong addr,
+                              void *p, target_ulong len)
+{
+    int mmu_idx = cpu_mmu_index(env_cpu(env), false);
+
+    while (len) {
+        target_ulong n = MIN(len, TARGET_PAGE_SIZE -
+                                  (addr & ~TARGET_PAGE_MASK));
+        void *h;
+        int flags;
+
+        flags = probe_access_flags(env, addr, 0, MMU_DATA_LOAD,
+                                   mmu_idx, true, &h, 0);
+        if ((flags & (TLB_INVALID_MASK | TLB_MMIO)) || !h) {
+            return false;
+        }
+        memcpy(p, h, n);
+        p += n;
+        addr += n;
+        len -= n;
+    }
+    return true;
+}
+
 void *uaccess_lock_user(CPUArchState *env, target_ulong addr,
                         target_ulong len, bool copy)
 {
     void *p = malloc(len);
-    if (p && copy) {
+    if (p && copy && !uaccess_read_fast(env, addr, p, len)) {
         if (cpu_memory_rw_debug(env_cpu(env), addr, p, len, 0)) {
             free(p);
             p = NULL;
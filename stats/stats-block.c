@@ -0,0 +1,112 @@
+/*
+ * query-stats provider for block device latencies
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/module.h"
+#include "qom/object.h"
+#include "qapi/qapi-types-stats.h"
+#include "block/accounting.h"
+#include "hw/qdev-core.h"
+#include "sysemu/block-backend.h"
+#include "sysemu/stats.h"
+
+static const char *const block_stats_names[BLOCK_MAX_IOTYPE] = {
+    [BLOCK_ACCT_READ] = "rd_latency",
+    [BLOCK_ACCT_WRITE] = "wr_latency",
+    [BLOCK_ACCT_FLUSH] = "flush_latency",
+    [BLOCK_ACCT_ZONE_APPEND] = "zone_append_latency",
+    [BLOCK_ACCT_UNMAP] = "unmap_latency",
+};
+
+/* Trailing empty bins are left out, the list is as long as it needs */
+static void block_stats_add(StatsList **stats_list, BlockAcctStats *acct,
+                            enum BlockAcctType type)
+{
+    uint64List *list = NULL;
+    Stats *stats;
+    bool used = false;
+    int i;
+
+    for (i = BLOCK_LATENCY_HDR_BINS - 1; i >= 0; i--) {
+        uint64_t count = stat64_get(&acct->latency_hdr[type][i]);
+
+        used |= count;
+        if (used) {
+            QAPI_LIST_PREPEND(list, count);
+        }
+    }
+
+    stats = g_new0(Stats, 1);
+    stats->name = g_strdup(block_stats_names[type]);
+    stats->value = g_new0(StatsValue, 1);
+    stats->value->type = QTYPE_QLIST;
+    stats->value->u.list = list;
+    QAPI_LIST_PREPEND(*stats_list, stats);
+}
+
+static void block_stats_cb(StatsResultList **result, StatsTarget target,
+                           strList *names, strList *targets, Error **errp)
+{
+    BlockBackend *blk = NULL;
+    enum BlockAcctType type;
+
+    if (target != STATS_TARGET_BLOCK) {
+        return;
+    }
+
+    while ((blk = blk_all_next(blk))) {
+        DeviceState *dev = blk_get_attached_dev(blk);
+        StatsList *stats_list = NULL;
+
+        /* Results are identified by QOM path; other users have none */
+        if (!dev) {
+            continue;
+        }
+
+        for (type = BLOCK_MAX_IOTYPE - 1; type > BLOCK_ACCT_NONE; type--) {
+            if (apply_str_list_filter(block_stats_names[type], names)) {
+                block_stats_add(&stats_list, blk_get_stats(blk), type);
+            }
+        }
+
+        if (stats_list) {
+            g_autofree char *path = object_get_canonical_path(OBJECT(dev));
+
+            add_stats_entry(result, STATS_PROVIDER_BLOCK, path, stats_list);
+        }
+    }
+}
+
+static void block_stats_schemas_cb(StatsSchemaList **result, Error **errp)
+{
+    StatsSchemaValueList *list = NULL;
+    enum BlockAcctType type;
+
+    for (type = BLOCK_MAX_IOTYPE - 1; type > BLOCK_ACCT_NONE; type--) {
+        StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+        value->name = g_strdup(block_stats_names[type]);
+        value->type = STATS_TYPE_LOG_LINEAR_HISTOGRAM;
+        value->has_unit = true;
+        value->unit = STATS_UNIT_SECONDS;
+        value->has_base = true;
+        value->base = 10;
+        value->exponent = -9;
+        value->has_bucket_size = true;
+        value->bucket_size = BLOCK_LATENCY_HDR_SUB;
+        QAPI_LIST_PREPEND(list, value);
+    }
+    add_stats_schema(result, STATS_PROVIDER_BLOCK, STATS_TARGET_BLOCK, list);
+}
+
+static void block_stats_register(void)
+{
+    add_stats_callbacks(STATS_PROVIDER_BLOCK, block_stats_cb,
+                        block_stats_schemas_cb);
+}
+
+type_init(block_stats_register);
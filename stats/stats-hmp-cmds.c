@@ -52,6 +52,10 @@ static void print_stats_schema_value(Monitor *mon, StatsSchemaValue *value)
     /* Print bucket size for linear histograms */
     if (value->type == STATS_TYPE_LINEAR_HISTOGRAM && value->has_bucket_size) {
         monitor_printf(mon, ", bucket size=%d", value->bucket_size);
+    } else if (value->type == STATS_TYPE_LOG_LINEAR_HISTOGRAM &&
+               value->has_bucket_size) {
+        monitor_printf(mon, ", buckets per power of two=%d",
+                       value->bucket_size);
     }
     monitor_printf(mon, ")");
 }
@@ -156,6 +160,9 @@ static StatsFilter *stats_filter(StatsTarget target, const char *names,
         break;
     }
     case STATS_TARGET_CRYPTODEV:
+    case STATS_TARGET_IOTHREAD:
+    case STATS_TARGET_BLOCK:
+    case STATS_TARGET_MEMORY_REGION:
         break;
     default:
         break;
@@ -229,6 +236,9 @@ void hmp_info_stats(Monitor *mon, const QDict *qdict)
         filter = stats_filter(target, names, cpu_index, provider);
         break;
     case STATS_TARGET_CRYPTODEV:
+    case STATS_TARGET_IOTHREAD:
+    case STATS_TARGET_BLOCK:
+    case STATS_TARGET_MEMORY_REGION:
         filter = stats_filter(target, names, -1, provider);
         break;
     default:
@@ -0,0 +1,141 @@
+/*
+ * query-stats provider for iothread polling
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/module.h"
+#include "qom/object.h"
+#include "qapi/qapi-types-stats.h"
+#include "block/aio.h"
+#include "sysemu/iothread.h"
+#include "sysemu/stats.h"
+
+typedef struct IOThreadStatsArgs {
+    StatsResultList **result;
+    strList *names;
+} IOThreadStatsArgs;
+
+static void iothread_stats_add(StatsList **stats_list, strList *names,
+                               const char *name, uint64_t value)
+{
+    Stats *stats;
+
+    if (!apply_str_list_filter(name, names)) {
+        return;
+    }
+
+    stats = g_new0(Stats, 1);
+    stats->name = g_strdup(name);
+    stats->value = g_new0(StatsValue, 1);
+    stats->value->type = QTYPE_QNUM;
+    stats->value->u.scalar = value;
+    QAPI_LIST_PREPEND(*stats_list, stats);
+}
+
+static int iothread_stats_query(Object *obj, void *opaque)
+{
+    IOThreadStatsArgs *args = opaque;
+    StatsList *stats_list = NULL;
+    IOThread *iothread;
+    AioContext *ctx;
+    g_autofree char *path = NULL;
+
+    iothread = (IOThread *)object_dynamic_cast(obj, TYPE_IOTHREAD);
+    if (!iothread || !iothread->ctx) {
+        return 0;
+    }
+    ctx = iothread->ctx;
+
+    iothread_stats_add(&stats_list, args->names, "wait_time",
+                       stat64_get(&ctx->wait_time_ns));
+    iothread_stats_add(&stats_list, args->names, "waits",
+                       stat64_get(&ctx->waits));
+    iothread_stats_add(&stats_list, args->names, "poll_time",
+                       stat64_get(&ctx->poll_time_ns));
+    iothread_stats_add(&stats_list, args->names, "poll_misses",
+                       stat64_get(&ctx->poll_misses));
+    iothread_stats_add(&stats_list, args->names, "poll_hits",
+                       stat64_get(&ctx->poll_hits));
+    iothread_stats_add(&stats_list, args->names, "poll_handlers",
+                       qatomic_read(&ctx->poll_handlers));
+    iothread_stats_add(&stats_list, args->names, "poll_ns",
+                       stat64_get(&ctx->poll_window_ns));
+    iothread_stats_add(&stats_list, args->names, "coroutine_pool_hits",
+                       stat64_get(&ctx->coroutine_pool_hits));
+    iothread_stats_add(&stats_list, args->names, "coroutine_pool_misses",
+                       stat64_get(&ctx->coroutine_pool_misses));
+
+    if (stats_list) {
+        path = object_get_canonical_path(obj);
+        add_stats_entry(args->result, STATS_PROVIDER_IOTHREAD, path,
+                        stats_list);
+    }
+    return 0;
+}
+
+static void iothread_stats_cb(StatsResultList **result, StatsTarget target,
+                              strList *names, strList *targets, Error **errp)
+{
+    IOThreadStatsArgs args = {
+        .result = result,
+        .names = names,
+    };
+
+    if (target != STATS_TARGET_IOTHREAD) {
+        return;
+    }
+
+    object_child_foreach(object_get_objects_root(), iothread_stats_query,
+                         &args);
+}
+
+static void iothread_stats_add_schema(StatsSchemaValueList **list,
+                                      const char *name, StatsType type,
+                                      bool ns)
+{
+    StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+    value->name = g_strdup(name);
+    value->type = type;
+    if (ns) {
+        value->has_unit = true;
+        value->unit = STATS_UNIT_SECONDS;
+        value->has_base = true;
+        value->base = 10;
+        value->exponent = -9;
+    }
+    QAPI_LIST_PREPEND(*list, value);
+}
+
+static void iothread_stats_schemas_cb(StatsSchemaList **result, Error **errp)
+{
+    StatsSchemaValueList *list = NULL;
+
+    iothread_stats_add_schema(&list, "wait_time", STATS_TYPE_CUMULATIVE, true);
+    iothread_stats_add_schema(&list, "waits", STATS_TYPE_CUMULATIVE, false);
+    iothread_stats_add_schema(&list, "poll_time", STATS_TYPE_CUMULATIVE, true);
+    iothread_stats_add_schema(&list, "poll_misses",
+                              STATS_TYPE_CUMULATIVE, false);
+    iothread_stats_add_schema(&list, "poll_hits",
+                              STATS_TYPE_CUMULATIVE, false);
+    iothread_stats_add_schema(&list, "poll_handlers",
+                              STATS_TYPE_INSTANT, false);
+    iothread_stats_add_schema(&list, "poll_ns", STATS_TYPE_INSTANT, true);
+    iothread_stats_add_schema(&list, "coroutine_pool_hits",
+                              STATS_TYPE_CUMULATIVE, false);
+    iothread_stats_add_schema(&list, "coroutine_pool_misses",
+                              STATS_TYPE_CUMULATIVE, false);
+    add_stats_schema(result, STATS_PROVIDER_IOTHREAD, STATS_TARGET_IOTHREAD,
+                     list);
+}
+
+static void iothread_stats_register(void)
+{
+    add_stats_callbacks(STATS_PROVIDER_IOTHREAD, iothread_stats_cb,
+                        iothread_stats_schemas_cb);
+}
+
+type_init(iothread_stats_register);
@@ -28,6 +28,7 @@
 #include "qemu/main-loop.h"
 #include "sysemu/cpus.h"
 #include "sysemu/cpu-throttle.h"
+#include "sysemu/tcg.h"
 
 /* vcpu throttling controls */
 static QEMUTimer *throttle_timer;
@@ -36,6 +37,22 @@ static unsigned int throttle_percentage;
 #define CPU_THROTTLE_PCT_MIN 1
 #define CPU_THROTTLE_PCT_MAX 99
 #define CPU_THROTTLE_TIMESLICE_NS 10000000
+/*
+ * Kicking a TCG vCPU only costs a TB exit, so it can afford a cycle
+ * short enough that the guest never stops for more than a couple of
+ * milliseconds, instead of running a fixed timeslice and sleeping up
+ * to 99 times as long.
+ */
+#define CPU_THROTTLE_PERIOD_TCG_NS 2000000
+
+/* Time a vcpu runs between two sleeps */
+static int64_t cpu_throttle_timeslice_ns(double pct)
+{
+    if (tcg_enabled()) {
+        return CPU_THROTTLE_PERIOD_TCG_NS * (1 - pct);
+    }
+    return CPU_THROTTLE_TIMESLICE_NS;
+}
 
 static void cpu_throttle_thread(CPUState *cpu, run_on_cpu_data opaque)
 {
@@ -50,7 +67,8 @@ static void cpu_throttle_thread(CPUState *cpu, run_on_cpu_data opaque)
     pct = (double)cpu_throttle_get_percentage() / 100;
     throttle_ratio = pct / (1 - pct);
     /* Add 1ns to fix double's rounding error (like 0.9999999...) */
-    sleeptime_ns = (int64_t)(throttle_ratio * CPU_THROTTLE_TIMESLICE_NS + 1);
+    sleeptime_ns = (int64_t)(throttle_ratio * cpu_throttle_timeslice_ns(pct)
+                             + 1);
     endtime_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) + sleeptime_ns;
     while (sleeptime_ns > 0 && !cpu->stop) {
         if (sleeptime_ns > SCALE_MS) {
@@ -84,7 +102,7 @@ static void cpu_throttle_timer_tick(void *opaque)
 
     pct = (double)cpu_throttle_get_percentage() / 100;
     timer_mod(throttle_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL_RT) +
-                                   CPU_THROTTLE_TIMESLICE_NS / (1 - pct));
+                                   cpu_throttle_timeslice_ns(pct) / (1 - pct));
 }
 
 void cpu_throttle_set(int new_throttle_pct)
@@ -34,6 +34,7 @@
 #include "sysemu/hw_accel.h"
 #include "exec/cpu-common.h"
 #include "qemu/thread.h"
+#include "qemu/thread-context.h"
 #include "qemu/main-loop.h"
 #include "qemu/plugin.h"
 #include "sysemu/cpus.h"
@@ -457,6 +458,17 @@ void qemu_wait_io_event(CPUState *cpu)
     qemu_wait_io_event_common(cpu);
 }
 
+/*
+ * Create the thread of @cpu, in its thread-context if it has one; the
+ * thread runs @start_routine with @cpu as argument.
+ */
+void cpu_thread_create(CPUState *cpu, const char *name,
+                       void *(*start_routine)(void *))
+{
+    thread_context_create_thread(cpu->thread_context, cpu->thread, name,
+                                 start_routine, cpu, QEMU_THREAD_JOINABLE);
+}
+
 void cpus_kick_thread(CPUState *cpu)
 {
     if (cpu->thread_kicked) {
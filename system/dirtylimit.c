@@ -12,7 +12,9 @@
 
 #include "qemu/osdep.h"
 #include "qemu/main-loop.h"
+#include "qemu/module.h"
 #include "qapi/qapi-commands-migration.h"
+#include "qapi/qapi-types-stats.h"
 #include "qapi/qmp/qdict.h"
 #include "qapi/error.h"
 #include "sysemu/dirtyrate.h"
@@ -23,6 +25,7 @@
 #include "exec/target_page.h"
 #include "hw/boards.h"
 #include "sysemu/kvm.h"
+#include "sysemu/stats.h"
 #include "trace.h"
 #include "migration/misc.h"
 #include "migration/migration.h"
@@ -34,12 +37,15 @@
  */
 #define DIRTYLIMIT_TOLERANCE_RANGE  25  /* MB/s */
 /*
- * Plus or minus vcpu sleep time linearly if dirty
- * page rate error value percentage over
- * DIRTYLIMIT_LINEAR_ADJUSTMENT_PCT.
- * Otherwise, plus or minus a fixed vcpu sleep time.
+ * Gains, in percent, of the controller that adjusts the vcpu sleep
+ * time.  The error is the difference between the time the dirty ring
+ * takes to fill up at the quota and at the measured rate, which is
+ * also the sleep time that would bring the vcpu to the quota in one
+ * step.  Applying only part of it keeps a noisy sample from making
+ * the sleep time oscillate.
  */
-#define DIRTYLIMIT_LINEAR_ADJUSTMENT_PCT     50
+#define DIRTYLIMIT_THROTTLE_KI      50
+#define DIRTYLIMIT_THROTTLE_KP      25
 /*
  * Max vcpu sleep time percentage during a cycle
  * composed of dirty ring full and sleep time.
@@ -60,6 +66,8 @@ typedef struct VcpuDirtyLimitState {
      * zero if not enabled.
      */
     uint64_t quota;
+    /* Error of the previous adjustment, in us of ring full time */
+    int64_t last_error_us;
 } VcpuDirtyLimitState;
 
 struct {
@@ -267,57 +275,46 @@ static inline bool dirtylimit_done(uint64_t quota,
     return ((max - min) <= DIRTYLIMIT_TOLERANCE_RANGE) ? true : false;
 }
 
-static inline bool
-dirtylimit_need_linear_adjustment(uint64_t quota,
-                                  uint64_t current)
+/*
+ * Error between the time the dirty ring of a vcpu takes to fill up
+ * at the quota and at the measured dirty page rate, in us.
+ */
+static int64_t dirtylimit_throttle_error(uint64_t quota, uint64_t current)
 {
-    uint64_t min, max;
-
-    min = MIN(quota, current);
-    max = MAX(quota, current);
+    double ring_MiB = qemu_target_pages_to_MiB(kvm_dirty_ring_size());
 
-    return ((max - min) * 100 / max) > DIRTYLIMIT_LINEAR_ADJUSTMENT_PCT;
+    return ring_MiB * 1000000 / quota - ring_MiB * 1000000 / current;
 }
 
 static void dirtylimit_set_throttle(CPUState *cpu,
                                     uint64_t quota,
                                     uint64_t current)
 {
+    VcpuDirtyLimitState *state = dirtylimit_vcpu_get_state(cpu->cpu_index);
     int64_t ring_full_time_us = 0;
-    uint64_t sleep_pct = 0;
-    uint64_t throttle_us = 0;
+    int64_t error_us, throttle_us;
 
     if (current == 0) {
         cpu->throttle_us_per_full = 0;
+        state->last_error_us = 0;
         return;
     }
 
     ring_full_time_us = dirtylimit_dirty_ring_full_time(current);
 
-    if (dirtylimit_need_linear_adjustment(quota, current)) {
-        if (quota < current) {
-            sleep_pct = (current - quota) * 100 / current;
-            throttle_us =
-                ring_full_time_us * sleep_pct / (double)(100 - sleep_pct);
-            cpu->throttle_us_per_full += throttle_us;
-        } else {
-            sleep_pct = (quota - current) * 100 / quota;
-            throttle_us =
-                ring_full_time_us * sleep_pct / (double)(100 - sleep_pct);
-            cpu->throttle_us_per_full -= throttle_us;
-        }
+    error_us = dirtylimit_throttle_error(quota, current);
+    throttle_us = (error_us * DIRTYLIMIT_THROTTLE_KI +
+                   (error_us - state->last_error_us) *
+                   DIRTYLIMIT_THROTTLE_KP) / 100;
+    state->last_error_us = error_us;
 
-        trace_dirtylimit_throttle_pct(cpu->cpu_index,
-                                      sleep_pct,
-                                      throttle_us);
-    } else {
-        if (quota < current) {
-            cpu->throttle_us_per_full += ring_full_time_us / 10;
-        } else {
-            cpu->throttle_us_per_full -= ring_full_time_us / 10;
-        }
+    if (dirtylimit_done(quota, current)) {
+        return;
     }
 
+    cpu->throttle_us_per_full += throttle_us;
+    trace_dirtylimit_throttle_pi(cpu->cpu_index, error_us, throttle_us);
+
     /*
      * TODO: in the big kvm_dirty_ring_size case (eg: 65536, or other scenario),
      *       current dirty page rate may never reach the quota, we should stop
@@ -338,11 +335,7 @@ static void dirtylimit_adjust_throttle(CPUState *cpu)
     quota = dirtylimit_vcpu_get_state(cpu_index)->quota;
     current = vcpu_dirty_rate_get(cpu_index);
 
-    if (!dirtylimit_done(quota, current)) {
-        dirtylimit_set_throttle(cpu, quota, current);
-    }
-
-    return;
+    dirtylimit_set_throttle(cpu, quota, current);
 }
 
 void dirtylimit_process(void)
@@ -382,6 +375,7 @@ void dirtylimit_set_vcpu(int cpu_index,
 {
     trace_dirtylimit_set_vcpu(cpu_index, quota);
 
+    dirtylimit_state->states[cpu_index].last_error_us = 0;
     if (enable) {
         dirtylimit_state->states[cpu_index].quota = quota;
         if (!dirtylimit_vcpu_get_state(cpu_index)->enabled) {
@@ -680,3 +674,108 @@ void hmp_info_vcpu_dirty_limit(Monitor *mon, const QDict *qdict)
                             info->value->current_rate);
     }
 }
+
+static void dirtylimit_stats_add(StatsList **stats_list, strList *names,
+                                 const char *name, uint64_t value)
+{
+    Stats *stats;
+
+    if (!apply_str_list_filter(name, names)) {
+        return;
+    }
+
+    stats = g_new0(Stats, 1);
+    stats->name = g_strdup(name);
+    stats->value = g_new0(StatsValue, 1);
+    stats->value->type = QTYPE_QNUM;
+    stats->value->u.scalar = value;
+    QAPI_LIST_PREPEND(*stats_list, stats);
+}
+
+static void dirtylimit_stats_cb(StatsResultList **result, StatsTarget target,
+                                strList *names, strList *targets,
+                                Error **errp)
+{
+    CPUState *cpu;
+
+    if (target != STATS_TARGET_VCPU) {
+        return;
+    }
+
+    dirtylimit_state_lock();
+
+    if (!dirtylimit_in_service()) {
+        dirtylimit_state_unlock();
+        return;
+    }
+
+    CPU_FOREACH(cpu) {
+        VcpuDirtyLimitState *state = dirtylimit_vcpu_get_state(cpu->cpu_index);
+        StatsList *stats_list = NULL;
+        uint64_t current;
+
+        if (!state->enabled ||
+            !apply_str_list_filter(cpu->parent_obj.canonical_path, targets)) {
+            continue;
+        }
+
+        current = vcpu_dirty_rate_get(cpu->cpu_index);
+        dirtylimit_stats_add(&stats_list, names, "throttle_us",
+                             cpu->throttle_us_per_full);
+        dirtylimit_stats_add(&stats_list, names, "rate_error",
+                             MAX(current, state->quota) -
+                             MIN(current, state->quota));
+        dirtylimit_stats_add(&stats_list, names, "dirty_rate", current);
+        dirtylimit_stats_add(&stats_list, names, "quota", state->quota);
+
+        if (stats_list) {
+            add_stats_entry(result, STATS_PROVIDER_DIRTY_LIMIT,
+                            cpu->parent_obj.canonical_path, stats_list);
+        }
+    }
+
+    dirtylimit_state_unlock();
+}
+
+static void dirtylimit_stats_add_schema(StatsSchemaValueList **list,
+                                        const char *name, bool us)
+{
+    StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+    value->name = g_strdup(name);
+    value->type = STATS_TYPE_INSTANT;
+    if (us) {
+        value->has_unit = true;
+        value->unit = STATS_UNIT_SECONDS;
+        value->has_base = true;
+        value->base = 10;
+        value->exponent = -6;
+    }
+    QAPI_LIST_PREPEND(*list, value);
+}
+
+static void dirtylimit_stats_schemas_cb(StatsSchemaList **result,
+                                        Error **errp)
+{
+    StatsSchemaValueList *list = NULL;
+
+    if (!kvm_enabled() || !kvm_dirty_ring_enabled()) {
+        return;
+    }
+
+    /* Rates are in MB/s, which StatsUnit cannot express */
+    dirtylimit_stats_add_schema(&list, "throttle_us", true);
+    dirtylimit_stats_add_schema(&list, "rate_error", false);
+    dirtylimit_stats_add_schema(&list, "dirty_rate", false);
+    dirtylimit_stats_add_schema(&list, "quota", false);
+    add_stats_schema(result, STATS_PROVIDER_DIRTY_LIMIT, STATS_TARGET_VCPU,
+                     list);
+}
+
+static void dirtylimit_stats_register(void)
+{
+    add_stats_callbacks(STATS_PROVIDER_DIRTY_LIMIT, dirtylimit_stats_cb,
+                        dirtylimit_stats_schemas_cb);
+}
+
+type_init(dirtylimit_stats_register);
@@ -0,0 +1,299 @@
+/*
+ * Sampled access statistics for I/O memory regions
+ *
+ * Every region that had a sampled access gets a MemoryRegionStats, and
+ * the statistics are reported by query-stats ("memory-region" target)
+ * and by "info mmio-stats".  Accesses and times are estimates: each
+ * sample counts for the period it was taken with.  The latency
+ * histograms count samples.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/host-utils.h"
+#include "qemu/module.h"
+#include "qemu/queue.h"
+#include "qemu/stats64.h"
+#include "qemu/thread.h"
+#include "qapi/qapi-types-stats.h"
+#include "exec/memory-stats.h"
+#include "monitor/hmp.h"
+#include "monitor/monitor.h"
+#include "sysemu/stats.h"
+
+/*
+ * Same log-linear binning as the block latency histograms: bin i <
+ * MR_STATS_HDR_SUB is for i ns, then each power of two is split in
+ * MR_STATS_HDR_SUB bins.  2^MR_STATS_HDR_MAX_BITS ns (about a second)
+ * and more go in the last bin.
+ */
+#define MR_STATS_HDR_SUB_BITS   3
+#define MR_STATS_HDR_SUB        (1 << MR_STATS_HDR_SUB_BITS)
+#define MR_STATS_HDR_MAX_BITS   30
+#define MR_STATS_HDR_BINS \
+    ((MR_STATS_HDR_MAX_BITS - MR_STATS_HDR_SUB_BITS + 1) * MR_STATS_HDR_SUB)
+
+struct MemoryRegionStats {
+    MemoryRegion *mr;
+    Stat64 accesses[2];
+    Stat64 time_ns[2];
+    Stat64 latency[2][MR_STATS_HDR_BINS];
+    QTAILQ_ENTRY(MemoryRegionStats) next;
+};
+
+uint32_t memory_region_stats_period;
+
+/* Protects the list, and the creation and freeing of mr->stats */
+static QemuMutex mr_stats_lock;
+static QTAILQ_HEAD(, MemoryRegionStats) mr_stats_list =
+    QTAILQ_HEAD_INITIALIZER(mr_stats_list);
+
+static const char *const mr_stats_names[2][3] = {
+    { "reads", "read_time", "read_latency" },
+    { "writes", "write_time", "write_latency" },
+};
+
+void memory_region_stats_set_period(uint32_t period)
+{
+    assert(!(period & (period - 1)));
+    qatomic_set(&memory_region_stats_period, period);
+}
+
+static unsigned mr_stats_hdr_bin(uint64_t latency_ns)
+{
+    int e;
+
+    if (latency_ns < MR_STATS_HDR_SUB) {
+        return latency_ns;
+    }
+
+    e = 63 - clz64(latency_ns);
+    if (e >= MR_STATS_HDR_MAX_BITS) {
+        return MR_STATS_HDR_BINS - 1;
+    }
+    return (e - MR_STATS_HDR_SUB_BITS + 1) * MR_STATS_HDR_SUB +
+           ((latency_ns >> (e - MR_STATS_HDR_SUB_BITS)) &
+            (MR_STATS_HDR_SUB - 1));
+}
+
+static MemoryRegionStats *mr_stats_get(MemoryRegion *mr)
+{
+    MemoryRegionStats *s = qatomic_load_acquire(&mr->stats);
+
+    if (likely(s)) {
+        return s;
+    }
+
+    QEMU_LOCK_GUARD(&mr_stats_lock);
+    if (!mr->stats) {
+        s = g_new0(MemoryRegionStats, 1);
+        s->mr = mr;
+        QTAILQ_INSERT_TAIL(&mr_stats_list, s, next);
+        qatomic_store_release(&mr->stats, s);
+    }
+    return mr->stats;
+}
+
+void memory_region_stats_account(MemoryRegion *mr, bool is_write,
+                                 uint32_t period, int64_t latency_ns)
+{
+    MemoryRegionStats *s = mr_stats_get(mr);
+
+    latency_ns = MAX(latency_ns, 0);
+    stat64_add(&s->accesses[is_write], period);
+    stat64_add(&s->time_ns[is_write], (uint64_t)latency_ns * period);
+    stat64_add(&s->latency[is_write][mr_stats_hdr_bin(latency_ns)], 1);
+}
+
+void memory_region_stats_free(MemoryRegion *mr)
+{
+    if (!mr->stats) {
+        return;
+    }
+
+    WITH_QEMU_LOCK_GUARD(&mr_stats_lock) {
+        QTAILQ_REMOVE(&mr_stats_list, mr->stats, next);
+    }
+    g_free(mr->stats);
+    mr->stats = NULL;
+}
+
+static char *mr_stats_id(MemoryRegion *mr)
+{
+    return object_get_canonical_path(OBJECT(mr)) ?:
+           g_strdup(memory_region_name(mr));
+}
+
+static void mr_stats_add_scalar(StatsList **stats_list, const char *name,
+                                uint64_t value)
+{
+    Stats *stats = g_new0(Stats, 1);
+
+    stats->name = g_strdup(name);
+    stats->value = g_new0(StatsValue, 1);
+    stats->value->type = QTYPE_QNUM;
+    stats->value->u.scalar = value;
+    QAPI_LIST_PREPEND(*stats_list, stats);
+}
+
+/* Trailing empty bins are left out, the list is as long as it needs */
+static void mr_stats_add_histogram(StatsList **stats_list, const char *name,
+                                   Stat64 *bins)
+{
+    uint64List *list = NULL;
+    Stats *stats;
+    bool used = false;
+    int i;
+
+    for (i = MR_STATS_HDR_BINS - 1; i >= 0; i--) {
+        uint64_t count = stat64_get(&bins[i]);
+
+        used |= count;
+        if (used) {
+            QAPI_LIST_PREPEND(list, count);
+        }
+    }
+
+    stats = g_new0(Stats, 1);
+    stats->name = g_strdup(name);
+    stats->value = g_new0(StatsValue, 1);
+    stats->value->type = QTYPE_QLIST;
+    stats->value->u.list = list;
+    QAPI_LIST_PREPEND(*stats_list, stats);
+}
+
+static void mr_stats_cb(StatsResultList **result, StatsTarget target,
+                        strList *names, strList *targets, Error **errp)
+{
+    MemoryRegionStats *s;
+    int dir;
+
+    if (target != STATS_TARGET_MEMORY_REGION) {
+        return;
+    }
+
+    QEMU_LOCK_GUARD(&mr_stats_lock);
+    QTAILQ_FOREACH(s, &mr_stats_list, next) {
+        StatsList *stats_list = NULL;
+
+        for (dir = 1; dir >= 0; dir--) {
+            if (apply_str_list_filter(mr_stats_names[dir][2], names)) {
+                mr_stats_add_histogram(&stats_list, mr_stats_names[dir][2],
+                                       s->latency[dir]);
+            }
+            if (apply_str_list_filter(mr_stats_names[dir][1], names)) {
+                mr_stats_add_scalar(&stats_list, mr_stats_names[dir][1],
+                                    stat64_get(&s->time_ns[dir]));
+            }
+            if (apply_str_list_filter(mr_stats_names[dir][0], names)) {
+                mr_stats_add_scalar(&stats_list, mr_stats_names[dir][0],
+                                    stat64_get(&s->accesses[dir]));
+            }
+        }
+
+        if (stats_list) {
+            g_autofree char *id = mr_stats_id(s->mr);
+
+            add_stats_entry(result, STATS_PROVIDER_MEMORY, id, stats_list);
+        }
+    }
+}
+
+static void mr_stats_add_schema(StatsSchemaValueList **list,
+                                const char *name, StatsType type, bool ns)
+{
+    StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+    value->name = g_strdup(name);
+    value->type = type;
+    if (ns) {
+        value->has_unit = true;
+        value->unit = STATS_UNIT_SECONDS;
+        value->has_base = true;
+        value->base = 10;
+        value->exponent = -9;
+    }
+    if (type == STATS_TYPE_LOG_LINEAR_HISTOGRAM) {
+        value->has_bucket_size = true;
+        value->bucket_size = MR_STATS_HDR_SUB;
+    }
+    QAPI_LIST_PREPEND(*list, value);
+}
+
+static void mr_stats_schemas_cb(StatsSchemaList **result, Error **errp)
+{
+    StatsSchemaValueList *list = NULL;
+    int dir;
+
+    for (dir = 1; dir >= 0; dir--) {
+        mr_stats_add_schema(&list, mr_stats_names[dir][2],
+                            STATS_TYPE_LOG_LINEAR_HISTOGRAM, true);
+        mr_stats_add_schema(&list, mr_stats_names[dir][1],
+                            STATS_TYPE_CUMULATIVE, true);
+        mr_stats_add_schema(&list, mr_stats_names[dir][0],
+                            STATS_TYPE_CUMULATIVE, false);
+    }
+    add_stats_schema(result, STATS_PROVIDER_MEMORY,
+                     STATS_TARGET_MEMORY_REGION, list);
+}
+
+static uint64_t mr_stats_total_ns(MemoryRegionStats *s)
+{
+    return stat64_get(&s->time_ns[0]) + stat64_get(&s->time_ns[1]);
+}
+
+static gint mr_stats_compare(gconstpointer a, gconstpointer b)
+{
+    uint64_t ta = mr_stats_total_ns(*(MemoryRegionStats **)a);
+    uint64_t tb = mr_stats_total_ns(*(MemoryRegionStats **)b);
+
+    return ta < tb ? 1 : ta > tb ? -1 : 0;
+}
+
+void hmp_info_mmio_stats(Monitor *mon, const QDict *qdict)
+{
+    g_autoptr(GPtrArray) regions = g_ptr_array_new();
+    uint32_t period = qatomic_read(&memory_region_stats_period);
+    MemoryRegionStats *s;
+    guint i;
+
+    if (!period) {
+        monitor_printf(mon, "MMIO statistics are disabled, "
+                       "see -machine mmio-stats\n");
+    }
+
+    QEMU_LOCK_GUARD(&mr_stats_lock);
+    QTAILQ_FOREACH(s, &mr_stats_list, next) {
+        g_ptr_array_add(regions, s);
+    }
+    g_ptr_array_sort(regions, mr_stats_compare);
+
+    monitor_printf(mon, "%12s %12s %8s %12s %8s  %s\n", "time(us)",
+                   "reads", "ns/read", "writes", "ns/write", "region");
+    for (i = 0; i < regions->len; i++) {
+        uint64_t reads, writes, read_ns, write_ns;
+
+        s = g_ptr_array_index(regions, i);
+        reads = stat64_get(&s->accesses[0]);
+        writes = stat64_get(&s->accesses[1]);
+        read_ns = stat64_get(&s->time_ns[0]);
+        write_ns = stat64_get(&s->time_ns[1]);
+        monitor_printf(mon, "%12" PRIu64 " %12" PRIu64 " %8" PRIu64
+                       " %12" PRIu64 " %8" PRIu64 "  %s\n",
+                       (read_ns + write_ns) / 1000,
+                       reads, reads ? read_ns / reads : 0,
+                       writes, writes ? write_ns / writes : 0,
+                       memory_region_name(s->mr));
+    }
+}
+
+static void mr_stats_register(void)
+{
+    qemu_mutex_init(&mr_stats_lock);
+    add_stats_callbacks(STATS_PROVIDER_MEMORY, mr_stats_cb,
+                        mr_stats_schemas_cb);
+}
+
+type_init(mr_stats_register);
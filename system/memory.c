@@ -17,11 +17,13 @@
 #include "qemu/log.h"
 #include "qapi/error.h"
 #include "exec/memory.h"
+#include "exec/memory-stats.h"
 #include "qapi/visitor.h"
 #include "qemu/bitops.h"
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
 #include "qemu/qemu-print.h"
+#include "qemu/timer.h"
 #include "qom/object.h"
 #include "trace.h"
 
@@ -560,6 +562,16 @@ static MemTxResult access_with_adjusted_size(hwaddr addr,
         reentrancy_guard_applied = true;
     }
 
+    /*
+     * Most register files implement every size the guest may use, and
+     * the whole access is a single callback: skip the splitting.
+     */
+    if (likely(size >= access_size_min && size <= access_size_max)) {
+        r = access_fn(mr, addr, value, size, 0,
+                      MAKE_64BIT_MASK(0, size * 8), attrs);
+        goto out;
+    }
+
     /* FIXME: support unaligned access? */
     access_size = MAX(MIN(size, access_size_max), access_size_min);
     access_mask = MAKE_64BIT_MASK(0, access_size * 8);
@@ -574,6 +586,7 @@ static MemTxResult access_with_adjusted_size(hwaddr addr,
                         access_mask, attrs);
         }
     }
+out:
     if (mr->dev && reentrancy_guard_applied) {
         mr->dev->mem_reentrancy_guard.engaged_in_io = false;
     }
@@ -750,7 +763,29 @@ static MemoryRegion *memory_region_get_flatview_root(MemoryRegion *mr)
 }
 
 /* Render a memory topology into a list of disjoint absolute ranges. */
-static FlatView *generate_memory_topology(MemoryRegion *mr)
+static bool flatview_equal(FlatView *a, FlatView *b)
+{
+    unsigned i;
+
+    if (a->nr != b->nr) {
+        return false;
+    }
+    for (i = 0; i < a->nr; i++) {
+        if (!flatrange_equal(&a->ranges[i], &b->ranges[i]) ||
+            a->ranges[i].dirty_log_mask != b->ranges[i].dirty_log_mask) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Render the FlatView of @mr.  If it comes out the same as @old_view, the
+ * previous view of @mr, @old_view is used again: this saves building the
+ * dispatch tree, and address spaces using the view see no change at all.
+ */
+static FlatView *generate_memory_topology(MemoryRegion *mr,
+                                          FlatView *old_view)
 {
     int i;
     FlatView *view;
@@ -764,6 +799,14 @@ static FlatView *generate_memory_topology(MemoryRegion *mr)
     }
     flatview_simplify(view);
 
+    if (old_view && flatview_equal(old_view, view)) {
+        /* Never published, so there are no RCU readers */
+        flatview_destroy(view);
+        flatview_ref(old_view);
+        g_hash_table_replace(flat_views, mr, old_view);
+        return old_view;
+    }
+
     view->dispatch = address_space_dispatch_new(view);
     for (i = 0; i < view->nr; i++) {
         MemoryRegionSection mrs =
@@ -1021,7 +1064,7 @@ static void flatviews_init(void)
     flat_views = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
                                        (GDestroyNotify) flatview_unref);
     if (!empty_view) {
-        empty_view = generate_memory_topology(NULL);
+        empty_view = generate_memory_topology(NULL, NULL);
         /* We keep it alive forever in the global variable.  */
         flatview_ref(empty_view);
     } else {
@@ -1032,12 +1075,11 @@ static void flatviews_init(void)
 
 static void flatviews_reset(void)
 {
+    GHashTable *old_views = flat_views;
     AddressSpace *as;
 
-    if (flat_views) {
-        g_hash_table_unref(flat_views);
-        flat_views = NULL;
-    }
+    /* Keep the old views until the new ones have been compared to them */
+    flat_views = NULL;
     flatviews_init();
 
     /* Render unique FVs */
@@ -1048,7 +1090,14 @@ static void flatviews_reset(void)
             continue;
         }
 
-        generate_memory_topology(physmr);
+        generate_memory_topology(physmr,
+                                 old_views ?
+                                 g_hash_table_lookup(old_views, physmr) :
+                                 NULL);
+    }
+
+    if (old_views) {
+        g_hash_table_unref(old_views);
     }
 }
 
@@ -1103,7 +1152,7 @@ static void address_space_update_topology(AddressSpace *as)
 
     flatviews_init();
     if (!g_hash_table_lookup(flat_views, physmr)) {
-        generate_memory_topology(physmr);
+        generate_memory_topology(physmr, NULL);
     }
     address_space_set_flatview(as);
 }
@@ -1444,6 +1493,7 @@ MemTxResult memory_region_dispatch_read(MemoryRegion *mr,
                                         MemTxAttrs attrs)
 {
     unsigned size = memop_size(op);
+    uint32_t sample;
     MemTxResult r;
 
     if (mr->alias) {
@@ -1456,7 +1506,15 @@ MemTxResult memory_region_dispatch_read(MemoryRegion *mr,
         return MEMTX_DECODE_ERROR;
     }
 
-    r = memory_region_dispatch_read1(mr, addr, pval, size, attrs);
+    sample = memory_region_stats_sample();
+    if (unlikely(sample)) {
+        int64_t start = get_clock();
+
+        r = memory_region_dispatch_read1(mr, addr, pval, size, attrs);
+        memory_region_stats_account(mr, false, sample, get_clock() - start);
+    } else {
+        r = memory_region_dispatch_read1(mr, addr, pval, size, attrs);
+    }
     adjust_endianness(mr, pval, op);
     return r;
 }
@@ -1487,26 +1545,12 @@ static bool memory_region_dispatch_write_eventfds(MemoryRegion *mr,
     return false;
 }
 
-MemTxResult memory_region_dispatch_write(MemoryRegion *mr,
-                                         hwaddr addr,
-                                         uint64_t data,
-                                         MemOp op,
-                                         MemTxAttrs attrs)
+static MemTxResult memory_region_dispatch_write1(MemoryRegion *mr,
+                                                 hwaddr addr,
+                                                 uint64_t data,
+                                                 unsigned size,
+                                                 MemTxAttrs attrs)
 {
-    unsigned size = memop_size(op);
-
-    if (mr->alias) {
-        return memory_region_dispatch_write(mr->alias,
-                                            mr->alias_offset + addr,
-                                            data, op, attrs);
-    }
-    if (!memory_region_access_valid(mr, addr, size, true, attrs)) {
-        unassigned_mem_write(mr, addr, data, size);
-        return MEMTX_DECODE_ERROR;
-    }
-
-    adjust_endianness(mr, &data, op);
-
     /*
      * FIXME: it's not clear why under KVM the write would be processed
      * directly, instead of going through eventfd.  This probably should
@@ -1533,6 +1577,40 @@ MemTxResult memory_region_dispatch_write(MemoryRegion *mr,
     }
 }
 
+MemTxResult memory_region_dispatch_write(MemoryRegion *mr,
+                                         hwaddr addr,
+                                         uint64_t data,
+                                         MemOp op,
+                                         MemTxAttrs attrs)
+{
+    unsigned size = memop_size(op);
+    uint32_t sample;
+    MemTxResult r;
+
+    if (mr->alias) {
+        return memory_region_dispatch_write(mr->alias,
+                                            mr->alias_offset + addr,
+                                            data, op, attrs);
+    }
+    if (!memory_region_access_valid(mr, addr, size, true, attrs)) {
+        unassigned_mem_write(mr, addr, data, size);
+        return MEMTX_DECODE_ERROR;
+    }
+
+    adjust_endianness(mr, &data, op);
+
+    sample = memory_region_stats_sample();
+    if (unlikely(sample)) {
+        int64_t start = get_clock();
+
+        r = memory_region_dispatch_write1(mr, addr, data, size, attrs);
+        memory_region_stats_account(mr, true, sample, get_clock() - start);
+    } else {
+        r = memory_region_dispatch_write1(mr, addr, data, size, attrs);
+    }
+    return r;
+}
+
 void memory_region_init_io(MemoryRegion *mr,
                            Object *owner,
                            const MemoryRegionOps *ops,
@@ -1791,6 +1869,7 @@ static void memory_region_finalize(Object *obj)
     memory_region_clear_coalescing(mr);
     g_free((char *)mr->name);
     g_free(mr->ioeventfds);
+    memory_region_stats_free(mr);
 }
 
 Object *memory_region_owner(MemoryRegion *mr)
@@ -3133,6 +3212,10 @@ void address_space_init(AddressSpace *as, MemoryRegion *root, const char *name)
     as->ioeventfds = NULL;
     QTAILQ_INIT(&as->listeners);
     QTAILQ_INSERT_TAIL(&address_spaces, as, address_spaces_link);
+    as->max_bounce_buffer_size = DEFAULT_MAX_BOUNCE_BUFFER_SIZE;
+    as->bounce_buffer_size = 0;
+    qemu_mutex_init(&as->map_client_list_lock);
+    QLIST_INIT(&as->map_client_list);
     as->name = g_strdup(name ? name : "anonymous");
     address_space_update_topology(as);
     address_space_update_ioeventfds(as);
@@ -3140,8 +3223,12 @@ void address_space_init(AddressSpace *as, MemoryRegion *root, const char *name)
 
 static void do_address_space_destroy(AddressSpace *as)
 {
+    assert(qatomic_read(&as->bounce_buffer_size) == 0);
+    assert(QLIST_EMPTY(&as->map_client_list));
     assert(QTAILQ_EMPTY(&as->listeners));
 
+    qemu_mutex_destroy(&as->map_client_list_lock);
+
     flatview_unref(as->current_map);
     g_free(as->name);
     g_free(as->ioeventfds);
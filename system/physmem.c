@@ -59,6 +59,7 @@
 
 #include "qemu/rcu_queue.h"
 #include "qemu/main-loop.h"
+#include "qemu/lockable.h"
 #include "exec/translate-all.h"
 #include "sysemu/replay.h"
 
@@ -129,6 +130,8 @@ typedef struct PhysPageMap {
 
 struct AddressSpaceDispatch {
     MemoryRegionSection *mru_section;
+    /* Unique among all dispatches ever created, see PhysSectionCache */
+    uint64_t gen;
     /* This is a multi-level map on the physical address space.
      * The bottom level has pointers to MemoryRegionSections.
      */
@@ -332,6 +335,57 @@ static MemoryRegionSection *phys_page_find(AddressSpaceDispatch *d, hwaddr addr)
     }
 }
 
+/*
+ * Per-thread cache of recently used sections, backing up the MRU section
+ * of the dispatch.  Threads that switch between a few regions, such as a
+ * device model reading descriptors and then the buffers they point to,
+ * would otherwise walk the radix tree on nearly every access.  Entries
+ * are tagged with the generation of their dispatch, so that they never
+ * match once the FlatView has been replaced, even if the memory of the
+ * old dispatch is reused.
+ */
+#define PHYS_SECTION_CACHE_SIZE 4
+
+typedef struct PhysSectionCacheEntry {
+    uint64_t gen;
+    MemoryRegionSection *section;
+} PhysSectionCacheEntry;
+
+typedef struct PhysSectionCache {
+    PhysSectionCacheEntry entries[PHYS_SECTION_CACHE_SIZE];
+    unsigned int next;
+} PhysSectionCache;
+
+static __thread PhysSectionCache phys_section_cache;
+static uint64_t phys_dispatch_gen;
+
+/* Called from RCU critical section */
+static MemoryRegionSection *phys_section_cache_find(AddressSpaceDispatch *d,
+                                                    hwaddr addr)
+{
+    PhysSectionCache *cache = &phys_section_cache;
+    MemoryRegionSection *section;
+    int i;
+
+    for (i = 0; i < PHYS_SECTION_CACHE_SIZE; i++) {
+        PhysSectionCacheEntry *e = &cache->entries[i];
+
+        if (e->gen == d->gen && section_covers_addr(e->section, addr)) {
+            return e->section;
+        }
+    }
+
+    section = phys_page_find(d, addr);
+    if (section != &d->map.sections[PHYS_SECTION_UNASSIGNED]) {
+        cache->entries[cache->next] = (PhysSectionCacheEntry) {
+            .gen = d->gen,
+            .section = section,
+        };
+        cache->next = (cache->next + 1) % PHYS_SECTION_CACHE_SIZE;
+    }
+    return section;
+}
+
 /* Called from RCU critical section */
 static MemoryRegionSection *address_space_lookup_region(AddressSpaceDispatch *d,
                                                         hwaddr addr,
@@ -342,7 +396,7 @@ static MemoryRegionSection *address_space_lookup_region(AddressSpaceDispatch *d,
 
     if (!section || section == &d->map.sections[PHYS_SECTION_UNASSIGNED] ||
         !section_covers_addr(section, addr)) {
-        section = phys_page_find(d, addr);
+        section = phys_section_cache_find(d, addr);
         qatomic_set(&d->mru_section, section);
     }
     if (resolve_subpage && section->mr->subpage) {
@@ -2464,6 +2518,8 @@ AddressSpaceDispatch *address_space_dispatch_new(FlatView *fv)
     assert(n == PHYS_SECTION_UNASSIGNED);
 
     d->phys_map  = (PhysPageEntry) { .ptr = PHYS_MAP_NODE_NIL, .skip = 1 };
+    /* Generation 0 marks unused cache entries */
+    d->gen = ++phys_dispatch_gen;
 
     return d;
 }
@@ -2974,55 +3030,46 @@ void cpu_flush_icache_range(hwaddr start, hwaddr len)
                                      NULL, len, FLUSH_CACHE);
 }
 
+#define BOUNCE_BUFFER_MAGIC 0xb4017ceb4ffe12edULL
+
 typedef struct {
+    uint64_t magic;
     MemoryRegion *mr;
-    void *buffer;
     hwaddr addr;
-    hwaddr len;
-    bool in_use;
+    size_t len;
+    uint8_t buffer[];
 } BounceBuffer;
 
-static BounceBuffer bounce;
-
-typedef struct MapClient {
-    QEMUBH *bh;
-    QLIST_ENTRY(MapClient) link;
-} MapClient;
-
-QemuMutex map_client_list_lock;
-static QLIST_HEAD(, MapClient) map_client_list
-    = QLIST_HEAD_INITIALIZER(map_client_list);
-
-static void cpu_unregister_map_client_do(MapClient *client)
+static void
+address_space_unregister_map_client_do(AddressSpaceMapClient *client)
 {
     QLIST_REMOVE(client, link);
     g_free(client);
 }
 
-static void cpu_notify_map_clients_locked(void)
+static void address_space_notify_map_clients_locked(AddressSpace *as)
 {
-    MapClient *client;
+    AddressSpaceMapClient *client;
 
-    while (!QLIST_EMPTY(&map_client_list)) {
-        client = QLIST_FIRST(&map_client_list);
+    while (!QLIST_EMPTY(&as->map_client_list)) {
+        client = QLIST_FIRST(&as->map_client_list);
         qemu_bh_schedule(client->bh);
-        cpu_unregister_map_client_do(client);
+        address_space_unregister_map_client_do(client);
     }
 }
 
-void cpu_register_map_client(QEMUBH *bh)
+void address_space_register_map_client(AddressSpace *as, QEMUBH *bh)
 {
-    MapClient *client = g_malloc(sizeof(*client));
+    AddressSpaceMapClient *client = g_malloc(sizeof(*client));
 
-    qemu_mutex_lock(&map_client_list_lock);
+    QEMU_LOCK_GUARD(&as->map_client_list_lock);
     client->bh = bh;
-    QLIST_INSERT_HEAD(&map_client_list, client, link);
-    /* Write map_client_list before reading in_use.  */
+    QLIST_INSERT_HEAD(&as->map_client_list, client, link);
+    /* Write map_client_list before reading bounce_buffer_size.  */
     smp_mb();
-    if (!qatomic_read(&bounce.in_use)) {
-        cpu_notify_map_clients_locked();
+    if (qatomic_read(&as->bounce_buffer_size) < as->max_bounce_buffer_size) {
+        address_space_notify_map_clients_locked(as);
     }
-    qemu_mutex_unlock(&map_client_list_lock);
 }
 
 void cpu_exec_init_all(void)
@@ -3038,28 +3085,25 @@ void cpu_exec_init_all(void)
     finalize_target_page_bits();
     io_mem_init();
     memory_map_init();
-    qemu_mutex_init(&map_client_list_lock);
 }
 
-void cpu_unregister_map_client(QEMUBH *bh)
+void address_space_unregister_map_client(AddressSpace *as, QEMUBH *bh)
 {
-    MapClient *client;
+    AddressSpaceMapClient *client;
 
-    qemu_mutex_lock(&map_client_list_lock);
-    QLIST_FOREACH(client, &map_client_list, link) {
+    QEMU_LOCK_GUARD(&as->map_client_list_lock);
+    QLIST_FOREACH(client, &as->map_client_list, link) {
         if (client->bh == bh) {
-            cpu_unregister_map_client_do(client);
+            address_space_unregister_map_client_do(client);
             break;
         }
     }
-    qemu_mutex_unlock(&map_client_list_lock);
 }
 
-static void cpu_notify_map_clients(void)
+static void address_space_notify_map_clients(AddressSpace *as)
 {
-    qemu_mutex_lock(&map_client_list_lock);
-    cpu_notify_map_clients_locked();
-    qemu_mutex_unlock(&map_client_list_lock);
+    QEMU_LOCK_GUARD(&as->map_client_list_lock);
+    address_space_notify_map_clients_locked(as);
 }
 
 static bool flatview_access_valid(FlatView *fv, hwaddr addr, hwaddr len,
@@ -3126,8 +3170,8 @@ flatview_extend_translation(FlatView *fv, hwaddr addr,
  * May map a subset of the requested range, given by and returned in *plen.
  * May return NULL if resources needed to perform the mapping are exhausted.
  * Use only for reads OR writes - not for read-modify-write operations.
- * Use cpu_register_map_client() to know when retrying the map operation is
- * likely to succeed.
+ * Use address_space_register_map_client() to know when retrying the map
+ * operation is likely to succeed.
  */
 void *address_space_map(AddressSpace *as,
                         hwaddr addr,
@@ -3150,25 +3194,41 @@ void *address_space_map(AddressSpace *as,
     mr = flatview_translate(fv, addr, &xlat, &l, is_write, attrs);
 
     if (!memory_access_is_direct(mr, is_write)) {
-        if (qatomic_xchg(&bounce.in_use, true)) {
+        size_t used = qatomic_read(&as->bounce_buffer_size);
+        BounceBuffer *bounce;
+
+        /* Avoid unbounded allocations: take what is left of the limit */
+        for (;;) {
+            hwaddr alloc = MIN(as->max_bounce_buffer_size - used, l);
+            size_t new_size = used + alloc;
+            size_t actual = qatomic_cmpxchg(&as->bounce_buffer_size, used,
+                                            new_size);
+            if (actual == used) {
+                l = alloc;
+                break;
+            }
+            used = actual;
+        }
+
+        if (l == 0) {
             *plen = 0;
             return NULL;
         }
-        /* Avoid unbounded allocations */
-        l = MIN(l, TARGET_PAGE_SIZE);
-        bounce.buffer = qemu_memalign(TARGET_PAGE_SIZE, l);
-        bounce.addr = addr;
-        bounce.len = l;
 
+        bounce = g_malloc0(l + sizeof(BounceBuffer));
+        bounce->magic = BOUNCE_BUFFER_MAGIC;
         memory_region_ref(mr);
-        bounce.mr = mr;
+        bounce->mr = mr;
+        bounce->addr = addr;
+        bounce->len = l;
+
         if (!is_write) {
             flatview_read(fv, addr, MEMTXATTRS_UNSPECIFIED,
-                               bounce.buffer, l);
+                          bounce->buffer, l);
         }
 
         *plen = l;
-        return bounce.buffer;
+        return bounce->buffer;
     }
 
 
@@ -3186,12 +3246,12 @@ void *address_space_map(AddressSpace *as,
 void address_space_unmap(AddressSpace *as, void *buffer, hwaddr len,
                          bool is_write, hwaddr access_len)
 {
-    if (buffer != bounce.buffer) {
-        MemoryRegion *mr;
-        ram_addr_t addr1;
+    MemoryRegion *mr;
+    ram_addr_t addr1;
+    BounceBuffer *bounce;
 
-        mr = memory_region_from_host(buffer, &addr1);
-        assert(mr != NULL);
+    mr = memory_region_from_host(buffer, &addr1);
+    if (mr != NULL) {
         if (is_write) {
             invalidate_and_set_dirty(mr, addr1, access_len);
         }
@@ -3201,16 +3261,22 @@ void address_space_unmap(AddressSpace *as, void *buffer, hwaddr len,
         memory_region_unref(mr);
         return;
     }
+
+    bounce = container_of(buffer, BounceBuffer, buffer);
+    assert(bounce->magic == BOUNCE_BUFFER_MAGIC);
+
     if (is_write) {
-        address_space_write(as, bounce.addr, MEMTXATTRS_UNSPECIFIED,
-                            bounce.buffer, access_len);
+        address_space_write(as, bounce->addr, MEMTXATTRS_UNSPECIFIED,
+                            bounce->buffer, access_len);
     }
-    qemu_vfree(bounce.buffer);
-    bounce.buffer = NULL;
-    memory_region_unref(bounce.mr);
-    /* Clear in_use before reading map_client_list.  */
-    qatomic_set_mb(&bounce.in_use, false);
-    cpu_notify_map_clients();
+
+    qatomic_sub(&as->bounce_buffer_size, bounce->len);
+    bounce->magic = ~BOUNCE_BUFFER_MAGIC;
+    memory_region_unref(bounce->mr);
+    g_free(bounce);
+    /* Write bounce_buffer_size before reading map_client_list.  */
+    smp_mb();
+    address_space_notify_map_clients(as);
 }
 
 void *cpu_physical_memory_map(hwaddr addr,
@@ -3392,7 +3458,7 @@ int cpu_memory_rw_debug(CPUState *cpu, vaddr addr,
     cpu_synchronize_state(cpu);
     while (len > 0) {
         int asidx;
-        MemTxAttrs attrs;
+        MemTxAttrs attrs, next_attrs;
         MemTxResult res;
 
         page = addr & TARGET_PAGE_MASK;
@@ -3402,9 +3468,29 @@ int cpu_memory_rw_debug(CPUState *cpu, vaddr addr,
         if (phys_addr == -1)
             return -1;
         l = (page + TARGET_PAGE_SIZE) - addr;
+        phys_addr += (addr & ~TARGET_PAGE_MASK);
+
+        /*
+         * Extend the access over the following pages for as long as they
+         * are physically contiguous, so that large reads from a debugger
+         * go through the address space once per run rather than once
+         * per page.
+         */
+        while (l < len) {
+            hwaddr next = cpu_get_phys_page_attrs_debug(cpu, addr + l,
+                                                        &next_attrs);
+
+            if (next != phys_addr + l ||
+                cpu_asidx_from_attrs(cpu, next_attrs) != asidx ||
+                next_attrs.secure != attrs.secure ||
+                next_attrs.space != attrs.space ||
+                next_attrs.user != attrs.user) {
+                break;
+            }
+            l += TARGET_PAGE_SIZE;
+        }
         if (l > len)
             l = len;
-        phys_addr += (addr & ~TARGET_PAGE_MASK);
         if (is_write) {
             res = address_space_write_rom(cpu->cpu_ases[asidx].as, phys_addr,
                                           attrs, buf, l);
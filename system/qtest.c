@@ -58,6 +58,21 @@ static GTimer *timer;
 static bool qtest_opened;
 static void (*qtest_server_send)(void*, const char*);
 static void *qtest_server_send_opaque;
+static bool qtest_binary;
+
+enum {
+    QTEST_BINARY_END,
+    QTEST_BINARY_READ,
+    QTEST_BINARY_WRITE,
+};
+
+typedef struct QEMU_PACKED QTestBinaryRequest {
+    uint8_t op;
+    uint8_t size;
+    uint8_t reserved[6];
+    uint64_t addr;
+    uint64_t value;
+} QTestBinaryRequest;
 
 #define FMT_timeval "%.06f"
 
@@ -245,6 +260,24 @@ static void *qtest_server_send_opaque;
  *
  * Forcibly set the given interrupt pin to the given level.
  *
+ * Binary accesses:
+ * """"""""""""""""
+ *
+ * .. code-block:: none
+ *
+ *  > binary
+ *  < OK
+ *
+ * Switches the stream to binary framing, so that harnesses measuring the
+ * cost of device accesses are not dominated by parsing the text commands.
+ * Each request is 24 bytes, little endian: a u8 operation (0 to go back to
+ * text commands, 1 to read, 2 to write), a u8 SIZE of 1, 2, 4 or 8, six
+ * reserved bytes, a u64 ADDR and a u64 VALUE, which is ignored for reads.
+ * Every request is answered with a u64, little endian: the value read, or
+ * 0.  Values are converted like those of the read and write commands.
+ * Requests can be pipelined.  Binary mode needs a chardev and cannot be
+ * combined with IRQ interception, whose messages would break the framing.
+ *
  */
 
 static int hex2nib(char ch)
@@ -785,6 +818,15 @@ static void qtest_process_command(CharBackend *chr, gchar **words)
         qtest_send_prefix(chr);
         qtest_sendf(chr, "OK %"PRIi64"\n",
                     (int64_t)qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL));
+    } else if (strcmp(words[0], "binary") == 0) {
+        qtest_send_prefix(chr);
+        if (!chr || irq_intercept_dev) {
+            qtest_send(chr, "FAIL binary mode needs a chardev and "
+                       "no IRQ interception\n");
+        } else {
+            qtest_send(chr, "OK\n");
+            qtest_binary = true;
+        }
     } else if (process_command_cb && process_command_cb(chr, words)) {
         /* Command got consumed by the callback handler */
     } else {
@@ -793,15 +835,120 @@ static void qtest_process_command(CharBackend *chr, gchar **words)
     }
 }
 
+static uint64_t qtest_binary_access(const QTestBinaryRequest *req)
+{
+    bool is_write = req->op == QTEST_BINARY_WRITE;
+    uint64_t addr = le64_to_cpu(req->addr);
+    uint64_t value = le64_to_cpu(req->value);
+    union {
+        uint8_t b;
+        uint16_t w;
+        uint32_t l;
+        uint64_t q;
+    } data;
+
+    if (qtest_log_fp) {
+        fprintf(qtest_log_fp, "[R +" FMT_timeval "] binary %s%u 0x%" PRIx64,
+                g_timer_elapsed(timer, NULL), is_write ? "write" : "read",
+                req->size, addr);
+        if (is_write) {
+            fprintf(qtest_log_fp, " 0x%" PRIx64, value);
+        }
+        fprintf(qtest_log_fp, "\n");
+    }
+
+    switch (req->size) {
+    case 1:
+        data.b = value;
+        break;
+    case 2:
+        data.w = tswap16(value);
+        break;
+    case 4:
+        data.l = tswap32(value);
+        break;
+    case 8:
+        data.q = tswap64(value);
+        break;
+    default:
+        g_assert_not_reached();
+    }
+
+    if (is_write) {
+        address_space_write(first_cpu->as, addr, MEMTXATTRS_UNSPECIFIED,
+                            &data, req->size);
+        return 0;
+    }
+
+    address_space_read(first_cpu->as, addr, MEMTXATTRS_UNSPECIFIED,
+                       &data, req->size);
+    switch (req->size) {
+    case 1:
+        return data.b;
+    case 2:
+        return tswap16(data.w);
+    case 4:
+        return tswap32(data.l);
+    default:
+        return tswap64(data.q);
+    }
+}
+
+/* Answer the complete binary requests in @inbuf with a single write */
+static void qtest_process_binary(CharBackend *chr, GString *inbuf)
+{
+    g_autoptr(GByteArray) replies = g_byte_array_new();
+    size_t offset = 0;
+
+    while (qtest_binary &&
+           inbuf->len - offset >= sizeof(QTestBinaryRequest)) {
+        QTestBinaryRequest req;
+        uint64_t reply = 0;
+
+        memcpy(&req, inbuf->str + offset, sizeof(req));
+        offset += sizeof(req);
+
+        switch (req.op) {
+        case QTEST_BINARY_END:
+            qtest_binary = false;
+            break;
+        case QTEST_BINARY_READ:
+        case QTEST_BINARY_WRITE:
+            reply = cpu_to_le64(qtest_binary_access(&req));
+            break;
+        default:
+            g_assert_not_reached();
+        }
+        g_byte_array_append(replies, (uint8_t *)&reply, sizeof(reply));
+    }
+
+    g_string_erase(inbuf, 0, offset);
+    if (replies->len) {
+        qemu_chr_fe_write_all(chr, replies->data, replies->len);
+    }
+}
+
 static void qtest_process_inbuf(CharBackend *chr, GString *inbuf)
 {
     char *end;
 
-    while ((end = strchr(inbuf->str, '\n')) != NULL) {
+    for (;;) {
         size_t offset;
         GString *cmd;
         gchar **words;
 
+        if (qtest_binary) {
+            qtest_process_binary(chr, inbuf);
+            if (qtest_binary) {
+                break;
+            }
+            continue;
+        }
+
+        end = strchr(inbuf->str, '\n');
+        if (!end) {
+            break;
+        }
         offset = end - inbuf->str;
 
         cmd = g_string_new_len(inbuf->str, offset);
@@ -825,6 +972,9 @@ static void qtest_read(void *opaque, const uint8_t *buf, int size)
 
 static int qtest_can_read(void *opaque)
 {
+    if (qtest_binary) {
+        return sizeof(QTestBinaryRequest) * 1024;
+    }
     return 1024;
 }
 
@@ -853,6 +1003,7 @@ static void qtest_event(void *opaque, QEMUChrEvent event)
         break;
     case CHR_EVENT_CLOSED:
         qtest_opened = false;
+        qtest_binary = false;
         if (qtest_log_fp) {
             fprintf(qtest_log_fp, "[I +" FMT_timeval "] CLOSED\n", g_timer_elapsed(timer, NULL));
         }
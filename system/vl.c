@@ -182,6 +182,10 @@ static bool list_data_dirs;
 static const char *qtest_chrdev;
 static const char *qtest_log;
 
+/* For -d startup, see startup_mark() */
+static int64_t startup_last_ns;
+static GString *startup_times;
+
 static int has_defaults = 1;
 static int default_audio = 1;
 static int default_serial = 1;
@@ -447,6 +451,12 @@ static QemuOptsList qemu_icount_opts = {
         }, {
             .name = "rrsnapshot",
             .type = QEMU_OPT_STRING,
+        }, {
+            .name = "rrcheckpoint",
+            .type = QEMU_OPT_NUMBER,
+        }, {
+            .name = "iosync",
+            .type = QEMU_OPT_STRING,
         },
         { /* end of list */ }
     },
@@ -2695,6 +2705,32 @@ static void qemu_machine_creation_done(void)
     }
 }
 
+/*
+ * Record the time since the previous mark as spent in @phase.  The
+ * marks are cheap, so they are always taken; startup_report() logs
+ * them if -d startup was given.
+ */
+static void startup_mark(const char *phase)
+{
+    int64_t now = get_clock();
+
+    if (!startup_times) {
+        startup_times = g_string_new(NULL);
+    } else {
+        g_string_append_printf(startup_times, "  %-20s %9.3f ms\n", phase,
+                               (now - startup_last_ns) / (double)SCALE_MS);
+    }
+    startup_last_ns = now;
+}
+
+static void startup_report(void)
+{
+    if (qemu_loglevel_mask(LOG_STARTUP) && startup_times->len) {
+        qemu_log("startup phases:\n%s", startup_times->str);
+    }
+    g_string_truncate(startup_times, 0);
+}
+
 void qmp_x_exit_preconfig(Error **errp)
 {
     if (phase_check(PHASE_MACHINE_INITIALIZED)) {
@@ -2702,9 +2738,19 @@ void qmp_x_exit_preconfig(Error **errp)
         return;
     }
 
+    if (preconfig_requested) {
+        /* Don't count the time spent waiting for the preconfig commands */
+        startup_last_ns = get_clock();
+    }
     qemu_init_board();
+    startup_mark("board");
     qemu_create_cli_devices();
+    startup_mark("devices");
     qemu_machine_creation_done();
+    startup_mark("machine done");
+    if (preconfig_requested) {
+        startup_report();
+    }
 
     if (loadvm) {
         RunState state = autostart ? RUN_STATE_RUNNING : runstate_get();
@@ -2740,6 +2786,7 @@ void qemu_init(int argc, char **argv)
     bool userconfig = true;
     FILE *vmstate_dump_file = NULL;
 
+    startup_mark(NULL);
     qemu_add_opts(&qemu_drive_opts);
     qemu_add_drive_opts(&qemu_legacy_drive_opts);
     qemu_add_drive_opts(&qemu_common_drive_opts);
@@ -2782,6 +2829,7 @@ void qemu_init(int argc, char **argv)
     qemu_init_arch_modules();
 
     qemu_init_subsystems();
+    startup_mark("modules and types");
 
     /* first pass of option parsing */
     optind = 1;
@@ -3633,6 +3681,7 @@ void qemu_init(int argc, char **argv)
     qemu_process_early_options();
 
     qemu_process_help_options();
+    startup_mark("options");
     qemu_maybe_daemonize(pid_file);
 
     /*
@@ -3659,7 +3708,9 @@ void qemu_init(int argc, char **argv)
     /* Transfer QemuOpts options into machine options */
     parse_memory_options();
 
+    startup_mark("main loop");
     qemu_create_machine(machine_opts_dict);
+    startup_mark("machine");
 
     suspend_mux_open();
 
@@ -3667,6 +3718,7 @@ void qemu_init(int argc, char **argv)
     qemu_setup_display();
     qemu_create_default_devices();
     qemu_create_early_backends();
+    startup_mark("early backends");
 
     qemu_apply_legacy_machine_options(machine_opts_dict);
     qemu_apply_machine_options(machine_opts_dict);
@@ -3679,6 +3731,7 @@ void qemu_init(int argc, char **argv)
      */
     configure_accelerators(argv[0]);
     phase_advance(PHASE_ACCEL_CREATED);
+    startup_mark("accelerator");
 
     /*
      * Beware, QOM objects created before this point miss global and
@@ -3709,6 +3762,7 @@ void qemu_init(int argc, char **argv)
      */
     qemu_create_late_backends();
     phase_advance(PHASE_LATE_BACKENDS_CREATED);
+    startup_mark("late backends");
 
     /*
      * Note: creates a QOM object, must run only after global and
@@ -3725,6 +3779,7 @@ void qemu_init(int argc, char **argv)
 
     qemu_resolve_machine_memdev();
     parse_numa_opts(current_machine);
+    startup_mark("cpu and memory");
 
     if (vmstate_dump_file) {
         /* dump and exit */
@@ -3737,7 +3792,9 @@ void qemu_init(int argc, char **argv)
         qmp_x_exit_preconfig(&error_fatal);
     }
     qemu_init_displays();
+    startup_mark("displays");
     accel_setup_post(current_machine);
     os_setup_post();
     resume_mux_open();
+    startup_report();
 }
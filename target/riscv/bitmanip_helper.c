@@ -20,34 +20,25 @@
 
 #include "qemu/osdep.h"
 #include "qemu/host-utils.h"
+#include "crypto/clmul.h"
 #include "exec/exec-all.h"
 #include "exec/helper-proto.h"
 #include "tcg/tcg.h"
 
+/*
+ * clmul_64 uses PCLMULQDQ or PMULL when the host has them.  For RV32 the
+ * inputs are zero-extended, and the whole product fits in the low half.
+ */
 target_ulong HELPER(clmul)(target_ulong rs1, target_ulong rs2)
 {
-    target_ulong result = 0;
-
-    for (int i = 0; i < TARGET_LONG_BITS; i++) {
-        if ((rs2 >> i) & 1) {
-            result ^= (rs1 << i);
-        }
-    }
-
-    return result;
+    return int128_getlo(clmul_64(rs1, rs2));
 }
 
 target_ulong HELPER(clmulr)(target_ulong rs1, target_ulong rs2)
 {
-    target_ulong result = 0;
-
-    for (int i = 0; i < TARGET_LONG_BITS; i++) {
-        if ((rs2 >> i) & 1) {
-            result ^= (rs1 >> (TARGET_LONG_BITS - i - 1));
-        }
-    }
+    Int128 r = clmul_64(rs1, rs2);
 
-    return result;
+    return int128_getlo(int128_urshift(r, TARGET_LONG_BITS - 1));
 }
 
 static inline target_ulong do_swap(target_ulong x, uint64_t mask, int shift)
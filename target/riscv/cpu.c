@@ -814,6 +814,9 @@ static void riscv_cpu_dump_state(CPUState *cs, FILE *f, int flags)
             qemu_fprintf(f, "\n");
         }
     }
+    if (kvm_enabled() && (flags & (CPU_DUMP_FPU | CPU_DUMP_VPU))) {
+        kvm_riscv_sync_ext_regs(cpu);
+    }
     if (flags & CPU_DUMP_FPU) {
         for (i = 0; i < 32; i++) {
             qemu_fprintf(f, " %-8s %016" PRIx64,
@@ -988,6 +991,10 @@ static void riscv_cpu_reset_hold(Object *obj)
     }
 
     pmp_unlock_entries(env);
+    riscv_cpu_ptw_cache_flush(env);
+    memset(env->pmu_pending, 0, sizeof(env->pmu_pending));
+    memset(env->pmu_pending_left, 0, sizeof(env->pmu_pending_left));
+    riscv_cpu_irq_pending_changed(env);
 #endif
     env->xl = riscv_cpu_mxl(env);
     riscv_cpu_update_mask(env);
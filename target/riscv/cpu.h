@@ -157,6 +157,26 @@ typedef struct PMUCTRState {
     target_ulong irq_overflow_left;
 } PMUCTRState;
 
+/* Events counted in batches, see riscv_pmu_count */
+typedef enum RISCVPMUPending {
+    RISCV_PMU_PENDING_ITLB_MISS,
+    RISCV_PMU_PENDING_DTLB_READ_MISS,
+    RISCV_PMU_PENDING_DTLB_WRITE_MISS,
+    RISCV_PMU_PENDING_NUM
+} RISCVPMUPending;
+
+/*
+ * Page walk cache entry.  @key is the root page table address, ORed with
+ * the translation mode and the kind of walk, or 0 for an invalid entry.
+ */
+typedef struct RISCVPTWCacheEntry {
+    hwaddr key;
+    target_ulong tag;
+    hwaddr base;
+} RISCVPTWCacheEntry;
+
+#define RISCV_PTW_CACHE_SIZE 16
+
 struct CPUArchState {
     target_ulong gpr[32];
     target_ulong gprh[32]; /* 64 top bits of the 128-bit registers */
@@ -243,6 +263,13 @@ struct CPUArchState {
      */
     uint64_t vsie;
 
+    /*
+     * Interrupt that riscv_cpu_exec_interrupt() would take, or
+     * RISCV_EXCP_NONE, valid while irq_pending_valid is set.
+     */
+    int irq_pending;
+    bool irq_pending_valid;
+
     target_ulong satp;   /* since: priv-1.10.0 */
     target_ulong stval;
     target_ulong medeleg;
@@ -347,6 +374,10 @@ struct CPUArchState {
     /* PMU event selector configured values for RV32 */
     target_ulong mhpmeventh_val[RV_MAX_MHPMEVENTS];
 
+    /* Events not yet added to their counter, and room left in the batch */
+    uint32_t pmu_pending[RISCV_PMU_PENDING_NUM];
+    int32_t pmu_pending_left[RISCV_PMU_PENDING_NUM];
+
     target_ulong sscratch;
     target_ulong mscratch;
 
@@ -412,6 +443,20 @@ struct CPUArchState {
     uint64_t sstateen[SMSTATEEN_MAX_COUNT];
     target_ulong senvcfg;
     uint64_t henvcfg;
+
+    /*
+     * Last-level page tables of recent walks, and G-stage translations
+     * of the page tables of recent VS-stage walks.
+     */
+    RISCVPTWCacheEntry ptw_cache[RISCV_PTW_CACHE_SIZE];
+    RISCVPTWCacheEntry gstage_cache[RISCV_PTW_CACHE_SIZE];
+
+    /*
+     * TLB slot in use by the host (0) and the guest (1), and the satp
+     * value that the entries of the slot not in use were filled with.
+     */
+    uint8_t tlb_slot[2];
+    target_ulong tlb_slot_atp[2][2];
 #endif
     target_ulong cur_pmmask;
     target_ulong cur_pmbase;
@@ -431,6 +476,10 @@ struct CPUArchState {
     uint64_t kvm_timer_compare;
     uint64_t kvm_timer_state;
     uint64_t kvm_timer_frequency;
+
+    /* FP and vector registers: in env (valid), to be put to KVM (dirty) */
+    bool kvm_ext_regs_valid;
+    bool kvm_ext_regs_dirty;
 #endif /* CONFIG_KVM */
 };
 
@@ -478,6 +527,15 @@ static inline int riscv_has_ext(CPURISCVState *env, target_ulong ext)
     return (env->misa_ext & ext) != 0;
 }
 
+/*
+ * Must be called whenever the pending, enable, delegation or priority
+ * state of the interrupts, or the privilege mode, may have changed.
+ */
+static inline void riscv_cpu_irq_pending_changed(CPURISCVState *env)
+{
+    env->irq_pending_valid = false;
+}
+
 #include "cpu_user.h"
 
 extern const char * const riscv_int_regnames[];
@@ -503,6 +561,10 @@ target_ulong riscv_cpu_get_geilen(CPURISCVState *env);
 void riscv_cpu_set_geilen(CPURISCVState *env, target_ulong geilen);
 bool riscv_cpu_vector_enabled(CPURISCVState *env);
 void riscv_cpu_set_virt_enabled(CPURISCVState *env, bool enable);
+void riscv_cpu_ptw_cache_flush(CPURISCVState *env);
+void riscv_cpu_tlb_flush_virt(CPURISCVState *env, bool virt);
+void riscv_cpu_tlb_switch_atp(CPURISCVState *env, bool virt,
+                              target_ulong old_atp, target_ulong atp);
 int riscv_env_mmu_index(CPURISCVState *env, bool ifetch);
 G_NORETURN void  riscv_cpu_do_unaligned_access(CPUState *cs, vaddr addr,
                                                MMUAccessType access_type,
@@ -549,31 +611,34 @@ G_NORETURN void riscv_raise_exception(CPURISCVState *env,
 
 target_ulong riscv_cpu_get_fflags(CPURISCVState *env);
 void riscv_cpu_set_fflags(CPURISCVState *env, target_ulong);
+bool riscv_cpu_frm_is_current(CPURISCVState *env);
 
 #include "exec/cpu-all.h"
 
-FIELD(TB_FLAGS, MEM_IDX, 0, 3)
-FIELD(TB_FLAGS, FS, 3, 2)
+FIELD(TB_FLAGS, MEM_IDX, 0, 4)
+FIELD(TB_FLAGS, FS, 4, 2)
 /* Vector flags */
-FIELD(TB_FLAGS, VS, 5, 2)
-FIELD(TB_FLAGS, LMUL, 7, 3)
-FIELD(TB_FLAGS, SEW, 10, 3)
-FIELD(TB_FLAGS, VL_EQ_VLMAX, 13, 1)
-FIELD(TB_FLAGS, VILL, 14, 1)
-FIELD(TB_FLAGS, VSTART_EQ_ZERO, 15, 1)
+FIELD(TB_FLAGS, VS, 6, 2)
+FIELD(TB_FLAGS, LMUL, 8, 3)
+FIELD(TB_FLAGS, SEW, 11, 3)
+FIELD(TB_FLAGS, VL_EQ_VLMAX, 14, 1)
+FIELD(TB_FLAGS, VILL, 15, 1)
+FIELD(TB_FLAGS, VSTART_EQ_ZERO, 16, 1)
 /* The combination of MXL/SXL/UXL that applies to the current cpu mode. */
-FIELD(TB_FLAGS, XL, 16, 2)
+FIELD(TB_FLAGS, XL, 17, 2)
 /* If PointerMasking should be applied */
-FIELD(TB_FLAGS, PM_MASK_ENABLED, 18, 1)
-FIELD(TB_FLAGS, PM_BASE_ENABLED, 19, 1)
-FIELD(TB_FLAGS, VTA, 20, 1)
-FIELD(TB_FLAGS, VMA, 21, 1)
+FIELD(TB_FLAGS, PM_MASK_ENABLED, 19, 1)
+FIELD(TB_FLAGS, PM_BASE_ENABLED, 20, 1)
+FIELD(TB_FLAGS, VTA, 21, 1)
+FIELD(TB_FLAGS, VMA, 22, 1)
 /* Native debug itrigger */
-FIELD(TB_FLAGS, ITRIGGER, 22, 1)
+FIELD(TB_FLAGS, ITRIGGER, 23, 1)
 /* Virtual mode enabled */
-FIELD(TB_FLAGS, VIRT_ENABLED, 23, 1)
-FIELD(TB_FLAGS, PRIV, 24, 2)
-FIELD(TB_FLAGS, AXL, 26, 2)
+FIELD(TB_FLAGS, VIRT_ENABLED, 24, 1)
+FIELD(TB_FLAGS, PRIV, 25, 2)
+FIELD(TB_FLAGS, AXL, 27, 2)
+/* fp_status already holds the rounding mode selected by frm */
+FIELD(TB_FLAGS, FRM_CURRENT, 29, 1)
 
 #ifdef TARGET_RISCV32
 #define riscv_cpu_mxl(env)  ((void)(env), MXL_RV32)
@@ -58,6 +58,9 @@ int riscv_env_mmu_index(CPURISCVState *env, bool ifetch)
         }
     }
 
+    if (mode != PRV_M && env->tlb_slot[virt]) {
+        mode |= MMU_SLOT_BIT;
+    }
     return mode | (virt ? MMU_2STAGE_BIT : 0);
 #endif
 }
@@ -138,6 +141,9 @@ void cpu_get_tb_cpu_state(CPURISCVState *env, vaddr *pc,
     flags = FIELD_DP32(flags, TB_FLAGS, VS, vs);
     flags = FIELD_DP32(flags, TB_FLAGS, XL, env->xl);
     flags = FIELD_DP32(flags, TB_FLAGS, AXL, cpu_address_xl(env));
+    if (fs != EXT_STATUS_DISABLED && riscv_cpu_frm_is_current(env)) {
+        flags = FIELD_DP32(flags, TB_FLAGS, FRM_CURRENT, 1);
+    }
     if (env->cur_pmmask != 0) {
         flags = FIELD_DP32(flags, TB_FLAGS, PM_MASK_ENABLED, 1);
     }
@@ -498,7 +504,13 @@ bool riscv_cpu_exec_interrupt(CPUState *cs, int interrupt_request)
     if (interrupt_request & CPU_INTERRUPT_HARD) {
         RISCVCPU *cpu = RISCV_CPU(cs);
         CPURISCVState *env = &cpu->env;
-        int interruptno = riscv_cpu_local_irq_pending(env);
+        int interruptno;
+
+        if (!env->irq_pending_valid) {
+            env->irq_pending = riscv_cpu_local_irq_pending(env);
+            env->irq_pending_valid = true;
+        }
+        interruptno = env->irq_pending;
         if (interruptno >= 0) {
             cs->exception_index = RISCV_EXCP_INT_FLAG | interruptno;
             riscv_cpu_do_interrupt(cs);
@@ -546,6 +558,7 @@ void riscv_cpu_swap_hypervisor_regs(CPURISCVState *env)
     bool current_virt = env->virt_enabled;
 
     g_assert(riscv_has_ext(env, RVH));
+    riscv_cpu_irq_pending_changed(env);
 
     if (current_virt) {
         /* Current V=1 and we are about to change to V=0 */
@@ -621,12 +634,17 @@ void riscv_cpu_set_geilen(CPURISCVState *env, target_ulong geilen)
 /* This function can only be called to set virt when RVH is enabled */
 void riscv_cpu_set_virt_enabled(CPURISCVState *env, bool enable)
 {
-    /* Flush the TLB on all virt mode changes. */
+    /*
+     * No TLB flush is needed, the host and the guest translations live
+     * in different mmu_idx.  The page walk caches are keyed by the root
+     * of the page tables and the kind of walk, so they are fine as well.
+     */
     if (env->virt_enabled != enable) {
-        tlb_flush(env_cpu(env));
+        riscv_pmu_flush(env);
     }
 
     env->virt_enabled = enable;
+    riscv_cpu_irq_pending_changed(env);
 
     if (enable) {
         /*
@@ -660,6 +678,7 @@ void riscv_cpu_interrupt(CPURISCVState *env)
 
     BQL_LOCK_GUARD();
 
+    riscv_cpu_irq_pending_changed(env);
     if (env->virt_enabled) {
         gein = get_field(env->hstatus, HSTATUS_VGEIN);
         vsgein = (env->hgeip & (1ULL << gein)) ? MIP_VSEIP : 0;
@@ -721,8 +740,14 @@ void riscv_cpu_set_mode(CPURISCVState *env, target_ulong newpriv)
     if (icount_enabled() && newpriv != env->priv) {
         riscv_itrigger_update_priv(env);
     }
+    if (newpriv != env->priv) {
+        /* Pending PMU events were counted subject to the old mode filter */
+        riscv_pmu_flush(env);
+    }
     /* tlb_flush is unnecessary as mode is contained in mmu_idx */
     env->priv = newpriv;
+    /* Callers may also have changed mstatus.xIE, so always recompute */
+    riscv_cpu_irq_pending_changed(env);
     env->xl = cpu_recompute_xl(env);
     riscv_cpu_update_mask(env);
 
@@ -773,6 +798,96 @@ static int get_physical_address_pmp(CPURISCVState *env, int *prot, hwaddr addr,
     return TRANSLATE_SUCCESS;
 }
 
+/*
+ * Page walk caches.
+ *
+ * ptw_cache remembers the last-level page table found by recent walks, so
+ * that the next walk through the same non-leaf PTEs starts at the last
+ * level.  gstage_cache remembers the G-stage translation of the page
+ * tables visited by VS-stage walks.  Both only hold translations that a
+ * hart may cache until the next SFENCE.VMA or HFENCE.  They are also
+ * flushed when PMP or MXR change, since PMP checks the PTE accesses and
+ * MXR affects G-stage permissions.
+ */
+enum {
+    PTW_SINGLE_STAGE = 1,
+    PTW_VS_STAGE = 2,
+    PTW_G_STAGE = 3,
+};
+
+void riscv_cpu_ptw_cache_flush(CPURISCVState *env)
+{
+    memset(env->ptw_cache, 0, sizeof(env->ptw_cache));
+    memset(env->gstage_cache, 0, sizeof(env->gstage_cache));
+}
+
+/*
+ * Flush the TLB entries of the guest (virt) or of the host, e.g. on
+ * SFENCE.VMA or HFENCE.  Each side keeps its entries across world switches
+ * and across fences for the other one.
+ */
+void riscv_cpu_tlb_flush_virt(CPURISCVState *env, bool virt)
+{
+    tlb_flush_by_mmuidx(env_cpu(env),
+                        virt ? MMU_GUEST_IDX_MASK : MMU_HOST_IDX_MASK);
+}
+
+/*
+ * Each world has two TLB slots, i.e. two sets of U and S mmu_idx, so
+ * that a context switch back to the previous address space finds its
+ * translations still there.  Translations are tagged by the whole satp
+ * (or vsatp) value, ASID and root alike, which is stricter than what the
+ * ISA allows to cache.  Any other value evicts the slot not in use.
+ */
+void riscv_cpu_tlb_switch_atp(CPURISCVState *env, bool virt,
+                              target_ulong old_atp, target_ulong atp)
+{
+    int cur = env->tlb_slot[virt];
+    int next = !cur;
+
+    if (env->tlb_slot_atp[virt][next] != atp) {
+        tlb_flush_by_mmuidx(env_cpu(env),
+                            MMU_SLOT_IDX_MASK <<
+                            ((virt ? MMU_2STAGE_BIT : 0) |
+                             (next ? MMU_SLOT_BIT : 0)));
+    }
+    env->tlb_slot_atp[virt][cur] = old_atp;
+    env->tlb_slot[virt] = next;
+}
+
+static hwaddr ptw_cache_key(CPURISCVState *env, target_ulong atp, int kind)
+{
+    if (riscv_cpu_mxl(env) == MXL_RV32) {
+        return ((hwaddr)get_field(atp, SATP32_PPN) << PGSHIFT) |
+               (get_field(atp, SATP32_MODE) << 2) | kind;
+    } else {
+        return ((hwaddr)get_field(atp, SATP64_PPN) << PGSHIFT) |
+               (get_field(atp, SATP64_MODE) << 2) | kind;
+    }
+}
+
+static bool ptw_cache_lookup(RISCVPTWCacheEntry *cache, hwaddr key,
+                             target_ulong tag, hwaddr *base)
+{
+    RISCVPTWCacheEntry *e = &cache[tag % RISCV_PTW_CACHE_SIZE];
+
+    if (e->key == key && e->tag == tag) {
+        *base = e->base;
+        return true;
+    }
+    return false;
+}
+
+static void ptw_cache_insert(RISCVPTWCacheEntry *cache, hwaddr key,
+                             target_ulong tag, hwaddr base)
+{
+    RISCVPTWCacheEntry *e = &cache[tag % RISCV_PTW_CACHE_SIZE];
+
+    e->key = key;
+    e->tag = tag;
+    e->base = base;
+}
+
 /*
  * get_physical_address - get the physical address for this virtual address
  *
@@ -834,10 +949,17 @@ static int get_physical_address(CPURISCVState *env, hwaddr *physical,
 
     *ret_prot = 0;
 
-    hwaddr base;
+    hwaddr base, ptw_key;
     int levels, ptidxbits, ptesize, vm, widened;
 
     if (first_stage == true) {
+        if (two_stage) {
+            ptw_key = ptw_cache_key(env, use_background ? env->vsatp
+                                                        : env->satp,
+                                    PTW_VS_STAGE);
+        } else {
+            ptw_key = ptw_cache_key(env, env->satp, PTW_SINGLE_STAGE);
+        }
         if (use_background) {
             if (riscv_cpu_mxl(env) == MXL_RV32) {
                 base = (hwaddr)get_field(env->vsatp, SATP32_PPN) << PGSHIFT;
@@ -864,6 +986,7 @@ static int get_physical_address(CPURISCVState *env, hwaddr *physical,
             base = (hwaddr)get_field(env->hgatp, SATP64_PPN) << PGSHIFT;
             vm = get_field(env->hgatp, SATP64_MODE);
         }
+        ptw_key = ptw_cache_key(env, env->hgatp, PTW_G_STAGE);
         widened = 2;
     }
 
@@ -914,15 +1037,24 @@ static int get_physical_address(CPURISCVState *env, hwaddr *physical,
         adue = adue && (env->henvcfg & HENVCFG_ADUE);
     }
 
-    int ptshift = (levels - 1) * ptidxbits;
+    int ptshift;
     target_ulong pte;
     hwaddr pte_addr;
+    hwaddr root = base;
+    target_ulong ptw_tag = addr >> (PGSHIFT + ptidxbits);
     int i;
 
 #if !TCG_OVERSIZED_GUEST
 restart:
 #endif
-    for (i = 0; i < levels; i++, ptshift -= ptidxbits) {
+    base = root;
+    i = 0;
+    if (ptw_cache_lookup(env->ptw_cache, ptw_key, ptw_tag, &base)) {
+        i = levels - 1;
+    }
+    ptshift = (levels - 1 - i) * ptidxbits;
+
+    for (; i < levels; i++, ptshift -= ptidxbits) {
         target_ulong idx;
         if (i == 0) {
             idx = (addr >> (PGSHIFT + ptshift)) &
@@ -935,20 +1067,29 @@ restart:
         /* check that physical address of PTE is legal */
 
         if (two_stage && first_stage) {
-            int vbase_prot;
+            hwaddr gkey = ptw_cache_key(env, env->hgatp, PTW_G_STAGE);
             hwaddr vbase;
 
-            /* Do the second stage translation on the base PTE address. */
-            int vbase_ret = get_physical_address(env, &vbase, &vbase_prot,
-                                                 base, NULL, MMU_DATA_LOAD,
-                                                 MMUIdx_U, false, true,
-                                                 is_debug);
-
-            if (vbase_ret != TRANSLATE_SUCCESS) {
-                if (fault_pte_addr) {
-                    *fault_pte_addr = (base + idx * ptesize) >> 2;
+            if (!ptw_cache_lookup(env->gstage_cache, gkey, base >> PGSHIFT,
+                                  &vbase)) {
+                int vbase_prot;
+
+                /* Do the second stage translation on the base PTE address. */
+                int vbase_ret = get_physical_address(env, &vbase, &vbase_prot,
+                                                     base, NULL, MMU_DATA_LOAD,
+                                                     MMUIdx_U, false, true,
+                                                     is_debug);
+
+                if (vbase_ret != TRANSLATE_SUCCESS) {
+                    if (fault_pte_addr) {
+                        *fault_pte_addr = (base + idx * ptesize) >> 2;
+                    }
+                    return TRANSLATE_G_STAGE_FAIL;
+                }
+                if (!is_debug) {
+                    ptw_cache_insert(env->gstage_cache, gkey, base >> PGSHIFT,
+                                     vbase);
                 }
-                return TRANSLATE_G_STAGE_FAIL;
             }
 
             pte_addr = vbase + idx * ptesize;
@@ -1005,6 +1146,9 @@ restart:
             return TRANSLATE_FAIL;
         }
         base = ppn << PGSHIFT;
+        if (i == levels - 2 && !is_debug) {
+            ptw_cache_insert(env->ptw_cache, ptw_key, ptw_tag, base);
+        }
     }
 
     /* No leaf pte at any translation level. */
@@ -1271,23 +1415,23 @@ void riscv_cpu_do_unaligned_access(CPUState *cs, vaddr addr,
 
 static void pmu_tlb_fill_incr_ctr(RISCVCPU *cpu, MMUAccessType access_type)
 {
-    enum riscv_pmu_event_idx pmu_event_type;
+    RISCVPMUPending ev;
 
     switch (access_type) {
     case MMU_INST_FETCH:
-        pmu_event_type = RISCV_PMU_EVENT_CACHE_ITLB_PREFETCH_MISS;
+        ev = RISCV_PMU_PENDING_ITLB_MISS;
         break;
     case MMU_DATA_LOAD:
-        pmu_event_type = RISCV_PMU_EVENT_CACHE_DTLB_READ_MISS;
+        ev = RISCV_PMU_PENDING_DTLB_READ_MISS;
         break;
     case MMU_DATA_STORE:
-        pmu_event_type = RISCV_PMU_EVENT_CACHE_DTLB_WRITE_MISS;
+        ev = RISCV_PMU_PENDING_DTLB_WRITE_MISS;
         break;
     default:
         return;
     }
 
-    riscv_pmu_incr_ctr(cpu, pmu_event_type);
+    riscv_pmu_count(&cpu->env, ev);
 }
 
 bool riscv_cpu_tlb_fill(CPUState *cs, vaddr address, int size,
@@ -1304,7 +1448,7 @@ bool riscv_cpu_tlb_fill(CPUState *cs, vaddr address, int size,
     bool two_stage_lookup = mmuidx_2stage(mmu_idx);
     bool two_stage_indirect_error = false;
     int ret = TRANSLATE_FAIL;
-    int mode = mmu_idx;
+    int mode = mmuidx_priv(mmu_idx);
     /* default TLB page size */
     target_ulong tlb_size = TARGET_PAGE_SIZE;
 
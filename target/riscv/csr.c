@@ -833,6 +833,7 @@ static RISCVException write_mhpmevent(CPURISCVState *env, int csrno,
     int evt_index = csrno - CSR_MCOUNTINHIBIT;
     uint64_t mhpmevt_val = val;
 
+    riscv_pmu_flush(env);
     env->mhpmevent_val[evt_index] = val;
 
     if (riscv_cpu_mxl(env) == MXL_RV32) {
@@ -862,6 +863,7 @@ static RISCVException write_mhpmeventh(CPURISCVState *env, int csrno,
     uint64_t mhpmevt_val = env->mhpmevent_val[evt_index];
 
     mhpmevt_val = mhpmevt_val | (mhpmevth_val << 32);
+    riscv_pmu_flush(env);
     env->mhpmeventh_val[evt_index] = val;
 
     riscv_pmu_update_event_map(env, mhpmevt_val, evt_index);
@@ -876,6 +878,7 @@ static RISCVException write_mhpmcounter(CPURISCVState *env, int csrno,
     PMUCTRState *counter = &env->pmu_ctrs[ctr_idx];
     uint64_t mhpmctr_val = val;
 
+    riscv_pmu_flush(env);
     counter->mhpmcounter_val = val;
     if (riscv_pmu_ctr_monitor_cycles(env, ctr_idx) ||
         riscv_pmu_ctr_monitor_instructions(env, ctr_idx)) {
@@ -903,6 +906,7 @@ static RISCVException write_mhpmcounterh(CPURISCVState *env, int csrno,
     uint64_t mhpmctr_val = counter->mhpmcounter_val;
     uint64_t mhpmctrh_val = val;
 
+    riscv_pmu_flush(env);
     counter->mhpmcounterh_val = val;
     mhpmctr_val = mhpmctr_val | (mhpmctrh_val << 32);
     if (riscv_pmu_ctr_monitor_cycles(env, ctr_idx) ||
@@ -922,10 +926,13 @@ static RISCVException riscv_pmu_read_ctr(CPURISCVState *env, target_ulong *val,
                                          bool upper_half, uint32_t ctr_idx)
 {
     PMUCTRState *counter = &env->pmu_ctrs[ctr_idx];
-    target_ulong ctr_prev = upper_half ? counter->mhpmcounterh_prev :
-                                         counter->mhpmcounter_prev;
-    target_ulong ctr_val = upper_half ? counter->mhpmcounterh_val :
-                                        counter->mhpmcounter_val;
+    target_ulong ctr_prev, ctr_val;
+
+    riscv_pmu_flush(env);
+    ctr_prev = upper_half ? counter->mhpmcounterh_prev :
+                            counter->mhpmcounter_prev;
+    ctr_val = upper_half ? counter->mhpmcounterh_val :
+                           counter->mhpmcounter_val;
 
     if (get_field(env->mcountinhibit, BIT(ctr_idx))) {
         /*
@@ -1341,6 +1348,7 @@ static RISCVException write_mstatus(CPURISCVState *env, int csrno,
     /* flush tlb on mstatus fields that affect VM */
     if ((val ^ mstatus) & MSTATUS_MXR) {
         tlb_flush(env_cpu(env));
+        riscv_cpu_ptw_cache_flush(env);
     }
     mask = MSTATUS_SIE | MSTATUS_SPIE | MSTATUS_MIE | MSTATUS_MPIE |
         MSTATUS_SPP | MSTATUS_MPRV | MSTATUS_SUM |
@@ -1941,6 +1949,8 @@ static RISCVException write_mcountinhibit(CPURISCVState *env, int csrno,
     PMUCTRState *counter;
     RISCVCPU *cpu = env_archcpu(env);
 
+    riscv_pmu_flush(env);
+
     /* WARL register - disable unavailable counters; TM bit is always 0 */
     env->mcountinhibit =
         val & (cpu->pmu_avail_ctrs | COUNTEREN_CY | COUNTEREN_IR);
@@ -3041,9 +3051,11 @@ static RISCVException write_satp(CPURISCVState *env, int csrno,
          * The ISA defines SATP.MODE=Bare as "no translation", but we still
          * pass these through QEMU's TLB emulation as it improves
          * performance.  Flushing the TLB on SATP writes with paging
-         * enabled avoids leaking those invalid cached mappings.
+         * enabled avoids leaking those invalid cached mappings.  With V=1
+         * this is the guest's vsatp, which only its own entries depend on.
+         * Rather than flushing, switch to the TLB slot of the new value.
          */
-        tlb_flush(env_cpu(env));
+        riscv_cpu_tlb_switch_atp(env, env->virt_enabled, env->satp, val);
         env->satp = val;
     }
     return RISCV_EXCP_NONE;
@@ -3532,6 +3544,9 @@ static RISCVException read_hgatp(CPURISCVState *env, int csrno,
 static RISCVException write_hgatp(CPURISCVState *env, int csrno,
                                   target_ulong val)
 {
+    if (env->hgatp != val) {
+        riscv_cpu_tlb_flush_virt(env, true);
+    }
     env->hgatp = val;
     return RISCV_EXCP_NONE;
 }
@@ -3725,6 +3740,10 @@ static RISCVException write_vsstatus(CPURISCVState *env, int csrno,
     if ((val & VSSTATUS64_UXL) == 0) {
         mask &= ~VSSTATUS64_UXL;
     }
+    if ((val ^ env->vsstatus) & mask & MSTATUS_MXR) {
+        riscv_cpu_tlb_flush_virt(env, true);
+        riscv_cpu_ptw_cache_flush(env);
+    }
     env->vsstatus = (env->vsstatus & ~mask) | (uint64_t)val;
     return RISCV_EXCP_NONE;
 }
@@ -3809,6 +3828,10 @@ static RISCVException read_vsatp(CPURISCVState *env, int csrno,
 static RISCVException write_vsatp(CPURISCVState *env, int csrno,
                                   target_ulong val)
 {
+    /* Guest translations outlive V=1, switch slots when the root changes */
+    if (env->vsatp != val) {
+        riscv_cpu_tlb_switch_atp(env, true, env->vsatp, val);
+    }
     env->vsatp = val;
     return RISCV_EXCP_NONE;
 }
@@ -4375,6 +4398,10 @@ static RISCVException riscv_csrrw_do64(CPURISCVState *env, int csrno,
     RISCVException ret;
     target_ulong old_value = 0;
 
+    if (write_mask) {
+        riscv_cpu_irq_pending_changed(env);
+    }
+
     /* execute combined read/write operation if it exists */
     if (csr_ops[csrno].op) {
         return csr_ops[csrno].op(env, csrno, ret_value, new_value, write_mask);
@@ -4445,6 +4472,7 @@ static RISCVException riscv_csrrw_do128(CPURISCVState *env, int csrno,
     if (int128_nz(write_mask)) {
         new_value = int128_or(int128_and(old_value, int128_not(write_mask)),
                               int128_and(new_value, write_mask));
+        riscv_cpu_irq_pending_changed(env);
         if (csr_ops[csrno].write128) {
             ret = csr_ops[csrno].write128(env, csrno, new_value);
             if (ret != RISCV_EXCP_NONE) {
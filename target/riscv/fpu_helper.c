@@ -51,6 +51,24 @@ void riscv_cpu_set_fflags(CPURISCVState *env, target_ulong hard)
     set_float_exception_flags(soft, &env->fp_status);
 }
 
+/*
+ * Return true if fp_status already rounds as selected by frm, so that
+ * instructions using the dynamic rounding mode need no set up.
+ */
+bool riscv_cpu_frm_is_current(CPURISCVState *env)
+{
+    static const int8_t softrm[] = {
+        [RISCV_FRM_RNE] = float_round_nearest_even,
+        [RISCV_FRM_RTZ] = float_round_to_zero,
+        [RISCV_FRM_RDN] = float_round_down,
+        [RISCV_FRM_RUP] = float_round_up,
+        [RISCV_FRM_RMM] = float_round_ties_away,
+    };
+
+    return env->frm < ARRAY_SIZE(softrm) &&
+           softrm[env->frm] == get_float_rounding_mode(&env->fp_status);
+}
+
 void helper_set_rounding_mode(CPURISCVState *env, uint32_t rm)
 {
     int softrm;
@@ -19,7 +19,9 @@
 #include "qemu/osdep.h"
 #include "exec/gdbstub.h"
 #include "gdbstub/helpers.h"
+#include "sysemu/kvm.h"
 #include "cpu.h"
+#include "kvm/kvm_riscv.h"
 
 struct TypeSize {
     const char *gdb_type;
@@ -108,8 +110,17 @@ int riscv_cpu_gdb_write_register(CPUState *cs, uint8_t *mem_buf, int n)
     return length;
 }
 
+/* Under KVM the FP and vector registers are only fetched on demand */
+static void riscv_gdb_sync_ext_regs(CPURISCVState *env)
+{
+    if (kvm_enabled()) {
+        kvm_riscv_sync_ext_regs(env_archcpu(env));
+    }
+}
+
 static int riscv_gdb_get_fpu(CPURISCVState *env, GByteArray *buf, int n)
 {
+    riscv_gdb_sync_ext_regs(env);
     if (n < 32) {
         if (env->misa_ext & RVD) {
             return gdb_get_reg64(buf, env->fpr[n]);
@@ -123,6 +134,7 @@ static int riscv_gdb_get_fpu(CPURISCVState *env, GByteArray *buf, int n)
 
 static int riscv_gdb_set_fpu(CPURISCVState *env, uint8_t *mem_buf, int n)
 {
+    riscv_gdb_sync_ext_regs(env);
     if (n < 32) {
         env->fpr[n] = ldq_p(mem_buf); /* always 64-bit */
         return sizeof(uint64_t);
@@ -133,6 +145,8 @@ static int riscv_gdb_set_fpu(CPURISCVState *env, uint8_t *mem_buf, int n)
 static int riscv_gdb_get_vector(CPURISCVState *env, GByteArray *buf, int n)
 {
     uint16_t vlenb = riscv_cpu_cfg(env)->vlenb;
+
+    riscv_gdb_sync_ext_regs(env);
     if (n < 32) {
         int i;
         int cnt = 0;
@@ -149,6 +163,8 @@ static int riscv_gdb_get_vector(CPURISCVState *env, GByteArray *buf, int n)
 static int riscv_gdb_set_vector(CPURISCVState *env, uint8_t *mem_buf, int n)
 {
     uint16_t vlenb = riscv_cpu_cfg(env)->vlenb;
+
+    riscv_gdb_sync_ext_regs(env);
     if (n < 32) {
         int i;
         for (i = 0; i < vlenb; i += 8) {
@@ -162,6 +178,8 @@ static int riscv_gdb_set_vector(CPURISCVState *env, uint8_t *mem_buf, int n)
 
 static int riscv_gdb_get_csr(CPURISCVState *env, GByteArray *buf, int n)
 {
+    /* For the vector CSRs */
+    riscv_gdb_sync_ext_regs(env);
     if (n < CSR_TABLE_SIZE) {
         target_ulong val = 0;
         int result;
@@ -176,6 +194,7 @@ static int riscv_gdb_get_csr(CPURISCVState *env, GByteArray *buf, int n)
 
 static int riscv_gdb_set_csr(CPURISCVState *env, uint8_t *mem_buf, int n)
 {
+    riscv_gdb_sync_ext_regs(env);
     if (n < CSR_TABLE_SIZE) {
         target_ulong val = ldtul_p(mem_buf);
         int result;
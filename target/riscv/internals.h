@@ -30,12 +30,29 @@
  *  - U+2STAGE          0b100
  *  - S+2STAGE          0b101
  *  - S+SUM+2STAGE      0b110
+ *
+ * U and S modes also come with MMU_SLOT_BIT set, for the second TLB slot
+ * of the host or of the guest (see riscv_cpu_tlb_switch_atp()).
  */
 #define MMUIdx_U            0
 #define MMUIdx_S            1
 #define MMUIdx_S_SUM        2
 #define MMUIdx_M            3
 #define MMU_2STAGE_BIT      (1 << 2)
+#define MMU_SLOT_BIT        (1 << 3)
+
+/*
+ * Guest (V=1) accesses always use an mmu_idx with MMU_2STAGE_BIT set, so
+ * the TLB entries of the host and those of the guest never alias and are
+ * flushed separately.
+ */
+#define MMU_SLOT_IDX_MASK   (BIT(MMUIdx_U) | BIT(MMUIdx_S) | \
+                             BIT(MMUIdx_S_SUM))
+#define MMU_HOST_IDX_MASK   (MMU_SLOT_IDX_MASK | BIT(MMUIdx_M) | \
+                             (MMU_SLOT_IDX_MASK << MMU_SLOT_BIT))
+#define MMU_GUEST_IDX_MASK  ((MMU_SLOT_IDX_MASK | \
+                              (MMU_SLOT_IDX_MASK << MMU_SLOT_BIT)) << \
+                             MMU_2STAGE_BIT)
 
 static inline int mmuidx_priv(int mmu_idx)
 {
@@ -30,6 +30,7 @@
 #include "sysemu/sysemu.h"
 #include "sysemu/kvm.h"
 #include "sysemu/kvm_int.h"
+#include "sysemu/hw_accel.h"
 #include "cpu.h"
 #include "trace.h"
 #include "hw/core/accel-cpu.h"
@@ -44,6 +45,7 @@
 #include "kvm_riscv.h"
 #include "sbi_ecall_interface.h"
 #include "chardev/char-fe.h"
+#include "migration/cpu.h"
 #include "migration/migration.h"
 #include "sysemu/runstate.h"
 #include "hw/riscv/numa.h"
@@ -819,6 +821,48 @@ static int kvm_riscv_put_regs_vector(CPUState *cs)
     return ret;
 }
 
+/*
+ * A vCPU exit only needs the core registers and CSRs in QEMU; the FP and
+ * vector registers add up to 64 more ONE_REG calls each way, and to
+ * several kB with large VLEN.  Only transfer them when QEMU looks at
+ * them (gdbstub, monitor, migration), and write them back only if they
+ * were fetched or loaded.
+ */
+static void kvm_riscv_do_sync_ext_regs(CPUState *cs, run_on_cpu_data arg)
+{
+    CPURISCVState *env = &RISCV_CPU(cs)->env;
+
+    /*
+     * The rest of the state must be in QEMU too, or the registers that
+     * are marked dirty here would never be put back.
+     */
+    cpu_synchronize_state(cs);
+    if (env->kvm_ext_regs_valid) {
+        return;
+    }
+
+    if (kvm_riscv_get_regs_fp(cs) || kvm_riscv_get_regs_vector(cs)) {
+        error_report("Failed to get FP and vector registers");
+        return;
+    }
+
+    env->kvm_ext_regs_valid = true;
+    /* The caller may modify them */
+    env->kvm_ext_regs_dirty = true;
+}
+
+/* ONE_REG calls have to come from the vCPU thread */
+void kvm_riscv_sync_ext_regs(RISCVCPU *cpu)
+{
+    run_on_cpu(CPU(cpu), kvm_riscv_do_sync_ext_regs, RUN_ON_CPU_NULL);
+}
+
+void kvm_riscv_ext_regs_loaded(RISCVCPU *cpu)
+{
+    cpu->env.kvm_ext_regs_valid = true;
+    cpu->env.kvm_ext_regs_dirty = true;
+}
+
 typedef struct KVMScratchCPU {
     int kvmfd;
     int vmfd;
@@ -1140,15 +1184,9 @@ int kvm_arch_get_registers(CPUState *cs)
         return ret;
     }
 
-    ret = kvm_riscv_get_regs_fp(cs);
-    if (ret) {
-        return ret;
-    }
-
-    ret = kvm_riscv_get_regs_vector(cs);
-    if (ret) {
-        return ret;
-    }
+    /* FP and vector registers are fetched by kvm_riscv_sync_ext_regs() */
+    RISCV_CPU(cs)->env.kvm_ext_regs_valid = false;
+    RISCV_CPU(cs)->env.kvm_ext_regs_dirty = false;
 
     return ret;
 }
@@ -1173,6 +1211,7 @@ int kvm_riscv_sync_mpstate_to_kvm(RISCVCPU *cpu, int state)
 
 int kvm_arch_put_registers(CPUState *cs, int level)
 {
+    CPURISCVState *env = &RISCV_CPU(cs)->env;
     int ret = 0;
 
     ret = kvm_riscv_put_regs_core(cs);
@@ -1185,14 +1224,21 @@ int kvm_arch_put_registers(CPUState *cs, int level)
         return ret;
     }
 
-    ret = kvm_riscv_put_regs_fp(cs);
-    if (ret) {
-        return ret;
-    }
+    /*
+     * Unless QEMU fetched or loaded them, KVM still has the current FP
+     * and vector registers, even across a reset.
+     */
+    if (env->kvm_ext_regs_valid && env->kvm_ext_regs_dirty) {
+        ret = kvm_riscv_put_regs_fp(cs);
+        if (ret) {
+            return ret;
+        }
 
-    ret = kvm_riscv_put_regs_vector(cs);
-    if (ret) {
-        return ret;
+        ret = kvm_riscv_put_regs_vector(cs);
+        if (ret) {
+            return ret;
+        }
+        env->kvm_ext_regs_dirty = false;
     }
 
     if (KVM_PUT_RESET_STATE == level) {
@@ -1488,6 +1534,179 @@ void kvm_arch_accel_class_init(ObjectClass *oc)
                                     "auto");
 }
 
+/*
+ * State of the in-kernel APLIC and IMSICs, for migration.  The APLIC
+ * is accessed through its register offsets, as in hw/intc/riscv_aplic.c,
+ * and the IMSIC interrupt files of each vCPU through their ISELECT
+ * numbers.  The layout is fixed by the machine configuration, which
+ * must be the same on both sides.
+ */
+#define KVM_AIA_APLIC_DOMAINCFG     0x0000
+#define KVM_AIA_APLIC_SOURCECFG(i)  (0x0004 + 4 * ((i) - 1))
+#define KVM_AIA_APLIC_SETIP(w)      (0x1c00 + 4 * (w))
+#define KVM_AIA_APLIC_SETIE(w)      (0x1e00 + 4 * (w))
+#define KVM_AIA_APLIC_TARGET(i)     (0x3004 + 4 * ((i) - 1))
+
+typedef struct KVMRISCVAIAState {
+    int fd;
+    uint32_t num_sources;
+    uint32_t num_ids;
+    uint32_t num_harts;
+
+    uint32_t domaincfg;
+    uint32_t *sourcecfg;        /* sources 1 to num_sources */
+    uint32_t *target;
+    uint32_t num_ip_words;
+    uint32_t *setip;
+    uint32_t *setie;
+
+    /* Per vCPU: eidelivery, eithreshold, eip[num_eix], eie[num_eix] */
+    uint32_t num_eix;
+    uint32_t imsic_len;
+    target_ulong *imsic;
+} KVMRISCVAIAState;
+
+static KVMRISCVAIAState kvm_aia;
+
+static int kvm_aia_access_aplic(KVMRISCVAIAState *s, uint32_t offset,
+                                uint32_t *val, bool write)
+{
+    int ret = kvm_device_access(s->fd, KVM_DEV_RISCV_AIA_GRP_APLIC, offset,
+                                val, write, NULL);
+
+    if (ret < 0) {
+        error_report("KVM AIA: failed to %s APLIC register 0x%x: %s",
+                     write ? "set" : "get", offset, strerror(-ret));
+    }
+    return ret;
+}
+
+static int kvm_aia_access_imsic(KVMRISCVAIAState *s, uint32_t hart,
+                                uint32_t isel, target_ulong *val, bool write)
+{
+    int ret = kvm_device_access(s->fd, KVM_DEV_RISCV_AIA_GRP_IMSIC,
+                                KVM_DEV_RISCV_AIA_IMSIC_MKATTR(hart, isel),
+                                val, write, NULL);
+
+    if (ret < 0) {
+        error_report("KVM AIA: failed to %s IMSIC register 0x%x of hart %u: "
+                     "%s", write ? "set" : "get", isel, hart, strerror(-ret));
+    }
+    return ret;
+}
+
+/*
+ * Walk the whole state in restore order: the IMSIC interrupt files
+ * first, so that MSIs that the APLIC forwards once it is enabled land
+ * in restored files, then the APLIC with the domain enabled last.
+ */
+static int kvm_aia_access_all(KVMRISCVAIAState *s, bool write)
+{
+    /* Each eip/eie register covers TARGET_LONG_BITS identities */
+    const uint32_t isel_step = TARGET_LONG_BITS / 32;
+    target_ulong *imsic = s->imsic;
+    uint32_t hart, i;
+
+    for (hart = 0; hart < s->num_harts; hart++) {
+        if (kvm_aia_access_imsic(s, hart, ISELECT_IMSIC_EIDELIVERY,
+                                 imsic++, write) < 0 ||
+            kvm_aia_access_imsic(s, hart, ISELECT_IMSIC_EITHRESHOLD,
+                                 imsic++, write) < 0) {
+            return -1;
+        }
+        for (i = 0; i < s->num_eix; i++) {
+            if (kvm_aia_access_imsic(s, hart,
+                                     ISELECT_IMSIC_EIE0 + i * isel_step,
+                                     imsic + s->num_eix, write) < 0 ||
+                kvm_aia_access_imsic(s, hart,
+                                     ISELECT_IMSIC_EIP0 + i * isel_step,
+                                     imsic, write) < 0) {
+                return -1;
+            }
+            imsic++;
+        }
+        imsic += s->num_eix;
+    }
+
+    for (i = 1; i <= s->num_sources; i++) {
+        if (kvm_aia_access_aplic(s, KVM_AIA_APLIC_SOURCECFG(i),
+                                 &s->sourcecfg[i - 1], write) < 0 ||
+            kvm_aia_access_aplic(s, KVM_AIA_APLIC_TARGET(i),
+                                 &s->target[i - 1], write) < 0) {
+            return -1;
+        }
+    }
+    for (i = 0; i < s->num_ip_words; i++) {
+        if (kvm_aia_access_aplic(s, KVM_AIA_APLIC_SETIE(i),
+                                 &s->setie[i], write) < 0 ||
+            kvm_aia_access_aplic(s, KVM_AIA_APLIC_SETIP(i),
+                                 &s->setip[i], write) < 0) {
+            return -1;
+        }
+    }
+    return kvm_aia_access_aplic(s, KVM_AIA_APLIC_DOMAINCFG, &s->domaincfg,
+                                write);
+}
+
+static int kvm_aia_pre_save(void *opaque)
+{
+    return kvm_aia_access_all(opaque, false);
+}
+
+static int kvm_aia_post_load(void *opaque, int version_id)
+{
+    return kvm_aia_access_all(opaque, true);
+}
+
+static const VMStateDescription vmstate_kvm_riscv_aia = {
+    .name = "kvm-riscv-aia",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .pre_save = kvm_aia_pre_save,
+    .post_load = kvm_aia_post_load,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32_EQUAL(num_sources, KVMRISCVAIAState, NULL),
+        VMSTATE_UINT32_EQUAL(num_ids, KVMRISCVAIAState, NULL),
+        VMSTATE_UINT32_EQUAL(num_harts, KVMRISCVAIAState, NULL),
+        VMSTATE_UINT32(domaincfg, KVMRISCVAIAState),
+        VMSTATE_VARRAY_UINT32(sourcecfg, KVMRISCVAIAState, num_sources, 0,
+                              vmstate_info_uint32, uint32_t),
+        VMSTATE_VARRAY_UINT32(target, KVMRISCVAIAState, num_sources, 0,
+                              vmstate_info_uint32, uint32_t),
+        VMSTATE_VARRAY_UINT32(setip, KVMRISCVAIAState, num_ip_words, 0,
+                              vmstate_info_uint32, uint32_t),
+        VMSTATE_VARRAY_UINT32(setie, KVMRISCVAIAState, num_ip_words, 0,
+                              vmstate_info_uint32, uint32_t),
+        VMSTATE_VARRAY_UINT32(imsic, KVMRISCVAIAState, imsic_len, 0,
+                              vmstate_info_uinttl, target_ulong),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static void kvm_aia_register_vmstate(int fd, uint32_t num_sources,
+                                     uint32_t num_ids, uint32_t num_harts)
+{
+    KVMRISCVAIAState *s = &kvm_aia;
+
+    s->fd = fd;
+    s->num_sources = num_sources;
+    s->num_ids = num_ids;
+    s->num_harts = num_harts;
+
+    s->sourcecfg = g_new0(uint32_t, num_sources);
+    s->target = g_new0(uint32_t, num_sources);
+    s->num_ip_words = DIV_ROUND_UP(num_sources + 1, 32);
+    s->setip = g_new0(uint32_t, s->num_ip_words);
+    s->setie = g_new0(uint32_t, s->num_ip_words);
+
+    /* Identity 0 does not exist, but is counted in eip0/eie0 */
+    s->num_eix = DIV_ROUND_UP(num_ids + 1, TARGET_LONG_BITS);
+    s->imsic_len = num_harts * (2 + 2 * s->num_eix);
+    s->imsic = g_new0(target_ulong, s->imsic_len);
+
+    vmstate_register(NULL, 0, &vmstate_kvm_riscv_aia, s);
+}
+
 void kvm_riscv_aia_create(MachineState *machine, uint64_t group_shift,
                           uint64_t aia_irq_num, uint64_t aia_msi_num,
                           uint64_t aplic_base, uint64_t imsic_base,
@@ -1630,6 +1849,9 @@ void kvm_riscv_aia_create(MachineState *machine, uint64_t group_shift,
         exit(1);
     }
 
+    kvm_aia_register_vmstate(aia_fd, aia_irq_num, aia_msi_num,
+                             machine->smp.cpus);
+
     kvm_msi_via_irqfd_allowed = true;
 }
 
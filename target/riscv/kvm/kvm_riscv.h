@@ -28,5 +28,7 @@ void kvm_riscv_aia_create(MachineState *machine, uint64_t group_shift,
 void riscv_kvm_aplic_request(void *opaque, int irq, int level);
 int kvm_riscv_sync_mpstate_to_kvm(RISCVCPU *cpu, int state);
 void riscv_kvm_cpu_finalize_features(RISCVCPU *cpu, Error **errp);
+void kvm_riscv_sync_ext_regs(RISCVCPU *cpu);
+void kvm_riscv_ext_regs_loaded(RISCVCPU *cpu);
 
 #endif
@@ -23,6 +23,8 @@
 #include "migration/cpu.h"
 #include "sysemu/cpu-timers.h"
 #include "debug.h"
+#include "pmu.h"
+#include "kvm/kvm_riscv.h"
 
 static bool pmp_needed(void *opaque)
 {
@@ -260,6 +262,18 @@ static const VMStateDescription vmstate_debug = {
     }
 };
 
+static int riscv_cpu_pre_save(void *opaque)
+{
+    RISCVCPU *cpu = opaque;
+
+    /* The batched PMU events are not migrated */
+    riscv_pmu_flush(&cpu->env);
+    if (kvm_enabled()) {
+        kvm_riscv_sync_ext_regs(cpu);
+    }
+    return 0;
+}
+
 static int riscv_cpu_post_load(void *opaque, int version_id)
 {
     RISCVCPU *cpu = opaque;
@@ -267,6 +281,11 @@ static int riscv_cpu_post_load(void *opaque, int version_id)
 
     env->xl = cpu_recompute_xl(env);
     riscv_cpu_update_mask(env);
+    riscv_cpu_ptw_cache_flush(env);
+    riscv_cpu_irq_pending_changed(env);
+    if (kvm_enabled()) {
+        kvm_riscv_ext_regs_loaded(cpu);
+    }
     return 0;
 }
 
@@ -355,6 +374,7 @@ const VMStateDescription vmstate_riscv_cpu = {
     .name = "cpu",
     .version_id = 9,
     .minimum_version_id = 9,
+    .pre_save = riscv_cpu_pre_save,
     .post_load = riscv_cpu_post_load,
     .fields = (const VMStateField[]) {
         VMSTATE_UINTTL_ARRAY(env.gpr, RISCVCPU, 32),
@@ -391,27 +391,42 @@ void helper_tlb_flush(CPURISCVState *env)
                (env->priv == PRV_U || get_field(env->hstatus, HSTATUS_VTVM))) {
         riscv_raise_exception(env, RISCV_EXCP_VIRT_INSTRUCTION_FAULT, GETPC());
     } else {
-        tlb_flush(cs);
+        riscv_cpu_tlb_flush_virt(env, env->virt_enabled);
+        riscv_cpu_ptw_cache_flush(env);
     }
 }
 
+static void riscv_ptw_cache_flush_work(CPUState *cs, run_on_cpu_data data)
+{
+    riscv_cpu_ptw_cache_flush(cpu_env(cs));
+}
+
 void helper_tlb_flush_all(CPURISCVState *env)
 {
     CPUState *cs = env_cpu(env);
+    CPUState *other;
+
+    CPU_FOREACH(other) {
+        if (other != cs) {
+            async_run_on_cpu(other, riscv_ptw_cache_flush_work,
+                             RUN_ON_CPU_NULL);
+        }
+    }
+    riscv_cpu_ptw_cache_flush(env);
     tlb_flush_all_cpus_synced(cs);
 }
 
 void helper_hyp_tlb_flush(CPURISCVState *env)
 {
-    CPUState *cs = env_cpu(env);
-
     if (env->virt_enabled) {
         riscv_raise_exception(env, RISCV_EXCP_VIRT_INSTRUCTION_FAULT, GETPC());
     }
 
     if (env->priv == PRV_M ||
         (env->priv == PRV_S && !env->virt_enabled)) {
-        tlb_flush(cs);
+        /* HFENCE.VVMA and HFENCE.GVMA only affect guest translations */
+        riscv_cpu_tlb_flush_virt(env, true);
+        riscv_cpu_ptw_cache_flush(env);
         return;
     }
 
@@ -442,6 +457,9 @@ static int check_access_hlsv(CPURISCVState *env, bool x, uintptr_t ra)
     if (!x && mode == PRV_S && get_field(env->vsstatus, MSTATUS_SUM)) {
         mode = MMUIdx_S_SUM;
     }
+    if (env->tlb_slot[1]) {
+        mode |= MMU_SLOT_BIT;
+    }
     return mode | MMU_2STAGE_BIT;
 }
 
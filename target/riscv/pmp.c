@@ -148,6 +148,7 @@ void pmp_unlock_entries(CPURISCVState *env)
     for (i = 0; i < pmp_num; i++) {
         env->pmp_state.pmp[i].cfg_reg &= ~(PMP_LOCK | PMP_AMATCH);
     }
+    pmp_update_rule_nums(env);
 }
 
 static void pmp_decode_napot(hwaddr a, hwaddr *sa, hwaddr *ea)
@@ -212,6 +213,76 @@ void pmp_update_rule_addr(CPURISCVState *env, uint32_t pmp_index)
     env->pmp_state.addr[pmp_index].ea = ea;
 }
 
+static int pmp_is_in_range(CPURISCVState *env, int pmp_index, hwaddr addr)
+{
+    int result = 0;
+
+    if ((addr >= env->pmp_state.addr[pmp_index].sa) &&
+        (addr <= env->pmp_state.addr[pmp_index].ea)) {
+        result = 1;
+    } else {
+        result = 0;
+    }
+
+    return result;
+}
+
+static int pmp_addr_cmp(const void *a, const void *b)
+{
+    hwaddr x = *(const hwaddr *)a;
+    hwaddr y = *(const hwaddr *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Split the address space at every boundary of an active rule.  All the
+ * addresses of a segment are matched by the same set of rules, so each
+ * segment only records the highest priority one.  Neighbouring segments
+ * decided by the same rule are merged; an access that stays within one
+ * segment can then never be partially inside a rule.
+ */
+static void pmp_update_rule_segs(CPURISCVState *env)
+{
+    pmp_table_t *t = &env->pmp_state;
+    hwaddr bound[PMP_MAX_SEGS];
+    int i, j, n = 0;
+
+    bound[n++] = 0;
+    for (i = 0; i < MAX_RISCV_PMPS; i++) {
+        if (pmp_get_a_field(t->pmp[i].cfg_reg) == PMP_AMATCH_OFF) {
+            continue;
+        }
+        bound[n++] = t->addr[i].sa;
+        if (t->addr[i].ea != (hwaddr)-1) {
+            bound[n++] = t->addr[i].ea + 1;
+        }
+    }
+    qsort(bound, n, sizeof(hwaddr), pmp_addr_cmp);
+
+    t->num_segs = 0;
+    for (j = 0; j < n; j++) {
+        int rule = -1;
+
+        if (j > 0 && bound[j] == bound[j - 1]) {
+            continue;
+        }
+        for (i = 0; i < MAX_RISCV_PMPS; i++) {
+            if (pmp_get_a_field(t->pmp[i].cfg_reg) != PMP_AMATCH_OFF &&
+                pmp_is_in_range(env, i, bound[j])) {
+                rule = i;
+                break;
+            }
+        }
+        if (t->num_segs > 0 && t->seg_rule[t->num_segs - 1] == rule) {
+            continue;
+        }
+        t->seg_start[t->num_segs] = bound[j];
+        t->seg_rule[t->num_segs] = rule;
+        t->num_segs++;
+    }
+}
+
 void pmp_update_rule_nums(CPURISCVState *env)
 {
     int i;
@@ -224,20 +295,39 @@ void pmp_update_rule_nums(CPURISCVState *env)
             env->pmp_state.num_rules++;
         }
     }
+    pmp_update_rule_segs(env);
 }
 
-static int pmp_is_in_range(CPURISCVState *env, int pmp_index, hwaddr addr)
+/*
+ * Return the index of the segment containing @addr.
+ */
+static int pmp_find_seg(CPURISCVState *env, hwaddr addr)
 {
-    int result = 0;
+    const pmp_table_t *t = &env->pmp_state;
+    int lo = 0, hi = t->num_segs - 1;
 
-    if ((addr >= env->pmp_state.addr[pmp_index].sa) &&
-        (addr <= env->pmp_state.addr[pmp_index].ea)) {
-        result = 1;
-    } else {
-        result = 0;
+    /* The first segment always starts at 0 */
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+
+        if (t->seg_start[mid] <= addr) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
     }
+    return lo;
+}
 
-    return result;
+/*
+ * Return the last address of segment @seg.
+ */
+static hwaddr pmp_seg_end(CPURISCVState *env, int seg)
+{
+    if (seg + 1 < env->pmp_state.num_segs) {
+        return env->pmp_state.seg_start[seg + 1] - 1;
+    }
+    return (hwaddr)-1;
 }
 
 /*
@@ -294,6 +384,107 @@ static bool pmp_hart_has_privs_default(CPURISCVState *env, pmp_priv_t privs,
 }
 
 
+/*
+ * Return the privileges granted to @mode by rule @i.
+ */
+static pmp_priv_t pmp_rule_privs(CPURISCVState *env, int i,
+                                 target_ulong mode)
+{
+    pmp_priv_t allowed_privs = 0;
+
+    /*
+     * Convert the PMP permissions to match the truth table in the
+     * Smepmp spec.
+     */
+    const uint8_t smepmp_operation =
+        ((env->pmp_state.pmp[i].cfg_reg & PMP_LOCK) >> 4) |
+        ((env->pmp_state.pmp[i].cfg_reg & PMP_READ) << 2) |
+        (env->pmp_state.pmp[i].cfg_reg & PMP_WRITE) |
+        ((env->pmp_state.pmp[i].cfg_reg & PMP_EXEC) >> 2);
+
+    if (!MSECCFG_MML_ISSET(env)) {
+        /*
+         * If mseccfg.MML Bit is not set, do pmp priv check
+         * This will always apply to regular PMP.
+         */
+        allowed_privs = PMP_READ | PMP_WRITE | PMP_EXEC;
+        if ((mode != PRV_M) || pmp_is_locked(env, i)) {
+            allowed_privs &= env->pmp_state.pmp[i].cfg_reg;
+        }
+    } else {
+        /*
+         * If mseccfg.MML Bit set, do the enhanced pmp priv check
+         */
+        if (mode == PRV_M) {
+            switch (smepmp_operation) {
+            case 0:
+            case 1:
+            case 4:
+            case 5:
+            case 6:
+            case 7:
+            case 8:
+                allowed_privs = 0;
+                break;
+            case 2:
+            case 3:
+            case 14:
+                allowed_privs = PMP_READ | PMP_WRITE;
+                break;
+            case 9:
+            case 10:
+                allowed_privs = PMP_EXEC;
+                break;
+            case 11:
+            case 13:
+                allowed_privs = PMP_READ | PMP_EXEC;
+                break;
+            case 12:
+            case 15:
+                allowed_privs = PMP_READ;
+                break;
+            default:
+                g_assert_not_reached();
+            }
+        } else {
+            switch (smepmp_operation) {
+            case 0:
+            case 8:
+            case 9:
+            case 12:
+            case 13:
+            case 14:
+                allowed_privs = 0;
+                break;
+            case 1:
+            case 10:
+            case 11:
+                allowed_privs = PMP_EXEC;
+                break;
+            case 2:
+            case 4:
+            case 15:
+                allowed_privs = PMP_READ;
+                break;
+            case 3:
+            case 6:
+                allowed_privs = PMP_READ | PMP_WRITE;
+                break;
+            case 5:
+                allowed_privs = PMP_READ | PMP_EXEC;
+                break;
+            case 7:
+                allowed_privs = PMP_READ | PMP_WRITE | PMP_EXEC;
+                break;
+            default:
+                g_assert_not_reached();
+            }
+        }
+    }
+
+    return allowed_privs;
+}
+
 /*
  * Public Interface
  */
@@ -308,6 +499,7 @@ bool pmp_hart_has_privs(CPURISCVState *env, hwaddr addr,
                         pmp_priv_t *allowed_privs, target_ulong mode)
 {
     int i = 0;
+    int seg;
     int pmp_size = 0;
     hwaddr s = 0;
     hwaddr e = 0;
@@ -331,6 +523,21 @@ bool pmp_hart_has_privs(CPURISCVState *env, hwaddr addr,
         pmp_size = size;
     }
 
+    /*
+     * Fast path: an access within one segment is decided by the rule
+     * recorded for it, see pmp_update_rule_segs.
+     */
+    seg = pmp_find_seg(env, addr);
+    if (addr + pmp_size - 1 <= pmp_seg_end(env, seg)) {
+        i = env->pmp_state.seg_rule[seg];
+        if (i < 0) {
+            return pmp_hart_has_privs_default(env, privs, allowed_privs,
+                                              mode);
+        }
+        *allowed_privs = pmp_rule_privs(env, i, mode);
+        return (privs & *allowed_privs) == privs;
+    }
+
     /*
      * 1.10 draft priv spec states there is an implicit order
      * from low to high
@@ -351,106 +558,13 @@ bool pmp_hart_has_privs(CPURISCVState *env, hwaddr addr,
         const uint8_t a_field =
             pmp_get_a_field(env->pmp_state.pmp[i].cfg_reg);
 
-        /*
-         * Convert the PMP permissions to match the truth table in the
-         * Smepmp spec.
-         */
-        const uint8_t smepmp_operation =
-            ((env->pmp_state.pmp[i].cfg_reg & PMP_LOCK) >> 4) |
-            ((env->pmp_state.pmp[i].cfg_reg & PMP_READ) << 2) |
-            (env->pmp_state.pmp[i].cfg_reg & PMP_WRITE) |
-            ((env->pmp_state.pmp[i].cfg_reg & PMP_EXEC) >> 2);
-
         if (((s + e) == 2) && (PMP_AMATCH_OFF != a_field)) {
-            /*
-             * If the PMP entry is not off and the address is in range,
-             * do the priv check
-             */
-            if (!MSECCFG_MML_ISSET(env)) {
-                /*
-                 * If mseccfg.MML Bit is not set, do pmp priv check
-                 * This will always apply to regular PMP.
-                 */
-                *allowed_privs = PMP_READ | PMP_WRITE | PMP_EXEC;
-                if ((mode != PRV_M) || pmp_is_locked(env, i)) {
-                    *allowed_privs &= env->pmp_state.pmp[i].cfg_reg;
-                }
-            } else {
-                /*
-                 * If mseccfg.MML Bit set, do the enhanced pmp priv check
-                 */
-                if (mode == PRV_M) {
-                    switch (smepmp_operation) {
-                    case 0:
-                    case 1:
-                    case 4:
-                    case 5:
-                    case 6:
-                    case 7:
-                    case 8:
-                        *allowed_privs = 0;
-                        break;
-                    case 2:
-                    case 3:
-                    case 14:
-                        *allowed_privs = PMP_READ | PMP_WRITE;
-                        break;
-                    case 9:
-                    case 10:
-                        *allowed_privs = PMP_EXEC;
-                        break;
-                    case 11:
-                    case 13:
-                        *allowed_privs = PMP_READ | PMP_EXEC;
-                        break;
-                    case 12:
-                    case 15:
-                        *allowed_privs = PMP_READ;
-                        break;
-                    default:
-                        g_assert_not_reached();
-                    }
-                } else {
-                    switch (smepmp_operation) {
-                    case 0:
-                    case 8:
-                    case 9:
-                    case 12:
-                    case 13:
-                    case 14:
-                        *allowed_privs = 0;
-                        break;
-                    case 1:
-                    case 10:
-                    case 11:
-                        *allowed_privs = PMP_EXEC;
-                        break;
-                    case 2:
-                    case 4:
-                    case 15:
-                        *allowed_privs = PMP_READ;
-                        break;
-                    case 3:
-                    case 6:
-                        *allowed_privs = PMP_READ | PMP_WRITE;
-                        break;
-                    case 5:
-                        *allowed_privs = PMP_READ | PMP_EXEC;
-                        break;
-                    case 7:
-                        *allowed_privs = PMP_READ | PMP_WRITE | PMP_EXEC;
-                        break;
-                    default:
-                        g_assert_not_reached();
-                    }
-                }
-            }
-
             /*
              * If matching address range was found, the protection bits
              * defined with PMP must be used. We shouldn't fallback on
              * finding default privileges.
              */
+            *allowed_privs = pmp_rule_privs(env, i, mode);
             return (privs & *allowed_privs) == privs;
         }
     }
@@ -481,6 +595,7 @@ void pmpcfg_csr_write(CPURISCVState *env, uint32_t reg_index,
     if (modified) {
         pmp_update_rule_nums(env);
         tlb_flush(env_cpu(env));
+        riscv_cpu_ptw_cache_flush(env);
     }
 }
 
@@ -537,7 +652,9 @@ void pmpaddr_csr_write(CPURISCVState *env, uint32_t addr_index,
                 if (is_next_cfg_tor) {
                     pmp_update_rule_addr(env, addr_index + 1);
                 }
+                pmp_update_rule_nums(env);
                 tlb_flush(env_cpu(env));
+                riscv_cpu_ptw_cache_flush(env);
             }
         } else {
             qemu_log_mask(LOG_GUEST_ERROR,
@@ -592,6 +709,7 @@ void mseccfg_csr_write(CPURISCVState *env, target_ulong val)
         val |= (env->mseccfg & (MSECCFG_MMWP | MSECCFG_MML));
         if ((val ^ env->mseccfg) & (MSECCFG_MMWP | MSECCFG_MML)) {
             tlb_flush(env_cpu(env));
+            riscv_cpu_ptw_cache_flush(env);
         }
     } else {
         val &= ~(MSECCFG_MMWP | MSECCFG_MML | MSECCFG_RLB);
@@ -624,11 +742,8 @@ target_ulong mseccfg_csr_read(CPURISCVState *env)
  */
 target_ulong pmp_get_tlb_size(CPURISCVState *env, hwaddr addr)
 {
-    hwaddr pmp_sa;
-    hwaddr pmp_ea;
     hwaddr tlb_sa = addr & ~(TARGET_PAGE_SIZE - 1);
     hwaddr tlb_ea = tlb_sa + TARGET_PAGE_SIZE - 1;
-    int i;
 
     /*
      * If PMP is not supported or there are no PMP rules, the TLB page will not
@@ -639,37 +754,16 @@ target_ulong pmp_get_tlb_size(CPURISCVState *env, hwaddr addr)
         return TARGET_PAGE_SIZE;
     }
 
-    for (i = 0; i < MAX_RISCV_PMPS; i++) {
-        if (pmp_get_a_field(env->pmp_state.pmp[i].cfg_reg) == PMP_AMATCH_OFF) {
-            continue;
-        }
-
-        pmp_sa = env->pmp_state.addr[i].sa;
-        pmp_ea = env->pmp_state.addr[i].ea;
-
-        /*
-         * Only the first PMP entry that covers (whole or partial of) the TLB
-         * page really matters:
-         * If it covers the whole TLB page, set the size to TARGET_PAGE_SIZE,
-         * since the following PMP entries have lower priority and will not
-         * affect the permissions of the page.
-         * If it only covers partial of the TLB page, set the size to 1 since
-         * the allowed permissions of the region may be different from other
-         * region of the page.
-         */
-        if (pmp_sa <= tlb_sa && pmp_ea >= tlb_ea) {
-            return TARGET_PAGE_SIZE;
-        } else if ((pmp_sa >= tlb_sa && pmp_sa <= tlb_ea) ||
-                   (pmp_ea >= tlb_sa && pmp_ea <= tlb_ea)) {
-            return 1;
-        }
-    }
-
     /*
-     * If no PMP entry matches the TLB page, the TLB page will also not be
-     * split into regions with different permissions by PMP so we set the size
-     * to TARGET_PAGE_SIZE.
+     * All of the page is decided by the same PMP entry (or by none) if it
+     * lies within a single segment, so it can be cached as a whole.
+     * Otherwise the allowed permissions may differ from one region of the
+     * page to another and the size is set to 1.
      */
+    if (tlb_ea > pmp_seg_end(env, pmp_find_seg(env, tlb_sa))) {
+        return 1;
+    }
+
     return TARGET_PAGE_SIZE;
 }
 
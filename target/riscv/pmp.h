@@ -57,10 +57,17 @@ typedef struct {
     hwaddr ea;
 } pmp_addr_t;
 
+/* Every active rule adds at most two boundaries to the one at 0 */
+#define PMP_MAX_SEGS (2 * MAX_RISCV_PMPS + 1)
+
 typedef struct {
     pmp_entry_t pmp[MAX_RISCV_PMPS];
     pmp_addr_t  addr[MAX_RISCV_PMPS];
     uint32_t num_rules;
+    /* Sorted segments of the address space and their deciding rule */
+    hwaddr seg_start[PMP_MAX_SEGS];
+    int8_t seg_rule[PMP_MAX_SEGS];
+    uint32_t num_segs;
 } pmp_table_t;
 
 void pmpcfg_csr_write(CPURISCVState *env, uint32_t reg_index,
@@ -100,91 +100,88 @@ static bool riscv_pmu_counter_enabled(RISCVCPU *cpu, uint32_t ctr_idx)
     }
 }
 
-static int riscv_pmu_incr_ctr_rv32(RISCVCPU *cpu, uint32_t ctr_idx)
+/*
+ * Privilege mode filtering: return true if @ctr_idx does not count events
+ * in the current mode.
+ */
+static bool riscv_pmu_ctr_filtered(CPURISCVState *env, uint32_t ctr_idx)
 {
-    CPURISCVState *env = &cpu->env;
-    target_ulong max_val = UINT32_MAX;
-    PMUCTRState *counter = &env->pmu_ctrs[ctr_idx];
     bool virt_on = env->virt_enabled;
+    uint64_t evt = env->mhpmevent_val[ctr_idx];
 
-    /* Privilege mode filtering */
-    if ((env->priv == PRV_M &&
-        (env->mhpmeventh_val[ctr_idx] & MHPMEVENTH_BIT_MINH)) ||
-        (env->priv == PRV_S && virt_on &&
-        (env->mhpmeventh_val[ctr_idx] & MHPMEVENTH_BIT_VSINH)) ||
-        (env->priv == PRV_U && virt_on &&
-        (env->mhpmeventh_val[ctr_idx] & MHPMEVENTH_BIT_VUINH)) ||
-        (env->priv == PRV_S && !virt_on &&
-        (env->mhpmeventh_val[ctr_idx] & MHPMEVENTH_BIT_SINH)) ||
-        (env->priv == PRV_U && !virt_on &&
-        (env->mhpmeventh_val[ctr_idx] & MHPMEVENTH_BIT_UINH))) {
-        return 0;
+    if (riscv_cpu_mxl(env) == MXL_RV32) {
+        evt = (uint64_t)env->mhpmeventh_val[ctr_idx] << 32;
     }
 
-    /* Handle the overflow scenario */
-    if (counter->mhpmcounter_val == max_val) {
-        if (counter->mhpmcounterh_val == max_val) {
-            counter->mhpmcounter_val = 0;
-            counter->mhpmcounterh_val = 0;
-            /* Generate interrupt only if OF bit is clear */
-            if (!(env->mhpmeventh_val[ctr_idx] & MHPMEVENTH_BIT_OF)) {
-                env->mhpmeventh_val[ctr_idx] |= MHPMEVENTH_BIT_OF;
-                riscv_cpu_update_mip(env, MIP_LCOFIP, BOOL_TO_MASK(1));
-            }
-        } else {
-            counter->mhpmcounterh_val++;
-        }
-    } else {
-        counter->mhpmcounter_val++;
-    }
+    return (env->priv == PRV_M && (evt & MHPMEVENT_BIT_MINH)) ||
+           (env->priv == PRV_S && virt_on && (evt & MHPMEVENT_BIT_VSINH)) ||
+           (env->priv == PRV_U && virt_on && (evt & MHPMEVENT_BIT_VUINH)) ||
+           (env->priv == PRV_S && !virt_on && (evt & MHPMEVENT_BIT_SINH)) ||
+           (env->priv == PRV_U && !virt_on && (evt & MHPMEVENT_BIT_UINH));
+}
 
-    return 0;
+/* Return the number of events @ctr_idx can take before it overflows */
+static uint64_t riscv_pmu_ctr_headroom(CPURISCVState *env, uint32_t ctr_idx)
+{
+    PMUCTRState *counter = &env->pmu_ctrs[ctr_idx];
+    uint64_t val = counter->mhpmcounter_val;
+
+    if (riscv_cpu_mxl(env) == MXL_RV32) {
+        val = ((uint64_t)counter->mhpmcounterh_val << 32) |
+              (uint32_t)counter->mhpmcounter_val;
+    }
+    return UINT64_MAX - val;
 }
 
-static int riscv_pmu_incr_ctr_rv64(RISCVCPU *cpu, uint32_t ctr_idx)
+static void riscv_pmu_incr_ctr_rv32(RISCVCPU *cpu, uint32_t ctr_idx,
+                                    uint32_t n)
 {
     CPURISCVState *env = &cpu->env;
     PMUCTRState *counter = &env->pmu_ctrs[ctr_idx];
-    uint64_t max_val = UINT64_MAX;
-    bool virt_on = env->virt_enabled;
+    uint64_t val = ((uint64_t)counter->mhpmcounterh_val << 32) |
+                   (uint32_t)counter->mhpmcounter_val;
+    bool overflow = n > UINT64_MAX - val;
 
-    /* Privilege mode filtering */
-    if ((env->priv == PRV_M &&
-        (env->mhpmevent_val[ctr_idx] & MHPMEVENT_BIT_MINH)) ||
-        (env->priv == PRV_S && virt_on &&
-        (env->mhpmevent_val[ctr_idx] & MHPMEVENT_BIT_VSINH)) ||
-        (env->priv == PRV_U && virt_on &&
-        (env->mhpmevent_val[ctr_idx] & MHPMEVENT_BIT_VUINH)) ||
-        (env->priv == PRV_S && !virt_on &&
-        (env->mhpmevent_val[ctr_idx] & MHPMEVENT_BIT_SINH)) ||
-        (env->priv == PRV_U && !virt_on &&
-        (env->mhpmevent_val[ctr_idx] & MHPMEVENT_BIT_UINH))) {
-        return 0;
+    val += n;
+    counter->mhpmcounter_val = (uint32_t)val;
+    counter->mhpmcounterh_val = val >> 32;
+
+    /* Generate interrupt only if OF bit is clear */
+    if (overflow && !(env->mhpmeventh_val[ctr_idx] & MHPMEVENTH_BIT_OF)) {
+        env->mhpmeventh_val[ctr_idx] |= MHPMEVENTH_BIT_OF;
+        riscv_cpu_update_mip(env, MIP_LCOFIP, BOOL_TO_MASK(1));
     }
+}
 
-    /* Handle the overflow scenario */
-    if (counter->mhpmcounter_val == max_val) {
-        counter->mhpmcounter_val = 0;
-        /* Generate interrupt only if OF bit is clear */
-        if (!(env->mhpmevent_val[ctr_idx] & MHPMEVENT_BIT_OF)) {
-            env->mhpmevent_val[ctr_idx] |= MHPMEVENT_BIT_OF;
-            riscv_cpu_update_mip(env, MIP_LCOFIP, BOOL_TO_MASK(1));
-        }
-    } else {
-        counter->mhpmcounter_val++;
+static void riscv_pmu_incr_ctr_rv64(RISCVCPU *cpu, uint32_t ctr_idx,
+                                    uint32_t n)
+{
+    CPURISCVState *env = &cpu->env;
+    PMUCTRState *counter = &env->pmu_ctrs[ctr_idx];
+    bool overflow = n > UINT64_MAX - counter->mhpmcounter_val;
+
+    counter->mhpmcounter_val += n;
+
+    /* Generate interrupt only if OF bit is clear */
+    if (overflow && !(env->mhpmevent_val[ctr_idx] & MHPMEVENT_BIT_OF)) {
+        env->mhpmevent_val[ctr_idx] |= MHPMEVENT_BIT_OF;
+        riscv_cpu_update_mip(env, MIP_LCOFIP, BOOL_TO_MASK(1));
     }
-    return 0;
 }
 
-int riscv_pmu_incr_ctr(RISCVCPU *cpu, enum riscv_pmu_event_idx event_idx)
+/*
+ * Return the counter that @event_idx increments in the current mode,
+ * or -1 if the event is not counted.
+ */
+static int riscv_pmu_event_ctr(RISCVCPU *cpu,
+                               enum riscv_pmu_event_idx event_idx)
 {
-    uint32_t ctr_idx;
-    int ret;
     CPURISCVState *env = &cpu->env;
+    uint32_t ctr_idx;
     gpointer value;
 
     if (!cpu->cfg.pmu_mask) {
-        return 0;
+        return -1;
     }
     value = g_hash_table_lookup(cpu->pmu_event_ctr_map,
                                 GUINT_TO_POINTER(event_idx));
@@ -194,17 +191,94 @@ int riscv_pmu_incr_ctr(RISCVCPU *cpu, enum riscv_pmu_event_idx event_idx)
 
     ctr_idx = GPOINTER_TO_UINT(value);
     if (!riscv_pmu_counter_enabled(cpu, ctr_idx) ||
-        get_field(env->mcountinhibit, BIT(ctr_idx))) {
+        get_field(env->mcountinhibit, BIT(ctr_idx)) ||
+        riscv_pmu_ctr_filtered(env, ctr_idx)) {
         return -1;
     }
 
-    if (riscv_cpu_mxl(env) == MXL_RV32) {
-        ret = riscv_pmu_incr_ctr_rv32(cpu, ctr_idx);
+    return ctr_idx;
+}
+
+static int riscv_pmu_add_ctr(RISCVCPU *cpu, enum riscv_pmu_event_idx event_idx,
+                             uint32_t n)
+{
+    int ctr_idx = riscv_pmu_event_ctr(cpu, event_idx);
+
+    if (ctr_idx < 0) {
+        return -1;
+    }
+
+    if (riscv_cpu_mxl(&cpu->env) == MXL_RV32) {
+        riscv_pmu_incr_ctr_rv32(cpu, ctr_idx, n);
     } else {
-        ret = riscv_pmu_incr_ctr_rv64(cpu, ctr_idx);
+        riscv_pmu_incr_ctr_rv64(cpu, ctr_idx, n);
     }
 
-    return ret;
+    return 0;
+}
+
+int riscv_pmu_incr_ctr(RISCVCPU *cpu, enum riscv_pmu_event_idx event_idx)
+{
+    return riscv_pmu_add_ctr(cpu, event_idx, 1);
+}
+
+/*
+ * TLB misses are counted in batches: riscv_pmu_count only bumps a per-hart
+ * pending count, and the pending events are added to their counter when
+ * the batch is full, before the counter would overflow, or whenever the
+ * PMU state is looked at or changed (see riscv_pmu_flush).
+ */
+#define RISCV_PMU_BATCH 256
+
+static const enum riscv_pmu_event_idx riscv_pmu_pending_event[] = {
+    [RISCV_PMU_PENDING_ITLB_MISS] = RISCV_PMU_EVENT_CACHE_ITLB_PREFETCH_MISS,
+    [RISCV_PMU_PENDING_DTLB_READ_MISS] = RISCV_PMU_EVENT_CACHE_DTLB_READ_MISS,
+    [RISCV_PMU_PENDING_DTLB_WRITE_MISS] =
+        RISCV_PMU_EVENT_CACHE_DTLB_WRITE_MISS,
+};
+
+/* Add the pending events and size the next batch for the current state */
+void riscv_pmu_fold(CPURISCVState *env)
+{
+    RISCVCPU *cpu = env_archcpu(env);
+    int i;
+
+    for (i = 0; i < RISCV_PMU_PENDING_NUM; i++) {
+        enum riscv_pmu_event_idx event_idx = riscv_pmu_pending_event[i];
+        int ctr_idx;
+
+        if (env->pmu_pending[i]) {
+            riscv_pmu_add_ctr(cpu, event_idx, env->pmu_pending[i]);
+            env->pmu_pending[i] = 0;
+        }
+
+        ctr_idx = riscv_pmu_event_ctr(cpu, event_idx);
+        if (ctr_idx < 0) {
+            /* Not counted, there is nothing to hurry for */
+            env->pmu_pending_left[i] = INT32_MAX;
+        } else {
+            /* The event that overflows the counter is folded at once */
+            uint64_t headroom = riscv_pmu_ctr_headroom(env, ctr_idx);
+
+            env->pmu_pending_left[i] = headroom < RISCV_PMU_BATCH ?
+                                       headroom + 1 : RISCV_PMU_BATCH;
+        }
+    }
+}
+
+void riscv_pmu_flush(CPURISCVState *env)
+{
+    int i;
+
+    for (i = 0; i < RISCV_PMU_PENDING_NUM; i++) {
+        if (env->pmu_pending[i]) {
+            riscv_pmu_add_ctr(env_archcpu(env), riscv_pmu_pending_event[i],
+                              env->pmu_pending[i]);
+            env->pmu_pending[i] = 0;
+        }
+        /* Size the next batch once the state has settled */
+        env->pmu_pending_left[i] = 0;
+    }
 }
 
 bool riscv_pmu_ctr_monitor_instructions(CPURISCVState *env,
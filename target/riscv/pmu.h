@@ -28,6 +28,17 @@ void riscv_pmu_init(RISCVCPU *cpu, Error **errp);
 int riscv_pmu_update_event_map(CPURISCVState *env, uint64_t value,
                                uint32_t ctr_idx);
 int riscv_pmu_incr_ctr(RISCVCPU *cpu, enum riscv_pmu_event_idx event_idx);
+void riscv_pmu_fold(CPURISCVState *env);
+void riscv_pmu_flush(CPURISCVState *env);
+
+/* Count one batched event */
+static inline void riscv_pmu_count(CPURISCVState *env, RISCVPMUPending ev)
+{
+    env->pmu_pending[ev]++;
+    if (--env->pmu_pending_left[ev] <= 0) {
+        riscv_pmu_fold(env);
+    }
+}
 void riscv_pmu_generate_fdt_node(void *fdt, uint32_t cmask, char *pmu_name);
 int riscv_pmu_setup_timer(CPURISCVState *env, uint64_t value,
                           uint32_t ctr_idx);
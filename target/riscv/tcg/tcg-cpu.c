@@ -26,6 +26,7 @@
 #include "qapi/error.h"
 #include "qapi/visitor.h"
 #include "qemu/accel.h"
+#include "qemu/atomic128.h"
 #include "qemu/error-report.h"
 #include "qemu/log.h"
 #include "hw/core/accel-cpu.h"
@@ -455,6 +456,13 @@ void riscv_cpu_validate_set_extensions(RISCVCPU *cpu, Error **errp)
         return;
     }
 
+#ifdef TARGET_RISCV64
+    if (cpu->cfg.ext_zacas && !HAVE_CMPXCHG128) {
+        warn_report_once("Zacas: the host has no 128-bit compare-and-swap, "
+                         "amocas.q will run with all other harts stopped");
+    }
+#endif
+
     if ((cpu->cfg.ext_zawrs) && !riscv_has_ext(env, RVA)) {
         error_setg(errp, "Zawrs extension requires A extension");
         return;
@@ -75,8 +75,8 @@ typedef struct DisasContext {
      * Remember the rounding mode encoded in the previous fp instruction,
      * which we have already installed into env->fp_status.  Or -1 for
      * no previous fp instruction.  Note that we exit the TB when writing
-     * to any system register, which includes CSR_FRM, so we do not have
-     * to reset this known value.
+     * to any system register but the trap scratch ones, which includes
+     * CSR_FRM, so we do not have to reset this known value.
      */
     int frm;
     RISCVMXL ol;
@@ -571,6 +571,13 @@ static void gen_jal(DisasContext *ctx, int rd, target_ulong imm)
     gen_pc_plus_diff(succ_pc, ctx, ctx->cur_insn_len);
     gen_set_gpr(ctx, rd, succ_pc);
 
+    /* Hot TBs carry on with the jump target as a superblock. */
+    if (!ctx->itrigger &&
+        translator_follow_jump(&ctx->base, ctx->base.pc_next + imm)) {
+        ctx->base.pc_next += imm - ctx->cur_insn_len;
+        return;
+    }
+
     gen_goto_tb(ctx, 0, imm); /* must use this for safety */
     ctx->base.is_jmp = DISAS_NORETURN;
 }
@@ -1180,7 +1187,14 @@ static void riscv_tr_init_disas_context(DisasContextBase *dcbase, CPUState *cs)
     ctx->priv_ver = env->priv_ver;
     ctx->virt_enabled = FIELD_EX32(tb_flags, TB_FLAGS, VIRT_ENABLED);
     ctx->misa_ext = env->misa_ext;
-    ctx->frm = -1;  /* unknown rounding mode */
+    if (FIELD_EX32(tb_flags, TB_FLAGS, FRM_CURRENT)) {
+        /* Dynamic rounding is already set up, and frm is known valid. */
+        ctx->frm = RISCV_FRM_DYN;
+        ctx->frm_valid = true;
+    } else {
+        ctx->frm = -1;  /* unknown rounding mode */
+        ctx->frm_valid = false;
+    }
     ctx->cfg_ptr = &(cpu->cfg);
     ctx->vill = FIELD_EX32(tb_flags, TB_FLAGS, VILL);
     ctx->sew = FIELD_EX32(tb_flags, TB_FLAGS, SEW);
@@ -24,6 +24,7 @@
 #include "cpu.h"
 #include "crypto/aes.h"
 #include "crypto/aes-round.h"
+#include "crypto/clmul.h"
 #include "crypto/sm4.h"
 #include "exec/memop.h"
 #include "exec/exec-all.h"
@@ -33,24 +34,12 @@
 
 static uint64_t clmul64(uint64_t y, uint64_t x)
 {
-    uint64_t result = 0;
-    for (int j = 63; j >= 0; j--) {
-        if ((y >> j) & 1) {
-            result ^= (x << j);
-        }
-    }
-    return result;
+    return int128_getlo(clmul_64(y, x));
 }
 
 static uint64_t clmulh64(uint64_t y, uint64_t x)
 {
-    uint64_t result = 0;
-    for (int j = 63; j >= 1; j--) {
-        if ((y >> j) & 1) {
-            result ^= (x >> (64 - j));
-        }
-    }
-    return result;
+    return int128_gethi(clmul_64(y, x));
 }
 
 RVVCALL(OPIVV2, vclmul_vv, OP_UUU_D, H8, H8, H8, clmul64)
@@ -771,6 +760,31 @@ void HELPER(vsm3c_vi)(void *vd_vptr, void *vs2_vptr, uint32_t uimm,
     env->vstart = 0;
 }
 
+/*
+ * Multiply @x by @y in GF(2^128) modulo x^128 + x^7 + x^2 + x + 1,
+ * with bit i of the operands being the coefficient of x^i, using the
+ * carry-less multiply of the host when it has one.
+ */
+static void vghsh_gfmul(uint64_t *z, const uint64_t *x, const uint64_t *y)
+{
+    Int128 lo = clmul_64(x[0], y[0]);
+    Int128 hi = clmul_64(x[1], y[1]);
+    Int128 mid = int128_xor(clmul_64(x[0], y[1]), clmul_64(x[1], y[0]));
+    uint64_t w0 = int128_getlo(lo);
+    uint64_t w1 = int128_gethi(lo) ^ int128_getlo(mid);
+    uint64_t w2 = int128_getlo(hi) ^ int128_gethi(mid);
+    uint64_t w3 = int128_gethi(hi);
+    Int128 t;
+
+    /* x^128 = x^7 + x^2 + x + 1, fold the top two words down */
+    t = clmul_64(w3, 0x87);
+    w1 ^= int128_getlo(t);
+    w2 ^= int128_gethi(t);
+    t = clmul_64(w2, 0x87);
+    z[0] = w0 ^ int128_getlo(t);
+    z[1] = w1 ^ int128_gethi(t);
+}
+
 void HELPER(vghsh_vv)(void *vd_vptr, void *vs1_vptr, void *vs2_vptr,
                       CPURISCVState *env, uint32_t desc)
 {
@@ -784,22 +798,11 @@ void HELPER(vghsh_vv)(void *vd_vptr, void *vs1_vptr, void *vs2_vptr,
         uint64_t Y[2] = {vd[i * 2 + 0], vd[i * 2 + 1]};
         uint64_t H[2] = {brev8(vs2[i * 2 + 0]), brev8(vs2[i * 2 + 1])};
         uint64_t X[2] = {vs1[i * 2 + 0], vs1[i * 2 + 1]};
-        uint64_t Z[2] = {0, 0};
+        uint64_t Z[2];
 
         uint64_t S[2] = {brev8(Y[0] ^ X[0]), brev8(Y[1] ^ X[1])};
 
-        for (int j = 0; j < 128; j++) {
-            if ((S[j / 64] >> (j % 64)) & 1) {
-                Z[0] ^= H[0];
-                Z[1] ^= H[1];
-            }
-            bool reduce = ((H[1] >> 63) & 1);
-            H[1] = H[1] << 1 | H[0] >> 63;
-            H[0] = H[0] << 1;
-            if (reduce) {
-                H[0] ^= 0x87;
-            }
-        }
+        vghsh_gfmul(Z, S, H);
 
         vd[i * 2 + 0] = brev8(Z[0]);
         vd[i * 2 + 1] = brev8(Z[1]);
@@ -820,20 +823,9 @@ void HELPER(vgmul_vv)(void *vd_vptr, void *vs2_vptr, CPURISCVState *env,
     for (uint32_t i = env->vstart / 4; i < env->vl / 4; i++) {
         uint64_t Y[2] = {brev8(vd[i * 2 + 0]), brev8(vd[i * 2 + 1])};
         uint64_t H[2] = {brev8(vs2[i * 2 + 0]), brev8(vs2[i * 2 + 1])};
-        uint64_t Z[2] = {0, 0};
-
-        for (int j = 0; j < 128; j++) {
-            if ((Y[j / 64] >> (j % 64)) & 1) {
-                Z[0] ^= H[0];
-                Z[1] ^= H[1];
-            }
-            bool reduce = ((H[1] >> 63) & 1);
-            H[1] = H[1] << 1 | H[0] >> 63;
-            H[0] = H[0] << 1;
-            if (reduce) {
-                H[0] ^= 0x87;
-            }
-        }
+        uint64_t Z[2];
+
+        vghsh_gfmul(Z, Y, H);
 
         vd[i * 2 + 0] = brev8(Z[0]);
         vd[i * 2 + 1] = brev8(Z[1]);
@@ -175,6 +175,33 @@ GEN_VEXT_ST_ELEM(ste_h, int16_t, H2, stw)
 GEN_VEXT_ST_ELEM(ste_w, int32_t, H4, stl)
 GEN_VEXT_ST_ELEM(ste_d, int64_t, H8, stq)
 
+/* The same, for an element already known to be in RAM at @host */
+typedef void vext_ldst_elem_host_fn(void *vd, uint32_t idx, void *host);
+
+#define GEN_VEXT_LD_ELEM_HOST(NAME, ETYPE, H, LDSUF)       \
+static void NAME(void *vd, uint32_t idx, void *host)       \
+{                                                          \
+    ETYPE *cur = ((ETYPE *)vd + H(idx));                   \
+    *cur = LDSUF##_p(host);                                \
+}
+
+GEN_VEXT_LD_ELEM_HOST(lde_b_host, int8_t,  H1, ldsb)
+GEN_VEXT_LD_ELEM_HOST(lde_h_host, int16_t, H2, ldsw)
+GEN_VEXT_LD_ELEM_HOST(lde_w_host, int32_t, H4, ldl)
+GEN_VEXT_LD_ELEM_HOST(lde_d_host, int64_t, H8, ldq)
+
+#define GEN_VEXT_ST_ELEM_HOST(NAME, ETYPE, H, STSUF)       \
+static void NAME(void *vd, uint32_t idx, void *host)       \
+{                                                          \
+    ETYPE data = *((ETYPE *)vd + H(idx));                  \
+    STSUF##_p(host, data);                                 \
+}
+
+GEN_VEXT_ST_ELEM_HOST(ste_b_host, int8_t,  H1, stb)
+GEN_VEXT_ST_ELEM_HOST(ste_h_host, int16_t, H2, stw)
+GEN_VEXT_ST_ELEM_HOST(ste_w_host, int32_t, H4, stl)
+GEN_VEXT_ST_ELEM_HOST(ste_d_host, int64_t, H8, stq)
+
 static void vext_set_tail_elems_1s(target_ulong vl, void *vd,
                                    uint32_t desc, uint32_t nf,
                                    uint32_t esz, uint32_t max_elems)
@@ -265,21 +292,46 @@ GEN_VEXT_ST_STRIDE(vsse64_v, int64_t, ste_d)
 /* unmasked unit-stride load and store operation */
 static void
 vext_ldst_us(void *vd, target_ulong base, CPURISCVState *env, uint32_t desc,
-             vext_ldst_elem_fn *ldst_elem, uint32_t log2_esz, uint32_t evl,
+             vext_ldst_elem_fn *ldst_elem, vext_ldst_elem_host_fn *ldst_host,
+             MMUAccessType access_type, uint32_t log2_esz, uint32_t evl,
              uintptr_t ra)
 {
-    uint32_t i, k;
+    uint32_t i, k, n;
     uint32_t nf = vext_nf(desc);
     uint32_t max_elems = vext_max_elems(desc, log2_esz);
     uint32_t esz = 1 << log2_esz;
+    uint32_t seg_size = nf << log2_esz;
+    int mmu_index = riscv_env_mmu_index(env, false);
 
-    /* load bytes from guest memory */
-    for (i = env->vstart; i < evl; i++, env->vstart++) {
-        k = 0;
-        while (k < nf) {
-            target_ulong addr = base + ((i * nf + k) << log2_esz);
-            ldst_elem(env, adjust_addr(env, addr), i + k * max_elems, vd, ra);
-            k++;
+    /*
+     * Probe the elements that lie on the same page at once and access
+     * them directly in host memory.  A segment crossing the page, or a
+     * page that is not RAM, goes through the TLB element by element.
+     */
+    for (i = env->vstart; i < evl; ) {
+        target_ulong addr = adjust_addr(env, base + i * seg_size);
+        void *host = NULL;
+
+        n = MIN(evl - i, -(addr | TARGET_PAGE_MASK) / seg_size);
+        if (n) {
+            host = probe_access(env, addr, n * seg_size, access_type,
+                                mmu_index, ra);
+        }
+
+        if (host) {
+            for (; n > 0; n--, i++, env->vstart++) {
+                for (k = 0; k < nf; k++, host += esz) {
+                    ldst_host(vd, i + k * max_elems, host);
+                }
+            }
+        } else {
+            for (n = MAX(n, 1); n > 0; n--, i++, env->vstart++) {
+                for (k = 0; k < nf; k++) {
+                    addr = base + ((i * nf + k) << log2_esz);
+                    ldst_elem(env, adjust_addr(env, addr), i + k * max_elems,
+                              vd, ra);
+                }
+            }
         }
     }
     env->vstart = 0;
@@ -292,7 +344,7 @@ vext_ldst_us(void *vd, target_ulong base, CPURISCVState *env, uint32_t desc,
  * stride, stride = NF * sizeof (ETYPE)
  */
 
-#define GEN_VEXT_LD_US(NAME, ETYPE, LOAD_FN)                            \
+#define GEN_VEXT_LD_US(NAME, ETYPE, LOAD_FN, LOAD_HOST_FN)              \
 void HELPER(NAME##_mask)(void *vd, void *v0, target_ulong base,         \
                          CPURISCVState *env, uint32_t desc)             \
 {                                                                       \
@@ -304,16 +356,16 @@ void HELPER(NAME##_mask)(void *vd, void *v0, target_ulong base,         \
 void HELPER(NAME)(void *vd, void *v0, target_ulong base,                \
                   CPURISCVState *env, uint32_t desc)                    \
 {                                                                       \
-    vext_ldst_us(vd, base, env, desc, LOAD_FN,                          \
-                 ctzl(sizeof(ETYPE)), env->vl, GETPC());                \
+    vext_ldst_us(vd, base, env, desc, LOAD_FN, LOAD_HOST_FN,            \
+                 MMU_DATA_LOAD, ctzl(sizeof(ETYPE)), env->vl, GETPC()); \
 }
 
-GEN_VEXT_LD_US(vle8_v,  int8_t,  lde_b)
-GEN_VEXT_LD_US(vle16_v, int16_t, lde_h)
-GEN_VEXT_LD_US(vle32_v, int32_t, lde_w)
-GEN_VEXT_LD_US(vle64_v, int64_t, lde_d)
+GEN_VEXT_LD_US(vle8_v,  int8_t,  lde_b, lde_b_host)
+GEN_VEXT_LD_US(vle16_v, int16_t, lde_h, lde_h_host)
+GEN_VEXT_LD_US(vle32_v, int32_t, lde_w, lde_w_host)
+GEN_VEXT_LD_US(vle64_v, int64_t, lde_d, lde_d_host)
 
-#define GEN_VEXT_ST_US(NAME, ETYPE, STORE_FN)                            \
+#define GEN_VEXT_ST_US(NAME, ETYPE, STORE_FN, STORE_HOST_FN)             \
 void HELPER(NAME##_mask)(void *vd, void *v0, target_ulong base,          \
                          CPURISCVState *env, uint32_t desc)              \
 {                                                                        \
@@ -325,14 +377,14 @@ void HELPER(NAME##_mask)(void *vd, void *v0, target_ulong base,          \
 void HELPER(NAME)(void *vd, void *v0, target_ulong base,                 \
                   CPURISCVState *env, uint32_t desc)                     \
 {                                                                        \
-    vext_ldst_us(vd, base, env, desc, STORE_FN,                          \
-                 ctzl(sizeof(ETYPE)), env->vl, GETPC());                 \
+    vext_ldst_us(vd, base, env, desc, STORE_FN, STORE_HOST_FN,           \
+                 MMU_DATA_STORE, ctzl(sizeof(ETYPE)), env->vl, GETPC()); \
 }
 
-GEN_VEXT_ST_US(vse8_v,  int8_t,  ste_b)
-GEN_VEXT_ST_US(vse16_v, int16_t, ste_h)
-GEN_VEXT_ST_US(vse32_v, int32_t, ste_w)
-GEN_VEXT_ST_US(vse64_v, int64_t, ste_d)
+GEN_VEXT_ST_US(vse8_v,  int8_t,  ste_b, ste_b_host)
+GEN_VEXT_ST_US(vse16_v, int16_t, ste_h, ste_h_host)
+GEN_VEXT_ST_US(vse32_v, int32_t, ste_w, ste_w_host)
+GEN_VEXT_ST_US(vse64_v, int64_t, ste_d, ste_d_host)
 
 /*
  * unit stride mask load and store, EEW = 1
@@ -342,8 +394,8 @@ void HELPER(vlm_v)(void *vd, void *v0, target_ulong base,
 {
     /* evl = ceil(vl/8) */
     uint8_t evl = (env->vl + 7) >> 3;
-    vext_ldst_us(vd, base, env, desc, lde_b,
-                 0, evl, GETPC());
+    vext_ldst_us(vd, base, env, desc, lde_b, lde_b_host,
+                 MMU_DATA_LOAD, 0, evl, GETPC());
 }
 
 void HELPER(vsm_v)(void *vd, void *v0, target_ulong base,
@@ -351,8 +403,8 @@ void HELPER(vsm_v)(void *vd, void *v0, target_ulong base,
 {
     /* evl = ceil(vl/8) */
     uint8_t evl = (env->vl + 7) >> 3;
-    vext_ldst_us(vd, base, env, desc, ste_b,
-                 0, evl, GETPC());
+    vext_ldst_us(vd, base, env, desc, ste_b, ste_b_host,
+                 MMU_DATA_STORE, 0, evl, GETPC());
 }
 
 /*
@@ -566,13 +618,42 @@ GEN_VEXT_LDFF(vle64ff_v, int64_t, lde_d)
  */
 static void
 vext_ldst_whole(void *vd, target_ulong base, CPURISCVState *env, uint32_t desc,
-                vext_ldst_elem_fn *ldst_elem, uint32_t log2_esz, uintptr_t ra)
+                vext_ldst_elem_fn *ldst_elem, uint32_t log2_esz, uintptr_t ra,
+                MMUAccessType access_type)
 {
     uint32_t i, k, off, pos;
     uint32_t nf = vext_nf(desc);
     uint32_t vlenb = riscv_cpu_cfg(env)->vlenb;
     uint32_t max_elems = vlenb >> log2_esz;
 
+    /*
+     * On a little-endian host the registers hold the elements in memory
+     * order, so an access that stays within one page of RAM is a plain
+     * copy.  Anything else, including a fault, goes element by element.
+     */
+    if (!HOST_BIG_ENDIAN) {
+        target_ulong addr = adjust_addr(env, base +
+                                        (env->vstart << log2_esz));
+        uint32_t len = (nf * max_elems - env->vstart) << log2_esz;
+        void *host = NULL;
+
+        if (len <= -(addr | TARGET_PAGE_MASK)) {
+            host = probe_access(env, addr, len, access_type,
+                                riscv_env_mmu_index(env, false), ra);
+        }
+        if (host) {
+            void *reg = vd + (env->vstart << log2_esz);
+
+            if (access_type == MMU_DATA_LOAD) {
+                memcpy(reg, host, len);
+            } else {
+                memcpy(host, reg, len);
+            }
+            env->vstart = 0;
+            return;
+        }
+    }
+
     k = env->vstart / max_elems;
     off = env->vstart % max_elems;
 
@@ -602,7 +683,8 @@ void HELPER(NAME)(void *vd, target_ulong base,       \
                   CPURISCVState *env, uint32_t desc) \
 {                                                    \
     vext_ldst_whole(vd, base, env, desc, LOAD_FN,    \
-                    ctzl(sizeof(ETYPE)), GETPC());   \
+                    ctzl(sizeof(ETYPE)), GETPC(),    \
+                    MMU_DATA_LOAD);                  \
 }
 
 GEN_VEXT_LD_WHOLE(vl1re8_v,  int8_t,  lde_b)
@@ -627,7 +709,8 @@ void HELPER(NAME)(void *vd, target_ulong base,       \
                   CPURISCVState *env, uint32_t desc) \
 {                                                    \
     vext_ldst_whole(vd, base, env, desc, STORE_FN,   \
-                    ctzl(sizeof(ETYPE)), GETPC());   \
+                    ctzl(sizeof(ETYPE)), GETPC(),    \
+                    MMU_DATA_STORE);                 \
 }
 
 GEN_VEXT_ST_WHOLE(vs1r_v, int8_t, ste_b)
@@ -2853,12 +2936,55 @@ void HELPER(NAME)(void *vd, void *v0, void *vs1,          \
                       total_elems * ESZ);                 \
 }
 
+/*
+ * As GEN_VEXT_VV_ENV, but unmasked operations hand the whole body to
+ * the softfloat array function ARRAY_OP, which checks once whether the
+ * host FPU can be used.  Only when the elements are in host order, as
+ * H4 and H8 are the identity on little-endian hosts.
+ */
+#define GEN_VEXT_VV_ENV_ARRAY(NAME, ESZ, TYPE, ARRAY_OP)  \
+void HELPER(NAME)(void *vd, void *v0, void *vs1,          \
+                  void *vs2, CPURISCVState *env,          \
+                  uint32_t desc)                          \
+{                                                         \
+    uint32_t vm = vext_vm(desc);                          \
+    uint32_t vl = env->vl;                                \
+    uint32_t total_elems =                                \
+        vext_get_total_elems(env, desc, ESZ);             \
+    uint32_t vta = vext_vta(desc);                        \
+    uint32_t vma = vext_vma(desc);                        \
+    uint32_t i;                                           \
+                                                          \
+    if (vm && !HOST_BIG_ENDIAN) {                         \
+        if (env->vstart < vl) {                           \
+            i = env->vstart;                              \
+            ARRAY_OP((TYPE *)vd + i, (TYPE *)vs2 + i,     \
+                     (TYPE *)vs1 + i, vl - i,             \
+                     &env->fp_status);                    \
+        }                                                 \
+    } else {                                              \
+        for (i = env->vstart; i < vl; i++) {              \
+            if (!vm && !vext_elem_mask(v0, i)) {          \
+                /* set masked-off elements to 1s */       \
+                vext_set_elems_1s(vd, vma, i * ESZ,       \
+                                  (i + 1) * ESZ);         \
+                continue;                                 \
+            }                                             \
+            do_##NAME(vd, vs1, vs2, i, env);              \
+        }                                                 \
+    }                                                     \
+    env->vstart = 0;                                      \
+    /* set tail elements to 1s */                         \
+    vext_set_elems_1s(vd, vta, vl * ESZ,                  \
+                      total_elems * ESZ);                 \
+}
+
 RVVCALL(OPFVV2, vfadd_vv_h, OP_UUU_H, H2, H2, H2, float16_add)
 RVVCALL(OPFVV2, vfadd_vv_w, OP_UUU_W, H4, H4, H4, float32_add)
 RVVCALL(OPFVV2, vfadd_vv_d, OP_UUU_D, H8, H8, H8, float64_add)
 GEN_VEXT_VV_ENV(vfadd_vv_h, 2)
-GEN_VEXT_VV_ENV(vfadd_vv_w, 4)
-GEN_VEXT_VV_ENV(vfadd_vv_d, 8)
+GEN_VEXT_VV_ENV_ARRAY(vfadd_vv_w, 4, float32, float32_add_array)
+GEN_VEXT_VV_ENV_ARRAY(vfadd_vv_d, 8, float64, float64_add_array)
 
 #define OPFVF2(NAME, TD, T1, T2, TX1, TX2, HD, HS2, OP)        \
 static void do_##NAME(void *vd, uint64_t s1, void *vs2, int i, \
@@ -2907,8 +3033,8 @@ RVVCALL(OPFVV2, vfsub_vv_h, OP_UUU_H, H2, H2, H2, float16_sub)
 RVVCALL(OPFVV2, vfsub_vv_w, OP_UUU_W, H4, H4, H4, float32_sub)
 RVVCALL(OPFVV2, vfsub_vv_d, OP_UUU_D, H8, H8, H8, float64_sub)
 GEN_VEXT_VV_ENV(vfsub_vv_h, 2)
-GEN_VEXT_VV_ENV(vfsub_vv_w, 4)
-GEN_VEXT_VV_ENV(vfsub_vv_d, 8)
+GEN_VEXT_VV_ENV_ARRAY(vfsub_vv_w, 4, float32, float32_sub_array)
+GEN_VEXT_VV_ENV_ARRAY(vfsub_vv_d, 8, float64, float64_sub_array)
 RVVCALL(OPFVF2, vfsub_vf_h, OP_UUU_H, H2, H2, float16_sub)
 RVVCALL(OPFVF2, vfsub_vf_w, OP_UUU_W, H4, H4, float32_sub)
 RVVCALL(OPFVF2, vfsub_vf_d, OP_UUU_D, H8, H8, float64_sub)
@@ -3026,8 +3152,8 @@ RVVCALL(OPFVV2, vfmul_vv_h, OP_UUU_H, H2, H2, H2, float16_mul)
 RVVCALL(OPFVV2, vfmul_vv_w, OP_UUU_W, H4, H4, H4, float32_mul)
 RVVCALL(OPFVV2, vfmul_vv_d, OP_UUU_D, H8, H8, H8, float64_mul)
 GEN_VEXT_VV_ENV(vfmul_vv_h, 2)
-GEN_VEXT_VV_ENV(vfmul_vv_w, 4)
-GEN_VEXT_VV_ENV(vfmul_vv_d, 8)
+GEN_VEXT_VV_ENV_ARRAY(vfmul_vv_w, 4, float32, float32_mul_array)
+GEN_VEXT_VV_ENV_ARRAY(vfmul_vv_d, 8, float64, float64_mul_array)
 RVVCALL(OPFVF2, vfmul_vf_h, OP_UUU_H, H2, H2, float16_mul)
 RVVCALL(OPFVF2, vfmul_vf_w, OP_UUU_W, H4, H4, float32_mul)
 RVVCALL(OPFVF2, vfmul_vf_d, OP_UUU_D, H8, H8, float64_mul)
@@ -3039,8 +3165,8 @@ RVVCALL(OPFVV2, vfdiv_vv_h, OP_UUU_H, H2, H2, H2, float16_div)
 RVVCALL(OPFVV2, vfdiv_vv_w, OP_UUU_W, H4, H4, H4, float32_div)
 RVVCALL(OPFVV2, vfdiv_vv_d, OP_UUU_D, H8, H8, H8, float64_div)
 GEN_VEXT_VV_ENV(vfdiv_vv_h, 2)
-GEN_VEXT_VV_ENV(vfdiv_vv_w, 4)
-GEN_VEXT_VV_ENV(vfdiv_vv_d, 8)
+GEN_VEXT_VV_ENV_ARRAY(vfdiv_vv_w, 4, float32, float32_div_array)
+GEN_VEXT_VV_ENV_ARRAY(vfdiv_vv_d, 8, float64, float64_div_array)
 RVVCALL(OPFVF2, vfdiv_vf_h, OP_UUU_H, H2, H2, float16_div)
 RVVCALL(OPFVF2, vfdiv_vf_w, OP_UUU_W, H4, H4, float32_div)
 RVVCALL(OPFVF2, vfdiv_vf_d, OP_UUU_D, H8, H8, float64_div)
@@ -3976,6 +4102,57 @@ GEN_VEXT_VF(vfsgnjx_vf_h, 2)
 GEN_VEXT_VF(vfsgnjx_vf_w, 4)
 GEN_VEXT_VF(vfsgnjx_vf_d, 8)
 
+/*
+ * Out of line versions of the GVEC expansion of vfsgnj*.vv, working on
+ * 64 bits at a time.  simd_data holds the element size.
+ */
+static uint64_t vec_fsign_mask(uint32_t desc)
+{
+    unsigned bits = 8 << simd_data(desc);
+    uint64_t m = 1ull << (bits - 1);
+
+    for (; bits < 64; bits *= 2) {
+        m |= m << bits;
+    }
+    return m;
+}
+
+void HELPER(vec_fsgnj)(void *d, void *a, void *b, uint32_t desc)
+{
+    intptr_t oprsz = simd_oprsz(desc);
+    uint64_t m = vec_fsign_mask(desc);
+    intptr_t i;
+
+    for (i = 0; i < oprsz; i += sizeof(uint64_t)) {
+        *(uint64_t *)(d + i) = (*(uint64_t *)(a + i) & ~m) |
+                               (*(uint64_t *)(b + i) & m);
+    }
+}
+
+void HELPER(vec_fsgnjn)(void *d, void *a, void *b, uint32_t desc)
+{
+    intptr_t oprsz = simd_oprsz(desc);
+    uint64_t m = vec_fsign_mask(desc);
+    intptr_t i;
+
+    for (i = 0; i < oprsz; i += sizeof(uint64_t)) {
+        *(uint64_t *)(d + i) = (*(uint64_t *)(a + i) & ~m) |
+                               (~*(uint64_t *)(b + i) & m);
+    }
+}
+
+void HELPER(vec_fsgnjx)(void *d, void *a, void *b, uint32_t desc)
+{
+    intptr_t oprsz = simd_oprsz(desc);
+    uint64_t m = vec_fsign_mask(desc);
+    intptr_t i;
+
+    for (i = 0; i < oprsz; i += sizeof(uint64_t)) {
+        *(uint64_t *)(d + i) = *(uint64_t *)(a + i) ^
+                               (*(uint64_t *)(b + i) & m);
+    }
+}
+
 /* Vector Floating-Point Compare Instructions */
 #define GEN_VEXT_CMP_VV_ENV(NAME, ETYPE, H, DO_OP)            \
 void HELPER(NAME)(void *vd, void *v0, void *vs1, void *vs2,   \
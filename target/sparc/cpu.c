@@ -555,6 +555,8 @@ static const char * const feature_name[] = {
     [CPU_FEATURE_BIT_MUL] = "mul",
     [CPU_FEATURE_BIT_DIV] = "div",
     [CPU_FEATURE_BIT_FSMULD] = "fsmuld",
+    [CPU_FEATURE_BIT_FLUSH_ELISION] = "flush-elision",
+    [CPU_FEATURE_BIT_FAST_WIN_TRAPS] = "fast-window-traps",
 #endif
 };
 
@@ -880,6 +882,10 @@ static Property sparc_cpu_properties[] = {
                     CPU_FEATURE_BIT_DIV, false),
     DEFINE_PROP_BIT("fsmuld",   SPARCCPU, env.def.features,
                     CPU_FEATURE_BIT_FSMULD, false),
+    DEFINE_PROP_BIT("flush-elision", SPARCCPU, env.def.features,
+                    CPU_FEATURE_BIT_FLUSH_ELISION, false),
+    DEFINE_PROP_BIT("fast-window-traps", SPARCCPU, env.def.features,
+                    CPU_FEATURE_BIT_FAST_WIN_TRAPS, false),
 #endif
     DEFINE_PROP_UNSIGNED("iu-version", SPARCCPU, env.def.iu_version, 0,
                          qdev_prop_uint64, target_ulong),
@@ -745,8 +745,16 @@ trap_state* cpu_tsptr(CPUSPARCState* env);
 #define TB_FLAG_AM_ENABLED   (1 << 5)
 #define TB_FLAG_SUPER        (1 << 6)
 #define TB_FLAG_HYPER        (1 << 7)
+#define TB_FLAG_CWP_VALID    (1 << 8)
+#define TB_FLAG_CWP_SHIFT    9
 #define TB_FLAG_ASI_SHIFT    24
 
+/*
+ * With up to this many windows, sparc32 TBs are specialized on CWP and
+ * access the windowed registers at fixed offsets.
+ */
+#define SPARC_DIRECT_NWINDOWS 8
+
 static inline void cpu_get_tb_cpu_state(CPUSPARCState *env, vaddr *pc,
                                         uint64_t *cs_base, uint32_t *pflags)
 {
@@ -776,6 +784,9 @@ static inline void cpu_get_tb_cpu_state(CPUSPARCState *env, vaddr *pc,
     if (env->psref) {
         flags |= TB_FLAG_FPU_ENABLED;
     }
+    if (env->nwindows <= SPARC_DIRECT_NWINDOWS) {
+        flags |= TB_FLAG_CWP_VALID | (env->cwp << TB_FLAG_CWP_SHIFT);
+    }
 #endif
     *pflags = flags;
 }
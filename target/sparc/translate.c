@@ -100,6 +100,10 @@
 static TCGv_ptr cpu_regwptr;
 static TCGv cpu_pc, cpu_npc;
 static TCGv cpu_regs[32];
+#ifndef TARGET_SPARC64
+/* The windowed registers at fixed offsets, see get_gpr() */
+static TCGv cpu_regbase[SPARC_DIRECT_NWINDOWS * 16 + 8];
+#endif
 static TCGv cpu_y;
 static TCGv cpu_tbr;
 static TCGv cpu_cond;
@@ -181,6 +185,9 @@ typedef struct DisasContext {
     int asi;
 #endif
     DisasDelayException *delay_excp_list;
+#ifndef TARGET_SPARC64
+    int cwp;            /* current window, or -1 if not known */
+#endif
 } DisasContext;
 
 // This function uses non-native bit order
@@ -312,11 +319,39 @@ static target_ulong address_mask_i(DisasContext *dc, target_ulong addr)
     return AM_CHECK(dc) ? (uint32_t)addr : addr;
 }
 
+/*
+ * If the TB was specialized on CWP, access the windowed registers directly
+ * in regbase rather than through regwptr.  The slots are shared between
+ * overlapping windows just like in memory, so that SAVE and RESTORE only
+ * need to change dc->cwp.
+ */
+static TCGv get_gpr(DisasContext *dc, int reg)
+{
+#ifndef TARGET_SPARC64
+    if (reg >= 8 && dc->cwp >= 0) {
+        return cpu_regbase[dc->cwp * 16 + reg - 8];
+    }
+#endif
+    return cpu_regs[reg];
+}
+
+/* Track the window change done by a SAVE, RESTORE or RETT helper */
+static void gen_update_cwp(DisasContext *dc, int delta)
+{
+#ifndef TARGET_SPARC64
+    if (dc->cwp >= 0) {
+        int nwindows = dc->def->nwindows;
+
+        dc->cwp = (dc->cwp + delta + nwindows) % nwindows;
+    }
+#endif
+}
+
 static TCGv gen_load_gpr(DisasContext *dc, int reg)
 {
     if (reg > 0) {
         assert(reg < 32);
-        return cpu_regs[reg];
+        return get_gpr(dc, reg);
     } else {
         TCGv t = tcg_temp_new();
         tcg_gen_movi_tl(t, 0);
@@ -328,7 +363,7 @@ static void gen_store_gpr(DisasContext *dc, int reg, TCGv v)
 {
     if (reg > 0) {
         assert(reg < 32);
-        tcg_gen_mov_tl(cpu_regs[reg], v);
+        tcg_gen_mov_tl(get_gpr(dc, reg), v);
     }
 }
 
@@ -336,7 +371,7 @@ static TCGv gen_dest_gpr(DisasContext *dc, int reg)
 {
     if (reg > 0) {
         assert(reg < 32);
-        return cpu_regs[reg];
+        return get_gpr(dc, reg);
     } else {
         return tcg_temp_new();
     }
@@ -1121,6 +1156,7 @@ typedef enum {
     GET_ASI_SHORT,
     GET_ASI_BCOPY,
     GET_ASI_BFILL,
+    GET_ASI_NOP,
 } ASIType;
 
 typedef struct {
@@ -1180,6 +1216,20 @@ static DisasASI resolve_asi(DisasContext *dc, int asi, MemOp memop)
             mem_idx = MMU_KERNEL_IDX;
             type = GET_ASI_BFILL;
             break;
+        case ASI_M_FLUSH_PAGE:   /* I/D-cache flush page, LEON I-cache flush */
+        case ASI_M_FLUSH_SEG:    /* I/D-cache flush segment, LEON D-cache flush */
+        case ASI_M_FLUSH_REGION: /* I/D-cache flush region */
+        case ASI_M_FLUSH_CTX:    /* I/D-cache flush context */
+        case ASI_M_FLUSH_USER:   /* I/D-cache flush user */
+            /*
+             * Self-modifying code is caught when the code page is written,
+             * so flushing the caches never has to invalidate translations.
+             * The helper does nothing for these, don't even call it.
+             */
+            if (dc->def->features & CPU_FEATURE_FLUSH_ELISION) {
+                type = GET_ASI_NOP;
+            }
+            break;
         }
 
         /* MMU_PHYS_IDX is used when the MMU is disabled to passthrough the
@@ -1403,6 +1453,7 @@ static void gen_st_asi(DisasContext *dc, DisasASI *da, TCGv src, TCGv addr)
 {
     switch (da->type) {
     case GET_ASI_EXCP:
+    case GET_ASI_NOP:
         break;
 
     case GET_ASI_DTWINX: /* Reserved for stda.  */
@@ -1471,8 +1522,14 @@ static void gen_st_asi(DisasContext *dc, DisasASI *da, TCGv src, TCGv addr)
             }
 #endif
 
-            /* A write to a TLB register may alter page maps.  End the TB. */
-            dc->npc = DYNAMIC_PC;
+            /*
+             * A write to a TLB register may alter page maps.  End the TB.
+             * The LEON cache control register isn't part of the TB state.
+             */
+            if (!(da->asi == ASI_LEON_CACHEREGS &&
+                  (dc->def->features & CPU_FEATURE_FLUSH_ELISION))) {
+                dc->npc = DYNAMIC_PC;
+            }
         }
         break;
     }
@@ -3197,7 +3254,7 @@ static bool do_arith_int(DisasContext *dc, arg_r_r_ri_cc *a,
             func(dst, src1, tcg_constant_tl(a->rs2_or_imm));
         }
     } else {
-        func(dst, src1, cpu_regs[a->rs2_or_imm]);
+        func(dst, src1, get_gpr(dc, a->rs2_or_imm));
     }
 
     if (logic_cc) {
@@ -3269,7 +3326,7 @@ static bool trans_OR(DisasContext *dc, arg_r_r_ri_cc *a)
             /* For simplicity, we under-decoded the rs2 form. */
             return false;
         } else {
-            gen_store_gpr(dc, a->rd, cpu_regs[a->rs2_or_imm]);
+            gen_store_gpr(dc, a->rd, get_gpr(dc, a->rs2_or_imm));
         }
         return advance_pc(dc);
     }
@@ -3304,16 +3361,16 @@ static bool trans_UDIV(DisasContext *dc, arg_r_r_ri *a)
         flush_cond(dc);
 
         n2 = tcg_temp_new_i32();
-        tcg_gen_trunc_tl_i32(n2, cpu_regs[a->rs2_or_imm]);
+        tcg_gen_trunc_tl_i32(n2, get_gpr(dc, a->rs2_or_imm));
 
         lab = delay_exception(dc, TT_DIV_ZERO);
         tcg_gen_brcondi_i32(TCG_COND_EQ, n2, 0, lab);
 
         t2 = tcg_temp_new_i64();
 #ifdef TARGET_SPARC64
-        tcg_gen_ext32u_i64(t2, cpu_regs[a->rs2_or_imm]);
+        tcg_gen_ext32u_i64(t2, get_gpr(dc, a->rs2_or_imm));
 #else
-        tcg_gen_extu_i32_i64(t2, cpu_regs[a->rs2_or_imm]);
+        tcg_gen_extu_i32_i64(t2, get_gpr(dc, a->rs2_or_imm));
 #endif
     }
 
@@ -3355,7 +3412,7 @@ static bool trans_UDIVX(DisasContext *dc, arg_r_r_ri *a)
         flush_cond(dc);
 
         lab = delay_exception(dc, TT_DIV_ZERO);
-        src2 = cpu_regs[a->rs2_or_imm];
+        src2 = get_gpr(dc, a->rs2_or_imm);
         tcg_gen_brcondi_tl(TCG_COND_EQ, src2, 0, lab);
     }
 
@@ -3402,7 +3459,7 @@ static bool trans_SDIVX(DisasContext *dc, arg_r_r_ri *a)
         flush_cond(dc);
 
         lab = delay_exception(dc, TT_DIV_ZERO);
-        src2 = cpu_regs[a->rs2_or_imm];
+        src2 = get_gpr(dc, a->rs2_or_imm);
         tcg_gen_brcondi_tl(TCG_COND_EQ, src2, 0, lab);
 
         /*
@@ -3671,7 +3728,7 @@ static TCGv gen_rs2_or_imm(DisasContext *dc, bool imm, int rs2_or_imm)
     if (imm || rs2_or_imm == 0) {
         return tcg_constant_tl(rs2_or_imm);
     } else {
-        return cpu_regs[rs2_or_imm];
+        return get_gpr(dc, rs2_or_imm);
     }
 }
 
@@ -3743,7 +3800,7 @@ static bool do_add_special(DisasContext *dc, arg_r_r_ri *a,
     if (a->imm || a->rs2_or_imm == 0) {
         tcg_gen_addi_tl(sum, src1, a->rs2_or_imm);
     } else {
-        tcg_gen_add_tl(sum, src1, cpu_regs[a->rs2_or_imm]);
+        tcg_gen_add_tl(sum, src1, get_gpr(dc, a->rs2_or_imm));
     }
     return func(dc, a->rd, sum);
 }
@@ -3780,6 +3837,7 @@ static bool do_rett(DisasContext *dc, int rd, TCGv src)
     gen_mov_pc_npc(dc);
     tcg_gen_mov_tl(cpu_npc, src);
     gen_helper_rett(tcg_env);
+    gen_update_cwp(dc, 1);
 
     dc->npc = DYNAMIC_PC;
     return true;
@@ -3805,6 +3863,7 @@ TRANS(RETURN, 64, do_add_special, a, do_return)
 static bool do_save(DisasContext *dc, int rd, TCGv src)
 {
     gen_helper_save(tcg_env);
+    gen_update_cwp(dc, -1);
     gen_store_gpr(dc, rd, src);
     return advance_pc(dc);
 }
@@ -3814,6 +3873,7 @@ TRANS(SAVE, ALL, do_add_special, a, do_save)
 static bool do_restore(DisasContext *dc, int rd, TCGv src)
 {
     gen_helper_restore(tcg_env);
+    gen_update_cwp(dc, 1);
     gen_store_gpr(dc, rd, src);
     return advance_pc(dc);
 }
@@ -3858,7 +3918,7 @@ static TCGv gen_ldst_addr(DisasContext *dc, int rs1, bool imm, int rs2_or_imm)
         if (imm) {
             tcg_gen_addi_tl(tmp, addr, rs2_or_imm);
         } else {
-            tcg_gen_add_tl(tmp, addr, cpu_regs[rs2_or_imm]);
+            tcg_gen_add_tl(tmp, addr, get_gpr(dc, rs2_or_imm));
         }
         addr = tmp;
     }
@@ -4862,6 +4922,13 @@ static void sparc_tr_init_disas_context(DisasContextBase *dcbase, CPUState *cs)
 #ifndef CONFIG_USER_ONLY
     dc->hypervisor = (dc->base.tb->flags & TB_FLAG_HYPER) != 0;
 #endif
+#else
+    if (dc->base.tb->flags & TB_FLAG_CWP_VALID) {
+        dc->cwp = (dc->base.tb->flags >> TB_FLAG_CWP_SHIFT) &
+                  (SPARC_DIRECT_NWINDOWS - 1);
+    } else {
+        dc->cwp = -1;
+    }
 #endif
     /*
      * if we reach a page boundary, we stop generation so that the
@@ -5095,6 +5162,17 @@ void sparc_tcg_init(void)
                                          gregnames[i]);
     }
 
+#ifndef TARGET_SPARC64
+    for (i = 0; i < ARRAY_SIZE(cpu_regbase); ++i) {
+        char *name = g_strdup_printf("w%d_%s", i / 16, gregnames[8 + i % 16]);
+
+        cpu_regbase[i] = tcg_global_mem_new(tcg_env,
+                                            offsetof(CPUSPARCState,
+                                                     regbase[i]),
+                                            name);
+    }
+#endif
+
     for (i = 0; i < TARGET_DPREGS; i++) {
         cpu_fpr[i] = tcg_global_mem_new_i64(tcg_env,
                                             offsetof(CPUSPARCState, fpr[i]),
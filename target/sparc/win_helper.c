@@ -22,6 +22,7 @@
 #include "cpu.h"
 #include "exec/exec-all.h"
 #include "exec/helper-proto.h"
+#include "exec/cpu_ldst.h"
 #include "trace.h"
 
 static inline void memcpy32(target_ulong *dst, const target_ulong *src)
@@ -149,14 +150,115 @@ void helper_rett(CPUSPARCState *env)
     env->psrs = env->psrps;
 }
 
-/* XXX: use another pointer for %iN registers to avoid slow wrapping
-   handling ? */
+/*
+ * Register @reg of window @cwp, numbered like in regwptr (%o0 is 0, %l0
+ * is 8, %i0 is 16), wherever it currently lives in regbase.
+ */
+static target_ulong *win_reg(CPUSPARCState *env, int cwp, int reg)
+{
+    int wrap = env->nwindows * 16;
+    int slot = cwp * 16 + reg;
+
+    if (slot >= wrap) {
+        slot -= wrap;
+    }
+    /* The %i registers of the last window are copied there while in use */
+    if (slot < 8 && env->cwp == env->nwindows - 1) {
+        slot += wrap;
+    }
+    return &env->regbase[slot];
+}
+
+/* Check that the 64-byte save area at @addr can be accessed without a trap */
+static bool win_probe(CPUSPARCState *env, target_ulong addr,
+                      MMUAccessType access_type, int mmu_idx, uintptr_t ra)
+{
+    target_ulong last = addr + 16 * sizeof(uint32_t) - 1;
+    void *host;
+
+    if (addr & 7) {
+        return false;
+    }
+    if (probe_access_flags(env, addr, 0, access_type, mmu_idx, true,
+                           &host, ra) & TLB_INVALID_MASK) {
+        return false;
+    }
+    if ((addr ^ last) & TARGET_PAGE_MASK &&
+        probe_access_flags(env, last, 0, access_type, mmu_idx, true,
+                           &host, ra) & TLB_INVALID_MASK) {
+        return false;
+    }
+    return true;
+}
+
+static int win_mmu_idx(void)
+{
+#ifdef CONFIG_USER_ONLY
+    return MMU_USER_IDX;
+#else
+    /* The trap handler would run in supervisor mode */
+    return MMU_KERNEL_IDX;
+#endif
+}
+
+/*
+ * With the fast-window-traps feature, do what the standard window overflow
+ * and underflow handlers of the SPARC V8 manual (and BCC, RTEMS and Linux)
+ * do instead of trapping: spill or fill the window next to the invalid
+ * one to/from its stack frame and rotate WIM by one.  Fall back to the
+ * trap if the handler itself would trap, or if traps are disabled.
+ */
+static bool win_fast_overflow(CPUSPARCState *env, uintptr_t ra)
+{
+    int mmu_idx = win_mmu_idx();
+    int cwp = cpu_cwp_dec(env, env->cwp - 2);
+    uint32_t mask = MAKE_64BIT_MASK(0, env->nwindows);
+    target_ulong sp = *win_reg(env, cwp, 6);
+    int i;
+
+    if (!(env->def.features & CPU_FEATURE_FAST_WIN_TRAPS) || !env->psret ||
+        !win_probe(env, sp, MMU_DATA_STORE, mmu_idx, ra)) {
+        return false;
+    }
+
+    /* %l0-%l7 and %i0-%i7 of the window after the invalid one */
+    for (i = 0; i < 16; i++) {
+        cpu_stl_mmuidx_ra(env, sp + i * 4, *win_reg(env, cwp, 8 + i),
+                          mmu_idx, ra);
+    }
+    env->wim = ((env->wim >> 1) | (env->wim << (env->nwindows - 1))) & mask;
+    trace_win_helper_fast_overflow(env->cwp, sp, env->wim);
+    return true;
+}
+
+static bool win_fast_underflow(CPUSPARCState *env, uintptr_t ra)
+{
+    int mmu_idx = win_mmu_idx();
+    int cwp = cpu_cwp_inc(env, env->cwp + 1);
+    uint32_t mask = MAKE_64BIT_MASK(0, env->nwindows);
+    target_ulong sp = *win_reg(env, cwp, 6);
+    int i;
+
+    if (!(env->def.features & CPU_FEATURE_FAST_WIN_TRAPS) || !env->psret ||
+        !win_probe(env, sp, MMU_DATA_LOAD, mmu_idx, ra)) {
+        return false;
+    }
+
+    for (i = 0; i < 16; i++) {
+        *win_reg(env, cwp, 8 + i) = cpu_ldl_mmuidx_ra(env, sp + i * 4,
+                                                      mmu_idx, ra);
+    }
+    env->wim = ((env->wim << 1) | (env->wim >> (env->nwindows - 1))) & mask;
+    trace_win_helper_fast_underflow(env->cwp, sp, env->wim);
+    return true;
+}
+
 void helper_save(CPUSPARCState *env)
 {
     uint32_t cwp;
 
     cwp = cpu_cwp_dec(env, env->cwp - 1);
-    if (env->wim & (1 << cwp)) {
+    if (env->wim & (1 << cwp) && !win_fast_overflow(env, GETPC())) {
         cpu_raise_exception_ra(env, TT_WIN_OVF, GETPC());
     }
     cpu_set_cwp(env, cwp);
@@ -167,7 +269,7 @@ void helper_restore(CPUSPARCState *env)
     uint32_t cwp;
 
     cwp = cpu_cwp_inc(env, env->cwp + 1);
-    if (env->wim & (1 << cwp)) {
+    if (env->wim & (1 << cwp) && !win_fast_underflow(env, GETPC())) {
         cpu_raise_exception_ra(env, TT_WIN_UNF, GETPC());
     }
     cpu_set_cwp(env, cwp);
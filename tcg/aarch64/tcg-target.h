@@ -60,6 +60,7 @@ typedef enum {
 
 #define have_lse    (cpuinfo & CPUINFO_LSE)
 #define have_lse2   (cpuinfo & CPUINFO_LSE2)
+#define have_sve256 (cpuinfo & CPUINFO_SVE256)
 
 /* optional instructions */
 #define TCG_TARGET_HAS_div_i32          1
@@ -142,7 +143,7 @@ typedef enum {
 
 #define TCG_TARGET_HAS_v64              1
 #define TCG_TARGET_HAS_v128             1
-#define TCG_TARGET_HAS_v256             0
+#define TCG_TARGET_HAS_v256             have_sve256
 
 #define TCG_TARGET_HAS_andc_vec         1
 #define TCG_TARGET_HAS_orc_vec          1
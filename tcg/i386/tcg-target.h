@@ -247,6 +247,8 @@ typedef enum {
 
 #define TCG_TARGET_DEFAULT_MO (TCG_MO_ALL & ~TCG_MO_ST_LD)
 #define TCG_TARGET_NEED_LDST_LABELS
+/* The branches to the slow paths are rel32, so they can go anywhere */
+#define TCG_TARGET_COLD_LDST_LABELS
 #define TCG_TARGET_NEED_POOL_LABELS
 
 #endif
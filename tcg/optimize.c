@@ -1513,7 +1513,11 @@ static bool fold_call(OptContext *ctx, TCGOp *op)
     init_arguments(ctx, op, nb_oargs + nb_iargs);
     copy_propagate(ctx, op, nb_oargs, nb_iargs);
 
-    /* If the function reads or writes globals, reset temp data. */
+    /*
+     * If the function may write globals, reset temp data.  Knowledge
+     * about globals is kept across helpers that only read them, since
+     * they are synced to memory before the call.
+     */
     flags = tcg_call_flags(op);
     if (!(flags & (TCG_CALL_NO_READ_GLOBALS | TCG_CALL_NO_WRITE_GLOBALS))) {
         int nb_globals = s->nb_globals;
@@ -1535,8 +1539,14 @@ static bool fold_call(OptContext *ctx, TCGOp *op)
         reset_temp(ctx, op->args[i]);
     }
 
-    /* Stop optimizing MB across calls. */
-    ctx->prev_mb = NULL;
+    /*
+     * Stop optimizing MB across calls, unless the helper can neither
+     * touch guest state nor raise an exception: merging a barrier into
+     * an earlier one across such a call cannot be observed.
+     */
+    if ((flags & TCG_CALL_NO_RWG_SE) != TCG_CALL_NO_RWG_SE) {
+        ctx->prev_mb = NULL;
+    }
     return true;
 }
 
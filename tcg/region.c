@@ -31,6 +31,7 @@
 #include "qemu/qtree.h"
 #include "qapi/error.h"
 #include "tcg/tcg.h"
+#include "tcg/startup.h"
 #include "exec/translation-block.h"
 #include "tcg-internal.h"
 #include "host/cpuinfo.h"
@@ -72,10 +73,28 @@ struct tcg_region_state {
     /* fields protected by the lock */
     size_t current; /* current region index */
     size_t agg_size_full; /* aggregate size of full regions */
+    /* full regions not owned by any context, oldest first */
+    size_t *full;
+    size_t full_head;
+    size_t n_full;
+    /* evicted regions, available for allocation */
+    size_t *free;
+    size_t n_free;
 };
 
 static struct tcg_region_state region;
 
+/* Set by tcg_region_set_layout before tcg_region_init */
+static bool region_hugepages;
+static size_t region_size_request;
+static bool region_cold_code;
+
+/* The huge page size that we align the buffer and the regions to */
+#define TCG_HUGEPAGE_SIZE  (2 * MiB)
+
+/* With region_cold_code, the share of each region kept for the slow paths */
+#define TCG_COLD_CODE_DIV  4
+
 /*
  * This is an array of struct tcg_region_tree's, with padding.
  * We use void * to simplify the computation of region_trees[i]; each
@@ -351,19 +370,39 @@ static void tcg_region_assign(TCGContext *s, size_t curr_region)
 
     tcg_region_bounds(curr_region, &start, &end);
 
+    if (region_cold_code) {
+        void *cold = end - ROUND_UP((end - start) / TCG_COLD_CODE_DIV,
+                                    qemu_icache_linesize);
+
+        s->code_gen_cold_ptr = cold;
+        s->code_gen_cold_highwater = end - TCG_HIGHWATER;
+        end = cold;
+    }
+
     s->code_gen_buffer = start;
     s->code_gen_ptr = start;
     s->code_gen_buffer_size = end - start;
     s->code_gen_highwater = end - TCG_HIGHWATER;
 }
 
+static size_t tcg_region_index(const void *p)
+{
+    return p < region.start_aligned ? 0 :
+           (p - region.start_aligned) / region.stride;
+}
+
 static bool tcg_region_alloc__locked(TCGContext *s)
 {
-    if (region.current == region.n) {
+    size_t curr_region;
+
+    if (region.current < region.n) {
+        curr_region = region.current++;
+    } else if (region.n_free) {
+        curr_region = region.free[--region.n_free];
+    } else {
         return true;
     }
-    tcg_region_assign(s, region.current);
-    region.current++;
+    tcg_region_assign(s, curr_region);
     return false;
 }
 
@@ -376,11 +415,14 @@ bool tcg_region_alloc(TCGContext *s)
     bool err;
     /* read the region size now; alloc__locked will overwrite it on success */
     size_t size_full = s->code_gen_buffer_size;
+    size_t full_region = tcg_region_index(s->code_gen_buffer);
 
     qemu_mutex_lock(&region.lock);
     err = tcg_region_alloc__locked(s);
     if (!err) {
         region.agg_size_full += size_full - TCG_HIGHWATER;
+        region.full[(region.full_head + region.n_full++) % region.n] =
+            full_region;
     }
     qemu_mutex_unlock(&region.lock);
     return err;
@@ -412,6 +454,9 @@ void tcg_region_reset_all(void)
     qemu_mutex_lock(&region.lock);
     region.current = 0;
     region.agg_size_full = 0;
+    region.full_head = 0;
+    region.n_full = 0;
+    region.n_free = 0;
 
     for (i = 0; i < n_ctxs; i++) {
         TCGContext *s = qatomic_read(&tcg_ctxs[i]);
@@ -422,6 +467,76 @@ void tcg_region_reset_all(void)
     tcg_region_tree_reset_all();
 }
 
+static gboolean tcg_region_collect_tb(gpointer key, gpointer value,
+                                      gpointer data)
+{
+    g_ptr_array_add(data, value);
+    return false;
+}
+
+/*
+ * Evict the region that filled up first among those not owned by any
+ * context, so that tcg_region_alloc() can hand it out again.  @func is
+ * called on each TB of the region before it is recycled, and must unlink
+ * it from everything that may still reach its code.
+ *
+ * Call from a safe-work context.  Returns false if there was no region
+ * to evict, in which case the whole buffer must be flushed.
+ */
+bool tcg_region_evict(void (*func)(TranslationBlock *tb))
+{
+    struct tcg_region_tree *rt;
+    GPtrArray *tbs;
+    void *start, *end;
+    size_t idx;
+    guint i;
+
+    qemu_mutex_lock(&region.lock);
+    if (region.n_full == 0) {
+        qemu_mutex_unlock(&region.lock);
+        return false;
+    }
+    idx = region.full[region.full_head];
+    region.full_head = (region.full_head + 1) % region.n;
+    region.n_full--;
+    qemu_mutex_unlock(&region.lock);
+
+    /* @func may need the page locks, which nest outside the tree lock */
+    rt = region_trees + idx * tree_size;
+    tbs = g_ptr_array_new();
+    qemu_mutex_lock(&rt->lock);
+    q_tree_foreach(rt->tree, tcg_region_collect_tb, tbs);
+    qemu_mutex_unlock(&rt->lock);
+
+    for (i = 0; i < tbs->len; i++) {
+        func(g_ptr_array_index(tbs, i));
+    }
+    g_ptr_array_free(tbs, true);
+
+    qemu_mutex_lock(&rt->lock);
+    /* Increment the refcount first so that destroy acts as a reset */
+    q_tree_ref(rt->tree);
+    q_tree_destroy(rt->tree);
+    qemu_mutex_unlock(&rt->lock);
+
+    tcg_region_bounds(idx, &start, &end);
+    qemu_mutex_lock(&region.lock);
+    region.agg_size_full -= end - start - TCG_HIGHWATER;
+    region.free[region.n_free++] = idx;
+    qemu_mutex_unlock(&region.lock);
+    return true;
+}
+
+void tcg_region_set_layout(bool hugepages, size_t region_size,
+                           bool cold_code)
+{
+    region_hugepages = hugepages;
+    region_size_request = region_size;
+#ifdef TCG_TARGET_COLD_LDST_LABELS
+    region_cold_code = cold_code;
+#endif
+}
+
 static size_t tcg_n_regions(size_t tb_size, unsigned max_cpus)
 {
 #ifdef CONFIG_USER_ONLY
@@ -437,6 +552,15 @@ static size_t tcg_n_regions(size_t tb_size, unsigned max_cpus)
      */
     /* Use a single region if all we have is one vCPU thread */
     if (max_cpus == 1 || !qemu_tcg_mttcg_enabled()) {
+        max_cpus = 1;
+    }
+
+    /* An explicit region size, but still at least one region per vCPU */
+    if (region_size_request) {
+        n_regions = MAX(tb_size / region_size_request, 1);
+        return MAX(n_regions, max_cpus);
+    }
+    if (max_cpus == 1) {
         return 1;
     }
 
@@ -551,12 +675,44 @@ static int alloc_code_gen_buffer(size_t size, int splitwx, Error **errp)
     return PROT_READ | PROT_WRITE | PROT_EXEC;
 }
 #else
+/*
+ * With hugepages, map the buffer at an address aligned to a huge page,
+ * so that all of it can use huge pages and not just the aligned middle.
+ */
+static void *code_gen_mmap(size_t size, int prot, int flags, int fd)
+{
+    size_t full = size + TCG_HUGEPAGE_SIZE;
+    void *resv, *buf;
+    int err;
+
+    if (!region_hugepages) {
+        return mmap(NULL, size, prot, flags, fd, 0);
+    }
+
+    resv = mmap(NULL, full, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (resv == MAP_FAILED) {
+        return MAP_FAILED;
+    }
+    buf = QEMU_ALIGN_PTR_UP(resv, TCG_HUGEPAGE_SIZE);
+    if (mmap(buf, size, prot, flags | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        err = errno;
+        munmap(resv, full);
+        errno = err;
+        return MAP_FAILED;
+    }
+    if (buf != resv) {
+        munmap(resv, buf - resv);
+    }
+    munmap(buf + size, resv + full - (buf + size));
+    return buf;
+}
+
 static int alloc_code_gen_buffer_anon(size_t size, int prot,
                                       int flags, Error **errp)
 {
     void *buf;
 
-    buf = mmap(NULL, size, prot, flags, -1, 0);
+    buf = code_gen_mmap(size, prot, flags, -1);
     if (buf == MAP_FAILED) {
         error_setg_errno(errp, errno,
                          "allocate %zu bytes for jit buffer", size);
@@ -577,12 +733,32 @@ static int alloc_code_gen_buffer_splitwx_memfd(size_t size, Error **errp)
     void *buf_rw = NULL, *buf_rx = MAP_FAILED;
     int fd = -1;
 
-    buf_rw = qemu_memfd_alloc("tcg-jit", size, 0, &fd, errp);
+    if (region_hugepages) {
+        /*
+         * Use hugetlbfs pages if any are reserved.  Otherwise fall back
+         * to a normal memfd, which can still get transparent huge pages
+         * through the madvise in tcg_region_init.
+         */
+        fd = qemu_memfd_create("tcg-jit", size, true, TCG_HUGEPAGE_SIZE,
+                               0, NULL);
+        if (fd >= 0) {
+            buf_rw = code_gen_mmap(size, PROT_READ | PROT_WRITE,
+                                   MAP_SHARED, fd);
+            if (buf_rw == MAP_FAILED) {
+                buf_rw = NULL;
+                close(fd);
+                fd = -1;
+            }
+        }
+    }
     if (buf_rw == NULL) {
-        goto fail;
+        buf_rw = qemu_memfd_alloc("tcg-jit", size, 0, &fd, errp);
+        if (buf_rw == NULL) {
+            goto fail;
+        }
     }
 
-    buf_rx = mmap(NULL, size, host_prot_read_exec(), MAP_SHARED, fd, 0);
+    buf_rx = code_gen_mmap(size, host_prot_read_exec(), MAP_SHARED, fd);
     if (buf_rx == MAP_FAILED) {
         error_setg_errno(errp, errno,
                          "failed to map shared memory for execute");
@@ -768,6 +944,9 @@ void tcg_region_init(size_t tb_size, int splitwx, unsigned max_cpus)
     if (tb_size < MIN_CODE_GEN_BUFFER_SIZE) {
         tb_size = MIN_CODE_GEN_BUFFER_SIZE;
     }
+    if (region_hugepages) {
+        tb_size = QEMU_ALIGN_UP(tb_size, TCG_HUGEPAGE_SIZE);
+    }
     if (tb_size > MAX_CODE_GEN_BUFFER_SIZE) {
         tb_size = MAX_CODE_GEN_BUFFER_SIZE;
     }
@@ -789,7 +968,12 @@ void tcg_region_init(size_t tb_size, int splitwx, unsigned max_cpus)
      */
     region.n = tcg_n_regions(tb_size, max_cpus);
     region_size = tb_size / region.n;
-    region_size = QEMU_ALIGN_DOWN(region_size, page_size);
+    if (region_hugepages && region_size >= TCG_HUGEPAGE_SIZE) {
+        /* Do not let a huge page straddle two regions */
+        region_size = QEMU_ALIGN_DOWN(region_size, TCG_HUGEPAGE_SIZE);
+    } else {
+        region_size = QEMU_ALIGN_DOWN(region_size, page_size);
+    }
 
     /* A region must have at least 2 pages; one code, one guard */
     g_assert(region_size >= 2 * page_size);
@@ -844,13 +1028,18 @@ void tcg_region_init(size_t tb_size, int splitwx, unsigned max_cpus)
                                  "mprotect of jit buffer");
             }
         }
-        if (have_prot != 0) {
-            /* Guard pages are nice for bug detection but are not essential. */
+        /*
+         * Guard pages are nice for bug detection but are not essential.
+         * With hugepages, they would split a huge page in every region.
+         */
+        if (have_prot != 0 && !region_hugepages) {
             (void)qemu_mprotect_none(end, page_size);
         }
     }
 
     tcg_region_trees_init();
+    region.full = g_new(size_t, region.n);
+    region.free = g_new(size_t, region.n);
 
     /*
      * Leave the initial context initialized to the first region.
@@ -902,6 +1091,46 @@ size_t tcg_code_size(void)
     return total;
 }
 
+/*
+ * Fill @fill with the number of bytes of code in each region, up to @max
+ * regions, and return the total number of regions.  Regions that have been
+ * handed out and are no longer in use by any TCG context are reported as
+ * full, as in tcg_code_size().
+ */
+size_t tcg_region_fill(uint64_t *fill, size_t max)
+{
+    unsigned int n_ctxs = qatomic_read(&tcg_cur_ctxs);
+    unsigned int i;
+    size_t n;
+
+    qemu_mutex_lock(&region.lock);
+    n = MIN(region.n, max);
+    for (i = 0; i < n; i++) {
+        fill[i] = 0;
+    }
+    for (i = 0; i < region.n_full; i++) {
+        size_t idx = region.full[(region.full_head + i) % region.n];
+        void *start, *end;
+
+        if (idx < n) {
+            tcg_region_bounds(idx, &start, &end);
+            fill[idx] = end - start - TCG_HIGHWATER;
+        }
+    }
+    for (i = 0; i < n_ctxs; i++) {
+        const TCGContext *s = qatomic_read(&tcg_ctxs[i]);
+        size_t idx;
+
+        idx = tcg_region_index(s->code_gen_buffer);
+        if (idx < n) {
+            fill[idx] = qatomic_read(&s->code_gen_ptr) - s->code_gen_buffer;
+        }
+    }
+    n = region.n;
+    qemu_mutex_unlock(&region.lock);
+    return n;
+}
+
 /*
  * Returns the code capacity (in bytes) of the entire cache, i.e. including all
  * regions.
@@ -1522,6 +1522,7 @@ void tcg_func_start(TCGContext *s)
     QTAILQ_INIT(&s->ops);
     QTAILQ_INIT(&s->free_ops);
     QSIMPLEQ_INIT(&s->labels);
+    s->emit_before_op = NULL;
 
     tcg_debug_assert(s->addr_type == TCG_TYPE_I32 ||
                      s->addr_type == TCG_TYPE_I64);
@@ -2249,6 +2250,7 @@ bool tcg_op_supported(TCGOpcode op)
 }
 
 static TCGOp *tcg_op_alloc(TCGOpcode opc, unsigned nargs);
+static void tcg_emit_op_insert(TCGOp *op);
 
 static void tcg_gen_callN(TCGHelperInfo *info, TCGTemp *ret, TCGTemp **args)
 {
@@ -2332,7 +2334,7 @@ static void tcg_gen_callN(TCGHelperInfo *info, TCGTemp *ret, TCGTemp **args)
     op->args[pi++] = (uintptr_t)info;
     tcg_debug_assert(pi == total_args);
 
-    QTAILQ_INSERT_TAIL(&tcg_ctx->ops, op, link);
+    tcg_emit_op_insert(op);
 
     tcg_debug_assert(n_extend < ARRAY_SIZE(extend_free));
     for (i = 0; i < n_extend; ++i) {
@@ -3212,10 +3214,19 @@ static TCGOp *tcg_op_alloc(TCGOpcode opc, unsigned nargs)
     return op;
 }
 
+static void tcg_emit_op_insert(TCGOp *op)
+{
+    if (tcg_ctx->emit_before_op) {
+        QTAILQ_INSERT_BEFORE(tcg_ctx->emit_before_op, op, link);
+    } else {
+        QTAILQ_INSERT_TAIL(&tcg_ctx->ops, op, link);
+    }
+}
+
 TCGOp *tcg_emit_op(TCGOpcode opc, unsigned nargs)
 {
     TCGOp *op = tcg_op_alloc(opc, nargs);
-    QTAILQ_INSERT_TAIL(&tcg_ctx->ops, op, link);
+    tcg_emit_op_insert(op);
     return op;
 }
 
@@ -4542,6 +4553,76 @@ static void tcg_reg_alloc_cbranch(TCGContext *s, TCGRegSet allocated_regs)
     }
 }
 
+/*
+ * Record the globals that stay in a host register, coherent with memory,
+ * on the edge from the branch @op to its label.  Only the registers that
+ * agree on all the incoming edges are kept.
+ */
+static void tcg_reg_alloc_branch_edge(TCGContext *s, const TCGOp *op)
+{
+    const TCGOpDef *def = &tcg_op_defs[op->opc];
+    TCGLabel *l = arg_label(op->args[def->nb_oargs + def->nb_iargs +
+                                     def->nb_cargs - 1]);
+    TCGTemp **regs = l->entry_regs;
+    int i;
+
+    if (l->has_value) {
+        /* Backward branch: the label has been emitted already. */
+        return;
+    }
+    if (regs == NULL) {
+        regs = tcg_malloc(sizeof(TCGTemp *) * TCG_TARGET_NB_REGS);
+        l->entry_regs = regs;
+        for (i = 0; i < TCG_TARGET_NB_REGS; i++) {
+            TCGTemp *ts = s->reg_to_temp[i];
+
+            regs[i] = ts && ts->kind == TEMP_GLOBAL && ts->mem_coherent
+                      ? ts : NULL;
+        }
+    } else {
+        for (i = 0; i < TCG_TARGET_NB_REGS; i++) {
+            if (regs[i] && s->reg_to_temp[i] != regs[i]) {
+                regs[i] = NULL;
+            }
+        }
+    }
+    l->nb_edges++;
+}
+
+/*
+ * At a label that can only be reached through forward branches, the
+ * globals that all of them left in the same host register are still
+ * there, so there is no need to load them again from memory.
+ */
+static void tcg_reg_alloc_label(TCGContext *s, const TCGOp *op)
+{
+    TCGLabel *l = arg_label(op->args[0]);
+    const TCGOp *prev = QTAILQ_PREV(op, link);
+    TCGLabelUse *u;
+    int i, n = 0;
+
+    if (l->entry_regs == NULL ||
+        (prev->opc != INDEX_op_br &&
+         !(tcg_op_defs[prev->opc].flags & TCG_OPF_BB_EXIT))) {
+        return;
+    }
+    QSIMPLEQ_FOREACH(u, &l->branches, next) {
+        n++;
+    }
+    if (n != l->nb_edges) {
+        return;
+    }
+
+    for (i = 0; i < TCG_TARGET_NB_REGS; i++) {
+        TCGTemp *ts = l->entry_regs[i];
+
+        if (ts && ts->val_type == TEMP_VAL_MEM && !s->reg_to_temp[i]) {
+            set_temp_val_reg(s, ts, i);
+            ts->mem_coherent = 1;
+        }
+    }
+}
+
 /*
  * Specialized code generation for INDEX_op_mov_* with a constant.
  */
@@ -5033,8 +5114,12 @@ static void tcg_reg_alloc_op(TCGContext *s, const TCGOp *op)
 
     if (def->flags & TCG_OPF_COND_BRANCH) {
         tcg_reg_alloc_cbranch(s, i_allocated_regs);
+        tcg_reg_alloc_branch_edge(s, op);
     } else if (def->flags & TCG_OPF_BB_END) {
         tcg_reg_alloc_bb_end(s, i_allocated_regs);
+        if (op->opc == INDEX_op_br) {
+            tcg_reg_alloc_branch_edge(s, op);
+        }
     } else {
         if (def->flags & TCG_OPF_CALL_CLOBBER) {
             /* XXX: permit generic clobber register list ? */
@@ -6095,7 +6180,10 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb, uint64_t pc_start)
     }
 #endif
 
-    tcg_optimize(s);
+    /* Blocks that are still warming up are translated as fast as possible. */
+    if (!tb->warmup) {
+        tcg_optimize(s);
+    }
 
     reachable_code_pass(s);
     liveness_pass_0(s);
@@ -6191,6 +6279,7 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb, uint64_t pc_start)
             break;
         case INDEX_op_set_label:
             tcg_reg_alloc_bb_end(s, s->reserved_regs);
+            tcg_reg_alloc_label(s, op);
             tcg_out_label(s, arg_label(op->args[0]));
             break;
         case INDEX_op_call:
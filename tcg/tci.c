@@ -350,6 +350,30 @@ static void tci_qemu_st(CPUArchState *env, uint64_t taddr, uint64_t val,
 # define CASE_64(x)
 #endif
 
+/*
+ * Threaded dispatch: with computed gotos, the hot opcodes jump straight
+ * from a table to their handler instead of going through the switch.
+ * The compiler duplicates the indirect jump at the top of the loop into
+ * the end of each handler, so the host branch predictor sees one jump
+ * site per opcode rather than a single shared one.  Opcodes without a
+ * label in the table still go through the switch.
+ */
+#ifdef __GNUC__
+# define TCI_THREADED
+#endif
+
+#ifdef TCI_THREADED
+# define TCI_LABEL(x)  glue(tci_op_, x):
+# define TCI_OP(op, x) [glue(INDEX_op_, op)] = &&glue(tci_op_, x)
+# if TCG_TARGET_REG_BITS == 64
+#  define TCI_OP_32_64(x) TCI_OP(glue(x, _i32), x), TCI_OP(glue(x, _i64), x)
+# else
+#  define TCI_OP_32_64(x) TCI_OP(glue(x, _i32), x)
+# endif
+#else
+# define TCI_LABEL(x)
+#endif
+
 /* Interpret pseudo code in tb. */
 /*
  * Disable CFI checks.
@@ -364,6 +388,67 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
     uint64_t stack[(TCG_STATIC_CALL_ARGS_SIZE + TCG_STATIC_FRAME_SIZE)
                    / sizeof(uint64_t)];
 
+#ifdef TCI_THREADED
+    static const void * const dispatch[NB_OPS] = {
+        [0 ... NB_OPS - 1] = &&tci_switch,
+        TCI_OP(call, call),
+        TCI_OP(br, br),
+        TCI_OP(setcond_i32, setcond_i32),
+        TCI_OP_32_64(mov),
+        TCI_OP(tci_movi, movi),
+        TCI_OP(tci_movl, movl),
+        TCI_OP(tci_brcond_i32, tci_brcond_i32),
+        TCI_OP(tci_ld32_add, tci_ld32_add),
+        TCI_OP(tci_ld32_st32, tci_ld32_st32),
+        TCI_OP_32_64(ld8u),
+        TCI_OP_32_64(ld8s),
+        TCI_OP_32_64(ld16u),
+        TCI_OP_32_64(ld16s),
+        TCI_OP(ld_i32, ld32),
+        TCI_OP_32_64(st8),
+        TCI_OP_32_64(st16),
+        TCI_OP(st_i32, st32),
+        TCI_OP_32_64(add),
+        TCI_OP_32_64(sub),
+        TCI_OP_32_64(and),
+        TCI_OP_32_64(or),
+        TCI_OP_32_64(xor),
+        TCI_OP(shl_i32, shl_i32),
+        TCI_OP(shr_i32, shr_i32),
+        TCI_OP(sar_i32, sar_i32),
+        TCI_OP(brcond_i32, brcond_i32),
+#if TCG_TARGET_REG_BITS == 64
+        TCI_OP(setcond_i64, setcond_i64),
+        TCI_OP(tci_brcond_i64, tci_brcond_i64),
+        TCI_OP(tci_ld64_add, tci_ld64_add),
+        TCI_OP(tci_ld64_st64, tci_ld64_st64),
+        TCI_OP(ld32u_i64, ld32),
+        TCI_OP(ld_i64, ld_i64),
+        TCI_OP(st32_i64, st32),
+        TCI_OP(st_i64, st_i64),
+        TCI_OP(shl_i64, shl_i64),
+        TCI_OP(shr_i64, shr_i64),
+        TCI_OP(sar_i64, sar_i64),
+        TCI_OP(brcond_i64, brcond_i64),
+        TCI_OP(ext32s_i64, ext32s),
+        TCI_OP(ext_i32_i64, ext32s),
+        TCI_OP(ext32u_i64, ext32u),
+        TCI_OP(extu_i32_i64, ext32u),
+#endif
+        TCI_OP(exit_tb, exit_tb),
+        TCI_OP(goto_tb, goto_tb),
+        TCI_OP(goto_ptr, goto_ptr),
+        TCI_OP(qemu_ld_a32_i32, qemu_ld_a32_i32),
+        TCI_OP(qemu_ld_a64_i32, qemu_ld_a64_i32),
+        TCI_OP(qemu_ld_a32_i64, qemu_ld_a32_i64),
+        TCI_OP(qemu_ld_a64_i64, qemu_ld_a64_i64),
+        TCI_OP(qemu_st_a32_i32, qemu_st_a32_i32),
+        TCI_OP(qemu_st_a64_i32, qemu_st_a64_i32),
+        TCI_OP(qemu_st_a32_i64, qemu_st_a32_i64),
+        TCI_OP(qemu_st_a64_i64, qemu_st_a64_i64),
+    };
+#endif
+
     regs[TCG_AREG0] = (tcg_target_ulong)env;
     regs[TCG_REG_CALL_STACK] = (uintptr_t)stack;
     tci_assert(tb_ptr);
@@ -385,8 +470,13 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
         insn = *tb_ptr++;
         opc = extract32(insn, 0, 8);
 
+#ifdef TCI_THREADED
+        goto *dispatch[opc];
+    tci_switch:
+#endif
         switch (opc) {
         case INDEX_op_call:
+        TCI_LABEL(call)
             {
                 void *call_slots[MAX_CALL_IARGS];
                 ffi_cif *cif;
@@ -440,10 +530,12 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             break;
 
         case INDEX_op_br:
+        TCI_LABEL(br)
             tci_args_l(insn, tb_ptr, &ptr);
             tb_ptr = ptr;
             continue;
         case INDEX_op_setcond_i32:
+        TCI_LABEL(setcond_i32)
             tci_args_rrrc(insn, &r0, &r1, &r2, &condition);
             regs[r0] = tci_compare32(regs[r1], regs[r2], condition);
             break;
@@ -461,6 +553,7 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             break;
 #elif TCG_TARGET_REG_BITS == 64
         case INDEX_op_setcond_i64:
+        TCI_LABEL(setcond_i64)
             tci_args_rrrc(insn, &r0, &r1, &r2, &condition);
             regs[r0] = tci_compare64(regs[r1], regs[r2], condition);
             break;
@@ -471,58 +564,130 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             break;
 #endif
         CASE_32_64(mov)
+        TCI_LABEL(mov)
             tci_args_rr(insn, &r0, &r1);
             regs[r0] = regs[r1];
             break;
         case INDEX_op_tci_movi:
+        TCI_LABEL(movi)
             tci_args_ri(insn, &r0, &t1);
             regs[r0] = t1;
             break;
         case INDEX_op_tci_movl:
+        TCI_LABEL(movl)
             tci_args_rl(insn, tb_ptr, &r0, &ptr);
             regs[r0] = *(tcg_target_ulong *)ptr;
             break;
 
+            /* Superinstructions: the second insn follows unchanged. */
+
+        case INDEX_op_tci_brcond_i32:
+        TCI_LABEL(tci_brcond_i32)
+            tci_args_rrrc(insn, &r0, &r1, &r2, &condition);
+            regs[r0] = tci_compare32(regs[r1], regs[r2], condition);
+            goto do_brcond;
+#if TCG_TARGET_REG_BITS == 64
+        case INDEX_op_tci_brcond_i64:
+        TCI_LABEL(tci_brcond_i64)
+            tci_args_rrrc(insn, &r0, &r1, &r2, &condition);
+            regs[r0] = tci_compare64(regs[r1], regs[r2], condition);
+#endif
+        do_brcond:
+            insn = *tb_ptr++;
+            tci_args_rl(insn, tb_ptr, &r0, &ptr);
+            if (regs[r0]) {
+                tb_ptr = ptr;
+            }
+            break;
+        case INDEX_op_tci_ld32_add:
+        TCI_LABEL(tci_ld32_add)
+            tci_args_rrs(insn, &r0, &r1, &ofs);
+            ptr = (void *)(regs[r1] + ofs);
+            regs[r0] = *(uint32_t *)ptr;
+            goto do_add;
+#if TCG_TARGET_REG_BITS == 64
+        case INDEX_op_tci_ld64_add:
+        TCI_LABEL(tci_ld64_add)
+            tci_args_rrs(insn, &r0, &r1, &ofs);
+            ptr = (void *)(regs[r1] + ofs);
+            regs[r0] = *(uint64_t *)ptr;
+#endif
+        do_add:
+            insn = *tb_ptr++;
+            tci_args_rrr(insn, &r0, &r1, &r2);
+            regs[r0] = regs[r1] + regs[r2];
+            break;
+        case INDEX_op_tci_ld32_st32:
+        TCI_LABEL(tci_ld32_st32)
+            tci_args_rrs(insn, &r0, &r1, &ofs);
+            ptr = (void *)(regs[r1] + ofs);
+            regs[r0] = *(uint32_t *)ptr;
+            insn = *tb_ptr++;
+            tci_args_rrs(insn, &r0, &r1, &ofs);
+            ptr = (void *)(regs[r1] + ofs);
+            *(uint32_t *)ptr = regs[r0];
+            break;
+#if TCG_TARGET_REG_BITS == 64
+        case INDEX_op_tci_ld64_st64:
+        TCI_LABEL(tci_ld64_st64)
+            tci_args_rrs(insn, &r0, &r1, &ofs);
+            ptr = (void *)(regs[r1] + ofs);
+            regs[r0] = *(uint64_t *)ptr;
+            insn = *tb_ptr++;
+            tci_args_rrs(insn, &r0, &r1, &ofs);
+            ptr = (void *)(regs[r1] + ofs);
+            *(uint64_t *)ptr = regs[r0];
+            break;
+#endif
+
             /* Load/store operations (32 bit). */
 
         CASE_32_64(ld8u)
+        TCI_LABEL(ld8u)
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             regs[r0] = *(uint8_t *)ptr;
             break;
         CASE_32_64(ld8s)
+        TCI_LABEL(ld8s)
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             regs[r0] = *(int8_t *)ptr;
             break;
         CASE_32_64(ld16u)
+        TCI_LABEL(ld16u)
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             regs[r0] = *(uint16_t *)ptr;
             break;
         CASE_32_64(ld16s)
+        TCI_LABEL(ld16s)
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             regs[r0] = *(int16_t *)ptr;
             break;
         case INDEX_op_ld_i32:
         CASE_64(ld32u)
+        TCI_LABEL(ld32)
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             regs[r0] = *(uint32_t *)ptr;
             break;
         CASE_32_64(st8)
+        TCI_LABEL(st8)
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             *(uint8_t *)ptr = regs[r0];
             break;
         CASE_32_64(st16)
+        TCI_LABEL(st16)
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             *(uint16_t *)ptr = regs[r0];
             break;
         case INDEX_op_st_i32:
         CASE_64(st32)
+        TCI_LABEL(st32)
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             *(uint32_t *)ptr = regs[r0];
@@ -531,10 +696,12 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             /* Arithmetic operations (mixed 32/64 bit). */
 
         CASE_32_64(add)
+        TCI_LABEL(add)
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] + regs[r2];
             break;
         CASE_32_64(sub)
+        TCI_LABEL(sub)
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] - regs[r2];
             break;
@@ -543,14 +710,17 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             regs[r0] = regs[r1] * regs[r2];
             break;
         CASE_32_64(and)
+        TCI_LABEL(and)
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] & regs[r2];
             break;
         CASE_32_64(or)
+        TCI_LABEL(or)
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] | regs[r2];
             break;
         CASE_32_64(xor)
+        TCI_LABEL(xor)
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] ^ regs[r2];
             break;
@@ -627,14 +797,17 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             /* Shift/rotate operations (32 bit). */
 
         case INDEX_op_shl_i32:
+        TCI_LABEL(shl_i32)
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = (uint32_t)regs[r1] << (regs[r2] & 31);
             break;
         case INDEX_op_shr_i32:
+        TCI_LABEL(shr_i32)
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = (uint32_t)regs[r1] >> (regs[r2] & 31);
             break;
         case INDEX_op_sar_i32:
+        TCI_LABEL(sar_i32)
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = (int32_t)regs[r1] >> (regs[r2] & 31);
             break;
@@ -667,6 +840,7 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             break;
 #endif
         case INDEX_op_brcond_i32:
+        TCI_LABEL(brcond_i32)
             tci_args_rl(insn, tb_ptr, &r0, &ptr);
             if ((uint32_t)regs[r0]) {
                 tb_ptr = ptr;
@@ -758,11 +932,13 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             regs[r0] = *(int32_t *)ptr;
             break;
         case INDEX_op_ld_i64:
+        TCI_LABEL(ld_i64)
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             regs[r0] = *(uint64_t *)ptr;
             break;
         case INDEX_op_st_i64:
+        TCI_LABEL(st_i64)
             tci_args_rrs(insn, &r0, &r1, &ofs);
             ptr = (void *)(regs[r1] + ofs);
             *(uint64_t *)ptr = regs[r0];
@@ -838,14 +1014,17 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             /* Shift/rotate operations (64 bit). */
 
         case INDEX_op_shl_i64:
+        TCI_LABEL(shl_i64)
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] << (regs[r2] & 63);
             break;
         case INDEX_op_shr_i64:
+        TCI_LABEL(shr_i64)
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = regs[r1] >> (regs[r2] & 63);
             break;
         case INDEX_op_sar_i64:
+        TCI_LABEL(sar_i64)
             tci_args_rrr(insn, &r0, &r1, &r2);
             regs[r0] = (int64_t)regs[r1] >> (regs[r2] & 63);
             break;
@@ -878,6 +1057,7 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             break;
 #endif
         case INDEX_op_brcond_i64:
+        TCI_LABEL(brcond_i64)
             tci_args_rl(insn, tb_ptr, &r0, &ptr);
             if (regs[r0]) {
                 tb_ptr = ptr;
@@ -885,11 +1065,13 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             break;
         case INDEX_op_ext32s_i64:
         case INDEX_op_ext_i32_i64:
+        TCI_LABEL(ext32s)
             tci_args_rr(insn, &r0, &r1);
             regs[r0] = (int32_t)regs[r1];
             break;
         case INDEX_op_ext32u_i64:
         case INDEX_op_extu_i32_i64:
+        TCI_LABEL(ext32u)
             tci_args_rr(insn, &r0, &r1);
             regs[r0] = (uint32_t)regs[r1];
             break;
@@ -904,15 +1086,18 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             /* QEMU specific operations. */
 
         case INDEX_op_exit_tb:
+        TCI_LABEL(exit_tb)
             tci_args_l(insn, tb_ptr, &ptr);
             return (uintptr_t)ptr;
 
         case INDEX_op_goto_tb:
+        TCI_LABEL(goto_tb)
             tci_args_l(insn, tb_ptr, &ptr);
             tb_ptr = *(void **)ptr;
             break;
 
         case INDEX_op_goto_ptr:
+        TCI_LABEL(goto_ptr)
             tci_args_r(insn, &r0);
             ptr = (void *)regs[r0];
             if (!ptr) {
@@ -922,10 +1107,12 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             break;
 
         case INDEX_op_qemu_ld_a32_i32:
+        TCI_LABEL(qemu_ld_a32_i32)
             tci_args_rrm(insn, &r0, &r1, &oi);
             taddr = (uint32_t)regs[r1];
             goto do_ld_i32;
         case INDEX_op_qemu_ld_a64_i32:
+        TCI_LABEL(qemu_ld_a64_i32)
             if (TCG_TARGET_REG_BITS == 64) {
                 tci_args_rrm(insn, &r0, &r1, &oi);
                 taddr = regs[r1];
@@ -939,6 +1126,7 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             break;
 
         case INDEX_op_qemu_ld_a32_i64:
+        TCI_LABEL(qemu_ld_a32_i64)
             if (TCG_TARGET_REG_BITS == 64) {
                 tci_args_rrm(insn, &r0, &r1, &oi);
                 taddr = (uint32_t)regs[r1];
@@ -949,6 +1137,7 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             }
             goto do_ld_i64;
         case INDEX_op_qemu_ld_a64_i64:
+        TCI_LABEL(qemu_ld_a64_i64)
             if (TCG_TARGET_REG_BITS == 64) {
                 tci_args_rrm(insn, &r0, &r1, &oi);
                 taddr = regs[r1];
@@ -967,10 +1156,12 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             break;
 
         case INDEX_op_qemu_st_a32_i32:
+        TCI_LABEL(qemu_st_a32_i32)
             tci_args_rrm(insn, &r0, &r1, &oi);
             taddr = (uint32_t)regs[r1];
             goto do_st_i32;
         case INDEX_op_qemu_st_a64_i32:
+        TCI_LABEL(qemu_st_a64_i32)
             if (TCG_TARGET_REG_BITS == 64) {
                 tci_args_rrm(insn, &r0, &r1, &oi);
                 taddr = regs[r1];
@@ -984,6 +1175,7 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             break;
 
         case INDEX_op_qemu_st_a32_i64:
+        TCI_LABEL(qemu_st_a32_i64)
             if (TCG_TARGET_REG_BITS == 64) {
                 tci_args_rrm(insn, &r0, &r1, &oi);
                 tmp64 = regs[r0];
@@ -996,6 +1188,7 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
             }
             goto do_st_i64;
         case INDEX_op_qemu_st_a64_i64:
+        TCI_LABEL(qemu_st_a64_i64)
             if (TCG_TARGET_REG_BITS == 64) {
                 tci_args_rrm(insn, &r0, &r1, &oi);
                 tmp64 = regs[r0];
@@ -1114,6 +1307,8 @@ int print_insn_tci(bfd_vma addr, disassemble_info *info)
 
     case INDEX_op_setcond_i32:
     case INDEX_op_setcond_i64:
+    case INDEX_op_tci_brcond_i32:
+    case INDEX_op_tci_brcond_i64:
         tci_args_rrrc(insn, &r0, &r1, &r2, &c);
         info->fprintf_func(info->stream, "%-12s  %s, %s, %s, %s",
                            op_name, str_r(r0), str_r(r1), str_r(r2), str_c(c));
@@ -1143,6 +1338,10 @@ int print_insn_tci(bfd_vma addr, disassemble_info *info)
     case INDEX_op_ld32s_i64:
     case INDEX_op_ld_i32:
     case INDEX_op_ld_i64:
+    case INDEX_op_tci_ld32_add:
+    case INDEX_op_tci_ld64_add:
+    case INDEX_op_tci_ld32_st32:
+    case INDEX_op_tci_ld64_st64:
     case INDEX_op_st8_i32:
     case INDEX_op_st8_i64:
     case INDEX_op_st16_i32:
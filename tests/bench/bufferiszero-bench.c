@@ -0,0 +1,85 @@
+/*
+ * QEMU buffer_is_zero and xbzrle speed benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/cutils.h"
+#include "qemu/units.h"
+#include "../migration/xbzrle.h"
+
+#define PAGE_SIZE 4096
+
+static void test_buffer_is_zero_speed(const void *opaque)
+{
+    size_t max = 64 * KiB;
+    void *buf = g_malloc0(max);
+    int accel_index = 0;
+
+    /* Run each accelerator in turn, the best one first.  */
+    do {
+        for (size_t len = 1 * KiB; len <= max; len *= 4) {
+            double total = 0.0;
+
+            g_test_timer_start();
+            do {
+                buffer_is_zero(buf, len);
+                total += len;
+            } while (g_test_timer_elapsed() < 0.5);
+
+            total /= MiB;
+            g_test_message("buffer_is_zero #%d: %2zuKB %8.0f MB/sec",
+                           accel_index, len / (size_t)KiB,
+                           total / g_test_timer_last());
+        }
+        accel_index++;
+    } while (test_buffer_is_zero_next_accel());
+
+    g_free(buf);
+}
+
+static void test_xbzrle_encode_speed(const void *opaque)
+{
+    size_t dirty = (uintptr_t)opaque;
+    uint8_t *old_buf = g_malloc0(PAGE_SIZE);
+    uint8_t *new_buf = g_malloc0(PAGE_SIZE);
+    uint8_t *dst = g_malloc(PAGE_SIZE);
+    double total = 0.0;
+
+    /* Change one byte every PAGE_SIZE / dirty bytes.  */
+    for (size_t i = 0; i < dirty; i++) {
+        new_buf[i * (PAGE_SIZE / dirty)] = 1;
+    }
+
+    g_test_timer_start();
+    do {
+        xbzrle_encode_buffer(old_buf, new_buf, PAGE_SIZE, dst, PAGE_SIZE);
+        total += PAGE_SIZE;
+    } while (g_test_timer_elapsed() < 0.5);
+
+    total /= MiB;
+    g_test_message("xbzrle_encode_buffer: %4zu changes %8.0f MB/sec",
+                   dirty, total / g_test_timer_last());
+
+    g_free(old_buf);
+    g_free(new_buf);
+    g_free(dst);
+}
+
+int main(int argc, char **argv)
+{
+    static const size_t dirty[] = { 1, 16, 256 };
+
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_data_func("/cutils/bufferiszero/speed", NULL,
+                         test_buffer_is_zero_speed);
+    for (int i = 0; i < ARRAY_SIZE(dirty); i++) {
+        g_autofree char *path =
+            g_strdup_printf("/migration/xbzrle/encode/speed/%zu", dirty[i]);
+        g_test_add_data_func(path, (void *)(uintptr_t)dirty[i],
+                             test_xbzrle_encode_speed);
+    }
+    return g_test_run();
+}
@@ -0,0 +1,93 @@
+/*
+ * HBitmap scan and merge speed benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/hbitmap.h"
+#include "qemu/units.h"
+
+/* One bit per 64 KiB cluster of a 16 TiB disk */
+#define BENCH_SIZE  (256 * MiB)
+
+typedef struct BenchPattern {
+    const char *name;
+    uint64_t period;    /* dirty runs start every @period bits */
+    uint64_t run;       /* and are @run bits long */
+} BenchPattern;
+
+static const BenchPattern patterns[] = {
+    { "sparse", 1 * MiB, 16 },
+    { "dense", 128, 64 },
+    { "full", BENCH_SIZE, BENCH_SIZE },
+};
+
+static HBitmap *bench_bitmap_new(const BenchPattern *p, uint64_t shift)
+{
+    HBitmap *hb = hbitmap_alloc(BENCH_SIZE, 0);
+    uint64_t i;
+
+    for (i = shift % p->period; i < BENCH_SIZE; i += p->period) {
+        hbitmap_set(hb, i, MIN(p->run, BENCH_SIZE - i));
+    }
+    return hb;
+}
+
+static void test_hbitmap_scan_speed(const void *opaque)
+{
+    const BenchPattern *p = opaque;
+    HBitmap *hb = bench_bitmap_new(p, 0);
+    int64_t offset, count;
+    double total = 0.0;
+
+    g_test_timer_start();
+    do {
+        for (offset = 0;
+             hbitmap_next_dirty_area(hb, offset, BENCH_SIZE, INT64_MAX,
+                                     &offset, &count);
+             offset += count) {
+            /* nothing */
+        }
+        total += BENCH_SIZE;
+    } while (g_test_timer_elapsed() < 0.5);
+
+    g_test_message("hbitmap_next_dirty_area %-6s: %8.0f Mbit/sec", p->name,
+                   total / MiB / g_test_timer_last());
+    hbitmap_free(hb);
+}
+
+static void test_hbitmap_merge_speed(const void *opaque)
+{
+    const BenchPattern *p = opaque;
+    HBitmap *a = bench_bitmap_new(p, 0);
+    HBitmap *b = bench_bitmap_new(p, p->run);
+    double total = 0.0;
+
+    g_test_timer_start();
+    do {
+        hbitmap_merge(a, b, a);
+        total += BENCH_SIZE;
+    } while (g_test_timer_elapsed() < 0.5);
+
+    g_test_message("hbitmap_merge %-6s: %8.0f Mbit/sec", p->name,
+                   total / MiB / g_test_timer_last());
+    hbitmap_free(a);
+    hbitmap_free(b);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    for (int i = 0; i < ARRAY_SIZE(patterns); i++) {
+        g_autofree char *scan =
+            g_strdup_printf("/hbitmap/scan/speed/%s", patterns[i].name);
+        g_autofree char *merge =
+            g_strdup_printf("/hbitmap/merge/speed/%s", patterns[i].name);
+
+        g_test_add_data_func(scan, &patterns[i], test_hbitmap_scan_speed);
+        g_test_add_data_func(merge, &patterns[i], test_hbitmap_merge_speed);
+    }
+    return g_test_run();
+}
@@ -43,6 +43,13 @@ static QemuThread *rw_threads;
 #define DEFAULT_RANGE (4096)
 #define DEFAULT_QHT_N_ELEMS DEFAULT_RANGE
 
+/*
+ * TB-like profile: a large, mostly stable table where nearly every
+ * operation is a successful lookup, as in the TCG TB hash table.
+ */
+#define TB_PROFILE_RANGE (1 << 16)
+#define TB_PROFILE_UPDATE_RATE 0.001
+
 static unsigned int duration = 1;
 static unsigned int n_rw_threads = 1;
 static unsigned long lookup_range = DEFAULT_RANGE;
@@ -80,6 +87,8 @@ static const char commands_string[] =
     "\n"
     " -o = offset at which keys start\n"
     " -p = precompute hashes\n"
+    " -t = TB-like read-mostly profile (same as -g 65536 -u 0.1 -R);\n"
+    "      options given after -t override it\n"
     "\n"
     " -g = set -s,-k,-K,-l,-r to the same value\n"
     " -s = initial size hint\n"
@@ -445,7 +454,7 @@ static void parse_args(int argc, char *argv[])
     int c;
 
     for (;;) {
-        c = getopt(argc, argv, "d:D:g:k:K:l:hn:N:o:pr:Rs:S:u:");
+        c = getopt(argc, argv, "d:D:g:k:K:l:hn:N:o:pr:Rs:S:tu:");
         if (c < 0) {
             break;
         }
@@ -503,6 +512,15 @@ static void parse_args(int argc, char *argv[])
                 resize_rate = 1.0;
             }
             break;
+        case 't':
+            init_range = TB_PROFILE_RANGE;
+            lookup_range = TB_PROFILE_RANGE;
+            update_range = TB_PROFILE_RANGE;
+            qht_n_elems = TB_PROFILE_RANGE;
+            init_size = TB_PROFILE_RANGE;
+            update_rate = TB_PROFILE_UPDATE_RATE;
+            qht_mode |= QHT_MODE_AUTO_RESIZE;
+            break;
         case 'u':
             update_rate = atof(optarg) / 100.0;
             if (update_rate > 1.0) {
@@ -0,0 +1,106 @@
+/*
+ * Check per-vCPU inline ops and conditional callbacks against regular
+ * callbacks.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include <inttypes.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <glib.h>
+
+#include <qemu-plugin.h>
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
+
+/* conditional callbacks fire every COND_PERIOD instructions */
+#define COND_PERIOD 1000
+
+typedef struct {
+    uint64_t tb_cb;
+    uint64_t tb_inline;
+    uint64_t insn_inline;
+    uint64_t insn_since_cond;
+    uint64_t cond_hits;
+} CPUCount;
+
+static struct qemu_plugin_scoreboard *counts;
+static qemu_plugin_u64 tb_cb;
+static qemu_plugin_u64 tb_inline;
+static qemu_plugin_u64 insn_inline;
+static qemu_plugin_u64 insn_since_cond;
+static qemu_plugin_u64 cond_hits;
+
+static void plugin_exit(qemu_plugin_id_t id, void *udata)
+{
+    g_autoptr(GString) report = g_string_new("");
+    uint64_t hits = qemu_plugin_u64_sum(cond_hits);
+
+    g_string_printf(report, "tb: %" PRIu64 ", insn: %" PRIu64
+                    ", cond hits: %" PRIu64 "\n",
+                    qemu_plugin_u64_sum(tb_inline),
+                    qemu_plugin_u64_sum(insn_inline), hits);
+    qemu_plugin_outs(report->str);
+
+    g_assert(qemu_plugin_u64_sum(tb_cb) == qemu_plugin_u64_sum(tb_inline));
+    g_assert(qemu_plugin_u64_sum(insn_inline) ==
+             hits * COND_PERIOD + qemu_plugin_u64_sum(insn_since_cond));
+
+    qemu_plugin_scoreboard_free(counts);
+}
+
+static void vcpu_tb_exec(unsigned int cpu_index, void *udata)
+{
+    qemu_plugin_u64_add(tb_cb, cpu_index, 1);
+}
+
+static void vcpu_insn_cond(unsigned int cpu_index, void *udata)
+{
+    g_assert(qemu_plugin_u64_get(insn_since_cond, cpu_index) == COND_PERIOD);
+    qemu_plugin_u64_set(insn_since_cond, cpu_index, 0);
+    qemu_plugin_u64_add(cond_hits, cpu_index, 1);
+}
+
+static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
+{
+    size_t n_insns = qemu_plugin_tb_n_insns(tb);
+
+    qemu_plugin_register_vcpu_tb_exec_cb(tb, vcpu_tb_exec,
+                                         QEMU_PLUGIN_CB_NO_REGS, NULL);
+    qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+        tb, QEMU_PLUGIN_INLINE_ADD_U64, tb_inline, 1);
+
+    for (size_t i = 0; i < n_insns; i++) {
+        struct qemu_plugin_insn *insn = qemu_plugin_tb_get_insn(tb, i);
+
+        qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+            insn, QEMU_PLUGIN_INLINE_ADD_U64, insn_inline, 1);
+        qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+            insn, QEMU_PLUGIN_INLINE_ADD_U64, insn_since_cond, 1);
+        qemu_plugin_register_vcpu_insn_exec_cond_cb(
+            insn, vcpu_insn_cond, QEMU_PLUGIN_CB_NO_REGS,
+            QEMU_PLUGIN_COND_EQ, insn_since_cond, COND_PERIOD, NULL);
+    }
+}
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id,
+                                           const qemu_info_t *info,
+                                           int argc, char **argv)
+{
+    counts = qemu_plugin_scoreboard_new(sizeof(CPUCount));
+    tb_cb = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount, tb_cb);
+    tb_inline = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount,
+                                                     tb_inline);
+    insn_inline = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount,
+                                                       insn_inline);
+    insn_since_cond = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount,
+                                                           insn_since_cond);
+    cond_hits = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount,
+                                                     cond_hits);
+
+    qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
+    qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
+    return 0;
+}
@@ -129,6 +129,17 @@ static const uint8_t kernel_stm32vldiscovery[] = {
     0x04, 0x38, 0x01, 0x40                  /* 0x40013804 = USART1 TXD */
 };
 
+static const uint8_t bios_noelv[] = {
+    0x37, 0x15, 0x00, 0xfc,                 /* lui   a0,0xfc001 */
+    0x13, 0x15, 0x05, 0x02,                 /* slli  a0,a0,32 */
+    0x13, 0x55, 0x05, 0x02,                 /* srli  a0,a0,32  APBUART base */
+    0x93, 0x05, 0x30, 0x00,                 /* li    a1,3 */
+    0x23, 0x24, 0xb5, 0x00,                 /* sw    a1,8(a0)  Enable RX/TX */
+    0x93, 0x05, 0x40, 0x05,                 /* li    a1,'T' */
+    0x23, 0x20, 0xb5, 0x00,                 /* sw    a1,0(a0)  Print 'T' */
+    0x6f, 0xf0, 0xdf, 0xff                  /* j     -4 (loop) */
+};
+
 typedef struct testdef {
     const char *arch;       /* Target architecture */
     const char *machine;    /* Name of the machine */
@@ -181,6 +192,8 @@ static const testdef_t tests[] = {
     { "arm", "microbit", "", "T", sizeof(kernel_nrf51), kernel_nrf51 },
     { "arm", "stm32vldiscovery", "", "T",
       sizeof(kernel_stm32vldiscovery), kernel_stm32vldiscovery },
+    { "riscv64", "noelv-generic", "", "TT", sizeof(bios_noelv), NULL,
+      bios_noelv },
 
     { NULL }
 };
@@ -1155,6 +1155,90 @@ uint64_t qtest_readq(QTestState *s, uint64_t addr)
     return qtest_read(s, "readq", addr);
 }
 
+/* Binary framing of the "binary" command, see system/qtest.c */
+enum {
+    QTEST_BINARY_END,
+    QTEST_BINARY_READ,
+    QTEST_BINARY_WRITE,
+};
+
+typedef struct QEMU_PACKED QTestBinaryRequest {
+    uint8_t op;
+    uint8_t size;
+    uint8_t reserved[6];
+    uint64_t addr;
+    uint64_t value;
+} QTestBinaryRequest;
+
+#define QTEST_BINARY_BATCH  1024
+
+static void qtest_client_socket_recv_bytes(QTestState *s, void *buf,
+                                           size_t size)
+{
+    size_t done = MIN(s->rx->len, size);
+
+    memcpy(buf, s->rx->str, done);
+    g_string_erase(s->rx, 0, done);
+
+    while (done < size) {
+        ssize_t len = recv(s->fd, (char *)buf + done, size - done, 0);
+
+        if (len == -1 && errno == EINTR) {
+            continue;
+        }
+        if (len == -1 || len == 0) {
+            fprintf(stderr, "Broken pipe\n");
+            abort();
+        }
+        done += len;
+    }
+}
+
+void qtest_mmio_batch(QTestState *s, QTestMMIOAccess *acc, size_t n)
+{
+    g_autofree QTestBinaryRequest *req =
+        g_new0(QTestBinaryRequest, QTEST_BINARY_BATCH + 1);
+    g_autofree uint64_t *reply = g_new(uint64_t, QTEST_BINARY_BATCH + 1);
+    size_t done = 0;
+
+    g_assert(s->ops.send == qtest_client_socket_send);
+    qtest_sendf(s, "binary\n");
+    qtest_rsp(s);
+
+    /*
+     * Keep the batches small enough for the socket buffers, the server
+     * blocks on its replies while no one reads them.
+     */
+    do {
+        size_t chunk = MIN(n - done, QTEST_BINARY_BATCH);
+        size_t count = chunk;
+        size_t i;
+
+        for (i = 0; i < chunk; i++) {
+            req[i] = (QTestBinaryRequest) {
+                .op = acc[done + i].write ? QTEST_BINARY_WRITE
+                                          : QTEST_BINARY_READ,
+                .size = acc[done + i].size,
+                .addr = cpu_to_le64(acc[done + i].addr),
+                .value = cpu_to_le64(acc[done + i].value),
+            };
+        }
+        if (done + chunk == n) {
+            req[count++] = (QTestBinaryRequest) { .op = QTEST_BINARY_END };
+        }
+
+        socket_send(s->fd, (const char *)req, count * sizeof(*req));
+        qtest_client_socket_recv_bytes(s, reply, count * sizeof(*reply));
+
+        for (i = 0; i < chunk; i++) {
+            if (!acc[done + i].write) {
+                acc[done + i].value = le64_to_cpu(reply[i]);
+            }
+        }
+        done += chunk;
+    } while (done < n);
+}
+
 static int hex2nib(char ch)
 {
     if (ch >= '0' && ch <= '9') {
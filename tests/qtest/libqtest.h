@@ -549,6 +549,33 @@ uint32_t qtest_readl(QTestState *s, uint64_t addr);
  */
 uint64_t qtest_readq(QTestState *s, uint64_t addr);
 
+/**
+ * QTestMMIOAccess:
+ * @addr: Guest address to access.
+ * @value: Value to write, or the value read back.
+ * @size: Access size, 1, 2, 4 or 8 bytes.
+ * @write: Whether to write @value rather than read.
+ */
+typedef struct QTestMMIOAccess {
+    uint64_t addr;
+    uint64_t value;
+    uint8_t size;
+    bool write;
+} QTestMMIOAccess;
+
+/**
+ * qtest_mmio_batch:
+ * @s: #QTestState instance to operate on.
+ * @acc: Accesses to perform, in order.
+ * @n: Number of entries in @acc.
+ *
+ * Performs @n accesses like qtest_readl() or qtest_writel() would, but
+ * through the binary framing of the qtest protocol, which costs much
+ * less per access than the text commands.  This is meant for measuring
+ * the cost of device accesses.  IRQ interception must not be in use.
+ */
+void qtest_mmio_batch(QTestState *s, QTestMMIOAccess *acc, size_t n);
+
 /**
  * qtest_memread:
  * @s: #QTestState instance to operate on.
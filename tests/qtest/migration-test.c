@@ -1430,6 +1430,24 @@ static void test_postcopy_preempt(void)
     test_postcopy_common(&args);
 }
 
+static void *test_migrate_postcopy_prefetch_start(QTestState *from,
+                                                  QTestState *to)
+{
+    migrate_set_parameter_int(to, "postcopy-prefetch-pages", 16);
+
+    return NULL;
+}
+
+static void test_postcopy_preempt_prefetch(void)
+{
+    MigrateCommon args = {
+        .postcopy_preempt = true,
+        .start_hook = test_migrate_postcopy_prefetch_start,
+    };
+
+    test_postcopy_common(&args);
+}
+
 #ifdef CONFIG_GNUTLS
 static void test_postcopy_tls_psk(void)
 {
@@ -2131,6 +2149,40 @@ static void test_precopy_file(void)
     test_file_common(&args, true);
 }
 
+static void *migrate_mapped_ram_start(QTestState *from, QTestState *to)
+{
+    migrate_set_capability(from, "mapped-ram", true);
+    migrate_set_capability(to, "mapped-ram", true);
+
+    return NULL;
+}
+
+static void test_precopy_file_mapped_ram(void)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/%s", tmpfs,
+                                           FILE_TEST_FILENAME);
+    MigrateCommon args = {
+        .connect_uri = uri,
+        .listen_uri = "defer",
+        .start_hook = migrate_mapped_ram_start,
+    };
+
+    test_file_common(&args, true);
+}
+
+static void test_precopy_file_mapped_ram_live(void)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/%s", tmpfs,
+                                           FILE_TEST_FILENAME);
+    MigrateCommon args = {
+        .connect_uri = uri,
+        .listen_uri = "defer",
+        .start_hook = migrate_mapped_ram_start,
+    };
+
+    test_file_common(&args, false);
+}
+
 static void file_offset_finish_hook(QTestState *from, QTestState *to,
                                     void *opaque)
 {
@@ -2223,6 +2275,30 @@ static void test_precopy_tcp_plain(void)
     test_precopy_common(&args);
 }
 
+static void *test_migrate_defer_hot_pages_start(QTestState *from,
+                                                QTestState *to)
+{
+    migrate_set_capability(from, "defer-hot-pages", true);
+
+    return NULL;
+}
+
+static void test_precopy_tcp_defer_hot_pages(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "tcp:127.0.0.1:0",
+        .start_hook = test_migrate_defer_hot_pages_start,
+        /*
+         * The guest must keep dirtying memory for a few passes so that
+         * some pages are held back until the final stage.
+         */
+        .live = true,
+        .iterations = 3,
+    };
+
+    test_precopy_common(&args);
+}
+
 static void *test_migrate_switchover_ack_start(QTestState *from, QTestState *to)
 {
 
@@ -2621,6 +2697,24 @@ test_migrate_precopy_tcp_multifd_start(QTestState *from,
     return test_migrate_precopy_tcp_multifd_start_common(from, to, "none");
 }
 
+static void *
+test_migrate_precopy_tcp_multifd_start_zero_page_legacy(QTestState *from,
+                                                        QTestState *to)
+{
+    test_migrate_precopy_tcp_multifd_start_common(from, to, "none");
+    migrate_set_parameter_str(from, "zero-page-detection", "legacy");
+    return NULL;
+}
+
+static void *
+test_migrate_precopy_tcp_multifd_start_no_zero_page(QTestState *from,
+                                                    QTestState *to)
+{
+    test_migrate_precopy_tcp_multifd_start_common(from, to, "none");
+    migrate_set_parameter_str(from, "zero-page-detection", "none");
+    return NULL;
+}
+
 static void *
 test_migrate_precopy_tcp_multifd_zlib_start(QTestState *from,
                                             QTestState *to)
@@ -2635,6 +2729,14 @@ test_migrate_precopy_tcp_multifd_zstd_start(QTestState *from,
 {
     return test_migrate_precopy_tcp_multifd_start_common(from, to, "zstd");
 }
+
+static void *
+test_migrate_precopy_tcp_multifd_zstd_adaptive_start(QTestState *from,
+                                                     QTestState *to)
+{
+    return test_migrate_precopy_tcp_multifd_start_common(from, to,
+                                                         "zstd-adaptive");
+}
 #endif /* CONFIG_ZSTD */
 
 static void test_multifd_tcp_none(void)
@@ -2652,6 +2754,26 @@ static void test_multifd_tcp_none(void)
     test_precopy_common(&args);
 }
 
+static void test_multifd_tcp_zero_page_legacy(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "defer",
+        .start_hook = test_migrate_precopy_tcp_multifd_start_zero_page_legacy,
+        .live = true,
+    };
+    test_precopy_common(&args);
+}
+
+static void test_multifd_tcp_no_zero_page(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "defer",
+        .start_hook = test_migrate_precopy_tcp_multifd_start_no_zero_page,
+        .live = true,
+    };
+    test_precopy_common(&args);
+}
+
 static void test_multifd_tcp_zlib(void)
 {
     MigrateCommon args = {
@@ -2670,6 +2792,15 @@ static void test_multifd_tcp_zstd(void)
     };
     test_precopy_common(&args);
 }
+
+static void test_multifd_tcp_zstd_adaptive(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "defer",
+        .start_hook = test_migrate_precopy_tcp_multifd_zstd_adaptive_start,
+    };
+    test_precopy_common(&args);
+}
 #endif
 
 #ifdef CONFIG_GNUTLS
@@ -3416,6 +3547,8 @@ int main(int argc, char **argv)
                            test_postcopy_recovery);
         migration_test_add("/migration/postcopy/preempt/plain",
                            test_postcopy_preempt);
+        migration_test_add("/migration/postcopy/preempt/prefetch",
+                           test_postcopy_preempt_prefetch);
         migration_test_add("/migration/postcopy/preempt/recovery/plain",
                            test_postcopy_preempt_recovery);
         if (getenv("QEMU_TEST_FLAKY_TESTS")) {
@@ -3461,6 +3594,10 @@ int main(int argc, char **argv)
                        test_precopy_file_offset);
     migration_test_add("/migration/precopy/file/offset/bad",
                        test_precopy_file_offset_bad);
+    migration_test_add("/migration/precopy/file/mapped-ram",
+                       test_precopy_file_mapped_ram);
+    migration_test_add("/migration/precopy/file/mapped-ram/live",
+                       test_precopy_file_mapped_ram_live);
 
     /*
      * Our CI system has problems with shared memory.
@@ -3501,6 +3638,8 @@ int main(int argc, char **argv)
 
     migration_test_add("/migration/precopy/tcp/plain/switchover-ack",
                        test_precopy_tcp_switchover_ack);
+    migration_test_add("/migration/precopy/tcp/plain/defer-hot-pages",
+                       test_precopy_tcp_defer_hot_pages);
 
 #ifdef CONFIG_GNUTLS
     migration_test_add("/migration/precopy/tcp/tls/psk/match",
@@ -3550,6 +3689,10 @@ int main(int argc, char **argv)
     }
     migration_test_add("/migration/multifd/tcp/plain/none",
                        test_multifd_tcp_none);
+    migration_test_add("/migration/multifd/tcp/plain/zero-page/legacy",
+                       test_multifd_tcp_zero_page_legacy);
+    migration_test_add("/migration/multifd/tcp/plain/zero-page/none",
+                       test_multifd_tcp_no_zero_page);
     migration_test_add("/migration/multifd/tcp/plain/cancel",
                        test_multifd_tcp_cancel);
     migration_test_add("/migration/multifd/tcp/plain/zlib",
@@ -3557,6 +3700,8 @@ int main(int argc, char **argv)
 #ifdef CONFIG_ZSTD
     migration_test_add("/migration/multifd/tcp/plain/zstd",
                        test_multifd_tcp_zstd);
+    migration_test_add("/migration/multifd/tcp/plain/zstd-adaptive",
+                       test_multifd_tcp_zstd_adaptive);
 #endif
 #ifdef CONFIG_GNUTLS
     migration_test_add("/migration/multifd/tcp/tls/psk/match",
@@ -0,0 +1,184 @@
+/*
+ * MMIO dispatch benchmark
+ *
+ * Hammers device registers from the harness and reports accesses per
+ * second, to catch regressions in memory_region_dispatch_read/write()
+ * and in the register paths of the device models.  The accesses go
+ * through the binary framing of the qtest protocol; the rate with the
+ * text commands is printed alongside, to show how much of it is
+ * protocol overhead.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+#include "libqos/pci-pc.h"
+
+#define BATCH       4096
+#define DURATION    1.0         /* seconds per measurement */
+
+typedef struct MMIOBench {
+    const char *arch;
+    const char *name;
+    const char *machine;
+    const char *device;         /* PCI device in slot, or NULL */
+    int slot;
+    uint64_t addr;              /* offset in BAR 0 for PCI devices */
+    uint8_t size;
+    bool write;
+    uint64_t value;
+} MMIOBench;
+
+static const MMIOBench benches[] = {
+    {
+        .arch = "sparc", .name = "apbuart-status-read",
+        .machine = "leon3_generic", .addr = 0x80000104, .size = 4,
+    }, {
+        .arch = "sparc", .name = "gptimer-counter-read",
+        .machine = "leon3_generic", .addr = 0x80000310, .size = 4,
+    }, {
+        .arch = "sparc", .name = "gptimer-reload-write",
+        .machine = "leon3_generic", .addr = 0x80000314, .size = 4,
+        .write = true, .value = 0x1000,
+    }, {
+        .arch = "riscv64", .name = "aclint-mtime-read",
+        .machine = "virt", .addr = 0x0200bff8, .size = 8,
+    }, {
+        .arch = "riscv64", .name = "aclint-mtimecmp-write",
+        .machine = "virt", .addr = 0x02004000, .size = 8,
+        .write = true, .value = UINT64_MAX,
+    }, {
+        .arch = "riscv64", .name = "aclint-msip-write",
+        .machine = "virt", .addr = 0x02000000, .size = 4,
+        .write = true, .value = 0,
+    }, {
+        .arch = "x86_64", .name = "e1000e-status-read",
+        .machine = "q35", .device = "e1000e", .slot = 4,
+        .addr = 0x8, .size = 4,
+    }, {
+        .arch = "x86_64", .name = "e1000e-itr-write",
+        .machine = "q35", .device = "e1000e", .slot = 4,
+        .addr = 0xc4, .size = 4, .write = true, .value = 0x100,
+    },
+};
+
+static void text_access(QTestState *qts, QTestMMIOAccess *acc)
+{
+    switch (acc->size) {
+    case 1:
+        if (acc->write) {
+            qtest_writeb(qts, acc->addr, acc->value);
+        } else {
+            acc->value = qtest_readb(qts, acc->addr);
+        }
+        break;
+    case 2:
+        if (acc->write) {
+            qtest_writew(qts, acc->addr, acc->value);
+        } else {
+            acc->value = qtest_readw(qts, acc->addr);
+        }
+        break;
+    case 4:
+        if (acc->write) {
+            qtest_writel(qts, acc->addr, acc->value);
+        } else {
+            acc->value = qtest_readl(qts, acc->addr);
+        }
+        break;
+    default:
+        if (acc->write) {
+            qtest_writeq(qts, acc->addr, acc->value);
+        } else {
+            acc->value = qtest_readq(qts, acc->addr);
+        }
+        break;
+    }
+}
+
+static double measure(QTestState *qts, QTestMMIOAccess *acc, bool binary)
+{
+    g_autoptr(GTimer) timer = g_timer_new();
+    uint64_t count = 0;
+    int i;
+
+    do {
+        if (binary) {
+            qtest_mmio_batch(qts, acc, BATCH);
+        } else {
+            for (i = 0; i < BATCH; i++) {
+                text_access(qts, &acc[i]);
+            }
+        }
+        count += BATCH;
+    } while (g_timer_elapsed(timer, NULL) < DURATION);
+
+    return count / g_timer_elapsed(timer, NULL);
+}
+
+static void test_mmio_bench(const void *opaque)
+{
+    const MMIOBench *b = opaque;
+    g_autofree QTestMMIOAccess *acc = g_new(QTestMMIOAccess, BATCH);
+    QPCIDevice *dev = NULL;
+    QPCIBus *pcibus = NULL;
+    uint64_t addr = b->addr;
+    double binary, text;
+    QTestState *qts;
+    int i;
+
+    if (b->device) {
+        qts = qtest_initf("-M %s -device %s,addr=%d", b->machine,
+                          b->device, b->slot);
+        pcibus = qpci_new_pc(qts, NULL);
+        dev = qpci_device_find(pcibus, QPCI_DEVFN(b->slot, 0));
+        g_assert(dev);
+        qpci_device_enable(dev);
+        addr += qpci_iomap(dev, 0, NULL).addr;
+    } else {
+        qts = qtest_initf("-M %s", b->machine);
+    }
+
+    for (i = 0; i < BATCH; i++) {
+        acc[i] = (QTestMMIOAccess) {
+            .addr = addr,
+            .value = b->value,
+            .size = b->size,
+            .write = b->write,
+        };
+    }
+
+    binary = measure(qts, acc, true);
+    text = measure(qts, acc, false);
+    g_test_message("%s: %.0f accesses/s (text protocol: %.0f accesses/s)",
+                   b->name, binary, text);
+
+    g_free(dev);
+    if (pcibus) {
+        qpci_free_pc(pcibus);
+    }
+    qtest_quit(qts);
+}
+
+int main(int argc, char **argv)
+{
+    const char *arch = qtest_get_arch();
+    int i;
+
+    g_test_init(&argc, &argv, NULL);
+
+    for (i = 0; i < ARRAY_SIZE(benches); i++) {
+        const MMIOBench *b = &benches[i];
+        g_autofree char *path = NULL;
+
+        if (strcmp(b->arch, arch) || !qtest_has_machine(b->machine) ||
+            (b->device && !qtest_has_device(b->device))) {
+            continue;
+        }
+        path = g_strdup_printf("mmio-bench/%s", b->name);
+        qtest_add_data_func(path, b, test_mmio_bench);
+    }
+
+    return g_test_run();
+}
@@ -0,0 +1,167 @@
+/*
+ * LEON3 TCG micro-benchmarks
+ *
+ * Each kernel stresses one TCG hot path: softmmu loads and stores, TLB
+ * refills, translation of freshly modified code and the FPU helpers.
+ * scripts/simplebench/bench_tcg.py selects the kernel and the iteration
+ * count by writing them at BENCH_PARAMS with the generic loader, and
+ * times the runs.  Without parameters all kernels run briefly, which
+ * keeps the file working as a test.
+ *
+ * The kernels are written in assembly so that the instruction counts
+ * per iteration quoted below, which bench_tcg.py divides by, are exact.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <minilib.h>
+
+#define BENCH_PARAMS    0x40f00000      /* u32 kernel, u32 iterations */
+#define DEFAULT_ITERS   100
+
+#define PSR_EF          0x1000
+
+typedef void bench_fn(unsigned int iters);
+
+extern bench_fn bench_ldst, bench_tlb, bench_tbgen, bench_fpu;
+
+static const struct {
+    const char *name;
+    bench_fn *fn;
+} kernels[] = {
+    { "ldst", bench_ldst },
+    { "tlb-fill", bench_tlb },
+    { "tb-gen", bench_tbgen },
+    { "fpu", bench_fpu },
+};
+
+#define NR_KERNELS  (sizeof(kernels) / sizeof(kernels[0]))
+
+unsigned int bench_buf[64] __attribute__((aligned(8)));
+unsigned char bench_pages[16 * 4096] __attribute__((aligned(4096)));
+const double bench_one = 1.0;
+
+/* 1: softmmu fast path, 67 insns per iteration */
+asm("	.text\n"
+    "	.align	4\n"
+    "	.globl	bench_ldst\n"
+    "bench_ldst:\n"
+    "	set	bench_buf, %o1\n"
+    "1:\n"
+    "	.rept	32\n"
+    "	ld	[%o1], %o2\n"
+    "	st	%o2, [%o1 + 4]\n"
+    "	.endr\n"
+    "	subcc	%o0, 1, %o0\n"
+    "	bne	1b\n"
+    "	 nop\n"
+    "	retl\n"
+    "	 nop\n");
+
+/* 2: TLB refills, 16 data pages per flush, 37 insns per iteration */
+asm("	.text\n"
+    "	.align	4\n"
+    "	.globl	bench_tlb\n"
+    "bench_tlb:\n"
+    "	set	bench_pages, %o1\n"
+    "	set	0x400, %o3\n"          /* flush entire */
+    "	set	4096, %o4\n"
+    "1:\n"
+    "	sta	%g0, [%o3] 0x18\n"
+    "	mov	%o1, %o2\n"
+    "	.rept	16\n"
+    "	ld	[%o2], %o5\n"
+    "	add	%o2, %o4, %o2\n"
+    "	.endr\n"
+    "	subcc	%o0, 1, %o0\n"
+    "	bne	1b\n"
+    "	 nop\n"
+    "	retl\n"
+    "	 nop\n");
+
+/*
+ * 3: translation, 137 insns per iteration.  The rewritten code gets a
+ * page of its own.
+ */
+asm("	.text\n"
+    "	.align	4\n"
+    "	.globl	bench_tbgen\n"
+    "bench_tbgen:\n"
+    "	save	%sp, -96, %sp\n"
+    "	set	smc_insn, %l0\n"
+    "1:\n"
+    "	ld	[%l0], %l1\n"
+    "	xor	%l1, 1, %l1\n"         /* bit 0 of simm13 */
+    "	st	%l1, [%l0]\n"
+    "	flush	%l0\n"
+    "	call	smc_block\n"
+    "	 nop\n"
+    "	subcc	%i0, 1, %i0\n"
+    "	bne	1b\n"
+    "	 nop\n"
+    "	ret\n"
+    "	 restore\n"
+    "	.align	4096\n"
+    "smc_block:\n"
+    "smc_insn:\n"
+    "	add	%g0, 0, %o0\n"
+    "	.rept	125\n"
+    "	add	%o1, %o0, %o1\n"
+    "	.endr\n"
+    "	retl\n"
+    "	 nop\n");
+
+/* 4: FPU helpers, 35 insns per iteration */
+asm("	.text\n"
+    "	.align	4\n"
+    "	.globl	bench_fpu\n"
+    "bench_fpu:\n"
+    "	set	bench_one, %o1\n"
+    "	ldd	[%o1], %f0\n"
+    "	fmovs	%f0, %f2\n"
+    "	fmovs	%f1, %f3\n"
+    "1:\n"
+    "	.rept	16\n"
+    "	fmuld	%f0, %f0, %f4\n"
+    "	faddd	%f2, %f4, %f2\n"
+    "	.endr\n"
+    "	subcc	%o0, 1, %o0\n"
+    "	bne	1b\n"
+    "	 nop\n"
+    "	retl\n"
+    "	 nop\n");
+
+static void enable_fpu(void)
+{
+    unsigned int psr;
+
+    asm volatile("rd %%psr, %0" : "=r"(psr));
+    psr |= PSR_EF;
+    asm volatile("wr %0, %%psr\n\tnop\n\tnop\n\tnop" : : "r"(psr) : "memory");
+}
+
+int main(void)
+{
+    volatile unsigned int *params = (volatile unsigned int *)BENCH_PARAMS;
+    unsigned int kernel = params[0];
+    unsigned int iters = params[1] ? params[1] : DEFAULT_ITERS;
+    unsigned int i;
+
+    enable_fpu();
+
+    if (kernel) {
+        if (kernel > NR_KERNELS) {
+            ml_printf("FAIL: no kernel %d\n", kernel);
+            return 1;
+        }
+        kernels[kernel - 1].fn(iters);
+        return 0;
+    }
+
+    for (i = 0; i < NR_KERNELS; i++) {
+        ml_printf("%s\n", kernels[i].name);
+        kernels[i].fn(iters);
+    }
+    ml_printf("PASS\n");
+    return 0;
+}
@@ -0,0 +1,189 @@
+/*
+ * LEON3 SMP test
+ *
+ * All the CPUs hammer on shared counters with ldstub, swap and casa,
+ * then CPU 0 sends interrupts to each of the others through the IRQMP
+ * force registers.  Run it with -smp 2 or more and MTTCG to check that
+ * the atomics really are atomic and that interrupt delivery between
+ * vCPU threads does not lose anything.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdbool.h>
+#include <minilib.h>
+
+#define IRQMP_BASE      0x80000200
+#define IRQMP_MPSTATUS  (IRQMP_BASE + 0x10)
+#define IRQMP_MASK(n)   (IRQMP_BASE + 0x40 + 4 * (n))
+#define IRQMP_FORCE(n)  (IRQMP_BASE + 0x80 + 4 * (n))
+
+#define PSR_PIL         0xf00
+
+#define MAX_CPUS        16
+#define ITERATIONS      20000
+#define IPI_IRQ         14
+#define IPI_ROUNDS      100
+#define TIMEOUT         10000000
+
+extern volatile unsigned int irq_count[MAX_CPUS];
+
+static volatile unsigned char ldstub_lock;
+static volatile unsigned int swap_lock;
+static volatile unsigned int ldstub_counter;
+static volatile unsigned int swap_counter;
+static volatile unsigned int casa_counter;
+static volatile unsigned int cpus_done;
+static volatile unsigned int cpus_ready;
+
+static inline void mmio_write(unsigned int addr, unsigned int val)
+{
+    *(volatile unsigned int *)addr = val;
+}
+
+static inline unsigned int mmio_read(unsigned int addr)
+{
+    return *(volatile unsigned int *)addr;
+}
+
+static inline unsigned int ldstub(volatile unsigned char *p)
+{
+    unsigned int old;
+
+    asm volatile("ldstub [%1], %0" : "=r"(old) : "r"(p) : "memory");
+    return old;
+}
+
+static inline unsigned int swap(volatile unsigned int *p, unsigned int val)
+{
+    asm volatile("swap [%1], %0" : "+r"(val) : "r"(p) : "memory");
+    return val;
+}
+
+/* Returns the old value of *p, which was replaced if it equals @cmp */
+static inline unsigned int casa(volatile unsigned int *p, unsigned int cmp,
+                                unsigned int val)
+{
+    asm volatile("casa [%1] 0xb, %2, %0"
+                 : "+r"(val) : "r"(p), "r"(cmp) : "memory");
+    return val;
+}
+
+static void atomic_inc(volatile unsigned int *p)
+{
+    unsigned int old;
+
+    do {
+        old = *p;
+    } while (casa(p, old, old + 1) != old);
+}
+
+static void run_atomics(void)
+{
+    int i;
+
+    for (i = 0; i < ITERATIONS; i++) {
+        while (ldstub(&ldstub_lock)) {
+            /* spin */
+        }
+        ldstub_counter++;
+        ldstub_lock = 0;
+
+        while (swap(&swap_lock, 1)) {
+            /* spin */
+        }
+        swap_counter++;
+        swap(&swap_lock, 0);
+
+        atomic_inc(&casa_counter);
+    }
+    atomic_inc(&cpus_done);
+}
+
+static void enable_interrupts(void)
+{
+    unsigned int psr;
+
+    asm volatile("rd %%psr, %0" : "=r"(psr));
+    psr &= ~PSR_PIL;
+    asm volatile("wr %0, %%psr\n\tnop\n\tnop\n\tnop" : : "r"(psr) : "memory");
+}
+
+void secondary_main(int cpu)
+{
+    run_atomics();
+
+    mmio_write(IRQMP_MASK(cpu), 1 << IPI_IRQ);
+    enable_interrupts();
+    atomic_inc(&cpus_ready);
+
+    for (;;) {
+        /* wait for interrupts */
+    }
+}
+
+static bool wait_for(volatile unsigned int *p, unsigned int val)
+{
+    int i;
+
+    for (i = 0; i < TIMEOUT; i++) {
+        if (*p == val) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int main(void)
+{
+    int ncpus = (mmio_read(IRQMP_MPSTATUS) >> 28) + 1;
+    unsigned int expected;
+    int cpu, i, err = 0;
+
+    ml_printf("LEON3 SMP test with %d CPUs\n", ncpus);
+
+    /* Writing 1 starts CPU n */
+    mmio_write(IRQMP_MPSTATUS, ((1 << ncpus) - 1) & ~1);
+
+    run_atomics();
+    if (!wait_for(&cpus_done, ncpus)) {
+        ml_printf("FAIL: only %d CPUs finished the atomics\n", cpus_done);
+        return 1;
+    }
+
+    expected = ncpus * ITERATIONS;
+    if (ldstub_counter != expected) {
+        ml_printf("FAIL: ldstub counter %d, expected %d\n",
+                  ldstub_counter, expected);
+        err = 1;
+    }
+    if (swap_counter != expected) {
+        ml_printf("FAIL: swap counter %d, expected %d\n",
+                  swap_counter, expected);
+        err = 1;
+    }
+    if (casa_counter != expected) {
+        ml_printf("FAIL: casa counter %d, expected %d\n",
+                  casa_counter, expected);
+        err = 1;
+    }
+
+    if (!wait_for(&cpus_ready, ncpus - 1)) {
+        ml_printf("FAIL: secondary CPUs did not enable interrupts\n");
+        return 1;
+    }
+    for (cpu = 1; cpu < ncpus; cpu++) {
+        for (i = 1; i <= IPI_ROUNDS; i++) {
+            mmio_write(IRQMP_FORCE(cpu), 1 << IPI_IRQ);
+            if (!wait_for(&irq_count[cpu], i)) {
+                ml_printf("FAIL: CPU %d got %d of %d interrupts\n",
+                          cpu, irq_count[cpu], i);
+                err = 1;
+                break;
+            }
+        }
+    }
+
+    ml_printf(err ? "FAIL\n" : "PASS\n");
+    return err;
+}
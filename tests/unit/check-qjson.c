@@ -1150,6 +1150,37 @@ static void large_dict(void)
     g_string_free(gstr, true);
 }
 
+static void stream_append(void *opaque, const char *buf, size_t len)
+{
+    GString *out = opaque;
+
+    g_assert_cmpuint(strlen(buf), ==, len);
+    g_string_append_len(out, buf, len);
+}
+
+static void large_dict_stream(void)
+{
+    GString *gstr = g_string_new("");
+    QObject *obj;
+    int pretty;
+
+    gen_test_json(gstr, 10, 100);
+    obj = qobject_from_json(gstr->str, &error_abort);
+
+    /* Streamed output must match, although it is passed on in chunks */
+    for (pretty = 0; pretty < 2; pretty++) {
+        g_autoptr(GString) expected = qobject_to_json_pretty(obj, pretty);
+        g_autoptr(GString) out = g_string_new("");
+
+        g_assert_cmpuint(expected->len, >, 64 * 1024);
+        qobject_to_json_stream(obj, pretty, stream_append, out);
+        g_assert_cmpstr(out->str, ==, expected->str);
+    }
+
+    qobject_unref(obj);
+    g_string_free(gstr, true);
+}
+
 static void simple_list(void)
 {
     int i;
@@ -1491,6 +1522,7 @@ int main(int argc, char **argv)
 
     g_test_add_func("/dicts/simple_dict", simple_dict);
     g_test_add_func("/dicts/large_dict", large_dict);
+    g_test_add_func("/dicts/large_dict_stream", large_dict_stream);
     g_test_add_func("/lists/simple_list", simple_list);
 
     g_test_add_func("/mixed/simple_whitespace", simple_whitespace);
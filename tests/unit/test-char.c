@@ -177,6 +177,58 @@ static void char_ringbuf_test(void)
     qemu_opts_del(opts);
 }
 
+#ifndef _WIN32
+static void char_ringbuf_path_test(void)
+{
+    char *tmp_path = g_dir_make_tmp("qemu-test-char.XXXXXX", NULL);
+    char *path = g_build_filename(tmp_path, "ring", NULL);
+    QemuOpts *opts;
+    Chardev *chr;
+    CharBackend be;
+    char *contents;
+    uint32_t *header;
+    gsize len;
+    int ret;
+
+    opts = qemu_opts_create(qemu_find_opts("chardev"), "ringbuf-label",
+                            1, &error_abort);
+    qemu_opt_set(opts, "backend", "ringbuf", &error_abort);
+    qemu_opt_set(opts, "size", "4", &error_abort);
+    qemu_opt_set(opts, "path", path, &error_abort);
+    chr = qemu_chr_new_from_opts(opts, NULL, &error_abort);
+    g_assert_nonnull(chr);
+    qemu_opts_del(opts);
+
+    qemu_chr_fe_init(&be, chr, &error_abort);
+    ret = qemu_chr_fe_write(&be, (void *)"buff", 4);
+    g_assert_cmpint(ret, ==, 4);
+    ret = qemu_chr_fe_write(&be, (void *)"er", 2);
+    g_assert_cmpint(ret, ==, 2);
+
+    g_assert_true(g_file_get_contents(path, &contents, &len, NULL));
+    g_assert_cmpint(len, ==, 64 + 4);
+    header = (uint32_t *)contents;
+    g_assert_cmphex(header[0], ==, 0x31425251);
+    g_assert_cmpint(header[1], ==, 4);
+    g_assert_cmpint(header[2], ==, 6);
+    g_assert_cmpint(header[3], ==, 6);
+    g_assert_cmpmem(contents + 64, 4, "erff", 4);
+    g_free(contents);
+
+    /* ringbuf-read still works on the mapped buffer */
+    contents = qmp_ringbuf_read("ringbuf-label", 4, false, 0, &error_abort);
+    g_assert_cmpstr(contents, ==, "ffer");
+    g_free(contents);
+
+    qemu_chr_fe_deinit(&be, true);
+
+    g_unlink(path);
+    g_free(path);
+    g_rmdir(tmp_path);
+    g_free(tmp_path);
+}
+#endif
+
 static void char_mux_test(void)
 {
     QemuOpts *opts;
@@ -1484,6 +1536,9 @@ int main(int argc, char **argv)
     g_test_add_func("/char/null", char_null_test);
     g_test_add_func("/char/invalid", char_invalid_test);
     g_test_add_func("/char/ringbuf", char_ringbuf_test);
+#ifndef _WIN32
+    g_test_add_func("/char/ringbuf-path", char_ringbuf_path_test);
+#endif
     g_test_add_func("/char/mux", char_mux_test);
 #ifdef _WIN32
     g_test_add_func("/char/console/subprocess", char_console_test_subprocess);
@@ -46,6 +46,8 @@ struct QIOChannelTLSTestData {
     bool expectClientFail;
     const char *hostname;
     const char *const *wildcards;
+    const char *priority;
+    bool ktls;
 };
 
 struct QIOChannelTLSHandshakeData {
@@ -64,7 +66,9 @@ static void test_tls_handshake_done(QIOTask *task,
 
 
 static QCryptoTLSCreds *test_tls_creds_create(QCryptoTLSCredsEndpoint endpoint,
-                                              const char *certdir)
+                                              const char *certdir,
+                                              const char *priority,
+                                              bool ktls)
 {
     Object *parent = object_get_objects_root();
     Object *creds = object_new_with_props(
@@ -77,7 +81,8 @@ static QCryptoTLSCreds *test_tls_creds_create(QCryptoTLSCredsEndpoint endpoint,
                      "server" : "client"),
         "dir", certdir,
         "verify-peer", "yes",
-        "priority", "NORMAL",
+        "priority", priority ? priority : "NORMAL",
+        "ktls", ktls ? "yes" : "no",
         /* We skip initial sanity checks here because we
          * want to make sure that problems are being
          * detected at the TLS session validation stage,
@@ -92,6 +97,31 @@ static QCryptoTLSCreds *test_tls_creds_create(QCryptoTLSCredsEndpoint endpoint,
 }
 
 
+/* Kernel TLS needs TCP, connect two sockets over loopback */
+static void test_tls_tcp_pair(int channel[2])
+{
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    socklen_t len = sizeof(addr);
+    int lfd = qemu_socket(AF_INET, SOCK_STREAM, 0);
+
+    g_assert(lfd >= 0);
+    g_assert(bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    g_assert(listen(lfd, 1) == 0);
+    g_assert(getsockname(lfd, (struct sockaddr *)&addr, &len) == 0);
+
+    channel[0] = qemu_socket(AF_INET, SOCK_STREAM, 0);
+    g_assert(channel[0] >= 0);
+    g_assert(connect(channel[0], (struct sockaddr *)&addr,
+                     sizeof(addr)) == 0);
+    channel[1] = accept(lfd, NULL, NULL);
+    g_assert(channel[1] >= 0);
+    close(lfd);
+}
+
+
 /*
  * This tests validation checking of peer certificates
  *
@@ -121,7 +151,11 @@ static void test_io_channel_tls(const void *opaque)
     GMainContext *mainloop;
 
     /* We'll use this for our fake client-server connection */
-    g_assert(qemu_socketpair(AF_UNIX, SOCK_STREAM, 0, channel) == 0);
+    if (data->ktls) {
+        test_tls_tcp_pair(channel);
+    } else {
+        g_assert(qemu_socketpair(AF_UNIX, SOCK_STREAM, 0, channel) == 0);
+    }
 
 #define CLIENT_CERT_DIR "tests/test-io-channel-tls-client/"
 #define SERVER_CERT_DIR "tests/test-io-channel-tls-server/"
@@ -152,12 +186,12 @@ static void test_io_channel_tls(const void *opaque)
 
     clientCreds = test_tls_creds_create(
         QCRYPTO_TLS_CREDS_ENDPOINT_CLIENT,
-        CLIENT_CERT_DIR);
+        CLIENT_CERT_DIR, data->priority, data->ktls);
     g_assert(clientCreds != NULL);
 
     serverCreds = test_tls_creds_create(
         QCRYPTO_TLS_CREDS_ENDPOINT_SERVER,
-        SERVER_CERT_DIR);
+        SERVER_CERT_DIR, data->priority, data->ktls);
     g_assert(serverCreds != NULL);
 
     auth = qauthz_list_new("channeltlsacl",
@@ -224,6 +258,15 @@ static void test_io_channel_tls(const void *opaque)
     g_assert(clientHandshake.failed == data->expectClientFail);
     g_assert(serverHandshake.failed == data->expectServerFail);
 
+    /*
+     * Without the tls kernel module the channels keep using GnuTLS,
+     * which the other tests cover already.
+     */
+    if (data->ktls && (!clientChanTLS->ktls || !serverChanTLS->ktls)) {
+        g_test_skip("kernel TLS not available");
+        goto cleanup;
+    }
+
     test = qio_channel_test_new();
     qio_channel_test_run_threads(test, false,
                                  QIO_CHANNEL(clientChanTLS),
@@ -236,6 +279,7 @@ static void test_io_channel_tls(const void *opaque)
                                  QIO_CHANNEL(serverChanTLS));
     qio_channel_test_validate(test);
 
+ cleanup:
     unlink(SERVER_CERT_DIR QCRYPTO_TLS_CREDS_X509_CA_CERT);
     unlink(SERVER_CERT_DIR QCRYPTO_TLS_CREDS_X509_SERVER_CERT);
     unlink(SERVER_CERT_DIR QCRYPTO_TLS_CREDS_X509_SERVER_KEY);
@@ -321,6 +365,21 @@ int main(int argc, char **argv)
                  clientcertreq.filename, false, false,
                  "qemu.org", wildcards);
 
+#if GNUTLS_VERSION_NUMBER >= 0x030600
+    /*
+     * TLS 1.3 with both directions offloaded: the server must not
+     * send session tickets, which the kernel would fail to handle.
+     */
+    struct QIOChannelTLSTestData ktls13 = {
+        cacertreq.filename, cacertreq.filename,
+        servercertreq.filename, clientcertreq.filename,
+        false, false, "qemu.org", wildcards,
+        "NORMAL:-VERS-ALL:+VERS-TLS1.3", true,
+    };
+    g_test_add_data_func("/qio/channel/tls/ktls13",
+                         &ktls13, test_io_channel_tls);
+#endif
+
     ret = g_test_run();
 
     test_tls_discard_cert(&clientcertreq);
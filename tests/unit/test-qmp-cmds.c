@@ -34,6 +34,10 @@ void qmp_coroutine_cmd(Error **errp)
 {
 }
 
+void qmp_no_bql_cmd(Error **errp)
+{
+}
+
 Empty2 *qmp_user_def_cmd0(Error **errp)
 {
     return g_new0(Empty2, 1);
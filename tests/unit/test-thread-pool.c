@@ -3,6 +3,7 @@
 #include "block/thread-pool.h"
 #include "block/block.h"
 #include "qapi/error.h"
+#include "qemu/defer-call.h"
 #include "qemu/timer.h"
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
@@ -134,6 +135,40 @@ static void test_submit_many(void)
     }
 }
 
+static void test_submit_deferred(void)
+{
+    WorkerTestData data[10];
+    int i;
+
+    /* Requests submitted in a defer_call section wait for its end */
+    defer_call_begin();
+    for (i = 0; i < 10; i++) {
+        data[i].n = 0;
+        data[i].ret = -EINPROGRESS;
+        data[i].aiocb = thread_pool_submit_aio(worker_cb, &data[i],
+                                               done_cb, &data[i]);
+    }
+    active = 10;
+
+    /* Cancelling a request that has not been handed out yet completes it */
+    bdrv_aio_cancel_async(data[0].aiocb);
+    g_usleep(10000);
+    for (i = 0; i < 10; i++) {
+        g_assert_cmpint(qatomic_read(&data[i].n), ==, 0);
+    }
+    defer_call_end();
+
+    while (active > 0) {
+        aio_poll(ctx, true);
+    }
+    g_assert_cmpint(data[0].n, ==, 0);
+    g_assert_cmpint(data[0].ret, ==, -ECANCELED);
+    for (i = 1; i < 10; i++) {
+        g_assert_cmpint(data[i].n, ==, 1);
+        g_assert_cmpint(data[i].ret, ==, 0);
+    }
+}
+
 static void do_test_cancel(bool sync)
 {
     WorkerTestData data[100];
@@ -240,6 +275,7 @@ int main(int argc, char **argv)
     g_test_add_func("/thread-pool/submit-aio", test_submit_aio);
     g_test_add_func("/thread-pool/submit-co", test_submit_co);
     g_test_add_func("/thread-pool/submit-many", test_submit_many);
+    g_test_add_func("/thread-pool/submit-deferred", test_submit_deferred);
     g_test_add_func("/thread-pool/cancel", test_cancel);
     g_test_add_func("/thread-pool/cancel-async", test_cancel_async);
 
@@ -30,11 +30,14 @@
 /** Records were dropped event ID */
 #define DROPPED_EVENT_ID (~(uint64_t)0 - 1)
 
-/** Trace record is valid */
-#define TRACE_RECORD_VALID ((uint64_t)1 << 63)
-
 /*
- * Trace records are written out by a dedicated thread.  The thread waits for
+ * Each thread that emits trace events owns a ring buffer that only it writes
+ * to, so recording an event needs no lock and no atomic read-modify-write.
+ * The buffers are chained in a list that threads push themselves onto; the
+ * writeout thread drains them and is the only one to unlink and free the
+ * buffer of a thread that has exited.
+ *
+ * Records are written out by that dedicated thread.  The thread waits for
  * records to become available, writes them out, and then waits again.
  */
 static GMutex trace_lock;
@@ -44,15 +47,30 @@ static GCond trace_empty_cond;
 static bool trace_available;
 static bool trace_writeout_enabled;
 
+/* Ring positions are free-running, so the length must be a power of two */
 enum {
-    TRACE_BUF_LEN = 4096 * 64,
+    TRACE_BUF_LEN = 4096 * 16,
     TRACE_BUF_FLUSH_THRESHOLD = TRACE_BUF_LEN / 4,
 };
 
-uint8_t trace_buf[TRACE_BUF_LEN];
-static volatile gint trace_idx;
-static unsigned int writeout_idx;
-static volatile gint dropped_events;
+/* Ring entries start with their size; this bit marks padding up to the end */
+#define TRACE_ENTRY_PAD ((uint64_t)1 << 63)
+
+typedef struct TraceThreadBuf {
+    struct TraceThreadBuf *next;
+    unsigned int head;          /* written by the owner thread */
+    unsigned int reserved;      /* owner thread only */
+    unsigned int tail;          /* written by the writeout thread */
+    unsigned int limit;         /* writeout thread only */
+    unsigned int dropped;       /* written by the owner thread */
+    unsigned int dropped_seen;  /* writeout thread only */
+    bool recording;             /* owner thread only, between start/finish */
+    bool exited;
+    uint8_t data[TRACE_BUF_LEN] QEMU_ALIGNED(8);
+} TraceThreadBuf;
+
+static TraceThreadBuf *trace_bufs;
+static __thread TraceThreadBuf *trace_thread_buf;
 static uint32_t trace_pid;
 static FILE *trace_fp;
 static char *trace_file_name;
@@ -75,54 +93,71 @@ typedef struct {
     uint64_t header_version;  /* HEADER_VERSION  */
 } TraceLogHeader;
 
+static void trace_thread_exit(gpointer opaque)
+{
+    TraceThreadBuf *buf = opaque;
+
+    /* Events traced later on in this thread get a fresh buffer */
+    trace_thread_buf = NULL;
+    qatomic_store_release(&buf->exited, true);
+}
 
-static void read_from_buffer(unsigned int idx, void *dataptr, size_t size);
-static unsigned int write_to_buffer(unsigned int idx, void *dataptr, size_t size);
+static GPrivate trace_thread_key = G_PRIVATE_INIT(trace_thread_exit);
 
-static void clear_buffer_range(unsigned int idx, size_t len)
+static TraceThreadBuf *get_thread_buf(void)
 {
-    uint32_t num = 0;
-    while (num < len) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
-        }
-        trace_buf[idx++] = 0;
-        num++;
+    TraceThreadBuf *buf = trace_thread_buf;
+    TraceThreadBuf *next;
+
+    if (likely(buf)) {
+        return buf;
+    }
+
+    /* don't use g_malloc, can deadlock when traced */
+    buf = calloc(1, sizeof(*buf));
+    if (!buf) {
+        return NULL;
     }
+    g_private_set(&trace_thread_key, buf);
+
+    do {
+        next = qatomic_read(&trace_bufs);
+        buf->next = next;
+    } while (qatomic_cmpxchg(&trace_bufs, next, buf) != next);
+
+    trace_thread_buf = buf;
+    return buf;
 }
+
 /**
- * Read a trace record from the trace buffer
+ * Return the next record of a thread buffer, skipping padding
  *
- * @idx         Trace buffer index
- * @record      Trace record to fill
+ * @buf         Thread buffer, only records up to buf->limit are considered
  *
- * Returns false if the record is not valid.
+ * Returns NULL if there are no more records.
  */
-static bool get_trace_record(unsigned int idx, TraceRecord **recordptr)
+static TraceRecord *peek_trace_record(TraceThreadBuf *buf)
 {
-    uint64_t event_flag = 0;
-    TraceRecord record;
-    /* read the event flag to see if its a valid record */
-    read_from_buffer(idx, &record, sizeof(event_flag));
+    uint64_t size;
 
-    if (!(record.event & TRACE_RECORD_VALID)) {
-        return false;
+    while (buf->tail != buf->limit) {
+        size = *(uint64_t *)&buf->data[buf->tail % TRACE_BUF_LEN];
+        if (!(size & TRACE_ENTRY_PAD)) {
+            return (TraceRecord *)
+                &buf->data[buf->tail % TRACE_BUF_LEN + sizeof(size)];
+        }
+        qatomic_store_release(&buf->tail,
+                              buf->tail + (size & ~TRACE_ENTRY_PAD));
     }
+    return NULL;
+}
 
-    smp_rmb(); /* read memory barrier before accessing record */
-    /* read the record header to know record length */
-    read_from_buffer(idx, &record, sizeof(TraceRecord));
-    *recordptr = malloc(record.length); /* don't use g_malloc, can deadlock when traced */
-    /* make a copy of record to avoid being overwritten */
-    read_from_buffer(idx, *recordptr, record.length);
-    smp_rmb(); /* memory barrier before clearing valid flag */
-    (*recordptr)->event &= ~TRACE_RECORD_VALID;
-    /* clear the trace buffer range for consumed record otherwise any byte
-     * with its MSB set may be considered as a valid event id when the writer
-     * thread crosses this range of buffer again.
-     */
-    clear_buffer_range(idx, record.length);
-    return true;
+static void consume_trace_record(TraceThreadBuf *buf)
+{
+    uint64_t size = *(uint64_t *)&buf->data[buf->tail % TRACE_BUF_LEN];
+
+    /* Let the owner reuse the space only after the record was copied */
+    qatomic_store_release(&buf->tail, buf->tail + size);
 }
 
 /**
@@ -154,128 +189,196 @@ static void wait_for_trace_records_available(void)
     g_mutex_unlock(&trace_lock);
 }
 
-static gpointer writeout_thread(gpointer opaque)
+static void write_dropped_record(void)
 {
-    TraceRecord *recordptr;
     union {
         TraceRecord rec;
         uint8_t bytes[sizeof(TraceRecord) + sizeof(uint64_t)];
     } dropped;
-    unsigned int idx = 0;
-    int dropped_count;
     size_t unused __attribute__ ((unused));
     uint64_t type = TRACE_RECORD_TYPE_EVENT;
+    uint64_t dropped_count = 0;
+    TraceThreadBuf *buf;
+
+    for (buf = qatomic_load_acquire(&trace_bufs); buf; buf = buf->next) {
+        unsigned int count = qatomic_read(&buf->dropped);
+
+        dropped_count += count - buf->dropped_seen;
+        buf->dropped_seen = count;
+    }
+    if (!dropped_count) {
+        return;
+    }
+
+    dropped.rec.event = DROPPED_EVENT_ID;
+    dropped.rec.timestamp_ns = get_clock();
+    dropped.rec.length = sizeof(TraceRecord) + sizeof(uint64_t);
+    dropped.rec.pid = trace_pid;
+    dropped.rec.arguments[0] = dropped_count;
+    unused = fwrite(&type, sizeof(type), 1, trace_fp);
+    unused = fwrite(&dropped.rec, dropped.rec.length, 1, trace_fp);
+}
+
+/*
+ * Write out what the threads have recorded so far.  The per-thread buffers
+ * are merged by timestamp, so that the file stays in chronological order as
+ * far as the records already published allow.
+ */
+static void write_trace_records(void)
+{
+    size_t unused __attribute__ ((unused));
+    uint64_t type = TRACE_RECORD_TYPE_EVENT;
+    TraceThreadBuf *buf, *first;
+
+    first = qatomic_load_acquire(&trace_bufs);
+    for (buf = first; buf; buf = buf->next) {
+        buf->limit = qatomic_load_acquire(&buf->head);
+    }
 
     for (;;) {
-        wait_for_trace_records_available();
+        TraceThreadBuf *best = NULL;
+        TraceRecord *record, *best_record = NULL;
+
+        for (buf = first; buf; buf = buf->next) {
+            record = peek_trace_record(buf);
+            if (record && (!best_record ||
+                           record->timestamp_ns < best_record->timestamp_ns)) {
+                best = buf;
+                best_record = record;
+            }
+        }
+        if (!best) {
+            break;
+        }
 
-        if (g_atomic_int_get(&dropped_events)) {
-            dropped.rec.event = DROPPED_EVENT_ID;
-            dropped.rec.timestamp_ns = get_clock();
-            dropped.rec.length = sizeof(TraceRecord) + sizeof(uint64_t);
-            dropped.rec.pid = trace_pid;
-            do {
-                dropped_count = g_atomic_int_get(&dropped_events);
-            } while (!g_atomic_int_compare_and_exchange(&dropped_events,
-                                                        dropped_count, 0));
-            dropped.rec.arguments[0] = dropped_count;
-            unused = fwrite(&type, sizeof(type), 1, trace_fp);
-            unused = fwrite(&dropped.rec, dropped.rec.length, 1, trace_fp);
+        unused = fwrite(&type, sizeof(type), 1, trace_fp);
+        unused = fwrite(best_record, best_record->length, 1, trace_fp);
+        consume_trace_record(best);
+    }
+}
+
+/* Free the buffers of threads that have exited once they are drained */
+static void reap_thread_bufs(void)
+{
+    TraceThreadBuf **prev = &trace_bufs;
+    TraceThreadBuf *buf;
+
+    while ((buf = qatomic_load_acquire(prev))) {
+        if (!qatomic_load_acquire(&buf->exited) ||
+            buf->tail != qatomic_read(&buf->head)) {
+            prev = &buf->next;
+            continue;
         }
 
-        while (get_trace_record(idx, &recordptr)) {
-            unused = fwrite(&type, sizeof(type), 1, trace_fp);
-            unused = fwrite(recordptr, recordptr->length, 1, trace_fp);
-            writeout_idx += recordptr->length;
-            free(recordptr); /* don't use g_free, can deadlock when traced */
-            idx = writeout_idx % TRACE_BUF_LEN;
+        if (prev != &trace_bufs) {
+            /* Threads only ever push at the head, inner links are ours */
+            *prev = buf->next;
+        } else if (qatomic_cmpxchg(&trace_bufs, buf, buf->next) != buf) {
+            /* A new thread pushed itself meanwhile, buf is now further down */
+            continue;
         }
+        free(buf); /* don't use g_free, can deadlock when traced */
+    }
+}
 
+static gpointer writeout_thread(gpointer opaque)
+{
+    for (;;) {
+        wait_for_trace_records_available();
+
+        write_dropped_record();
+        write_trace_records();
         fflush(trace_fp);
+        reap_thread_bufs();
     }
     return NULL;
 }
 
 void trace_record_write_u64(TraceBufferRecord *rec, uint64_t val)
 {
-    rec->rec_off = write_to_buffer(rec->rec_off, &val, sizeof(uint64_t));
+    memcpy(&trace_thread_buf->data[rec->rec_off], &val, sizeof(val));
+    rec->rec_off += sizeof(val);
 }
 
 void trace_record_write_str(TraceBufferRecord *rec, const char *s, uint32_t slen)
 {
+    uint8_t *p = &trace_thread_buf->data[rec->rec_off];
+
     /* Write string length first */
-    rec->rec_off = write_to_buffer(rec->rec_off, &slen, sizeof(slen));
+    memcpy(p, &slen, sizeof(slen));
     /* Write actual string now */
-    rec->rec_off = write_to_buffer(rec->rec_off, (void*)s, slen);
+    memcpy(p + sizeof(slen), s, slen);
+    rec->rec_off += sizeof(slen) + slen;
 }
 
 int trace_record_start(TraceBufferRecord *rec, uint32_t event, size_t datasize)
 {
-    unsigned int idx, rec_off, old_idx, new_idx;
+    TraceThreadBuf *buf = get_thread_buf();
     uint32_t rec_len = sizeof(TraceRecord) + datasize;
-    uint64_t event_u64 = event;
-    uint64_t timestamp_ns = get_clock();
+    unsigned int size = sizeof(uint64_t) + ROUND_UP(rec_len, sizeof(uint64_t));
+    unsigned int head, idx, pad = 0;
+    TraceRecord *record;
 
-    do {
-        old_idx = g_atomic_int_get(&trace_idx);
-        smp_rmb();
-        new_idx = old_idx + rec_len;
-
-        if (new_idx - writeout_idx > TRACE_BUF_LEN) {
-            /* Trace Buffer Full, Event dropped ! */
-            g_atomic_int_inc(&dropped_events);
-            return -ENOSPC;
-        }
-    } while (!g_atomic_int_compare_and_exchange(&trace_idx, old_idx, new_idx));
+    if (!buf) {
+        return -ENOMEM;
+    }
 
-    idx = old_idx % TRACE_BUF_LEN;
+    /*
+     * A signal handler that traces while this thread is in the middle of
+     * a record would reserve the same space; drop such nested events.
+     */
+    if (buf->recording) {
+        qatomic_set(&buf->dropped, buf->dropped + 1);
+        return -EBUSY;
+    }
+    buf->recording = true;
+    barrier();
+
+    head = buf->head;
+    idx = head % TRACE_BUF_LEN;
+    if (TRACE_BUF_LEN - idx < size) {
+        /* Records are contiguous, skip to the start of the ring */
+        pad = TRACE_BUF_LEN - idx;
+    }
 
-    rec_off = idx;
-    rec_off = write_to_buffer(rec_off, &event_u64, sizeof(event_u64));
-    rec_off = write_to_buffer(rec_off, &timestamp_ns, sizeof(timestamp_ns));
-    rec_off = write_to_buffer(rec_off, &rec_len, sizeof(rec_len));
-    rec_off = write_to_buffer(rec_off, &trace_pid, sizeof(trace_pid));
+    if (size > TRACE_BUF_LEN / 2 ||
+        head + pad + size - qatomic_load_acquire(&buf->tail) > TRACE_BUF_LEN) {
+        /* Trace Buffer Full, Event dropped ! */
+        qatomic_set(&buf->dropped, buf->dropped + 1);
+        barrier();
+        buf->recording = false;
+        return -ENOSPC;
+    }
 
+    if (pad) {
+        *(uint64_t *)&buf->data[idx] = pad | TRACE_ENTRY_PAD;
+        idx = 0;
+    }
+
+    *(uint64_t *)&buf->data[idx] = size;
+    record = (TraceRecord *)&buf->data[idx + sizeof(uint64_t)];
+    record->event = event;
+    record->timestamp_ns = get_clock();
+    record->length = rec_len;
+    record->pid = trace_pid;
+
+    buf->reserved = head + pad + size;
     rec->tbuf_idx = idx;
-    rec->rec_off  = (idx + sizeof(TraceRecord)) % TRACE_BUF_LEN;
+    rec->rec_off = idx + sizeof(uint64_t) + sizeof(TraceRecord);
     return 0;
 }
 
-static void read_from_buffer(unsigned int idx, void *dataptr, size_t size)
+void trace_record_finish(TraceBufferRecord *rec)
 {
-    uint8_t *data_ptr = dataptr;
-    uint32_t x = 0;
-    while (x < size) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
-        }
-        data_ptr[x++] = trace_buf[idx++];
-    }
-}
+    TraceThreadBuf *buf = trace_thread_buf;
 
-static unsigned int write_to_buffer(unsigned int idx, void *dataptr, size_t size)
-{
-    uint8_t *data_ptr = dataptr;
-    uint32_t x = 0;
-    while (x < size) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
-        }
-        trace_buf[idx++] = data_ptr[x++];
-    }
-    return idx; /* most callers wants to know where to write next */
-}
+    /* Publish the record, its contents must be visible first */
+    qatomic_store_release(&buf->head, buf->reserved);
+    barrier();
+    buf->recording = false;
 
-void trace_record_finish(TraceBufferRecord *rec)
-{
-    TraceRecord record;
-    read_from_buffer(rec->tbuf_idx, &record, sizeof(TraceRecord));
-    smp_wmb(); /* write barrier before marking as valid */
-    record.event |= TRACE_RECORD_VALID;
-    write_to_buffer(rec->tbuf_idx, &record, sizeof(TraceRecord));
-
-    if (((unsigned int)g_atomic_int_get(&trace_idx) - writeout_idx)
-        > TRACE_BUF_FLUSH_THRESHOLD) {
+    if (buf->reserved - qatomic_read(&buf->tail) > TRACE_BUF_FLUSH_THRESHOLD &&
+        !qatomic_read(&trace_available)) {
         flush_trace_file(false);
     }
 }
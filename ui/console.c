@@ -522,6 +522,15 @@ win32_pixman_image_destroy(pixman_image_t *image, void *data)
         &error_warn
     );
 }
+#else
+void qemu_displaysurface_set_share_fd(DisplaySurface *surface,
+                                      int fd, uint32_t offset)
+{
+    assert(surface->share_fd < 0);
+
+    surface->share_fd = fd;
+    surface->share_offset = offset;
+}
 #endif
 
 DisplaySurface *qemu_create_displaysurface(int width, int height)
@@ -565,6 +574,8 @@ DisplaySurface *qemu_create_displaysurface_from(int width, int height,
 #ifdef WIN32
     pixman_image_set_destroy_function(surface->image,
                                       win32_pixman_image_destroy, surface);
+#else
+    surface->share_fd = -1;
 #endif
 
     return surface;
@@ -576,6 +587,9 @@ DisplaySurface *qemu_create_displaysurface_pixman(pixman_image_t *image)
 
     trace_displaysurface_create_pixman(surface);
     surface->image = pixman_image_ref(image);
+#ifndef WIN32
+    surface->share_fd = -1;
+#endif
 
     return surface;
 }
@@ -74,6 +74,9 @@ struct _DBusDisplayListener {
     bool ds_mapped;
     bool can_share_map;
 
+#ifdef G_OS_UNIX
+    QemuDBusDisplay1ListenerUnixMap *map_proxy;
+#endif
 #ifdef WIN32
     QemuDBusDisplay1ListenerWin32Map *map_proxy;
     QemuDBusDisplay1ListenerWin32D3d11 *d3d11_proxy;
@@ -294,6 +297,51 @@ static void dbus_scanout_dmabuf(DisplayChangeListener *dcl,
 #endif /* GBM */
 #endif /* OPENGL */
 
+#ifdef G_OS_UNIX
+static bool dbus_scanout_map(DBusDisplayListener *ddl)
+{
+    g_autoptr(GError) err = NULL;
+    g_autoptr(GUnixFDList) fd_list = NULL;
+
+    if (ddl->ds_share == SHARE_KIND_MAPPED) {
+        return true;
+    }
+
+    if (!ddl->can_share_map || ddl->ds->share_fd < 0) {
+        return false;
+    }
+
+    fd_list = g_unix_fd_list_new();
+    if (g_unix_fd_list_append(fd_list, ddl->ds->share_fd, &err) != 0) {
+        g_debug("Failed to setup scanout map fdlist: %s", err->message);
+        return false;
+    }
+
+    if (!qemu_dbus_display1_listener_unix_map_call_scanout_map_sync(
+            ddl->map_proxy,
+            g_variant_new_handle(0),
+            ddl->ds->share_offset,
+            surface_width(ddl->ds),
+            surface_height(ddl->ds),
+            surface_stride(ddl->ds),
+            surface_format(ddl->ds),
+            G_DBUS_CALL_FLAGS_NONE,
+            DBUS_DEFAULT_TIMEOUT,
+            fd_list,
+            NULL,
+            NULL,
+            &err)) {
+        g_debug("Failed to call ScanoutMap: %s", err->message);
+        ddl->can_share_map = false;
+        return false;
+    }
+
+    ddl->ds_share = SHARE_KIND_MAPPED;
+
+    return true;
+}
+#endif
+
 #ifdef WIN32
 static bool dbus_scanout_map(DBusDisplayListener *ddl)
 {
@@ -640,6 +688,16 @@ static void dbus_gfx_update(DisplayChangeListener *dcl,
 
     trace_dbus_update(x, y, w, h);
 
+#ifdef G_OS_UNIX
+    if (dbus_scanout_map(ddl)) {
+        qemu_dbus_display1_listener_unix_map_call_update_map(
+            ddl->map_proxy,
+            x, y, w, h,
+            G_DBUS_CALL_FLAGS_NONE,
+            DBUS_DEFAULT_TIMEOUT, NULL, NULL, NULL);
+        return;
+    }
+#endif
 #ifdef WIN32
     if (dbus_scanout_map(ddl)) {
         qemu_dbus_display1_listener_win32_map_call_update_map(
@@ -781,6 +839,9 @@ dbus_display_listener_dispose(GObject *object)
     g_clear_object(&ddl->conn);
     g_clear_pointer(&ddl->bus_name, g_free);
     g_clear_object(&ddl->proxy);
+#ifdef G_OS_UNIX
+    g_clear_object(&ddl->map_proxy);
+#endif
 #ifdef WIN32
     g_clear_object(&ddl->map_proxy);
     g_clear_object(&ddl->d3d11_proxy);
@@ -960,6 +1021,33 @@ dbus_display_listener_setup_shared_map(DBusDisplayListener *ddl)
         return;
     }
 
+    ddl->can_share_map = true;
+#elif defined(G_OS_UNIX)
+    g_autoptr(GError) err = NULL;
+
+    if (!dbus_display_listener_implements(ddl,
+            "org.qemu.Display1.Listener.Unix.Map")) {
+        return;
+    }
+
+    if (!(g_dbus_connection_get_capabilities(ddl->conn) &
+          G_DBUS_CAPABILITY_FLAGS_UNIX_FD_PASSING)) {
+        g_debug("The listener connection does not pass FDs");
+        return;
+    }
+
+    ddl->map_proxy =
+        qemu_dbus_display1_listener_unix_map_proxy_new_sync(ddl->conn,
+            G_DBUS_PROXY_FLAGS_DO_NOT_AUTO_START,
+            NULL,
+            "/org/qemu/Display1/Listener",
+            NULL,
+            &err);
+    if (!ddl->map_proxy) {
+        g_debug("Failed to setup Unix map proxy: %s", err->message);
+        return;
+    }
+
     ddl->can_share_map = true;
 #endif
 }
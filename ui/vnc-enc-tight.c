@@ -816,6 +816,24 @@ static int tight_init_stream(VncState *vs, int stream_id,
     return 0;
 }
 
+/*
+ * Rectangles encoded in parallel go out in no fixed order, so they cannot
+ * share zlib dictionaries: start every stream afresh on both sides.
+ * Returns the reset bits for the compression control byte.
+ */
+static int tight_reset_stream(VncState *vs, int stream_id)
+{
+    z_streamp zstream = &vs->tight->stream[stream_id];
+
+    if (!vs->tight->reset_streams) {
+        return 0;
+    }
+    if (zstream->opaque != NULL) {
+        deflateReset(zstream);
+    }
+    return 1 << stream_id;
+}
+
 static void tight_send_compact_size(VncState *vs, size_t len)
 {
     int lpc = 0;
@@ -925,7 +943,8 @@ static int send_full_color_rect(VncState *vs, int x, int y, int w, int h)
     }
 #endif
 
-    vnc_write_u8(vs, stream << 4); /* no flushing, no filter */
+    /* no filter */
+    vnc_write_u8(vs, (stream << 4) | tight_reset_stream(vs, stream));
 
     if (vs->tight->pixel24) {
         tight_pack24(vs, vs->tight->tight.buffer, w * h,
@@ -982,7 +1001,8 @@ static int send_mono_rect(VncState *vs, int x, int y,
 
     bytes = DIV_ROUND_UP(w, 8) * h;
 
-    vnc_write_u8(vs, (stream | VNC_TIGHT_EXPLICIT_FILTER) << 4);
+    vnc_write_u8(vs, ((stream | VNC_TIGHT_EXPLICIT_FILTER) << 4) |
+                 tight_reset_stream(vs, stream));
     vnc_write_u8(vs, VNC_TIGHT_FILTER_PALETTE);
     vnc_write_u8(vs, 1);
 
@@ -1048,7 +1068,8 @@ static bool send_gradient_rect(VncState *vs, int x, int y, int w, int h)
         return send_full_color_rect(vs, x, y, w, h);
     }
 
-    vnc_write_u8(vs, (stream | VNC_TIGHT_EXPLICIT_FILTER) << 4);
+    vnc_write_u8(vs, ((stream | VNC_TIGHT_EXPLICIT_FILTER) << 4) |
+                 tight_reset_stream(vs, stream));
     vnc_write_u8(vs, VNC_TIGHT_FILTER_GRADIENT);
 
     buffer_reserve(&vs->tight->gradient, w * 3 * sizeof(int));
@@ -1090,7 +1111,8 @@ static int send_palette_rect(VncState *vs, int x, int y,
 
     colors = palette_size(palette);
 
-    vnc_write_u8(vs, (stream | VNC_TIGHT_EXPLICIT_FILTER) << 4);
+    vnc_write_u8(vs, ((stream | VNC_TIGHT_EXPLICIT_FILTER) << 4) |
+                 tight_reset_stream(vs, stream));
     vnc_write_u8(vs, VNC_TIGHT_FILTER_PALETTE);
     vnc_write_u8(vs, colors - 1);
 
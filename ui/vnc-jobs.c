@@ -51,6 +51,11 @@
  * its own output buffer.
  * When the encoding job is done, the worker thread will hold the output lock
  * and copy its output buffer in vs->output.
+ *
+ * With encode-threads > 1 the worker hands some of the rectangles of a job
+ * to encoder threads while it holds the display lock.  Each of them has its
+ * own output buffer and tight state, and the worker appends their output to
+ * its own once they are all done.
  */
 
 struct VncJobQueue {
@@ -69,6 +74,21 @@ typedef struct VncJobQueue VncJobQueue;
  */
 static VncJobQueue *queue;
 
+typedef struct VncEncoder {
+    QemuThread thread;
+    QemuSemaphore start;
+    VncState vs;
+    VncTight tight;
+    VncJob *job;
+    int index;
+    int stride;
+    int n_rectangles;
+} VncEncoder;
+
+static VncEncoder *encoders[VNC_ENCODE_THREADS_MAX - 1];
+static int nr_encoders;
+static QemuSemaphore encoders_done;
+
 static void vnc_lock_queue(VncJobQueue *queue)
 {
     qemu_mutex_lock(&queue->mutex);
@@ -176,9 +196,8 @@ void vnc_jobs_consume_buffer(VncState *vs)
 /*
  * Copy data for local use
  */
-static void vnc_async_encoding_start(VncState *orig, VncState *local)
+static void vnc_async_encoding_copy(VncState *orig, VncState *local)
 {
-    buffer_init(&local->output, "vnc-worker-output");
     local->sioc = NULL; /* Don't do any network work on this thread */
     local->ioc = NULL; /* Don't do any network work on this thread */
 
@@ -189,14 +208,21 @@ static void vnc_async_encoding_start(VncState *orig, VncState *local)
     local->write_pixels = orig->write_pixels;
     local->client_pf = orig->client_pf;
     local->client_be = orig->client_be;
-    local->tight = orig->tight;
-    local->zlib = orig->zlib;
     local->hextile = orig->hextile;
-    local->zrle = orig->zrle;
     local->client_width = orig->client_width;
     local->client_height = orig->client_height;
 }
 
+static void vnc_async_encoding_start(VncState *orig, VncState *local)
+{
+    buffer_init(&local->output, "vnc-worker-output");
+    vnc_async_encoding_copy(orig, local);
+
+    local->tight = orig->tight;
+    local->zlib = orig->zlib;
+    local->zrle = orig->zrle;
+}
+
 static void vnc_async_encoding_end(VncState *orig, VncState *local)
 {
     buffer_free(&local->output);
@@ -235,6 +261,111 @@ static bool vnc_worker_clamp_rect(VncState *vs, VncJob *job, VncRect *rect)
     return false;
 }
 
+static int vnc_encode_rects(VncState *vs, VncJob *job, int index, int stride)
+{
+    VncRectEntry *entry;
+    int n_rectangles = 0;
+    int i = 0;
+
+    QLIST_FOREACH(entry, &job->rectangles, next) {
+        if (i++ % stride == index) {
+            int n = vnc_send_framebuffer_update(vs, entry->rect.x,
+                                                entry->rect.y,
+                                                entry->rect.w,
+                                                entry->rect.h);
+
+            if (n >= 0) {
+                n_rectangles += n;
+            }
+        }
+    }
+    return n_rectangles;
+}
+
+static void *vnc_encoder_thread(void *arg)
+{
+    VncEncoder *enc = arg;
+
+    for (;;) {
+        qemu_sem_wait(&enc->start);
+        enc->n_rectangles = vnc_encode_rects(&enc->vs, enc->job,
+                                             enc->index, enc->stride);
+        qemu_sem_post(&encoders_done);
+    }
+    return NULL;
+}
+
+static void vnc_start_encoders(int n)
+{
+    while (nr_encoders < n) {
+        VncEncoder *enc = g_new0(VncEncoder, 1);
+
+        qemu_sem_init(&enc->start, 0);
+        buffer_init(&enc->vs.output, "vnc-encoder-output");
+        enc->vs.tight = &enc->tight;
+        enc->vs.magic = VNC_MAGIC;
+        enc->tight.reset_streams = true;
+        qemu_thread_create(&enc->thread, "vnc_encoder", vnc_encoder_thread,
+                           enc, QEMU_THREAD_DETACHED);
+        encoders[nr_encoders++] = enc;
+    }
+}
+
+/* How many threads, the worker included, should encode @nrects rectangles */
+static int vnc_encode_stride(VncState *vs, int nrects)
+{
+    switch (vs->vnc_encoding) {
+    case VNC_ENCODING_ZLIB:
+    case VNC_ENCODING_ZRLE:
+    case VNC_ENCODING_ZYWRLE:
+        /* A single zlib stream that the client never resets */
+        return 1;
+    default:
+        return MAX(MIN(vs->vd->encode_threads, nrects), 1);
+    }
+}
+
+/*
+ * Encode the rectangles of @job into @vs, spreading them round-robin over
+ * @stride threads.  The rectangles don't overlap, so the order in which
+ * they reach the client does not matter.  The only state the encoders
+ * share is vs->lossy_rect, where they all just set flags.
+ */
+static int vnc_encode_job(VncState *vs, VncJob *job, int stride)
+{
+    int n_rectangles;
+    int i;
+
+    vnc_start_encoders(stride - 1);
+    for (i = 0; i < stride - 1; i++) {
+        VncEncoder *enc = encoders[i];
+
+        vnc_async_encoding_copy(vs, &enc->vs);
+        enc->tight.type = vs->tight->type;
+        enc->tight.quality = vs->tight->quality;
+        enc->tight.compression = vs->tight->compression;
+        enc->tight.pixel24 = vs->tight->pixel24;
+        enc->job = job;
+        enc->index = i + 1;
+        enc->stride = stride;
+        qemu_sem_post(&enc->start);
+    }
+
+    n_rectangles = vnc_encode_rects(vs, job, 0, stride);
+
+    for (i = 0; i < stride - 1; i++) {
+        qemu_sem_wait(&encoders_done);
+    }
+    for (i = 0; i < stride - 1; i++) {
+        VncEncoder *enc = encoders[i];
+
+        vnc_write(vs, enc->vs.output.buffer, enc->vs.output.offset);
+        buffer_reset(&enc->vs.output);
+        n_rectangles += enc->n_rectangles;
+    }
+    return n_rectangles;
+}
+
 static int vnc_worker_thread_loop(VncJobQueue *queue)
 {
     VncJob *job;
@@ -242,6 +373,7 @@ static int vnc_worker_thread_loop(VncJobQueue *queue)
     VncState vs = {};
     int n_rectangles;
     int saved_offset;
+    int nrects = 0;
 
     vnc_lock_queue(queue);
     while (QTAILQ_EMPTY(&queue->jobs) && !queue->exit) {
@@ -285,8 +417,6 @@ static int vnc_worker_thread_loop(VncJobQueue *queue)
 
     vnc_lock_display(job->vs->vd);
     QLIST_FOREACH_SAFE(entry, &job->rectangles, next, tmp) {
-        int n;
-
         if (job->vs->ioc == NULL) {
             vnc_unlock_display(job->vs->vd);
             /* Copy persistent encoding data */
@@ -295,13 +425,21 @@ static int vnc_worker_thread_loop(VncJobQueue *queue)
         }
 
         if (vnc_worker_clamp_rect(&vs, job, &entry->rect)) {
-            n = vnc_send_framebuffer_update(&vs, entry->rect.x, entry->rect.y,
-                                            entry->rect.w, entry->rect.h);
-
-            if (n >= 0) {
-                n_rectangles += n;
-            }
+            nrects++;
+        } else {
+            QLIST_REMOVE(entry, next);
+            g_free(entry);
         }
+    }
+
+    /*
+     * Encoder threads may take any rectangle, so the client must never
+     * rely on a zlib dictionary left by an earlier one.
+     */
+    vs.tight->reset_streams = vs.vd->encode_threads > 1;
+    n_rectangles = vnc_encode_job(&vs, job, vnc_encode_stride(&vs, nrects));
+
+    QLIST_FOREACH_SAFE(entry, &job->rectangles, next, tmp) {
         g_free(entry);
     }
     trace_vnc_job_nrects(&vs, job, n_rectangles);
@@ -376,6 +514,7 @@ void vnc_start_worker_thread(void)
     if (vnc_worker_thread_running())
         return;
 
+    qemu_sem_init(&encoders_done, 0);
     q = vnc_queue_init();
     qemu_thread_create(&q->thread, "vnc_worker", vnc_worker_thread, q,
                        QEMU_THREAD_DETACHED);
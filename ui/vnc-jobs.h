@@ -30,6 +30,8 @@
 #ifndef VNC_JOBS_H
 #define VNC_JOBS_H
 
+#define VNC_ENCODE_THREADS_MAX 16
+
 /* Jobs */
 VncJob *vnc_job_new(VncState *vs);
 int vnc_job_add_rect(VncJob *job, int x, int y, int w, int h);
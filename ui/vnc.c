@@ -3092,6 +3092,45 @@ static void vnc_rect_updated(VncDisplay *vd, int x, int y, struct timeval * tv)
     rect->updated = true;
 }
 
+/*
+ * Compare and copy the cells of one guest dirty bitmap word, where @x is
+ * the first cell of the word.  Each run of adjacent dirty cells is first
+ * compared with a single memcmp, which is all an idle desktop needs; only
+ * a run that changed is looked at cell by cell.  Returns the mask of the
+ * cells that changed.
+ */
+static unsigned long vnc_refresh_cells(uint8_t *server_row,
+                                       uint8_t *guest_row,
+                                       unsigned long dirty, int x,
+                                       int cmp_bytes, int line_bytes)
+{
+    unsigned long changed = 0;
+
+    while (dirty) {
+        int start = ctzl(dirty);
+        int len = ctol(dirty >> start);
+        int begin = (x + start) * cmp_bytes;
+        int end = MIN((x + start + len) * cmp_bytes, line_bytes);
+        int i;
+
+        dirty &= ~(BITMAP_LAST_WORD_MASK(len) << start);
+        assert(end >= begin);
+        if (memcmp(server_row + begin, guest_row + begin, end - begin) == 0) {
+            continue;
+        }
+
+        for (i = start; i < start + len; i++, begin += cmp_bytes) {
+            int n = MIN(cmp_bytes, end - begin);
+
+            if (memcmp(server_row + begin, guest_row + begin, n) != 0) {
+                memcpy(server_row + begin, guest_row + begin, n);
+                changed |= 1UL << i;
+            }
+        }
+    }
+    return changed;
+}
+
 static int vnc_refresh_server_surface(VncDisplay *vd)
 {
     int width = MIN(pixman_image_get_width(vd->guest.fb),
@@ -3104,7 +3143,8 @@ static int vnc_refresh_server_surface(VncDisplay *vd)
     int has_dirty = 0;
     pixman_image_t *tmpbuf = NULL;
     unsigned long offset;
-    int x;
+    int cells = DIV_ROUND_UP(width, VNC_DIRTY_PIXELS_PER_BIT);
+    int w;
     uint8_t *guest_ptr, *server_ptr;
 
     struct timeval tv = { 0, 0 };
@@ -3146,9 +3186,8 @@ static int vnc_refresh_server_surface(VncDisplay *vd)
 
     for (;;) {
         y = offset / VNC_DIRTY_BPL(&vd->guest);
-        x = offset % VNC_DIRTY_BPL(&vd->guest);
 
-        server_ptr = server_row0 + y * server_stride + x * cmp_bytes;
+        server_ptr = server_row0 + y * server_stride;
 
         if (vd->guest.format != VNC_SERVER_FB_FORMAT) {
             qemu_pixman_linebuf_fill(tmpbuf, vd->guest.fb, width, 0, y);
@@ -3156,30 +3195,42 @@ static int vnc_refresh_server_surface(VncDisplay *vd)
         } else {
             guest_ptr = guest_row0 + y * guest_stride;
         }
-        guest_ptr += x * cmp_bytes;
 
-        for (; x < DIV_ROUND_UP(width, VNC_DIRTY_PIXELS_PER_BIT);
-             x++, guest_ptr += cmp_bytes, server_ptr += cmp_bytes) {
-            int _cmp_bytes = cmp_bytes;
-            if (!test_and_clear_bit(x, vd->guest.dirty[y])) {
-                continue;
+        /* Handle a whole bitmap word, i.e. BITS_PER_LONG cells, at a time */
+        for (w = offset % VNC_DIRTY_BPL(&vd->guest) / BITS_PER_LONG;
+             w * BITS_PER_LONG < cells; w++) {
+            unsigned long dirty = vd->guest.dirty[y][w];
+            unsigned long changed;
+
+            if ((w + 1) * BITS_PER_LONG > cells) {
+                dirty &= BITMAP_LAST_WORD_MASK(cells);
             }
-            if ((x + 1) * cmp_bytes > line_bytes) {
-                _cmp_bytes = line_bytes - x * cmp_bytes;
+            if (!dirty) {
+                continue;
             }
-            assert(_cmp_bytes >= 0);
-            if (memcmp(server_ptr, guest_ptr, _cmp_bytes) == 0) {
+            vd->guest.dirty[y][w] &= ~dirty;
+
+            changed = vnc_refresh_cells(server_ptr, guest_ptr, dirty,
+                                        w * BITS_PER_LONG, cmp_bytes,
+                                        line_bytes);
+            if (!changed) {
                 continue;
             }
-            memcpy(server_ptr, guest_ptr, _cmp_bytes);
             if (!vd->non_adaptive) {
-                vnc_rect_updated(vd, x * VNC_DIRTY_PIXELS_PER_BIT,
-                                 y, &tv);
+                unsigned long bits = changed;
+
+                while (bits) {
+                    int x = w * BITS_PER_LONG + ctzl(bits);
+
+                    vnc_rect_updated(vd, x * VNC_DIRTY_PIXELS_PER_BIT,
+                                     y, &tv);
+                    bits &= bits - 1;
+                }
             }
             QTAILQ_FOREACH(vs, &vd->clients, next) {
-                set_bit(x, vs->dirty[y]);
+                vs->dirty[y][w] |= changed;
             }
-            has_dirty++;
+            has_dirty += ctpopl(changed);
         }
 
         y++;
@@ -3590,6 +3641,9 @@ static QemuOptsList qemu_vnc_opts = {
         },{
             .name = "power-control",
             .type = QEMU_OPT_BOOL,
+        },{
+            .name = "encode-threads",
+            .type = QEMU_OPT_NUMBER,
         },
         { /* end of list */ }
     },
@@ -4148,6 +4202,14 @@ void vnc_display_open(const char *id, Error **errp)
 
     vd->power_control = qemu_opt_get_bool(opts, "power-control", false);
 
+    vd->encode_threads = qemu_opt_get_number(opts, "encode-threads", 1);
+    if (vd->encode_threads < 1 ||
+        vd->encode_threads > VNC_ENCODE_THREADS_MAX) {
+        error_setg(errp, "encode-threads must be between 1 and %d",
+                   VNC_ENCODE_THREADS_MAX);
+        goto fail;
+    }
+
     if (tlsauthz) {
         vd->tlsauthzid = g_strdup(tlsauthz);
     }
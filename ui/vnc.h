@@ -178,6 +178,7 @@ struct VncDisplay
     bool lossy;
     bool non_adaptive;
     bool power_control;
+    int encode_threads;
     QCryptoTLSCreds *tlscreds;
     QAuthZ *tlsauthz;
     char *tlsauthzid;
@@ -205,6 +206,7 @@ typedef struct VncTight {
 #endif
     int levels[4];
     z_stream stream[4];
+    bool reset_streams;
 } VncTight;
 
 typedef struct VncHextile {
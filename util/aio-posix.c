@@ -21,6 +21,7 @@
 #include "qemu/rcu_queue.h"
 #include "qemu/sockets.h"
 #include "qemu/cutils.h"
+#include "qapi/error.h"
 #include "trace.h"
 #include "aio-posix.h"
 
@@ -148,6 +149,7 @@ void aio_set_fd_handler(AioContext *ctx,
             new_node->pfd.fd = fd;
         } else {
             new_node->pfd = node->pfd;
+            new_node->poll_ns = node->poll_ns;
         }
         g_source_add_poll(&ctx->source, &new_node->pfd);
 
@@ -428,9 +430,15 @@ void aio_dispatch(AioContext *ctx)
     timerlistgroup_run_timers(&ctx->tlg);
 }
 
+static bool fdmon_supports_polling(AioContext *ctx)
+{
+    return ctx->fdmon_ops->need_wait != aio_poll_disabled;
+}
+
 static bool run_poll_handlers_once(AioContext *ctx,
                                    AioHandlerList *ready_list,
                                    int64_t now,
+                                   int64_t elapsed_time,
                                    int64_t *timeout)
 {
     bool progress = false;
@@ -438,6 +446,15 @@ static bool run_poll_handlers_once(AioContext *ctx,
     AioHandler *tmp;
 
     QLIST_FOREACH_SAFE(node, &ctx->poll_aio_handlers, node_poll, tmp) {
+        /*
+         * Stop polling handlers whose own polling time has passed.  With
+         * fdmon implementations that check fds while polling, their events
+         * are still noticed through ->need_wait().
+         */
+        if (elapsed_time > node->poll_ns && fdmon_supports_polling(ctx)) {
+            continue;
+        }
+
         if (node->io_poll(node->opaque)) {
             aio_add_poll_ready_handler(ready_list, node);
 
@@ -459,11 +476,6 @@ static bool run_poll_handlers_once(AioContext *ctx,
     return progress;
 }
 
-static bool fdmon_supports_polling(AioContext *ctx)
-{
-    return ctx->fdmon_ops->need_wait != aio_poll_disabled;
-}
-
 static bool remove_idle_poll_handlers(AioContext *ctx,
                                       AioHandlerList *ready_list,
                                       int64_t now)
@@ -540,14 +552,18 @@ static bool run_poll_handlers(AioContext *ctx, AioHandlerList *ready_list,
     RCU_READ_LOCK_GUARD();
 
     start_time = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    elapsed_time = 0;
     do {
-        progress = run_poll_handlers_once(ctx, ready_list,
-                                          start_time, timeout);
+        progress = run_poll_handlers_once(ctx, ready_list, start_time,
+                                          elapsed_time, timeout);
         elapsed_time = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start_time;
         max_ns = qemu_soonest_timeout(*timeout, max_ns);
         assert(!(max_ns && progress));
     } while (elapsed_time < max_ns && !ctx->fdmon_ops->need_wait(ctx));
 
+    stat64_add(progress ? &ctx->poll_hits : &ctx->poll_misses, 1);
+    stat64_add(&ctx->poll_time_ns, elapsed_time);
+
     if (remove_idle_poll_handlers(ctx, ready_list,
                                   start_time + elapsed_time)) {
         *timeout = 0;
@@ -578,12 +594,24 @@ static bool run_poll_handlers(AioContext *ctx, AioHandlerList *ready_list,
 static bool try_poll_mode(AioContext *ctx, AioHandlerList *ready_list,
                           int64_t *timeout)
 {
-    int64_t max_ns;
+    AioHandler *node;
+    int64_t max_ns = 0;
+    int n = 0;
 
     if (QLIST_EMPTY_RCU(&ctx->poll_aio_handlers)) {
+        qatomic_set(&ctx->poll_handlers, 0);
         return false;
     }
 
+    /* Poll for as long as the handler that benefits most from it */
+    QLIST_FOREACH(node, &ctx->poll_aio_handlers, node_poll) {
+        max_ns = MAX(max_ns, node->poll_ns);
+        n++;
+    }
+    ctx->poll_ns = MIN(max_ns, ctx->poll_max_ns);
+    stat64_set(&ctx->poll_window_ns, ctx->poll_ns);
+    qatomic_set(&ctx->poll_handlers, n);
+
     max_ns = qemu_soonest_timeout(*timeout, ctx->poll_ns);
     if (max_ns && !ctx->fdmon_ops->need_wait(ctx)) {
         /*
@@ -599,6 +627,51 @@ static bool try_poll_mode(AioContext *ctx, AioHandlerList *ready_list,
     return false;
 }
 
+/*
+ * Adjust the polling time of @node, given that aio_poll() took @block_ns to
+ * find it ready.  Handlers adapt separately so that a busy handler does not
+ * keep quiet ones in the polling loop.
+ */
+static void adjust_polling_time(AioContext *ctx, AioHandler *node,
+                                int64_t block_ns)
+{
+    if (block_ns <= node->poll_ns) {
+        /* This is the sweet spot, no adjustment needed */
+    } else if (block_ns > ctx->poll_max_ns) {
+        /* We'd have to poll for too long, poll less */
+        int64_t old = node->poll_ns;
+
+        if (ctx->poll_shrink) {
+            node->poll_ns /= ctx->poll_shrink;
+        } else {
+            node->poll_ns = 0;
+        }
+
+        trace_poll_shrink(ctx, node, old, node->poll_ns);
+    } else if (node->poll_ns < ctx->poll_max_ns &&
+               block_ns < ctx->poll_max_ns) {
+        /* There is room to grow, poll longer */
+        int64_t old = node->poll_ns;
+        int64_t grow = ctx->poll_grow;
+
+        if (grow == 0) {
+            grow = 2;
+        }
+
+        if (node->poll_ns) {
+            node->poll_ns *= grow;
+        } else {
+            node->poll_ns = 4000; /* start polling at 4 microseconds */
+        }
+
+        if (node->poll_ns > ctx->poll_max_ns) {
+            node->poll_ns = ctx->poll_max_ns;
+        }
+
+        trace_poll_grow(ctx, node, old, node->poll_ns);
+    }
+}
+
 bool aio_poll(AioContext *ctx, bool blocking)
 {
     AioHandlerList ready_list = QLIST_HEAD_INITIALIZER(ready_list);
@@ -681,41 +754,29 @@ bool aio_poll(AioContext *ctx, bool blocking)
     /* Adjust polling time */
     if (ctx->poll_max_ns) {
         int64_t block_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start;
+        AioHandler *node;
 
-        if (block_ns <= ctx->poll_ns) {
-            /* This is the sweet spot, no adjustment needed */
-        } else if (block_ns > ctx->poll_max_ns) {
-            /* We'd have to poll for too long, poll less */
-            int64_t old = ctx->poll_ns;
-
-            if (ctx->poll_shrink) {
-                ctx->poll_ns /= ctx->poll_shrink;
-            } else {
-                ctx->poll_ns = 0;
-            }
-
-            trace_poll_shrink(ctx, old, ctx->poll_ns);
-        } else if (ctx->poll_ns < ctx->poll_max_ns &&
-                   block_ns < ctx->poll_max_ns) {
-            /* There is room to grow, poll longer */
-            int64_t old = ctx->poll_ns;
-            int64_t grow = ctx->poll_grow;
-
-            if (grow == 0) {
-                grow = 2;
-            }
-
-            if (ctx->poll_ns) {
-                ctx->poll_ns *= grow;
-            } else {
-                ctx->poll_ns = 4000; /* start polling at 4 microseconds */
+        QLIST_FOREACH(node, &ready_list, node_ready) {
+            if (node->io_poll) {
+                adjust_polling_time(ctx, node, block_ns);
             }
+        }
 
-            if (ctx->poll_ns > ctx->poll_max_ns) {
-                ctx->poll_ns = ctx->poll_max_ns;
+        /*
+         * Handlers that stayed quiet for longer than polling could ever
+         * cover would not have gained anything from it, poll them less.
+         */
+        if (block_ns > ctx->poll_max_ns) {
+            QLIST_FOREACH(node, &ctx->poll_aio_handlers, node_poll) {
+                if (!QLIST_IS_INSERTED(node, node_ready)) {
+                    adjust_polling_time(ctx, node, block_ns);
+                }
             }
+        }
 
-            trace_poll_grow(ctx, old, ctx->poll_ns);
+        if (blocking) {
+            stat64_add(&ctx->waits, 1);
+            stat64_add(&ctx->wait_time_ns, block_ns);
         }
     }
 
@@ -787,3 +848,13 @@ void aio_context_set_aio_params(AioContext *ctx, int64_t max_batch)
 
     aio_notify(ctx);
 }
+
+bool aio_context_enable_sqpoll(AioContext *ctx, int cpu, Error **errp)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    return fdmon_io_uring_enable_sqpoll(ctx, cpu, errp);
+#else
+    error_setg(errp, "io_uring SQPOLL requires io_uring support");
+    return false;
+#endif
+}
@@ -37,6 +37,7 @@ struct AioHandler {
     unsigned flags; /* see fdmon-io_uring.c */
 #endif
     int64_t poll_idle_timeout; /* when to stop userspace polling */
+    int64_t poll_ns; /* polling time for this handler, in nanoseconds */
     bool poll_ready; /* has polling detected an event? */
 };
 
@@ -67,6 +68,7 @@ static inline void fdmon_epoll_disable(AioContext *ctx)
 
 #ifdef CONFIG_LINUX_IO_URING
 bool fdmon_io_uring_setup(AioContext *ctx);
+bool fdmon_io_uring_enable_sqpoll(AioContext *ctx, int cpu, Error **errp);
 void fdmon_io_uring_destroy(AioContext *ctx);
 #else
 static inline bool fdmon_io_uring_setup(AioContext *ctx)
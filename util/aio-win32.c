@@ -441,3 +441,9 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
 void aio_context_set_aio_params(AioContext *ctx, int64_t max_batch)
 {
 }
+
+bool aio_context_enable_sqpoll(AioContext *ctx, int cpu, Error **errp)
+{
+    error_setg(errp, "io_uring SQPOLL is not implemented on Windows");
+    return false;
+}
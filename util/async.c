@@ -609,6 +609,12 @@ AioContext *aio_context_new(Error **errp)
     timerlistgroup_init(&ctx->tlg, aio_timerlist_notify, ctx);
 
     ctx->poll_ns = 0;
+    stat64_init(&ctx->poll_window_ns, 0);
+    stat64_init(&ctx->poll_hits, 0);
+    stat64_init(&ctx->poll_misses, 0);
+    stat64_init(&ctx->poll_time_ns, 0);
+    stat64_init(&ctx->waits, 0);
+    stat64_init(&ctx->wait_time_ns, 0);
     ctx->poll_max_ns = 0;
     ctx->poll_grow = 0;
     ctx->poll_shrink = 0;
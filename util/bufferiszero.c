@@ -203,6 +203,46 @@ buffer_zero_avx512(const void *buf, size_t len)
 # define INIT_ACCEL    buffer_zero_sse2
 #endif
 
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+
+/* Note that this requires len >= 64, like the x86 functions above.  */
+
+static bool buffer_zero_neon(const void *buf, size_t len)
+{
+    uint64x2_t t = vld1q_u64(buf);
+    uint64x2_t *p = (uint64x2_t *)(((uintptr_t)buf + 5 * 16) & -16);
+    uint64x2_t *e = (uint64x2_t *)(((uintptr_t)buf + len) & -16);
+
+    /* Loop over 16-byte aligned blocks of 64.  */
+    while (likely(p <= e)) {
+        __builtin_prefetch(p);
+        /* Whatever the maximum is, it is only zero if all bytes are.  */
+        if (unlikely(vmaxvq_u32(vreinterpretq_u32_u64(t)) != 0)) {
+            return false;
+        }
+        t = p[-4] | p[-3] | p[-2] | p[-1];
+        p += 4;
+    }
+
+    /* Finish the aligned tail.  */
+    t |= e[-3];
+    t |= e[-2];
+    t |= e[-1];
+
+    /* Finish the unaligned tail.  */
+    t |= vld1q_u64(buf + len - 16);
+
+    return vmaxvq_u32(vreinterpretq_u32_u64(t)) == 0;
+}
+
+# define INIT_USED     0
+# define INIT_LENGTH   0
+# define INIT_ACCEL    buffer_zero_int
+#endif
+
+#ifdef INIT_ACCEL
+
 static unsigned used_accel = INIT_USED;
 static unsigned length_to_accel = INIT_LENGTH;
 static bool (*buffer_accel)(const void *, size_t) = INIT_ACCEL;
@@ -223,7 +263,11 @@ select_accel_cpuinfo(unsigned info)
         { CPUINFO_AVX2,    128, buffer_zero_avx2 },
         { CPUINFO_SSE4,     64, buffer_zero_sse4 },
 #endif
+#ifdef __aarch64__
+        { CPUINFO_ASIMD,    64, buffer_zero_neon },
+#else
         { CPUINFO_SSE2,     64, buffer_zero_sse2 },
+#endif
         { CPUINFO_ALWAYS,    0, buffer_zero_int },
     };
 
@@ -237,7 +281,8 @@ select_accel_cpuinfo(unsigned info)
     return 0;
 }
 
-#if defined(CONFIG_AVX512F_OPT) || defined(CONFIG_AVX2_OPT)
+#if defined(CONFIG_AVX512F_OPT) || defined(CONFIG_AVX2_OPT) || \
+    defined(__aarch64__)
 static void __attribute__((constructor)) init_accel(void)
 {
     used_accel = select_accel_cpuinfo(cpuinfo_init());
@@ -16,6 +16,19 @@
 # ifndef HWCAP2_BTI
 #  define HWCAP2_BTI 0  /* added in glibc 2.32 */
 # endif
+# ifndef HWCAP_SVE
+#  define HWCAP_SVE (1 << 22)
+# endif
+# ifndef HWCAP2_SVE2
+#  define HWCAP2_SVE2 (1 << 1)
+# endif
+# include <sys/prctl.h>
+# ifndef PR_SVE_GET_VL
+#  define PR_SVE_GET_VL 51
+# endif
+# ifndef PR_SVE_VL_LEN_MASK
+#  define PR_SVE_VL_LEN_MASK 0xffff
+# endif
 #endif
 #ifdef CONFIG_DARWIN
 # include <sys/sysctl.h>
@@ -53,7 +66,11 @@ unsigned __attribute__((constructor)) cpuinfo_init(void)
         return info;
     }
 
-    info = CPUINFO_ALWAYS;
+    /*
+     * Advanced SIMD is required by the procedure call standard, but
+     * have a bit for it so that its users can also test the fallback.
+     */
+    info = CPUINFO_ALWAYS | CPUINFO_ASIMD;
 
 #ifdef CONFIG_LINUX
     unsigned long hwcap = qemu_getauxval(AT_HWCAP);
@@ -61,9 +78,23 @@ unsigned __attribute__((constructor)) cpuinfo_init(void)
     info |= (hwcap & HWCAP_USCAT ? CPUINFO_LSE2 : 0);
     info |= (hwcap & HWCAP_AES ? CPUINFO_AES : 0);
     info |= (hwcap & HWCAP_PMULL ? CPUINFO_PMULL : 0);
+    info |= (hwcap & HWCAP_SVE ? CPUINFO_SVE : 0);
 
     unsigned long hwcap2 = qemu_getauxval(AT_HWCAP2);
     info |= (hwcap2 & HWCAP2_BTI ? CPUINFO_BTI : 0);
+    info |= (hwcap2 & HWCAP2_SVE2 ? CPUINFO_SVE2 : 0);
+
+    /*
+     * TCG can only use SVE for TCG_TYPE_V256, and only if a Z register
+     * holds exactly that much: the vector length is per-thread but is
+     * inherited, so the value seen here applies to the vCPU threads.
+     */
+    if (info & CPUINFO_SVE) {
+        int vl = prctl(PR_SVE_GET_VL, 0, 0, 0, 0);
+        if (vl >= 0 && (vl & PR_SVE_VL_LEN_MASK) == 32) {
+            info |= CPUINFO_SVE256;
+        }
+    }
 #endif
 #ifdef CONFIG_DARWIN
     info |= sysctl_for_bool("hw.optional.arm.FEAT_LSE") * CPUINFO_LSE;
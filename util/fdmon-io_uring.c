@@ -25,7 +25,10 @@
  *
  * File descriptor monitoring is implemented using the following operations:
  *
- * 1. IORING_OP_POLL_ADD - adds a file descriptor to be monitored.
+ * 1. IORING_OP_POLL_ADD - adds a file descriptor to be monitored.  If the
+ *    kernel supports it, the request is multishot: it posts a cqe every time
+ *    the file descriptor becomes ready and stays armed until it is removed.
+ *    Otherwise it is one-shot and must be re-armed after each cqe.
  * 2. IORING_OP_POLL_REMOVE - removes a file descriptor being monitored.  When
  *    the poll mask changes for a file descriptor it is first removed and then
  *    re-added with the new poll mask, so this operation is also used as part
@@ -37,6 +40,10 @@
  * io_uring calls the submission queue the "sq ring" and the completion queue
  * the "cq ring".  Ring entries are called "sqe" and "cqe", respectively.
  *
+ * With fdmon_io_uring_enable_sqpoll() a kernel thread polls the sq ring, so
+ * submitting sqes from a non-blocking fdmon_io_uring_wait() does not need a
+ * system call as long as that thread is awake.
+ *
  * The code is structured so that sq/cq rings are only modified within
  * fdmon_io_uring_wait().  Changes to AioHandlers are made by enqueuing them on
  * ctx->submit_list so that fdmon_io_uring_wait() can submit IORING_OP_POLL_ADD
@@ -46,11 +53,15 @@
 #include "qemu/osdep.h"
 #include <poll.h>
 #include "qemu/rcu_queue.h"
+#include "qapi/error.h"
 #include "aio-posix.h"
 
 enum {
     FDMON_IO_URING_ENTRIES  = 128, /* sq/cq ring size */
 
+    /* How long the SQPOLL kernel thread polls before going to sleep */
+    FDMON_IO_URING_SQ_THREAD_IDLE_MS = 1000,
+
     /* AioHandler::flags */
     FDMON_IO_URING_PENDING  = (1 << 0),
     FDMON_IO_URING_ADD      = (1 << 1),
@@ -171,6 +182,13 @@ static void add_poll_add_sqe(AioContext *ctx, AioHandler *node)
     struct io_uring_sqe *sqe = get_sqe(ctx);
     int events = poll_events_from_pfd(node->pfd.events);
 
+#ifdef HAVE_IO_URING_PREP_POLL_MULTISHOT
+    if (ctx->fdmon_io_uring_multishot) {
+        io_uring_prep_poll_multishot(sqe, node->pfd.fd, events);
+        io_uring_sqe_set_data(sqe, node);
+        return;
+    }
+#endif
     io_uring_prep_poll_add(sqe, node->pfd.fd, events);
     io_uring_sqe_set_data(sqe, node);
 }
@@ -234,6 +252,19 @@ static bool process_cqe(AioContext *ctx,
         return false;
     }
 
+    /*
+     * A multishot IORING_OP_POLL_ADD is still armed.  The handler cannot be
+     * deleted until its last cqe arrives, but it must not run either.
+     */
+    if (cqe->flags & IORING_CQE_F_MORE) {
+        if (qatomic_read(&node->flags) & FDMON_IO_URING_REMOVE) {
+            return false;
+        }
+        aio_add_ready_handler(ready_list, node,
+                              pfd_events_from_poll(cqe->res));
+        return true;
+    }
+
     /*
      * Deletion can only happen when IORING_OP_POLL_ADD completes.  If we race
      * with enqueue() here then we can safely clear the FDMON_IO_URING_REMOVE
@@ -245,9 +276,19 @@ static bool process_cqe(AioContext *ctx,
         return false;
     }
 
+    /* Kernels before Linux 5.13 reject multishot poll */
+    if (cqe->res == -EINVAL && ctx->fdmon_io_uring_multishot) {
+        ctx->fdmon_io_uring_multishot = false;
+        add_poll_add_sqe(ctx, node);
+        return false;
+    }
+
     aio_add_ready_handler(ready_list, node, pfd_events_from_poll(cqe->res));
 
-    /* IORING_OP_POLL_ADD is one-shot so we must re-arm it */
+    /*
+     * IORING_OP_POLL_ADD is one-shot, or a multishot request was terminated
+     * by the kernel (e.g. on cq ring overflow), so we must re-arm it
+     */
     add_poll_add_sqe(ctx, node);
     return true;
 }
@@ -321,18 +362,81 @@ static const FDMonOps fdmon_io_uring_ops = {
     .need_wait = fdmon_io_uring_need_wait,
 };
 
-bool fdmon_io_uring_setup(AioContext *ctx)
+static int fdmon_io_uring_init(AioContext *ctx, struct io_uring_params *params)
 {
     int ret;
 
-    ret = io_uring_queue_init(FDMON_IO_URING_ENTRIES, &ctx->fdmon_io_uring, 0);
+    ret = io_uring_queue_init_params(FDMON_IO_URING_ENTRIES,
+                                     &ctx->fdmon_io_uring, params);
     if (ret != 0) {
-        return false;
+        return ret;
     }
 
     QSLIST_INIT(&ctx->submit_list);
+#ifdef HAVE_IO_URING_PREP_POLL_MULTISHOT
+    ctx->fdmon_io_uring_multishot = true;
+#endif
     ctx->fdmon_ops = &fdmon_io_uring_ops;
-    return true;
+    return 0;
+}
+
+bool fdmon_io_uring_setup(AioContext *ctx)
+{
+    struct io_uring_params params = {};
+
+    return fdmon_io_uring_init(ctx, &params) == 0;
+}
+
+/*
+ * Replace the ring with one that is polled by a kernel thread, pinned to
+ * @cpu unless it is negative.  If that fails, a regular ring is set up
+ * again.  Must be called from the thread that runs @ctx, or before @ctx is
+ * used by any thread.
+ */
+bool fdmon_io_uring_enable_sqpoll(AioContext *ctx, int cpu, Error **errp)
+{
+    struct io_uring_params params = {
+        .flags = IORING_SETUP_SQPOLL,
+        .sq_thread_idle = FDMON_IO_URING_SQ_THREAD_IDLE_MS,
+    };
+    AioHandler *node;
+    bool ok = true;
+    int ret;
+
+    if (ctx->fdmon_ops != &fdmon_io_uring_ops) {
+        error_setg(errp, "io_uring file descriptor monitoring is not in use");
+        return false;
+    }
+
+    if (cpu >= 0) {
+        params.flags |= IORING_SETUP_SQ_AFF;
+        params.sq_thread_cpu = cpu;
+    }
+
+    /* Existing poll requests are lost with the old ring, see below */
+    fdmon_io_uring_destroy(ctx);
+
+    ret = fdmon_io_uring_init(ctx, &params);
+    if (ret == 0 && !(params.features & IORING_FEAT_SQPOLL_NONFIXED)) {
+        io_uring_queue_exit(&ctx->fdmon_io_uring);
+        ctx->fdmon_ops = &fdmon_poll_ops;
+        ret = -ENOTSUP;
+    }
+    if (ret != 0) {
+        error_setg_errno(errp, -ret, "Unable to set up io_uring SQPOLL");
+        ok = false;
+        if (!fdmon_io_uring_setup(ctx)) {
+            return false;
+        }
+    }
+
+    /* Monitor the existing handlers in the new ring */
+    QLIST_FOREACH(node, &ctx->aio_handlers, node) {
+        if (!QLIST_IS_INSERTED(node, node_deleted)) {
+            enqueue(&ctx->submit_list, node, FDMON_IO_URING_ADD);
+        }
+    }
+    return ok;
 }
 
 void fdmon_io_uring_destroy(AioContext *ctx)
@@ -11,6 +11,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu/hbitmap.h"
+#include "qemu/bitmap.h"
 #include "qemu/host-utils.h"
 #include "trace.h"
 #include "crypto/hash.h"
@@ -197,7 +198,8 @@ int64_t hbitmap_next_dirty(const HBitmap *hb, int64_t start, int64_t count)
 {
     HBitmapIter hbi;
     int64_t first_dirty_off;
-    uint64_t end;
+    uint64_t end, bit, pos;
+    unsigned long cur;
 
     assert(start >= 0 && count >= 0);
 
@@ -207,6 +209,20 @@ int64_t hbitmap_next_dirty(const HBitmap *hb, int64_t start, int64_t count)
 
     end = count > hb->orig_size - start ? hb->orig_size : start + count;
 
+    /*
+     * Dense bitmaps often have the answer in the word that contains
+     * @start; look there before setting up an iterator over all levels.
+     */
+    bit = start >> hb->granularity;
+    pos = bit >> BITS_PER_LEVEL;
+    cur = hb->levels[HBITMAP_LEVELS - 1][pos] &
+          ~((1UL << (bit & (BITS_PER_LONG - 1))) - 1);
+    if (cur) {
+        first_dirty_off = ((pos << BITS_PER_LEVEL) + ctzl(cur)) <<
+                          hb->granularity;
+        return first_dirty_off >= end ? -1 : MAX(start, first_dirty_off);
+    }
+
     hbitmap_iter_init(&hbi, hb, start);
     first_dirty_off = hbitmap_iter_next(&hbi);
 
@@ -217,6 +233,32 @@ int64_t hbitmap_next_dirty(const HBitmap *hb, int64_t start, int64_t count)
     return MAX(start, first_dirty_off);
 }
 
+/*
+ * Return the index of the first word in [@pos, @sz) of @p that is not all
+ * ones, or @sz.  Words are checked in groups of eight first, an AND
+ * reduction that the compiler turns into vector code.
+ */
+static size_t hb_skip_ones_words(const unsigned long *p, size_t pos, size_t sz)
+{
+    while (pos + 8 <= sz) {
+        unsigned long acc = ~0UL;
+        int i;
+
+        for (i = 0; i < 8; i++) {
+            acc &= p[pos + i];
+        }
+        if (acc != ~0UL) {
+            break;
+        }
+        pos += 8;
+    }
+
+    while (pos < sz && p[pos] == ~0UL) {
+        pos++;
+    }
+    return pos;
+}
+
 int64_t hbitmap_next_zero(const HBitmap *hb, int64_t start, int64_t count)
 {
     size_t pos = (start >> hb->granularity) >> BITS_PER_LEVEL;
@@ -245,10 +287,7 @@ int64_t hbitmap_next_zero(const HBitmap *hb, int64_t start, int64_t count)
     assert((start >> hb->granularity) < hb->size);
 
     if (cur == (unsigned long)-1) {
-        do {
-            pos++;
-        } while (pos < sz && last_lev[pos] == (unsigned long)-1);
-
+        pos = hb_skip_ones_words(last_lev, pos + 1, sz);
         if (pos >= sz) {
             return -1;
         }
@@ -901,7 +940,7 @@ static void hbitmap_sparse_merge(HBitmap *dst, const HBitmap *src)
 void hbitmap_merge(const HBitmap *a, const HBitmap *b, HBitmap *result)
 {
     int i;
-    uint64_t j;
+    uint64_t j, count;
 
     assert(a->orig_size == result->orig_size);
     assert(b->orig_size == result->orig_size);
@@ -932,16 +971,25 @@ void hbitmap_merge(const HBitmap *a, const HBitmap *b, HBitmap *result)
     /* This merge is O(size), as BITS_PER_LONG and HBITMAP_LEVELS are constant.
      * It may be possible to improve running times for sparsely populated maps
      * by using hbitmap_iter_next, but this is suboptimal for dense maps.
+     *
+     * The dirty count is recomputed in the same pass over the last level;
+     * bits past hb->size are never set, so whole words can be counted.
      */
     assert(a->size == b->size);
-    for (i = HBITMAP_LEVELS - 1; i >= 0; i--) {
-        for (j = 0; j < a->sizes[i]; j++) {
-            result->levels[i][j] = a->levels[i][j] | b->levels[i][j];
-        }
+    i = HBITMAP_LEVELS - 1;
+    count = 0;
+    for (j = 0; j < a->sizes[i]; j++) {
+        unsigned long word = a->levels[i][j] | b->levels[i][j];
+
+        result->levels[i][j] = word;
+        count += ctpopl(word);
+    }
+    while (i-- > 0) {
+        bitmap_or(result->levels[i], a->levels[i], b->levels[i],
+                  a->sizes[i] << BITS_PER_LEVEL);
     }
 
-    /* Recompute the dirty count */
-    result->count = hb_count_between(result, 0, result->size - 1);
+    result->count = count;
 }
 
 char *hbitmap_sha256(const HBitmap *bitmap, Error **errp)
@@ -0,0 +1,123 @@
+/*
+ * Split loops over a set of worker threads
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "qemu/parallel.h"
+#include "qemu/rcu.h"
+#include "qemu/thread.h"
+
+struct QemuParallel {
+    QemuThread *threads;
+    unsigned int nr_threads;
+    /* posted once for each worker that takes part in a loop */
+    QemuSemaphore start;
+    /* set by the last worker to finish a loop */
+    QemuEvent done;
+    bool exiting;
+
+    /* the current loop */
+    QemuParallelFunc *func;
+    void *opaque;
+    unsigned int n;
+    unsigned int next;
+    unsigned int running;
+};
+
+static void qemu_parallel_work(QemuParallel *p)
+{
+    unsigned int i;
+
+    while ((i = qatomic_fetch_inc(&p->next)) < p->n) {
+        p->func(p->opaque, i);
+    }
+}
+
+static void *qemu_parallel_thread(void *opaque)
+{
+    QemuParallel *p = opaque;
+
+    rcu_register_thread();
+    for (;;) {
+        qemu_sem_wait(&p->start);
+        if (qatomic_read(&p->exiting)) {
+            break;
+        }
+        qemu_parallel_work(p);
+        if (qatomic_fetch_dec(&p->running) == 1) {
+            qemu_event_set(&p->done);
+        }
+    }
+    rcu_unregister_thread();
+    return NULL;
+}
+
+QemuParallel *qemu_parallel_new(const char *name, unsigned int nr_threads)
+{
+    QemuParallel *p = g_new0(QemuParallel, 1);
+
+    assert(nr_threads > 0);
+    qemu_sem_init(&p->start, 0);
+    qemu_event_init(&p->done, false);
+    p->nr_threads = nr_threads;
+    p->threads = g_new0(QemuThread, nr_threads);
+
+    for (unsigned int i = 0; i < nr_threads; i++) {
+        g_autofree char *thread_name = g_strdup_printf("%s/%u", name, i);
+
+        qemu_thread_create(&p->threads[i], thread_name, qemu_parallel_thread,
+                           p, QEMU_THREAD_JOINABLE);
+    }
+    return p;
+}
+
+void qemu_parallel_free(QemuParallel *p)
+{
+    if (!p) {
+        return;
+    }
+
+    qatomic_set(&p->exiting, true);
+    for (unsigned int i = 0; i < p->nr_threads; i++) {
+        qemu_sem_post(&p->start);
+    }
+    for (unsigned int i = 0; i < p->nr_threads; i++) {
+        qemu_thread_join(&p->threads[i]);
+    }
+    qemu_event_destroy(&p->done);
+    qemu_sem_destroy(&p->start);
+    g_free(p->threads);
+    g_free(p);
+}
+
+void qemu_parallel_run(QemuParallel *p, unsigned int n,
+                       QemuParallelFunc *func, void *opaque)
+{
+    unsigned int nr_workers;
+
+    if (!p || n < 2) {
+        for (unsigned int i = 0; i < n; i++) {
+            func(opaque, i);
+        }
+        return;
+    }
+
+    /* The caller takes one share of the work itself.  */
+    nr_workers = MIN(p->nr_threads, n - 1);
+    p->func = func;
+    p->opaque = opaque;
+    p->n = n;
+    p->next = 0;
+    p->running = nr_workers;
+    qemu_event_reset(&p->done);
+
+    /* Posting the semaphore orders the stores above for the workers.  */
+    for (unsigned int i = 0; i < nr_workers; i++) {
+        qemu_sem_post(&p->start);
+    }
+    qemu_parallel_work(p);
+    qemu_event_wait(&p->done);
+}
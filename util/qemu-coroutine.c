@@ -85,6 +85,15 @@ Coroutine *qemu_coroutine_create(CoroutineEntry *entry, void *opaque)
         }
     }
 
+    if (IS_ENABLED(CONFIG_COROUTINE_POOL)) {
+        AioContext *ctx = qemu_get_current_aio_context();
+
+        if (ctx) {
+            stat64_inc(co ? &ctx->coroutine_pool_hits :
+                       &ctx->coroutine_pool_misses);
+        }
+    }
+
     if (!co) {
         co = qemu_coroutine_new();
     }
@@ -100,16 +109,22 @@ static void coroutine_delete(Coroutine *co)
     co->caller = NULL;
 
     if (IS_ENABLED(CONFIG_COROUTINE_POOL)) {
-        if (release_pool_size < qatomic_read(&pool_max_size) * 2) {
-            QSLIST_INSERT_HEAD_ATOMIC(&release_pool, co, pool_next);
-            qatomic_inc(&release_pool_size);
-            return;
-        }
+        /*
+         * Prefer this thread's own pool: the next coroutine created here
+         * gets a stack that is still in the cache and mapped, without
+         * touching the shared list.  Only hand coroutines to other
+         * threads once the local pool is full.
+         */
         if (get_alloc_pool_size() < qatomic_read(&pool_max_size)) {
             QSLIST_INSERT_HEAD(get_ptr_alloc_pool(), co, pool_next);
             set_alloc_pool_size(get_alloc_pool_size() + 1);
             return;
         }
+        if (release_pool_size < qatomic_read(&pool_max_size) * 2) {
+            QSLIST_INSERT_HEAD_ATOMIC(&release_pool, co, pool_next);
+            qatomic_inc(&release_pool_size);
+            return;
+        }
     }
 
     qemu_coroutine_delete(co);
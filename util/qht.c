@@ -70,6 +70,7 @@
 #include "qemu/atomic.h"
 #include "qemu/rcu.h"
 #include "qemu/memalign.h"
+#include "qemu/host-utils.h"
 
 //#define QHT_DEBUG
 
@@ -552,28 +553,84 @@ bool qht_reset_size(struct qht *ht, size_t n_elems)
     return !!new;
 }
 
+/*
+ * Return a mask with bit i set if the i-th hash of @b is equal to @hash.
+ *
+ * The vector versions read the hashes with plain loads; a torn or stale
+ * read is harmless because the caller checks the bucket's seqlock before
+ * trusting the result.  TSAN would flag them, so it gets the generic loop.
+ */
+#if !defined(CONFIG_TSAN) && defined(__SSE2__) && QHT_BUCKET_ENTRIES == 4
+#include <emmintrin.h>
+
+static inline uint32_t qht_bucket_match(const struct qht_bucket *b,
+                                        uint32_t hash)
+{
+    __m128i h = _mm_loadu_si128((const __m128i *)b->hashes);
+    __m128i eq = _mm_cmpeq_epi32(h, _mm_set1_epi32(hash));
+
+    return _mm_movemask_ps(_mm_castsi128_ps(eq));
+}
+#elif !defined(CONFIG_TSAN) && defined(__aarch64__) && \
+      defined(__ARM_NEON) && QHT_BUCKET_ENTRIES == 4
+#include <arm_neon.h>
+
+static inline uint32_t qht_bucket_match(const struct qht_bucket *b,
+                                        uint32_t hash)
+{
+    static const uint32_t bits[4] = { 1, 2, 4, 8 };
+    uint32x4_t eq = vceqq_u32(vld1q_u32(b->hashes), vdupq_n_u32(hash));
+
+    return vaddvq_u32(vandq_u32(eq, vld1q_u32(bits)));
+}
+#else
+static inline uint32_t qht_bucket_match(const struct qht_bucket *b,
+                                        uint32_t hash)
+{
+    uint32_t mask = 0;
+    int i;
+
+    for (i = 0; i < QHT_BUCKET_ENTRIES; i++) {
+        if (qatomic_read(&b->hashes[i]) == hash) {
+            mask |= 1u << i;
+        }
+    }
+    return mask;
+}
+#endif
+
 static inline
 void *qht_do_lookup(const struct qht_bucket *head, qht_lookup_func_t func,
                     const void *userp, uint32_t hash)
 {
     const struct qht_bucket *b = head;
-    int i;
 
     do {
-        for (i = 0; i < QHT_BUCKET_ENTRIES; i++) {
-            if (qatomic_read(&b->hashes[i]) == hash) {
-                /* The pointer is dereferenced before seqlock_read_retry,
-                 * so (unlike qht_insert__locked) we need to use
-                 * qatomic_rcu_read here.
-                 */
-                void *p = qatomic_rcu_read(&b->pointers[i]);
-
-                if (likely(p) && likely(func(p, userp))) {
-                    return p;
-                }
+        const struct qht_bucket *next = qatomic_rcu_read(&b->next);
+        uint32_t mask;
+
+        /*
+         * Chained buckets are allocated separately and are unlikely to be
+         * in cache; start fetching the next one while we compare this one.
+         */
+        if (next) {
+            __builtin_prefetch(next);
+        }
+        mask = qht_bucket_match(b, hash);
+        while (mask) {
+            int i = ctz32(mask);
+            /* The pointer is dereferenced before seqlock_read_retry,
+             * so (unlike qht_insert__locked) we need to use
+             * qatomic_rcu_read here.
+             */
+            void *p = qatomic_rcu_read(&b->pointers[i]);
+
+            if (likely(p) && likely(func(p, userp))) {
+                return p;
             }
+            mask &= mask - 1;
         }
-        b = qatomic_rcu_read(&b->next);
+        b = next;
     } while (b);
 
     return NULL;
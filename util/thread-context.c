@@ -344,6 +344,11 @@ void thread_context_create_thread(ThreadContext *tc, QemuThread *thread,
         .mode = mode,
     };
 
+    if (!tc) {
+        qemu_thread_create(thread, name, start_routine, arg, mode);
+        return;
+    }
+
     qemu_mutex_lock(&tc->mutex);
     tc->thread_cmd = TC_CMD_NEW;
     tc->thread_cmd_data = &data;
@@ -25,9 +25,17 @@
 
 static void do_spawn_thread(ThreadPool *pool);
 
+/*
+ * Requests submitted inside a defer_call_begin()/defer_call_end() section
+ * are handed to the workers in one go when the section ends, or once this
+ * many have accumulated.
+ */
+#define THREAD_POOL_MAX_DEFERRED 32
+
 typedef struct ThreadPoolElement ThreadPoolElement;
 
 enum ThreadState {
+    THREAD_DEFERRED,
     THREAD_QUEUED,
     THREAD_ACTIVE,
     THREAD_DONE,
@@ -63,6 +71,8 @@ struct ThreadPool {
 
     /* The following variables are only accessed from one AioContext. */
     QLIST_HEAD(, ThreadPoolElement) head;
+    QTAILQ_HEAD(, ThreadPoolElement) deferred_list;
+    int deferred_count;
 
     /* The following variables are protected by lock.  */
     QTAILQ_HEAD(, ThreadPoolElement) request_list;
@@ -222,6 +232,16 @@ static void thread_pool_cancel(BlockAIOCB *acb)
 
     trace_thread_pool_cancel(elem, elem->common.opaque);
 
+    if (elem->state == THREAD_DEFERRED) {
+        QTAILQ_REMOVE(&pool->deferred_list, elem, reqs);
+        pool->deferred_count--;
+        qemu_bh_schedule(pool->completion_bh);
+
+        elem->state = THREAD_DONE;
+        elem->ret = -ECANCELED;
+        return;
+    }
+
     QEMU_LOCK_GUARD(&pool->lock);
     if (elem->state == THREAD_QUEUED) {
         QTAILQ_REMOVE(&pool->request_list, elem, reqs);
@@ -233,6 +253,37 @@ static void thread_pool_cancel(BlockAIOCB *acb)
 
 }
 
+/* Move deferred requests to the request list and wake up workers for them */
+static void thread_pool_flush(void *opaque)
+{
+    ThreadPool *pool = opaque;
+    ThreadPoolElement *req;
+    int n = pool->deferred_count;
+
+    if (!n) {
+        return;
+    }
+
+    qemu_mutex_lock(&pool->lock);
+    for (int i = pool->idle_threads;
+         i < n && pool->cur_threads < pool->max_threads; i++) {
+        spawn_thread(pool);
+    }
+    while ((req = QTAILQ_FIRST(&pool->deferred_list))) {
+        QTAILQ_REMOVE(&pool->deferred_list, req, reqs);
+        req->state = THREAD_QUEUED;
+        QTAILQ_INSERT_TAIL(&pool->request_list, req, reqs);
+    }
+    pool->deferred_count = 0;
+    qemu_mutex_unlock(&pool->lock);
+
+    if (n == 1) {
+        qemu_cond_signal(&pool->request_cond);
+    } else {
+        qemu_cond_broadcast(&pool->request_cond);
+    }
+}
+
 static const AIOCBInfo thread_pool_aiocb_info = {
     .aiocb_size         = sizeof(ThreadPoolElement),
     .cancel_async       = thread_pool_cancel,
@@ -251,20 +302,23 @@ BlockAIOCB *thread_pool_submit_aio(ThreadPoolFunc *func, void *arg,
     req = qemu_aio_get(&thread_pool_aiocb_info, NULL, cb, opaque);
     req->func = func;
     req->arg = arg;
-    req->state = THREAD_QUEUED;
+    req->state = THREAD_DEFERRED;
     req->pool = pool;
 
     QLIST_INSERT_HEAD(&pool->head, req, all);
 
     trace_thread_pool_submit(pool, req, arg);
 
-    qemu_mutex_lock(&pool->lock);
-    if (pool->idle_threads == 0 && pool->cur_threads < pool->max_threads) {
-        spawn_thread(pool);
+    /*
+     * Outside of a defer_call section this submits the request right away;
+     * inside one, the lock is only taken once for the whole batch.
+     */
+    QTAILQ_INSERT_TAIL(&pool->deferred_list, req, reqs);
+    if (++pool->deferred_count >= THREAD_POOL_MAX_DEFERRED) {
+        thread_pool_flush(pool);
+    } else {
+        defer_call(thread_pool_flush, pool);
     }
-    QTAILQ_INSERT_TAIL(&pool->request_list, req, reqs);
-    qemu_mutex_unlock(&pool->lock);
-    qemu_cond_signal(&pool->request_cond);
     return &req->common;
 }
 
@@ -337,6 +391,7 @@ static void thread_pool_init_one(ThreadPool *pool, AioContext *ctx)
     pool->new_thread_bh = aio_bh_new(ctx, spawn_thread_bh_fn, pool);
 
     QLIST_INIT(&pool->head);
+    QTAILQ_INIT(&pool->deferred_list);
     QTAILQ_INIT(&pool->request_list);
 
     thread_pool_update_params(pool, ctx);
@@ -467,8 +467,15 @@ bool throttle_schedule_timer(ThrottleState *ts,
  * @direction: throttle direction
  * @size:     the size of the operation
  */
-void throttle_account(ThrottleState *ts, ThrottleDirection direction,
-                      uint64_t size)
+/* account @units operations and @size bytes at once
+ *
+ * @ts:        the throttling state
+ * @direction: the ThrottleDirection
+ * @units:     the number of operations
+ * @size:      the number of bytes
+ */
+void throttle_account_units(ThrottleState *ts, ThrottleDirection direction,
+                            double units, uint64_t size)
 {
     static const BucketType bucket_types_size[THROTTLE_MAX][2] = {
         { THROTTLE_BPS_TOTAL, THROTTLE_BPS_READ },
@@ -478,15 +485,9 @@ void throttle_account(ThrottleState *ts, ThrottleDirection direction,
         { THROTTLE_OPS_TOTAL, THROTTLE_OPS_READ },
         { THROTTLE_OPS_TOTAL, THROTTLE_OPS_WRITE }
     };
-    double units = 1.0;
     unsigned i;
 
     assert(direction < THROTTLE_MAX);
-    /* if cfg.op_size is defined and smaller than size we compute unit count */
-    if (ts->cfg.op_size && size > ts->cfg.op_size) {
-        units = (double) size / ts->cfg.op_size;
-    }
-
     for (i = 0; i < ARRAY_SIZE(bucket_types_size[THROTTLE_READ]); i++) {
         LeakyBucket *bkt;
 
@@ -504,6 +505,19 @@ void throttle_account(ThrottleState *ts, ThrottleDirection direction,
     }
 }
 
+void throttle_account(ThrottleState *ts, ThrottleDirection direction,
+                      uint64_t size)
+{
+    double units = 1.0;
+
+    /* if cfg.op_size is defined and smaller than size we compute unit count */
+    if (ts->cfg.op_size && size > ts->cfg.op_size) {
+        units = (double) size / ts->cfg.op_size;
+    }
+
+    throttle_account_units(ts, direction, units, size);
+}
+
 /* return a ThrottleConfig based on the options in a ThrottleLimits
  *
  * @arg:    the ThrottleLimits object to read from
@@ -27,7 +27,14 @@
  * protocol messages over the UNIX domain socket.
  *
  * When virtqueues are set up libvhost-user calls set_watch() to monitor kick
- * fds. These fds are also handled in the VuServer->ctx AioContext.
+ * fds. These fds are also handled in the VuServer->ctx AioContext, unless
+ * VuServer->vq_ctxs spreads the virtqueues over other AioContexts.  Kick fds
+ * can also be polled, so that an IOThread with adaptive polling picks up new
+ * requests without waiting for the kick.
+ *
+ * Virtqueues in other AioContexts run in parallel with vu_client_trip(), so
+ * they are paused while a vhost-user message is processed, see
+ * vu_pause_vqs().
  *
  * Both vu_client_trip() and kick fd monitoring can be stopped by shutting down
  * the socket connection. Shutting down the socket connection causes
@@ -75,6 +82,9 @@ static void panic_cb(VuDev *vu_dev, const char *buf)
     error_report("vu_panic: %s", buf);
 }
 
+static void coroutine_fn vu_pause_vqs(VuServer *server);
+static void vu_resume_vqs(VuServer *server);
+
 void vhost_user_server_inc_in_flight(VuServer *server)
 {
     assert(!server->wait_idle);
@@ -187,6 +197,7 @@ vu_message_read(VuDev *vu_dev, int conn_fd, VhostUserMsg *vmsg)
         }
     }
 
+    vu_pause_vqs(server);
     return true;
 
 fail:
@@ -210,8 +221,12 @@ static coroutine_fn void vu_client_trip(void *opaque)
         if (!vu_dispatch(vu_dev) && server->ctx) {
             break;
         }
+        vu_resume_vqs(server);
     }
 
+    /* Kicks in other threads must not start new requests */
+    vu_pause_vqs(server);
+
     if (vhost_user_server_has_in_flight(server)) {
         /* Wait for requests to complete before we can unmap the memory */
         server->wait_idle = true;
@@ -221,6 +236,7 @@ static coroutine_fn void vu_client_trip(void *opaque)
     assert(!vhost_user_server_has_in_flight(server));
 
     vu_deinit(vu_dev);
+    server->vqs_paused = false;
 
     /* vu_deinit() should have called remove_watch() */
     assert(QTAILQ_EMPTY(&server->vu_fd_watches));
@@ -260,6 +276,121 @@ static void kick_handler(void *opaque)
     }
 }
 
+/* Look for new requests without waiting for the guest to kick us */
+static bool kick_poll(void *opaque)
+{
+    VuFdWatch *vu_fd_watch = opaque;
+
+    return vu_fd_watch->vq->handler &&
+           !vu_queue_empty(vu_fd_watch->vu_dev, vu_fd_watch->vq);
+}
+
+static void kick_poll_ready(void *opaque)
+{
+    VuFdWatch *vu_fd_watch = opaque;
+    VuDev *vu_dev = vu_fd_watch->vu_dev;
+    VuVirtq *vq = vu_fd_watch->vq;
+
+    /* The kick, if any, is read and ignored later in kick_handler() */
+    if (vq->handler) {
+        vq->handler(vu_dev, vq - vu_dev->vq);
+    }
+
+    if (vu_dev->broken) {
+        VuServer *server = container_of(vu_dev, VuServer, vu_dev);
+
+        qio_channel_shutdown(server->ioc, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
+    }
+}
+
+static AioContext *vu_fd_watch_ctx(VuServer *server, VuFdWatch *vu_fd_watch)
+{
+    if (vu_fd_watch->vq && server->nr_vq_ctxs) {
+        int idx = vu_fd_watch->vq - server->vu_dev.vq;
+
+        return server->vq_ctxs[idx % server->nr_vq_ctxs];
+    }
+    return server->ctx;
+}
+
+static void vu_fd_watch_attach(VuServer *server, VuFdWatch *vu_fd_watch)
+{
+    bool is_kick = vu_fd_watch->vq;
+
+    if (is_kick && server->vqs_paused) {
+        return;
+    }
+    aio_set_fd_handler(vu_fd_watch_ctx(server, vu_fd_watch), vu_fd_watch->fd,
+                       kick_handler, NULL,
+                       is_kick ? kick_poll : NULL,
+                       is_kick ? kick_poll_ready : NULL,
+                       vu_fd_watch);
+}
+
+static void vu_fd_watch_detach(VuServer *server, VuFdWatch *vu_fd_watch)
+{
+    aio_set_fd_handler(vu_fd_watch_ctx(server, vu_fd_watch), vu_fd_watch->fd,
+                       NULL, NULL, NULL, NULL, vu_fd_watch);
+}
+
+/* Runs in the AioContext of the virtqueue */
+static void vu_pause_vq_bh(void *opaque)
+{
+    VuFdWatch *vu_fd_watch = opaque;
+    VuServer *server = container_of(vu_fd_watch->vu_dev, VuServer, vu_dev);
+
+    vu_fd_watch_detach(server, vu_fd_watch);
+    qatomic_dec(&server->vq_pausing);
+}
+
+/*
+ * libvhost-user is not thread-safe, so a vhost-user message must not be
+ * processed while virtqueues in other threads use the device.  Stop
+ * monitoring their kick fds from their own threads, so that no handler is
+ * left running, and wait for their requests to complete.  Messages are
+ * rare, so it is fine to just poll for that.
+ */
+static void coroutine_fn vu_pause_vqs(VuServer *server)
+{
+    VuFdWatch *vu_fd_watch;
+
+    if (!server->nr_vq_ctxs || server->vqs_paused) {
+        return;
+    }
+    server->vqs_paused = true;
+
+    QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
+        if (vu_fd_watch->vq) {
+            qatomic_inc(&server->vq_pausing);
+            aio_bh_schedule_oneshot(vu_fd_watch_ctx(server, vu_fd_watch),
+                                    vu_pause_vq_bh, vu_fd_watch);
+        }
+    }
+
+    while (qatomic_read(&server->vq_pausing) ||
+           vhost_user_server_has_in_flight(server)) {
+        aio_co_schedule(qemu_get_current_aio_context(),
+                        qemu_coroutine_self());
+        qemu_coroutine_yield();
+    }
+}
+
+static void vu_resume_vqs(VuServer *server)
+{
+    VuFdWatch *vu_fd_watch;
+
+    if (!server->vqs_paused) {
+        return;
+    }
+    server->vqs_paused = false;
+
+    QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
+        if (vu_fd_watch->vq && server->ctx) {
+            vu_fd_watch_attach(server, vu_fd_watch);
+        }
+    }
+}
+
 static VuFdWatch *find_vu_fd_watch(VuServer *server, int fd)
 {
 
@@ -292,10 +423,15 @@ set_watch(VuDev *vu_dev, int fd, int vu_evt,
         vu_fd_watch->fd = fd;
         vu_fd_watch->cb = cb;
         qemu_socket_set_nonblock(fd);
-        aio_set_fd_handler(server->ctx, fd, kick_handler,
-                           NULL, NULL, NULL, vu_fd_watch);
         vu_fd_watch->vu_dev = vu_dev;
         vu_fd_watch->pvt = pvt;
+
+        /* libvhost-user passes the virtqueue index for kick fds */
+        if ((uintptr_t)pvt < vu_dev->max_queues &&
+            vu_dev->vq[(uintptr_t)pvt].kick_fd == fd) {
+            vu_fd_watch->vq = &vu_dev->vq[(uintptr_t)pvt];
+        }
+        vu_fd_watch_attach(server, vu_fd_watch);
     }
 }
 
@@ -313,7 +449,7 @@ static void remove_watch(VuDev *vu_dev, int fd)
     if (!vu_fd_watch) {
         return;
     }
-    aio_set_fd_handler(server->ctx, fd, NULL, NULL, NULL, NULL, NULL);
+    vu_fd_watch_detach(server, vu_fd_watch);
 
     QTAILQ_REMOVE(&server->vu_fd_watches, vu_fd_watch, next);
     g_free(vu_fd_watch);
@@ -373,8 +509,7 @@ void vhost_user_server_stop(VuServer *server)
         VuFdWatch *vu_fd_watch;
 
         QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
-            aio_set_fd_handler(server->ctx, vu_fd_watch->fd,
-                               NULL, NULL, NULL, NULL, vu_fd_watch);
+            vu_fd_watch_detach(server, vu_fd_watch);
         }
 
         qio_channel_shutdown(server->ioc, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
@@ -412,8 +547,7 @@ void vhost_user_server_attach_aio_context(VuServer *server, AioContext *ctx)
     }
 
     QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
-        aio_set_fd_handler(ctx, vu_fd_watch->fd, kick_handler, NULL,
-                           NULL, NULL, vu_fd_watch);
+        vu_fd_watch_attach(server, vu_fd_watch);
     }
 
     if (server->co_trip) {
@@ -444,8 +578,7 @@ void vhost_user_server_detach_aio_context(VuServer *server)
         VuFdWatch *vu_fd_watch;
 
         QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
-            aio_set_fd_handler(server->ctx, vu_fd_watch->fd,
-                               NULL, NULL, NULL, NULL, vu_fd_watch);
+            vu_fd_watch_detach(server, vu_fd_watch);
         }
     }
 
@@ -462,6 +595,8 @@ void vhost_user_server_detach_aio_context(VuServer *server)
 bool vhost_user_server_start(VuServer *server,
                              SocketAddress *socket_addr,
                              AioContext *ctx,
+                             AioContext **vq_ctxs,
+                             int nr_vq_ctxs,
                              uint16_t max_queues,
                              const VuDevIface *vu_iface,
                              Error **errp)
@@ -491,6 +626,8 @@ bool vhost_user_server_start(VuServer *server,
         .vu_iface              = vu_iface,
         .max_queues            = max_queues,
         .ctx                   = ctx,
+        .vq_ctxs               = vq_ctxs,
+        .nr_vq_ctxs            = nr_vq_ctxs,
     };
 
     qio_net_listener_set_name(server->listener, "vhost-user-backend-listener");